@@ -97,7 +97,13 @@ task.h is included from an application file. */
 static void prvHeapInit( void );
 
 /* Allocate the memory for the heap. */
-static uint8_t ucHeap[ configTOTAL_HEAP_SIZE ];
+#if( configAPPLICATION_ALLOCATED_HEAP == 1 )
+	/* The application writer has already defined the array used for the RTOS
+	heap - probably so it can be placed in a special segment or address. */
+	extern uint8_t ucHeap[ configTOTAL_HEAP_SIZE ];
+#else
+	static uint8_t ucHeap[ configTOTAL_HEAP_SIZE ];
+#endif /* configAPPLICATION_ALLOCATED_HEAP */
 
 /* Define the linked list structure.  This is used to link free blocks in order
 of their size. */
@@ -118,6 +124,9 @@ static BlockLink_t xStart, xEnd;
 fragmentation. */
 static size_t xFreeBytesRemaining = configADJUSTED_HEAP_SIZE;
 
+/* Lowest value xFreeBytesRemaining ever had, as in heap_4. */
+static size_t xMinimumEverFreeBytesRemaining = configADJUSTED_HEAP_SIZE;
+
 /* STATIC FUNCTIONS ARE DEFINED AS MACROS TO MINIMIZE THE FUNCTION CALL DEPTH. */
 
 /*
@@ -217,6 +226,11 @@ void *pvReturn = NULL;
 				}
 
 				xFreeBytesRemaining -= pxBlock->xBlockSize;
+
+				if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+				{
+					xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+				}
 			}
 		}
 
@@ -271,6 +285,42 @@ size_t xPortGetFreeHeapSize( void )
 }
 /*-----------------------------------------------------------*/
 
+size_t xPortGetMinimumEverFreeHeapSize( void )
+{
+	return xMinimumEverFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetFreeBlockCount( size_t *pxLargestFreeBlock )
+{
+BlockLink_t *pxBlock;
+size_t xBlocks = 0, xLargest = 0;
+
+	vTaskSuspendAll();
+	{
+		/* The list is ordered by size, so the last block before the end
+		marker is the largest one.  Nothing is listed before the first
+		allocation initialises the heap. */
+		if( xStart.pxNextFreeBlock != NULL )
+		{
+			for( pxBlock = xStart.pxNextFreeBlock; pxBlock != &xEnd; pxBlock = pxBlock->pxNextFreeBlock )
+			{
+				xBlocks++;
+				xLargest = pxBlock->xBlockSize;
+			}
+		}
+	}
+	( void ) xTaskResumeAll();
+
+	if( pxLargestFreeBlock != NULL )
+	{
+		*pxLargestFreeBlock = xLargest;
+	}
+
+	return xBlocks;
+}
+/*-----------------------------------------------------------*/
+
 void vPortInitialiseBlocks( void )
 {
 	/* This just exists to keep the linker quiet. */
@@ -209,7 +209,8 @@ typedef tskTCB TCB_t;
 /*lint -e956 A manual analysis and inspection has been used to determine which
 static variables must be declared volatile. */
 
-PRIVILEGED_DATA TCB_t * volatile pxCurrentTCB = NULL;
+/* Also referenced from the port's assembly, which LTO doesn't see, hence used. */
+PRIVILEGED_DATA TCB_t * volatile pxCurrentTCB __attribute__ (( used )) = NULL;
 
 /* Lists for ready and blocked tasks. --------------------*/
 PRIVILEGED_DATA static List_t pxReadyTasksLists[ configMAX_PRIORITIES ];/*< Prioritised ready tasks. */
@@ -2199,7 +2200,8 @@ BaseType_t xSwitchRequired = pdFALSE;
 #endif /* configUSE_APPLICATION_TASK_TAG */
 /*-----------------------------------------------------------*/
 
-void vTaskSwitchContext( void )
+/* Called from xPortPendSVHandler's assembly, which LTO doesn't see, hence used. */
+__attribute__ (( used )) __RAMFUNC_HOT void vTaskSwitchContext( void )
 {
 	if( uxSchedulerSuspended != ( UBaseType_t ) pdFALSE )
 	{
@@ -0,0 +1,423 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file bench.c
+ *
+ * @brief On-target micro-benchmarks (make bench)
+ *
+ * Replaces AFC_IPM.c in the benchmark image: instead of starting the MMC tasks, one task times the
+ * hot paths with the core cycle counter and prints the results on the debug UART (115200 8N1) as CSV:
+ * @code
+ * bench,name,iterations,min_cycles,avg_cycles,max_cycles
+ * bench,ipmb_encode,1000,412,415,530
+ * skip,i2c_loopback,no ack
+ * done,clock_hz,100000000
+ * @endcode
+ * The cost of reading the counter is measured first and taken out of every result. The heap benchmark times the
+ * heap the image is built with (HEAP=2 or 4).
+ * The I2C loopback benchmark needs #BENCH_I2C_MASTER wired to the IPMB interface (SDA to SDA, SCL to SCL,
+ * with pull-ups). Build with PROFILE=1 to also get the I2C interrupt time on its own.
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "board_defs.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmb_frame.h"
+#include "ipmi.h"
+#include "prof.h"
+
+/*! @brief Iterations of each benchmark */
+#define BENCH_ITERATIONS        1000
+/*! @brief Iterations of the I2C loopback, each one is a bus transfer */
+#define BENCH_I2C_ITERATIONS    100
+/*! @brief Interface writing to the IPMB interface in the loopback benchmark */
+#define BENCH_I2C_MASTER        I2C2
+#define BENCH_UART              LPC_UART0
+#define BENCH_UART_BAUD         115200
+#define BENCH_TASK_PRIORITY     ( tskIDLE_PRIORITY + 1 )
+#define BENCH_STACK_DEPTH       ( configMINIMAL_STACK_SIZE * 3 )
+/*! @brief Blocks kept allocated by the heap benchmark, one of them replaced per iteration */
+#define BENCH_HEAP_SLOTS        16
+/*! @brief Largest block asked for by the heap benchmark */
+#define BENCH_HEAP_MAX_BLOCK    200
+
+/*! @brief Results of a benchmark */
+typedef struct bench_result {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} bench_result;
+
+static uint32_t bench_overhead;
+static QueueHandle_t bench_ping;
+static QueueHandle_t bench_pong;
+
+static void prvBenchPuts( const char * str )
+{
+    Chip_UART_SendBlocking( BENCH_UART, str, strlen( str ) );
+}
+
+static void prvBenchPutu( uint32_t value )
+{
+    char buf[11];
+    uint8_t i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + ( value % 10 );
+        value /= 10;
+    } while ( value );
+    prvBenchPuts( &buf[i] );
+}
+
+static void prvBenchUARTInit( void )
+{
+    Chip_IOCON_PinMux( LPC_IOCON, UART_DEBUG_PORT, UART_DEBUG_TX_PIN, IOCON_MODE_INACT, UART_DEBUG_PIN_FUNC );
+    Chip_IOCON_PinMux( LPC_IOCON, UART_DEBUG_PORT, UART_DEBUG_RX_PIN, IOCON_MODE_INACT, UART_DEBUG_PIN_FUNC );
+    Chip_UART_Init( BENCH_UART );
+    Chip_UART_SetBaud( BENCH_UART, BENCH_UART_BAUD );
+    Chip_UART_ConfigData( BENCH_UART, UART_LCR_WLEN8 | UART_LCR_SBS_1BIT );
+    Chip_UART_SetupFIFOS( BENCH_UART, UART_FCR_FIFO_EN | UART_FCR_TRG_LEV2 );
+    Chip_UART_TXEnable( BENCH_UART );
+}
+
+static void prvBenchStart( bench_result * result )
+{
+    memset( result, 0, sizeof(bench_result) );
+    result->min = UINT32_MAX;
+}
+
+static void prvBenchAdd( bench_result * result, uint32_t start, uint32_t end )
+{
+    uint32_t cycles = end - start;
+
+    cycles = ( cycles > bench_overhead ) ? cycles - bench_overhead : 0;
+    result->count++;
+    result->total += cycles;
+    if ( cycles < result->min ) {
+        result->min = cycles;
+    }
+    if ( cycles > result->max ) {
+        result->max = cycles;
+    }
+}
+
+static void prvBenchReport( const char * name, const bench_result * result )
+{
+    if ( result->count == 0 ) {
+        return;
+    }
+    prvBenchPuts( "bench," );
+    prvBenchPuts( name );
+    prvBenchPuts( "," );
+    prvBenchPutu( result->count );
+    prvBenchPuts( "," );
+    prvBenchPutu( result->min );
+    prvBenchPuts( "," );
+    prvBenchPutu( result->total / result->count );
+    prvBenchPuts( "," );
+    prvBenchPutu( result->max );
+    prvBenchPuts( "\r\n" );
+}
+
+static void prvBenchSkip( const char * name, const char * reason )
+{
+    prvBenchPuts( "skip," );
+    prvBenchPuts( name );
+    prvBenchPuts( "," );
+    prvBenchPuts( reason );
+    prvBenchPuts( "\r\n" );
+}
+
+/* Times a statement BENCH_ITERATIONS times and reports it */
+#define BENCH_RUN( name, stmt )                                 \
+    do {                                                        \
+        bench_result result;                                    \
+        uint32_t n;                                             \
+        uint32_t start;                                         \
+        prvBenchStart( &result );                               \
+        for ( n = 0; n < BENCH_ITERATIONS; n++ ) {              \
+            start = DWT->CYCCNT;                                \
+            stmt;                                               \
+            prvBenchAdd( &result, start, DWT->CYCCNT );         \
+        }                                                       \
+        prvBenchReport( name, &result );                        \
+    } while ( 0 )
+
+static void prvBenchEcho( void * pvParameters )
+{
+    uint32_t value;
+
+    (void) pvParameters;
+
+    for ( ;; ) {
+        xQueueReceive( bench_ping, &value, portMAX_DELAY );
+        xQueueSend( bench_pong, &value, portMAX_DELAY );
+    }
+}
+
+static void prvBenchYield( void * pvParameters )
+{
+    (void) pvParameters;
+
+    for ( ;; ) {
+        taskYIELD();
+    }
+}
+
+static void prvBenchFrames( void )
+{
+    static uint8_t frame[IPMI_MSG_MAX_LENGTH];
+    ipmi_msg msg;
+    ipmi_msg decoded;
+    uint8_t len;
+    uint8_t i;
+
+    memset( &msg, 0, sizeof(msg) );
+    msg.dest_addr = MCH_ADDRESS;
+    msg.netfn = NETFN_APP;
+    msg.src_addr = 0x72;
+    msg.seq = 1;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data_len = 16;
+    for ( i = 0; i < msg.data_len; i++ ) {
+        msg.data[i] = i;
+    }
+
+    /* The I2C driver strips the destination address, the decoder expects it in front */
+    frame[0] = msg.dest_addr;
+    len = ipmb_encode( &frame[1], &msg ) + 1;
+
+    BENCH_RUN( "ipmb_encode", ipmb_encode( &frame[1], &msg ) );
+    BENCH_RUN( "ipmb_decode", ipmb_decode( &decoded, frame, len ) );
+    BENCH_RUN( "ipmb_chksum", ipmb_calculate_chksum( frame, len ) );
+}
+
+static void prvBenchDispatch( void )
+{
+    ipmi_build_handler_index();
+
+    BENCH_RUN( "ipmi_lookup_hit", ipmi_retrieve_handler( 0, NETFN_APP, IPMI_GET_DEVICE_ID_CMD ) );
+    BENCH_RUN( "ipmi_lookup_miss", ipmi_retrieve_handler( 0, NETFN_APP, 0xFE ) );
+}
+
+static void prvBenchScheduler( void )
+{
+    TaskHandle_t task;
+    uint32_t value = 0;
+
+    /* Send, the echo task (one priority up) wakes and answers, back here: two switches */
+    bench_ping = xQueueCreate( 1, sizeof(uint32_t) );
+    bench_pong = xQueueCreate( 1, sizeof(uint32_t) );
+    xTaskCreate( prvBenchEcho, "Bench Echo", configMINIMAL_STACK_SIZE, NULL, BENCH_TASK_PRIORITY + 1, &task );
+    BENCH_RUN( "queue_round_trip", xQueueSend( bench_ping, &value, portMAX_DELAY ); xQueueReceive( bench_pong, &value, portMAX_DELAY ) );
+    vTaskDelete( task );
+
+    /* Yield to a task of the same priority which yields right back: two switches */
+    xTaskCreate( prvBenchYield, "Bench Yield", configMINIMAL_STACK_SIZE, NULL, BENCH_TASK_PRIORITY, &task );
+    BENCH_RUN( "context_switch_x2", taskYIELD() );
+    vTaskDelete( task );
+}
+
+/* Frees one of the blocks and allocates another size in its place, on the heap linked in (HEAP=2 or 4), whose
+ * free list grows as the sizes mix; host/heap_bench.c compares the heaps over a long run */
+static void prvBenchHeap( void )
+{
+    static void * block[BENCH_HEAP_SLOTS];
+    bench_result malloc_result;
+    bench_result free_result;
+    uint32_t seed = 1;
+    uint32_t start;
+    uint32_t n;
+    uint8_t i;
+
+    prvBenchStart( &malloc_result );
+    prvBenchStart( &free_result );
+    for ( n = 0; n < BENCH_ITERATIONS; n++ ) {
+        seed = seed * 1103515245 + 12345;
+        i = ( seed >> 16 ) % BENCH_HEAP_SLOTS;
+
+        if ( block[i] != NULL ) {
+            start = DWT->CYCCNT;
+            vPortFree( block[i] );
+            prvBenchAdd( &free_result, start, DWT->CYCCNT );
+        }
+        start = DWT->CYCCNT;
+        block[i] = pvPortMalloc( 8 + ( seed >> 8 ) % BENCH_HEAP_MAX_BLOCK );
+        prvBenchAdd( &malloc_result, start, DWT->CYCCNT );
+    }
+    for ( i = 0; i < BENCH_HEAP_SLOTS; i++ ) {
+        vPortFree( block[i] );
+        block[i] = NULL;
+    }
+    prvBenchReport( "heap_malloc", &malloc_result );
+    prvBenchReport( "heap_free", &free_result );
+}
+
+static void prvBenchI2C( void )
+{
+    static uint8_t tx[16];
+    bench_result result;
+    uint8_t * rx;
+    uint8_t addr;
+    uint32_t start;
+    uint32_t n;
+#if configAPP_PROFILE
+    prof_stats isr;
+#endif
+
+    vI2CInit( IPMB_I2C, I2C_Mode_IPMB );
+    vI2CInit( BENCH_I2C_MASTER, I2C_Mode_Local_Master );
+    addr = get_ipmb_addr() >> 1;
+
+    if ( xI2CWrite( BENCH_I2C_MASTER, addr, tx, sizeof(tx) ) != i2c_err_SUCCESS ) {
+        prvBenchSkip( "i2c_loopback", "no ack" );
+        return;
+    }
+    if ( xI2CSlaveReceive( IPMB_I2C, &rx, 10 ) ) {
+        vI2CSlaveReleaseFrame( IPMB_I2C );
+    }
+
+#if configAPP_PROFILE
+    prof_get( PROF_I2C_ISR, &isr, 1 );
+#endif
+
+    /* Master write until the slave side has the frame: both ISRs and the two task wake-ups */
+    prvBenchStart( &result );
+    for ( n = 0; n < BENCH_I2C_ITERATIONS; n++ ) {
+        tx[0] = n;
+        start = DWT->CYCCNT;
+        if ( ( xI2CWrite( BENCH_I2C_MASTER, addr, tx, sizeof(tx) ) != i2c_err_SUCCESS ) ||
+             ( xI2CSlaveReceive( IPMB_I2C, &rx, 10 ) == 0 ) ) {
+            continue;
+        }
+        prvBenchAdd( &result, start, DWT->CYCCNT );
+        vI2CSlaveReleaseFrame( IPMB_I2C );
+    }
+    prvBenchReport( "i2c_loopback_16b", &result );
+
+#if configAPP_PROFILE
+    if ( prof_get( PROF_I2C_ISR, &isr, 0 ) && isr.count ) {
+        result.count = isr.count;
+        result.min = isr.min;
+        result.max = isr.max;
+        result.total = isr.total;
+        prvBenchReport( "i2c_isr", &result );
+    }
+#endif
+}
+
+static void prvBenchTask( void * pvParameters )
+{
+    bench_result result;
+    uint32_t start;
+    uint32_t n;
+
+    (void) pvParameters;
+
+    prvBenchPuts( "bench,name,iterations,min_cycles,avg_cycles,max_cycles\r\n" );
+
+    /* Cost of the measurement itself */
+    bench_overhead = 0;
+    prvBenchStart( &result );
+    for ( n = 0; n < BENCH_ITERATIONS; n++ ) {
+        start = DWT->CYCCNT;
+        prvBenchAdd( &result, start, DWT->CYCCNT );
+    }
+    bench_overhead = result.min;
+
+    prvBenchFrames();
+    prvBenchDispatch();
+    prvBenchScheduler();
+    prvBenchHeap();
+    prvBenchI2C();
+
+    prvBenchPuts( "done,clock_hz," );
+    prvBenchPutu( configCPU_CLOCK_HZ );
+    prvBenchPuts( "\r\n" );
+
+    vTaskSuspend( NULL );
+}
+
+int main( void )
+{
+    SystemCoreClockUpdate();
+    prvBenchUARTInit();
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    PROF_INIT();
+
+    xTaskCreate( prvBenchTask, "Bench", BENCH_STACK_DEPTH, NULL, BENCH_TASK_PRIORITY, NULL );
+    vTaskStartScheduler();
+
+    for ( ;; );
+}
+
+/*-----------------------------------------------------------*/
+/* FreeRTOS hooks, the MMC ones live in AFC_IPM.c */
+
+void vApplicationStackOverflowHook ( TaskHandle_t pxTask, signed char * pcTaskName )
+{
+    (void) pxTask;
+    taskDISABLE_INTERRUPTS();
+    prvBenchPuts( "error,stack_overflow," );
+    prvBenchPuts( (const char *) pcTaskName );
+    prvBenchPuts( "\r\n" );
+    for ( ; ; ) {}
+}
+
+void vApplicationMallocFailedHook ( void )
+{
+    prvBenchPuts( "error,malloc_failed\r\n" );
+}
+
+void vConfigureTimerForRunTimeStats( void )
+{
+    /* Same setup as the MMC image: TIMER0 counting at 10 kHz */
+    Chip_TIMER_Init( LPC_TIMER0 );
+    Chip_TIMER_Reset( LPC_TIMER0 );
+    LPC_TIMER0->CTCR = 0x00;
+    LPC_TIMER0->PR = ( configCPU_CLOCK_HZ / 10000UL ) - 1UL;
+    LPC_TIMER0->TCR = 0x01;
+}
+
+void vAssertCalled( char* file, uint32_t line )
+{
+    taskDISABLE_INTERRUPTS();
+    prvBenchPuts( "error,assert," );
+    prvBenchPuts( file );
+    prvBenchPuts( "," );
+    prvBenchPutu( line );
+    prvBenchPuts( "\r\n" );
+    for ( ; ; );
+}
@@ -0,0 +1,97 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file boot.c
+ *
+ * @brief Boot loader: starts the newest valid MMC image slot (see image.h)
+ *
+ * Runs from sector 0 at the reset clock, with no data or bss of its own (only the boot note at the
+ * start of RamLoc16), so it's done in the time it takes to check two header CRCs.
+ */
+
+/* Project includes */
+#include "chip.h"
+#include "image.h"
+#include "boot_time.h"
+
+extern void _vStackTop( void );
+
+void boot_reset( void );
+static void prvBootFault( void );
+
+/* Word 7 is the checksum the boot ROM wants, set when the flash is programmed */
+__attribute__ ((used, section(".isr_vector")))
+void (* const boot_vectors[8])( void ) = {
+    &_vStackTop,
+    boot_reset,
+    prvBootFault,                           /* NMI */
+    prvBootFault,                           /* Hard fault */
+    prvBootFault,                           /* MPU fault */
+    prvBootFault,                           /* Bus fault */
+    prvBootFault,                           /* Usage fault */
+    0,
+};
+
+static void prvBootFault( void )
+{
+    for ( ;; ) {
+    }
+}
+
+/* Hands the core over to an image: its vector table, its stack, its reset handler */
+static void prvBootStart( uint32_t base )
+{
+    const uint32_t * vectors = (const uint32_t *) base;
+
+    SCB->VTOR = base;
+    __asm volatile ( "msr msp, %0\n"
+                     "bx %1\n" : : "r" ( vectors[0] ), "r" ( vectors[1] ) );
+}
+
+void boot_reset( void )
+{
+    volatile image_boot_state * state = IMAGE_BOOT_STATE;
+    unsigned int command[5];
+    unsigned int result[4];
+    uint8_t failed = IMAGE_SLOT_NONE;
+    uint8_t slot;
+
+    /* Boot timeline from here, the image keeps the timer running */
+    boot_time_timer_start();
+
+    /* Still on trial: the image started last time was reset before it got anywhere */
+    if ( state->magic == IMAGE_BOOT_TRIAL ) {
+        failed = state->slot;
+    }
+
+    slot = image_select( failed );
+    if ( slot == IMAGE_SLOT_NONE ) {
+        /* Nothing to start, wait for the UART ISP */
+        command[0] = IAP_REINVOKE_ISP_CMD;
+        iap_entry( command, result );
+        prvBootFault();
+    }
+
+    state->magic = IMAGE_BOOT_TRIAL;
+    state->slot = slot;
+    state->failed = ( failed != slot ) ? failed : IMAGE_SLOT_NONE;
+    prvBootStart( IMAGE_SLOT_BASE( slot ) );
+}
@@ -0,0 +1,411 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file bench_host.c
+ *
+ * @brief Host-native benchmark of the IPMB framing and IPMI handler lookup (make bench-host)
+ *
+ * Builds ipmb_frame.c, ipmi_dispatch.c and ipmi_cache.c with the host compiler against the stand-in kernel header of
+ * host/inc, so the frame code can be checked and timed in seconds, without a board. A corpus of requests
+ * and responses of every data length is encoded, decoded and compared, every single bit error and
+ * truncation of its frames must be rejected, and the handler index must agree with a linear scan of the
+ * records on every (netfn, cmd) pair, as must the response cache on hits and invalidations. Then each operation is timed over the corpus. The results are CSV:
+ * @code
+ * check,corpus,ok,0
+ * bench,ipmb_decode,4000000,11.2,89285714
+ * @endcode
+ * with bench lines giving ( iterations, ns per call, calls per second ). Each failed check goes out as
+ * "check,name,FAIL,detail,index" and the benchmarks are then skipped, with exit status 1. The timings are those of the host CPU, use make bench
+ * for the target figures.
+ */
+
+/* C Standard includes */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Project includes */
+#include "FreeRTOS.h"
+#include "ipmb.h"
+#include "ipmb_frame.h"
+#include "ipmi.h"
+#include "ipmi_cache.h"
+
+/*! @brief Messages in the corpus */
+#define BENCH_HOST_CORPUS       256
+/*! @brief Timed calls of each benchmark */
+#define BENCH_HOST_ITERATIONS   4000000UL
+#define BENCH_HOST_MMC_ADDR     0x72
+
+/* Same (netfn, cmd) pairs as the firmware handler records, X( name, netfn, cmd ) */
+#define BENCH_HOST_HANDLERS( X )                                                    \
+    X( get_device_id,           NETFN_APP,      IPMI_GET_DEVICE_ID_CMD )            \
+    X( get_properties,          NETFN_GRPEXT,   IPMI_PICMG_CMD_GET_PROPERTIES )     \
+    X( fru_control,             NETFN_GRPEXT,   IPMI_PICMG_CMD_FRU_CONTROL )        \
+    X( fru_control_caps,        NETFN_GRPEXT,   IPMI_PICMG_CMD_FRU_CONTROL_CAPABILITIES ) \
+    X( set_fru_activation,      NETFN_GRPEXT,   IPMI_PICMG_CMD_SET_FRU_ACTIVATION ) \
+    X( get_led_properties,      NETFN_GRPEXT,   IPMI_PICMG_CMD_GET_FRU_LED_PROPERTIES ) \
+    X( get_led_color,           NETFN_GRPEXT,   IPMI_PICMG_CMD_GET_LED_COLOR_CAPABILITIES ) \
+    X( set_led,                 NETFN_GRPEXT,   IPMI_PICMG_CMD_SET_FRU_LED_STATE )  \
+    X( get_led,                 NETFN_GRPEXT,   IPMI_PICMG_CMD_GET_FRU_LED_STATE )  \
+    X( set_amc_port_state,      NETFN_GRPEXT,   IPMI_PICMG_CMD_SET_AMC_PORT_STATE ) \
+    X( get_amc_port_state,      NETFN_GRPEXT,   IPMI_PICMG_CMD_GET_AMC_PORT_STATE ) \
+    X( hpm_get_capabilities,    NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_GET_UPGRADE_CAPABILITIES ) \
+    X( hpm_get_component_properties, NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_GET_COMPONENT_PROPERTIES ) \
+    X( hpm_abort,               NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_ABORT_FIRMWARE_UPGRADE ) \
+    X( hpm_initiate,            NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_INITIATE_UPGRADE_ACTION ) \
+    X( hpm_upload,              NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_UPLOAD_FIRMWARE_BLOCK ) \
+    X( hpm_finish,              NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_FINISH_FIRMWARE_UPLOAD ) \
+    X( hpm_get_status,          NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_GET_UPGRADE_STATUS ) \
+    X( hpm_activate,            NETFN_GRPEXT,   IPMI_PICMG_CMD_HPM_ACTIVATE_FIRMWARE ) \
+    X( set_receiver,            NETFN_SE,       IPMI_SET_EVENT_RECEIVER_CMD )       \
+    X( get_receiver,            NETFN_SE,       IPMI_GET_EVENT_RECEIVER_CMD )       \
+    X( get_sensor_reading,      NETFN_SE,       IPMI_GET_SENSOR_READING_CMD )       \
+    X( set_hysteresis,          NETFN_SE,       IPMI_SET_SENSOR_HYSTERESIS_CMD )    \
+    X( get_hysteresis,          NETFN_SE,       IPMI_GET_SENSOR_HYSTERESIS_CMD )    \
+    X( set_threshold,           NETFN_SE,       IPMI_SET_SENSOR_THRESHOLD_CMD )     \
+    X( get_threshold,           NETFN_SE,       IPMI_GET_SENSOR_THRESHOLD_CMD )     \
+    X( get_sdr_info,            NETFN_SE,       IPMI_GET_DEVICE_SDR_INFO_CMD )      \
+    X( get_sdr,                 NETFN_SE,       IPMI_GET_DEVICE_SDR_CMD )           \
+    X( reserve_sdr,             NETFN_SE,       IPMI_RESERVE_DEVICE_SDR_REPOSITORY_CMD ) \
+    X( get_fru_info,            NETFN_STORAGE,  IPMI_GET_FRU_INVENTORY_AREA_INFO_CMD ) \
+    X( read_fru,                NETFN_STORAGE,  IPMI_READ_FRU_DATA_CMD )            \
+    X( write_fru,               NETFN_STORAGE,  IPMI_WRITE_FRU_DATA_CMD )           \
+    X( get_ipmb_stats,          NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_IPMB_STATISTICS ) \
+    X( clear_ipmb_stats,        NETFN_CUSTOM,   IPMI_CUSTOM_CMD_CLEAR_IPMB_STATISTICS ) \
+    X( get_ipmb_latency,        NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_IPMB_LATENCY )  \
+    X( get_sensor_readings,     NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_SENSOR_READINGS ) \
+    X( get_sensor_stats,        NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_SENSOR_STATISTICS ) \
+    X( clear_sensor_stats,      NETFN_CUSTOM,   IPMI_CUSTOM_CMD_CLEAR_SENSOR_STATISTICS ) \
+    X( i2c_trace,               NETFN_CUSTOM,   IPMI_CUSTOM_CMD_I2C_TRACE )         \
+    X( i2c_snoop,               NETFN_CUSTOM,   IPMI_CUSTOM_CMD_I2C_SNOOP )         \
+    X( get_memory_stats,        NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_MEMORY_STATISTICS ) \
+    X( get_stack_usage,         NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_STACK_USAGE )   \
+    X( get_cpu_load,            NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_CPU_LOAD )      \
+    X( kernel_trace,            NETFN_CUSTOM,   IPMI_CUSTOM_CMD_KERNEL_TRACE )      \
+    X( get_profile,             NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_PROFILE )      \
+    X( echo,                    NETFN_CUSTOM,   IPMI_CUSTOM_CMD_ECHO )              \
+    X( get_init_status,         NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_INIT_STATUS )   \
+    X( get_boot_timeline,       NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_BOOT_TIMELINE ) \
+    X( get_crash_record,        NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_CRASH_RECORD )  \
+    X( clear_crash_record,      NETFN_CUSTOM,   IPMI_CUSTOM_CMD_CLEAR_CRASH_RECORD ) \
+    X( sensor_stream,           NETFN_CUSTOM,   IPMI_CUSTOM_CMD_SENSOR_STREAM )     \
+    X( fpga_load,               NETFN_CUSTOM,   IPMI_CUSTOM_CMD_FPGA_LOAD )         \
+    X( get_queue_stats,         NETFN_CUSTOM,   IPMI_CUSTOM_CMD_GET_QUEUE_STATISTICS ) \
+    X( set_sensor_deadband,     NETFN_CUSTOM,   IPMI_CUSTOM_CMD_SET_SENSOR_DEADBAND ) \
+    X( telemetry_subscribe,     NETFN_CUSTOM,   IPMI_CUSTOM_CMD_TELEMETRY_SUBSCRIBE )
+
+#define BENCH_HOST_HANDLER( name, netfn, cmd )                                      \
+    static void bench_host_##name ( ipmi_msg * req, ipmi_msg * rsp )                \
+    {                                                                               \
+        (void) req;                                                                 \
+        rsp->completion_code = IPMI_CC_OK;                                          \
+    }                                                                               \
+    IPMI_HANDLER( netfn, cmd, bench_host_##name );
+
+BENCH_HOST_HANDLERS( BENCH_HOST_HANDLER )
+
+extern const t_req_handler_record __ipmi_handlers_start[];
+extern const t_req_handler_record __ipmi_handlers_end[];
+
+/* Get Device ID request from the MCH, as it goes on the bus */
+static const uint8_t known_get_device_id[] = { 0x72, 0x18, 0x76, 0x20, 0x04, 0x01, 0xDB };
+
+typedef struct bench_host_frame {
+    uint8_t buf[IPMI_MSG_MAX_LENGTH];
+    uint8_t len;
+} bench_host_frame;
+
+static ipmi_msg corpus[BENCH_HOST_CORPUS];
+static bench_host_frame corpus_frame[BENCH_HOST_CORPUS];
+static int failures;
+static volatile uint32_t bench_host_sink;
+
+static uint32_t prvBenchHostRand( void )
+{
+    static uint32_t seed = 0x1BADB002;
+
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static double prvBenchHostNow( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void prvBenchHostCheck( const char * name, int ok, const char * detail, int index )
+{
+    if ( ok ) {
+        return;
+    }
+    if ( failures++ < 20 ) {
+        printf( "check,%s,FAIL,%s,%d\n", name, detail, index );
+    }
+}
+
+/* Requests and responses of every netfn, LUN and data length the frame can carry */
+static void prvBenchHostBuildCorpus( void )
+{
+    ipmi_msg * msg;
+    uint8_t max;
+    int i;
+    uint8_t j;
+
+    for ( i = 0; i < BENCH_HOST_CORPUS; i++ ) {
+        msg = &corpus[i];
+        memset( msg, 0, sizeof(ipmi_msg) );
+        msg->dest_addr = ( i & 1 ) ? MCH_ADDRESS : BENCH_HOST_MMC_ADDR;
+        msg->src_addr = ( i & 1 ) ? BENCH_HOST_MMC_ADDR : MCH_ADDRESS;
+        msg->netfn = ( ( ( i >> 1 ) % 0x20 ) << 1 ) | ( i & 1 );
+        msg->dest_LUN = prvBenchHostRand() & 0x03;
+        msg->src_LUN = prvBenchHostRand() & 0x03;
+        msg->seq = prvBenchHostRand() & 0x3F;
+        msg->cmd = prvBenchHostRand() & 0xFF;
+        /* Responses give one data byte to the completion code */
+        max = IS_RESPONSE( (*msg) ) ? IPMB_MAX_DATA_LEN - 1 : IPMB_MAX_DATA_LEN;
+        msg->data_len = ( i / 2 ) % ( max + 1 );
+        if ( IS_RESPONSE( (*msg) ) ) {
+            msg->completion_code = ( i & 2 ) ? IPMI_CC_OK : prvBenchHostRand() & 0xFF;
+        }
+        for ( j = 0; j < msg->data_len; j++ ) {
+            msg->data[j] = prvBenchHostRand() & 0xFF;
+        }
+
+        /* The destination address goes first on the bus, ipmb_encode leaves it out */
+        corpus_frame[i].buf[0] = msg->dest_addr;
+        corpus_frame[i].len = ipmb_encode( &corpus_frame[i].buf[1], msg ) + 1;
+    }
+}
+
+static int prvBenchHostSameMsg( const ipmi_msg * a, const ipmi_msg * b )
+{
+    return ( a->dest_addr == b->dest_addr ) && ( a->netfn == b->netfn ) && ( a->dest_LUN == b->dest_LUN ) &&
+        ( a->src_addr == b->src_addr ) && ( a->seq == b->seq ) && ( a->src_LUN == b->src_LUN ) &&
+        ( a->cmd == b->cmd ) && ( !IS_RESPONSE( (*a) ) || ( a->completion_code == b->completion_code ) ) &&
+        ( a->data_len == b->data_len ) && ( memcmp( a->data, b->data, a->data_len ) == 0 );
+}
+
+static void prvBenchHostCheckFrames( void )
+{
+    bench_host_frame bad;
+    ipmi_msg decoded;
+    int i;
+    uint8_t pos;
+    uint8_t bit;
+    uint8_t sum;
+
+    memset( &decoded, 0, sizeof(decoded) );
+    prvBenchHostCheck( "known_frame", ( ipmb_decode( &decoded, (uint8_t *) known_get_device_id,
+            sizeof(known_get_device_id) ) == ipmb_error_success ) && ( decoded.netfn == NETFN_APP ) &&
+            ( decoded.cmd == IPMI_GET_DEVICE_ID_CMD ) && ( decoded.seq == 1 ) && ( decoded.data_len == 0 ),
+            "decode", 0 );
+    memcpy( bad.buf, known_get_device_id, sizeof(known_get_device_id) );
+    bad.len = ipmb_encode( &bad.buf[1], &decoded ) + 1;
+    prvBenchHostCheck( "known_frame", ( bad.len == sizeof(known_get_device_id) ) &&
+            ( memcmp( bad.buf, known_get_device_id, bad.len ) == 0 ), "encode", 0 );
+
+    for ( i = 0; i < BENCH_HOST_CORPUS; i++ ) {
+        memset( &decoded, 0, sizeof(decoded) );
+        prvBenchHostCheck( "frame_roundtrip", ( ipmb_decode( &decoded, corpus_frame[i].buf, corpus_frame[i].len )
+                == ipmb_error_success ) && prvBenchHostSameMsg( &corpus[i], &decoded ), "mismatch", i );
+
+        /* One bit flipped anywhere changes a checksummed sum, so it can't go through */
+        for ( pos = 0; pos < corpus_frame[i].len; pos++ ) {
+            for ( bit = 0; bit < 8; bit++ ) {
+                bad = corpus_frame[i];
+                bad.buf[pos] ^= 1 << bit;
+                prvBenchHostCheck( "frame_bit_error", ipmb_decode( &decoded, bad.buf, bad.len )
+                        != ipmb_error_success, "accepted", i );
+            }
+        }
+
+        /* A truncated frame can't be told from a whole one when its bytes happen to sum to zero */
+        sum = corpus_frame[i].buf[0];
+        for ( pos = 1; pos < corpus_frame[i].len; sum += corpus_frame[i].buf[pos++] ) {
+            if ( sum == 0 ) {
+                continue;
+            }
+            prvBenchHostCheck( "frame_truncated", ipmb_decode( &decoded, corpus_frame[i].buf, pos )
+                    != ipmb_error_success, "accepted", i );
+        }
+    }
+    prvBenchHostCheck( "frame_oversized", ipmb_decode( &decoded, corpus_frame[0].buf, IPMI_MSG_MAX_LENGTH + 1 )
+            == ipmb_error_msg_length, "accepted", 0 );
+}
+
+static void prvBenchHostCheckLookup( void )
+{
+    const t_req_handler_record * record;
+    const t_req_handler_record * expected;
+    uint8_t lun;
+    uint8_t netfn;
+    int cmd;
+
+    ipmi_build_handler_index();
+
+    for ( lun = 0; lun < IPMI_LUNS; lun++ ) {
+        for ( netfn = 0; netfn < 0x40; netfn++ ) {
+            for ( cmd = 0; cmd < 0x100; cmd++ ) {
+                expected = NULL;
+                for ( record = __ipmi_handlers_start; record < __ipmi_handlers_end; record++ ) {
+                    if ( ( record->lun == lun ) && ( record->netfn == netfn ) && ( record->cmd == cmd ) ) {
+                        expected = record;
+                    }
+                }
+                prvBenchHostCheck( "handler_lookup", ipmi_retrieve_handler( lun, netfn, cmd ) == expected,
+                        "mismatch", ( lun << 16 ) | ( netfn << 8 ) | cmd );
+            }
+        }
+    }
+}
+
+static void prvBenchHostCheckRegister( void )
+{
+    const t_req_handler_record * section = &__ipmi_handlers_start[0];
+    const t_req_handler_record * record;
+
+    prvBenchHostCheck( "handler_register", ipmi_register_handler( 0, NETFN_CUSTOM, 0xF0, section->req_handler,
+            section->flags ), "refused", 0 );
+    record = ipmi_retrieve_handler( 0, NETFN_CUSTOM, 0xF0 );
+    prvBenchHostCheck( "handler_register", record && ( record->req_handler == section->req_handler )
+            && ( record->flags == section->flags ), "lookup", 0 );
+    prvBenchHostCheck( "handler_register", !ipmi_register_handler( 0, NETFN_CUSTOM, 0xF0, section->req_handler, 0 ),
+            "duplicate", 0 );
+    prvBenchHostCheck( "handler_register", !ipmi_register_handler( section->lun, section->netfn, section->cmd,
+            section->req_handler, 0 ), "duplicate", 1 );
+    prvBenchHostCheck( "handler_register", !ipmi_register_handler( IPMI_LUNS, NETFN_CUSTOM, 0xF1,
+            section->req_handler, 0 ), "lun", 0 );
+    prvBenchHostCheck( "handler_unregister", !ipmi_unregister_handler( section->lun, section->netfn, section->cmd ),
+            "section", 0 );
+    prvBenchHostCheck( "handler_unregister", ipmi_unregister_handler( 0, NETFN_CUSTOM, 0xF0 ), "refused", 0 );
+    prvBenchHostCheck( "handler_unregister", ipmi_retrieve_handler( 0, NETFN_CUSTOM, 0xF0 ) == NULL, "lookup", 0 );
+    prvBenchHostCheck( "handler_unregister", !ipmi_unregister_handler( 0, NETFN_CUSTOM, 0xF0 ), "twice", 0 );
+
+    /* Same command on another LUN, the LUN 0 one is still found */
+    prvBenchHostCheck( "handler_register", ipmi_register_handler( 1, section->netfn, section->cmd,
+            section->req_handler, 0 ), "refused", 1 );
+    record = ipmi_retrieve_handler( 1, section->netfn, section->cmd );
+    prvBenchHostCheck( "handler_register", record && ( record != section ) && ( record->lun == 1 ), "lun lookup", 0 );
+    prvBenchHostCheck( "handler_unregister", ipmi_unregister_handler( 1, section->netfn, section->cmd ),
+            "refused", 1 );
+
+    /* The probe sequences go past the deleted slots */
+    for ( record = __ipmi_handlers_start; record < __ipmi_handlers_end; record++ ) {
+        prvBenchHostCheck( "handler_unregister", ipmi_retrieve_handler( record->lun, record->netfn, record->cmd )
+                == record, "section lookup", record - __ipmi_handlers_start );
+    }
+}
+
+static void prvBenchHostCheckCache( void )
+{
+    ipmi_msg req = corpus[0];
+    ipmi_msg resp;
+    ipmi_msg hit;
+    uint32_t tag;
+
+    req.data_len = 4;
+    memset( &resp, 0, sizeof(resp) );
+    resp.completion_code = IPMI_CC_OK;
+    resp.data_len = 3;
+    memcpy( resp.data, "\x11\x22\x33", 3 );
+
+    prvBenchHostCheck( "cache", !ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ), "empty hit", 0 );
+    ipmi_cache_store( &req, IPMI_CACHE_FRU, tag, &resp );
+    memset( &hit, 0, sizeof(hit) );
+    prvBenchHostCheck( "cache", ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ) &&
+            ( hit.completion_code == IPMI_CC_OK ) && ( hit.data_len == 3 ) && ( memcmp( hit.data, resp.data, 3 ) == 0 ),
+            "miss", 0 );
+    prvBenchHostCheck( "cache", !ipmi_cache_lookup( &req, IPMI_CACHE_SDR, &hit, &tag ), "epoch", 0 );
+    req.data[3] ^= 1;
+    prvBenchHostCheck( "cache", !ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ), "data", 0 );
+    req.data[3] ^= 1;
+
+    ipmi_cache_invalidate( IPMI_CACHE_SDR );
+    prvBenchHostCheck( "cache", ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ), "other epoch", 0 );
+    ipmi_cache_invalidate( IPMI_CACHE_FRU );
+    prvBenchHostCheck( "cache", !ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ), "invalidated", 0 );
+
+    /* Built while the subsystem changed: kept, never served */
+    ipmi_cache_invalidate( IPMI_CACHE_FRU );
+    ipmi_cache_store( &req, IPMI_CACHE_FRU, tag, &resp );
+    prvBenchHostCheck( "cache", !ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ), "stale tag", 0 );
+
+    resp.completion_code = IPMI_CC_UNSPECIFIED_ERROR;
+    ipmi_cache_store( &req, IPMI_CACHE_FRU, tag, &resp );
+    prvBenchHostCheck( "cache", !ipmi_cache_lookup( &req, IPMI_CACHE_FRU, &hit, &tag ), "error kept", 0 );
+}
+
+static void prvBenchHostReport( const char * name, unsigned long iterations, double elapsed )
+{
+    printf( "bench,%s,%lu,%.1f,%.0f\n", name, iterations, elapsed * 1e9 / iterations, iterations / elapsed );
+}
+
+/* Times a statement BENCH_HOST_ITERATIONS times, walking the corpus with i */
+#define BENCH_HOST_RUN( name, stmt )                                \
+    do {                                                            \
+        unsigned long n;                                            \
+        double start = prvBenchHostNow();                           \
+        for ( n = 0; n < BENCH_HOST_ITERATIONS; n++ ) {             \
+            int i = n % BENCH_HOST_CORPUS;                          \
+            stmt;                                                   \
+        }                                                           \
+        prvBenchHostReport( name, BENCH_HOST_ITERATIONS, prvBenchHostNow() - start ); \
+    } while ( 0 )
+
+static void prvBenchHostTime( void )
+{
+    static uint8_t frame[IPMI_MSG_MAX_LENGTH];
+    ipmi_msg decoded;
+    uint8_t count = __ipmi_handlers_end - __ipmi_handlers_start;
+
+    BENCH_HOST_RUN( "ipmb_encode", bench_host_sink += ipmb_encode( frame, &corpus[i] ) );
+    BENCH_HOST_RUN( "ipmb_decode",
+        bench_host_sink += ipmb_decode( &decoded, corpus_frame[i].buf, corpus_frame[i].len ) );
+    BENCH_HOST_RUN( "ipmb_chksum",
+        bench_host_sink += ipmb_calculate_chksum( corpus_frame[i].buf, corpus_frame[i].len ) );
+    BENCH_HOST_RUN( "ipmi_lookup_hit",
+        bench_host_sink += ( ipmi_retrieve_handler( __ipmi_handlers_start[i % count].lun,
+                                                    __ipmi_handlers_start[i % count].netfn,
+                                                    __ipmi_handlers_start[i % count].cmd ) != NULL ) );
+    BENCH_HOST_RUN( "ipmi_lookup_miss",
+        bench_host_sink += ( ipmi_retrieve_handler( 0, NETFN_SE, 0x80 + ( i & 0x7F ) ) != NULL ) );
+}
+
+int main( void )
+{
+    prvBenchHostBuildCorpus();
+
+    prvBenchHostCheckFrames();
+    prvBenchHostCheckLookup();
+    prvBenchHostCheckRegister();
+    prvBenchHostCheckCache();
+    printf( "check,corpus,%s,%d\n", failures ? "FAIL" : "ok", failures );
+    if ( failures ) {
+        return 1;
+    }
+
+    prvBenchHostTime();
+    return 0;
+}
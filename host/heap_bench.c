@@ -0,0 +1,260 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file heap_bench.c
+ *
+ * @brief Host-native fragmentation benchmark of the FreeRTOS heaps (make heap-bench-host)
+ *
+ * Built once with each heap (FreeRTOS/heap_2.c and heap_4.c, see the HEAP option of the Makefile) against the
+ * stand-in kernel headers of host/inc. The heap first gets the objects the firmware keeps for good (task
+ * stacks and TCBs, queues, timers, mutexes), then #HEAP_BENCH_OPERATIONS steps of churn, about a day of
+ * uptime at one allocation or free every 10 ms: short lived semaphores, client queues, buffers of any size
+ * and tasks created and deleted (TCB, then stack). Every step picks one of #HEAP_BENCH_SLOTS slots at random,
+ * frees what it holds or fills it. The results are CSV:
+ * @code
+ * sample,heap_4,1000000,3496,3280,3,6.2
+ * result,heap_4,10000000,5000231,0,0,1840,9,35.1,2210,27.4,1980
+ * @endcode
+ * with sample lines every #HEAP_BENCH_SAMPLE steps giving ( steps, free bytes, largest free block, free blocks,
+ * fragmentation % ) and the result line ( steps, allocations, failed, failed with enough bytes free, fewest
+ * bytes ever free, most free blocks, average and worst ns per allocation, average and worst ns per free ).
+ * Fragmentation is the part of the free bytes outside the largest free block. The failures with enough bytes
+ * free are those fragmentation alone caused. The free list walk of both heaps is linear in the free blocks,
+ * the most of them seen bounds the worst allocation; the worst times are those of the host CPU, scheduler
+ * noise included, use make bench for the target figures. The block header is 16 bytes on a 64 bit host
+ * instead of 8, the absolute figures are a bit pessimistic, the comparison still holds.
+ */
+
+/* C Standard includes */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Project includes */
+#include "FreeRTOS.h"
+
+#ifndef HEAP_BENCH_HEAP
+#error "Build with -DHEAP_BENCH_HEAP=n for FreeRTOS/heap_n.c"
+#endif
+
+/*! @brief Steps of churn after the startup objects */
+#define HEAP_BENCH_OPERATIONS   10000000UL
+/*! @brief Steps between two sample lines */
+#define HEAP_BENCH_SAMPLE       1000000UL
+/*! @brief Blocks held by the churn at most, half of them on average */
+#define HEAP_BENCH_SLOTS        16
+
+/* Target sizes, in bytes */
+#define HEAP_BENCH_TCB          96
+#define HEAP_BENCH_QUEUE( len, size )   ( 76 + ( len ) * ( size ) )
+#define HEAP_BENCH_SEMAPHORE    HEAP_BENCH_QUEUE( 0, 0 )
+#define HEAP_BENCH_TIMER        40
+/* Block header of both heaps on this host (next free block, size) */
+#define HEAP_BENCH_HEADER       ( sizeof(void *) + sizeof(size_t) )
+
+/* Samples of the firmware's startup objects, in their order of creation */
+static const uint16_t heap_bench_startup[] = {
+    HEAP_BENCH_QUEUE( 8, 4 ),               /* Timer daemon queue */
+    HEAP_BENCH_TCB, 400 * 4,                /* Timer daemon */
+    HEAP_BENCH_TCB, 100 * 4,                /* Idle */
+    HEAP_BENCH_SEMAPHORE, HEAP_BENCH_SEMAPHORE, HEAP_BENCH_SEMAPHORE,   /* I2C bus mutexes */
+    HEAP_BENCH_QUEUE( 8, 24 ), HEAP_BENCH_QUEUE( 4, 4 ), HEAP_BENCH_SEMAPHORE,  /* IPMB TX queues */
+    HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, /* IPMB retries */
+    HEAP_BENCH_TCB, 200 * 4, HEAP_BENCH_TCB, 200 * 4,   /* IPMB TX and RX */
+    HEAP_BENCH_QUEUE( 4, 16 ), HEAP_BENCH_QUEUE( 8, 12 ), HEAP_BENCH_QUEUE( 12, 0 ),  /* IPMI queues */
+    HEAP_BENCH_TCB, 300 * 4,                /* IPMI dispatcher */
+    HEAP_BENCH_TCB, 200 * 4,                /* Sensors */
+    HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, HEAP_BENCH_TIMER, HEAP_BENCH_TIMER,
+    HEAP_BENCH_QUEUE( 4, 8 ),               /* HPM */
+};
+
+/*! @brief Kinds of churn blocks */
+enum heap_bench_kind {
+    HEAP_BENCH_KIND_SEMAPHORE,              /* Completion of a synchronous IPMB request */
+    HEAP_BENCH_KIND_CLIENT_QUEUE,           /* IPMB client registration */
+    HEAP_BENCH_KIND_BUFFER,                 /* Any size from 8 to 199 bytes */
+    HEAP_BENCH_KIND_TASK,                   /* TCB and a stack of 100 to 200 words */
+};
+
+typedef struct heap_bench_slot {
+    void * block[2];                        /* Task: TCB and stack, the others only use the first */
+} heap_bench_slot;
+
+/* The heap storage (configAPPLICATION_ALLOCATED_HEAP) */
+uint8_t ucHeap[ configTOTAL_HEAP_SIZE ] __attribute__ ((aligned(8)));
+
+static heap_bench_slot heap_bench_slots[HEAP_BENCH_SLOTS];
+
+typedef struct heap_bench_stats {
+    unsigned long allocs;
+    unsigned long failed;
+    unsigned long failed_fragmented;
+    size_t max_free_blocks;
+    double malloc_total;
+    double malloc_worst;
+    unsigned long frees;
+    double free_total;
+    double free_worst;
+} heap_bench_stats;
+
+static heap_bench_stats stats;
+
+static uint32_t prvHeapBenchRand( void )
+{
+    static uint32_t seed = 0x1BADB002;
+
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static double prvHeapBenchNow( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void * prvHeapBenchMalloc( size_t size )
+{
+    size_t free_bytes = xPortGetFreeHeapSize();
+    double start = prvHeapBenchNow();
+    void * block = pvPortMalloc( size );
+    double elapsed = prvHeapBenchNow() - start;
+
+    stats.allocs++;
+    stats.malloc_total += elapsed;
+    if ( elapsed > stats.malloc_worst ) {
+        stats.malloc_worst = elapsed;
+    }
+    if ( block == NULL ) {
+        stats.failed++;
+        /* With its header, rounded up to the alignment */
+        if ( ( ( size + HEAP_BENCH_HEADER + portBYTE_ALIGNMENT_MASK ) & ~portBYTE_ALIGNMENT_MASK ) <= free_bytes ) {
+            stats.failed_fragmented++;
+        }
+    }
+    return block;
+}
+
+static void prvHeapBenchFree( void * block )
+{
+    double start;
+    double elapsed;
+
+    if ( block == NULL ) {
+        return;
+    }
+    start = prvHeapBenchNow();
+    vPortFree( block );
+    elapsed = prvHeapBenchNow() - start;
+
+    stats.frees++;
+    stats.free_total += elapsed;
+    if ( elapsed > stats.free_worst ) {
+        stats.free_worst = elapsed;
+    }
+}
+
+static void prvHeapBenchFill( heap_bench_slot * slot )
+{
+    switch ( prvHeapBenchRand() % 8 ) {
+    case 0:
+    case 1:
+    case 2:
+        slot->block[0] = prvHeapBenchMalloc( HEAP_BENCH_SEMAPHORE );
+        break;
+    case 3:
+        slot->block[0] = prvHeapBenchMalloc( HEAP_BENCH_QUEUE( 4, sizeof(uint32_t) ) );
+        break;
+    case 4:
+    case 5:
+    case 6:
+        slot->block[0] = prvHeapBenchMalloc( 8 + prvHeapBenchRand() % 192 );
+        break;
+    default:
+        /* xTaskCreate of this kernel: TCB first, given back if the stack doesn't fit */
+        slot->block[0] = prvHeapBenchMalloc( HEAP_BENCH_TCB );
+        if ( slot->block[0] != NULL ) {
+            slot->block[1] = prvHeapBenchMalloc( ( 100 + prvHeapBenchRand() % 101 ) * 4 );
+            if ( slot->block[1] == NULL ) {
+                prvHeapBenchFree( slot->block[0] );
+                slot->block[0] = NULL;
+            }
+        }
+        break;
+    }
+}
+
+static void prvHeapBenchEmpty( heap_bench_slot * slot )
+{
+    /* vTaskDelete: the idle task frees the stack, then the TCB */
+    prvHeapBenchFree( slot->block[1] );
+    prvHeapBenchFree( slot->block[0] );
+    slot->block[0] = NULL;
+    slot->block[1] = NULL;
+}
+
+static size_t prvHeapBenchSample( unsigned long step, int print )
+{
+    size_t largest;
+    size_t blocks = xPortGetFreeBlockCount( &largest );
+    size_t free_bytes = xPortGetFreeHeapSize();
+
+    if ( blocks > stats.max_free_blocks ) {
+        stats.max_free_blocks = blocks;
+    }
+    if ( print ) {
+        printf( "sample,heap_%d,%lu,%zu,%zu,%zu,%.1f\n", HEAP_BENCH_HEAP, step, free_bytes, largest, blocks,
+                free_bytes ? 100.0 * ( free_bytes - largest ) / free_bytes : 0.0 );
+    }
+    return blocks;
+}
+
+int main( void )
+{
+    unsigned long step;
+    size_t i;
+
+    for ( i = 0; i < sizeof(heap_bench_startup) / sizeof(heap_bench_startup[0]); i++ ) {
+        if ( pvPortMalloc( heap_bench_startup[i] ) == NULL ) {
+            printf( "result,heap_%d,startup,FAIL,%zu\n", HEAP_BENCH_HEAP, i );
+            return 1;
+        }
+    }
+    prvHeapBenchSample( 0, 1 );
+
+    for ( step = 1; step <= HEAP_BENCH_OPERATIONS; step++ ) {
+        heap_bench_slot * slot = &heap_bench_slots[prvHeapBenchRand() % HEAP_BENCH_SLOTS];
+
+        if ( slot->block[0] != NULL ) {
+            prvHeapBenchEmpty( slot );
+        } else {
+            prvHeapBenchFill( slot );
+        }
+        prvHeapBenchSample( step, ( step % HEAP_BENCH_SAMPLE ) == 0 );
+    }
+
+    printf( "result,heap_%d,%lu,%lu,%lu,%lu,%zu,%zu,%.1f,%.0f,%.1f,%.0f\n", HEAP_BENCH_HEAP, HEAP_BENCH_OPERATIONS,
+            stats.allocs, stats.failed, stats.failed_fragmented, xPortGetMinimumEverFreeHeapSize(),
+            stats.max_free_blocks, stats.malloc_total / stats.allocs, stats.malloc_worst,
+            stats.frees ? stats.free_total / stats.frees : 0.0, stats.free_worst );
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file FreeRTOS.h
+ *
+ * @brief Host stand-in for the FreeRTOS headers (make bench-host)
+ *
+ * Just enough for the kernel-free modules (ipmb_frame.c, ipmi_dispatch.c) and the headers they include
+ * to compile natively: the kernel types as opaque handles, configASSERT on assert() and every
+ * configAPP option off. The FreeRTOS heaps (make heap-bench-host) also build against it, with the size
+ * of the target heap and no hooks. Nothing here may end up in the firmware, it's only on the host include path.
+ */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+/* C Standard includes */
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void * TaskHandle_t;
+typedef void * QueueHandle_t;
+typedef void * SemaphoreHandle_t;
+typedef void * TimerHandle_t;
+
+#define pdFALSE                     ( ( BaseType_t ) 0 )
+#define pdTRUE                      ( ( BaseType_t ) 1 )
+#define portMAX_DELAY               ( ( TickType_t ) 0xffffffffUL )
+#define configTICK_RATE_HZ          ( ( TickType_t ) 1000 )
+#define portTICK_PERIOD_MS          ( ( TickType_t ) 1000 / configTICK_RATE_HZ )
+#define configMINIMAL_STACK_SIZE    ( ( unsigned short ) 128 )
+#define tskIDLE_PRIORITY            ( ( UBaseType_t ) 0U )
+
+#define configASSERT( x )           assert( x )
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+/* heap_2.c and heap_4.c, as configured by FreeRTOSConfig.h without static stacks */
+#define configTOTAL_HEAP_SIZE       ( ( size_t ) ( 12 * 1024 ) )
+#define configAPPLICATION_ALLOCATED_HEAP 1
+#define configUSE_MALLOC_FAILED_HOOK 0
+#define portBYTE_ALIGNMENT          8
+#define portBYTE_ALIGNMENT_MASK     ( 0x0007 )
+#define portPOINTER_SIZE_TYPE       uintptr_t
+#define mtCOVERAGE_TEST_MARKER()
+#define traceMALLOC( pvAddress, uiSize )
+#define traceFREE( pvAddress, uiSize )
+
+void *pvPortMalloc( size_t xWantedSize );
+void vPortFree( void *pv );
+size_t xPortGetFreeHeapSize( void );
+size_t xPortGetMinimumEverFreeHeapSize( void );
+size_t xPortGetFreeBlockCount( size_t *pxLargestFreeBlock );
+
+#define configAPP_STATIC_STACKS     0
+#define configAPP_KERNEL_TRACE      0
+#define configAPP_PROFILE           0
+#define configAPP_RAMFUNC           0
+
+/* The host linker only brackets sections named like C identifiers, see afcipm.ld for the target */
+#define IPMI_HANDLER_SECTION        "ipmi_handlers"
+#define __ipmi_handlers_start       __start_ipmi_handlers
+#define __ipmi_handlers_end         __stop_ipmi_handlers
+#define METRIC_SECTION              "metrics"
+#define __metrics_start             __start_metrics
+#define __metrics_end               __stop_metrics
+
+#endif /*HOST_FREERTOS_H_*/
@@ -51,34 +51,140 @@ licensing and training services.
  *----------------------------------------------------------*/
 
 #define configUSE_PREEMPTION                    1
-#define configUSE_IDLE_HOOK                     0
-#define configMAX_PRIORITIES                    ( 5 )
+/* Runs the background jobs (idle_job.h) */
+#define configUSE_IDLE_HOOK                     1
+/* The top one is the deferred work daemon's alone, see deferred.h */
+#define configMAX_PRIORITIES                    ( 6 )
 #define configUSE_TICK_HOOK                     0
 #define configCPU_CLOCK_HZ                      ( ( unsigned long ) SystemCoreClock )
 #define configTICK_RATE_HZ                      ( ( portTickType ) 1000 )
 #define configMINIMAL_STACK_SIZE                ( ( unsigned short ) 100 )
-#define configTOTAL_HEAP_SIZE                   ( ( size_t ) ( 10 * 1024 ) )
+/* Application option (not a kernel one): project task stacks in static buffers, see task_stack.h.
+ * The heap then only holds the kernel objects (queues, timers, TCBs) and the kernel tasks' stacks. */
+#ifndef configAPP_STATIC_STACKS
+#define configAPP_STATIC_STACKS                 0
+#endif
+/* The heap is in RamAHB16 (see mem_stats.c), with the block pools, DMA buffers and trace rings (~2.5 KB).
+ * RamLoc16 keeps .data/.bss, the static task stacks and the main stack. */
+#if configAPP_STATIC_STACKS
+#define configTOTAL_HEAP_SIZE                   ( ( size_t ) ( 8 * 1024 ) )
+#else
+#define configTOTAL_HEAP_SIZE                   ( ( size_t ) ( 12 * 1024 ) )
+#endif
+#define configAPPLICATION_ALLOCATED_HEAP        1
+/* Application option (not a kernel one): heap implementation linked in, FreeRTOS/heap_2.c (best fit, free
+ * blocks never merged) or heap_4.c (first fit, merged with their neighbours), see the Makefile */
+#ifndef configAPP_HEAP
+#define configAPP_HEAP                          2
+#endif
 #define configMAX_TASK_NAME_LEN                 ( 12 )
 #define configUSE_TRACE_FACILITY                1
 #define configUSE_16_BIT_TICKS                  0
 #define configIDLE_SHOULD_YIELD                 0
 #define configUSE_CO_ROUTINES                   0
 #define configUSE_MUTEXES                       1
+/* The IPMI dispatcher waits on its request and deferred work queues at once */
+#define configUSE_QUEUE_SETS                    1
 #define configMAX_CO_ROUTINE_PRIORITIES         ( 2 )
-#define configUSE_COUNTING_SEMAPHORES           0
+#define configUSE_COUNTING_SEMAPHORES           1
 #define configUSE_ALTERNATIVE_API               0
+/* Application option (not a kernel one): MPU guard at the bottom of the running task's stack, which
+ * replaces the check of each context switch, see stack_guard.h */
+#ifndef configAPP_STACK_GUARD
+#define configAPP_STACK_GUARD                   0
+#endif
+#if configAPP_STACK_GUARD
+#define configCHECK_FOR_STACK_OVERFLOW          0
+#else
 #define configCHECK_FOR_STACK_OVERFLOW          1
+#endif
 #define configUSE_RECURSIVE_MUTEXES             0
 #define configQUEUE_REGISTRY_SIZE               10
-#define configGENERATE_RUN_TIME_STATS           0
-#define configUSE_MALLOC_FAILED_HOOK            0
+#define configGENERATE_RUN_TIME_STATS           1
+#define configUSE_MALLOC_FAILED_HOOK            1
 #define configENABLE_BACKWARD_COMPATIBILITY     1
 #define configUSE_APPLICATION_TASK_TAG          1
 #define configUSE_TASK_NOTIFICATIONS            1
 
+/* Priorities of all the tasks and interrupts, see priorities.h */
+#include "priorities.h"
+
+/* Software timers, used by the IPMB layer to schedule retransmissions */
+#define configUSE_TIMERS                        1
+#define configTIMER_TASK_PRIORITY               TIMER_TASK_PRIORITY
+#define configTIMER_QUEUE_LENGTH                8
+#define configTIMER_TASK_STACK_DEPTH            ( configMINIMAL_STACK_SIZE * 2 )
+
+/* Compiled out of the release build (make release), FreeRTOS.h then defines configASSERT as empty */
+#ifndef NDEBUG
 #define configASSERT( x )     if( ( x ) == 0 ) { vAssertCalled( __FILE__, __LINE__ );}
+#endif
 void vAssertCalled( char* file, uint32_t line);
 
+/* Failed allocations are recorded with their caller, see mem_stats.h (expanded inside pvPortMalloc) */
+void mem_stats_malloc_trace( void * caller, size_t size );
+#define traceMALLOC( pvAddress, uiSize )    if( ( pvAddress ) == NULL ) { mem_stats_malloc_trace( __builtin_return_address( 0 ), ( uiSize ) ); }
+
+/* Application option (not a kernel one): scheduler, queue and interrupt trace recorder, see kernel_trace.h */
+#ifndef configAPP_KERNEL_TRACE
+#define configAPP_KERNEL_TRACE                  0
+#endif
+#include "kernel_trace.h"
+#include "stack_guard.h"
+
+/* Application option (not a kernel one): worst response time of each task against its deadline, see response_time.h */
+#ifndef configAPP_RESPONSE_TIME
+#define configAPP_RESPONSE_TIME                 0
+#endif
+#include "response_time.h"
+
+/* Expanded inside vTaskSwitchContext and prvAddTaskToReadyList */
+#define traceTASK_SWITCHED_IN()                 do { KERNEL_TRACE_SWITCHED_IN(); STACK_GUARD_SWITCHED_IN(); } while ( 0 )
+#define traceTASK_SWITCHED_OUT()                do { KERNEL_TRACE_SWITCHED_OUT(); RESPONSE_TIME_SWITCHED_OUT(); } while ( 0 )
+#define traceMOVED_TASK_TO_READY_STATE( pxTCB ) do { KERNEL_TRACE_READY( pxTCB ); RESPONSE_TIME_READY( pxTCB ); } while ( 0 )
+
+/* Queue depth telemetry, always on, see queue_stats.h */
+#include "queue_stats.h"
+
+/* Application option (not a kernel one): cycle count probes on the hot paths, see prof.h */
+#ifndef configAPP_PROFILE
+#define configAPP_PROFILE                       0
+#endif
+
+/* Application option (not a kernel one): mock I2C backend for the load simulator, see i2c.h */
+#ifndef configAPP_I2C_MOCK
+#define configAPP_I2C_MOCK                      0
+#endif
+
+/* Application option (not a kernel one): hot paths run from RAM, including the context switch
+ * (xPortPendSVHandler and vTaskSwitchContext), see ram_sections.h */
+#ifndef configAPP_RAMFUNC
+#define configAPP_RAMFUNC                       0
+#endif
+#include "ram_sections.h"
+
+/* Tick suppressed while idle (SysTick reprogrammed by vPortSuppressTicksAndSleep), the core sleeps until
+ * the next timeout or any interrupt, the I2C ones included. The core cycle counter stops while the core
+ * sleeps, so the builds timing with it across idle time (kernel trace, profile probes, and the bench and
+ * load simulator images, see the Makefile) keep the tick */
+#ifndef configUSE_TICKLESS_IDLE
+#if configAPP_KERNEL_TRACE || configAPP_PROFILE
+#define configUSE_TICKLESS_IDLE                 0
+#else
+#define configUSE_TICKLESS_IDLE                 1
+#endif
+#endif
+
+/* No sleep while a background job (idle_job.h) has work left, the idle task goes on running its slices */
+uint8_t idle_job_pending( void );
+#define configPRE_SLEEP_PROCESSING( x )         do { if ( idle_job_pending() ) { ( x ) = 0; } } while ( 0 )
+
+/* Application option (not a kernel one): hardware watchdog fed by the task monitor, see watchdog.h */
+#ifndef configAPP_WATCHDOG
+#define configAPP_WATCHDOG                      1
+#endif
+
+void vConfigureTimerForRunTimeStats( void );
 #if (configGENERATE_RUN_TIME_STATS == 1)
 #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() vConfigureTimerForRunTimeStats()
 #define portGET_RUN_TIME_COUNTER_VALUE() LPC_TIMER0->TC
@@ -96,6 +202,10 @@ void vAssertCalled( char* file, uint32_t line);
 #define INCLUDE_vTaskDelay                      1
 #define INCLUDE_uxTaskGetStackHighWaterMark     1
 #define INCLUDE_xTaskGetCurrentTaskHandle       1
+#define INCLUDE_xTimerPendFunctionCall          1
+#define INCLUDE_xTaskGetIdleTaskHandle          1
+#define INCLUDE_xTimerGetTimerDaemonTaskHandle  1
+#define INCLUDE_pcTaskGetTaskName               1
 
 /* Use the system definition, if there is one */
 #ifdef __NVIC_PRIO_BITS
@@ -0,0 +1,62 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file adc.h
+ *
+ * @brief On-chip ADC, sampled in the background
+ *
+ * The ADC runs in burst mode over the channels in use and the GPDMA copies every conversion
+ * to a buffer, so nothing runs per conversion. Once a sweep buffer is full (#ADC_OVERSAMPLE
+ * conversions of every channel), the DMA interrupt averages the conversions of each channel
+ * into its result and starts the next sweep. Readers only pick up the latest results.
+ */
+
+#ifndef ADC_H_
+#define ADC_H_
+
+/*! @brief Number of ADC channels */
+#define ADC_CHANNELS                8
+/*! @brief Conversions per second, shared by all the channels in use */
+#define ADC_SAMPLE_RATE             4000
+/*! @brief Conversions of each channel averaged into one result, as a power of 2 (0 disables oversampling) */
+#define ADC_OVERSAMPLE_SHIFT        2
+#define ADC_OVERSAMPLE              ( 1 << ADC_OVERSAMPLE_SHIFT )
+/*! @brief Full scale of a result (12 bit ADC) */
+#define ADC_RESULT_MAX              0xFFF
+
+/*! @brief Configures the channel pins and starts sampling
+ *
+ * @param channels: Mask of the channels to sample, bit n for AD0.n.
+ */
+void adc_init( uint8_t channels );
+
+/*! @brief Latest result of a channel, never waits
+ *
+ * @param channel: ADC channel (0 to 7).
+ * @param value: Where to copy the result to, 0 to #ADC_RESULT_MAX.
+ * @return 1 on success, 0 if the channel isn't sampled or no sweep has completed yet
+ */
+uint8_t adc_read( uint8_t channel, uint16_t * value );
+
+/*! @brief Sweeps completed since #adc_init, wraps around */
+uint32_t adc_sweeps( void );
+
+#endif /*ADC_H_*/
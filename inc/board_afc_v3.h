@@ -0,0 +1,92 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file board_afc_v3.h
+ *
+ * @brief AFC v3 board
+ * @warning Only included by board_defs.h
+ */
+
+#ifndef BOARD_AFC_V3_H_
+#define BOARD_AFC_V3_H_
+
+/* I2C pins: X( interface, port, SDA pin, SCL pin, pin function ) */
+#define BOARD_I2C_PINS( X )             \
+    X( I2C0, 0, 27, 28, 1 )             \
+    X( I2C1, 0, 0, 1, 3 )               \
+    X( I2C2, 0, 10, 11, 2 )
+
+/* Geographic Address pin definitions */
+#define GA0_PORT        1
+#define GA0_PIN         0
+#define GA1_PORT        1
+#define GA1_PIN         1
+#define GA2_PORT        1
+#define GA2_PIN         4
+#define GA_TEST_PORT    1
+#define GA_TEST_PIN     8
+
+#define ledBLUE_PORT    1
+#define ledBLUE_PIN     9
+#define ledGREEN_PORT   1
+#define ledGREEN_PIN    10
+#define ledRED_PORT     1
+#define ledRED_PIN      25
+
+/* AMC hot swap handle switch, low when the handle is closed (port 0 or 2, for the GPIO interrupt) */
+#define HOT_SWAP_HANDLE_PORT    2
+#define HOT_SWAP_HANDLE_PIN     13
+
+/* Payload power rails, in power up order (see payload.h):
+ * X( name, enable port, enable pin, power good port, power good pin, timeout ms ), PAYLOAD_NO_PG for
+ * a rail without power good signal (the timeout is then its settling time). Power good pins on port 0 or 2. */
+#define PAYLOAD_RAILS( X )                          \
+    X( P12V,    1, 28, PAYLOAD_NO_PG, 0,    20 )    \
+    X( P3V3,    1, 27, 2, 5,                50 )    \
+    X( P1V8,    1, 26, 2, 6,                50 )    \
+    X( P1V0,    1, 24, 2, 7,                50 )
+
+/* Debug UART (TXD0/RXD0) */
+#define UART_DEBUG_PORT     0
+#define UART_DEBUG_TX_PIN   2
+#define UART_DEBUG_RX_PIN   3
+#define UART_DEBUG_PIN_FUNC 1
+
+/* MicroTCA.4 RTM, managed over its local bus (see rtm.h): interface, address of the RTM MMC on it
+ * (8 bit form) and IPMB-L address the MMC answers at for it, from our own one */
+#define RTM_I2C                 I2C2
+#define RTM_MMC_ADDR            0xEA
+#define RTM_IPMB_ADDR( amc )    ( (amc) + 0x40 )
+
+/* Sensors, see board_sensors.h */
+#define BOARD_SENSORS( X )                                                          \
+    X( LM75_1, I2C1, 0x4C, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #1" )            \
+    X( LM75_2, I2C1, 0x4D, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #2" )            \
+    X( LM75_3, I2C1, 0x4E, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #3" )            \
+    X( LM75_4, I2C1, 0x4F, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #4" )            \
+    X( P12V_CURR, I2C1, 0x40, ina220_shunt_driver, 100, SDR_CURR_INA220, "+12V Curr" ) \
+    X( P12V_VOLT, I2C1, 0x40, ina220_bus_driver, 100, SDR_VOLT_INA220, "+12V" )     \
+    X( P12V_POWER, I2C1, 0x40, ina220_power_driver, 100, SDR_POWER_INA220, "+12V Power" )
+
+/* Shunt of the +12V payload power monitor (INA220, see board_sensors.h) */
+#define INA220_SHUNT_MOHM       5
+
+#endif /*BOARD_AFC_V3_H_*/
@@ -19,82 +19,49 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*!
+ * @file board_defs.h
+ *
+ * @brief Board variant, selected at build time (make BOARD=AFC_V3 or BOARD=MBED)
+ *
+ * Each variant has its own header, board_<variant>.h, describing it with constants and X-lists
+ * only: the drivers expand the lists into their const tables in flash (I2C pins in i2c.c, payload
+ * rails in payload.c, sensors in sensor.c and sdr.c) and loop over them, so a new board revision is a
+ * new header here and nothing else. A variant header defines:
+ * - BOARD_I2C_PINS( X ): X( interface, port, SDA pin, SCL pin, pin function ), one per I2C interface;
+ * - GA0/GA1/GA2/GA_TEST_PORT and _PIN: geographic address inputs and their test output;
+ * - ledBLUE/ledGREEN/ledRED_PORT and _PIN;
+ * - HOT_SWAP_HANDLE_PORT and _PIN, low when the handle is closed (port 0 or 2, for the GPIO interrupt);
+ * - PAYLOAD_RAILS( X ), see payload.h;
+ * - UART_DEBUG_PORT, _TX_PIN, _RX_PIN and _PIN_FUNC;
+ * - BOARD_SENSORS( X ), see board_sensors.h;
+ * - RTM_I2C, RTM_MMC_ADDR and RTM_IPMB_ADDR( AMC address ), only on a board with an RTM connector (see rtm.h);
+ * - FPGA_CFG_SSP, FPGA_FLASH_SSP (LPC_SSP0 or LPC_SSP1), FPGA_SSP_PINS( X ): X( port, pin, pin function ) for their
+ *   SCK, MOSI and MISO, and FPGA_FLASH_CS, FPGA_PROGRAM_B, FPGA_INIT_B, FPGA_DONE _PORT and _PIN, only on a board
+ *   with the payload FPGA configuration wired to the MMC (see fpga.h), and with its register mailbox FPGA_MBOX_SSP
+ *   (one of the two) and FPGA_MBOX_CS_PORT and _PIN.
+ */
+
 #ifndef BOARD_DEFS_H_
 #define BOARD_DEFS_H_
 
-//#ifndef BOARD
-#define BOARD           MBED
-//#endif
-
-#if (BOARD == AFC_V3)
-
-/* I2C Pins definitions */
-
-#define I2C0_PORT       0
-#define I2C0_SDA_PIN    27
-#define I2C0_SCL_PIN    28
-#define I2C0_PIN_FUNC   1
-
-#define I2C1_PORT       0
-#define I2C1_SDA_PIN    0
-#define I2C1_SCL_PIN    1
-#define I2C1_PIN_FUNC   3
-
-#define I2C2_PORT       0
-#define I2C2_SDA_PIN    10
-#define I2C2_SCL_PIN    11
-#define I2C2_PIN_FUNC   2
-
-/* Geographic Address pin definitions */
-#define GA0_PORT         1
-#define GA1_PORT         1
-#define GA2_PORT         1
-#define GA_TEST_PORT    1
-#define GA0_PIN         0
-#define GA1_PIN         1
-#define GA2_PIN         4
-#define GA_TEST_PIN     8
-
-#define ledBLUE_PORT    1
-#define ledBLUE_PIN     9
-#define ledGREEN_PORT   1
-#define ledGREEN_PIN    10
-#define ledRED_PORT     1
-#define ledRED_PIN      25
-
-#elif (BOARD == MBED)
-
-/* I2C Pins definitions */
-
-#define I2C0_PORT       0
-#define I2C0_SDA_PIN    27
-#define I2C0_SCL_PIN    28
-#define I2C0_PIN_FUNC   1
-
-#define I2C1_PORT       0
-#define I2C1_SDA_PIN    0
-#define I2C1_SCL_PIN    1
-#define I2C1_PIN_FUNC   3
-
-#define I2C2_PORT       0
-#define I2C2_SDA_PIN    10
-#define I2C2_SCL_PIN    11
-#define I2C2_PIN_FUNC   2
-
-/* Geographic Address pin definitions */
-#define GA_PORT         1
-#define GA0_PIN         0
-#define GA1_PIN         1
-#define GA2_PIN         4
-#define GA_TEST_PIN     8
-
-#define ledBLUE_PORT    1
-#define ledBLUE_PIN     18
-#define ledGREEN_PORT   1
-#define ledGREEN_PIN    20
-#define ledRED_PORT     1
-#define ledRED_PIN      21
+/*! @name Board variants
+ * @{
+ */
+#define BOARD_AFC_V3    1
+#define BOARD_MBED      2
+/*! @} */
 
+#ifndef BOARD
+#define BOARD           BOARD_AFC_V3
 #endif
 
+#if ( BOARD == BOARD_AFC_V3 )
+#include "board_afc_v3.h"
+#elif ( BOARD == BOARD_MBED )
+#include "board_mbed.h"
+#else
+#error "Unknown BOARD"
 #endif
+
+#endif /*BOARD_DEFS_H_*/
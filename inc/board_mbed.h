@@ -0,0 +1,78 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file board_mbed.h
+ *
+ * @brief mbed LPC1768 development board, standing in for the AFC
+ * @warning Only included by board_defs.h
+ */
+
+#ifndef BOARD_MBED_H_
+#define BOARD_MBED_H_
+
+/* I2C pins: X( interface, port, SDA pin, SCL pin, pin function ) */
+#define BOARD_I2C_PINS( X )             \
+    X( I2C0, 0, 27, 28, 1 )             \
+    X( I2C1, 0, 0, 1, 3 )               \
+    X( I2C2, 0, 10, 11, 2 )
+
+/* Geographic Address pin definitions */
+#define GA0_PORT        1
+#define GA0_PIN         0
+#define GA1_PORT        1
+#define GA1_PIN         1
+#define GA2_PORT        1
+#define GA2_PIN         4
+#define GA_TEST_PORT    1
+#define GA_TEST_PIN     8
+
+#define ledBLUE_PORT    1
+#define ledBLUE_PIN     18
+#define ledGREEN_PORT   1
+#define ledGREEN_PIN    20
+#define ledRED_PORT     1
+#define ledRED_PIN      21
+
+/* Hot swap handle stand-in (a push button to ground on p30), port 0 or 2 for the GPIO interrupt */
+#define HOT_SWAP_HANDLE_PORT    0
+#define HOT_SWAP_HANDLE_PIN     4
+
+/* Payload power rails stand-in: enables on p26 to p23, power good inputs on p8 to p6 (see board_afc_v3.h) */
+#define PAYLOAD_RAILS( X )                          \
+    X( P12V,    2, 0, PAYLOAD_NO_PG, 0,     20 )    \
+    X( P3V3,    2, 1, 0, 6,                 50 )    \
+    X( P1V8,    2, 2, 0, 7,                 50 )    \
+    X( P1V0,    2, 3, 0, 8,                 50 )
+
+/* Debug UART (TXD0/RXD0, the mbed USB serial port) */
+#define UART_DEBUG_PORT     0
+#define UART_DEBUG_TX_PIN   2
+#define UART_DEBUG_RX_PIN   3
+#define UART_DEBUG_PIN_FUNC 1
+
+/* Sensors, see board_sensors.h */
+#define BOARD_SENSORS( X )                                                          \
+    X( LM75_1, I2C1, 0x4C, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #1" )            \
+    X( LM75_2, I2C1, 0x4D, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #2" )            \
+    X( LM75_3, I2C1, 0x4E, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #3" )            \
+    X( LM75_4, I2C1, 0x4F, lm75_driver, 200, SDR_TEMP_LM75, "LM75 #4" )
+
+#endif /*BOARD_MBED_H_*/
@@ -0,0 +1,133 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file board_sensors.h
+ *
+ * @brief Sensors of the board, in one table
+ *
+ * #BOARD_SENSORS, from the variant header of the board (see board_defs.h), is expanded by sensor.c into the polling table and by sdr.c into the SDR records,
+ * so both always agree. Each line is
+ * X( id, bus, address, driver, period_ms, SDR template, name ), where the SDR template is a
+ * macro taking ( sensor number, name ) and giving the record initializer. Each template T comes with
+ * T_LINEAR, its ( format, M, B, Bexp, Rexp ), from which both the record (#SDR_LINEAR) and the integer
+ * conversion of sdr.c (#SDR_LINEAR_CONV) are built.
+ * The sensor number of each sensor is its position in the table, #SENSOR_id.
+ * On-chip ADC channels go on the #SENSOR_LOCAL bus with the channel as address, e.g.
+ * X( P3V3, SENSOR_LOCAL, 0, adc_driver, 100, SDR_VOLT_ADC, "+3.3V" ).
+ * Registers of the payload FPGA mailbox go on the #SENSOR_FPGA bus with the register index as address,
+ * with fpga_reg_driver, e.g. X( FPGA_TEMP, SENSOR_FPGA, 0, fpga_reg_driver, 500, SDR_TEMP_LM75, "FPGA Temp" ).
+ * An INA220 power monitor is three sensors of the same device, one per register (ina220_shunt_driver,
+ * ina220_bus_driver and ina220_power_driver, with the SDR_CURR_INA220, SDR_VOLT_INA220 and SDR_POWER_INA220
+ * templates). Given the same period they're read in the same sweep, back to back; the period of the first one
+ * sets the averaging of the device.
+ * @warning Must be included after board_defs.h
+ */
+
+#ifndef BOARD_SENSORS_H_
+#define BOARD_SENSORS_H_
+
+/* LM75 temperature sensor: signed degrees Celsius, one per unit (M = 1, B = 0).
+ * The upper thresholds are readable, settable and send an event when they assert or deassert. */
+#define SDR_TEMP_LM75_LINEAR    SDR_UNITS_2S_COMPLEMENT, 1, 0, 0, 0
+#define SDR_TEMP_LM75( num, name )                                          \
+    SDR_FULL_SENSOR( num, name,                                             \
+        .sensor_type = SDR_SENSOR_TYPE_TEMPERATURE,                         \
+        .event_type = SDR_EVENT_TYPE_THRESHOLD,                             \
+        .capabilities = SDR_CAP_AUTO_REARM | SDR_CAP_HYSTERESIS_SETTABLE |  \
+                        SDR_CAP_THRESHOLD_SETTABLE | SDR_CAP_EVENTS_GLOBAL, \
+        /* UNC, UC and UNR going high; upper comparisons returned */        \
+        .assert_mask = { 0x80, 0x0A },                                      \
+        .deassert_mask = { 0x80, 0x7A },                                    \
+        .reading_mask = { THRESHOLD_UPPER, THRESHOLD_UPPER },               \
+        SDR_LINEAR( SDR_TEMP_LM75_LINEAR ),                                 \
+        .units2 = SDR_UNIT_DEGREES_C,                                       \
+        .nominal = 25,                                                      \
+        .normal_max = 60,                                                   \
+        .normal_min = 0,                                                    \
+        .sensor_max = 0x7F,                                                 \
+        .sensor_min = 0x80,                                                 \
+        .upper_nonrecover = 85,                                             \
+        .upper_critical = 75,                                               \
+        .upper_noncritical = 65,                                            \
+        .pos_hysteresis = 2,                                                \
+        .neg_hysteresis = 2 )
+
+/* ADC channel: 8 most significant bits of the result, 3.3 V full scale at the pin (M = 129, R exp = -4).
+ * A rail behind a divider needs its own template with the scaled M. */
+#define SDR_VOLT_ADC_LINEAR     SDR_UNITS_UNSIGNED, 129, 0, 0, -4
+#define SDR_VOLT_ADC( num, name )                                           \
+    SDR_FULL_SENSOR( num, name,                                             \
+        .sensor_type = SDR_SENSOR_TYPE_VOLTAGE,                             \
+        .event_type = SDR_EVENT_TYPE_THRESHOLD,                             \
+        SDR_LINEAR( SDR_VOLT_ADC_LINEAR ),                                  \
+        .units2 = SDR_UNIT_VOLTS,                                           \
+        .sensor_max = 0xFF,                                                 \
+        .sensor_min = 0x00 )
+
+/* INA220 power monitor, configured by sensor.c with a current LSB of 1 mA for a shunt of #INA220_SHUNT_MOHM
+ * (board header). A monitor with another shunt needs its own current template with the scaled M. */
+#ifndef INA220_SHUNT_MOHM
+#define INA220_SHUNT_MOHM       5
+#endif
+
+/* Shunt voltage, 320 uV per count, as current: signed amps, M = 320 / shunt in mOhm, R exp = -3 */
+#define SDR_CURR_INA220_LINEAR  SDR_UNITS_2S_COMPLEMENT, ( 320 / INA220_SHUNT_MOHM ), 0, 0, -3
+#define SDR_CURR_INA220( num, name )                                        \
+    SDR_FULL_SENSOR( num, name,                                             \
+        .sensor_type = SDR_SENSOR_TYPE_CURRENT,                             \
+        .event_type = SDR_EVENT_TYPE_THRESHOLD,                             \
+        SDR_LINEAR( SDR_CURR_INA220_LINEAR ),                               \
+        .units2 = SDR_UNIT_AMPS,                                            \
+        .sensor_max = 0x7F,                                                 \
+        .sensor_min = 0x80 )
+
+/* Bus voltage, 64 mV per count up to 16.3 V (M = 64, R exp = -3) */
+#define SDR_VOLT_INA220_LINEAR  SDR_UNITS_UNSIGNED, 64, 0, 0, -3
+#define SDR_VOLT_INA220( num, name )                                        \
+    SDR_FULL_SENSOR( num, name,                                             \
+        .sensor_type = SDR_SENSOR_TYPE_VOLTAGE,                             \
+        .event_type = SDR_EVENT_TYPE_THRESHOLD,                             \
+        SDR_LINEAR( SDR_VOLT_INA220_LINEAR ),                               \
+        .units2 = SDR_UNIT_VOLTS,                                           \
+        .sensor_max = 0xFF,                                                 \
+        .sensor_min = 0x00 )
+
+/* Power, 320 mW per count up to 81.6 W (M = 32, R exp = -2) */
+#define SDR_POWER_INA220_LINEAR SDR_UNITS_UNSIGNED, 32, 0, 0, -2
+#define SDR_POWER_INA220( num, name )                                       \
+    SDR_FULL_SENSOR( num, name,                                             \
+        .sensor_type = SDR_SENSOR_TYPE_OTHER_UNITS,                         \
+        .event_type = SDR_EVENT_TYPE_THRESHOLD,                             \
+        SDR_LINEAR( SDR_POWER_INA220_LINEAR ),                              \
+        .units2 = SDR_UNIT_WATTS,                                           \
+        .sensor_max = 0xFF,                                                 \
+        .sensor_min = 0x00 )
+
+/*! @brief Sensor numbers */
+#define BOARD_SENSOR_ENUM( id, ... )    SENSOR_##id,
+enum board_sensor {
+    BOARD_SENSORS( BOARD_SENSOR_ENUM )
+    BOARD_SENSOR_COUNT
+};
+
+/*! @brief Sensor number of the FRU Hot Swap sensor (hotswap.c), after the polled ones */
+#define SENSOR_HOT_SWAP                 BOARD_SENSOR_COUNT
+
+#endif /*BOARD_SENSORS_H_*/
@@ -0,0 +1,102 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file boot_time.h
+ *
+ * @brief Boot timeline: time from reset to each start up step, in microseconds
+ *
+ * TIMER3 runs free from the first instruction of ResetISR (or of the boot loader, which leaves it
+ * running), counting microseconds: at the reset clock its default peripheral clock (IRC / 4) is
+ * 1 MHz, and #boot_time_clock sets the prescaler for the PLL clock once SystemInit has switched to it.
+ * Each step of #BOOT_TIME_MARKS is stamped with #boot_time_mark into a .noinit record, which the
+ * startup code neither copies nor zeroes, so the steps before the data and bss init can be stamped
+ * too and a debugger finds the last timeline after a reset. The start up stages of init_stage.h are the
+ * last marks. The timeline is read with the custom Get Boot Timeline command, and logged once (log.h)
+ * by #boot_time_log when the deferred init is over.
+ * @warning Must be included after chip.h
+ */
+
+#ifndef BOOT_TIME_H_
+#define BOOT_TIME_H_
+
+/*! @brief Free running microsecond timer */
+#define BOOT_TIME_TIMER             LPC_TIMER3
+#define BOOT_TIME_TIMER_CLOCK       SYSCTL_CLOCK_TIMER3
+#define BOOT_TIME_TIMER_PCLK        SYSCTL_PCLK_TIMER3
+/*! @brief Value of a mark not reached */
+#define BOOT_TIME_NONE              0xFFFFFFFF
+
+/*! @brief Timeline steps, in order: X( id, name ). The last ones are the stages of init_stage.h, in their order */
+#define BOOT_TIME_MARKS( X )                                                \
+    X( RESET,       "reset" )       /* ResetISR entered */                  \
+    X( DATA,        "data" )        /* .data sections copied */             \
+    X( BSS,         "bss" )         /* .bss sections zeroed */              \
+    X( SYSTEM_INIT, "system_init" ) /* Chip_SystemInit: PLL clock */        \
+    X( HW_INIT,     "hw_init" )     /* prvHardwareInit, image slots */      \
+    X( IPMI_INIT,   "ipmi_init" )   /* IPMB and dispatcher created */       \
+    X( SCHEDULER,   "scheduler" )   /* vTaskStartScheduler called */        \
+    X( CORE,        "ipmb_ready" )                                          \
+    X( SENSORS,     "sensors" )                                             \
+    X( FRU,         "fru" )                                                 \
+    X( HPM,         "hpm" )
+
+#define BOOT_TIME_ENUM( id, name )  BOOT_TIME_##id,
+typedef enum boot_time_id {
+    BOOT_TIME_MARKS( BOOT_TIME_ENUM )
+    BOOT_TIME_COUNT
+} boot_time_id;
+
+/*! @brief Mark of the first start up stage (#INIT_STAGE_CORE) */
+#define BOOT_TIME_STAGES            BOOT_TIME_CORE
+
+/*! @brief Starts the timer if the boot loader didn't, registers only (no data or bss used) */
+static inline void boot_time_timer_start( void )
+{
+    if ( !( LPC_SYSCTL->PCONP & ( 1 << BOOT_TIME_TIMER_CLOCK ) ) || !( BOOT_TIME_TIMER->TCR & TIMER_ENABLE ) ) {
+        LPC_SYSCTL->PCONP |= ( 1 << BOOT_TIME_TIMER_CLOCK );
+        BOOT_TIME_TIMER->PR = 0;
+        BOOT_TIME_TIMER->TCR = TIMER_RESET;
+        BOOT_TIME_TIMER->TCR = TIMER_ENABLE;
+    }
+}
+
+/*! @brief First thing in ResetISR: starts the timer, clears the record and stamps #BOOT_TIME_RESET
+ *
+ * Runs before the data and bss init, so it only touches the registers and the .noinit record.
+ */
+void boot_time_start( void );
+
+/*! @brief Scales the timer to the clock SystemInit set, right after it */
+void boot_time_clock( void );
+
+/*! @brief Stamps a step with the current time, the first time only */
+void boot_time_mark( boot_time_id id );
+
+/*! @brief Microseconds from reset to a step, #BOOT_TIME_NONE if it isn't reached (or no such step) */
+uint32_t boot_time_get( uint8_t id );
+
+/*! @brief Name of a step, NULL if there's no such step */
+const char * boot_time_name( uint8_t id );
+
+/*! @brief Logs the timeline, a "boot,<mark>,<us>" record per step reached */
+void boot_time_log( void );
+
+#endif /*BOOT_TIME_H_*/
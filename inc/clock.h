@@ -0,0 +1,76 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file clock.h
+ *
+ * @brief CPU clock scaling: full speed for the heavy jobs, a lower clock the rest of the time
+ *
+ * SystemInit (sysinit.c) locks PLL0 and then drops the CPU clock to #CLOCK_STEADY_HZ by raising the CCLK
+ * divider. A job that needs the cycles (an HPM upgrade, an FPGA bitstream load, telemetry pushed to a
+ * collector) sets its bit with #clock_boost for as long as it runs; the divider SystemInit was left with
+ * comes back while any bit is set. Only the divider changes, PLL0 stays locked and connected (the
+ * peripheral clock selection can't be changed while it is): every peripheral clock moves with the CPU
+ * clock, so each module whose timings come from one registers a #clock_hook that programs them again.
+ * A change happens with the interrupts disabled: the flash access time (raised before a faster clock,
+ * lowered after a slower one), SystemCoreClock, the SysTick reload and every hook, in one go.
+ * Cycle counts straddling a change convert to time with the wrong clock, the timestamps don't (their
+ * timer is one of the hooks).
+ */
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+/*! @brief Highest CPU clock outside of the boosts, in Hz (the full clock if it's no lower) */
+#ifndef CLOCK_STEADY_HZ
+#define CLOCK_STEADY_HZ             60000000
+#endif
+/*! @brief Most hooks registered */
+#define CLOCK_HOOKS_MAX             8
+
+/*! @name Users of the full clock, for #clock_boost
+ * @{
+ */
+#define CLOCK_BOOST_HPM             0x01    /*!< HPM upgrade operation in progress, hpm.c */
+#define CLOCK_BOOST_FPGA            0x02    /*!< FPGA bitstream load, fpga.c */
+#define CLOCK_BOOST_TELEMETRY       0x04    /*!< Telemetry subscription, telemetry.c */
+#define CLOCK_BOOST_SELFTEST        0x08    /*!< Self test or load generator running, selftest.c */
+/*! @} */
+
+/*! @brief Programs the timings derived from a peripheral clock again, after a change of the CPU clock
+ *
+ * Called with the interrupts disabled, with SystemCoreClock and the peripheral clocks already at the new
+ * rate: must be short and must not call the kernel.
+ */
+typedef void (* clock_hook)( void );
+
+/*! @brief Registers a hook, from the init of its module
+ *
+ * @return 1 on success, 0 if #CLOCK_HOOKS_MAX hooks are already registered
+ */
+uint8_t clock_register( clock_hook hook );
+
+/*! @brief Sets or clears the full clock request of a user, from a task once the scheduler runs
+ *
+ * @param user: One of the @ref CLOCK_BOOST_HPM "users".
+ * @param on: 1 while the job runs, 0 once it's done.
+ */
+void clock_boost( uint8_t user, uint8_t on );
+
+#endif /*CLOCK_H_*/
@@ -0,0 +1,111 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file config_store.h
+ *
+ * @brief Persistent settings: key-value store in two flash sectors, written as an append-only log
+ *
+ * Settings changed over IPMI (event receiver, sensor thresholds, LED overrides) are kept in the two
+ * 4 KB sectors between the image slots (#IMAGE_CONFIG_START, see image.h). A sector is never erased
+ * to change one value: each change is a record (key, length, value) appended to the active sector,
+ * the latest record of a key being its value. Records are written a 256 byte row at a time, so the
+ * changes made within #CONFIG_FLUSH_DELAY of each other are batched in a RAM row and written together
+ * by a low priority task, each row with the sector generation and a CRC (a row torn by a reset is skipped).
+ *     When the active sector is full, the latest record of each key is copied to the other one, with the
+ * next generation, and only then is the full sector erased: a reset in between leaves both valid, and
+ * #config_init replays the older one before the newer one and lets the task finish the move. So a
+ * sector is erased once every dozen rows or so, whatever the number of keys.
+ *     #config_init rebuilds a RAM index of the latest record of each key from the log, so #config_get
+ * is a lookup in the index, and never touches the flash driver.
+ *     Counters (power-on hours, lifetime error totals) live in the same log, in rows of their own: a base
+ * value and a bit per increment. Adding to a counter programs the next bits of its row in place, with no
+ * erase and no new row, so an hourly count takes a row every couple of months; a new row (with the total
+ * as its base) is only written once the bits run out or too many increments come at once.
+ */
+
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+/*! @brief Config task stack, in words (the IAP calls take up to 128 bytes) */
+#define CONFIG_STACK_DEPTH          ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Time without a change before the pending changes are written */
+#define CONFIG_FLUSH_DELAY          ( 1000 / portTICK_PERIOD_MS )
+/*! @brief Longest value */
+#define CONFIG_VALUE_MAX            16
+
+/*! @name Keys
+ * @{
+ */
+#define CONFIG_KEY_EVENT_RECEIVER   0x00                            /*!< Event receiver address, LUN */
+#define CONFIG_KEY_LED( led )       ( 0x08 + ( led ) )              /*!< LED override: function, on duration, color (8 LEDs) */
+#define CONFIG_KEY_THRESHOLD( s )   ( 0x10 + ( s ) )                /*!< Sensor thresholds and hysteresis (#SENSOR_MAX sensors) */
+#define CONFIG_KEYS                 0x20
+/*! @} */
+
+/*! @name Counters
+ * @{
+ */
+#define CONFIG_COUNTER_POH              0   /*!< Power-on hours, see poh.h */
+#define CONFIG_COUNTER_IPMB_RX_ERRORS   1   /*!< IPMB frames with a bad checksum or length */
+#define CONFIG_COUNTER_IPMB_TX_FAILURES 2   /*!< IPMB messages given up after the retries */
+#define CONFIG_COUNTER_IPMB_TIMEOUTS    3   /*!< Late IPMB responses */
+#define CONFIG_COUNTER_I2C_RECOVERIES   4   /*!< I2C bus recoveries */
+#define CONFIG_COUNTERS                 5
+/*! @} */
+
+/*! @brief Rebuilds the index from the flash log and starts the task writing it
+ *
+ * Before the modules restoring their settings (#config_get) and before the scheduler starts.
+ */
+void config_init( void );
+
+/*! @brief Copies the value of a key
+ *
+ * @param key: One of the CONFIG_KEY_* keys.
+ * @param value: Where to copy the value to.
+ * @param len: Length of the value, a value stored with another length isn't returned.
+ * @return 1 on success, 0 if there's no such key or nothing of that length is stored for it
+ */
+uint8_t config_get( uint8_t key, void * value, uint8_t len );
+
+/*! @brief Changes the value of a key (removes it with @p len 0), written to flash after #CONFIG_FLUSH_DELAY
+ *
+ * Never blocks: the change is queued in RAM, where a later one to the same key replaces it. An unchanged
+ * value isn't written again.
+ * @param len: Up to #CONFIG_VALUE_MAX bytes.
+ * @return 1 on success, 0 if there's no such key or the changes waiting to be written fill a row
+ */
+uint8_t config_set( uint8_t key, const void * value, uint8_t len );
+
+/*! @brief Adds to a counter, in RAM until the next #config_counter_sync
+ *
+ * Never blocks, and doesn't wake the task: a counter bumped often is written in batches.
+ * @param counter: One of the CONFIG_COUNTER_* counters.
+ */
+void config_counter_add( uint8_t counter, uint32_t count );
+
+/*! @brief Value of a counter, the increments not written yet included (0 for an unknown counter) */
+uint32_t config_counter_get( uint8_t counter );
+
+/*! @brief Has the task write the increments added since the last call, after #CONFIG_FLUSH_DELAY */
+void config_counter_sync( void );
+
+#endif /*CONFIG_STORE_H_*/
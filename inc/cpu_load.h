@@ -0,0 +1,76 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file cpu_load.h
+ *
+ * @brief Per task CPU load, from the FreeRTOS run time stats
+ *
+ * A periodic job (periodic.h) reads the run time counter of every task (TIMER0, see vConfigureTimerForRunTimeStats) each
+ * #CPU_LOAD_PERIOD and keeps the share of the last #CPU_LOAD_WINDOW periods taken by each task.
+ * A task other than idle holding more than #CPU_LOAD_RUNAWAY of the CPU for #CPU_LOAD_RUNAWAY_PERIODS
+ * periods in a row is flagged as a runaway: at or above the IPMB priority it would be starving the IPMB tasks.
+ * The job runs in the timer task, only below the deferred work daemon (deferred.h), so the sampling keeps going while a task runs away.
+ */
+
+#ifndef CPU_LOAD_H_
+#define CPU_LOAD_H_
+
+/*! @brief Most tasks followed, every one of the task plan (priorities.h) */
+#define CPU_LOAD_MAX_TASKS          TASK_PLAN_TASKS
+/*! @brief Sampling period */
+#define CPU_LOAD_PERIOD             ( 1000 / portTICK_PERIOD_MS )
+/*! @brief Number of periods averaged by the sliding window */
+#define CPU_LOAD_WINDOW             8
+/*! @brief Load of a whole CPU, the loads are in 0.5 % steps */
+#define CPU_LOAD_FULL               200
+/*! @brief Load above which a task may be a runaway (90 %) */
+#define CPU_LOAD_RUNAWAY            180
+/*! @brief Periods in a row above #CPU_LOAD_RUNAWAY before a task is flagged */
+#define CPU_LOAD_RUNAWAY_PERIODS    3
+
+/*! @brief CPU load of a task */
+typedef struct cpu_load_task {
+    UBaseType_t number;                     /*!< FreeRTOS task number, unique to the task */
+    const char * name;
+    uint8_t priority;
+    uint8_t last;                           /*!< Load during the last period, in 1/#CPU_LOAD_FULL */
+    uint8_t window;                         /*!< Average load over the window, in 1/#CPU_LOAD_FULL */
+    uint8_t runaway;                        /*!< Currently flagged as a runaway */
+} cpu_load_task;
+
+/*! @brief Starts the sampling job */
+void cpu_load_init( void );
+
+/*! @brief Number of tasks followed */
+uint8_t cpu_load_count( void );
+
+/*! @brief CPU load of a task
+ *
+ * @param index: Position of the task, from 0 to #cpu_load_count - 1.
+ * @param load: Where to copy its load to.
+ * @return 1 on success, 0 if there's no such task
+ */
+uint8_t cpu_load_get( uint8_t index, cpu_load_task * load );
+
+/*! @brief Number of times a task was flagged as a runaway since reset */
+uint32_t cpu_load_runaways( void );
+
+#endif /*CPU_LOAD_H_*/
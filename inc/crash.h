@@ -0,0 +1,119 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file crash.h
+ *
+ * @brief Crash record kept across the reset that follows an assert or a fault
+ *
+ * An assert, a stack overflow, a task missing its watchdog deadline (watchdog.h) or a fault exception
+ * (hard, memory management, bus, usage fault and NMI, handled here instead of the startup code's spin
+ * loops) fills a record in the AHB SRAM that the startup code doesn't touch: the faulting PC, LR and
+ * xPSR (or the caller of the assert), the fault status registers, the running task, the assert
+ * location, the IPMB counters and the newest bytes of the log ring. The log is then flushed to the UART and the watchdog resets the board within
+ * #CRASH_RESET_TIMEOUT, so a crash costs a reboot instead of a hang until someone power cycles it.
+ *     After the reboot, #crash_init checks the record (a power cycle leaves garbage, which fails the
+ * CRC) and logs it; it stays readable with the custom Get Crash Record command until the Clear Crash
+ * Record command or a power cycle, and counts the crashes since then. The log bytes are records of
+ * log.h, the first one usually cut: tools/log_decode.py resynchronizes on the next one.
+ * @warning Must be included after FreeRTOS.h and ipmb.h
+ */
+
+#ifndef CRASH_H_
+#define CRASH_H_
+
+/*! @brief Newest bytes of the log ring copied into the record */
+#define CRASH_LOG_LEN               128
+/*! @brief Characters kept from the end of the file name of an assert */
+#define CRASH_FILE_LEN              16
+/*! @brief Watchdog timeout that resets the board, in watchdog clock ticks (IRC / 4: 1 us) */
+#define CRASH_RESET_TIMEOUT         1000
+
+/*! @brief What caused the crash */
+typedef enum crash_reason {
+    CRASH_NONE = 0,
+    CRASH_ASSERT,                           /*!< configASSERT, #crash_record.file and line are set */
+    CRASH_STACK_OVERFLOW,                   /*!< Found by the kernel at a context switch, pc is 0; with the stack guard
+                                                 (stack_guard.h) a fault on it, with the fault fields set */
+    CRASH_HARD_FAULT,
+    CRASH_MEM_FAULT,
+    CRASH_BUS_FAULT,
+    CRASH_USAGE_FAULT,
+    CRASH_NMI,
+    CRASH_WATCHDOG,                         /*!< A task missed its watchdog deadline (watchdog.h), task is the late one */
+} crash_reason;
+
+/*! @brief The record, little endian as read by the Get Crash Record command */
+typedef struct crash_record {
+    uint32_t magic;
+    uint32_t crc;                           /*!< CRC-32 of the fields after it (image_crc32) */
+    uint32_t count;                         /*!< Crashes since the last power cycle or clear, this one included */
+    uint32_t uptime;                        /*!< Microseconds from reset (boot_time.h) to the crash */
+    uint32_t wallclock;                     /*!< Seconds since 1970 at the crash (wallclock.h), 0 if unknown */
+    uint8_t reason;                         /*!< #crash_reason */
+    uint8_t log_len;                        /*!< Bytes used in #log */
+    uint16_t line;                          /*!< Line of the assert */
+    uint32_t pc;                            /*!< Stacked PC of a fault, return address of an assert */
+    uint32_t lr;                            /*!< Stacked LR of a fault */
+    uint32_t psr;                           /*!< Stacked xPSR of a fault (exception number of an interrupt handler that faulted) */
+    uint32_t sp;                            /*!< Stack pointer at the fault */
+    uint32_t cfsr;                          /*!< SCB fault status and address registers */
+    uint32_t hfsr;
+    uint32_t mmfar;
+    uint32_t bfar;
+    char task[configMAX_TASK_NAME_LEN];     /*!< Task running (or overflowing its stack), empty before the scheduler */
+    char file[CRASH_FILE_LEN];              /*!< End of the file name of an assert, not terminated if it fills it */
+    uint32_t ipmb_stats[IPMB_STAT_COUNT];   /*!< IPMB counters (ipmb.h) at the crash */
+    uint8_t log[CRASH_LOG_LEN];             /*!< Newest bytes of the log ring, oldest first */
+} crash_record;
+
+/*! @brief Checks the record left by the last reset, logs it and the reset cause */
+void crash_init( void );
+
+/*! @brief Records an assert and resets the board
+ *
+ * @param file: __FILE__ of the assert.
+ * @param line: __LINE__ of the assert.
+ * @param pc: Return address of vAssertCalled, in its caller.
+ */
+void crash_assert( const char * file, uint32_t line, uint32_t pc ) __attribute__ ((noreturn));
+
+/*! @brief Records the stack overflow of a task and resets the board */
+void crash_stack_overflow( const char * task ) __attribute__ ((noreturn));
+
+/*! @brief Records a task late for its watchdog check in and resets the board
+ *
+ * @param task: Name of the task, a string in flash.
+ */
+void crash_watchdog( const char * task ) __attribute__ ((noreturn));
+
+/*! @brief Copies part of the record left by the last crash
+ *
+ * @param offset: First byte to copy.
+ * @param data: Where to copy it to.
+ * @param len: Bytes to copy, fewer are copied at the end of the record.
+ * @return Size of the record, 0 if there's none
+ */
+uint16_t crash_get( uint16_t offset, uint8_t * data, uint8_t len );
+
+/*! @brief Forgets the record and its crash count */
+void crash_clear( void );
+
+#endif /*CRASH_H_*/
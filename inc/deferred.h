@@ -0,0 +1,74 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file deferred.h
+ *
+ * @brief Deferred work daemon: interrupt bottom halves run by one task
+ *
+ * An interrupt handler with more to do than it should (a callback that may call the driver again, a state
+ * machine step) hands it to #deferred_call_from_isr, which puts the function and its two arguments in a ring
+ * and wakes the daemon with a direct task notification. The daemon, above every other task, runs the work
+ * in the order it was queued. Queuing takes no lock: a slot is claimed with an atomic compare and swap on
+ * the head (LDREX/STREX), written, then published by storing its function last, so handlers of any priority
+ * and the tasks can queue at once. Unlike xTimerPendFunctionCallFromISR nothing is copied through the timer
+ * command queue, and the timer task stays free for the timers.
+ * The work must not block; it runs above the timer task, so that task never interrupts it, but it may
+ * interrupt a timer callback.
+ * @code
+ * deferred_call_from_isr( prvChainDone, chain, 0, woken );
+ * @endcode
+ * @warning Must be included after FreeRTOS.h and timers.h
+ */
+
+#ifndef DEFERRED_H_
+#define DEFERRED_H_
+
+/*! @brief Daemon stack, in words */
+#define DEFERRED_STACK_DEPTH        ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Work items queued at most, a power of 2 */
+#define DEFERRED_RING_LEN           16
+
+/*! @brief Counters of the ring */
+typedef struct deferred_stats {
+    uint32_t runs;                          /*!< Work items run */
+    uint32_t full;                          /*!< Items refused, the ring was full */
+    uint8_t high_water;                     /*!< Most items ever waiting */
+} deferred_stats;
+
+/*! @brief Starts the daemon, before the scheduler. Work queued before then runs as soon as it starts */
+void deferred_init( void );
+
+/*! @brief Queues work from an interrupt handler
+ *
+ * @param fn: Function to run in the daemon, as for xTimerPendFunctionCallFromISR.
+ * @param arg: Its first argument.
+ * @param param: Its second argument.
+ * @param woken: Set to pdTRUE if the handler has to yield on its way out.
+ * @return 1 if it's queued, 0 if the ring is full
+ */
+uint8_t deferred_call_from_isr( PendedFunction_t fn, void * arg, uint32_t param, portBASE_TYPE * woken );
+
+/*! @brief Queues work from a task or a critical section, same as #deferred_call_from_isr otherwise */
+uint8_t deferred_call( PendedFunction_t fn, void * arg, uint32_t param );
+
+/*! @brief Copies the counters of the ring */
+void deferred_get_stats( deferred_stats * stats );
+
+#endif /*DEFERRED_H_*/
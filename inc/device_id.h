@@ -0,0 +1,89 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file device_id.h
+ *
+ * @brief Identity of the MMC, in one place
+ *
+ * Get Device ID answers with the constant #device_id_rsp built from these values, copied as it is; the FRU
+ * inventory (fru.c), the MC locator record (sdr.c) and the HPM.1 component description use the same names.
+ * The firmware revision comes from the build (make FW_REV=<major>.<minor>), which also writes it in the
+ * image header (tools/image_header.py), so Get Device ID and HPM.1 always agree.
+ */
+
+#ifndef DEVICE_ID_H_
+#define DEVICE_ID_H_
+
+/*! @name Firmware revision: major (0 to 127), minor in BCD
+ * @{
+ */
+#ifndef DEVICE_FW_REV_MAJOR
+#define DEVICE_FW_REV_MAJOR         0x05
+#endif
+#ifndef DEVICE_FW_REV_MINOR
+#define DEVICE_FW_REV_MINOR         0x50
+#endif
+/*! @} */
+
+#define DEVICE_ID                   0x0A
+#define DEVICE_REVISION             0x02
+/*! @brief IPMI 2.0 */
+#define DEVICE_IPMI_VERSION         0x02
+/*! @brief Sensor device, SDR repository, SEL, FRU inventory and IPMB event receiver */
+#define DEVICE_SUPPORT              0x1F
+/*! @brief IANA enterprise number of the manufacturer, 3 bytes */
+#define DEVICE_MANUFACTURER_ID      0x00315A
+#define DEVICE_PRODUCT_ID           0x0101
+
+/*! @name Names, in the FRU board and product areas and the SDR
+ * @{
+ */
+#define DEVICE_MANUFACTURER_NAME    "LNLS"
+#define DEVICE_PRODUCT_NAME         "AFC"
+#define DEVICE_PART_NUMBER          "AFC-V3"
+#define DEVICE_MMC_NAME             "AFC MMC"
+/*! @} */
+
+/*! @brief Get Device ID response data (IPMI v2.0 section 20.1), without the completion code */
+typedef struct device_id_rsp {
+    uint8_t device_id;
+    uint8_t revision;
+    uint8_t fw_rev_major;                   /*!< Bit 7 clear: device available */
+    uint8_t fw_rev_minor;
+    uint8_t ipmi_version;
+    uint8_t support;
+    uint8_t manufacturer_id[3];             /*!< LS byte first */
+    uint8_t product_id[2];                  /*!< LS byte first */
+} device_id_rsp;
+
+/*! @brief #device_id_rsp initializer from the values above */
+#define DEVICE_ID_RSP {                                                     \
+    .device_id = DEVICE_ID,                                                 \
+    .revision = DEVICE_REVISION,                                            \
+    .fw_rev_major = DEVICE_FW_REV_MAJOR & 0x7F,                             \
+    .fw_rev_minor = DEVICE_FW_REV_MINOR,                                    \
+    .ipmi_version = DEVICE_IPMI_VERSION,                                    \
+    .support = DEVICE_SUPPORT,                                              \
+    .manufacturer_id = { DEVICE_MANUFACTURER_ID & 0xFF, ( DEVICE_MANUFACTURER_ID >> 8 ) & 0xFF, \
+                         DEVICE_MANUFACTURER_ID >> 16 },                    \
+    .product_id = { DEVICE_PRODUCT_ID & 0xFF, DEVICE_PRODUCT_ID >> 8 },     \
+}
+
+#endif /*DEVICE_ID_H_*/
@@ -0,0 +1,76 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file dma_copy.h
+ *
+ * @brief Bulk memory copies moved by the GPDMA
+ *
+ * A copy of #DMA_COPY_MIN bytes or more between word aligned buffers of the AHB SRAM (#__RAM_AHB, the only
+ * RAM the GPDMA reaches) goes through a GPDMA channel of its own, so the CPU runs the other tasks and the
+ * interrupts meanwhile; anything else is copied by the CPU, as it is when the channel is busy with another
+ * copy or none was left for it. #dma_memcpy blocks the calling task until the copy is done, #dma_copy_async
+ * calls back from the deferred work daemon (deferred.h) instead.
+ * The channel is the last one taken, after the peripheral streams (log, ADC, FPGA): channel 0 has the
+ * highest priority on the GPDMA, a memory copy only gets the bus the streams leave.
+ * @code
+ * dma_memcpy( row_buf.data, pending.data, sizeof(pending.data) );
+ * @endcode
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef DMA_COPY_H_
+#define DMA_COPY_H_
+
+/*! @brief Shorter copies are done by the CPU, setting the channel up takes about as long */
+#define DMA_COPY_MIN                64
+/*! @brief Longest wait for a copy in #dma_memcpy, it's then stopped and done by the CPU */
+#define DMA_COPY_TIMEOUT            ( 10 / portTICK_PERIOD_MS )
+
+/*! @brief End of an asynchronous copy, in the deferred work daemon
+ *
+ * @param ctx: Given to #dma_copy_async.
+ * @param ok: 1 if the copy is done, 0 on a GPDMA bus error (the destination holds a part of it).
+ */
+typedef void (* dma_copy_callback)( void * ctx, uint32_t ok );
+
+/*! @brief Takes the copy channel and its interrupt, once the peripheral streams have theirs
+ *
+ * The copies before are done by the CPU.
+ */
+void dma_copy_init( void );
+
+/*! @brief Copies len bytes, from a task (the scheduler running, not in a critical section)
+ *
+ * Blocks the calling task until the copy is done, without taking its notification.
+ */
+void dma_memcpy( void * dst, const void * src, uint32_t len );
+
+/*! @brief Starts copying len bytes, never blocks
+ *
+ * @param done: Called once it's over, not if the copy wasn't started.
+ * @return 1 if the GPDMA is copying, 0 if the copy isn't for it (too short, out of reach or the channel is busy):
+ *         nothing was copied, the caller copies itself
+ */
+uint8_t dma_copy_async( void * dst, const void * src, uint32_t len, dma_copy_callback done, void * ctx );
+
+/*! @brief DMA interrupt part, called by the handler shared with the ADC (adc.c) */
+void dma_copy_irq( void );
+
+#endif /*DMA_COPY_H_*/
@@ -0,0 +1,100 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file eeprom.h
+ *
+ * @brief Page writes to I2C EEPROMs (24Cxx), with ACK polling, on the asynchronous chains of i2c.h
+ *
+ * A write is split on the page boundaries of the device and each page goes out as its own chain. While the
+ * EEPROM programs a page it NACKs its address, so the next page is simply sent again until it's taken
+ * (#I2C_XFER_POLL, the NACKs don't count against the device): each page starts as soon as the write cycle
+ * of the one before it ends, instead of after the longest cycle of the datasheet. Every attempt is a chain
+ * queued behind the ones already there, so transfers to the other devices of the bus go on in between.
+ * After the last page one more poll (the word address alone, which doesn't program anything) waits for its
+ * cycle, so the write is on the device once the callback runs.
+ * @code
+ * static const eeprom_dev fru_eeprom = { .i2c_id = I2C1, .addr = 0x50, .addr_len = 1, .size = 256, .page = 8 };
+ * static eeprom_op op;
+ * eeprom_write( &op, &fru_eeprom, offset, data, len, write_done, NULL );
+ * @endcode
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef EEPROM_H_
+#define EEPROM_H_
+
+/*! @brief Largest page supported */
+#define EEPROM_PAGE_MAX             16
+/*! @brief Longest write cycle waited for (a 24Cxx takes 5 ms at most), in microseconds */
+#define EEPROM_WRITE_TIMEOUT_US     20000
+
+/*! @brief An EEPROM on an I2C bus */
+typedef struct eeprom_dev {
+    I2C_ID_T i2c_id;
+    uint8_t addr;                           /*!< Slave address (7 bit address) of the first block */
+    uint8_t addr_len;                       /*!< Word address bytes, 1 or 2. The bits above them (24C04 to 24C16)
+                                             *   go in the slave address */
+    uint16_t size;                          /*!< Bytes */
+    uint8_t page;                           /*!< Page size, a power of 2 up to #EEPROM_PAGE_MAX */
+} eeprom_dev;
+
+struct eeprom_op;
+
+/*! @brief End of a write, run by the deferred work daemon (see #xI2CTransferAsync)
+ *
+ * @param op: Write that ended, #eeprom_op.written bytes from its start are on the device.
+ * @param error: #i2c_err_SUCCESS, #i2c_err_TIMEOUT if the device never took a page within
+ * #EEPROM_WRITE_TIMEOUT_US, or the error of the transfer that failed.
+ */
+typedef void (* eeprom_callback)( struct eeprom_op * op, i2c_err error );
+
+/*! @brief A write in progress, owned by the driver from #eeprom_write to its callback */
+typedef struct eeprom_op {
+    const eeprom_dev * dev;
+    uint16_t offset;
+    const uint8_t * data;                   /*!< Read page by page as they go out, so it must stay around */
+    uint16_t len;
+    uint16_t written;                       /*!< Bytes the device took so far */
+    eeprom_callback callback;
+    void * ctx;                             /*!< Free for the owner */
+    uint16_t polls;                         /*!< Attempts NACKed by the device, busy with a write cycle */
+    /* Driver state */
+    uint8_t chunk;                          /*!< Bytes of the page on the bus, 0 for the last poll */
+    uint32_t deadline;                      /*!< Timestamp (timestamp.h) at which the device is given up */
+    xI2C_chain chain;
+    xI2C_xfer xfer;
+    uint8_t buf[2 + EEPROM_PAGE_MAX];       /*!< Word address, then the page */
+} eeprom_op;
+
+/*! @brief Starts a write, returns right away
+ *
+ * @param op: Descriptor of the write, it can't live in the caller stack.
+ * @param dev: Device written, registered with #xI2CRegisterDevice.
+ * @param offset: First byte written.
+ * @param data: Bytes to write, used until the callback runs.
+ * @param len: Number of bytes, 1 or more.
+ * @param callback: Run once the last page is written, or on the first error.
+ * @param ctx: Stored in the @c ctx field of the descriptor.
+ * @return 1 if the write started, 0 if it doesn't fit the device or the chain was refused
+ */
+uint8_t eeprom_write( eeprom_op * op, const eeprom_dev * dev, uint16_t offset, const uint8_t * data, uint16_t len,
+                      eeprom_callback callback, void * ctx );
+
+#endif /*EEPROM_H_*/
@@ -0,0 +1,83 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file ekey.h
+ *
+ * @brief AMC E-Keying (AMC.0 section 3.9): port states from the FRU connectivity records
+ *
+ * The links the module can carry are the link descriptors of its AMC Point-to-Point Connectivity records
+ * (#FRU_PICMG_P2P_CONNECTIVITY, read through the FRU multi-record index), and the ports of each one come
+ * from the channel descriptor of its AMC channel. The carrier manager enables and disables links with
+ * Set AMC Port State: each command only updates the wanted state, and #EKEY_APPLY_DELAY after the last one
+ * the ports the enabled links need are compared with the ones in effect and every switch register that
+ * changes is written in one I2C chain (#xI2CTransferAsync), so a burst of commands at activation costs one
+ * transaction. Leaving M4 disables every link.
+ *     A board with port switches describes them with EKEY_I2C and EKEY_PORTS( X ):
+ * X( port, address, register, bit ), one per AMC port behind a switch (bit set when the port is enabled);
+ * the devices must be on a bus the sensors bring up. Without them only the states are kept.
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef EKEY_H_
+#define EKEY_H_
+
+/*! @brief Most link descriptors kept, further ones are ignored */
+#define EKEY_LINKS_MAX              16
+/*! @brief Most AMC channels kept, links of further channels are ignored */
+#define EKEY_CHANNELS_MAX           16
+/*! @brief Longest connectivity record parsed */
+#define EKEY_RECORD_MAX             128
+/*! @brief Most switch registers written in one apply */
+#define EKEY_XFERS_MAX              8
+/*! @brief Time after the last Set AMC Port State before the switches are written */
+#define EKEY_APPLY_DELAY            ( 10 / portTICK_PERIOD_MS )
+/*! @brief Link Info of a connectivity record or of Set/Get AMC Port State: AMC channel ID in the low byte */
+#define EKEY_LINK_CHANNEL( info )   ( ( info ) & 0xFF )
+/*! @brief Lanes of a Link Info, bit n for lane n */
+#define EKEY_LINK_LANES( info )     ( ( ( info ) >> 8 ) & 0x0F )
+/*! @brief Links of one channel given back by #ekey_get_links (AMC.0 allows up to 4 per response) */
+#define EKEY_CHANNEL_LINKS_MAX      4
+/*! @brief AMC port of a lane that isn't used, in a channel descriptor */
+#define EKEY_PORT_UNUSED            0x1F
+
+/*! @brief Sets up the port switches, called once before the sensor buses come up */
+void ekey_init( void );
+
+/*! @brief Enables or disables a link (Set AMC Port State)
+ *
+ * @param info: Link Info, matched as a whole against the link descriptors.
+ * @param enable: 1 to enable it, 0 to disable it.
+ * @return 1 on success, 0 if the module has no such link
+ */
+uint8_t ekey_set_link( uint32_t info, uint8_t enable );
+
+/*! @brief Links of an AMC channel and their states (Get AMC Port State)
+ *
+ * @param channel: AMC channel ID.
+ * @param info: Gets the Link Info of up to #EKEY_CHANNEL_LINKS_MAX links.
+ * @param state: Gets their states, 1 enabled.
+ * @return Number of links, 0 if the channel has none
+ */
+uint8_t ekey_get_links( uint8_t channel, uint32_t * info, uint8_t * state );
+
+/*! @brief Disables every link, on deactivation */
+void ekey_disable_all( void );
+
+#endif /*EKEY_H_*/
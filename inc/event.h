@@ -0,0 +1,119 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file event.h
+ *
+ * @brief Platform Event messages sent to the event receiver
+ *
+ * Events are queued in a small ring and sent one at a time with the asynchronous IPMB API, so
+ * whoever posts them (the sensor poller) never waits for the bus, and the responses we owe the MCH
+ * never queue up behind a burst of events. An event is sent again until the receiver acknowledges
+ * it. While it waits, a newer event of the same sensor and offset takes the place of the queued one
+ * instead of adding another, so a sensor toggling quickly costs at most one queued event.
+ * The acknowledgements and the retries are processed by the IPMI dispatcher (#ipmi_defer), not in the IPMB
+ * or timer tasks they're signalled from.
+ *     Every event posted is also kept in a RAM history of the last #EVENT_HISTORY_LEN, sent or not (no receiver,
+ * queue full), for post-mortems that can't count on the SEL of the MCH. It's read in pages from a cursor with the
+ * custom Get Event History command (#event_history_read).
+ *
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef EVENT_H_
+#define EVENT_H_
+
+/*! @brief Events waiting to be acknowledged, further ones are dropped */
+#define EVENT_QUEUE_LEN             8
+/*! @brief First delay before sending an unacknowledged event again, doubled on each try */
+#define EVENT_RETRY_MIN             ( 500 / portTICK_PERIOD_MS )
+/*! @brief Longest delay between two tries */
+#define EVENT_RETRY_MAX             ( 8000 / portTICK_PERIOD_MS )
+/*! @brief Events kept in the history */
+#define EVENT_HISTORY_LEN           32
+
+/*! @name History record flags, see #event_record
+ * @{
+ */
+#define EVENT_HISTORY_UPTIME        0x01    /*!< Wall clock unknown, #event_record.time counts from boot */
+#define EVENT_HISTORY_NOT_SENT      0x02    /*!< Not queued for the receiver: events disabled or queue full */
+/*! @} */
+
+/*! @brief Receiver address that disables the event messages */
+#define EVENT_RECEIVER_DISABLED     0xFF
+
+/*! @brief Event Message revision of the Platform Event messages (IPMI 1.5 / 2.0) */
+#define EVENT_MSG_REV               0x04
+/*! @brief Event direction bit of #ipmi_event.dir_type */
+#define EVENT_DEASSERTION           0x80
+/*! @brief Event data 1 of a threshold event: trigger reading in byte 2, trigger threshold in byte 3 */
+#define EVENT_DATA1_THRESHOLD( offset ) ( 0x50 | ( offset ) )
+
+/*! @brief One event, as in the Platform Event request (IPMI 2.0 table 29-6) */
+typedef struct ipmi_event {
+    uint8_t sensor_type;
+    uint8_t sensor_num;
+    uint8_t dir_type;                       /*!< #EVENT_DEASSERTION and Event/Reading type */
+    uint8_t data[3];                        /*!< Event data 1 to 3 */
+} ipmi_event;
+
+/*! @brief Event of the history: the sensor type isn't kept, it's in the SDR of the sensor */
+typedef struct __attribute__ ((packed)) event_record {
+    uint32_t time;                          /*!< Seconds since 1970 (see wallclock.h), or since boot with #EVENT_HISTORY_UPTIME */
+    uint8_t flags;                          /*!< @ref EVENT_HISTORY_UPTIME "Flags" */
+    uint8_t sensor_num;
+    uint8_t dir_type;
+    uint8_t data[3];
+} event_record;
+
+/*! @brief Starts the event delivery, the IPMB layer must be up (see #ipmb_init) */
+void event_init( void );
+
+/*! @brief Queues an event for the receiver, never blocks
+ *
+ * @return 1 if the event was queued (or merged with a queued one of the same sensor and offset),
+ * 0 if the events are disabled or the queue is full
+ */
+uint8_t event_post( const ipmi_event * event );
+
+/*! @brief Sets the event receiver, as given to Set Event Receiver
+ *
+ * #EVENT_RECEIVER_DISABLED stops the events and drops the queued ones.
+ * @param addr: Receiver slave address (8 bit address).
+ * @param lun: Receiver LUN.
+ */
+void event_set_receiver( uint8_t addr, uint8_t lun );
+
+/*! @brief Copies records of the history, oldest first
+ *
+ *     The records are numbered by a 16 bit counter, from 0 at boot. A cursor older than the oldest record kept
+ * (records written over, or a cursor of another boot) starts at the oldest one.
+ * @param cursor: Number of the first record wanted, set to the number of the first one copied. The next page
+ * starts at the new value plus the count returned.
+ * @param records: Where to copy them to.
+ * @param max: Room in @p records.
+ * @return Records copied, 0 once the cursor reached the newest one
+ */
+uint8_t event_history_read( uint16_t * cursor, event_record * records, uint8_t max );
+
+/*! @brief Current event receiver address and LUN */
+void event_get_receiver( uint8_t * addr, uint8_t * lun );
+
+#endif /*EVENT_H_*/
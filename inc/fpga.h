@@ -0,0 +1,124 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file fpga.h
+ *
+ * @brief Payload FPGA configuration, streamed from its SPI flash
+ *
+ * The bitstream goes from the SPI flash (#FPGA_FLASH_SSP, one Read command for the whole of it) to the serial
+ * configuration port of the FPGA (#FPGA_CFG_SSP: DIN and CCLK, slave serial mode) by the GPDMA, through two
+ * #FPGA_BLOCK_LEN buffers in the AHB SRAM: while one block is sent to the FPGA the next one is read from the
+ * flash into the other buffer. The FPGA task only runs once per block, to start the next two transfers and
+ * add the block to the CRC-32 (as image_crc32) of the bitstream, so the load goes at the SSP clock.
+ *     A load pulses PROGRAM_B, waits for INIT_B to go high, streams the bitstream and clocks on until DONE
+ * goes high. INIT_B going low during the stream is the FPGA reporting a bitstream CRC error. The progress,
+ * CRC and outcome are read with #fpga_get_status (custom "FPGA Load" command).
+ *
+ *     Once configured, the FPGA exposes its own temperature, voltage and link status in a block of 16 bit
+ * registers read over SPI (#fpga_mbox_read): one command with the first register index, and the FPGA
+ * sends the registers that follow for as long as it's clocked. The sensor poller (sensor.c) reads all the
+ * #SENSOR_FPGA sensors that are due with a single such burst, moved by the GPDMA.
+ *
+ * Only built on a board with the FPGA configuration wired to the MMC, the variant header then defines
+ * #FPGA_CFG_SSP and the other FPGA_ constants (see board_defs.h), and #FPGA_MBOX_SSP for the mailbox.
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef FPGA_H_
+#define FPGA_H_
+
+/*! @brief FPGA task stack, in words */
+#define FPGA_STACK_DEPTH            ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Bytes of each of the two stream buffers, one DMA transfer each */
+#define FPGA_BLOCK_LEN              512
+/*! @brief SCK of both SSPs (the SSP can't go above PCLK / 2) */
+#define FPGA_SSP_CLOCK              25000000
+/*! @brief SPI flash Read command, followed by a 24 bit address */
+#define FPGA_FLASH_READ_CMD         0x03
+/*! @brief Longest time for INIT_B to go high after PROGRAM_B */
+#define FPGA_INIT_TIMEOUT           ( 100 / portTICK_PERIOD_MS )
+/*! @brief Longest time for a block to be read and the previous one sent */
+#define FPGA_BLOCK_TIMEOUT          ( 50 / portTICK_PERIOD_MS )
+/*! @brief Bytes of clocks sent after the bitstream, waiting for DONE (startup sequence) */
+#define FPGA_DONE_CLOCKS            64
+
+/*! @brief Mailbox burst read command, followed by the first register index */
+#define FPGA_MBOX_READ_CMD          0x0B
+/*! @brief Most registers read in one burst */
+#define FPGA_MBOX_REGS_MAX          32
+/*! @brief Longest wait for a burst (a few us at #FPGA_SSP_CLOCK, or the bus is held by a load) */
+#define FPGA_MBOX_TIMEOUT           ( 5 / portTICK_PERIOD_MS )
+
+/*! @brief Load states */
+typedef enum fpga_state {
+    FPGA_IDLE = 0,                          /*!< Never loaded since reset */
+    FPGA_LOADING,
+    FPGA_LOADED,                            /*!< DONE went high */
+    FPGA_FAILED,                            /*!< See #fpga_error */
+} fpga_state;
+
+/*! @brief Why a load failed */
+typedef enum fpga_error {
+    FPGA_ERR_NONE = 0,
+    FPGA_ERR_INIT,                          /*!< INIT_B didn't go high after PROGRAM_B */
+    FPGA_ERR_CRC,                           /*!< INIT_B went low, the FPGA found a CRC error in the bitstream */
+    FPGA_ERR_DONE,                          /*!< DONE didn't go high after the bitstream */
+    FPGA_ERR_DMA,                           /*!< A transfer timed out or got a bus error */
+} fpga_error;
+
+/*! @brief Progress and outcome of the last load */
+typedef struct fpga_status {
+    uint8_t state;                          /*!< #fpga_state */
+    uint8_t error;                          /*!< #fpga_error */
+    uint32_t sent;                          /*!< Bitstream bytes sent to the FPGA */
+    uint32_t len;                           /*!< Bitstream length */
+    uint32_t crc;                           /*!< CRC-32 of the bytes sent so far */
+    uint32_t elapsed_us;                    /*!< Load time so far (whole load once it's over) */
+} fpga_status;
+
+/*! @brief Sets the FPGA pins up and starts the FPGA task, nothing is done on a board without #FPGA_CFG_SSP */
+void fpga_init( void );
+
+/*! @brief Starts loading the FPGA, never blocks
+ *
+ * @param addr: Flash address of the bitstream.
+ * @param len: Bitstream length in bytes.
+ * @return 1 if the load is started, 0 if one is running already (or there's no FPGA)
+ */
+uint8_t fpga_load( uint32_t addr, uint32_t len );
+
+/*! @brief Copies the status of the last load */
+void fpga_get_status( fpga_status * status );
+
+/*! @brief Reads a block of FPGA registers in one burst, waiting for the DMA
+ *
+ * The registers are left where the DMA put them, 2 bytes each, MS byte first, and stay there until the
+ * next call: only one task (the sensor poller) reads the mailbox.
+ * @param first: Index of the first register.
+ * @param count: Registers to read, up to #FPGA_MBOX_REGS_MAX.
+ * @return The registers, NULL if the FPGA isn't configured, a load holds the bus, the burst timed out or
+ *         there's no mailbox on this board
+ */
+const uint8_t * fpga_mbox_read( uint8_t first, uint8_t count );
+
+/*! @brief DMA interrupt part of the loader, called by the handler shared with the ADC (adc.c) */
+void fpga_dma_irq( void );
+
+#endif /*FPGA_H_*/
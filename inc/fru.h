@@ -0,0 +1,243 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file fru.h
+ *
+ * @brief FRU inventory (Platform Management FRU Information Storage Definition v1.0)
+ *
+ * #FRU_IMAGE builds a whole FRU image (common header, board and product areas) as a const object:
+ * area lengths, offsets, padding and checksums are all computed by the compiler from the strings
+ * given, so nothing is assembled at boot. It is the default inventory, used when the FRU EEPROM
+ * doesn't hold a valid one.
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef FRU_H_
+#define FRU_H_
+
+/*! @brief FRU format version of the header and of every area */
+#define FRU_FORMAT_VERSION          0x01
+/*! @brief Areas and offsets are counted in blocks of this many bytes */
+#define FRU_BLOCK_SIZE              8
+/*! @brief Longest string accepted by #FRU_IMAGE */
+#define FRU_STR_MAX                 32
+/*! @brief Type/length byte of an 8-bit ASCII field */
+#define FRU_TYPE_LEN_ASCII( len )   ( 0xC0 | ( len ) )
+/*! @brief Type/length byte that ends the fields of an area */
+#define FRU_END_OF_FIELDS           0xC1
+/*! @brief English, the default language code */
+#define FRU_LANG_ENGLISH            0x00
+
+/*! @name Compile time helpers used by #FRU_IMAGE
+ * @{
+ */
+/* Byte i of a string literal, 0 past its end (a constant expression for the compiler) */
+#define FRU_STR_BYTE( s, i )        ( ( (i) < sizeof(s) - 1 ) ? (uint8_t)( s )[i] : 0 )
+/* Sum of the bytes of a string literal of up to FRU_STR_MAX characters */
+#define FRU_STR_SUM( s )                                                                        \
+    ( FRU_STR_BYTE( s, 0 ) + FRU_STR_BYTE( s, 1 ) + FRU_STR_BYTE( s, 2 ) + FRU_STR_BYTE( s, 3 ) +       \
+      FRU_STR_BYTE( s, 4 ) + FRU_STR_BYTE( s, 5 ) + FRU_STR_BYTE( s, 6 ) + FRU_STR_BYTE( s, 7 ) +       \
+      FRU_STR_BYTE( s, 8 ) + FRU_STR_BYTE( s, 9 ) + FRU_STR_BYTE( s, 10 ) + FRU_STR_BYTE( s, 11 ) +     \
+      FRU_STR_BYTE( s, 12 ) + FRU_STR_BYTE( s, 13 ) + FRU_STR_BYTE( s, 14 ) + FRU_STR_BYTE( s, 15 ) +   \
+      FRU_STR_BYTE( s, 16 ) + FRU_STR_BYTE( s, 17 ) + FRU_STR_BYTE( s, 18 ) + FRU_STR_BYTE( s, 19 ) +   \
+      FRU_STR_BYTE( s, 20 ) + FRU_STR_BYTE( s, 21 ) + FRU_STR_BYTE( s, 22 ) + FRU_STR_BYTE( s, 23 ) +   \
+      FRU_STR_BYTE( s, 24 ) + FRU_STR_BYTE( s, 25 ) + FRU_STR_BYTE( s, 26 ) + FRU_STR_BYTE( s, 27 ) +   \
+      FRU_STR_BYTE( s, 28 ) + FRU_STR_BYTE( s, 29 ) + FRU_STR_BYTE( s, 30 ) + FRU_STR_BYTE( s, 31 ) )
+/* Characters of a string literal (compile error past FRU_STR_MAX) */
+#define FRU_STR_LEN( s )            ( ( sizeof(s) - 1 <= FRU_STR_MAX ) ? sizeof(s) - 1 : -1 )
+/* Sum of a whole field: type/length byte and characters */
+#define FRU_FIELD_SUM( s )          ( FRU_TYPE_LEN_ASCII( sizeof(s) - 1 ) + FRU_STR_SUM( s ) )
+/* Zero checksum of a byte sum */
+#define FRU_CHECKSUM( sum )         ( (uint8_t)( 0x100 - ( ( sum ) & 0xFF ) ) )
+/* Area length rounded up to whole blocks */
+#define FRU_BLOCKS( len )           ( ( ( len ) + FRU_BLOCK_SIZE - 1 ) / FRU_BLOCK_SIZE )
+#define FRU_PAD( len )              ( FRU_BLOCKS( len ) * FRU_BLOCK_SIZE - ( len ) )
+
+/* Field declaration and initialization inside the image struct */
+#define FRU_FIELD( f, s )           uint8_t f##_tl; char f[FRU_STR_LEN( s )];
+#define FRU_FIELD_INIT( f, s )      .f##_tl = FRU_TYPE_LEN_ASCII( sizeof(s) - 1 ), .f = s,
+
+/* Board area: version, length, language, manufacturing date (3), 4 fields, empty FRU file ID, end, checksum */
+#define FRU_BOARD_RAW( mfg, name, serial, part ) \
+    ( 6 + 4 + sizeof(mfg) - 1 + sizeof(name) - 1 + sizeof(serial) - 1 + sizeof(part) - 1 + 3 )
+/* Product area: version, length, language, 5 fields, empty asset tag and FRU file ID, end, checksum */
+#define FRU_PRODUCT_RAW( mfg, name, part, ver, serial ) \
+    ( 3 + 5 + sizeof(mfg) - 1 + sizeof(name) - 1 + sizeof(part) - 1 + sizeof(ver) - 1 + sizeof(serial) - 1 + 4 )
+/*! @} */
+
+/*! @brief Declares a const FRU image
+ *
+ *     The image has a common header, a board info area and a product info area, in this order,
+ * made of 8-bit ASCII strings of up to #FRU_STR_MAX characters. The manufacturing date is left
+ * unspecified and the asset tag and FRU file ID fields empty.
+ *
+ * @code
+ * FRU_IMAGE( board_fru, "LNLS", "AFC", "00001", "AFC-V3",
+ *                       "LNLS", "AFC", "AFC-V3", "3.0", "00001" );
+ * @endcode
+ */
+#define FRU_IMAGE( var, b_mfg, b_name, b_serial, b_part, p_mfg, p_name, p_part, p_ver, p_serial )            \
+    static const struct __attribute__ ((packed)) {                                                       \
+        uint8_t header[FRU_BLOCK_SIZE];                                                                  \
+        uint8_t b_head[6];                                                                               \
+        FRU_FIELD( b_mfg_f, b_mfg ) FRU_FIELD( b_name_f, b_name )                                        \
+        FRU_FIELD( b_serial_f, b_serial ) FRU_FIELD( b_part_f, b_part )                                  \
+        uint8_t b_tail[2];                                                                               \
+        uint8_t b_pad[FRU_PAD( FRU_BOARD_RAW( b_mfg, b_name, b_serial, b_part ) )];                      \
+        uint8_t b_checksum;                                                                              \
+        uint8_t p_head[3];                                                                               \
+        FRU_FIELD( p_mfg_f, p_mfg ) FRU_FIELD( p_name_f, p_name ) FRU_FIELD( p_part_f, p_part )          \
+        FRU_FIELD( p_ver_f, p_ver ) FRU_FIELD( p_serial_f, p_serial )                                    \
+        uint8_t p_tail[3];                                                                               \
+        uint8_t p_pad[FRU_PAD( FRU_PRODUCT_RAW( p_mfg, p_name, p_part, p_ver, p_serial ) )];             \
+        uint8_t p_checksum;                                                                              \
+    } var = {                                                                                            \
+        .header = { FRU_FORMAT_VERSION, 0, 0, 1,                                                         \
+                    1 + FRU_BLOCKS( FRU_BOARD_RAW( b_mfg, b_name, b_serial, b_part ) ), 0, 0,            \
+                    FRU_CHECKSUM( FRU_FORMAT_VERSION + 1 + 1 +                                           \
+                                  FRU_BLOCKS( FRU_BOARD_RAW( b_mfg, b_name, b_serial, b_part ) ) ) },    \
+        .b_head = { FRU_FORMAT_VERSION, FRU_BLOCKS( FRU_BOARD_RAW( b_mfg, b_name, b_serial, b_part ) ),  \
+                    FRU_LANG_ENGLISH, 0, 0, 0 },                                                         \
+        FRU_FIELD_INIT( b_mfg_f, b_mfg ) FRU_FIELD_INIT( b_name_f, b_name )                              \
+        FRU_FIELD_INIT( b_serial_f, b_serial ) FRU_FIELD_INIT( b_part_f, b_part )                        \
+        .b_tail = { FRU_TYPE_LEN_ASCII( 0 ), FRU_END_OF_FIELDS },                                        \
+        .b_checksum = FRU_CHECKSUM( FRU_FORMAT_VERSION +                                                 \
+                                    FRU_BLOCKS( FRU_BOARD_RAW( b_mfg, b_name, b_serial, b_part ) ) +     \
+                                    FRU_FIELD_SUM( b_mfg ) + FRU_FIELD_SUM( b_name ) +                   \
+                                    FRU_FIELD_SUM( b_serial ) + FRU_FIELD_SUM( b_part ) +                \
+                                    FRU_TYPE_LEN_ASCII( 0 ) + FRU_END_OF_FIELDS ),                       \
+        .p_head = { FRU_FORMAT_VERSION,                                                                  \
+                    FRU_BLOCKS( FRU_PRODUCT_RAW( p_mfg, p_name, p_part, p_ver, p_serial ) ),             \
+                    FRU_LANG_ENGLISH },                                                                  \
+        FRU_FIELD_INIT( p_mfg_f, p_mfg ) FRU_FIELD_INIT( p_name_f, p_name )                              \
+        FRU_FIELD_INIT( p_part_f, p_part ) FRU_FIELD_INIT( p_ver_f, p_ver )                              \
+        FRU_FIELD_INIT( p_serial_f, p_serial )                                                           \
+        .p_tail = { FRU_TYPE_LEN_ASCII( 0 ), FRU_TYPE_LEN_ASCII( 0 ), FRU_END_OF_FIELDS },               \
+        .p_checksum = FRU_CHECKSUM( FRU_FORMAT_VERSION +                                                 \
+                                    FRU_BLOCKS( FRU_PRODUCT_RAW( p_mfg, p_name, p_part, p_ver, p_serial ) ) + \
+                                    FRU_FIELD_SUM( p_mfg ) + FRU_FIELD_SUM( p_name ) +                   \
+                                    FRU_FIELD_SUM( p_part ) + FRU_FIELD_SUM( p_ver ) +                   \
+                                    FRU_FIELD_SUM( p_serial ) +                                          \
+                                    2 * FRU_TYPE_LEN_ASCII( 0 ) + FRU_END_OF_FIELDS ),                   \
+    }
+
+/*! @name FRU EEPROM (24C02 like: 256 bytes, 8 byte pages, one address byte)
+ * @{
+ */
+#define FRU_EEPROM_I2C              I2C1
+#define FRU_EEPROM_ADDR             0x50
+#define FRU_EEPROM_SIZE             256
+#define FRU_EEPROM_PAGE             8
+/*! @} */
+/*! @brief Bytes read from the EEPROM in each transfer of the boot load */
+#define FRU_LOAD_CHUNK              16
+/*! @brief Writes are held this long before going to the EEPROM, so a burst of Write FRU Data is committed once */
+#define FRU_FLUSH_DELAY             (100/portTICK_PERIOD_MS)
+/*! @brief Delay before writing again pages whose write failed */
+#define FRU_WRITE_RETRY             (100/portTICK_PERIOD_MS)
+/*! @brief Time between checks of the RAM copy against its checksums (background job, see idle_job.h) */
+#define FRU_CHECK_PERIOD            (60000/portTICK_PERIOD_MS)
+
+/*! @name Multi-record area
+ * @{
+ */
+#define FRU_MR_HEADER_LEN           5       /*!< Type, end of list/version, length, record and header checksums */
+#define FRU_MR_END_OF_LIST          0x80
+#define FRU_MR_VERSION              0x02
+#define FRU_MR_TYPE_OEM             0xC0    /*!< Manufacturer ID (3 bytes, LS first), then record ID and data */
+/*! @brief Slots of the RAM index of the OEM records, the most records indexed */
+#define FRU_MR_INDEX_LEN            8
+/*! @} */
+
+/*! @name PICMG records (AMC.0), in OEM records with the PICMG manufacturer ID
+ * @{
+ */
+#define FRU_PICMG_MFG_ID            0x00315A
+#define FRU_PICMG_MODULE_CURRENT    0x16
+#define FRU_PICMG_P2P_CONNECTIVITY  0x19
+#define FRU_PICMG_CLOCK_CONFIG      0x2D
+/*! @} */
+
+/*! @brief Where the inventory served by the FRU commands came from */
+typedef enum {
+    FRU_SOURCE_LOADING = 0,                 /*!< Still being read from the EEPROM */
+    FRU_SOURCE_EEPROM,                      /*!< Valid image read from the EEPROM */
+    FRU_SOURCE_DEFAULT                      /*!< EEPROM missing, blank or corrupted: #fru_default_image */
+} fru_source;
+
+/*! @brief Starts loading the FRU inventory
+ *
+ *     The EEPROM is read once, with an asynchronous I2C chain, into a RAM copy that serves every
+ * later read. The image is used if its header and area checksums are right; otherwise the
+ * default image is served instead (and written to the EEPROM if it was blank). Every #FRU_CHECK_PERIOD
+ * the idle task checks the RAM copy again, one area at a time, and logs a checksum gone wrong.
+ * Must be called after the EEPROM bus is initialized.
+ */
+void fru_init( void );
+
+/*! @brief Where the current inventory comes from */
+fru_source fru_get_source( void );
+
+/*! @brief Size of the FRU inventory area in bytes */
+uint16_t fru_size( void );
+
+/*! @brief Copies part of the FRU inventory (from RAM)
+ *
+ * @param offset: First byte to copy.
+ * @param data: Destination buffer.
+ * @param count: Bytes to copy, cut at the end of the inventory.
+ * @return Bytes copied, 0 while the inventory is still loading
+ */
+uint8_t fru_read( uint16_t offset, uint8_t * data, uint8_t count );
+
+/*! @brief Changes part of the FRU inventory
+ *
+ *     The RAM copy is updated at once. The EEPROM is written behind, #FRU_FLUSH_DELAY after the
+ * last change, one page per modified page no matter how many writes touched it.
+ *
+ * @param offset: First byte to write.
+ * @param data: New contents.
+ * @param count: Bytes to write, cut at the end of the inventory.
+ * @return Bytes written, 0 while the inventory is still loading
+ */
+uint8_t fru_write( uint16_t offset, const uint8_t * data, uint8_t count );
+
+/*! @brief Copies an OEM multi-record (E-Keying, clock configuration...) from the RAM copy
+ *
+ *     The multi-record area is walked once, when the inventory is loaded (and again on the first lookup after
+ * a Write FRU Data), into a small hashed index of the OEM records whose checksums are right, so a lookup
+ * doesn't walk the list or check sums again.
+ * @param mfg_id: Manufacturer ID of the record, e.g. #FRU_PICMG_MFG_ID.
+ * @param record_id: Record ID under that manufacturer, e.g. #FRU_PICMG_P2P_CONNECTIVITY.
+ * @param instance: Which one of the records with this ID, in the order of the area (0 for the first one).
+ * @param data: Destination buffer, gets the record data from the manufacturer ID on (no record header).
+ * @param max: Size of @p data, a longer record is cut.
+ * @return Bytes of the record data (even past @p max), 0 if there's no such record
+ */
+uint8_t fru_get_record( uint32_t mfg_id, uint8_t record_id, uint8_t instance, uint8_t * data, uint8_t max );
+
+/*! @brief Default FRU image of the board, built at compile time
+ *
+ * @param len: Filled with the image length.
+ * @return Image in flash
+ */
+const uint8_t * fru_default_image( uint16_t * len );
+
+#endif /*FRU_H_*/
@@ -0,0 +1,108 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file gpio.h
+ *
+ * @brief Single access GPIO reads and writes, for the pins of board_defs.h
+ *
+ * The LPCOpen pin functions take the port and pin at run time and update the registers with a read,
+ * modify and write (FIOSET |= mask): an interrupt changing another pin of the same port in between has
+ * its change undone. These are inlined (even at -O0) and touch the pin with a single access:
+ * - writes go to FIOSET or FIOCLR (or to the bit-band alias of FIODIR), which only affect the pin itself;
+ * - reads come from the bit-band alias of FIOPIN, one load giving 0 or 1.
+ *
+ * The GPIO block sits in the SRAM bit-band region (0x20000000 to 0x200FFFFF), so each bit of its
+ * registers also has its own word in the alias region at 0x22000000. With the port and pin constant, as
+ * with the board_defs.h names through the GPIO_PIN_* macros, the address is folded at compile time.
+ * @code
+ * GPIO_PIN_SET( ledBLUE );
+ * closed = !GPIO_PIN_READ( HOT_SWAP_HANDLE );
+ * @endcode
+ * @warning Must be included after chip.h
+ */
+
+#ifndef GPIO_H_
+#define GPIO_H_
+
+/*! @brief Word at the bit-band alias of bit @p bit of the SRAM region register @p reg */
+#define GPIO_BITBAND( reg, bit )    ( *(volatile uint32_t *) ( 0x22000000 + \
+                                       ( ( (uint32_t) &( reg ) - 0x20000000 ) << 5 ) + ( ( bit ) << 2 ) ) )
+
+/*! @brief Sets a pin high */
+static inline __attribute__ ((always_inline)) void gpio_set( uint8_t port, uint8_t pin )
+{
+    LPC_GPIO[port].SET = 1UL << pin;
+}
+
+/*! @brief Sets a pin low */
+static inline __attribute__ ((always_inline)) void gpio_clear( uint8_t port, uint8_t pin )
+{
+    LPC_GPIO[port].CLR = 1UL << pin;
+}
+
+/*! @brief Sets a pin high (@p value not 0) or low */
+static inline __attribute__ ((always_inline)) void gpio_write( uint8_t port, uint8_t pin, uint8_t value )
+{
+    if ( value ) {
+        gpio_set( port, pin );
+    } else {
+        gpio_clear( port, pin );
+    }
+}
+
+/*! @brief Level at a pin, 0 or 1 */
+static inline __attribute__ ((always_inline)) uint8_t gpio_read( uint8_t port, uint8_t pin )
+{
+    return GPIO_BITBAND( LPC_GPIO[port].PIN, pin );
+}
+
+/*! @brief Inverts the output of a pin
+ *
+ * The port has no toggle register: the output latch is read (FIOSET reads it back) and the pin is then
+ * set or cleared, so the other pins are never touched. Two writers toggling the same pin still race.
+ */
+static inline __attribute__ ((always_inline)) void gpio_toggle( uint8_t port, uint8_t pin )
+{
+    if ( GPIO_BITBAND( LPC_GPIO[port].SET, pin ) ) {
+        gpio_clear( port, pin );
+    } else {
+        gpio_set( port, pin );
+    }
+}
+
+/*! @brief Makes a pin an output (@p output not 0) or an input */
+static inline __attribute__ ((always_inline)) void gpio_set_dir( uint8_t port, uint8_t pin, uint8_t output )
+{
+    GPIO_BITBAND( LPC_GPIO[port].DIR, pin ) = ( output != 0 );
+}
+
+/*! @name Pins by their board_defs.h name (name##_PORT and name##_PIN)
+ * @{
+ */
+#define GPIO_PIN_SET( name )            gpio_set( name##_PORT, name##_PIN )
+#define GPIO_PIN_CLEAR( name )          gpio_clear( name##_PORT, name##_PIN )
+#define GPIO_PIN_WRITE( name, value )   gpio_write( name##_PORT, name##_PIN, value )
+#define GPIO_PIN_READ( name )           gpio_read( name##_PORT, name##_PIN )
+#define GPIO_PIN_TOGGLE( name )         gpio_toggle( name##_PORT, name##_PIN )
+#define GPIO_PIN_SET_DIR( name, output ) gpio_set_dir( name##_PORT, name##_PIN, output )
+/*! @} */
+
+#endif /*GPIO_H_*/
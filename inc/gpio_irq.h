@@ -0,0 +1,65 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file gpio_irq.h
+ *
+ * @brief GPIO edge interrupts, shared by the pins of ports 0 and 2
+ *
+ * All the GPIO interrupts come through EINT3. Each module registers the pins it watches with a
+ * handler, and the edges are masked and unmasked per pin, from a task or an interrupt.
+ */
+
+#ifndef GPIO_IRQ_H_
+#define GPIO_IRQ_H_
+
+/*! @brief Most pins watched */
+#define GPIO_IRQ_MAX                8
+
+/*! @name Edges, for #gpio_irq_enable
+ * @{
+ */
+#define GPIO_IRQ_NONE               0x00
+#define GPIO_IRQ_RISING             0x01
+#define GPIO_IRQ_FALLING            0x02
+#define GPIO_IRQ_BOTH               ( GPIO_IRQ_RISING | GPIO_IRQ_FALLING )
+/*! @} */
+
+/*! @brief Called from EINT3 on an enabled edge of the pin, may use the FromISR APIs
+ *
+ * @param arg: Argument given to #gpio_irq_register.
+ * @param woken: Set to pdTRUE to switch context on return.
+ */
+typedef void (* gpio_irq_handler)( void * arg, portBASE_TYPE * woken );
+
+/*! @brief Registers the handler of a pin, with its edges masked, before the scheduler starts
+ *
+ * @param port: 0 or 2, the only ports with interrupts.
+ * @return 1 on success, 0 if the port has no interrupts or #GPIO_IRQ_MAX pins are already registered
+ */
+uint8_t gpio_irq_register( uint8_t port, uint8_t pin, gpio_irq_handler handler, void * arg );
+
+/*! @brief Unmasks the given edges of a pin (#GPIO_IRQ_NONE masks it), from a task or an interrupt
+ *
+ * Edges that happened while the pin was masked are forgotten.
+ */
+void gpio_irq_enable( uint8_t port, uint8_t pin, uint8_t edges );
+
+#endif /*GPIO_IRQ_H_*/
@@ -0,0 +1,109 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file hotswap.h
+ *
+ * @brief AMC hot swap handle and M-state machine
+ *
+ * The handle switch raises a GPIO interrupt on both edges. The first edge masks the pin interrupt
+ * and starts a one-shot debounce timer; when it expires (#HOTSWAP_DEBOUNCE later, in the timer task)
+ * the pin is unmasked and read, and a level different from the last debounced one goes straight to
+ * the hot swap state machine. So a handle operation costs one interrupt and one timer run whatever the
+ * switch bounces, and nothing runs while the handle is left alone.
+ *     The M-states (PICMG 3.0 section 3.2.4) are run by a transition table: each (state, event) pair
+ * found in it gives the next state and an optional action, any other event is ignored. The machine only
+ * runs in the timer task (the handle debounce already does, the IPMI commands pend a call there with
+ * #hotswap_post), so the events are serialized without a lock and never wait for each other. Entering a
+ * state sets the blue LED pattern of that state and sends a FRU Hot Swap event from the #SENSOR_HOT_SWAP
+ * sensor, with the cause of the change.
+ *     Activation and deactivation hand the payload rails to the sequencer (payload.h), whose done
+ * callback feeds #HOTSWAP_EVT_ACTIVATED, #HOTSWAP_EVT_ACTIVATION_FAILED or #HOTSWAP_EVT_DEACTIVATED
+ * back into the machine, so M3 and M6 last as long as the rails take.
+ */
+
+#ifndef HOTSWAP_H_
+#define HOTSWAP_H_
+
+/*! @brief Time the handle must settle before its level is taken */
+#define HOTSWAP_DEBOUNCE            ( 30 / portTICK_PERIOD_MS )
+
+/*! @brief Sensor type of the FRU Hot Swap sensor */
+#define HOTSWAP_SENSOR_TYPE         0xF0
+
+/*! @brief M-states */
+typedef enum hotswap_state {
+    HOTSWAP_M0,                             /*!< Not installed */
+    HOTSWAP_M1,                             /*!< Inactive */
+    HOTSWAP_M2,                             /*!< Activation request */
+    HOTSWAP_M3,                             /*!< Activation in progress */
+    HOTSWAP_M4,                             /*!< Active */
+    HOTSWAP_M5,                             /*!< Deactivation request */
+    HOTSWAP_M6,                             /*!< Deactivation in progress */
+    HOTSWAP_M7,                             /*!< Communication lost */
+} hotswap_state;
+
+/*! @brief Inputs of the state machine */
+typedef enum hotswap_event {
+    HOTSWAP_EVT_NONE,
+    HOTSWAP_EVT_INSERTED,                   /*!< Power up, the module sits in its slot */
+    HOTSWAP_EVT_HANDLE_CLOSED,
+    HOTSWAP_EVT_HANDLE_OPENED,
+    HOTSWAP_EVT_ACTIVATE,                   /*!< Set FRU Activation (activate) */
+    HOTSWAP_EVT_DEACTIVATE,                 /*!< Set FRU Activation (deactivate) */
+    HOTSWAP_EVT_ACTIVATED,                  /*!< The payload is up */
+    HOTSWAP_EVT_DEACTIVATED,                /*!< The payload is down */
+    HOTSWAP_EVT_ACTIVATION_FAILED,          /*!< A payload rail didn't come up (or the sequence couldn't start) */
+    HOTSWAP_EVT_COLD_RESET,                 /*!< FRU Control (cold reset) */
+    HOTSWAP_EVT_COUNT
+} hotswap_event;
+
+/*! @name Causes of a state change, in the Hot Swap events (PICMG 3.0 table 3-20)
+ * @{
+ */
+#define HOTSWAP_CAUSE_NORMAL        0x0
+#define HOTSWAP_CAUSE_SHELF_MANAGER 0x1
+#define HOTSWAP_CAUSE_HANDLE        0x2
+#define HOTSWAP_CAUSE_UNEXPECTED    0x9     /*!< Unexpected deactivation */
+/*! @} */
+
+/*! @brief Configures the handle pin and its interrupt and starts the state machine, before the scheduler starts
+ *
+ * The machine leaves M0 once the scheduler runs, after the event receiver is set up.
+ */
+void hotswap_init( void );
+
+/*! @brief Last debounced handle level: 1 if closed, 0 if open */
+uint8_t hotswap_handle_closed( void );
+
+/*! @brief Debounced handle changes since #hotswap_init */
+uint32_t hotswap_handle_changes( void );
+
+/*! @brief Current M-state */
+hotswap_state hotswap_get_state( void );
+
+/*! @brief Feeds an event to the state machine, never blocks
+ *
+ * The event runs later in the timer task, in the order posted.
+ * @return 1 if the event was queued, 0 if the timer command queue is full
+ */
+uint8_t hotswap_post( hotswap_event event );
+
+#endif /*HOTSWAP_H_*/
@@ -0,0 +1,163 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file hpm.h
+ *
+ * @brief HPM.1 firmware upgrade of the MMC over IPMB
+ *
+ * The new image is uploaded into the slot the MMC isn't running from (see image.h), and Activate
+ * Firmware only writes that slot's header and resets into it through the boot loader. The IPMI
+ * handlers never touch the flash: Initiate Upgrade Action hands the erase of the slot to the HPM task
+ * and answers "in progress" right away, and the uploaded blocks are gathered in one of #HPM_BUFFERS
+ * RAM buffers of #HPM_WRITE_CHUNK bytes. A full buffer goes to the HPM task, which writes it with
+ * #image_flash_write while the next blocks fill the other one, so the upload runs at the pace of the
+ * IPMB link. Only when both buffers are waiting for the flash is a block answered NODE_BUSY, to be
+ * sent again.
+ *     Flash can't be read while IAP erases or writes it, so each IAP call runs with the interrupts
+ * disabled (the IAP ROM code also takes the top 32 bytes of RamLoc16, which is the interrupt stack,
+ * unused then). The sectors are erased one at a time and only if they aren't blank already, to keep
+ * those windows short.
+ *     The upload file is the image with its #image_header appended (tools/image_header.py). Finish
+ * Firmware Upload checks the whole image against the CRC of that header; the header row itself is
+ * only written by Activate Firmware, with the next sequence number, so a slot never looks newer than
+ * the running one before it's complete. Until the new image confirms itself the boot loader rolls
+ * back to the old one on the next reset.
+ *     A patch release mostly matches the running image, so the upload can be a delta (#hpm_delta): after
+ * Initiate Upgrade Action the host sends the CRC-32 of each #HPM_WRITE_CHUNK chunk of the upload file, and the
+ * chunks the running image already holds are copied from it by the HPM task instead of uploaded. The images are
+ * linked for their own slot, so the running one is compared (and copied) with its addresses into its slot moved
+ * to the other slot. The upload then only carries the chunks that differ, back to back, and Finish Firmware Upload
+ * checks the whole image as usual, so a wrong guess costs a failed check and never a bad image.
+ *     The upload can also be compressed (the .upz of tools/image_header.py): a first block starting with
+ * #HPM_Z_MAGIC is followed by the length of the upload file, then the file as one LZ4 block, decompressed
+ * block by block straight into the RAM buffers (lz4_stream.h). A match is read back from the buffers, or from
+ * the slot once they're written, so there's no window to keep. A block that expands past what the buffers can
+ * take is answered NODE_BUSY: the decoder stops where it is and picks up from there when it's sent again. The
+ * Finish Firmware Upload length is then the compressed one. A compressed upload can't follow a delta manifest.
+ */
+
+#ifndef HPM_H_
+#define HPM_H_
+
+/*! @brief HPM task stack, in words */
+#define HPM_STACK_DEPTH             ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Bytes written to flash at once, one of the sizes Chip_IAP_CopyRamToFlash takes (256, 512, 1024 or 4096) */
+#define HPM_WRITE_CHUNK             256
+/*! @brief RAM buffers the upload is gathered in, one filled while the others are written */
+#define HPM_BUFFERS                 2
+/*! @brief Time for the Activate Firmware response to go out before the reset */
+#define HPM_ACTIVATE_DELAY          ( 100 / portTICK_PERIOD_MS )
+/*! @brief Time between checks of the running image against the CRC of its header (background job, see idle_job.h) */
+#define HPM_SCRUB_PERIOD            ( 600000 / portTICK_PERIOD_MS )
+/*! @brief Bytes of the running image added to the CRC in each slice of the check, a few microseconds of bitwise CRC */
+#define HPM_SCRUB_SLICE             16
+
+/*! @brief Component IDs are the image slots, only the one not running can be upgraded */
+#define HPM_COMPONENT( slot )       ( 1 << ( slot ) )
+
+/*! @name Initiate Upgrade Action actions
+ * @{
+ */
+#define HPM_ACTION_BACKUP           0x00    /*!< Not supported, the running slot is the backup */
+#define HPM_ACTION_PREPARE          0x01    /*!< Erases the slot */
+#define HPM_ACTION_UPLOAD           0x02    /*!< Erases the slot and expects the upload */
+#define HPM_ACTION_COMPARE          0x03    /*!< Not supported */
+/*! @} */
+
+/*! @name HPM.1 completion codes
+ * @{
+ */
+#define HPM_CC_IN_PROGRESS          0x80    /*!< Long command going on, see Get Upgrade Status */
+#define HPM_CC_INVALID_LENGTH       0x81    /*!< Finish Firmware Upload: length isn't what was uploaded */
+#define HPM_CC_CHECKSUM             0x82    /*!< Finish Firmware Upload: image doesn't match its header, or not written */
+/*! @} */
+
+/*! @brief Creates the HPM task and its queue, and starts the background check of the running image
+ *
+ * Every #HPM_SCRUB_PERIOD the idle task runs the CRC of the running slot again, #HPM_SCRUB_SLICE bytes
+ * at a time, and logs an image that no longer matches its header (the flash wearing out).
+ */
+void hpm_init( void );
+
+/*! @brief First word of a compressed upload, "AFCZ" */
+#define HPM_Z_MAGIC                 0x5A434641
+/*! @brief Bytes before the LZ4 block of a compressed upload: magic and length of the upload file */
+#define HPM_Z_HEADER_LEN            8
+
+/*! @brief Chunk CRCs in each delta manifest request */
+#define HPM_DELTA_CRCS              5
+
+/*! @brief Upgradable components: the slot not running, none if the MMC was started without the boot loader */
+uint8_t hpm_components( void );
+
+/*! @brief Initiate Upgrade Action, from the IPMI task
+ *
+ * @param components: Bitmask of components, only #hpm_components is accepted.
+ * @param action: One of the HPM_ACTION_ values.
+ * @return IPMI completion code, #HPM_CC_IN_PROGRESS while the erase is done
+ */
+uint8_t hpm_initiate( uint8_t components, uint8_t action );
+
+/*! @brief Upload Firmware Block, from the IPMI task
+ *
+ * Blocks are numbered from 0 after Initiate Upgrade Action, wrapping at 256. The last block can be
+ * sent again (its response was lost), it's acknowledged without being written twice.
+ * @return IPMI completion code, IPMI_CC_NODE_BUSY if the block must be sent again later
+ */
+uint8_t hpm_upload( uint8_t block, const uint8_t * data, uint8_t len );
+
+/*! @brief Delta manifest, from the IPMI task: chunks of the upload file that can be copied from the running image
+ *
+ * The chunks are numbered from 0 after Initiate Upgrade Action and come in order, all of them before the first
+ * block: the uploaded blocks then only hold the chunks left out, back to back. The last request can be sent again
+ * (its response was lost), it gets the same answer.
+ * @param first: First chunk.
+ * @param crcs: CRC-32 (as #image_crc32) of each chunk, LS byte first.
+ * @param count: Chunks, 1 to #HPM_DELTA_CRCS.
+ * @param match: Set to the chunks the running image holds, bit i for chunk @p first + i.
+ * @return IPMI completion code, IPMI_CC_NODE_BUSY if the request must be sent again later
+ */
+uint8_t hpm_delta( uint16_t first, const uint8_t * crcs, uint8_t count, uint8_t * match );
+
+/*! @brief Finish Firmware Upload, from the IPMI task
+ *
+ * @param len: Upload length (image and header), must be the number of bytes uploaded or copied (compressed bytes
+ * for a compressed upload).
+ * @return IPMI completion code, #HPM_CC_IN_PROGRESS while the last writes and the check are done
+ */
+uint8_t hpm_finish( uint8_t component, uint32_t len );
+
+/*! @brief Abort Firmware Upgrade, from the IPMI task
+ *
+ * @return IPMI completion code, #HPM_CC_IN_PROGRESS while the HPM task is busy with a long command
+ */
+uint8_t hpm_abort( void );
+
+/*! @brief Activate Firmware, from the IPMI task: the uploaded slot gets its header and the MMC resets into it shortly after
+ *
+ * @return IPMI completion code
+ */
+uint8_t hpm_activate( void );
+
+/*! @brief Get Upgrade Status: last long command and its completion code (#HPM_CC_IN_PROGRESS while it runs) */
+void hpm_get_status( uint8_t * cmd, uint8_t * cc );
+
+#endif /*HPM_H_*/
@@ -31,6 +31,31 @@
 /*! @brief Max message length (in bits) used in I2C */
 #define i2cMAX_MSG_LENGTH           32
 
+/*! @brief Standard-mode SCL frequency, used by IPMB-L and by buses with no registered devices */
+#define I2C_STANDARD_MODE_CLOCK     100000
+/*! @brief Fast-mode SCL frequency, the highest one supported by the driver */
+#define I2C_FAST_MODE_CLOCK         400000
+/*! @brief Slack added to the transfer time computed from its length (clock stretching, arbitration)
+ * @see #i2c_err_TIMEOUT
+ */
+#define I2C_TIMEOUT_MARGIN          (10/portTICK_PERIOD_MS)
+/*! @brief Times a master transfer is restarted after losing arbitration before failing with #i2c_err_FAILURE */
+#define I2C_ARB_LOST_RETRIES        4
+/*! @brief Bus free time between a STOP and the next START in standard mode (t_BUF), in ns */
+#define I2C_BUS_FREE_NS_STANDARD    4700
+/*! @brief Same in fast mode */
+#define I2C_BUS_FREE_NS_FAST        1300
+/*! @brief Busy-wait loops making up half of an SCL period (about 5us) while recovering the bus */
+#define I2C_RECOVERY_DELAY_LOOPS    100
+/*! @brief Number of slots in the device registry (shared by all interfaces) @see #xI2CRegisterDevice */
+#define I2C_MAX_DEVICES             8
+/*! @brief Consecutive failed accesses after which a registered device is quarantined @see #xI2CDeviceAvailable */
+#define I2C_QUARANTINE_FAILURES     3
+/*! @brief Time a quarantined device is left alone before being accessed again, doubled after each failed retry */
+#define I2C_BACKOFF_MIN             (100/portTICK_PERIOD_MS)
+/*! @brief Upper limit of the quarantine backoff */
+#define I2C_BACKOFF_MAX             (10000/portTICK_PERIOD_MS)
+
 /*! @name I2C Control Register (I2CCON) bit values
  */
 #define I2C_AA                           (1 << 2)        /*!< @brief <b> Assert Acknowledge Flag </b>
@@ -154,6 +179,56 @@
 #define I2C_STAT_SLA_LAST_DATA_SENT_ACK  0xC8
 /*@}*/
 
+/*! @brief Set to 1 to run the I2C interrupt service routine from RAM, avoiding the flash wait states on every bus event
+ * (follows #configAPP_RAMFUNC by default) */
+#ifndef I2C_ISR_IN_RAM
+#define I2C_ISR_IN_RAM                   configAPP_RAMFUNC
+#endif
+
+/*! @brief Set to 0 to leave the bus trace recorder out of the build, see #vI2CTraceEnable */
+#ifndef I2C_TRACE
+#define I2C_TRACE                        1
+#endif
+/*! @brief Entries of the bus trace ring (must be a power of 2) */
+#define I2C_TRACE_LEN                    64
+
+/*! @brief Set to 0 to leave the IPMB snoop capture out of the build, see #xI2CSnoopEnable */
+#ifndef I2C_SNOOP
+#define I2C_SNOOP                        1
+#endif
+/*! @brief Frames of the snoop capture ring (must be a power of 2, up to 128) */
+#define I2C_SNOOP_LEN                    16
+/*! @brief Time between two exports of the captured frames to the log */
+#define I2C_SNOOP_EXPORT_PERIOD          ( 10 / portTICK_PERIOD_MS )
+/*! @brief Most frames written to the log by one export, the UART can't take much more */
+#define I2C_SNOOP_EXPORT_MAX             2
+
+/*! @brief Size of the slave receive FIFO of each interface, in bytes (up to 255)
+ *
+ * Each frame takes #I2C_SLAVE_RX_HDR bytes more than its length. The ISR only receives a frame when a whole
+ * #I2C_SLAVE_RX_RECORD_MAX is free, so at least ( I2C_SLAVE_RX_FIFO_LEN / I2C_SLAVE_RX_RECORD_MAX ) frames can
+ * wait for the receiver task, and several times that many of the short IPMB requests.
+ */
+#define I2C_SLAVE_RX_FIFO_LEN            128
+/*! @brief Header of each frame in the slave receive FIFO: its length, the core cycle count at its STOP (LSB first),
+ * then the slave address it was sent to */
+#define I2C_SLAVE_RX_HDR                 6
+/*! @brief Room taken by the longest frame in the slave receive FIFO */
+#define I2C_SLAVE_RX_RECORD_MAX          ( I2C_SLAVE_RX_HDR + i2cMAX_MSG_LENGTH )
+/*! @brief Slave addresses answered besides the main one (ADR1 to ADR3), see #xI2CSlaveAddAddress */
+#define I2C_SLAVE_ADDR_EXTRA             3
+/*! @brief #xI2C_Config::slave_rx_start of a frame there was no room for */
+#define I2C_SLAVE_RX_NONE                0xFF
+
+#if ( I2C_SLAVE_RX_FIFO_LEN > 0xFE ) || ( I2C_SLAVE_RX_FIFO_LEN < 2 * I2C_SLAVE_RX_RECORD_MAX )
+#error "I2C_SLAVE_RX_FIFO_LEN must take two of the longest frames and keep its offsets below I2C_SLAVE_RX_NONE"
+#endif
+
+/*! @brief Period (in ticks) to probe the GA pins again and follow address changes, 0 to resolve them only at init */
+#ifndef IPMB_ADDR_RECHECK_PERIOD
+#define IPMB_ADDR_RECHECK_PERIOD         0
+#endif
+
 /*! @brief Size of #IPMBL_TABLE
  */
 #define IPMBL_TABLE_SIZE                 27
@@ -187,11 +262,34 @@ typedef enum {
     i2c_err_SLA_W_SENT_NACK,                /*!< SLA+R address transmitted, but no response has been received.
                                              *  Slave is either busy or unreachable.
                                              *  @see #I2C_STAT_SLA_W_SENT_NACK  */
-    i2c_err_DATA_SENT_NACK                  /*!< DATA byte has been transmitted, but NACK has returned.
+    i2c_err_DATA_SENT_NACK,                 /*!< DATA byte has been transmitted, but NACK has returned.
                                              *  Slave is either busy or unreachable.
                                              *  @see #I2C_STAT_DATA_SENT_NACK  */
+    i2c_err_TIMEOUT,                        /*!< Transfer didn't end in time (bus stuck), the bus was recovered.
+                                             *  @see #vI2CBusRecover */
+    i2c_err_QUARANTINED,                    /*!< Device is quarantined after failing repeatedly, the bus
+                                             *  wasn't accessed. @see #xI2CDeviceAvailable */
+    i2c_err_PEC                             /*!< SMBus Packet Error Code read back doesn't match the bytes
+                                             *  received. @see #I2C_XFER_PEC */
 } i2c_err;
 
+/*! @name Transfer flags, see #xI2C_xfer.flags
+ * @{
+ */
+#define I2C_XFER_PEC                0x01    /*!< SMBus Packet Error Checking: a CRC-8 (x^8 + x^2 + x + 1) of every byte
+                                             *   on the bus, addresses included, is sent after the bytes written or
+                                             *   read back after the bytes read and checked (#i2c_err_PEC). The ISR
+                                             *   computes it byte by byte, neither buffer holds it */
+#define I2C_XFER_POLL               0x02    /*!< ACK polling: the device may NACK its address while it's busy (an
+                                             *   EEPROM in its write cycle), which ends the transfer with
+                                             *   #i2c_err_SLA_W_SENT_NACK without counting as a failure of the
+                                             *   device (see #xI2CRegisterDevice) */
+#define I2C_XFER_RESTART            0x04    /*!< Burst: the bus isn't released after this write, the next transfer of
+                                             *   the chain addresses its slave with a repeated START instead of a
+                                             *   STOP and a new START (write-only transfers, ignored on the last
+                                             *   one). The caller bounds how long it keeps the bus this way */
+/*! @} */
+
 /*! @brief I2C transaction parameter structure */
 typedef struct xI2C_msg
 {
@@ -201,11 +299,102 @@ typedef struct xI2C_msg
     uint8_t tx_len;                         /*!< Number of bytes to transmit */
     uint8_t rx_data[i2cMAX_MSG_LENGTH];     /*!< Buffer cointaning received bytes, limitted to #i2cMAX_MSG_LENGTH */
     uint8_t rx_len;                         /*!< Number of bytes to receive */
+    uint8_t flags;                          /*!< @ref I2C_XFER_PEC "Transfer flags", the lengths above include the PEC byte */
     i2c_err error;                          /*!< Error value from I2C driver
                                              *  @see #i2c_err
                                              */
 } xI2C_msg;
 
+/*! @brief Descriptor of one transfer of a chain, see #xI2CTransferChain
+ *
+ * Both lengths may be set, in which case the bytes are written and the answer is read after a repeated START.
+ */
+typedef struct xI2C_xfer
+{
+    uint8_t addr;                           /*!< Slave address of I2C device */
+    uint8_t * tx_data;                      /*!< Bytes to transmit */
+    uint8_t tx_len;                         /*!< Number of bytes to transmit */
+    uint8_t * rx_data;                      /*!< Buffer in which the received bytes are copied */
+    uint8_t rx_len;                         /*!< Number of bytes to receive */
+    uint8_t flags;                          /*!< @ref I2C_XFER_PEC "Transfer flags", 0 for a plain I2C transfer */
+    i2c_err error;                          /*!< Result of this transfer, filled by the driver */
+} xI2C_xfer;
+
+/*! @brief Entry of a scan list, see #xI2CScanStart
+ *
+ * Register pointer written, then the answer read after a repeated START, as a #xI2C_xfer with both lengths set.
+ */
+typedef struct xI2C_scan_entry
+{
+    uint8_t addr;                           /*!< Slave address of I2C device */
+    uint8_t tx_data[2];                     /*!< Register pointer */
+    uint8_t tx_len;                         /*!< Number of bytes in #tx_data */
+    uint8_t rx_len;                         /*!< Number of bytes to receive */
+    uint8_t slot;                           /*!< Destination slot of the bytes read, see #xI2C_chain.dest */
+    uint8_t flags;                          /*!< @ref I2C_XFER_PEC "Transfer flags" */
+} xI2C_scan_entry;
+
+struct xI2C_chain;
+
+/*! @brief Completion callback of an asynchronous chain, see #xI2CTransferAsync
+ *
+ * @param chain: Chain that ended, each transfer holds its own result.
+ * @param error: First error found in the chain, #i2c_err_SUCCESS if all transfers succeeded.
+ */
+typedef void (* i2c_chain_callback)( struct xI2C_chain * chain, i2c_err error );
+
+/*! @brief Chain of transfers queued on an interface, executed back to back by the ISR
+ *
+ * The transfers are either #xfer or, for a scan list (#xI2CScanStart), the entries of #scan picked by #mask.
+ */
+typedef struct xI2C_chain
+{
+    xI2C_xfer * xfer;                       /*!< Array of transfers */
+    uint8_t count;                          /*!< Number of transfers in #xfer (entries in #scan) */
+    I2C_ID_T i2c_id;                        /*!< Interface the chain was queued on (set by the driver) */
+    TaskHandle_t caller;                    /*!< Task notified when the whole chain is done (blocking chains only) */
+    i2c_chain_callback callback;            /*!< Completion callback (asynchronous chains only) */
+    void * ctx;                             /*!< Free for the owner of an asynchronous chain */
+    struct xI2C_chain * next;               /*!< Next queued chain */
+    const xI2C_scan_entry * scan;           /*!< Scan list, NULL for a chain of #xfer */
+    uint32_t mask;                          /*!< Scan list: entries to run, bit n for entry n */
+    uint8_t * dest;                         /*!< Scan list: bytes read by entry n go to dest + slot * #stride */
+    uint8_t stride;                         /*!< Scan list: bytes of each destination slot */
+    i2c_err * result;                       /*!< Scan list: result of entry n goes to result[n] (entries run only) */
+    volatile uint8_t busy;                  /*!< Set by the driver while the chain is queued */
+} xI2C_chain;
+
+/*! @brief Bus trace entry, one per ISR run */
+typedef struct xI2C_trace_entry
+{
+    uint32_t timestamp;                     /*!< Core cycle counter (DWT CYCCNT) */
+    uint8_t i2c_id;                         /*!< Interface that raised the interrupt */
+    uint8_t stat;                           /*!< I2STAT value handled */
+    uint8_t data;                           /*!< I2DAT contents (byte received or last byte sent) */
+} xI2C_trace_entry;
+
+/*! @brief Frame seen on the bus by the snoop capture, as received (not decoded) */
+typedef struct xI2C_snoop_frame
+{
+    uint32_t timestamp;                     /*!< Core cycle counter (DWT CYCCNT) at its STOP */
+    uint8_t i2c_id;                         /*!< Interface it was seen on */
+    uint8_t len;                            /*!< Bytes in #data */
+    uint8_t data[i2cMAX_MSG_LENGTH];        /*!< Slave address it was sent to (8 bit form), then the bytes received */
+} xI2C_snoop_frame;
+
+/*! @brief Entry of the I2C device registry */
+typedef struct xI2C_device
+{
+    I2C_ID_T i2c_id;                        /*!< Interface the device is connected to */
+    uint8_t addr;                           /*!< Slave address of I2C device */
+    uint32_t max_clock;                     /*!< Highest SCL frequency supported by the device (Hz) */
+    uint8_t failures;                       /*!< Consecutive failed accesses (NACK on its address or timeout) */
+    uint8_t quarantined;                    /*!< Set after #I2C_QUARANTINE_FAILURES consecutive failures */
+    uint32_t errors;                        /*!< Failed accesses since registration */
+    TickType_t backoff;                     /*!< Current quarantine backoff */
+    TickType_t retry_at;                    /*!< Tick from which a quarantined device may be accessed again */
+} xI2C_device;
+
 /*! @brief Pin definition struct for I2C interface
  *
  * (Port number, Pin number, Pin Function)
@@ -221,24 +410,46 @@ typedef struct xI2C_pins {
 /*! @brief I2C common interface structure */
 typedef struct xI2C_Config {
     LPC_I2C_T *reg;                /*!< Control Register Address */
-    xI2C_pins_t pins;              /*!< Pin configuration struct */
     IRQn_Type irq;                 /*!< Interruption table index */
     I2C_Mode mode;                 /*!< Mode of operation*/
+    uint32_t clock_rate;           /*!< SCL frequency (Hz), the highest one all registered devices support */
     TaskHandle_t master_task_id;   /*!< Handler of caller task in
                                     * I2C master mode */
-    TaskHandle_t slave_task_id;    /*!< Handler of caller task in
-                                    * slave mode (will be notified
-                                    * when a full message is received
-                                    * (bytes from START to STOP) or
-                                    * an error happens in the I2C
-                                    * interruption service )*/
+    TaskHandle_t slave_task_id;    /*!< Receiver task in slave mode, see
+                                    * #vI2CSlaveRegister (notified
+                                    * when a full message is received,
+                                    * bytes from START to STOP) */
+    uint8_t slave_rx_fifo[I2C_SLAVE_RX_FIFO_LEN]; /*!< Frames received in slave mode, each after its #I2C_SLAVE_RX_HDR
+                                    * header. A frame never wraps: if the FIFO ends too soon, a 0 length (or the
+                                    * FIFO end) closes the data and the next frame is at offset 0 */
+    volatile uint8_t slave_rx_wr;  /*!< Offset after the newest frame (only the ISR moves it) */
+    volatile uint8_t slave_rx_rd;  /*!< Offset of the oldest unread frame (only the receiver task moves it) */
+    uint8_t slave_rx_start;        /*!< Offset of the frame being received, #I2C_SLAVE_RX_NONE if it's being dropped */
+    uint8_t slave_rx_addr;         /*!< Slave address the frame being received was sent to (8 bit form) */
+    uint8_t slave_rx_snoop;        /*!< The frame being received is for another address, it goes to the snoop capture */
+    uint8_t slave_addr[I2C_SLAVE_ADDR_EXTRA]; /*!< Extra slave addresses (8 bit form), 0 for a free slot */
+    uint32_t slave_rx_dropped;     /*!< Frames received in slave mode while the FIFO had no room for them */
+    uint32_t arb_lost;             /*!< Arbitration losses, as master or while addressed as slave */
+    uint32_t timeouts;             /*!< Master transfers that didn't end in time */
+    uint8_t arb_retries;           /*!< Restarts of the current master transfer after losing arbitration */
+    uint8_t master_pending;        /*!< Master transfer to be restarted once the slave frame that interrupted it ends */
+    volatile uint8_t slave_busy;   /*!< A frame addressed to us is being received, from its address to its STOP */
+    volatile uint32_t bus_free_at; /*!< Core cycle count (DWT CYCCNT) at the last STOP seen by the interface */
+    uint32_t deferred_starts;      /*!< Master transfers held back until the slave frame being received ended */
+    uint32_t bus_recoveries;       /*!< Times #vI2CBusRecover ran on this interface */
+    xI2C_chain * chain_head;       /*!< Chain being executed, NULL if no chain is pending */
+    xI2C_chain * chain_tail;       /*!< Last queued chain */
+    uint8_t chain_pos;             /*!< Index of the current transfer in #chain_head */
     uint8_t rx_cnt;                /*!< Received bytes counter */
     uint8_t tx_cnt;                /*!< Transmitted bytes counter */
+    uint8_t pec;                   /*!< CRC-8 of the bytes of the current master transfer so far, see #I2C_XFER_PEC */
     xI2C_msg msg;                  /*!< Message body (tx and rx buffers) */
 } xI2C_Config;
 
 /*! Global I2C Configuration struct array (1 item for each interface) */
 extern struct xI2C_Config i2c_cfg[];
+/*! Pins of each interface, from BOARD_I2C_PINS of the board variant (see board_defs.h) */
+extern const xI2C_pins_t i2c_pins[];
 
 /*! Macro to obtain the I2C base address by its number */
 #define LPC_I2Cx(x)      ((i2c_cfg[x].reg))
@@ -262,6 +473,119 @@ extern struct xI2C_Config i2c_cfg[];
  */
 void vI2CInit( I2C_ID_T i2c_id, I2C_Mode mode );
 
+/*! @brief Frees a stuck bus and resets the interface
+ *
+ *     A slave holding SDA low (after a reset in the middle of a read, for example) is clocked with
+ * up to 9 SCL pulses driven as GPIO, until it releases the line. A STOP is then generated and the
+ * interface is disabled and enabled again, which resets its state machine. All pending transfer
+ * chains are ended with #i2c_err_TIMEOUT.
+ *
+ *     Called by the driver when a master transfer times out, it must run in task context.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ */
+void vI2CBusRecover( I2C_ID_T i2c_id );
+
+#if I2C_TRACE
+/*! @brief Starts or stops recording the bus events of every interface
+ *
+ *     Each I2C interrupt adds one #xI2C_trace_entry (timestamp, bus, STAT, data byte) to a ring of
+ * #I2C_TRACE_LEN entries. The ISR is the only writer and #xI2CTraceRead the only reader, so the
+ * ring needs no locking (all I2C interrupts share the same priority and can't preempt each other).
+ * When the ring is full new entries are dropped and counted, the oldest ones are kept.
+ * Starting the trace enables the core cycle counter used for the timestamps.
+ *
+ * @param enable: 1 to start recording, 0 to stop (the recorded entries are kept)
+ */
+void vI2CTraceEnable( uint8_t enable );
+
+/*! @brief Takes the oldest entries out of the trace ring
+ *
+ * @param entries: Buffer for the entries.
+ * @param max: Number of entries that fit in the buffer.
+ * @return Number of entries copied
+ */
+uint8_t xI2CTraceRead( xI2C_trace_entry * entries, uint8_t max );
+
+/*! @brief Number of entries still waiting in the trace ring */
+uint8_t xI2CTracePending( void );
+
+/*! @brief Number of events not recorded because the ring was full (since the trace was last started) */
+uint32_t ulI2CTraceDropped( void );
+#endif
+
+#if I2C_SNOOP
+/*! @brief Starts or stops capturing the frames sent to the other addresses of an IPMB bus
+ *
+ *     The address mask of the interface is widened so every frame written on the bus is received.
+ * The ones sent to our own addresses (main and extra ones) keep going to the receiver task as before,
+ * the others are stamped with the core cycle counter and copied as they are into a ring of
+ * #I2C_SNOOP_LEN frames by the ISR, next to the normal path. Every #I2C_SNOOP_EXPORT_PERIOD the oldest
+ * frames are written to the log (log.h), which the GPDMA drains to the debug UART, as an
+ * "i2c,snoop" record (timestamp, bus, length) followed by the bytes in "i2c,snoop_data" records, 4 per
+ * argument, little endian. A full ring drops the new frames.
+ * Only one interface is captured at a time.
+ *
+ * @warning While capturing, the MMC acknowledges every address written on the bus: a FRU missing from
+ * the crate seems to be there and its requests go unanswered instead of failing at once. It's a bench
+ * and diagnostics tool, not to be left on in a crate.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ), in #I2C_Mode_IPMB.
+ * @param enable: 1 to start capturing (the counters start over), 0 to stop (captured frames are still exported).
+ * @return 1 on success, 0 if the interface isn't in IPMB mode (or is mocked) or another one is being captured
+ */
+uint8_t xI2CSnoopEnable( I2C_ID_T i2c_id, uint8_t enable );
+
+/*! @brief Frames captured since the capture was last started, dropped ones included */
+uint32_t ulI2CSnoopCaptured( void );
+
+/*! @brief Frames not captured because the ring was full (since the capture was last started) */
+uint32_t ulI2CSnoopDropped( void );
+#endif
+
+/*! @brief Records the maximum speed of a device connected to a local bus
+ *
+ *     The interface clock is set to the highest rate every registered device on it supports
+ * (limited to #I2C_FAST_MODE_CLOCK). A single clock is used for the whole bus, since a slower
+ * device could misread faster transfers addressed to its neighbours.
+ * The IPMB-L interface always stays at #I2C_STANDARD_MODE_CLOCK.
+ *
+ * May be called before or after #vI2CInit, but not while a transfer is running on the interface.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param addr: Slave address of the device (7 bit address).
+ * @param max_clock: Highest SCL frequency supported by the device, in Hz.
+ * @return #i2c_err_SUCCESS, or #i2c_err_FAILURE if the registry is full
+ */
+i2c_err xI2CRegisterDevice( I2C_ID_T i2c_id, uint8_t addr, uint32_t max_clock );
+
+/*! @brief Tells if a device may be accessed now
+ *
+ *     The driver keeps track of the health of every registered device: a NACK on its address or a
+ * transfer timeout counts as a failure, any successful transfer clears the count. After
+ * #I2C_QUARANTINE_FAILURES consecutive failures the device is quarantined and left alone for
+ * #I2C_BACKOFF_MIN. After that one access is let through: if it fails again the backoff is doubled
+ * (up to #I2C_BACKOFF_MAX), if it succeeds the quarantine ends.
+ *
+ *     #xI2CWrite, #xI2CRead and #xI2CWriteRead fail with #i2c_err_QUARANTINED without touching the
+ * bus while this returns 0. Chains aren't filtered, whoever builds them (sensor polling, for example)
+ * should check the devices first. Devices that weren't registered are always available.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param addr: Slave address of the device (7 bit address).
+ * @return 1 if the device may be accessed, 0 if it is quarantined and its backoff hasn't expired
+ */
+uint8_t xI2CDeviceAvailable( I2C_ID_T i2c_id, uint8_t addr );
+
+/*! @brief Health counters of a registered device
+ *
+ * @return Registry entry of the device, NULL if it wasn't registered
+ */
+const xI2C_device * pxI2CDeviceInfo( I2C_ID_T i2c_id, uint8_t addr );
+
+/*! @brief Ends the quarantine of a device and clears its failure counters (e.g. after a hot-swap) */
+void vI2CDeviceReset( I2C_ID_T i2c_id, uint8_t addr );
+
 /*! @brief Enter Master Write mode and transmit a buffer
  *
  * Bytes are transmitted in crescent order, incrementing the buffer index.
@@ -294,6 +618,39 @@ void vI2CInit( I2C_ID_T i2c_id, I2C_Mode mode );
  */
 i2c_err xI2CWrite( I2C_ID_T i2c_id, uint8_t addr, uint8_t * tx_data, uint8_t tx_len );
 
+/*! @brief Reserves the interface transmit buffer, so the caller can build the message in place
+ *
+ *     First half of a zero-copy write: the caller writes its bytes straight into the returned buffer
+ * (up to #i2cMAX_MSG_LENGTH-1) and then sends them with #xI2CWriteCommit. The interface is locked in between,
+ * so the buffer must always be committed and the caller must not block before doing it.
+ *
+ * @code
+ * uint8_t * tx_buf = pxI2CWriteReserve( I2C0, 10 );
+ *
+ * if ( tx_buf != NULL ) {
+ *     tx_len = encode_message( tx_buf, &msg );
+ *     err = xI2CWriteCommit( I2C0, 0x42, tx_len );
+ * }
+ * @endcode
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param timeout: Amount of ticks to wait for the interface to be free
+ * @return Pointer to the transmit buffer, or NULL if the interface is busy
+ * @see #xI2CWriteCommit
+ */
+uint8_t * pxI2CWriteReserve( I2C_ID_T i2c_id, uint32_t timeout );
+
+/*! @brief Sends the message built in the buffer returned by #pxI2CWriteReserve
+ *
+ * The interface lock is released here (also on error) and, just like #xI2CWrite, this function blocks until the transfer ends.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param addr: Destination of the message (7 bit address).
+ * @param tx_len: Amount of bytes written in the buffer (must be lower than #i2cMAX_MSG_LENGTH, or an error will return)
+ * @return I2C Driver error
+ * @see #pxI2CWriteReserve
+ */
+i2c_err xI2CWriteCommit( I2C_ID_T i2c_id, uint8_t addr, uint8_t tx_len );
+
 /*! @brief Enter Master Read mode and receive a buffer from slave
  *
  * @note This function blocks until its completion, in other words, it'll only
@@ -332,6 +689,140 @@ i2c_err xI2CWrite( I2C_ID_T i2c_id, uint8_t addr, uint8_t * tx_data, uint8_t tx_
  */
 i2c_err xI2CRead( I2C_ID_T i2c_id, uint8_t addr, uint8_t * rx_data, uint8_t rx_len );
 
+/*! @brief Transmit a buffer and read the answer in a single transfer (repeated START)
+ *
+ *     Meant for register-addressed devices (sensors, EEPROMs): the register pointer is written and the
+ * ISR issues a repeated START right after the last byte, so the bus isn't released between both
+ * phases and the caller is woken up only once.
+ *
+ * @note This function blocks until its completion, just like #xI2CWrite and #xI2CRead.
+ *
+ * Example:
+ * @code
+ * uint8_t reg = 0x00; // LM75 temperature register
+ * uint8_t temp[2];
+ *
+ * if ( xI2CWriteRead( I2C1, 0x4C, &reg, 1, temp, sizeof(temp) ) == i2c_err_SUCCESS ) {
+ *     // temp[0] holds the integer part
+ * }
+ * @endcode
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param addr: Destination of the message (7 bit address).
+ * @param tx_data: Pointer to buffer of bytes to be transmitted.
+ * @param tx_len: Length of tx_data buffer (must be lower than #i2cMAX_MSG_LENGTH)
+ * @param rx_data: Pointer to buffer in which the received bytes will be copied.
+ * @param rx_len: Number of bytes that will be read from slave (must be lower than #i2cMAX_MSG_LENGTH)
+ * @return I2C Driver error
+ * @see #xI2CWrite
+ * @see #xI2CRead
+ */
+i2c_err xI2CWriteRead( I2C_ID_T i2c_id, uint8_t addr, uint8_t * tx_data, uint8_t tx_len, uint8_t * rx_data, uint8_t rx_len );
+
+/*! @brief Queue a chain of transfers on the interface and wait for all of them
+ *
+ *     The transfers are run by the ISR one after the other, without waking any task in between,
+ * and chains submitted by several tasks are executed in order. The caller is notified once,
+ * when its last transfer ends. A failed transfer doesn't stop the chain, check each @c error field.
+ *
+ * @warning Don't mix chains with #xI2CWrite / #xI2CRead calls on the same interface, the single
+ * transfer functions don't wait for the pending chains.
+ *
+ * Example:
+ * @code
+ * uint8_t reg = 0x00;
+ * uint8_t temp[4][2];
+ * xI2C_xfer sweep[4] = {
+ *     { .addr = 0x4C, .tx_data = &reg, .tx_len = 1, .rx_data = temp[0], .rx_len = 2 },
+ *     { .addr = 0x4D, .tx_data = &reg, .tx_len = 1, .rx_data = temp[1], .rx_len = 2 },
+ *     { .addr = 0x4E, .tx_data = &reg, .tx_len = 1, .rx_data = temp[2], .rx_len = 2 },
+ *     { .addr = 0x4F, .tx_data = &reg, .tx_len = 1, .rx_data = temp[3], .rx_len = 2 },
+ * };
+ *
+ * xI2CTransferChain( I2C1, sweep, 4 );
+ * @endcode
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param xfer: Array of transfers (each length, plus the PEC byte of an #I2C_XFER_PEC one, must be lower than #i2cMAX_MSG_LENGTH)
+ * @param count: Number of transfers in the array
+ * @return First error found in the chain, #i2c_err_SUCCESS if all transfers succeeded
+ */
+i2c_err xI2CTransferChain( I2C_ID_T i2c_id, xI2C_xfer * xfer, uint8_t count );
+
+/*! @brief Queue a chain of transfers on the interface and return right away
+ *
+ *     Same as #xI2CTransferChain, but the caller isn't blocked and its task notification value is
+ * left alone. When the last transfer ends, @c chain->callback runs in the deferred work daemon
+ * (deferred.h, queued by the ISR), so it may use any FreeRTOS API and even submit the next chain,
+ * the same one included.
+ *
+ * @warning The chain descriptor, its transfers and their buffers are used until the callback runs,
+ * so they can't live in the caller stack. The callback must not block, it runs in the daemon, which the
+ * timer task can't interrupt.
+ *
+ * Example:
+ * @code
+ * static uint8_t reg = 0x00;
+ * static uint8_t temp[2];
+ * static xI2C_xfer xfer = { .addr = 0x4C, .tx_data = &reg, .tx_len = 1, .rx_data = temp, .rx_len = 2 };
+ * static xI2C_chain poll = { .xfer = &xfer, .count = 1, .callback = temp_done };
+ *
+ * static void temp_done( xI2C_chain * chain, i2c_err error )
+ * {
+ *     if ( error == i2c_err_SUCCESS ) {
+ *         update_sensor( temp[0] );
+ *     }
+ *     // Pipeline the next reading
+ *     xI2CTransferAsync( I2C1, chain );
+ * }
+ * @endcode
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param chain: Chain with its transfers, count and callback filled in.
+ * @return #i2c_err_SUCCESS if the chain was queued, #i2c_err_MAX_LENGTH if a transfer is too long
+ */
+i2c_err xI2CTransferAsync( I2C_ID_T i2c_id, xI2C_chain * chain );
+
+/*! @brief Queue a scan list on the interface and return right away
+ *
+ *     A scan list is a const array of register reads (#xI2C_scan_entry), for the sweeps repeated every
+ * period: nothing is built per sweep, @c chain->mask picks the entries to run, and the ISR writes the
+ * bytes read straight into the destination slots (@c chain->dest) and the result of each entry into
+ * @c chain->result. Nothing runs in between, and the end of the list is told once: by @c chain->callback
+ * (deferred to the deferred work daemon, as for #xI2CTransferAsync), or without a callback by a notification
+ * of the task that started the scan, which then calls #xI2CScanWait.
+ *     With a callback, a scan started from a software timer costs no other task a context switch for the
+ * whole sweep.
+ *
+ * @warning The chain, the list and the destination are used until the scan ends. Without a callback,
+ * call it from a task only, and call #xI2CScanWait before starting that chain again.
+ *
+ * Example:
+ * @code
+ * static const xI2C_scan_entry temps[2] = {
+ *     { .addr = 0x4C, .tx_data = { 0x00 }, .tx_len = 1, .rx_len = 2, .slot = 0 },
+ *     { .addr = 0x4D, .tx_data = { 0x00 }, .tx_len = 1, .rx_len = 2, .slot = 1 },
+ * };
+ * static uint8_t raw[2][2];
+ * static i2c_err result[2];
+ * static xI2C_chain sweep = { .scan = temps, .count = 2, .mask = 0x3, .dest = &raw[0][0], .stride = 2, .result = result };
+ *
+ * xI2CScanStart( I2C1, &sweep );
+ * xI2CScanWait( &sweep );
+ * @endcode
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param chain: Chain with the list, count (up to 32), mask, destination and results filled in.
+ * @return #i2c_err_SUCCESS if the scan was queued (or the mask is empty, see #xI2CScanWait),
+ * #i2c_err_MAX_LENGTH if an entry is too long
+ */
+i2c_err xI2CScanStart( I2C_ID_T i2c_id, xI2C_chain * chain );
+
+/*! @brief Waits for the end of a scan list started without a callback
+ *
+ * Updates the device health of the entries run (see #xI2CDeviceAvailable), as a blocking chain does, and
+ * recovers the bus if the scan gets stuck on it. Other scans of the same task may end meanwhile, their
+ * notification isn't lost.
+ * @return First error found in the entries run, #i2c_err_SUCCESS if they all succeeded
+ */
+i2c_err xI2CScanWait( xI2C_chain * chain );
+
 /*! @brief Enter Slave Receiver mode and waits a data transmission
  *
  *     This function forces the I2C interface switch to Slave Listen (Receiver) mode
@@ -365,18 +856,132 @@ i2c_err xI2CRead( I2C_ID_T i2c_id, uint8_t addr, uint8_t * rx_data, uint8_t rx_l
  */
 uint8_t xI2CSlaveTransfer ( I2C_ID_T i2c_id, uint8_t * rx_data, uint32_t timeout );
 
+/*! @brief Enter Slave Receiver mode and waits a data transmission, without copying it
+ *
+ *     Zero-copy version of #xI2CSlaveTransfer. The ISR receives the frames straight into a lock-free FIFO
+ * of #I2C_SLAVE_RX_FIFO_LEN bytes (the ISR is its only writer, the receiver task its only reader), so
+ * back-to-back frames queue up behind the one still being read. This function returns a pointer to the
+ * oldest unread frame, which stays valid until #vI2CSlaveReleaseFrame is called.
+ *     The frames are for the receiver of the interface (there's only one), registered once by
+ * #vI2CSlaveRegister or else by the first call, which the ISR notifies on every frame. No lock is
+ * taken and nothing is registered again on each call: frames that arrive before the first call (or
+ * while the receiver is busy with the previous one) are already waiting in the FIFO.
+ *
+ * @note Frames that arrive while the FIFO has no room are dropped and counted in #xI2C_Config::slave_rx_dropped.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param rx_frame: Written with a pointer to the received frame bytes.
+ * @param timeout: Amount of time to remain blocked until a message arrives (32-bit value)
+ * @return Length of message received (0 on timeout, in which case nothing must be released)
+ * @warning Only the registered receiver may call it.
+ * @see #xI2CSlaveTransfer
+ */
+uint8_t xI2CSlaveReceive ( I2C_ID_T i2c_id, uint8_t ** rx_frame, uint32_t timeout );
+
+/*! @brief Makes a task the receiver of an interface in slave mode, once for good
+ *
+ *     The ISR notifies it on every frame it stores, whether or not the task is waiting in #xI2CSlaveReceive
+ * at that moment, so the receive loop doesn't reach the driver in between frames.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param task: Receiver task, the only one allowed to call #xI2CSlaveReceive (NULL to unregister).
+ */
+void vI2CSlaveRegister ( I2C_ID_T i2c_id, TaskHandle_t task );
+
+/*! @brief Gives the frame returned by #xI2CSlaveReceive back to the ISR
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ */
+void vI2CSlaveReleaseFrame ( I2C_ID_T i2c_id );
+
+/*! @brief Core cycle count (DWT CYCCNT) at the STOP of the frame returned by #xI2CSlaveReceive
+ *
+ * Only meaningful until the frame is released, and only if the cycle counter was enabled when it arrived.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ */
+uint32_t ulI2CSlaveFrameStamp ( I2C_ID_T i2c_id );
+
+/*! @brief Slave address (8 bit form) the frame returned by #xI2CSlaveReceive was sent to
+ *
+ * The main address, or one added by #xI2CSlaveAddAddress. Only meaningful until the frame is released.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ */
+uint8_t ucI2CSlaveFrameAddr ( I2C_ID_T i2c_id );
+
+/*! @brief Answers one more slave address on an interface in slave mode (IPMB)
+ *
+ *     The interface has three address registers besides the main one, so the MMC can receive the
+ * frames sent to a FRU it stands for (an RTM behind it, a virtual FRU) on the same bus. Each frame
+ * comes with the address it was sent to, see #ucI2CSlaveFrameAddr (in IPMB frames it's also the
+ * first byte, rsSA). Adding an address already answered does nothing.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param addr: Slave address, 8 bit form (bit 0 ignored), not 0.
+ * @return 1 on success, 0 if the #I2C_SLAVE_ADDR_EXTRA slots are taken
+ */
+uint8_t xI2CSlaveAddAddress ( I2C_ID_T i2c_id, uint8_t addr );
+
+/*! @brief Stops answering a slave address added by #xI2CSlaveAddAddress
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param addr: Slave address, 8 bit form (bit 0 ignored).
+ */
+void vI2CSlaveRemoveAddress ( I2C_ID_T i2c_id, uint8_t addr );
+
+#if configAPP_I2C_MOCK
+/*! @brief Mock transmitter, gets the frames written to a mocked interface instead of the bus
+ *
+ * Called by #xI2CWriteCommit from the writing task, with the interface buffer still reserved, and by
+ * #xI2CTransferChain once per write of the chain. It must not block and its return value is the one of the write.
+ */
+typedef i2c_err (* i2c_mock_tx)( I2C_ID_T i2c_id, uint8_t addr, const uint8_t * tx_data, uint8_t tx_len );
+
+/*! @brief Replaces the bus of an interface by a mock backend (make I2C_MOCK=1, see sim/loadsim.c)
+ *
+ *     Must be called before #vI2CInit, which then only sets up the driver state: the pins, the peripheral
+ * and its interrupt are left alone. Writes (#xI2CWrite, #xI2CWriteCommit) go to \p tx and the slave frames
+ * come from #xI2CMockInject. The other transfers aren't mocked.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param tx: Where the written frames go.
+ */
+void vI2CMockAttach( I2C_ID_T i2c_id, i2c_mock_tx tx );
+
+/*! @brief Hands a frame to the slave receiver of a mocked interface, as if a master had sent it
+ *
+ * The frame goes through the receive FIFO like one from the ISR, so it's dropped (and counted in
+ * #xI2C_Config::slave_rx_dropped) when the FIFO has no room. Not callable from an interrupt.
+ *
+ * @param i2c_id: Interface ID ( I2C0, I2C1, I2C2 ).
+ * @param frame: Frame bytes, starting with our own slave address in IPMB mode.
+ * @param len: Number of bytes, up to #i2cMAX_MSG_LENGTH.
+ * @return 1 if the frame was queued, 0 if it was dropped
+ */
+uint8_t xI2CMockInject( I2C_ID_T i2c_id, const uint8_t * frame, uint8_t len );
+#endif
+
 /*! @brief Reads own I2C slave address using GA pins
  *
  * Based on coreipm/coreipm/mmc.c
  * @author Gokhan Sozmen
  * Reads the GA pins, performing an unconnection checking, to define the device I2C slave address, as specified by MicroTCA documentation.
  *
- * @return 7-bit Slave Address
+ * @warning Toggles GA_TEST_PIN and busy-waits, use #get_ipmb_addr to get the cached address instead.
+ *
+ * @return 7-bit Slave Address (0 if the GA pins state is invalid)
+ */
+uint8_t probe_ipmb_addr( void );
+
+/*! @brief Returns own I2C slave address
+ *
+ * The address is probed from the GA pins once, when the IPMB interface is initialized
+ * (or at the first call, if it's not initialized yet) and cached, so this is cheap enough for every message sent.
  *
- * @todo Develop a function to discover the Geographic Address once (checking the GA pins)
- * and store it into a global variable, since everytime a IPMI message is built
- * (request or response) the MMC has to check its own  address to fill the rs/rqSA field,
- * and it takes some time to go through all this function.
+ * @return 7-bit Slave Address
+ * @see #probe_ipmb_addr
+ * @see #IPMB_ADDR_RECHECK_PERIOD
  */
 uint8_t get_ipmb_addr( void );
 
@@ -0,0 +1,82 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file i2c_mux.h
+ *
+ * @brief Access to devices behind I2C switches (PCA9548 like: one control byte, one bit per channel)
+ *
+ * Devices are addressed by (mux, channel, addr). The channel currently selected in each switch is
+ * remembered, so the control byte is only written when the channel actually changes.
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef I2C_MUX_H_
+#define I2C_MUX_H_
+
+/*! @brief Maximum number of registered I2C switches */
+#define I2C_MUX_MAX                 4
+/*! @brief Channels of each switch */
+#define I2C_MUX_CHANNELS            8
+/*! @brief Maximum number of transfers in a single #xI2CMuxBatch call */
+#define I2C_MUX_BATCH_MAX           8
+/*! @brief Returned by #xI2CMuxRegister when the registry is full */
+#define I2C_MUX_INVALID             0xFF
+/*! @brief Selected channel is unknown (at power up or after an error), the next access always writes the control byte */
+#define I2C_MUX_CHANNEL_UNKNOWN     0xFF
+
+/*! @brief Transfer to a device behind a switch, see #xI2CMuxBatch */
+typedef struct xI2C_mux_xfer {
+    uint8_t channel;                        /*!< Switch channel the device is connected to */
+    xI2C_xfer xfer;                         /*!< Transfer itself, its error field holds the result */
+} xI2C_mux_xfer;
+
+/*! @brief Registers an I2C switch
+ *
+ * @param i2c_id: Interface the switch is connected to ( I2C0, I2C1, I2C2 ).
+ * @param addr: Switch slave address (7 bit address).
+ * @return Handle used by the other functions, #I2C_MUX_INVALID if there are already #I2C_MUX_MAX switches
+ */
+uint8_t xI2CMuxRegister( I2C_ID_T i2c_id, uint8_t addr );
+
+/*! @brief #xI2CWrite to a device behind a switch */
+i2c_err xI2CMuxWrite( uint8_t mux, uint8_t channel, uint8_t addr, uint8_t * tx_data, uint8_t tx_len );
+
+/*! @brief #xI2CRead from a device behind a switch */
+i2c_err xI2CMuxRead( uint8_t mux, uint8_t channel, uint8_t addr, uint8_t * rx_data, uint8_t rx_len );
+
+/*! @brief #xI2CWriteRead on a device behind a switch */
+i2c_err xI2CMuxWriteRead( uint8_t mux, uint8_t channel, uint8_t addr, uint8_t * tx_data, uint8_t tx_len, uint8_t * rx_data, uint8_t rx_len );
+
+/*! @brief Runs several transfers behind the same switch, grouped by channel
+ *
+ *     Transfers are grouped by channel (keeping their order inside each channel), starting with the
+ * channel that is already selected, so the control byte is written at most once per group. Each group
+ * goes to the bus as one #xI2CTransferChain. The control byte is written on its own, so the group is
+ * skipped (#i2c_err_FAILURE) if the switch doesn't take it, instead of hitting the devices of the
+ * previous channel.
+ *
+ * @param mux: Switch handle, from #xI2CMuxRegister.
+ * @param xfer: Array of transfers, left in the caller order (each one gets its own result).
+ * @param count: Number of transfers, up to #I2C_MUX_BATCH_MAX.
+ * @return First error found, #i2c_err_SUCCESS if every transfer succeeded
+ */
+i2c_err xI2CMuxBatch( uint8_t mux, xI2C_mux_xfer * xfer, uint8_t count );
+
+#endif /*I2C_MUX_H_*/
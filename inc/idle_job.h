@@ -0,0 +1,80 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file idle_job.h
+ *
+ * @brief Background maintenance jobs, run by the idle task in short slices
+ *
+ * Integrity checks (image CRC, FRU checksums...) don't get a task each: they're described by an #idle_job and
+ * run from the FreeRTOS idle hook, so they only ever get the CPU when no task is ready and never delay the
+ * IPMB/IPMI tasks. The hook runs one slice of one job per pass of the idle loop, taking the due jobs in turn;
+ * a slice must not block and should take no more than a few microseconds, so a task woken meanwhile waits at
+ * most that long (the idle task is only preempted at the end of a slice by a task of its own priority).
+ * A job keeps where it is between slices in its own state and tells when it's done with the pass; it then
+ * waits for its period before the next one.
+ *     With the tick suppressed while idle (configUSE_TICKLESS_IDLE), the core doesn't go to sleep while a job
+ * has work left (#idle_job_pending, from configPRE_SLEEP_PROCESSING): the pass completes in idle time, then the
+ * core sleeps until the next one is due.
+ * @code
+ * static idle_job check_job = IDLE_JOB( "Check", prvCheckStep, NULL, 60000 / portTICK_PERIOD_MS );
+ * idle_job_start( &check_job );
+ * @endcode
+ */
+
+#ifndef IDLE_JOB_H_
+#define IDLE_JOB_H_
+
+/*! @brief Most jobs started */
+#define IDLE_JOB_MAX_JOBS           4
+
+/*! @name Slice results
+ * @{
+ */
+#define IDLE_JOB_MORE               0       /*!< Work left in this pass, the job gets another slice */
+#define IDLE_JOB_DONE               1       /*!< Pass complete, the next one starts after the period */
+/*! @} */
+
+/*! @brief Background job, the storage is the caller's */
+typedef struct idle_job {
+    const char * name;
+    uint8_t (* step)( void * arg );         /*!< Runs one slice, in the idle task (mustn't block), gives #IDLE_JOB_MORE or #IDLE_JOB_DONE */
+    void * arg;
+    TickType_t period;                      /*!< Time from the end of a pass to the start of the next one */
+    /* Managed by idle_job.c */
+    TickType_t due;                         /*!< Tick the next pass starts */
+    uint8_t active;                         /*!< A pass is running */
+    uint32_t passes;                        /*!< Passes completed */
+    uint32_t slices;
+} idle_job;
+
+/*! @brief #idle_job initializer, the first pass starts right away */
+#define IDLE_JOB( name, step, arg, period )    { name, step, arg, period, 0, 0, 0, 0 }
+
+/*! @brief Starts running a job, before or after the scheduler starts
+ *
+ * @param job: Job descriptor, must stay valid (static storage).
+ * @return 1 on success, 0 if #IDLE_JOB_MAX_JOBS jobs are already running
+ */
+uint8_t idle_job_start( idle_job * job );
+
+/*! @brief Tells if a job is in the middle of a pass or due for one (idle task only) */
+uint8_t idle_job_pending( void );
+
+#endif /*IDLE_JOB_H_*/
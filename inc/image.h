@@ -0,0 +1,142 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file image.h
+ *
+ * @brief Dual image flash layout, shared by the boot loader (boot/) and the MMC firmware
+ *
+ * The 128 KB of flash hold a small boot loader in sector 0, two slots for the MMC image, each
+ * linked for its own slot (afcipm_a.ld, afcipm_b.ld), and the persistent settings (config_store.h):
+ * @code
+ * 0x00000  boot loader         sector 0 (4 KB)
+ * 0x01000  slot A              sectors 1-13 (52 KB)
+ * 0x0E000  settings            sectors 14-15 (8 KB)
+ * 0x10000  slot B              sectors 16-17 (first 52 KB of 64 KB)
+ * @endcode
+ * Each slot ends with a header row (#image_header: sequence number, length and CRC of the image)
+ * and a confirmation row. The header is only written once the whole image has been checked against
+ * its CRC, so at boot the loader checks nothing but the header's own CRC: picking the newest slot
+ * costs a few dozen bytes of CRC instead of the whole image.
+ *     An image is on trial until it confirms itself (#image_confirm, once the IPMI dispatcher runs),
+ * which writes its confirmation row. The loader leaves a note in RAM (#IMAGE_BOOT_STATE, kept
+ * across a reset) of the slot it started: found again on the next reset while still on trial, that
+ * slot never made it and the other one is started instead, where #image_init discards the failed
+ * image. So a bad upgrade is rolled back with one reset.
+ */
+
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+/*! @name Flash layout
+ * @{
+ */
+#define IMAGE_BOOT_START            0x00000000
+#define IMAGE_SLOT_A_START          0x00001000
+#define IMAGE_SLOT_B_START          0x00010000
+#define IMAGE_SLOT_SIZE             0x0000D000
+#define IMAGE_SLOTS                 2
+#define IMAGE_SLOT_NONE             0xFF
+#define IMAGE_SLOT_BASE( slot )     ( ( slot ) == 0 ? IMAGE_SLOT_A_START : IMAGE_SLOT_B_START )
+/*! @brief Settings log (config_store.h), two 4 KB sectors the images must stay clear of */
+#define IMAGE_CONFIG_START          0x0000E000
+#define IMAGE_CONFIG_SIZE           0x00002000
+/*! @brief Smallest flash write, the header and confirmation rows are one each */
+#define IMAGE_ROW                   256
+/*! @brief Offset of the header row in a slot, the image itself must end before it */
+#define IMAGE_HEADER_OFFSET         ( IMAGE_SLOT_SIZE - 2 * IMAGE_ROW )
+/*! @brief Offset of the confirmation row in a slot */
+#define IMAGE_CONFIRM_OFFSET        ( IMAGE_SLOT_SIZE - IMAGE_ROW )
+/*! @} */
+
+/*! @brief Flash sector of an address (LPC17xx: 4 KB sectors below 64 KB, 32 KB sectors above) */
+#define IMAGE_SECTOR( addr )        ( ( (addr) < 0x10000 ) ? ( (addr) >> 12 ) : ( 16 + ( ( (addr) - 0x10000 ) >> 15 ) ) )
+
+#define IMAGE_MAGIC                 0x49434641  /*!< "AFCI" */
+#define IMAGE_CONFIRM_MAGIC         0x4B4F4641  /*!< "AFOK", first word of the confirmation row */
+
+/*! @brief Image header, at #IMAGE_HEADER_OFFSET in its slot (tools/image_header.py builds it) */
+typedef struct image_header {
+    uint32_t magic;                         /*!< #IMAGE_MAGIC */
+    uint32_t sequence;                      /*!< Larger is newer (wrapping), given by the MMC that wrote the image */
+    uint32_t length;                        /*!< Bytes of the image, from the slot start */
+    uint32_t image_crc;                     /*!< CRC-32 of the image, checked once when it's written */
+    uint16_t version;                       /*!< Firmware revision, major << 8 | minor */
+    uint16_t reserved;
+    uint32_t header_crc;                    /*!< CRC-32 of the fields above, all that's checked at boot */
+} image_header;
+
+/*! @brief Boot note left by the loader, at the start of RamLoc16 (.uninit_RESERVED, not cleared at reset) */
+typedef struct image_boot_state {
+    uint32_t magic;                         /*!< #IMAGE_BOOT_TRIAL until the image confirms itself */
+    uint8_t slot;                           /*!< Slot started */
+    uint8_t failed;                         /*!< Slot whose trial failed on the previous boot, or #IMAGE_SLOT_NONE */
+} image_boot_state;
+
+#define IMAGE_BOOT_STATE            ( (volatile image_boot_state *) 0x10000000 )
+#define IMAGE_BOOT_TRIAL            0x54524941  /*!< "AIRT" */
+#define IMAGE_BOOT_CONFIRMED        0x4B4F4F42  /*!< "BOOK" */
+
+/*! @brief CRC-32 (IEEE 802.3, as zlib's crc32) of a buffer */
+uint32_t image_crc32( const void * data, uint32_t len );
+
+/*! @brief Adds bytes to a running #image_crc32: start from 0xFFFFFFFF, the CRC is the inverted result */
+uint32_t image_crc32_update( uint32_t crc, const void * data, uint32_t len );
+
+/*! @brief Header of a slot, valid or not */
+const image_header * image_get_header( uint8_t slot );
+
+/*! @brief Tells if a slot holds a startable image: header with the right CRC, sane vector table */
+uint8_t image_slot_valid( uint8_t slot );
+
+/*! @brief Tells if the image of a slot has confirmed itself */
+uint8_t image_slot_confirmed( uint8_t slot );
+
+/*! @brief Slot to start: the valid one with the newest sequence, the other one if it failed its trial
+ *
+ * @param failed: Slot whose trial failed, or #IMAGE_SLOT_NONE.
+ * @return the slot, #IMAGE_SLOT_NONE if neither is valid
+ */
+uint8_t image_select( uint8_t failed );
+
+/*! @brief Erases flash sectors, with the interrupts off (the flash can't be read meanwhile)
+ *
+ * Sectors already blank are skipped, the others are erased one at a time to keep the interrupts off the least.
+ * @return 1 on success, 0 if an IAP command failed
+ */
+uint8_t image_flash_erase( uint32_t first, uint32_t last );
+
+/*! @brief Writes a RAM buffer (word aligned) to erased flash, with the interrupts off
+ *
+ * @param len: One of the IAP sizes: 256, 512, 1024 or 4096.
+ * @return 1 on success, 0 if an IAP command failed
+ */
+uint8_t image_flash_write( uint32_t addr, const uint32_t * buf, uint32_t len );
+
+/*! @brief Slot the running image was linked for, #IMAGE_SLOT_NONE if it was linked to run without the boot loader */
+uint8_t image_running_slot( void );
+
+/*! @brief Discards the image of a slot whose trial failed on the previous boot, before the scheduler starts */
+void image_init( void );
+
+/*! @brief Ends the trial of the running image: writes its confirmation row if it isn't there yet */
+void image_confirm( void );
+
+#endif /*IMAGE_H_*/
@@ -0,0 +1,86 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file init_stage.h
+ *
+ * @brief Staged start up: IPMB answers before the slow modules are up
+ *
+ * main() only brings up what the MCH needs to see at once (IPMB, the IPMI dispatcher, hot swap and
+ * payload) and leaves the rest (sensors, FRU inventory, firmware upgrade) to a low priority task, which
+ * runs once the scheduler is up and only while IPMB has nothing to do. Each module marks its stage done
+ * with #init_stage_done. A handler needing some stages is registered with IPMI_HANDLER_NEEDS() (ipmi.h),
+ * and the dispatcher answers it NODE_BUSY, without running it, until they all are: #init_ready is a
+ * load of the mask of the stages done, it never blocks. The same bits are also kept in an event group,
+ * so a task depending on other stages waits for them with #init_wait instead of being started after
+ * them, and the modules come up in whatever order their own dependencies allow.
+ * The tick of each stage is kept for the Get Init Status command.
+ */
+
+#ifndef INIT_STAGE_H_
+#define INIT_STAGE_H_
+
+/*! @brief Deferred init task stack, in words (heap allocated, given back when it's done) */
+#define INIT_STACK_DEPTH            ( configMINIMAL_STACK_SIZE * 2 )
+
+/*! @brief Start up stages, in the order they usually complete */
+typedef enum init_stage {
+    INIT_STAGE_CORE,                        /*!< IPMI dispatcher running: the MMC answers on IPMB */
+    INIT_STAGE_SENSORS,                     /*!< Sensor table registered, thresholds set, polling started */
+    INIT_STAGE_FRU,                         /*!< FRU inventory read from the EEPROM (or the default one) */
+    INIT_STAGE_HPM,                         /*!< Firmware upgrade task up */
+    INIT_STAGES
+} init_stage;
+
+/*! @brief Mask of a stage, for #init_ready and IPMI_HANDLER_NEEDS() */
+#define INIT_STAGE_BIT( stage )     ( 1 << ( stage ) )
+/*! @brief Mask of all the stages */
+#define INIT_STAGES_ALL             ( INIT_STAGE_BIT( INIT_STAGES ) - 1 )
+
+/*! @brief Creates the event group of the stages, before the scheduler starts
+ *
+ * The stages done before are in it too. Until then #init_wait can't be used.
+ */
+void init_stage_init( void );
+
+/*! @brief Marks a stage done, from a task or before the scheduler starts */
+void init_stage_done( init_stage stage );
+
+/*! @brief Waits for all the stages of a mask to be done, from a task
+ *
+ * @param stages: #INIT_STAGE_BIT() masks.
+ * @param ticks: Longest wait, portMAX_DELAY for no limit.
+ * @return 1 if they're all done, 0 if the wait timed out
+ */
+uint8_t init_wait( uint8_t stages, TickType_t ticks );
+
+/*! @brief Tells if all the stages of a mask are done */
+uint8_t init_ready( uint8_t stages );
+
+/*! @brief Mask of the stages done */
+uint8_t init_stages_done( void );
+
+/*! @brief Tick a stage was done at
+ *
+ * @return 1 if the stage is done, 0 otherwise (@p tick is left alone)
+ */
+uint8_t init_stage_tick( init_stage stage, TickType_t * tick );
+
+#endif /*INIT_STAGE_H_*/
@@ -31,26 +31,154 @@
 /*! @brief Default I2C interface to use in IPMB protocol */
 #define IPMB_I2C                I2C0
 
-/*! @name IPMB Tasks Priorities
- * @todo Put all the priority definitions in one file so we can manage them easier
+/*! @name Redundant IPMB
+ * A carrier with IPMB-A and IPMB-B defines IPMB_I2C_B in its board header, the interface of IPMB-B (IPMB-A is
+ * #IPMB_I2C), and both links are run: frames are received on either one, requests and events go out on them in
+ * turn and the responses on the link their request came in on. A write that fails is tried again right away on
+ * the other link, and a link failing #IPMB_LINK_FAILURES writes in a row (or getting stuck) is left out for
+ * #IPMB_LINK_HOLDOFF. Without IPMB_I2C_B there's only IPMB-L.
  * @{
  */
-#define IPMB_TXTASK_PRIORITY    3
-/*! @brief IPMB TX Task priority inside FreeRTOS */
-#define IPMB_RXTASK_PRIORITY    IPMB_TXTASK_PRIORITY
-/*@}*/
+/*! @brief No link preference, see #ipmi_msg_cfg.link */
+#define IPMB_LINK_ANY           0xFF
+/*! @brief Writes failed in a row that take a link out of the rotation */
+#define IPMB_LINK_FAILURES      3
+/*! @brief Time a failed link is left out before it's tried again, in ticks */
+#define IPMB_LINK_HOLDOFF       ( 1000 / portTICK_PERIOD_MS )
+/*! @} */
+
+/*! @brief IPMB TX and RX Task stacks, in words */
+#define IPMB_TASK_STACK_DEPTH   ( configMINIMAL_STACK_SIZE * 2 )
 
-/*! @brief Maximum count of messages to be sent */
+/*! @brief Maximum count of requests (events included) to be sent */
 #define IPMB_TXQUEUE_LEN        5
+/*! @brief Number of frames in the response transmit pool
+ *
+ * Responses are built in place in frames of a block pool (see #ipmb_response_alloc), and only their pointer goes
+ * through the TX queue and the retry slots. The TX task gives each frame back once it's sent or given up
+ */
+#define IPMB_TX_POOL_LEN        6
+/*! @brief Longest wait of #ipmb_response_send
+ *
+ * The TX task completes every response soon after its request deadline (#IPMB_MSG_TIMEOUT) at worst, sent or dropped,
+ * so this only bounds the wait if the TX task itself is stuck
+ */
+#define IPMB_RESP_SEND_TIMEOUT  ( 2 * ( IPMB_MSG_TIMEOUT ) )
+/*! @brief Time waited between two tries when every frame of the TX pool is taken, in ticks */
+#define IPMB_TX_POOL_WAIT       1
+/*! @brief Maximum count of responses to be sent, they have their own queue and are sent before the requests
+ *
+ * Every frame of the TX pool fits, so queueing a response never fails
+ */
+#define IPMB_TX_RESP_QUEUE_LEN  IPMB_TX_POOL_LEN
+/*! @brief Maximum responses sent in a row while a request is waiting (starvation protection) */
+#define IPMB_TX_RESP_BURST      4
+/*! @brief Most frames sent back to back, with repeated STARTs, by one wake up of the TX task
+ *
+ * Bounds how long the bus is kept from the other masters: 4 full frames are about 12 ms at 100 kHz, after which the
+ * STOP gives it back for arbitration.
+ */
+#define IPMB_TX_BURST           4
 /*! @brief Maximum count if received messages to be delivered to client task  */
 #define IPMB_CLIENT_QUEUE_LEN   5
 
+/*! @brief Number of frames in the received messages pool
+ *
+ * Frames come from a fixed block pool (see mem_pool.h). They are owned by the RX task while being received and decoded
+ * and then, by pointer, by the client (and the IPMI handler it dispatches to) until it calls #ipmb_release_msg
+ */
+#define IPMB_RX_POOL_LEN        8
+/*! @brief Time the RX task waits before trying again when every frame of the pool is taken */
+#define IPMB_RX_POOL_WAIT       (1/portTICK_PERIOD_MS)
+
 /*! @brief Maximum retries made by IPMB TX Task when sending a message */
 #define IPMB_MAX_RETRIES        3
 
+/*! @brief Number of messages that can be waiting for a retransmission at the same time
+ *
+ * Each slot holds a copy of the message and a one-shot FreeRTOS timer. When all slots are taken, the message is retried right away
+ */
+#define IPMB_RETRY_SLOTS        4
+
+/*! @brief Base delay before retransmitting a message the I2C driver couldn't send
+ *
+ * The n-th retry waits (IPMB_RETRY_BACKOFF << (n-1)) ticks plus a random jitter of up to IPMB_RETRY_BACKOFF ticks,
+ * so the whole retry sequence stays well inside #IPMB_MSG_TIMEOUT
+ */
+#define IPMB_RETRY_BACKOFF      (5/portTICK_PERIOD_MS)
+
 /*! @brief Timeout limit between the end of a request and start of a response (defined in IPMB timing specifications)
  */
 #define IPMB_MSG_TIMEOUT        250/portTICK_PERIOD_MS
+/*! @brief #IPMB_MSG_TIMEOUT in microseconds, for the deadlines kept with the timestamps of timestamp.h */
+#define IPMB_MSG_TIMEOUT_US     ( 250 * 1000 )
+
+/*! @brief Maximum number of outgoing requests that may be waiting for a response at the same time
+ *
+ * Must be a power of 2, since the sequence number is used (masked) as the table index
+ */
+#define IPMB_MAX_OUTSTANDING_REQ    8
+
+/*! @brief Sequence numbers are 6 bits wide on the wire (shared with the LUN in the same byte) */
+#define IPMB_SEQ_MAX                0x3F
+
+/*! @brief Number of (rsSA, NetFN) pairs with their own sequence number counter
+ *
+ * When all of them are taken the oldest one is recycled, so this is only a soft limit
+ */
+#define IPMB_SEQ_CONTEXTS           4
+
+/*! @brief Number of received requests (and their responses) kept in the replay cache
+ *
+ * An entry is only taken over once its response is sent or too late, so there's one for each RX frame a request
+ * can be held in.
+ */
+#define IPMB_RESP_CACHE_LEN         IPMB_RX_POOL_LEN
+
+#if IPMB_RESP_CACHE_LEN < IPMB_RX_POOL_LEN
+#error "IPMB_RESP_CACHE_LEN must take every request the RX pool can hold"
+#endif
+
+/*! @brief Time window in which a request with the same requester, Seq, NetFN and CMD is treated as a retry
+ *
+ * The requester may retry up to #IPMB_MAX_RETRIES times, each after waiting #IPMB_MSG_TIMEOUT for our response
+ */
+#define IPMB_DUP_REQ_WINDOW         ((IPMB_MSG_TIMEOUT_US) * (IPMB_MAX_RETRIES + 1))
+
+/*! @brief Records, per NetFN/CMD, how long our responses take (from request arrival until the response is on the wire)
+ *
+ * Uses the microsecond timestamps of timestamp.h. Set to 0 to save the histogram RAM
+ */
+#ifndef IPMB_LATENCY_STATS
+#define IPMB_LATENCY_STATS          1
+#endif
+/*! @brief Number of different NetFN/CMD pairs with their own latency histogram */
+#define IPMB_LATENCY_SLOTS          8
+/*! @brief Buckets in each latency histogram
+ *
+ * Bucket 0 counts responses sent within 1us and bucket n the ones that took [2^(n-1), 2^n) us.
+ * The last bucket also takes everything slower, from 131.072ms on
+ */
+#define IPMB_LATENCY_BUCKETS        19
+
+/*! @brief Ticks to wait for the I2C interface to be free before counting a transmission as failed */
+#define IPMB_I2C_RESERVE_TIMEOUT    10
+
+/*! @brief Maximum number of clients registered with #ipmb_register_client */
+#define IPMB_MAX_CLIENTS        4
+
+/*! @brief Maximum number of FRUs answered for with #ipmb_register_proxy (one extra slave address of the IPMB interface each) */
+#define IPMB_MAX_PROXIES        I2C_SLAVE_ADDR_EXTRA
+
+/*! @brief Filter value matching any NetFN or CMD */
+#define IPMB_FILTER_ANY         0xFF
+
+/*! @name IPMB client flags
+ * @{
+ */
+#define IPMB_CLIENT_REQUESTS    (1 << 0)    /*!< Client receives incoming requests */
+/* Responses go to the callback of their request (#ipmb_send_request_async), never to a client */
+/*@}*/
 
 /*! @brief Timeout limit waiting a free space in client queue to put a received message
  */
@@ -90,6 +218,12 @@
  */
 #define IPMB_RESP_HEADER_LENGTH     7
 
+/*! @brief Maximum length of the data field of a message
+ *
+ * 32 (Max IPMI msg len) - 6 request header bytes - 1 final chksum byte. Responses carry one byte less,
+ * since the completion code is kept in its own field
+ */
+#define IPMB_MAX_DATA_LEN           ( IPMI_MSG_MAX_LENGTH - IPMB_REQ_HEADER_LENGTH - 1 )
 
 #define IPMB_NETFN_MASK         0xFC
 #define IPMB_DEST_LUN_MASK      0x3
@@ -107,7 +241,6 @@ typedef struct ipmi_msg {
                                          * @see ipmi.h
                                          */
     uint8_t dest_LUN;                   /*!< Destination LUN (Logical Unit Number) */
-    uint8_t hdr_chksum;                 /*!< Connection Header Checksum */
     uint8_t src_addr;                   /*!< Source slave address */
     uint8_t seq;                        /*!< Sequence Number */
     uint8_t src_LUN;                    /*!< Source LUN (Logical Unit Number) */
@@ -118,20 +251,11 @@ typedef struct ipmi_msg {
                                          * @see ipmi.h
                                          */
     uint8_t data_len;                   /*!< Amount of valid bytes in #data buffer */
-    uint8_t data[IPMI_MSG_MAX_LENGTH];  /*!< Data buffer <br>
-                                         * Data field has 24 bytes:
-                                         * 32 (Max IPMI msg len) - 7 header bytes - 1 final chksum byte
+    uint8_t data[IPMB_MAX_DATA_LEN];    /*!< Data buffer <br>
+                                         * Checksums aren't kept, they're checked by #ipmb_decode and rebuilt by #ipmb_encode
                                          */
-    uint8_t msg_chksum;                 /*!< Message checksum */
 } ipmi_msg;
 
-typedef struct ipmi_msg_cfg {
-    ipmi_msg buffer;
-    TaskHandle_t caller_task;
-    uint8_t retries;
-    uint32_t timestamp;
-} ipmi_msg_cfg;
-
 /*! @brief IPMB errors enumeration */
 typedef enum ipmb_error {
     ipmb_error_unknown = 0,
@@ -141,25 +265,231 @@ typedef enum ipmb_error {
     ipmb_error_invalid_req,             /*!< A invalid request was received */
     ipmb_error_hdr_chksum,              /*!< Invalid header checksum from incoming message */
     ipmb_error_msg_chksum,              /*!< Invalid message checksum from incoming message */
+    ipmb_error_msg_length,              /*!< Incoming message too short or too long to be a valid frame */
     ipmb_error_queue_creation           /*!< Client queue couldn't be created. Invalid pointer to handler was given */
 } ipmb_error;
 
+/*! @brief Completion callback of an asynchronous request
+ *
+ * @param resp Matched response, only valid during the call, or NULL if the request failed or timed out.
+ * @param error #ipmb_error_success, #ipmb_error_failure (couldn't be sent) or #ipmb_error_timeout.
+ * @param ctx Context pointer given to #ipmb_send_request_async.
+ *
+ * @warning Called from the IPMB tasks or the timer task context, it must not block.
+ */
+typedef void (* ipmb_req_callback) ( ipmi_msg * resp, ipmb_error error, void * ctx );
+
+/*! @brief Outcome of a response sent with #ipmb_response_send, signalled by the TX task
+ *
+ * Owned by the sending task and reused for each of its responses; only the one it's waiting for can complete it,
+ * so a response given up on (see #IPMB_RESP_SEND_TIMEOUT) and finished later doesn't wake the next wait.
+ * Task notifications aren't used for this since the I2C driver blocks on them in the same tasks.
+ */
+typedef struct ipmb_completion {
+    QueueHandle_t signal;               /*!< Binary semaphore, given when #pending is completed */
+    const void * volatile pending;      /*!< Frame being waited for, NULL once completed or given up on */
+    volatile ipmb_error status;         /*!< Outcome of the last completed frame */
+} ipmb_completion;
+
+/*! @brief Message and its delivery information, as stored in the request TX queue and the TX pool frames
+ *
+ * #retries sits right after the odd-sized #buffer so it fills the alignment padding
+ * @warning #buffer must be the first field, so a response frame can be found from its message pointer
+ */
+typedef struct ipmi_msg_cfg {
+    ipmi_msg buffer;
+    uint8_t retries;
+    ipmb_completion * completion;       /*!< Completed with the outcome of a response, NULL if nobody waits */
+    uint32_t timestamp;                 /*!< Arrival of a request received, first send of a request sent (timestamp.h) */
+    ipmb_req_callback callback;         /*!< Request completion callback (asynchronous requests only) */
+    void * callback_ctx;                /*!< Context given back to #callback */
+    uint8_t link;                       /*!< Link a request was received on and its response goes out on first, #IPMB_LINK_ANY */
+    uint16_t corr;                      /*!< Correlation ID of the request received it belongs to, 0 if none (see #ipmb_corr) */
+} ipmi_msg_cfg;
+
+/*! @brief Points in the life of a received request, stamped with the core cycle counter (see #ipmb_stamp) */
+typedef enum ipmb_stamp_id {
+    IPMB_STAMP_RX = 0,                  /*!< STOP of the frame, in the I2C ISR */
+    IPMB_STAMP_DISPATCH,                /*!< Taken from the queue by the IPMI dispatcher */
+    IPMB_STAMP_HANDLER,                 /*!< Handed to its handler */
+    IPMB_STAMP_COUNT
+} ipmb_stamp_id;
+
+/*! @brief Received frame from the RX pool
+ *
+ * The RX task decodes the bytes received by the I2C ISR (read in place from the driver receive ring) into #msg.
+ * A pointer to the msg buffer is what travels through the client queue.
+ * @warning #msg must be the first field, so #ipmb_release_msg can find the frame from the message pointer
+ */
+typedef struct ipmb_rx_frame {
+    ipmi_msg_cfg msg;                   /*!< Decoded message */
+    uint32_t stamp[IPMB_STAMP_COUNT];   /*!< Core cycle count at each #ipmb_stamp_id point */
+} ipmb_rx_frame;
+
+/*! @brief State of an outstanding requests table entry */
+typedef enum ipmb_outstanding_state {
+    IPMB_OUTSTANDING_FREE = 0,          /*!< Slot can be taken by a new sequence number */
+    IPMB_OUTSTANDING_RESERVED,          /*!< Sequence number allocated, request still waiting in the TX queue */
+    IPMB_OUTSTANDING_SENT               /*!< Request is on the wire, waiting for its response */
+} ipmb_outstanding_state;
+
+/*! @brief Sequence number counter of a (rsSA, NetFN) pair, see #ipmb_alloc_seq */
+typedef struct ipmb_seq_context {
+    uint8_t valid;                      /*!< Context is in use */
+    uint8_t dest_addr;                  /*!< Responder slave address (rsSA) */
+    uint8_t netfn;                      /*!< Request NetFN */
+    uint8_t seq;                        /*!< Last sequence number given to this pair */
+} ipmb_seq_context;
+
+/*! @brief Entry of the outstanding requests table
+ *
+ * Each request successfully handed to the I2C driver is kept here until its response arrives or its deadline expires.
+ * The entry is located by the request sequence number and then matched against the full (rsSA, NetFN, CMD, Seq) key.
+ */
+typedef struct ipmb_outstanding_req {
+    uint8_t in_use;                     /*!< One of #ipmb_outstanding_state */
+    uint8_t dest_addr;                  /*!< Responder slave address (rsSA) */
+    uint8_t netfn;                      /*!< Request NetFN (the response one must be netfn+1) */
+    uint8_t cmd;                        /*!< Request command */
+    uint8_t seq;                        /*!< Request sequence number */
+    ipmb_req_callback callback;         /*!< Completion callback of an asynchronous request, NULL otherwise */
+    void * callback_ctx;                /*!< Context given back to #callback */
+    uint32_t deadline;                  /*!< Timestamp (timestamp.h) after which the response is discarded */
+} ipmb_outstanding_req;
+
+/*! @brief Consumer of incoming messages, see #ipmb_register_client */
+typedef struct ipmb_client {
+    QueueHandle_t queue;                /*!< Where the messages are delivered */
+    uint8_t netfn;                      /*!< Request NetFN filter (responses are matched against the NetFN of their request) or #IPMB_FILTER_ANY */
+    uint8_t cmd;                        /*!< Command filter or #IPMB_FILTER_ANY */
+    uint8_t flags;                      /*!< #IPMB_CLIENT_REQUESTS */
+} ipmb_client;
+
+/*! @brief Handler of the requests sent to a FRU the MMC stands for, see #ipmb_register_proxy
+ *
+ * @param req Received request, the handler owns its frame and must give it back with #ipmb_release_msg.
+ *
+ * @warning Called from the IPMB RX task, it must not block.
+ */
+typedef void (* ipmb_proxy_handler) ( ipmi_msg * req );
+
+/*! @brief FRU answered for on its own IPMB address, see #ipmb_register_proxy */
+typedef struct ipmb_proxy {
+    uint8_t addr;                       /*!< IPMB address of the FRU (8 bit form) */
+    ipmb_proxy_handler handler;         /*!< Receives the requests sent to #addr */
+} ipmb_proxy;
+
+/*! @brief Replay cache entry states */
+typedef enum ipmb_resp_cache_state {
+    ipmb_cache_free = 0,                /*!< Entry not used */
+    ipmb_cache_pending,                 /*!< Request delivered to the client, response not sent yet */
+    ipmb_cache_done                     /*!< Response sent, kept in #ipmb_resp_cache_entry::resp */
+} ipmb_resp_cache_state;
+
+/*! @brief Result of the duplicate request check */
+typedef enum ipmb_resp_cache_result {
+    ipmb_cache_new = 0,                 /*!< New request, deliver it to the client */
+    ipmb_cache_in_progress,             /*!< Retry of a request still being handled */
+    ipmb_cache_replay,                  /*!< Retry of an answered request, replay the cached response */
+    ipmb_cache_full                     /*!< Every entry is taken by a request still being handled, drop it */
+} ipmb_resp_cache_result;
+
+/*! @brief Response replay cache entry
+ *
+ * Keyed by (rqSA, Seq, NetFN, CMD) of the received request.
+ */
+typedef struct ipmb_resp_cache_entry {
+    uint8_t state;                      /*!< @see #ipmb_resp_cache_state */
+    uint8_t rq_addr;                    /*!< Requester slave address */
+    uint8_t netfn;                      /*!< Request NetFN */
+    uint8_t cmd;                        /*!< Request command */
+    uint8_t seq;                        /*!< Request sequence number */
+    uint32_t timestamp;                 /*!< Arrival time of the last copy of this request (also used as LRU age) */
+#if IPMB_LATENCY_STATS
+    uint32_t rx_stamp;                  /*!< Arrival time of the first copy */
+#endif
+    ipmi_msg resp;                      /*!< Response sent to this request */
+} ipmb_resp_cache_entry;
+
+/*! @brief Response latency histogram of one request NetFN/CMD
+ *
+ * Counters saturate at 0xFFFF instead of wrapping
+ */
+typedef struct ipmb_latency_hist {
+    uint8_t netfn;                      /*!< Request NetFN, 0xFF while the slot is unused */
+    uint8_t cmd;                        /*!< Request command */
+    uint16_t bucket[IPMB_LATENCY_BUCKETS]; /*!< log2 histogram, see #IPMB_LATENCY_BUCKETS */
+} ipmb_latency_hist;
+
+/*! @brief Static RAM taken by the IPMB layer message storage, in bytes
+ *
+ * Counts the request TX queue and retry slots (messages are copied by value), the RX and TX frame pools, the outstanding
+ * requests table and the replay cache. The response TX queue and the client queues only hold pointers. FreeRTOS queue
+ * control blocks aren't included.
+ * With the current layout a message takes 34 bytes and a queued one 56 bytes (64 before the data field was sized to the wire maximum).
+ */
+#define IPMB_MSG_RAM_USAGE  ( ( IPMB_TXQUEUE_LEN + IPMB_RETRY_SLOTS + IPMB_TX_POOL_LEN ) * sizeof(ipmi_msg_cfg) + \
+                              IPMB_TX_RESP_QUEUE_LEN * sizeof(ipmi_msg_cfg *) + \
+                              IPMB_RX_POOL_LEN * sizeof(ipmb_rx_frame) + \
+                              IPMB_MAX_OUTSTANDING_REQ * sizeof(ipmb_outstanding_req) + \
+                              IPMB_SEQ_CONTEXTS * sizeof(ipmb_seq_context) + \
+                              IPMB_RESP_CACHE_LEN * sizeof(ipmb_resp_cache_entry) )
+
+/*! @brief IPMB link statistics counters
+ *
+ * Counters are plain 32-bit increments (no critical section), each one is mostly written by a single task.
+ * The I2C ones are kept by the driver and only mapped here, see #ipmb_get_stat.
+ * @warning The order is part of the Get IPMB Statistics command response, only append new counters.
+ */
+typedef enum ipmb_stat_id {
+    IPMB_STAT_RX_FRAMES = 0,            /*!< Valid frames received */
+    IPMB_STAT_RX_CHKSUM_ERR,            /*!< Frames with a wrong header or message checksum */
+    IPMB_STAT_RX_MALFORMED,             /*!< Frames too short or too long */
+    IPMB_STAT_RX_DUP_REQ,               /*!< Retried requests (replayed from the cache or dropped) */
+    IPMB_STAT_RX_UNMATCHED_RESP,        /*!< Responses with no request waiting for them */
+    IPMB_STAT_TX_FRAMES,                /*!< Frames successfully transmitted */
+    IPMB_STAT_TX_RETRIES,               /*!< Retransmissions scheduled */
+    IPMB_STAT_TX_FAILURES,              /*!< Messages given up after #IPMB_MAX_RETRIES */
+    IPMB_STAT_TIMEOUTS,                 /*!< Late responses, both ours and the ones we were waiting for */
+    IPMB_STAT_QUEUE_FULL,               /*!< Messages dropped because a TX or client queue was full */
+    IPMB_STAT_I2C_ARB_LOST,             /*!< I2C arbitration losses (#xI2C_Config::arb_lost) */
+    IPMB_STAT_I2C_RX_OVERRUN,           /*!< Frames dropped by the I2C slave receiver (#xI2C_Config::slave_rx_dropped) */
+    IPMB_STAT_I2C_TIMEOUTS,             /*!< Master transfers that got stuck (#xI2C_Config::timeouts) */
+    IPMB_STAT_I2C_BUS_RECOVERIES,       /*!< Bus recoveries (#xI2C_Config::bus_recoveries) */
+    IPMB_STAT_RATE_LIMITED,             /*!< Requests answered NODE_BUSY for going over the rate of their requester (ipmi.c) */
+    IPMB_STAT_I2C_DEFERRED_STARTS,      /*!< Transmits held back for a frame being received (#xI2C_Config::deferred_starts) */
+    IPMB_STAT_LINK_FAILOVERS,           /*!< Frames sent on the other link after a failed write (redundant IPMB) */
+    IPMB_STAT_LINK_DOWN,                /*!< Times a link was left out of the rotation, see #IPMB_LINK_FAILURES */
+    IPMB_STAT_TX_BURSTS,                /*!< Frames sent after a repeated START, in the same burst as the one before */
+    IPMB_STAT_COUNT
+} ipmb_stat_id;
+
+extern volatile uint32_t ipmb_stats[IPMB_STAT_COUNT];
+
+/*! @brief Increments one of the IPMB layer counters, from any task (needs metrics.h) */
+#define IPMB_STAT_INC(id)   METRIC_INC( ipmb_stats[(id)] )
+
 /* Function Prototypes */
 
 /*! @brief IPMB Transmitter Task
  *
- * When #ipmb_send_request or #ipmb_send_response put a message in #ipmb_txqueue, this task unblocks.
+ * When #ipmb_send_request_async or #ipmb_send_response put a message in one of the TX queues, this task unblocks.
+ * Responses have their own queue, of pointers to the TX pool frames they were built in, and are serviced first, since the MCH is waiting for them, but after #IPMB_TX_RESP_BURST
+ * responses in a row a pending request is sent, so events still get through when many requests are being answered.
  * First step to send a message is differentiating requests from responses. It does this analyzing the parity of NetFN (even for requests, odd for responses).
  *
- * When sending a response, this task has to check if it matches with the sequence number from the last known request and the amount of time it took to be built (timeout checking). Last step is checking if it has already tried to send this message more than #IPMB_MAX_RETRIES value. <br>
+ * When sending a response, this task has to check if it matches a request in the replay cache and the amount of time it took to be built (timeout checking). Last step is checking if it has already tried to send this message more than #IPMB_MAX_RETRIES value. <br>
  * After passing all checking, the message is formatted as the IPMB protocol demands and passed down to the I2C driver, using the function xI2CWrite(). <br>
- * If an error comes out of the I2C driver when sending the message, it increases the retry counter in the #ipmi_msg_cfg struct and send the message to the front of #ipmb_txqueue. <br>
- * If no errors occurs, the task that put the message in the queue is notified with a success flag.
+ * Messages queued meanwhile are taken in the same wake up, up to #IPMB_TX_BURST, and the ones going out on the same link are
+ * written as one chain (#xI2CTransferChain with #I2C_XFER_RESTART): back to back, with a repeated START to each destination
+ * and a single STOP at the end. <br>
+ * If an error comes out of the I2C driver when sending the message, it increases the retry counter in the #ipmi_msg_cfg struct and schedules a retransmission after a backoff delay (#IPMB_RETRY_BACKOFF). <br>
+ * A response is ended by signalling its #ipmb_completion with the outcome, sent or dropped; a request is completed later, through its callback.
  *
- * The proccess is analog when sending a request, but the only check that is made is the retry number. The task skip all checking because, when sending a request, the message is formatted using it's own functions #ipmb_send_request or #ipmb_send_response and they are guaranteed to put only valid messages in queue.
+ * The proccess is analog when sending a request, but the only check that is made is the retry number. The task skip all checking because, when sending a request, the message is formatted using it's own functions #ipmb_send_request_async or #ipmb_send_response and they are guaranteed to put only valid messages in queue.
  * @param pvParameters: Default parameter to FreeRTOS tasks, not used here.
  * @see IPMB_RXTask
- * @see ipmb_send_request
+ * @see ipmb_send_request_async
  * @see ipmb_send_response
  */
 void IPMB_TXTask ( void *pvParameters );
@@ -167,14 +497,19 @@ void IPMB_TXTask ( void *pvParameters );
 /*! @brief IPMB Receiver Task
  *
  * Similarly to #IPMB_TXTask, this task remains blocked until a new message is received by the I2C driver. The message passes through checksum checking to assure its integrity. <br>
- * If the message is a request, we have to check if it's a new one or just a retransmission of the last. In order to do this, the sequential number is tested, since every request has a different one.<br>
- * Right after that, the arrival time and the message body are stored for future checking and the specified client is notified using #ipmb_notify_client.
+ * If the message is a request, we have to check if it's a new one or just a retransmission. In order to do this, the requester address, sequential number, NetFN and CMD are looked up in the response replay cache.<br>
+ * Retransmissions of already answered requests are responded again straight from the cache and retransmissions of requests still being handled are dropped.
+ * New requests have their arrival time stored in the cache for future checking and the specified client is notified using #ipmb_notify_client.
  *
- * If we have received a response instead, we match it with the last stored request and also check if the awating request hasn't timed-out yet.
+ * If we have received a response instead, we look it up in the outstanding requests table (indexed by its sequence number), match the full
+ * (rsSA, NetFN, CMD, Seq) key and check if the awaiting request hasn't timed-out yet. Only matched responses are passed to the completion
+ * callback of their request (#ipmb_send_request_async). The asynchronous requests left without a
+ * response are completed by the timer of their outstanding slot (timer_wheel.h) instead.
  *
  * @note When a malformed message, a response without a request or a repeated request are received, they are just ignored, following the IPMB specifications.
  *
- * @param pvParameters: Default parameter to FreeRTOS tasks, not used here.
+ * With a redundant IPMB there's one such task per link, each one receiving on its own interface.
+ * @param pvParameters: Link the task receives on.
  * @see IPMB_TXTask
  * @see ipmb_notify_client
  */
@@ -186,15 +521,105 @@ void IPMB_RXTask ( void *pvParameters );
  */
 void ipmi_init ( void );
 
-/*! @brief Format and send a request via IPMB channel
+/*! @brief Queues a request and returns immediately, the outcome is reported through a callback
+ *
+ * The callback receives the matched response, or NULL with #ipmb_error_failure if the request couldn't be sent
+ * or #ipmb_error_timeout if no response arrived within #IPMB_MSG_TIMEOUT. It's called exactly once, from the
+ * IPMB RX task (response), the timer task (timeout) or the IPMB TX task (send failure), so no task has to stay
+ * blocked on the bus.
+ *
+ * @param req Request to be sent (NetFN, CMD and data) and its responder address, 0 for the MCH; the rest of the
+ * connection header is filled by the IPMB layer.
+ * @param callback Completion callback, must not block.
+ * @param ctx Context pointer given back to @p callback.
+ *
+ * @retval ipmb_error_success The request was queued, @p callback will be called.
+ * @retval ipmb_error_failure The TX queue is full, @p callback won't be called.
+ */
+ipmb_error ipmb_send_request_async ( ipmi_msg * req, ipmb_req_callback callback, void * ctx );
+
+/*! @brief Takes a frame of the TX pool to build a response in place
+ *
+ * The connection header is filled from @p req, the completion code and data are left for the caller to write
+ * (the data length starts at 0). The frame then goes to #ipmb_response_send or #ipmb_response_queue, which only
+ * queue its pointer: the response is never copied on its way to the I2C driver.
+ *
+ * @param req Request being answered.
+ * @param ticks_to_wait Longest wait for a frame when the pool is exhausted.
+ * @return The response, NULL if no frame was given back in time.
+ */
+ipmi_msg * ipmb_response_alloc ( ipmi_msg * req, TickType_t ticks_to_wait );
+
+/*! @brief Sets up a completion for #ipmb_response_send, once per sending task
+ *
+ * @retval ipmb_error_success The completion is ready.
+ * @retval ipmb_error_failure Its semaphore couldn't be created.
+ */
+ipmb_error ipmb_completion_init ( ipmb_completion * done );
+
+/*! @brief Sends a response built with #ipmb_response_alloc and waits for the outcome
+ *
+ * Returns as soon as the TX task is done with the frame, which it signals through @p done. The IPMB layer
+ * owns the frame from now on, whatever the result.
+ *
+ * @param resp Response frame.
+ * @param done Completion of the calling task, see #ipmb_completion_init.
+ *
+ * @retval ipmb_error_success The response is on the wire.
+ * @retval ipmb_error_timeout It was ready after the requester stopped waiting, and dropped.
+ * @retval ipmb_error_failure It couldn't be sent (retries exhausted, no request to answer) or the TX task didn't
+ *                            complete it within #IPMB_RESP_SEND_TIMEOUT.
+ */
+ipmb_error ipmb_response_send ( ipmi_msg * resp, ipmb_completion * done );
+
+/*! @brief Queues a response built with #ipmb_response_alloc without waiting for it to be sent
+ *
+ * Used when the caller can't afford to block until the frame is on the wire (e.g. the IPMI dispatcher itself).
+ * The IPMB layer owns the frame from now on.
  */
-ipmb_error ipmb_send_request ( ipmi_msg * req );
-ipmb_error ipmb_send_response ( ipmi_msg * req, ipmi_msg * resp );
+void ipmb_response_queue ( ipmi_msg * resp );
+
+/*! @brief Sends a response built by the caller, copied into a TX pool frame (see #ipmb_response_send) */
+ipmb_error ipmb_send_response ( ipmi_msg * req, ipmi_msg * resp, ipmb_completion * done );
 
-/*! @brief Creates and returns a queue in which the client can block to receive the incoming requests.
+/*! @brief Queues a response built by the caller for transmission without waiting for it to be sent
  *
- * The queue is created and its handler is written at the given pointer (queue).
- * Also keeps a copy of the handler to know where to write the incoming messages.
+ * The response is copied into a TX pool frame, whose connection header is filled from @p req (see #ipmb_response_alloc).
+ *
+ * @param req Request being answered.
+ * @param resp Response data and completion code.
+ *
+ * @retval ipmb_error_success The response was queued.
+ * @retval ipmb_error_failure The TX pool is exhausted.
+ */
+ipmb_error ipmb_queue_response ( ipmi_msg * req, ipmi_msg * resp );
+
+/*! @brief Creates and returns a queue in which the client can block to receive the incoming messages it's interested in.
+ *
+ * The queue is created and its handler is written at the given pointer (queue). The RX task delivers each
+ * message straight to the client with the most specific matching filter (NetFN and CMD, then NetFN only, then
+ * #IPMB_FILTER_ANY), so a subsystem can get its own messages without going through the IPMI dispatcher.
+ * Messages no client wants are dropped.
+ *
+ * The queue items are pointers (ipmi_msg *) to frames of the IPMB receive pool, no message is copied.
+ * The client owns each received message and must give it back with #ipmb_release_msg once it's done with it.
+ *
+ * @param queue Pointer to a QueueHandle_t variable which will be written by this function.
+ * @param netfn Request NetFN to receive or #IPMB_FILTER_ANY.
+ * @param cmd Command to receive or #IPMB_FILTER_ANY.
+ * @param flags #IPMB_CLIENT_REQUESTS.
+ *
+ * @retval ipmb_error_success The queue was successfully created.
+ * @retval ipmb_error_queue_creation Queue creation failed due to lack of Heap space or #IPMB_MAX_CLIENTS are already registered.
+ */
+ipmb_error ipmb_register_client ( QueueHandle_t * queue, uint8_t netfn, uint8_t cmd, uint8_t flags );
+
+/*! @brief Registers a client that receives every incoming message (the IPMI dispatcher)
+ *
+ * Same as #ipmb_register_client with #IPMB_FILTER_ANY filters, more specific clients still get their own messages.
+ *
+ * The queue items are pointers (ipmi_msg *) to frames of the IPMB receive pool, no message is copied.
+ * The client owns each received message and must give it back with #ipmb_release_msg once it's done with it.
  *
  * @param queue Pointer to a QueueHandle_t variable which will be written by this function.
  *
@@ -203,4 +628,75 @@ ipmb_error ipmb_send_response ( ipmi_msg * req, ipmi_msg * resp );
  */
 ipmb_error ipmb_register_rxqueue ( QueueHandle_t * queue );
 
+/*! @brief Answers the requests sent to another IPMB address, for a FRU behind the MMC (the RTM)
+ *
+ * The address is added to the IPMB interface (#xI2CSlaveAddAddress) and the new requests sent to it go
+ * through the replay cache as usual, but are handed straight to @p handler by the RX task instead of the
+ * clients, so they don't wait behind the IPMI dispatcher. The response is sent with #ipmb_queue_response,
+ * its source address is then the proxy one.
+ *
+ * @param addr IPMB address of the FRU (8 bit form).
+ * @param handler Handler of its requests, must not block.
+ *
+ * @retval ipmb_error_success The address is answered from now on.
+ * @retval ipmb_error_failure #IPMB_MAX_PROXIES are already registered or the interface has no address register left.
+ */
+ipmb_error ipmb_register_proxy ( uint8_t addr, ipmb_proxy_handler handler );
+
+/*! @brief Reads a statistics counter of the IPMB link
+ *
+ * @param id Counter to be read.
+ * @return Counter value, 0 for an unknown counter.
+ */
+uint32_t ipmb_get_stat ( ipmb_stat_id id );
+
+/*! @brief Clears all the IPMB link statistics counters, I2C ones and latency histograms included */
+void ipmb_clear_stats ( void );
+
+/*! @brief Gets one of the response latency histograms
+ *
+ * @param slot Histogram index, from 0 to #IPMB_LATENCY_SLOTS-1.
+ * @return Pointer to the histogram or NULL if the slot hasn't been used yet (or #IPMB_LATENCY_STATS is disabled).
+ */
+const ipmb_latency_hist * ipmb_get_latency_hist ( uint8_t slot );
+
+/*! @brief Gives a received message back to the IPMB receive pool
+ *
+ * @param msg Message pointer obtained from the client queue.
+ */
+void ipmb_release_msg ( ipmi_msg * msg );
+
+/*! @brief Time left to answer a received request
+ *
+ * The budget is #IPMB_MSG_TIMEOUT counted from the request arrival. A response queued after it
+ * runs out is dropped by #IPMB_TXTask, so long handlers should check it and give up early.
+ *
+ * @param req Request pointer obtained from the client queue (must still be held, see #ipmb_release_msg).
+ * @return Remaining microseconds, 0 if the requester already stopped waiting.
+ */
+uint32_t ipmb_request_budget ( ipmi_msg * req );
+
+/*! @brief Stamps a received message with the core cycle counter, the IPMB RX task stamps #IPMB_STAMP_RX
+ *
+ * @param msg Message pointer obtained from the client queue (must still be held, see #ipmb_release_msg).
+ * @param id Point reached.
+ */
+void ipmb_stamp ( ipmi_msg * msg, ipmb_stamp_id id );
+
+/*! @brief Core cycle count at a point of a received message, see #ipmb_stamp
+ *
+ * @param msg Message pointer obtained from the client queue (must still be held, see #ipmb_release_msg).
+ * @param id Point reached.
+ */
+uint32_t ipmb_get_stamp ( ipmi_msg * msg, ipmb_stamp_id id );
+
+/*! @brief Correlation ID of a received message, tagging its spans in the kernel trace (kernel_trace.h)
+ *
+ * The RX task gives each frame it decodes the next ID (never 0), its response and the requests sent on its
+ * behalf (from a task that set it, #KERNEL_TRACE_CORR_SET) carry it on.
+ * @param msg Message pointer obtained from the client queue (must still be held, see #ipmb_release_msg).
+ * @return The ID, 0 for a message that didn't come from the IPMB
+ */
+uint16_t ipmb_corr ( ipmi_msg * msg );
+
 #endif
@@ -0,0 +1,46 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file ipmb_frame.h
+ *
+ * @brief IPMB frame encoding, decoding and checksums
+ *
+ * Pure functions on a message and a byte buffer: besides configASSERT they don't use the kernel, so
+ * ipmb_frame.c also builds natively against the host shim (make bench-host, see host/bench_host.c).
+ * @warning Must be included after ipmb.h
+ */
+
+#ifndef IPMB_FRAME_H_
+#define IPMB_FRAME_H_
+
+/* Macro to check is the message is a response (odd netfn) */
+#define IS_RESPONSE(msg) (msg.netfn & 0x01)
+
+/*! @brief 2's complement of the sum of the first \p range bytes of \p buffer */
+uint8_t ipmb_calculate_chksum ( uint8_t * buffer, uint8_t range );
+
+/*! @brief Formats \p msg into \p buffer, from the NetFN byte on, and returns the number of bytes written */
+uint8_t ipmb_encode ( uint8_t * buffer, ipmi_msg * msg );
+
+/*! @brief Checks a received frame (destination address included) and decodes it into \p msg */
+ipmb_error ipmb_decode ( ipmi_msg * msg, uint8_t * buffer, uint8_t len );
+
+#endif /*IPMB_FRAME_H_*/
@@ -22,9 +22,42 @@
 #ifndef IPMI_H_
 #define IPMI_H_
 
-/* TODO: Join all priority defines in a single header so we can manage them in a easier way */
-#define IPMI_TASK_PRIORITY 3
-#define IPMI_HANDLER_TASK_PRIORITY 3
+/* Task stacks, in words */
+#define IPMI_TASK_STACK_DEPTH ( configMINIMAL_STACK_SIZE * 2 )
+#define IPMI_HANDLER_STACK_DEPTH ( configMINIMAL_STACK_SIZE * 2 )
+#define IPMI_SLOW_HANDLER_STACK_DEPTH ( configMINIMAL_STACK_SIZE * 4 )
+
+/* Number of worker tasks running the request handlers */
+#define IPMI_HANDLER_WORKERS 2
+/* Requests waiting for a free worker, when full new requests are answered with NODE_BUSY */
+#define IPMI_WORKQUEUE_LEN IPMB_CLIENT_QUEUE_LEN
+/* Worker tasks of the handlers flagged IPMI_HANDLER_SLOW, on a queue of
+   their own: a long handler only ever holds these, never the workers
+   of the other handlers */
+#define IPMI_SLOW_HANDLER_WORKERS 1
+#define IPMI_SLOW_WORKQUEUE_LEN 2
+
+/* Request budget (see ipmb_request_budget()) below which a handler is
+   not started anymore, the requester gets IPMI_CC_NODE_BUSY instead of
+   a response that would come too late to be sent */
+#define IPMI_HANDLER_MIN_BUDGET (20*1000)
+
+/* Source addresses followed at once by the dispatcher, for the rate
+   limit and the round robin between requesters. A new address takes
+   the slot of the one heard from the longest ago */
+#define IPMI_REQUESTERS 4
+/* Sustained requests per second of each requester and how many more it
+   can send in a burst, past that it's answered NODE_BUSY at once. The
+   MCH is never limited */
+#define IPMI_REQUESTER_RATE 50
+#define IPMI_REQUESTER_BURST 16
+/* Requests taken in by the dispatcher and waiting for the turn of
+   their requester, there can't be more than IPMB receive frames */
+#define IPMI_PENDING_LEN IPMB_RX_POOL_LEN
+
+/* Deferred work items waiting for the dispatcher (see ipmi_defer()),
+   when full ipmi_defer() fails and the caller runs the work itself */
+#define IPMI_DEFER_QUEUE_LEN 8
 
 #define IPMI_MAX_DATA_LEN 24
 
@@ -258,6 +291,125 @@
 #define IPMI_PICMG_CMD_GET_SHELF_MANAGER_IP_ADDRESSES           0x21
 #define IPMI_PICMG_CMD_SHELF_POWER_ALLOCATION                   0x22
 #define IPMI_PICMG_CMD_GET_TELCO_ALARM_CAPABILITY               0x29
+/* HPM.1 firmware upgrade (PICMG HPM.1 section 3) */
+#define IPMI_PICMG_CMD_HPM_GET_UPGRADE_CAPABILITIES             0x2e
+#define IPMI_PICMG_CMD_HPM_GET_COMPONENT_PROPERTIES             0x2f
+#define IPMI_PICMG_CMD_HPM_ABORT_FIRMWARE_UPGRADE               0x30
+#define IPMI_PICMG_CMD_HPM_INITIATE_UPGRADE_ACTION              0x31
+#define IPMI_PICMG_CMD_HPM_UPLOAD_FIRMWARE_BLOCK                0x32
+#define IPMI_PICMG_CMD_HPM_FINISH_FIRMWARE_UPLOAD               0x33
+#define IPMI_PICMG_CMD_HPM_GET_UPGRADE_STATUS                   0x34
+#define IPMI_PICMG_CMD_HPM_ACTIVATE_FIRMWARE                    0x35
+
+/* FRU Control options */
+#define IPMI_PICMG_FRU_CONTROL_COLD_RESET                       0x00
+/* Set FRU Activation: FRU activation/deactivation */
+#define IPMI_PICMG_FRU_DEACTIVATE                               0x00
+#define IPMI_PICMG_FRU_ACTIVATE                                 0x01
+
+/* HPM.1 Get Target Upgrade Capabilities: version, deferred activation,
+   services affected (the payload goes down with the MMC reset) and
+   automatic rollback (image.h), timeouts in 5 s units */
+#define IPMI_HPM_VERSION                                        0x00
+#define IPMI_HPM_GLOBAL_CAPABILITIES                            0x1A
+#define IPMI_HPM_UPGRADE_TIMEOUT                                0x02
+#define IPMI_HPM_ROLLBACK_TIMEOUT                               0x01
+#define IPMI_HPM_INACCESSIBILITY_TIMEOUT                        0x02
+/* HPM.1 Get Component Properties selectors */
+#define IPMI_HPM_PROP_GENERAL                                   0x00
+#define IPMI_HPM_PROP_CURRENT_VERSION                           0x01
+#define IPMI_HPM_PROP_DESCRIPTION                               0x02
+/* General properties: payload cold reset required, deferred
+   activation, preparation supported, automatic rollback */
+#define IPMI_HPM_COMPONENT_PROPERTIES                           0x35
+/* Description string, followed by the slot letter and NUL padded */
+#define IPMI_HPM_DESCRIPTION                                    DEVICE_MMC_NAME
+#define IPMI_HPM_DESCRIPTION_LEN                                12
+
+/* Custom netfn (0x32) */
+#define IPMI_CUSTOM_CMD_GET_IPMB_STATISTICS                     0x01
+#define IPMI_CUSTOM_CMD_CLEAR_IPMB_STATISTICS                   0x02
+#define IPMI_CUSTOM_CMD_GET_IPMB_LATENCY                        0x03
+#define IPMI_CUSTOM_CMD_I2C_TRACE                               0x04
+#define IPMI_CUSTOM_CMD_GET_SENSOR_READINGS                     0x05
+#define IPMI_CUSTOM_CMD_GET_SENSOR_STATISTICS                   0x06
+#define IPMI_CUSTOM_CMD_CLEAR_SENSOR_STATISTICS                 0x07
+#define IPMI_CUSTOM_CMD_GET_MEMORY_STATISTICS                   0x08
+#define IPMI_CUSTOM_CMD_GET_STACK_USAGE                         0x09
+#define IPMI_CUSTOM_CMD_GET_CPU_LOAD                            0x0A
+#define IPMI_CUSTOM_CMD_KERNEL_TRACE                            0x0B
+#define IPMI_CUSTOM_CMD_GET_PROFILE                             0x0C
+#define IPMI_CUSTOM_CMD_ECHO                                    0x0D
+#define IPMI_CUSTOM_CMD_GET_INIT_STATUS                         0x0E
+#define IPMI_CUSTOM_CMD_GET_BOOT_TIMELINE                       0x0F
+/* Marks returned in each Get Boot Timeline response (4 bytes each) */
+#define IPMI_BOOT_TIMELINE_MARKS                                5
+#define IPMI_CUSTOM_CMD_GET_CRASH_RECORD                        0x10
+#define IPMI_CUSTOM_CMD_CLEAR_CRASH_RECORD                      0x11
+#define IPMI_CUSTOM_CMD_I2C_SNOOP                               0x12
+#define IPMI_CUSTOM_CMD_SENSOR_STREAM                           0x13
+#define IPMI_CUSTOM_CMD_FPGA_LOAD                               0x14
+#define IPMI_CUSTOM_CMD_GET_QUEUE_STATISTICS                    0x15
+#define IPMI_CUSTOM_CMD_SET_SENSOR_DEADBAND                     0x16
+#define IPMI_CUSTOM_CMD_TELEMETRY_SUBSCRIBE                     0x17
+/* Sent by the MMC to the subscribed collector, see telemetry.h */
+#define IPMI_CUSTOM_CMD_TELEMETRY_FRAME                         0x18
+#define IPMI_CUSTOM_CMD_GET_LIFETIME_COUNTERS                   0x19
+#define IPMI_CUSTOM_CMD_GET_METRICS                             0x1A
+#define IPMI_CUSTOM_CMD_SELF_TEST                               0x1B
+#define IPMI_CUSTOM_CMD_GET_EVENT_HISTORY                       0x1C
+/* Bytes of each event in a Get Event History response, and events per response */
+#define IPMI_EVENT_HISTORY_RECORD_LEN                           10
+#define IPMI_EVENT_HISTORY_RECORDS                              ( ( IPMI_MAX_DATA_LEN - 3 ) / IPMI_EVENT_HISTORY_RECORD_LEN )
+#define IPMI_CUSTOM_CMD_GET_RESPONSE_TIMES                      0x1D
+#define IPMI_CUSTOM_CMD_HPM_DELTA_MANIFEST                      0x1E
+/* Record bytes returned in each Get Crash Record response */
+#define IPMI_CRASH_RECORD_CHUNK                                 20
+/* Bytes of timings before the echoed payload of an Echo response */
+#define IPMI_ECHO_TIMING_LEN                                    6
+/* Counters returned in each Get IPMB Statistics response (4 bytes each) */
+#define IPMI_IPMB_STATS_PER_RESP                                5
+/* Histogram buckets returned in each Get IPMB Latency response (2 bytes each) */
+#define IPMI_IPMB_LATENCY_PER_RESP                              10
+/* I2C trace entries returned in each I2C Trace read response (7 bytes each) */
+#define IPMI_I2C_TRACE_PER_RESP                                 3
+/* I2C Trace request operations */
+#define IPMI_I2C_TRACE_STOP                                     0x00
+#define IPMI_I2C_TRACE_START                                    0x01
+#define IPMI_I2C_TRACE_READ                                     0x02
+/* I2C Snoop request operations */
+#define IPMI_I2C_SNOOP_STOP                                     0x00
+#define IPMI_I2C_SNOOP_START                                    0x01
+/* Kernel trace bytes returned in each Kernel Trace read response */
+#define IPMI_KERNEL_TRACE_PER_RESP                              16
+/* Kernel Trace request operations */
+#define IPMI_KERNEL_TRACE_STOP                                  0x00
+#define IPMI_KERNEL_TRACE_START                                 0x01
+#define IPMI_KERNEL_TRACE_READ                                  0x02
+#define IPMI_KERNEL_TRACE_STREAM                                0x03
+/* FPGA Load request operations */
+#define IPMI_FPGA_LOAD_STATUS                                   0x00
+#define IPMI_FPGA_LOAD_START                                    0x01
+/* Get Sensor Readings selection (request byte 0) */
+#define IPMI_SENSOR_SELECT_RANGE                                0x00
+#define IPMI_SENSOR_SELECT_BITMAP                               0x01
+/* Sensor readings returned in each Get Sensor Readings response (3 bytes each, after the token) */
+#define IPMI_SENSOR_READINGS_PER_RESP                           7
+/* Get Sensor Readings token when every selected sensor was returned */
+#define IPMI_SENSOR_READINGS_DONE                               0xFF
+
+/* Get Device SDR: read the whole record */
+#define IPMI_SDR_READ_ALL                                       0xFF
+/* Get Device SDR: record bytes that fit in a response, after the next record ID */
+#define IPMI_SDR_MAX_READ                                       ( IPMB_MAX_DATA_LEN - 1 - 2 )
+
+/* Read FRU Data: inventory bytes that fit in a response, after the count */
+#define IPMI_FRU_MAX_READ                                       ( IPMB_MAX_DATA_LEN - 1 - 1 )
+
+/* Get Sensor Reading response, byte 2 */
+#define IPMI_SENSOR_EVENT_MSGS_ENABLED                          0x80
+#define IPMI_SENSOR_SCANNING_ENABLED                            0x40
+#define IPMI_SENSOR_READING_UNAVAILABLE                         0x20
 
 /* Completion Codes */
 #define IPMI_CC_OK                                              0x00
@@ -286,20 +438,121 @@
 #define IPMI_CC_ILLEGAL_COMMAND_DISABLED                        0xd6
 #define IPMI_CC_UNSPECIFIED_ERROR                               0xff
 
+/* Request handler. Handlers that may take long (blocking bus accesses,
+   several sensor reads) should check ipmb_request_budget(req) and
+   answer IPMI_CC_TIMEOUT as soon as it reaches 0, the requester won't
+   get the response anyway. The response is the TX frame it will be
+   sent from (ipmb_response_alloc), only its completion code and data
+   are written by the handler. */
 typedef void (* t_req_handler)(ipmi_msg * req, ipmi_msg * resp);
 
+/* Handler flags */
+/* Trivial handler (constant reply, no blocking calls), run directly by
+   the dispatcher instead of being handed to a worker task */
+#define IPMI_HANDLER_INLINE    (1 << 0)
+/* Start up stages (init_stage.h, INIT_STAGE_BIT() masks) the handler
+   needs, it's answered NODE_BUSY until they're done */
+#define IPMI_HANDLER_NEEDS_SHIFT 1
+#define IPMI_HANDLER_NEEDS(stages_) ((stages_) << IPMI_HANDLER_NEEDS_SHIFT)
+#define IPMI_HANDLER_NEEDS_MASK IPMI_HANDLER_NEEDS(0x0F)
+/* Response kept by the dispatcher and served again to the same request
+   until the epoch_ subsystem changes (ipmi_cache.h); it must only
+   depend on the request data and on that subsystem. Inline handlers
+   only */
+#define IPMI_HANDLER_CACHE_SHIFT 5
+#define IPMI_HANDLER_CACHE(epoch_) (((epoch_) + 1) << IPMI_HANDLER_CACHE_SHIFT)
+#define IPMI_HANDLER_CACHE_MASK (0x03 << IPMI_HANDLER_CACHE_SHIFT)
+/* Slow handler (bus transfers, flash or EEPROM accesses, several
+   sensor reads), run by the IPMI_SLOW_HANDLER_WORKERS on their own
+   queue and larger stacks. Not for inline handlers */
+#define IPMI_HANDLER_SLOW      (1 << 7)
+
 typedef struct{
   uint8_t netfn;
   uint8_t cmd;
+  uint8_t flags;
+  uint8_t lun;
   t_req_handler req_handler;
 }t_req_handler_record;
 
+/* LUNs a request can be addressed to. The dispatcher takes the requests
+   to LUN 0 (the management commands) before the others, and keeps
+   workers free for them */
+#define IPMI_LUNS 4
+/* Workers that may be busy with requests to the other LUNs at once,
+   past that they're answered NODE_BUSY. The slow workers aren't
+   counted, their requests just wait in their queue */
+#define IPMI_SECONDARY_LUN_WORKERS ( IPMI_HANDLER_WORKERS - 1 )
+
+/* Size of the handler lookup hash table (must be a power of 2 and at
+   most 256, since the slots hold 8-bit record indexes) */
+#define IPMI_HANDLER_HASH_BITS 7
+#define IPMI_HANDLER_HASH_SIZE (1 << IPMI_HANDLER_HASH_BITS)
+/* Handlers that can be registered at run time with
+   ipmi_register_handler(), their records are kept in a static table */
+#define IPMI_RUNTIME_HANDLERS 8
+
+/* Registers a command handler. The record is emitted into the
+   .ipmi_handlers linker section and indexed by the dispatcher at boot,
+   so each module can declare its own commands next to its handlers:
+
+   IPMI_HANDLER(NETFN_APP, IPMI_GET_DEVICE_ID_CMD, ipmi_app_get_device_id);
+*/
+#define IPMI_HANDLER(netfn_, cmd_, fn_) IPMI_HANDLER_FLAGS(netfn_, cmd_, fn_, 0)
+
+/* Section of the handler records. The host build (host/inc/FreeRTOS.h)
+   uses a name the host linker brackets with __start_/__stop_ symbols */
+#ifndef IPMI_HANDLER_SECTION
+#define IPMI_HANDLER_SECTION ".ipmi_handlers"
+#endif
+
+/* Same as IPMI_HANDLER(), also setting the handler flags (IPMI_HANDLER_INLINE,
+   IPMI_HANDLER_NEEDS(), IPMI_HANDLER_CACHE(), IPMI_HANDLER_SLOW) */
+#define IPMI_HANDLER_FLAGS(netfn_, cmd_, fn_, flags_)			\
+  IPMI_HANDLER_LUN(0, netfn_, cmd_, fn_, flags_)
+
+/* Same as IPMI_HANDLER_FLAGS(), for a command of another LUN (an OEM
+   diagnostics service on LUN 1, say), which doesn't see the LUN 0
+   commands nor delays them */
+#define IPMI_HANDLER_LUN(lun_, netfn_, cmd_, fn_, flags_)		\
+  static const t_req_handler_record ipmi_handler_record_##fn_		\
+  __attribute__((section(IPMI_HANDLER_SECTION), used, aligned(4))) = {	\
+    .lun = (lun_),							\
+    .netfn = (netfn_),							\
+    .cmd = (cmd_),							\
+    .flags = (flags_),							\
+    .req_handler = (fn_)						\
+  }
+
+
+/* Deferred work, run by the dispatcher between requests */
+typedef void (* ipmi_deferred_fn)( void * ctx, uint32_t arg );
 
 /* Function Prototypes */
 void IPMITask ( void *pvParameters );
 void ipmb_init ( void );
 void IPMI_handler_task( void * pvParameters);
-t_req_handler ipmi_retrieve_handler(uint8_t netfn, uint8_t cmd);
+void ipmi_send_completion_code ( ipmi_msg * req, uint8_t completion_code );
+/* Queues fn(ctx, arg) for the dispatcher, never blocks. The dispatcher
+   services the received requests first, then the deferred work in the
+   order it was queued, so callbacks and timers can hand it their
+   processing instead of getting a task of their own. fn must not block
+   for long, requests wait behind it. Returns 1 if the work was queued,
+   0 if the queue is full or the dispatcher isn't up yet. Not to be
+   called from an interrupt. */
+uint8_t ipmi_defer ( ipmi_deferred_fn fn, void * ctx, uint32_t arg );
+const t_req_handler_record * ipmi_retrieve_handler(uint8_t lun, uint8_t netfn, uint8_t cmd);
+void ipmi_build_handler_index ( void );
+/* Adds a handler at run time (OEM commands of an optional module),
+   indexed in the same hash table as the IPMI_HANDLER() ones. Can be
+   called from any task once ipmi_init() is done. Returns 1 on success,
+   0 if the (lun, netfn, cmd) key is already handled, the LUN is out of
+   range or IPMI_RUNTIME_HANDLERS are already registered. */
+uint8_t ipmi_register_handler ( uint8_t lun, uint8_t netfn, uint8_t cmd, t_req_handler fn, uint8_t flags );
+/* Removes a handler added with ipmi_register_handler(), its commands
+   are answered INV_CMD from then on (one already dispatched still runs
+   it). Returns 1 on success, 0 if there's no such run time handler. */
+uint8_t ipmi_unregister_handler ( uint8_t lun, uint8_t netfn, uint8_t cmd );
 
 /* Handler functions */
 
@@ -307,6 +560,64 @@ t_req_handler ipmi_retrieve_handler(uint8_t netfn, uint8_t cmd);
 void ipmi_app_get_device_id ( ipmi_msg *req, ipmi_msg *rsp );
 void ipmi_picmg_get_properties ( ipmi_msg *req, ipmi_msg *rsp );
 void ipmi_se_set_receiver ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_get_receiver ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_get_sensor_reading ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_set_sensor_hysteresis ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_get_sensor_hysteresis ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_set_sensor_threshold ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_get_sensor_threshold ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_get_device_sdr_info ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_get_device_sdr ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_se_reserve_device_sdr ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_storage_get_fru_info ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_storage_read_fru_data ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_storage_write_fru_data ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_fru_control ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_fru_control_caps ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_set_fru_activation ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_get_led_properties ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_get_led_color ( ipmi_msg *req, ipmi_msg *rsp );
 void ipmi_picmg_set_led ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_get_led ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_set_amc_port_state ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_get_amc_port_state ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_get_capabilities ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_get_component_properties ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_abort ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_initiate ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_upload ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_finish ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_get_status ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_picmg_hpm_activate ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_ipmb_stats ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_clear_ipmb_stats ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_ipmb_latency ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_i2c_trace ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_sensor_readings ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_sensor_stats ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_clear_sensor_stats ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_memory_stats ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_stack_usage ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_cpu_load ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_kernel_trace ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_profile ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_echo ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_init_status ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_boot_timeline ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_crash_record ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_clear_crash_record ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_i2c_snoop ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_sensor_stream ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_fpga_load ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_queue_stats ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_set_sensor_deadband ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_telemetry_subscribe ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_chassis_get_poh_counter ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_lifetime_counters ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_metrics ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_self_test ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_event_history ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_get_response_times ( ipmi_msg *req, ipmi_msg *rsp );
+void ipmi_custom_hpm_delta_manifest ( ipmi_msg *req, ipmi_msg *rsp );
 
 #endif
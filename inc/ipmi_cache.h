@@ -0,0 +1,72 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file ipmi_cache.h
+ *
+ * @brief Responses of the read-only IPMI commands, kept for the next identical request
+ *
+ * A handler registered with IPMI_HANDLER_CACHE() (ipmi.h) says its response only depends on the request
+ * data and on the state of one subsystem (#ipmi_cache_epoch). The dispatcher keeps each successful response
+ * keyed by LUN, netfn, command and request data, tagged with the epoch count of the subsystem when the handler
+ * ran, and copies it straight into the TX frame of the next identical request without running the handler.
+ * Whoever changes the state of a subsystem calls #ipmi_cache_invalidate, which drops all its responses at
+ * once (they no longer match the epoch count).
+ * Only inline handlers are cached, so the table itself is only touched by the dispatcher.
+ */
+
+#ifndef IPMI_CACHE_H_
+#define IPMI_CACHE_H_
+
+/*! @brief Responses kept, direct mapped by the hash of their key (power of 2) */
+#define IPMI_CACHE_ENTRIES          8
+/*! @brief Longest request data kept in a key, requests with more data aren't cached */
+#define IPMI_CACHE_REQ_MAX          8
+
+/*! @brief Subsystems the cached responses depend on */
+typedef enum ipmi_cache_epoch {
+    IPMI_CACHE_STATIC,                      /*!< Constant for the life of the image (Get Device ID, Get Properties) */
+    IPMI_CACHE_SDR,                         /*!< Device SDR repository and its reservation */
+    IPMI_CACHE_FRU,                         /*!< FRU inventory contents */
+    IPMI_CACHE_EPOCHS
+} ipmi_cache_epoch;
+
+struct ipmi_msg;
+
+/*! @brief Drops the cached responses of a subsystem, from any task */
+void ipmi_cache_invalidate( ipmi_cache_epoch epoch );
+
+/*! @brief Looks up the response to a request, dispatcher only
+ *
+ * @param req: Request being answered.
+ * @param epoch: Subsystem of its handler.
+ * @param resp: Response frame, the completion code and data are copied into it on a hit.
+ * @param tag: Set on a miss, to be given to #ipmi_cache_store with the response built by the handler.
+ * @return 1 on a hit, 0 otherwise
+ */
+uint8_t ipmi_cache_lookup( const struct ipmi_msg * req, ipmi_cache_epoch epoch, struct ipmi_msg * resp, uint32_t * tag );
+
+/*! @brief Keeps the response of a handler, dispatcher only
+ *
+ * Responses other than IPMI_CC_OK aren't kept. A response built while the subsystem changed is kept with
+ * the epoch count of before (@p tag from #ipmi_cache_lookup), so it's never served.
+ */
+void ipmi_cache_store( const struct ipmi_msg * req, ipmi_cache_epoch epoch, uint32_t tag, const struct ipmi_msg * resp );
+
+#endif /*IPMI_CACHE_H_*/
@@ -0,0 +1,151 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file kernel_trace.h
+ *
+ * @brief Scheduler, queue and interrupt trace recorder
+ *
+ * With #configAPP_KERNEL_TRACE set (make KERNEL_TRACE=1), the FreeRTOS trace macros and the project interrupt
+ * handlers log into a RAM ring of #KERNEL_TRACE_LEN bytes, timed by the core cycle counter (DWT CYCCNT).
+ * The ring always holds the newest records, so stopping the trace right after a latency spike keeps what led
+ * to it. Records are packed: the #kernel_trace_event (with #KERNEL_TRACE_HAS_ARG set if the arg follows), the id,
+ * the cycles since the previous record as a varint (7 bits per byte, LS first, bit 7 set on all but the last
+ * byte), then the arg if any, 2 bytes LS first. Most records take 3 or 4 bytes instead of 8, the host tools
+ * undo the deltas from the cycle count before the oldest record (#kernel_trace_base). The entries are read out with the custom "Kernel Trace" IPMI command, or streamed to the debug UART
+ * (#kernel_trace_stream), and turned into a timeline by tools/kernel_trace_decode.py.
+ * Each request received from the IPMB gets a correlation ID (ipmb.h), and the layers handling it record the
+ * #kernel_trace_span they go through tagged with it, so the decoder can draw the waterfall of each request.
+ * The ring isn't cleared at reset (ram_sections.h): after a soft or watchdog reset, the trace that was
+ * running is read out as it was, until the next start.
+ * This header is included by FreeRTOSConfig.h, so it can only depend on the C standard types.
+ */
+
+#ifndef KERNEL_TRACE_H_
+#define KERNEL_TRACE_H_
+
+/*! @brief Bytes of the trace ring (must be a power of 2) */
+#define KERNEL_TRACE_LEN            1024
+/*! @brief Longest record: event, id, 5 byte delta and arg */
+#define KERNEL_TRACE_RECORD_MAX     9
+/*! @brief Set in the event byte of the records followed by an arg (the ones with a non zero arg) */
+#define KERNEL_TRACE_HAS_ARG        0x80
+
+/*! @brief Traced events */
+typedef enum kernel_trace_event {
+    KERNEL_TRACE_TASK_IN = 1,               /*!< id: task number */
+    KERNEL_TRACE_TASK_OUT,                  /*!< id: task number */
+    KERNEL_TRACE_TASK_READY,                /*!< id: task number of the task made ready */
+    KERNEL_TRACE_QUEUE_SEND,                /*!< id: queue type, arg: queue address */
+    KERNEL_TRACE_QUEUE_SEND_ISR,
+    KERNEL_TRACE_QUEUE_RECEIVE,
+    KERNEL_TRACE_QUEUE_RECEIVE_ISR,
+    KERNEL_TRACE_QUEUE_BLOCK_RECEIVE,       /*!< The current task is about to block on an empty queue */
+    KERNEL_TRACE_QUEUE_BLOCK_SEND,          /*!< The current task is about to block on a full queue */
+    KERNEL_TRACE_ISR_ENTER,                 /*!< id: exception number (IRQ number + 16) */
+    KERNEL_TRACE_ISR_EXIT,
+    KERNEL_TRACE_SPAN_START,                /*!< id: #kernel_trace_span, arg: correlation ID of the request */
+    KERNEL_TRACE_SPAN_STOP,
+} kernel_trace_event;
+
+/*! @brief Steps of the handling of a request, id of the span records */
+typedef enum kernel_trace_span {
+    KERNEL_TRACE_SPAN_RX = 0,               /*!< Frame decoded by the IPMB RX task */
+    KERNEL_TRACE_SPAN_QUEUE,                /*!< Waiting for the IPMI dispatcher */
+    KERNEL_TRACE_SPAN_HANDLER,              /*!< Handler running, inline or in a worker */
+    KERNEL_TRACE_SPAN_TX,                   /*!< Message in the IPMB TX task, from taken out of its queue to written */
+    KERNEL_TRACE_SPAN_I2C,                  /*!< Master transfer of the handler, plus the I2C bus number */
+} kernel_trace_span;
+
+#if configAPP_KERNEL_TRACE
+/*! @brief Adds an entry, from any context running at or below configMAX_SYSCALL_INTERRUPT_PRIORITY */
+void kernel_trace_record( uint8_t event, uint8_t id, uint32_t arg );
+
+/*! @brief Records entering (or leaving) the running interrupt handler */
+void kernel_trace_isr( uint8_t event );
+
+/*! @brief Starts or stops recording, starting clears the ring and enables the cycle counter (not while it's streamed) */
+void kernel_trace_enable( uint8_t enable );
+
+/*! @brief Bytes of records in the ring, from the oldest one on */
+uint16_t kernel_trace_length( void );
+
+/*! @brief Cycle count the delta of the oldest record is relative to */
+uint32_t kernel_trace_base( void );
+
+/*! @brief Copies the records, as bytes, while the trace is stopped
+ *
+ * @param offset: Position of the first byte, 0 being the start of the oldest record.
+ * @param buf: Where to copy them to.
+ * @param len: Bytes wanted.
+ * @return Bytes copied, 0 if there's nothing at @p offset or the trace is running
+ */
+uint8_t kernel_trace_read( uint16_t offset, uint8_t * buf, uint8_t len );
+
+/*! @brief Sends the stopped ring to the log as #LOG_BLOCK_KERNEL_TRACE blocks, without copying it (log.h)
+ *
+ * A "ktrace,stream" record with the length in bytes, the core clock in MHz and the #kernel_trace_base comes
+ * first. The trace can't be started again until the DMA is done with the ring.
+ * @return 1 if the ring is queued, 0 if the trace is running, empty, already streaming or the log is full
+ */
+uint8_t kernel_trace_stream( void );
+
+/*! @brief Adds a #KERNEL_TRACE_SPAN_START or #KERNEL_TRACE_SPAN_STOP entry, nothing if @p corr is 0 */
+void kernel_trace_span_record( uint8_t event, uint8_t span, uint16_t corr );
+
+/*! @brief Sets the correlation ID of the request the calling task works for, 0 when it's done with it
+ *
+ * Kept in the application tag of the task, which nothing else uses, so the drivers it calls can tag their spans.
+ */
+void kernel_trace_corr_set( uint16_t corr );
+
+/*! @brief Correlation ID set by the calling task, 0 if it isn't working for a request */
+uint16_t kernel_trace_corr( void );
+
+#define KERNEL_TRACE_ISR_ENTER()    kernel_trace_isr( KERNEL_TRACE_ISR_ENTER )
+#define KERNEL_TRACE_ISR_EXIT()     kernel_trace_isr( KERNEL_TRACE_ISR_EXIT )
+
+/* Spans of a request, see kernel_trace_span_record */
+#define KERNEL_TRACE_SPAN_START( span, corr )   kernel_trace_span_record( KERNEL_TRACE_SPAN_START, ( span ), ( corr ) )
+#define KERNEL_TRACE_SPAN_STOP( span, corr )    kernel_trace_span_record( KERNEL_TRACE_SPAN_STOP, ( span ), ( corr ) )
+#define KERNEL_TRACE_CORR_SET( corr )           kernel_trace_corr_set( corr )
+#define KERNEL_TRACE_CORR()                     kernel_trace_corr()
+
+/* FreeRTOS hooks, expanded inside tasks.c (pxCurrentTCB, pxTCB) */
+/* The task hooks are shared with the stack guard and the response time monitor, FreeRTOSConfig.h puts them together */
+#define KERNEL_TRACE_SWITCHED_IN()              kernel_trace_record( KERNEL_TRACE_TASK_IN, pxCurrentTCB->uxTCBNumber, 0 )
+#define KERNEL_TRACE_SWITCHED_OUT()             kernel_trace_record( KERNEL_TRACE_TASK_OUT, pxCurrentTCB->uxTCBNumber, 0 )
+#define KERNEL_TRACE_READY( pxTCB )             kernel_trace_record( KERNEL_TRACE_TASK_READY, ( pxTCB )->uxTCBNumber, 0 )
+/* Queue events, from the queue hooks of queue_stats.h */
+#define KERNEL_TRACE_QUEUE( event, pxQueue )    kernel_trace_record( ( event ), ( pxQueue )->ucQueueType, (uint32_t) ( pxQueue ) )
+#else
+#define KERNEL_TRACE_ISR_ENTER()
+#define KERNEL_TRACE_ISR_EXIT()
+#define KERNEL_TRACE_SPAN_START( span, corr )   ( (void) 0 )
+#define KERNEL_TRACE_SPAN_STOP( span, corr )    ( (void) 0 )
+#define KERNEL_TRACE_CORR_SET( corr )           ( (void) 0 )
+#define KERNEL_TRACE_CORR()                     0
+#define KERNEL_TRACE_SWITCHED_IN()
+#define KERNEL_TRACE_SWITCHED_OUT()
+#define KERNEL_TRACE_READY( pxTCB )
+#define KERNEL_TRACE_QUEUE( event, pxQueue )    ( (void) 0 )
+#endif
+
+#endif /*KERNEL_TRACE_H_*/
@@ -1,15 +1,142 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file led.h
+ *
+ * @brief FRU LEDs, driven by a hardware timer
+ *
+ * Each LED follows the PICMG FRU LED model: a local control state set by the firmware (#led_set_local,
+ * e.g. the hot swap LED), an override state set by the Shelf Manager (Set FRU LED State) and a lamp
+ * test, which wins over both until it ends. A state is off, on or blinking with on and off durations.
+ *     No task is involved: the match interrupt of TIMER1 (1 ms resolution) only fires at the next
+ * on/off transition of any LED and drives the pins itself, and the state changes just pend it.
+ * The LED IDs are the PICMG ones: #LED_BLUE is the hot swap LED, then LED1 and LED2.
+ */
+
 #ifndef LED_H_
 #define LED_H_
 
-/* LEDs Pin and port definitions */
-
+/*! @brief FRU LEDs, by PICMG LED ID */
 typedef enum LED_id {
     LED_BLUE,
+    LED_RED,
     LED_GREEN,
-    LED_RED
+    LED_COUNT
 } LED_id;
 
-/* Function to toggle the LED */
+/*! @brief Every LED, for #led_set_override */
+#define LED_ALL                     0xFF
+
+/*! @name LED functions, as in Set FRU LED State
+ * Values from 0x01 to #LED_FUNC_BLINK_MAX blink, with that off duration in tens of ms.
+ * @{
+ */
+#define LED_FUNC_OFF                0x00
+#define LED_FUNC_BLINK_MAX          0xFA
+#define LED_FUNC_LAMP_TEST          0xFB    /*!< Override only: on for a time, then back to the previous state */
+#define LED_FUNC_LOCAL              0xFC    /*!< Override only: back to the local control state */
+#define LED_FUNC_ON                 0xFF
+/*! @} */
+
+/*! @name LED colors, as in the PICMG LED commands
+ * @{
+ */
+#define LED_COLOR_BLUE              0x01
+#define LED_COLOR_RED               0x02
+#define LED_COLOR_GREEN             0x03
+#define LED_COLOR_AMBER             0x04
+#define LED_COLOR_ORANGE            0x05
+#define LED_COLOR_WHITE             0x06
+#define LED_COLOR_DONT_CHANGE       0x0E
+#define LED_COLOR_DEFAULT           0x0F
+/*! @} */
+
+/*! @name LED states, bits of #led_state::states (Get FRU LED State)
+ * @{
+ */
+#define LED_STATE_LOCAL             0x01    /*!< Always set, every LED has a local control state */
+#define LED_STATE_OVERRIDE          0x02
+#define LED_STATE_LAMP_TEST         0x04
+/*! @} */
+
+/*! @brief Longest lamp test, in hundreds of ms */
+#define LED_LAMP_TEST_MAX           0x7F
+
+/*! @brief One LED state: what it does and in which color */
+typedef struct led_pattern {
+    uint8_t function;                       /*!< #LED_FUNC_OFF, #LED_FUNC_ON or the blink off duration */
+    uint8_t on_duration;                    /*!< Blink on duration, in tens of ms */
+    uint8_t color;
+} led_pattern;
+
+/*! @brief The states of an LED, as reported by Get FRU LED State */
+typedef struct led_state {
+    uint8_t states;                         /*!< LED_STATE_* bits */
+    led_pattern local;
+    led_pattern override;                   /*!< Meaningless without #LED_STATE_OVERRIDE */
+    uint8_t lamp_test_duration;             /*!< Hundreds of ms, meaningless without #LED_STATE_LAMP_TEST */
+} led_state;
+
+/*! @brief What an LED can do (Get LED Color Capabilities) */
+typedef struct led_caps {
+    uint8_t colors;                         /*!< Bit n set for color n */
+    uint8_t local_color;                    /*!< Default color of the local control state */
+    uint8_t override_color;                 /*!< Default color of the override state */
+} led_caps;
+
+/*! @brief Configures the LED pins and starts the timer, the LEDs start in their local control state (all off) */
+void led_init( void );
+
+/*! @brief Capabilities of an LED, NULL if there's no such LED */
+const led_caps * led_get_caps( uint8_t led );
+
+/*! @brief Sets the local control state of an LED, in effect unless it's overridden
+ *
+ * @param led: LED ID.
+ * @param function: #LED_FUNC_OFF, #LED_FUNC_ON or a blink off duration (tens of ms).
+ * @param on_duration: Blink on duration, from 1 to #LED_FUNC_BLINK_MAX tens of ms (ignored unless it blinks).
+ * @return 1 on success, 0 if there's no such LED or the function is invalid
+ */
+uint8_t led_set_local( uint8_t led, uint8_t function, uint8_t on_duration );
+
+/*! @brief Overrides the state of an LED (or of all of them, #LED_ALL), as asked by Set FRU LED State
+ *
+ * @param led: LED ID or #LED_ALL.
+ * @param function: An LED function, #LED_FUNC_LAMP_TEST and #LED_FUNC_LOCAL included.
+ * @param on_duration: Blink on duration in tens of ms, or lamp test duration in hundreds of ms (up to #LED_LAMP_TEST_MAX).
+ * @param color: An LED color of the LED, #LED_COLOR_DONT_CHANGE or #LED_COLOR_DEFAULT.
+ * @return 1 on success, 0 if a parameter is invalid (then no LED is changed)
+ */
+uint8_t led_set_override( uint8_t led, uint8_t function, uint8_t on_duration, uint8_t color );
+
+/*! @brief Copies the states of an LED
+ *
+ * @return 1 on success, 0 if there's no such LED
+ */
+uint8_t led_get_state( uint8_t led, led_state * state );
+
+/*! @brief Toggles an LED pin directly, behind the back of the LED states
+ *
+ * For the debug code and the fault handlers (interrupts disabled) only.
+ */
 void prvToggleLED( LED_id led );
 
 #endif /* LED_H_ */
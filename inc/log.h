@@ -0,0 +1,143 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file log.h
+ *
+ * @brief Binary logger, drained to the debug UART by the GPDMA
+ *
+ * A log call doesn't format anything: it writes a record with the ID of its format string, a
+ * sequence number, the microsecond timestamp of the boot timeline (boot_time.h) and up to 4 arguments
+ * into a RAM ring, under the interrupt mask for a few dozen cycles, from a task or an interrupt. The
+ * format strings go in the .log_fmt section, which isn't loaded: the ID is the offset of the string in
+ * it, and tools/log_decode.py reads them from the ELF file to print the records captured on the UART.
+ *     The GPDMA moves the ring to UART0 in the background, the CPU only starts a transfer every
+ * #LOG_DRAIN_PERIOD or when the previous one completes. A full ring drops the new records (the decoder
+ * sees the gap in the sequence numbers), so logging never blocks and can stay on in production.
+ * An argument printed with %s must be a pointer to a string in the image (flash), the decoder reads it there.
+ * @code
+ * LOG( "ipmb,retry,%u,%x", seq, addr );
+ * @endcode
+ *     Bulk diagnostics (trace rings, tables) go out with #log_send_block: the ring only gets a block header,
+ * the DMA then reads the bytes from where they are, between the records written before and after it.
+ * At #LOG_UART_BAUD 921600 (make LOG_BAUD=921600) that's about 90 kB/s, against a few hundred bytes
+ * per second read out through IPMB requests.
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+/*! @brief Ring size in bytes (must be a power of 2) */
+#define LOG_RING_LEN                2048
+/*! @brief Longest DMA transfer from the ring */
+#define LOG_DMA_MAX                 1024
+/*! @brief Time between two checks of the ring when the DMA is idle */
+#define LOG_DRAIN_PERIOD            ( 10 / portTICK_PERIOD_MS )
+#define LOG_UART                    LPC_UART0
+/*! @brief Debug UART baud rate (make LOG_BAUD=...), the capture side must use the same one */
+#ifndef LOG_UART_BAUD
+#define LOG_UART_BAUD               115200
+#endif
+#define LOG_ARGS_MAX                4
+
+/*! @name Record: sync byte, argument count, sequence, format ID (2), timestamp (4), arguments (4 each), little endian
+ * @{
+ */
+#define LOG_SYNC                    0xA5
+#define LOG_HEADER_LEN              9
+#define LOG_RECORD_MAX              ( LOG_HEADER_LEN + 4 * LOG_ARGS_MAX )
+/*! @} */
+
+/*! @name Block: sync byte, tag, sequence, length (2), timestamp (4), then the bytes of the block
+ * @{
+ */
+#define LOG_SYNC_BLOCK              0x5A
+/*! @brief Longest block, a single GPDMA transfer */
+#define LOG_BLOCK_MAX               4095
+/*! @} */
+
+/*! @name Block tags
+ * @{
+ */
+#define LOG_BLOCK_KERNEL_TRACE      0x01    /*!< Kernel trace records (kernel_trace.h), oldest first */
+#define LOG_BLOCK_SENSORS           0x02    /*!< #sensor_snapshot array, one per changed sensor */
+/*! @} */
+
+/*! @brief Block of memory sent by the log DMA as it is, see #log_send_block
+ *
+ * The descriptor belongs to the caller and stays queued (so untouched) until #done is called.
+ */
+typedef struct log_block {
+    const void * data;                      /*!< Bytes to send, in the AHB SRAM (read by the GPDMA) */
+    uint16_t len;                           /*!< Up to #LOG_BLOCK_MAX */
+    uint8_t tag;                            /*!< Tells the decoder what the bytes are */
+    void (* done)( struct log_block * block ); /*!< Called from the DMA interrupt once sent, may be NULL */
+    uint32_t pos;                           /*!< Ring position right after the header (logger only) */
+    struct log_block * next;                /*!< Next queued block (logger only) */
+} log_block;
+
+/*! @brief Writes a record, from any context running at or below configMAX_SYSCALL_INTERRUPT_PRIORITY (see #LOG) */
+void log_record( uint16_t id, uint8_t nargs, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3 );
+
+/* Argument count and padding of the #LOG arguments */
+#define LOG_NARGS_( _0, _1, _2, _3, _4, n, ... )    n
+#define LOG_NARGS( ... )            LOG_NARGS_( _, ##__VA_ARGS__, 4, 3, 2, 1, 0 )
+#define LOG_ARGS_( _, a0, a1, a2, a3, ... ) \
+    (uint32_t) ( a0 ), (uint32_t) ( a1 ), (uint32_t) ( a2 ), (uint32_t) ( a3 )
+
+/*! @brief Logs a printf style format (%d, %u, %x, %c and %s only) with up to 4 integer or pointer arguments */
+#define LOG( fmt, ... )                                                             \
+    do {                                                                            \
+        static const char log_fmt_[] __attribute__ ((section(".log_fmt"))) = fmt;   \
+        log_record( (uint32_t) log_fmt_, LOG_NARGS( __VA_ARGS__ ),                  \
+                    LOG_ARGS_( _, ##__VA_ARGS__, 0, 0, 0, 0 ) );                    \
+    } while ( 0 )
+
+/*! @brief Takes UART0 and a GPDMA channel and starts draining the ring, records written before are kept */
+void log_init( void );
+
+/*! @brief Queues a block to be sent after the records written so far, without copying it
+ *
+ * Only the header goes in the ring, so it takes a sequence number like a record. The bytes are read by the
+ * DMA when their turn comes: they must stay as they are until the #log_block.done callback.
+ * @param block: Descriptor, with the data, len, tag and done fields set.
+ * @return 1 on success, 0 if the block is too long, already queued or the ring has no room for its header
+ */
+uint8_t log_send_block( log_block * block );
+
+/*! @brief Records dropped because the ring was full */
+uint32_t log_dropped( void );
+
+/*! @brief Sends what's left in the ring by polling the UART, with the interrupts disabled (fault handlers) */
+void log_panic_flush( void );
+
+/*! @brief Copies the newest bytes written to the ring (sent or not), oldest first, with the interrupts disabled
+ *
+ * @param data: Where to copy them to.
+ * @param len: Bytes wanted, up to #LOG_RING_LEN.
+ * @return Bytes copied, fewer since boot were written
+ */
+uint32_t log_last( uint8_t * data, uint32_t len );
+
+/*! @brief DMA interrupt part of the logger, called by the handler shared with the ADC (adc.c) */
+void log_dma_irq( void );
+
+#endif /*LOG_H_*/
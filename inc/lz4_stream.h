@@ -0,0 +1,79 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file lz4_stream.h
+ *
+ * @brief Streaming decoder of the LZ4 block format, one input chunk at a time and without a window buffer
+ *
+ * The input can come in pieces of any size (the blocks of an upload): the decoder keeps where it is in the
+ * sequence between calls. It has no window of its own, the output is written and read back through an
+ * #lz4_sink, so the caller keeps the output where it goes anyway (a flash image readable as it's written) and
+ * a match can reach as far back as the format allows (64 KB). A sink that can't take a byte right now stops
+ * the decoder, which picks up from that byte on the next call.
+ * The expected output length is given at the start: the last sequence of a block has no match, so that's how
+ * its end is found. Any inconsistency (match before the start, output overrun, bytes past the end) makes the
+ * stream fail for good.
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef LZ4_STREAM_H_
+#define LZ4_STREAM_H_
+
+/*! @brief Where the decoded bytes go */
+typedef struct lz4_sink {
+    uint8_t (* put)( uint8_t byte );        /*!< Appends a byte, 0 if it can't take it now */
+    uint8_t (* get)( uint16_t distance );   /*!< Byte written @p distance bytes before the next one (1 is the last) */
+} lz4_sink;
+
+/*! @brief Decoder state, the storage is the caller's */
+typedef struct lz4_stream {
+    uint32_t total;                         /*!< Output bytes expected */
+    uint32_t left;                          /*!< Output bytes still to come */
+    uint32_t count;                         /*!< Literal or match bytes left in the current sequence */
+    uint16_t offset;                        /*!< Distance of the current match */
+    uint8_t token;
+    uint8_t state;
+} lz4_stream;
+
+/*! @brief Starts a stream
+ *
+ * @param total: Bytes the stream decodes to.
+ */
+void lz4_stream_init( lz4_stream * stream, uint32_t total );
+
+/*! @brief Decodes input bytes
+ *
+ *     Stops at the end of the input, when the sink refuses a byte, or when the stream is done or has failed.
+ * The input not consumed must be given again (possibly with more after it) on the next call. A match can
+ * still have bytes to write once the input is consumed: they go out on the next call, which may have no input.
+ * @return Input bytes consumed
+ */
+uint16_t lz4_stream_feed( lz4_stream * stream, const uint8_t * in, uint16_t len, const lz4_sink * sink );
+
+/*! @brief Tells if the decoder has bytes to write that need no more input (a match cut by the sink) */
+uint8_t lz4_stream_pending( const lz4_stream * stream );
+
+/*! @brief Tells if all the @p total bytes were decoded, at the end of a sequence */
+uint8_t lz4_stream_done( const lz4_stream * stream );
+
+/*! @brief Tells if the stream is inconsistent, nothing more is decoded from it */
+uint8_t lz4_stream_failed( const lz4_stream * stream );
+
+#endif /*LZ4_STREAM_H_*/
@@ -0,0 +1,72 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file mem_pool.h
+ *
+ * @brief Fixed size block pools
+ *
+ * A pool hands out blocks of one size from a static array. The free blocks are kept in a list linked
+ * through their first word, so allocating and freeing are O(1) and never touch the FreeRTOS heap.
+ * Both only mask the interrupts up to configMAX_SYSCALL_INTERRUPT_PRIORITY for a few instructions,
+ * so they can be called from tasks and from those interrupts alike.
+ */
+
+#ifndef MEM_POOL_H_
+#define MEM_POOL_H_
+
+/*! @brief Most pools that can be registered, see #mem_pool_get */
+#define MEM_POOL_MAX                4
+
+/*! @brief Block pool, only touched through the mem_pool functions */
+typedef struct mem_pool {
+    const char * name;
+    void * free;                            /*!< First free block */
+    uint8_t * base;                         /*!< Storage of the blocks */
+    uint16_t block_size;
+    uint16_t count;                         /*!< Blocks in the pool */
+    uint16_t used;                          /*!< Blocks currently allocated */
+    uint16_t high_water;                    /*!< Most blocks ever allocated at once */
+    uint32_t exhausted;                     /*!< Allocations that failed because every block was taken */
+} mem_pool;
+
+/*! @brief Sets up a pool over an array of blocks and registers it
+ *
+ * @param pool: Pool to set up.
+ * @param name: Name reported by the instrumentation.
+ * @param storage: Blocks, word aligned.
+ * @param block_size: Size of each block, at least a pointer and a multiple of 4.
+ * @param count: Number of blocks.
+ */
+void mem_pool_init( mem_pool * pool, const char * name, void * storage, uint16_t block_size, uint16_t count );
+
+/*! @brief Takes a block, NULL if the pool is exhausted (never waits) */
+void * mem_pool_alloc( mem_pool * pool );
+
+/*! @brief Gives a block back to its pool */
+void mem_pool_free( mem_pool * pool, void * block );
+
+/*! @brief Tells if a pointer is a block of the pool */
+uint8_t mem_pool_owns( const mem_pool * pool, const void * block );
+
+/*! @brief Registered pool, NULL past the last one */
+const mem_pool * mem_pool_get( uint8_t index );
+
+#endif /*MEM_POOL_H_*/
@@ -0,0 +1,62 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file mem_stats.h
+ *
+ * @brief Heap usage and allocation failures
+ *
+ * Reads the counters of the FreeRTOS heap (heap_2 or heap_4, #configAPP_HEAP) and records the first allocation that failed: traceMALLOC (FreeRTOSConfig.h)
+ * notes the caller of pvPortMalloc, which the malloc failed hook then latches. The pools of mem_pool.h keep
+ * their own counters.
+ */
+
+#ifndef MEM_STATS_H_
+#define MEM_STATS_H_
+
+/*! @brief Snapshot of the FreeRTOS heap */
+typedef struct heap_stats {
+    size_t total;                           /*!< Bytes that can be allocated */
+    size_t free;                            /*!< Bytes currently free */
+    size_t min_free;                        /*!< Fewest bytes ever free */
+    size_t largest_free;                    /*!< Largest free block, the biggest allocation that can succeed */
+    uint16_t free_blocks;                   /*!< Free blocks, more of them for the same free bytes means more fragmentation */
+} heap_stats;
+
+/*! @brief Allocation failures */
+typedef struct malloc_failure {
+    uint32_t count;                         /*!< Failed allocations */
+    uint32_t caller;                        /*!< Return address of the first failed pvPortMalloc call, 0 if none failed */
+    size_t size;                            /*!< Bytes it asked for, heap block header and alignment included */
+} malloc_failure;
+
+/*! @brief Reads the heap counters (walks the free list) */
+void mem_stats_get_heap( heap_stats * stats );
+
+/*! @brief Copies the allocation failures record */
+void mem_stats_get_malloc_failure( malloc_failure * failure );
+
+/*! @brief Called by traceMALLOC when pvPortMalloc returns NULL, with the scheduler suspended */
+void mem_stats_malloc_trace( void * caller, size_t size );
+
+/*! @brief Called by vApplicationMallocFailedHook, counts the failure and latches the first one */
+void mem_stats_malloc_failed( void );
+
+#endif /*MEM_STATS_H_*/
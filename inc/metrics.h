@@ -0,0 +1,129 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file metrics.h
+ *
+ * @brief Registry of the counters, gauges and histograms of all the modules, dumped by one IPMI command
+ *
+ * A module declares each metric next to the variable it lives in, at file scope:
+ *
+ * static uint32_t sensor_read_errors;
+ * METRIC_COUNTER( "sensor.read_err", sensor_read_errors );
+ *
+ * The descriptors go to the .metrics linker section, like the IPMI handler records, so there's no table to
+ * keep up to date and no registration at run time. The variables are updated in place with #METRIC_INC,
+ * #METRIC_ADD and #METRIC_SET, single atomic operations (LDREX/STREX on the Cortex-M3) safe from any task or
+ * interrupt; a gauge that is computed rather than stored is read by a function when dumped (#METRIC_GAUGE_FN).
+ *     The custom Get Metrics command pages through the registry in a compact TLV format (#metrics_dump): the
+ * names once, then only the values, each a LEB128 varint, so a scraper polling every board of a crate reads a
+ * few bytes per counter.
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+/*! @name Metric types, the T of the TLVs
+ * @{
+ */
+#define METRIC_TYPE_COUNTER         0x01    /*!< Only goes up, until the statistics of its module are cleared */
+#define METRIC_TYPE_GAUGE           0x02    /*!< Current value */
+#define METRIC_TYPE_HISTOGRAM       0x03    /*!< Array of bucket counts */
+/*! @} */
+
+/*! @name Pages of #metrics_dump
+ * @{
+ */
+#define METRICS_PAGE_VALUES         0x00    /*!< Values, one element per counter or gauge and per histogram bucket */
+#define METRICS_PAGE_NAMES          0x01    /*!< Descriptors, one element per metric */
+/*! @} */
+
+/*! @brief Element of #metrics_dump past the last one */
+#define METRICS_END                 0xFFFF
+
+/*! @brief Section of the descriptors. The host build (host/inc/FreeRTOS.h) uses a name the host linker brackets
+ * with __start_/__stop_ symbols */
+#ifndef METRIC_SECTION
+#define METRIC_SECTION              ".metrics"
+#endif
+
+/*! @brief Metric descriptor, see #METRIC_COUNTER */
+typedef struct metric_desc {
+    const char * name;
+    const volatile void * value;            /*!< First element, NULL for a gauge read by #read */
+    uint32_t (* read)( void );              /*!< Computed gauges only */
+    uint8_t type;                           /*!< METRIC_TYPE_* */
+    uint8_t size;                           /*!< Bytes per element: 1, 2 or 4 */
+    uint8_t count;                          /*!< Elements: buckets of a histogram, 1 otherwise */
+} metric_desc;
+
+#define METRIC_CAT_( a, b )         a##b
+#define METRIC_CAT( a, b )          METRIC_CAT_( a, b )
+
+/*! @brief Descriptor in the .metrics section, use the METRIC_COUNTER / GAUGE / HISTOGRAM shorthands */
+#define METRIC_DESC( type_, name_, value_, read_, size_, count_ )                               \
+    static const metric_desc METRIC_CAT( metric_record_, __COUNTER__ )                          \
+    __attribute__((section(METRIC_SECTION), used, aligned(4))) = {                              \
+        .name = (name_),                                                                        \
+        .value = (value_),                                                                      \
+        .read = (read_),                                                                        \
+        .type = (type_),                                                                        \
+        .size = (size_),                                                                        \
+        .count = (count_)                                                                       \
+    }
+
+/*! @brief Registers an unsigned variable (or array element) of 1, 2 or 4 bytes as a counter */
+#define METRIC_COUNTER( name, var ) \
+    METRIC_DESC( METRIC_TYPE_COUNTER, name, &( var ), NULL, sizeof( var ), 1 )
+/*! @brief Registers an unsigned variable of 1, 2 or 4 bytes as a gauge */
+#define METRIC_GAUGE( name, var ) \
+    METRIC_DESC( METRIC_TYPE_GAUGE, name, &( var ), NULL, sizeof( var ), 1 )
+/*! @brief Registers a gauge read by uint32_t fn( void ) when dumped, which mustn't block */
+#define METRIC_GAUGE_FN( name, fn ) \
+    METRIC_DESC( METRIC_TYPE_GAUGE, name, NULL, fn, 4, 1 )
+/*! @brief Registers an array of bucket counts (up to 255) as a histogram */
+#define METRIC_HISTOGRAM( name, array ) \
+    METRIC_DESC( METRIC_TYPE_HISTOGRAM, name, array, NULL, sizeof( ( array )[0] ), sizeof( array ) / sizeof( ( array )[0] ) )
+
+/*! @brief Adds one to a metric variable, atomically */
+#define METRIC_INC( var )           __atomic_fetch_add( &( var ), 1, __ATOMIC_RELAXED )
+/*! @brief Adds to a metric variable, atomically */
+#define METRIC_ADD( var, n )        __atomic_fetch_add( &( var ), ( n ), __ATOMIC_RELAXED )
+/*! @brief Sets a metric variable with a single store */
+#define METRIC_SET( var, v )        __atomic_store_n( &( var ), ( v ), __ATOMIC_RELAXED )
+
+/*! @brief Number of registered metrics */
+uint16_t metrics_count( void );
+
+/*! @brief Fills a page of the registry with TLVs
+ *
+ *     Each TLV is the type of a metric, the length of what follows, then for #METRICS_PAGE_NAMES the number of
+ * elements of the metric and its name (no NUL), for #METRICS_PAGE_VALUES the values of its elements as LEB128
+ * varints. A histogram that doesn't fit in the page is split: the next page starts with a TLV holding the rest of
+ * its buckets. The elements are numbered from 0 in the order of the section, which is the same in both pages.
+ * @param page: #METRICS_PAGE_VALUES or #METRICS_PAGE_NAMES.
+ * @param element: First element to dump, set to the first one left out, #METRICS_END once the last one is in.
+ * @param buf: Where to write the TLVs.
+ * @param size: Room in @p buf.
+ * @return Bytes written
+ */
+uint8_t metrics_dump( uint8_t page, uint16_t * element, uint8_t * buf, uint8_t size );
+
+#endif /*METRICS_H_*/
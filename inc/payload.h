@@ -0,0 +1,75 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file payload.h
+ *
+ * @brief Payload power sequencer
+ *
+ * The payload rails (#PAYLOAD_RAILS in board_defs.h) are brought up one after the other: each step
+ * turns its enable on and waits for the rail's power good signal, through a GPIO edge interrupt,
+ * or for its settling time when it has none. So a step takes as long as the rail needs, not a
+ * worst case delay, and no task ever waits: the sequence is a thread of the timer task (pt.h),
+ * woken by the power good interrupts and timed out through the timer wheel. A rail that doesn't
+ * come up in time fails the power up and takes the rails already up down again, in reverse order.
+ * Power down goes in reverse order too, waiting for each power good to drop (a timeout there only
+ * counts as a fault).
+ */
+
+#ifndef PAYLOAD_H_
+#define PAYLOAD_H_
+
+/*! @brief Power good port of a rail without power good signal */
+#define PAYLOAD_NO_PG               0xFF
+
+/*! @brief Payload power states */
+typedef enum payload_state {
+    PAYLOAD_OFF,
+    PAYLOAD_POWERING_UP,
+    PAYLOAD_ON,
+    PAYLOAD_POWERING_DOWN,
+} payload_state;
+
+/*! @brief Called in the timer task when a power up or down is over
+ *
+ * @param ok: 1 if all the rails made it, 0 if one timed out (after a failed power up, the payload is off).
+ */
+typedef void (* payload_callback)( uint8_t ok );
+
+/*! @brief Configures the enables (all off) and the power good inputs, before the scheduler starts */
+void payload_init( void );
+
+/*! @brief Starts powering the payload up or down, never blocks
+ *
+ * A running sequence is turned around from the rail it's at, its callback isn't called anymore.
+ * The sequence never completes inside this call, even when there's nothing to do.
+ * @param on: 1 to power up, 0 to power down.
+ * @param done: Called when it's over, may be NULL.
+ * @return 1 if the sequence is started, 0 if the timer command queue is full
+ */
+uint8_t payload_power( uint8_t on, payload_callback done );
+
+/*! @brief Current payload power state */
+payload_state payload_get_state( void );
+
+/*! @brief Rails that missed their power good timeout since #payload_init */
+uint32_t payload_faults( void );
+
+#endif /*PAYLOAD_H_*/
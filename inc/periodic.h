@@ -0,0 +1,68 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file periodic.h
+ *
+ * @brief Periodic jobs sharing a single software timer
+ *
+ * Small periodic activities (samplers, LED patterns, watchdog kicks...) don't get a task or a timer each:
+ * they're described by a #periodic_job and run by one FreeRTOS timer, in the timer task, so they share its
+ * stack and no context switch happens between them. The timer is one-shot and rearmed for the next job due,
+ * so nothing wakes up between runs. The phase offsets the first run of a job, spreading the jobs of the same
+ * period over different ticks.
+ * A job must not block (it's a timer callback) and should be short: the jobs due on the same tick run one
+ * after the other. One late by a full period or more skips the runs it missed instead of catching up.
+ * @code
+ * static periodic_job sample_job = PERIODIC_JOB( "Sample", prvSample, NULL, 1000 / portTICK_PERIOD_MS, 0 );
+ * periodic_start( &sample_job );
+ * @endcode
+ */
+
+#ifndef PERIODIC_H_
+#define PERIODIC_H_
+
+/*! @brief Most jobs started */
+#define PERIODIC_MAX_JOBS           8
+
+/*! @brief Periodic job, the storage is the caller's */
+typedef struct periodic_job {
+    const char * name;
+    void (* run)( void * arg );             /*!< Called in the timer task, mustn't block */
+    void * arg;
+    TickType_t period;                      /*!< Time between runs */
+    TickType_t phase;                       /*!< Time from #periodic_start to the first run */
+    /* Managed by periodic.c */
+    TickType_t due;                         /*!< Tick of the next run */
+    uint32_t runs;
+    uint32_t skipped;                       /*!< Runs missed because the job was late by a full period */
+} periodic_job;
+
+/*! @brief #periodic_job initializer */
+#define PERIODIC_JOB( name, run, arg, period, phase )   { name, run, arg, period, phase, 0, 0, 0 }
+
+/*! @brief Starts running a job, before or after the scheduler starts
+ *
+ * @param job: Job descriptor, must stay valid (static storage).
+ * @return 1 on success, 0 if #PERIODIC_MAX_JOBS jobs are already running
+ */
+uint8_t periodic_start( periodic_job * job );
+
+#endif /*PERIODIC_H_*/
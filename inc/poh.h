@@ -0,0 +1,42 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file poh.h
+ *
+ * @brief Power-on hours and lifetime IPMB error totals
+ *
+ * A periodic job (periodic.h) adds an hour to the power-on counter of the config store every #POH_PERIOD,
+ * together with the IPMB and I2C errors counted since its last run (see #ipmb_stat_id), so these totals
+ * survive resets and #ipmb_clear_stats. The power-on hours are returned by the Chassis Get POH Counter command,
+ * the totals by the custom Get Lifetime Counters command. Up to an hour of both is lost at each reset.
+ */
+
+#ifndef POH_H_
+#define POH_H_
+
+/*! @brief Minutes per count of the power-on counter, as returned by Get POH Counter */
+#define POH_MINUTES_PER_COUNT       60
+/*! @brief Time between runs of the job */
+#define POH_PERIOD                  ( POH_MINUTES_PER_COUNT * 60 * 1000 / portTICK_PERIOD_MS )
+
+/*! @brief Starts the counting job, after #config_init */
+void poh_init( void );
+
+#endif /*POH_H_*/
@@ -0,0 +1,114 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file priorities.h
+ *
+ * @brief Priorities of every task and interrupt, with the period and deadline of each task
+ *
+ * The one place to change them. #TASK_PLAN has a line per task, by the name it's created with (the kernel
+ * truncates it to configMAX_TASK_NAME_LEN - 1 characters): X( name, priority, instances, period_ms, deadline_ms ).
+ * The period is the one of a task woken by the clock, 0 for one woken by events. The deadline is the longest a
+ * wake up of the task may take, from the task made ready to it blocking again, 0 for the background tasks.
+ * An IPMB request goes through the RX task, the dispatcher, a worker and the TX task, and their deadlines add up
+ * to 150 ms, within the 250 ms the requester waits (#IPMB_MSG_TIMEOUT on our side). Built with
+ * #configAPP_RESPONSE_TIME, the response time monitor (response_time.h) checks the measured response times
+ * against these deadlines.
+ * Interrupt priorities are NVIC levels (0 most urgent, configPRIO_BITS wide). All the handlers call the FreeRTOS
+ * API, so none may be more urgent than configMAX_SYSCALL_INTERRUPT_PRIORITY (level 5); the kernel ones (SysTick,
+ * PendSV) are at the lowest, configKERNEL_INTERRUPT_PRIORITY.
+ * This header is included by FreeRTOSConfig.h, so it can only depend on the C standard types.
+ */
+
+#ifndef PRIORITIES_H_
+#define PRIORITIES_H_
+
+/*! @name Task priorities, most urgent first
+ * @{
+ */
+/*! @brief Deferred work daemon (deferred.h), above the timer task: interrupt work comes first */
+#define DEFERRED_TASK_PRIORITY      ( configMAX_PRIORITIES - 1 )
+/*! @brief Timer task: software timers, periodic jobs (periodic.h) and the timer wheel (timer_wheel.h) */
+#define TIMER_TASK_PRIORITY         ( configMAX_PRIORITIES - 2 )
+/*! @brief IPMB TX and RX tasks */
+#define IPMB_TXTASK_PRIORITY        3
+#define IPMB_RXTASK_PRIORITY        IPMB_TXTASK_PRIORITY
+/*! @brief RTM task, same as the IPMB tasks: it only moves frames */
+#define RTM_TASK_PRIORITY           IPMB_RXTASK_PRIORITY
+/*! @brief IPMI dispatcher and workers, with the IPMB tasks so a response doesn't wait behind the next frame */
+#define IPMI_TASK_PRIORITY          IPMB_TXTASK_PRIORITY
+#define IPMI_HANDLER_TASK_PRIORITY  IPMB_TXTASK_PRIORITY
+/*! @brief Slow IPMI handlers, below the IPMB tasks and the other workers so they can't hold up a quick response */
+#define IPMI_SLOW_HANDLER_TASK_PRIORITY ( IPMB_TXTASK_PRIORITY - 1 )
+/*! @brief Background tasks, below the IPMB/IPMI tasks */
+#define BACKGROUND_TASK_PRIORITY    ( tskIDLE_PRIORITY + 1 )
+/*! @brief Sensor poller */
+#define SENSOR_TASK_PRIORITY        BACKGROUND_TASK_PRIORITY
+/*! @brief Task monitor, starving it resets the board */
+#define WATCHDOG_TASK_PRIORITY      BACKGROUND_TASK_PRIORITY
+/*! @brief Self tests, with the sensor poller whose timing they check */
+#define SELFTEST_TASK_PRIORITY      BACKGROUND_TASK_PRIORITY
+/*! @brief Deferred init, heap allocated and gone once it's done */
+#define INIT_TASK_PRIORITY          BACKGROUND_TASK_PRIORITY
+/*! @brief HPM upgrades, the flash doesn't hurry */
+#define HPM_TASK_PRIORITY           BACKGROUND_TASK_PRIORITY
+/*! @brief FPGA loads, the DMA does the moving */
+#define FPGA_TASK_PRIORITY          BACKGROUND_TASK_PRIORITY
+/*! @brief Config store, it only writes the flash */
+#define CONFIG_TASK_PRIORITY        BACKGROUND_TASK_PRIORITY
+/*! @} */
+
+/*! @brief Every task, X( name, priority, instances, period_ms, deadline_ms ), the kernel ones included */
+#define TASK_PLAN( X )                                                          \
+    X( "Deferred",          DEFERRED_TASK_PRIORITY,     1,  0,      2   )       \
+    X( "Tmr Svc",           TIMER_TASK_PRIORITY,        1,  0,      10  )       \
+    X( "IPMB_TX",           IPMB_TXTASK_PRIORITY,       1,  0,      20  )       \
+    X( "IPMB_RX",           IPMB_RXTASK_PRIORITY,       1,  0,      10  )       \
+    X( "IPMB_RX_B",         IPMB_RXTASK_PRIORITY,       1,  0,      10  )       \
+    X( "RTM",               RTM_TASK_PRIORITY,          1,  0,      20  )       \
+    X( "IPMI Dispatcher",   IPMI_TASK_PRIORITY,         1,  0,      20  )       \
+    X( "IPMI Worker",       IPMI_HANDLER_TASK_PRIORITY, 2,  0,      100 )       \
+    X( "IPMI Slow",         IPMI_SLOW_HANDLER_TASK_PRIORITY, 1, 0,  1000 )      \
+    X( "Sensors",           SENSOR_TASK_PRIORITY,       1,  10,     10  )       \
+    X( "Watchdog",          WATCHDOG_TASK_PRIORITY,     1,  250,    250 )       \
+    X( "SelfTest",          SELFTEST_TASK_PRIORITY,     1,  0,      0   )       \
+    X( "Init",              INIT_TASK_PRIORITY,         1,  0,      0   )       \
+    X( "HPM",               HPM_TASK_PRIORITY,          1,  0,      0   )       \
+    X( "FPGA",              FPGA_TASK_PRIORITY,         1,  0,      0   )       \
+    X( "Config",            CONFIG_TASK_PRIORITY,       1,  0,      0   )       \
+    X( "IDLE",              tskIDLE_PRIORITY,           1,  0,      0   )
+
+#define TASK_PLAN_INSTANCES( name, priority, instances, period, deadline )  + ( instances )
+/*! @brief Most tasks created, from the table */
+#define TASK_PLAN_TASKS             ( 0 TASK_PLAN( TASK_PLAN_INSTANCES ) )
+
+/*! @name Interrupt priorities (NVIC levels)
+ * @{
+ */
+/*! @brief I2C buses, a slave on the IPMB stretches SCL until its byte is served */
+#define I2C_IRQ_PRIORITY            5
+/*! @brief GPDMA, one handler for the log UART, ADC and FPGA channels */
+#define DMA_IRQ_PRIORITY            6
+/*! @brief EINT3, the GPIO interrupts (hot swap handle, payload signals) */
+#define GPIO_IRQ_PRIORITY           6
+/*! @brief LED pattern timer */
+#define LED_IRQ_PRIORITY            7
+/*! @} */
+
+#endif /*PRIORITIES_H_*/
@@ -0,0 +1,97 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file prof.h
+ *
+ * @brief Cycle count probes on the hot paths
+ *
+ * With #configAPP_PROFILE set (make PROFILE=1), #PROF_SCOPE measures the core cycles (DWT CYCCNT) from where it
+ * stands to the end of the enclosing block and adds them to the count, total, min and max of its probe.
+ * The probes are read with the custom "Get Profile" IPMI command. Without the option everything compiles to nothing.
+ * @code
+ * uint8_t ipmb_encode ( uint8_t * buffer, ipmi_msg * msg )
+ * {
+ *     PROF_SCOPE( PROF_IPMB_ENCODE );
+ *     ...
+ * }
+ * @endcode
+ * Nested probes count their time in both. A probe taken from an interrupt while the same one runs in a task
+ * also counts the interrupt in the task measurement.
+ */
+
+#ifndef PROF_H_
+#define PROF_H_
+
+/*! @brief Probes, X( id, description ) */
+#define PROF_PROBES( X )                                        \
+    X( PROF_I2C_ISR,        "I2C interrupt" )                   \
+    X( PROF_IPMB_ENCODE,    "IPMB frame encoding" )             \
+    X( PROF_IPMB_DECODE,    "IPMB frame decoding" )             \
+    X( PROF_IPMB_CHKSUM,    "IPMB checksum" )                   \
+    X( PROF_IPMI_LOOKUP,    "IPMI handler lookup" )             \
+    X( PROF_IPMI_HANDLER,   "IPMI handler execution" )
+
+#define PROF_PROBE_ENUM( id, desc )     id,
+enum prof_probe {
+    PROF_PROBES( PROF_PROBE_ENUM )
+    PROF_PROBE_COUNT
+};
+
+/*! @brief Measurements of a probe */
+typedef struct prof_stats {
+    uint32_t count;
+    uint64_t total;                         /*!< Cycles */
+    uint32_t min;
+    uint32_t max;
+} prof_stats;
+
+#if configAPP_PROFILE
+/*! @brief Start of a measurement, ended by #prof_end when it goes out of scope */
+typedef struct prof_scope {
+    uint8_t probe;
+    uint32_t start;
+} prof_scope;
+
+#define PROF_CAT_( a, b )               a##b
+#define PROF_CAT( a, b )                PROF_CAT_( a, b )
+/*! @brief Measures from here to the end of the block */
+#define PROF_SCOPE( probe ) \
+    prof_scope PROF_CAT( prof_scope_, __LINE__ ) __attribute__ ((cleanup(prof_end))) = { ( probe ), DWT->CYCCNT }
+/*! @brief Enables the cycle counter, before the scheduler starts */
+#define PROF_INIT()                     prof_init()
+
+void prof_init( void );
+void prof_end( const prof_scope * scope );
+
+/*! @brief Copies the measurements of a probe and optionally starts it over
+ *
+ * @param probe: Probe id.
+ * @param stats: Where to copy the measurements to.
+ * @param clear: 1 to clear them after the copy.
+ * @return 1 on success, 0 if there's no such probe
+ */
+uint8_t prof_get( uint8_t probe, prof_stats * stats, uint8_t clear );
+#else
+#define PROF_SCOPE( probe )
+#define PROF_INIT()
+#endif
+
+#endif /*PROF_H_*/
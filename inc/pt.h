@@ -0,0 +1,124 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file pt.h
+ *
+ * @brief Stackless threads of the state machine drivers, all run in the timer task
+ *
+ * A driver going through steps that each wait for an interrupt, a bus transfer or a delay is written as one
+ * function reading from top to bottom, instead of a state variable and a callback per step, and still gets no
+ * task nor stack: a #pt_thread only keeps the line it waits at (protothreads, see PT_BEGIN()). All the threads
+ * run in the timer task, on its stack, and return to it at each wait. pt_wake() runs a thread again (from a
+ * task, or pt_wake_from_isr() from an interrupt) and pt_timeout() does when a delay is up, through the timer
+ * wheel; the thread then checks the condition it waits for, so a wake with nothing new is harmless.
+ * Local variables don't survive a wait, what a thread keeps across them is in its driver's static storage, and
+ * it can't wait inside a switch statement of its own.
+ * @code
+ * static PT_THREAD( prvBlink( pt_thread * pt ) )
+ * {
+ *     PT_BEGIN( pt );
+ *     for ( ;; ) {
+ *         led_toggle();
+ *         PT_SLEEP( pt, 500 / portTICK_PERIOD_MS );
+ *     }
+ *     PT_END( pt );
+ * }
+ *
+ * static pt_thread blink = PT_THREAD_INIT( prvBlink, NULL );
+ * pt_start( &blink );
+ * @endcode
+ * @warning Must be included after FreeRTOS.h and timer_wheel.h
+ */
+
+#ifndef PT_H_
+#define PT_H_
+
+/*! @brief What a thread function returns */
+typedef uint8_t pt_state;
+#define PT_WAITING                  0
+#define PT_ENDED                    1
+
+/*! @brief Stackless thread, the storage is the caller's */
+typedef struct pt_thread {
+    pt_state (* fn)( struct pt_thread * pt ); /*!< Called in the timer task, mustn't block */
+    void * arg;
+    /* Managed by pt.c */
+    uint16_t lc;                            /*!< Line the thread waits at, 0 to start from the top */
+    uint8_t running;                        /*!< Started and not ended */
+    uint8_t expired;                        /*!< The delay of #pt_timeout is up */
+    volatile uint8_t pended;                /*!< A run is pended to the timer task already */
+    wheel_timer timer;
+} pt_thread;
+
+/*! @brief #pt_thread initializer */
+#define PT_THREAD_INIT( fn, arg )   { fn, arg, 0, 0, 0, 0, { 0 } }
+
+/*! @brief Declares a thread function */
+#define PT_THREAD( decl )           pt_state decl
+
+/*! @brief Starts the body of a thread function, from where it last waited */
+#define PT_BEGIN( pt )              switch ( ( pt )->lc ) { case 0:
+/*! @brief Returns to the timer task until cond is true, checked at once and at every wake */
+#define PT_WAIT_UNTIL( pt, cond )                                           \
+    do {                                                                    \
+        ( pt )->lc = __LINE__;                                              \
+    case __LINE__:                                                          \
+        if ( !( cond ) ) {                                                  \
+            return PT_WAITING;                                              \
+        }                                                                   \
+    } while ( 0 )
+/*! @brief Waits for ticks, see #pt_timeout */
+#define PT_SLEEP( pt, ticks )                                               \
+    do {                                                                    \
+        pt_timeout( ( pt ), ( ticks ) );                                    \
+        PT_WAIT_UNTIL( ( pt ), pt_expired( pt ) );                          \
+    } while ( 0 )
+/*! @brief Ends the body of a thread function, it's done once it gets there */
+#define PT_END( pt )                } ( pt )->lc = 0; return PT_ENDED;
+
+/*! @brief Runs a thread from the top until it first waits, in the timer task (not from the thread itself)
+ *
+ * A thread already running is started over, its delay dropped and its wakes still pended only running it
+ * once more from the top.
+ * @param pt: Thread, must stay valid while it runs (static storage).
+ */
+void pt_start( pt_thread * pt );
+
+/*! @brief Runs a waiting thread again in the timer task, from a task, never blocks
+ *
+ * Wakes given before the run are only one run.
+ * @return 1 on success, 0 if the timer command queue is full
+ */
+uint8_t pt_wake( pt_thread * pt );
+
+/*! @brief Same as #pt_wake, from an interrupt */
+uint8_t pt_wake_from_isr( pt_thread * pt, portBASE_TYPE * woken );
+
+/*! @brief Wakes the thread once ticks have gone by, from the thread
+ *
+ * Replaces the delay it was waiting for. Once it's up #pt_expired is 1 until the next #pt_timeout.
+ * @param ticks: Ticks from now, 0 wakes it on the next pass of the timer wheel.
+ */
+void pt_timeout( pt_thread * pt, TickType_t ticks );
+
+/*! @return 1 if the delay of the last #pt_timeout is up */
+uint8_t pt_expired( const pt_thread * pt );
+
+#endif /*PT_H_*/
@@ -0,0 +1,103 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file queue_stats.h
+ *
+ * @brief Queue depth telemetry
+ *
+ * Each queue registered with #queue_stats_register (which also adds it to the FreeRTOS queue registry) gets its
+ * registry position as queue number, and the FreeRTOS queue trace macros, expanded inside queue.c, update its
+ * counters: the deepest it's been, senders that had to block on it full, sends that failed (full, no wait left)
+ * and the time spent by blocked senders, summed in ticks. They're read over IPMB with the custom "Get Queue
+ * Statistics" command, to size the queues against real crates. The other queues (number 0) cost one test per
+ * operation.
+ * This header is included by FreeRTOSConfig.h, so it can only depend on the C standard types.
+ */
+
+#ifndef QUEUE_STATS_H_
+#define QUEUE_STATS_H_
+
+/*! @brief Most queues followed, as many as the FreeRTOS registry holds */
+#define QUEUE_STATS_MAX             configQUEUE_REGISTRY_SIZE
+
+/*! @brief Queue operations counted, see #queue_stats_hook */
+typedef enum queue_stats_op {
+    QUEUE_STATS_SEND,                       /*!< An item is about to be copied in */
+    QUEUE_STATS_RECEIVE,                    /*!< An item is about to be taken out */
+    QUEUE_STATS_BLOCK,                      /*!< The current task is about to block on the full queue */
+    QUEUE_STATS_FAIL,                       /*!< A send gave up */
+} queue_stats_op;
+
+/*! @brief Counters of a queue */
+typedef struct queue_usage {
+    const char * name;
+    uint8_t length;                         /*!< Items it holds */
+    uint8_t waiting;                        /*!< Items in it now */
+    uint8_t high_water;                     /*!< Most items it ever held */
+    uint32_t blocked;                       /*!< Sends that had to wait for room */
+    uint32_t failed;                        /*!< Sends that found it full and gave up */
+    uint32_t wait_ticks;                    /*!< Time spent by blocked senders, added up, in ticks */
+} queue_usage;
+
+/*! @brief Follows a queue and adds it to the FreeRTOS queue registry
+ *
+ * @param queue: Queue handle (QueueHandle_t, this header can't use the type).
+ * @param name: Name in the registry, must stay valid.
+ * @return 1 on success, 0 if #QUEUE_STATS_MAX queues are already followed
+ */
+uint8_t queue_stats_register( void * queue, const char * name );
+
+/*! @brief Number of queues followed */
+uint8_t queue_stats_count( void );
+
+/*! @brief Copies the counters of a queue
+ *
+ * @param index: Registration order of the queue.
+ * @param usage: Where to copy them to.
+ * @return 1 on success, 0 if there's no such queue
+ */
+uint8_t queue_stats_get( uint8_t index, queue_usage * usage );
+
+/*! @brief Restarts the counters of a queue, the high water from its depth now */
+void queue_stats_clear( uint8_t index );
+
+/*! @brief Counts an operation, from the queue trace macros (with interrupts masked or the scheduler suspended)
+ *
+ * @param number: Queue number, 0 if it isn't followed.
+ * @param waiting: Items in the queue, before the operation.
+ * @param senders: Tasks blocked on it, before the operation.
+ */
+void queue_stats_hook( uint8_t number, uint8_t waiting, uint8_t senders, queue_stats_op op );
+
+#define QUEUE_STATS_HOOK( pxQueue, op ) \
+    queue_stats_hook( ( pxQueue )->uxQueueNumber, ( pxQueue )->uxMessagesWaiting, \
+                      listCURRENT_LIST_LENGTH( &( pxQueue )->xTasksWaitingToSend ), ( op ) )
+
+/* FreeRTOS hooks, expanded inside queue.c (pxQueue), also feeding the kernel trace (kernel_trace.h) */
+#define traceQUEUE_SEND( pxQueue )                  ( KERNEL_TRACE_QUEUE( KERNEL_TRACE_QUEUE_SEND, pxQueue ), QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_SEND ) )
+#define traceQUEUE_SEND_FROM_ISR( pxQueue )         ( KERNEL_TRACE_QUEUE( KERNEL_TRACE_QUEUE_SEND_ISR, pxQueue ), QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_SEND ) )
+#define traceQUEUE_RECEIVE( pxQueue )               ( KERNEL_TRACE_QUEUE( KERNEL_TRACE_QUEUE_RECEIVE, pxQueue ), QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_RECEIVE ) )
+#define traceQUEUE_RECEIVE_FROM_ISR( pxQueue )      ( KERNEL_TRACE_QUEUE( KERNEL_TRACE_QUEUE_RECEIVE_ISR, pxQueue ), QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_RECEIVE ) )
+#define traceBLOCKING_ON_QUEUE_RECEIVE( pxQueue )   KERNEL_TRACE_QUEUE( KERNEL_TRACE_QUEUE_BLOCK_RECEIVE, pxQueue )
+#define traceBLOCKING_ON_QUEUE_SEND( pxQueue )      ( KERNEL_TRACE_QUEUE( KERNEL_TRACE_QUEUE_BLOCK_SEND, pxQueue ), QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_BLOCK ) )
+#define traceQUEUE_SEND_FAILED( pxQueue )           QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_FAIL )
+#define traceQUEUE_SEND_FROM_ISR_FAILED( pxQueue )  QUEUE_STATS_HOOK( pxQueue, QUEUE_STATS_FAIL )
+
+#endif /*QUEUE_STATS_H_*/
@@ -0,0 +1,69 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file ram_sections.h
+ *
+ * @brief Placement of data in the two RAM banks
+ *
+ * The LPC1764 has 16 KB of local SRAM (RamLoc16), on the CPU's own bus, and 16 KB of AHB SRAM
+ * (RamAHB16), shared with the GPDMA. Anything not marked lands in RamLoc16 with the usual .data and
+ * .bss, which is where the CPU-private hot data (driver state, kernel lists, task stacks) belongs.
+ * Big or DMA accessed buffers (the heap, block pools, DMA targets, trace rings) are marked to go to
+ * RamAHB16 instead, so they don't take the local bank's space or contend with the CPU for it.
+ * The section names are the ones of the LPCXpresso __DATA(RAM2)/__BSS(RAM2) macros, afcipm.ld collects
+ * them in .data_RAM2/.bss_RAM2 and the startup code copies/zeroes those with the main sections.
+ * Every byte of .bss is zeroed before main, so buffers that are always written before they're read
+ * (rings behind their own indexes, block pools, staging and DMA buffers, the FreeRTOS heap, task
+ * stacks) are marked noinit instead: the startup code skips them, and what they held survives a
+ * soft reset.
+ *
+ * Code can run from RamLoc16 too, out of reach of the flash wait states: functions in .ramfunc.$RAM
+ * (same as LPCXpresso's __RAMFUNC(RAM)) are linked with .data and copied there by ResetISR. The hot
+ * paths (I2C interrupt, context switch, IPMB checksums) are marked #__RAMFUNC_HOT, which only moves
+ * them with #configAPP_RAMFUNC set. The linker adds veneers on the calls between flash and RAM.
+ * @code
+ * static uint32_t adc_dma_buf[ADC_CHANNELS] __RAM_AHB;
+ * __RAMFUNC_HOT void vI2C_ISR( uint8_t i2c_id );
+ * @endcode
+ */
+
+#ifndef RAM_SECTIONS_H_
+#define RAM_SECTIONS_H_
+
+/*! @brief Zero initialized variable in RamAHB16 */
+#define __RAM_AHB           __attribute__ ((section(".bss.$RAM2")))
+/*! @brief Initialized variable in RamAHB16, its initial value is copied from flash at reset */
+#define __RAM_AHB_DATA      __attribute__ ((section(".data.$RAM2")))
+/*! @brief Variable in RamAHB16 left alone by the startup code (keeps its value across a soft reset, random at power up) */
+#define __RAM_AHB_NOINIT    __attribute__ ((section(".noinit.$RAM2")))
+/*! @brief Variable in RamLoc16 left alone by the startup code (usable before the data and bss init) */
+#define __NOINIT            __attribute__ ((section(".noinit")))
+
+/*! @brief Function run from RamLoc16 */
+#define __RAMFUNC           __attribute__ ((section(".ramfunc.$RAM")))
+/*! @brief Hot path function, run from RamLoc16 with #configAPP_RAMFUNC set and from flash otherwise */
+#if configAPP_RAMFUNC
+#define __RAMFUNC_HOT       __RAMFUNC
+#else
+#define __RAMFUNC_HOT
+#endif
+
+#endif /*RAM_SECTIONS_H_*/
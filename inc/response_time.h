@@ -0,0 +1,99 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file response_time.h
+ *
+ * @brief Worst response time of each task, against the deadline of the task plan
+ *
+ * With #configAPP_RESPONSE_TIME set (make RESPONSE_TIME=1), the scheduler hooks (see FreeRTOSConfig.h) stamp
+ * each task when it's made ready and again when it blocks, with the microsecond timer (timestamp.h): the time in
+ * between is the response time of that wake up, preemptions and interrupts included. Each task keeps its wake ups,
+ * its worst response time and the wake ups that missed the deadline #TASK_PLAN gives it (priorities.h, by name).
+ * A task whose worst response time reaches #RESPONSE_TIME_RISK percent of its deadline is flagged as at risk and
+ * logged once ("rtime,at_risk" record: task number, worst and deadline in us). The measurements start with the
+ * first check (#RESPONSE_TIME_PERIOD after the scheduler starts) and are read with the custom "Get Response Times"
+ * IPMI command. Without the option the hooks compile to nothing.
+ * This header is included by FreeRTOSConfig.h, so it can only depend on the C standard types.
+ */
+
+#ifndef RESPONSE_TIME_H_
+#define RESPONSE_TIME_H_
+
+/*! @brief Worst response time at which a task is flagged as at risk, in percent of its deadline */
+#define RESPONSE_TIME_RISK          75
+/*! @brief Period of the check against the deadlines, in ticks */
+#define RESPONSE_TIME_PERIOD        ( 1000 / portTICK_PERIOD_MS )
+/*! @brief Characters of the task name kept, the terminating NUL included (configMAX_TASK_NAME_LEN) */
+#define RESPONSE_TIME_NAME_LEN      12
+
+/*! @name Flags of a task
+ * @{
+ */
+#define RESPONSE_TIME_AT_RISK       0x01    /*!< Worst response time at #RESPONSE_TIME_RISK percent of the deadline or more */
+#define RESPONSE_TIME_MISSED        0x02    /*!< At least one wake up missed the deadline */
+#define RESPONSE_TIME_UNPLANNED     0x04    /*!< Not in #TASK_PLAN, so no deadline */
+/*! @} */
+
+/*! @brief Measurements of a task */
+typedef struct response_time_stats {
+    char name[RESPONSE_TIME_NAME_LEN];
+    uint8_t number;                         /*!< FreeRTOS task number */
+    uint8_t priority;                       /*!< From #TASK_PLAN */
+    uint8_t flags;                          /*!< RESPONSE_TIME_AT_RISK, ... */
+    uint32_t deadline_us;                   /*!< 0 for a background task */
+    uint32_t worst_us;
+    uint32_t wakeups;                       /*!< Wake ups measured */
+    uint32_t misses;                        /*!< Wake ups longer than the deadline */
+} response_time_stats;
+
+#if configAPP_RESPONSE_TIME
+/*! @brief Starts the check job, before the scheduler starts */
+void response_time_init( void );
+
+/*! @brief Number of tasks seen so far */
+uint8_t response_time_count( void );
+
+/*! @brief Copies the measurements of a task
+ *
+ * @param index: Position of the task, from 0 to #response_time_count - 1.
+ * @param stats: Where to copy them to.
+ * @return 1 on success, 0 if there's no such task
+ */
+uint8_t response_time_get( uint8_t index, response_time_stats * stats );
+
+/*! @brief Starts all the measurements over, the flags included */
+void response_time_clear( void );
+
+/* Scheduler hooks, the task number is the one of the TCB */
+void response_time_ready( uint32_t number );
+void response_time_switched_out( uint32_t number, const char * name, uint8_t blocked );
+
+/* FreeRTOS hooks, expanded inside tasks.c (pxCurrentTCB, pxTCB, pxReadyTasksLists): the task switched out
+ * blocks unless it's still in its ready list (preempted or yielding) */
+#define RESPONSE_TIME_READY( pxTCB )    response_time_ready( ( pxTCB )->uxTCBNumber )
+#define RESPONSE_TIME_SWITCHED_OUT()                                                                \
+    response_time_switched_out( pxCurrentTCB->uxTCBNumber, pxCurrentTCB->pcTaskName,              \
+        !listIS_CONTAINED_WITHIN( &pxReadyTasksLists[pxCurrentTCB->uxPriority], &pxCurrentTCB->xGenericListItem ) )
+#else
+#define RESPONSE_TIME_READY( pxTCB )
+#define RESPONSE_TIME_SWITCHED_OUT()
+#endif
+
+#endif /*RESPONSE_TIME_H_*/
@@ -0,0 +1,118 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file rtm.h
+ *
+ * @brief Bridge of the IPMB-L requests to the RTM MMC, over the RTM local bus
+ *
+ * The MMC answers on IPMB-L at a second address for the RTM (#RTM_IPMB_ADDR, an #ipmb_register_proxy),
+ * and the requests sent to it are forwarded to the RTM MMC on #RTM_I2C, which runs in IPMB mode too so the
+ * RTM can answer as a master. Nothing of the bridge goes through the IPMI dispatcher or its workers:
+ * the IPMB RX task checks the response cache, takes an outstanding slot and queues the frame with
+ * #xI2CTransferAsync, then goes back to IPMB-L right away, so up to #RTM_MAX_OUTSTANDING requests are
+ * on their way to the RTM at once. The RTM task receives the answers, matches them to their slot by
+ * local sequence number, NetFN and CMD and queues them on IPMB-L with the header of the original request.
+ *     A slot not answered within #RTM_RESP_TIMEOUT_US (or the IPMB budget left, if shorter) is
+ * answered IPMI_CC_TIMEOUT, one the local bus couldn't send IPMI_CC_DESTINATION_UNAVAILABLE, and a
+ * request finding every slot taken IPMI_CC_NODE_BUSY, so the MCH always gets an answer in time.
+ *     Read FRU Data, Get FRU Inventory Area Info and Get Device SDR answers don't change until the RTM is
+ * written or replaced, so the successful ones are kept in a small LRU cache and served by the RX
+ * task without touching the local bus. The reservation ID of Get Device SDR isn't part of the key.
+ * Any Write FRU Data forwarded, timeout or local bus failure flushes the whole cache.
+ * Requests the RTM sends on its own (events) aren't bridged yet and are dropped.
+ *
+ * Only built on a board with an RTM connector, the variant header defines #RTM_I2C (see board_defs.h).
+ * @warning Must be included after i2c.h and ipmb.h
+ */
+
+#ifndef RTM_H_
+#define RTM_H_
+
+/*! @brief RTM task stack, in words */
+#define RTM_STACK_DEPTH             ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Requests forwarded to the RTM and not answered yet at the same time */
+#define RTM_MAX_OUTSTANDING         4
+/*! @brief Time the RTM has to answer, below #IPMB_MSG_TIMEOUT_US so our IPMI_CC_TIMEOUT still goes out in time */
+#define RTM_RESP_TIMEOUT_US         ( 150 * 1000 )
+/*! @brief Longest wait of the RTM task for an answer, the overdue slots are answered in between */
+#define RTM_SWEEP_PERIOD            ( 10 / portTICK_PERIOD_MS )
+/*! @brief Answers kept in the response cache */
+#define RTM_CACHE_LEN               4
+/*! @brief Longest cache key, the request data bytes that select the answer */
+#define RTM_CACHE_KEY_MAX           4
+
+/*! @brief State of an outstanding slot */
+typedef enum rtm_req_state {
+    RTM_REQ_FREE = 0,                   /*!< Can take a new request (once #rtm_bridge_req::chain_busy is clear) */
+    RTM_REQ_SENT,                       /*!< Forwarded, waiting for the RTM answer */
+    RTM_REQ_FAILED,                     /*!< The local bus couldn't send it, answered by the next sweep */
+    RTM_REQ_DONE                        /*!< Being answered by the RTM task */
+} rtm_req_state;
+
+/*! @brief Request forwarded to the RTM
+ *
+ * The chain, its transfer and the frame are used by the I2C driver until the chain callback runs, which may
+ * be after the answer arrived, so the slot is only taken again once #chain_busy is clear.
+ */
+typedef struct rtm_bridge_req {
+    volatile uint8_t state;             /*!< One of #rtm_req_state */
+    volatile uint8_t chain_busy;        /*!< The I2C driver still uses #chain */
+    uint8_t seq;                        /*!< Sequence number on the local bus */
+    uint32_t deadline;                  /*!< Timestamp (timestamp.h) after which IPMI_CC_TIMEOUT is answered */
+    ipmi_msg req;                       /*!< Request as received on IPMB-L, its header addresses the answer */
+    uint8_t frame[IPMI_MSG_MAX_LENGTH]; /*!< Request encoded for the local bus */
+    xI2C_xfer xfer;
+    xI2C_chain chain;
+} rtm_bridge_req;
+
+/*! @brief Response cache entry */
+typedef struct rtm_cache_entry {
+    uint8_t valid;
+    uint8_t netfn;                      /*!< Request NetFN */
+    uint8_t cmd;                        /*!< Request command */
+    uint8_t key_len;                    /*!< Bytes used in #key */
+    uint8_t key[RTM_CACHE_KEY_MAX];     /*!< Request data bytes selecting the answer */
+    uint32_t age;                       /*!< Last use, for the LRU replacement */
+    ipmi_msg resp;                      /*!< Completion code and data of the answer */
+} rtm_cache_entry;
+
+/*! @brief Bridge counters, see #rtm_get_stat */
+typedef enum rtm_stat_id {
+    RTM_STAT_FORWARDED = 0,             /*!< Requests sent to the RTM */
+    RTM_STAT_ANSWERED,                  /*!< RTM answers relayed to IPMB-L */
+    RTM_STAT_CACHE_HITS,                /*!< Requests answered from the cache */
+    RTM_STAT_BUSY,                      /*!< Requests answered IPMI_CC_NODE_BUSY, every slot taken */
+    RTM_STAT_TIMEOUTS,                  /*!< Requests the RTM didn't answer in time */
+    RTM_STAT_FAILURES,                  /*!< Requests the local bus couldn't send */
+    RTM_STAT_UNMATCHED,                 /*!< Frames from the RTM matching no slot (late answers, RTM requests) */
+    RTM_STAT_COUNT
+} rtm_stat_id;
+
+/*! @brief Brings up the RTM local bus, answers for the RTM on IPMB-L and starts the RTM task
+ *
+ * @warning Must be called after #ipmb_init, nothing is done on a board without #RTM_I2C.
+ */
+void rtm_init( void );
+
+/*! @brief Reads one of the bridge counters, 0 for an unknown one */
+uint32_t rtm_get_stat( rtm_stat_id id );
+
+#endif /*RTM_H_*/
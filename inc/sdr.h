@@ -0,0 +1,300 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file sdr.h
+ *
+ * @brief Device SDR repository
+ *
+ * The records are const and live in flash. The record ID of each one is its position in the
+ * repository, so a record is found in constant time. Fields that are only known at run time (our
+ * IPMB address) are filled in as the records are read, see #sdr_read.
+ *
+ * Records are built by #SDR_FULL_SENSOR and #SDR_MC_LOCATOR, which fill in the header and the
+ * length fields at compile time. The sensor records come from the board table, see board_sensors.h,
+ * followed by the FRU Hot Swap sensor (#SENSOR_HOT_SWAP).
+ */
+
+#ifndef SDR_H_
+#define SDR_H_
+
+/*! @brief SDR version of every record (IPMI 1.5 / 2.0) */
+#define SDR_VERSION                 0x51
+/*! @name Record types
+ * @{
+ */
+#define SDR_TYPE_FULL_SENSOR        0x01
+#define SDR_TYPE_MC_LOCATOR         0x12
+/*! @} */
+
+/*! @brief Length of the record header (record ID, version, type, length) */
+#define SDR_HEADER_LEN              5
+/*! @brief Offset of the owner / device slave address, the same in sensor and MC locator records */
+#define SDR_OWNER_ID_OFFSET         5
+/*! @brief Longest ID string of a record */
+#define SDR_ID_STRING_MAX           16
+/*! @brief ID string type/length byte for an 8-bit ASCII string */
+#define SDR_ID_STRING_ASCII( len )  ( 0xC0 | ( len ) )
+/*! @brief Entity of the records: PICMG AdvancedMC module */
+#define SDR_ENTITY_AMC              0xC1
+/*! @brief Device relative entity instance */
+#define SDR_ENTITY_INSTANCE         0x60
+
+/*! @name Full sensor record field values
+ * @{
+ */
+#define SDR_SENSOR_TYPE_TEMPERATURE 0x01
+#define SDR_SENSOR_TYPE_VOLTAGE     0x02
+#define SDR_SENSOR_TYPE_CURRENT     0x03
+#define SDR_SENSOR_TYPE_OTHER_UNITS 0x0B    /*!< Other units-based sensor (power) */
+#define SDR_EVENT_TYPE_THRESHOLD    0x01
+#define SDR_EVENT_TYPE_SENSOR_SPECIFIC 0x6F
+#define SDR_UNITS_FORMAT_MASK       0xC0    /*!< Analog data format bits of units1 */
+#define SDR_UNITS_UNSIGNED          0x00
+#define SDR_UNITS_2S_COMPLEMENT     0x80
+#define SDR_UNITS_NO_READING        0xC0    /*!< Discrete sensor, no analog reading */
+#define SDR_UNIT_DEGREES_C          0x01
+#define SDR_UNIT_VOLTS              0x04
+#define SDR_UNIT_AMPS               0x05
+#define SDR_UNIT_WATTS              0x06
+#define SDR_INIT_SCANNING           0x41    /*!< Initialize scanning, scanning enabled */
+#define SDR_CAP_AUTO_REARM          0x40
+#define SDR_CAP_HYSTERESIS_MASK     0x30
+#define SDR_CAP_HYSTERESIS_SETTABLE 0x20    /*!< Hysteresis readable and settable */
+#define SDR_CAP_THRESHOLD_SETTABLE  0x08    /*!< Thresholds readable and settable, see the threshold masks */
+#define SDR_CAP_EVENTS_GLOBAL       0x02    /*!< Event messages can only be disabled globally */
+/*! @} */
+
+/*! @brief Record ID of the first record when browsing the repository */
+#define SDR_RECORD_FIRST            0x0000
+/*! @brief Next record ID returned with the last record */
+#define SDR_RECORD_LAST             0xFFFF
+
+/*! @brief Full Sensor Record (IPMI 2.0 table 43-1) */
+typedef struct __attribute__ ((packed)) sdr_full_sensor {
+    uint8_t record_id[2];
+    uint8_t version;
+    uint8_t type;
+    uint8_t length;                         /*!< Bytes after the header */
+    uint8_t owner_id;                       /*!< Filled in when read */
+    uint8_t owner_lun;
+    uint8_t sensor_num;
+    uint8_t entity_id;
+    uint8_t entity_instance;
+    uint8_t init;
+    uint8_t capabilities;
+    uint8_t sensor_type;
+    uint8_t event_type;
+    uint8_t assert_mask[2];
+    uint8_t deassert_mask[2];
+    uint8_t reading_mask[2];
+    uint8_t units1;
+    uint8_t units2;
+    uint8_t units3;
+    uint8_t linearization;
+    uint8_t M;
+    uint8_t M_tolerance;
+    uint8_t B;
+    uint8_t B_accuracy;
+    uint8_t accuracy_dir;
+    uint8_t R_B_exp;
+    uint8_t analog_flags;
+    uint8_t nominal;
+    uint8_t normal_max;
+    uint8_t normal_min;
+    uint8_t sensor_max;
+    uint8_t sensor_min;
+    uint8_t upper_nonrecover;
+    uint8_t upper_critical;
+    uint8_t upper_noncritical;
+    uint8_t lower_nonrecover;
+    uint8_t lower_critical;
+    uint8_t lower_noncritical;
+    uint8_t pos_hysteresis;
+    uint8_t neg_hysteresis;
+    uint8_t reserved[2];
+    uint8_t OEM;
+    uint8_t id_type_len;
+    char id_string[SDR_ID_STRING_MAX];
+} sdr_full_sensor;
+
+/*! @brief Management Controller Device Locator Record (IPMI 2.0 table 43-7) */
+typedef struct __attribute__ ((packed)) sdr_mc_locator {
+    uint8_t record_id[2];
+    uint8_t version;
+    uint8_t type;
+    uint8_t length;                         /*!< Bytes after the header */
+    uint8_t slave_addr;                     /*!< Filled in when read */
+    uint8_t channel;
+    uint8_t power_state;
+    uint8_t capabilities;
+    uint8_t reserved[3];
+    uint8_t entity_id;
+    uint8_t entity_instance;
+    uint8_t OEM;
+    uint8_t id_type_len;
+    char id_string[SDR_ID_STRING_MAX];
+} sdr_mc_locator;
+
+/*! @brief Whole length of a record of the given type with the given ID string, header included */
+#define SDR_RECORD_LEN( type, name )    ( offsetof( type, id_string ) + sizeof(name) - 1 )
+
+/*! @brief Initializer of a Full Sensor Record
+ *
+ * Fills in the header, the key, the entity and the ID string; the remaining fields (sensor type,
+ * units, conversion factors, thresholds...) are given as designated initializers.
+ * @code
+ * static const sdr_full_sensor rec = SDR_FULL_SENSOR( 0, "Temp", .sensor_type = SDR_SENSOR_TYPE_TEMPERATURE, .M = 1 );
+ * @endcode
+ */
+#define SDR_FULL_SENSOR( num, name, ... )                                      \
+    {                                                                          \
+        .version = SDR_VERSION,                                                \
+        .type = SDR_TYPE_FULL_SENSOR,                                          \
+        .length = SDR_RECORD_LEN( sdr_full_sensor, name ) - SDR_HEADER_LEN,    \
+        .sensor_num = ( num ),                                                 \
+        .entity_id = SDR_ENTITY_AMC,                                           \
+        .entity_instance = SDR_ENTITY_INSTANCE,                                \
+        .init = SDR_INIT_SCANNING,                                             \
+        .capabilities = SDR_CAP_AUTO_REARM,                                    \
+        .id_type_len = SDR_ID_STRING_ASCII( sizeof(name) - 1 ),                \
+        .id_string = name,                                                     \
+        __VA_ARGS__                                                            \
+    }
+
+/*! @brief 10^e for 0 <= e <= 9, as a constant expression */
+#define SDR_POW10( e )                                                      \
+    ( (e) == 0 ? 1L : (e) == 1 ? 10L : (e) == 2 ? 100L : (e) == 3 ? 1000L : \
+      (e) == 4 ? 10000L : (e) == 5 ? 100000L : (e) == 6 ? 1000000L :        \
+      (e) == 7 ? 10000000L : (e) == 8 ? 100000000L : 1000000000L )
+
+/*! @brief Designated initializers of the conversion fields of a Full Sensor Record
+ *
+ * Reading = ( M * raw + B * 10^Bexp ) * 10^Rexp, M and B being 10 bit signed numbers,
+ * given as ( format, M, B, Bexp, Rexp ).
+ * @param format: Analog data format, #SDR_UNITS_UNSIGNED or #SDR_UNITS_2S_COMPLEMENT.
+ */
+#define SDR_LINEAR( ... )                       SDR_LINEAR_( __VA_ARGS__ )
+#define SDR_LINEAR_( fmt, mul, off, bexp, rexp )                  \
+    .units1 = ( fmt ),                                            \
+    .M = ( mul ) & 0xFF,                                          \
+    .M_tolerance = ( ( ( mul ) >> 8 ) & 0x03 ) << 6,              \
+    .B = ( off ) & 0xFF,                                          \
+    .B_accuracy = ( ( ( off ) >> 8 ) & 0x03 ) << 6,               \
+    .R_B_exp = ( ( ( rexp ) & 0x0F ) << 4 ) | ( ( bexp ) & 0x0F )
+
+/*! @brief Integer form of the conversion of a sensor, see #sdr_raw_to_milli
+ *
+ * Reading in thousandths of the sensor unit = ( m * raw + b ) * mul / div. With a negative
+ * Bexp, m is scaled up instead of b being scaled down, so no coefficient is ever fractional.
+ */
+typedef struct sdr_linear {
+    int32_t m;
+    int32_t b;
+    int32_t mul;
+    int32_t div;
+    uint8_t format;
+} sdr_linear;
+
+/*! @brief #sdr_linear of the parameters given to #SDR_LINEAR, computed at compile time */
+#define SDR_LINEAR_CONV( ... )                  SDR_LINEAR_CONV_( __VA_ARGS__ )
+#define SDR_LINEAR_CONV_( fmt, mult, offs, bexp, rexp )                                         \
+    {                                                                                           \
+        .m = ( mult ) * SDR_POW10( ( bexp ) < 0 ? -( bexp ) : 0 ),                              \
+        .b = ( offs ) * SDR_POW10( ( bexp ) > 0 ? ( bexp ) : 0 ),                               \
+        .mul = SDR_POW10( SDR_MILLI_EXP( bexp, rexp ) > 0 ? SDR_MILLI_EXP( bexp, rexp ) : 0 ),  \
+        .div = SDR_POW10( SDR_MILLI_EXP( bexp, rexp ) < 0 ? -SDR_MILLI_EXP( bexp, rexp ) : 0 ), \
+        .format = ( fmt ),                                                                      \
+    }
+/* Power of ten left to apply to ( m * raw + b ) to get thousandths */
+#define SDR_MILLI_EXP( bexp, rexp )             ( ( rexp ) + ( ( bexp ) < 0 ? ( bexp ) : 0 ) + 3 )
+
+/*! @brief Initializer of a Management Controller Device Locator Record */
+#define SDR_MC_LOCATOR( name, caps )                                          \
+    {                                                                         \
+        .version = SDR_VERSION,                                               \
+        .type = SDR_TYPE_MC_LOCATOR,                                          \
+        .length = SDR_RECORD_LEN( sdr_mc_locator, name ) - SDR_HEADER_LEN,    \
+        .capabilities = ( caps ),                                             \
+        .entity_id = SDR_ENTITY_AMC,                                          \
+        .entity_instance = SDR_ENTITY_INSTANCE,                               \
+        .id_type_len = SDR_ID_STRING_ASCII( sizeof(name) - 1 ),               \
+        .id_string = name,                                                    \
+    }
+
+/*! @brief Number of records in the repository */
+uint16_t sdr_count( void );
+
+/*! @brief Number of sensor records in the repository */
+uint8_t sdr_sensor_count( void );
+
+/*! @brief Length of a record, header included (0 if there's no such record) */
+uint8_t sdr_record_len( uint16_t record_id );
+
+/*! @brief Full Sensor Record of a sensor, NULL if there's no such sensor
+ *
+ * @param sensor: Sensor number.
+ */
+const sdr_full_sensor * sdr_get_sensor( uint8_t sensor );
+
+/*! @brief Converts a raw reading of a sensor to thousandths of its unit (m°C, mV, mA...)
+ *
+ * Integer only (the coefficients come from #SDR_LINEAR_CONV), so it's cheap enough for the polling
+ * and threshold paths. Unknown sensors give 0.
+ * @param sensor: Sensor number.
+ * @param raw: Raw reading, only the low byte is used.
+ */
+int32_t sdr_raw_to_milli( uint8_t sensor, uint16_t raw );
+
+/*! @brief Converts thousandths of the unit of a sensor to the nearest raw reading, saturated to the raw range */
+uint8_t sdr_milli_to_raw( uint8_t sensor, int32_t milli );
+
+/*! @brief Finds where a Get Device SDR read is, resuming the previous read of the reservation if it left off there
+ *
+ *     The MCH reads each record in chunks, one after the other. The position right after the last chunk (moved to
+ * the start of the next record at the end of one) is kept with the reservation it was read under, so the next
+ * chunk finds its record, length and next record ID without looking them up. Only the IPMI dispatcher reads the
+ * repository, the cursor isn't locked.
+ * @param reservation: Reservation of the request (as given, whether it's needed or not).
+ * @param record_id: Record to read, #SDR_RECORD_LAST already resolved.
+ * @param offset: First byte to read.
+ * @param next: Where to write the ID of the following record (#SDR_RECORD_LAST after the last one).
+ * @return Length of the record, header included, 0 if there's no such record
+ */
+uint8_t sdr_locate( uint16_t reservation, uint16_t record_id, uint8_t offset, uint16_t * next );
+
+/*! @brief Copies part of a record, moving the cursor of #sdr_locate past it
+ *
+ * @param record_id: Record to read.
+ * @param offset: First byte to copy.
+ * @param data: Destination buffer.
+ * @param count: Number of bytes to copy, must not go past the end of the record.
+ */
+void sdr_read( uint16_t record_id, uint8_t offset, uint8_t * data, uint8_t count );
+
+/*! @brief Starts a new reservation, cancelling the previous one
+ *
+ * @return Reservation ID (never 0)
+ */
+uint16_t sdr_reserve( void );
+
+/*! @brief Tells if a reservation is still the current one */
+uint8_t sdr_reservation_valid( uint16_t reservation );
+
+#endif /*SDR_H_*/
@@ -0,0 +1,79 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file selftest.h
+ *
+ * @brief Self tests and load generators, started and stopped at run time
+ *
+ * One low priority task runs one test at a time, for a given number of seconds or until it's stopped,
+ * on the production image (custom Self Test command, see #ipmi_custom_self_test): a test started while
+ * another one runs replaces it. The results are metrics (metrics.h) named "selftest.*", zeroed when a test
+ * starts, with the time it has run so far in "selftest.elapsed_ms" for the rates.
+ * - #SELFTEST_I2C_LOOPBACK writes IPMB frames from #SELFTEST_I2C_MASTER to the IPMB address of the MMC, which
+ *   needs the two interfaces wired together (as the loopback of bench.c). The frames are responses nobody asked
+ *   for: the IPMB RX task drops them, and counts them as unmatched.
+ * - #SELFTEST_IPMB_FLOOD keeps requests (Get Device ID) in flight to another IPMB controller, the MCH by default.
+ * - #SELFTEST_SENSOR_SWEEP follows the timestamps of the sensor readings and counts the reads that came later
+ *   than the period of their sensor; a failed read counts as late.
+ * The test runs on the full clock (#CLOCK_BOOST_SELFTEST).
+ * @warning Must be included after ipmb.h
+ */
+
+#ifndef SELFTEST_H_
+#define SELFTEST_H_
+
+/*! @brief Self test task stack, in words */
+#define SELFTEST_STACK_DEPTH        ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Interface writing to the IPMB interface in the I2C loopback */
+#define SELFTEST_I2C_MASTER         I2C2
+/*! @brief Requests in flight of the IPMB flood by default, leaving the rest of #IPMB_MAX_OUTSTANDING_REQ to the MMC */
+#define SELFTEST_FLOOD_DEPTH        ( IPMB_MAX_OUTSTANDING_REQ / 2 )
+/*! @brief Most data bytes of a loopback frame, a response of #IPMI_MSG_MAX_LENGTH bytes */
+#define SELFTEST_LOOPBACK_DATA_MAX  ( IPMI_MSG_MAX_LENGTH - IPMB_RESP_HEADER_LENGTH - 1 )
+/*! @brief Most bytes of test parameters */
+#define SELFTEST_PARAM_MAX          2
+
+/*! @name Tests
+ * @{
+ */
+#define SELFTEST_NONE               0x00    /*!< No test, stops the one running */
+#define SELFTEST_I2C_LOOPBACK       0x01    /*!< Parameters: [0] data bytes per frame (up to and by default #SELFTEST_LOOPBACK_DATA_MAX) */
+#define SELFTEST_IPMB_FLOOD         0x02    /*!< Parameters: [0] responder address (default #MCH_ADDRESS), [1] requests in flight (1 to #IPMB_MAX_OUTSTANDING_REQ, default #SELFTEST_FLOOD_DEPTH) */
+#define SELFTEST_SENSOR_SWEEP       0x03    /*!< No parameters */
+#define SELFTEST_COUNT              0x04
+/*! @} */
+
+/*! @brief Creates the test task, the IPMB layer must be up (see #ipmb_init) */
+void selftest_init( void );
+
+/*! @brief Starts a test, replacing the one running
+ *
+ * @param test: One of the @ref SELFTEST_NONE "tests", #SELFTEST_NONE stops the one running.
+ * @param seconds: How long to run it, 0 until it's stopped.
+ * @param param: Parameters of the test, the missing ones take their default.
+ * @param len: Bytes in @p param.
+ * @return 1 on success, 0 if there's no such test or a parameter is out of range
+ */
+uint8_t selftest_start( uint8_t test, uint16_t seconds, const uint8_t * param, uint8_t len );
+
+/*! @brief Test running, #SELFTEST_NONE if there's none */
+uint8_t selftest_running( void );
+
+#endif /*SELFTEST_H_*/
@@ -0,0 +1,230 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file sensor.h
+ *
+ * @brief Sensor polling and reading store
+ *
+ * The board sensors are described by a const table (see sensor.c). A single task walks the table
+ * every #SENSOR_POLL_PERIOD, reads every sensor that is due with one I2C scan list sweep per bus
+ * (see #xI2CScanStart: the interrupts write the raw bytes, the task is told once per bus) and keeps
+ * the last reading of each one, so the IPMI handlers never have to touch the buses.
+ * The period of the table is the one of a steady reading far from its thresholds: a sensor coming close to
+ * one, or heading to it fast, is read up to 2^#SENSOR_ADAPT_SHIFT_MAX times as often, and goes back one step
+ * per read once it's clear again.
+ * Managers tend to read each sensor at a fixed cadence: the times of the Get Sensor Reading requests
+ * (#sensor_note_request) teach the poller the request period of each sensor, and once it's steady the reads are
+ * moved earlier, never later, to land #SENSOR_PREFETCH_LEAD before the next expected request. The reading served
+ * is then fresh at the same poll rate (a request period longer than the sensor's costs at most one extra read per
+ * request).
+ * For monitoring without polling over IPMB, the store can also be pushed to the debug UART log every few
+ * periods (#sensor_stream).
+ * Consumers that only care about changes don't scan the store: a reading moving past the deadband of its
+ * sensor (or changing status) sets the bit of the sensor in the change mask of every consumer, which takes
+ * its mask with #sensor_take_changes and walks the bits with #SENSOR_CHANGE_NEXT.
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef SENSOR_H_
+#define SENSOR_H_
+
+/*! @brief Sensor polling task stack, in words */
+#define SENSOR_STACK_DEPTH          ( configMINIMAL_STACK_SIZE * 2 )
+/*! @brief Scheduler granularity, the sensor periods are rounded up to a multiple of it */
+#define SENSOR_POLL_PERIOD          ( 10 / portTICK_PERIOD_MS )
+/*! @brief Maximum number of sensors in the board table (up to 32, one bit each in the I2C sweep masks) */
+#define SENSOR_MAX                  16
+/*! @brief Longest register read by a sensor driver */
+#define SENSOR_RX_MAX               4
+/*! @brief A reading older than this many sensor periods is reported as unavailable */
+#define SENSOR_STALE_PERIODS        3
+/*! @brief Fastest adaptive rate, as a right shift of the period of the table */
+#define SENSOR_ADAPT_SHIFT_MAX      3
+/*! @brief A reading this many raw counts from a threshold (or past it) is taken at the fastest rate */
+#define SENSOR_ADAPT_NEAR           2
+/*! @brief Reads wanted before a reading reaches a threshold, at its current rate of change */
+#define SENSOR_ADAPT_SAMPLES        4
+/*! @brief Weight of each new sample in the running average, 1 / 2^SENSOR_EWMA_SHIFT */
+#define SENSOR_EWMA_SHIFT           3
+/*! @brief A read aligned to the request cadence is scheduled this long before the expected request (two poll rounds) */
+#define SENSOR_PREFETCH_LEAD        ( 2 * SENSOR_POLL_PERIOD )
+/*! @brief Request intervals in a row within the tolerance of the estimate before the reads are aligned */
+#define SENSOR_PREFETCH_LOCK        3
+/*! @brief Longest request period learned, in ticks */
+#define SENSOR_PREFETCH_MAX_PERIOD  ( 60000 / portTICK_PERIOD_MS )
+/*! @brief Expected requests missed in a row after which the reads are no longer aligned */
+#define SENSOR_PREFETCH_MISSES      2
+/*! @brief #sensor_reset_stats on every sensor */
+#define SENSOR_ALL                  0xFF
+/*! @brief Shortest period of the telemetry stream, see #sensor_stream */
+#define SENSOR_STREAM_MIN_MS        100
+/*! @brief Deadband of every sensor at startup, in raw counts: any change of the reading counts */
+#define SENSOR_DEADBAND_DEFAULT     0
+
+/*! @name Consumers of the change masks, see #sensor_take_changes
+ * @{
+ */
+#define SENSOR_CONSUMER_STREAM      0       /*!< Telemetry stream, #sensor_stream */
+#define SENSOR_CONSUMER_PUSH        1       /*!< Telemetry pushed to a collector, see telemetry.h */
+#define SENSOR_CONSUMERS            2
+/*! @} */
+
+/*! @brief Highest sensor number set in a non-zero change mask, clear it with mask &= ~( 1UL << n ) */
+#define SENSOR_CHANGE_NEXT( mask )  ( 31 - __CLZ( mask ) )
+
+/*! @brief Bus of the sensors read by the MMC itself (on-chip ADC), see #sensor_driver.read */
+#define SENSOR_LOCAL                ( (I2C_ID_T) I2C_NUM_INTERFACE )
+/*! @brief Bus of the registers of the payload FPGA mailbox (see #fpga_mbox_read), the register index is
+ * the address; all the ones due are read in one burst and decoded by #sensor_driver.decode */
+#define SENSOR_FPGA                 ( (I2C_ID_T) ( I2C_NUM_INTERFACE + 1 ) )
+
+/*! @name Reading status
+ * @{
+ */
+#define SENSOR_READING_VALID        0x01    /*!< Last read succeeded, value and timestamp are from it */
+#define SENSOR_READING_UNAVAILABLE  0x02    /*!< Last read failed or the device is quarantined, value is from the last good read */
+/*! @} */
+
+/*! @brief How to read one kind of sensor
+ *
+ * I2C sensors are read by the poller with the transfer described here. Local sensors (#SENSOR_LOCAL)
+ * are read by #read instead, which must not block.
+ */
+typedef struct sensor_driver {
+    uint8_t tx_data[2];                     /*!< Bytes written before reading (register pointer) */
+    uint8_t tx_len;                         /*!< Number of bytes in #tx_data */
+    uint8_t rx_len;                         /*!< Bytes read back, up to #SENSOR_RX_MAX */
+    uint32_t max_clock;                     /*!< Highest SCL frequency supported by the device (Hz) */
+    uint16_t (* decode)( const uint8_t * rx ); /*!< Turns the bytes read into the sensor value */
+    uint8_t (* read)( uint8_t addr, uint8_t * rx ); /*!< Local sensors only: fills rx, 0 if there's no reading */
+    /*! I2C sensors, optional: configures the device once its bus is up (once per device, from the period of its
+     * first sensor in the table), before the polling starts. May block */
+    void (* setup)( I2C_ID_T i2c_id, uint8_t addr, uint16_t period_ms );
+} sensor_driver;
+
+/*! @brief Entry of the board sensor table */
+typedef struct sensor_desc {
+    I2C_ID_T i2c_id;                        /*!< Bus the sensor is connected to, #SENSOR_LOCAL for the on-chip ones */
+    uint8_t addr;                           /*!< Sensor slave address (7 bit address), ADC channel of local sensors */
+    const sensor_driver * driver;           /*!< How to read it */
+    uint16_t period_ms;                     /*!< Time between reads in the steady state, the slowest rate */
+} sensor_desc;
+
+/*! @brief Statistics of the successful reads of a sensor since the last reset
+ *
+ * The values are compared as signed 16 bit numbers, so drivers of signed sensors sign extend their readings.
+ */
+typedef struct sensor_stats {
+    int16_t min;
+    int16_t max;
+    int32_t ewma;                           /*!< Exponentially weighted average, times 2^#SENSOR_EWMA_SHIFT */
+    uint32_t count;                         /*!< Samples taken, min/max/ewma are meaningless while it's 0 */
+} sensor_stats;
+
+/*! @brief Last reading of a sensor */
+typedef struct sensor_reading {
+    uint16_t value;                         /*!< Raw reading, in the units of the sensor driver */
+    uint8_t status;                         /*!< #SENSOR_READING_VALID, #SENSOR_READING_UNAVAILABLE or 0 (never read) */
+    TickType_t timestamp;                   /*!< Tick of the last successful read */
+    sensor_stats stats;
+} sensor_reading;
+
+/*! @brief Telemetry stream entry, from the reading of a sensor (see #sensor_stream) */
+typedef struct sensor_snapshot {
+    uint8_t sensor;
+    uint8_t status;                         /*!< As in #sensor_reading */
+    uint16_t value;
+    uint32_t timestamp;                     /*!< Tick of the last successful read */
+    int16_t average;                        /*!< #SENSOR_STATS_AVERAGE, 0 without samples */
+    uint16_t count;                         /*!< Samples since the last statistics reset, saturated */
+} sensor_snapshot;
+
+/*! @brief Running average of a sensor, in the units of its readings */
+#define SENSOR_STATS_AVERAGE( stats )   ( (int16_t) ( ( stats )->ewma >> SENSOR_EWMA_SHIFT ) )
+
+/*! @brief Registers the sensor devices, brings up their buses and starts the polling task */
+void sensor_init( void );
+
+/*! @brief Number of sensors in the board table */
+uint8_t sensor_count( void );
+
+/*! @brief Board table entry of a sensor, NULL if there's no such sensor */
+const sensor_desc * sensor_get_desc( uint8_t sensor );
+
+/*! @brief Copies the last reading of a sensor, never touches the bus
+ *
+ *     Lock-free: the polling task publishes each reading through a sequence counter and two copies
+ * of the slot, always writing the one readers aren't told to use. A reader running above the
+ * poller (the IPMI tasks) therefore never waits for it; one running below only retries if the poller
+ * published twice while it was copying.
+ *
+ * @param sensor: Index of the sensor in the board table.
+ * @param reading: Where to copy the reading to.
+ * @return 1 on success, 0 if there's no such sensor
+ */
+uint8_t sensor_get_reading( uint8_t sensor, sensor_reading * reading );
+
+/*! @brief Restarts the statistics of a sensor (or of all of them, #SENSOR_ALL) from its next reading
+ *
+ * The polling task does the reset, so the store keeps a single writer.
+ */
+void sensor_reset_stats( uint8_t sensor );
+
+/*! @brief Starts or stops the telemetry stream
+ *
+ *     Every period the polling task takes a snapshot of the store (one #sensor_snapshot per sensor that
+ * changed since the last one, see #sensor_set_deadband, in the AHB SRAM), which the log DMA sends as a
+ * #LOG_BLOCK_SENSORS block without another copy. The first snapshot has every sensor and none is sent while
+ * nothing changes. A snapshot isn't taken while the last one is still queued, a slow line only lowers the rate
+ * (the changes add up meanwhile).
+ * @param period_ms: Time between snapshots, 0 to stop, at least #SENSOR_STREAM_MIN_MS.
+ * @return 1 on success, 0 if the period is too short
+ */
+uint8_t sensor_stream( uint16_t period_ms );
+
+/*! @brief Sets how far the reading of a sensor must move before it counts as a change
+ *
+ * @param sensor: Sensor number.
+ * @param deadband: Raw counts, a reading more than this far from the last change is a new one.
+ * @return 1 on success, 0 if there's no such sensor
+ */
+uint8_t sensor_set_deadband( uint8_t sensor, uint16_t deadband );
+
+/*! @brief Takes the sensors that changed since the last call, clearing them for this consumer only
+ *
+ * @param consumer: @ref SENSOR_CONSUMER_STREAM "Consumer" taking its mask.
+ * @return One bit per sensor, bit n for sensor n
+ */
+uint32_t sensor_take_changes( uint8_t consumer );
+
+/*! @brief Records a request for the reading of a sensor, from the Get Sensor Reading handler
+ *
+ *     Learns the request period of the sensor (see #SENSOR_PREFETCH_LOCK), requests closer than a poll period
+ * to the last one (retries, a second manager) are left out. Also adds the age of the reading served to the
+ * "sensor.served_age_ms" metric.
+ * @param sensor: Sensor number.
+ * @param reading: Reading returned to the requester.
+ */
+void sensor_note_request( uint8_t sensor, const sensor_reading * reading );
+
+/*! @brief Tells if a reading can't be reported: never read, last read failed or older than #SENSOR_STALE_PERIODS periods */
+uint8_t sensor_reading_stale( uint8_t sensor, const sensor_reading * reading );
+
+#endif /*SENSOR_H_*/
@@ -0,0 +1,71 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file stack_guard.h
+ *
+ * @brief MPU guard region at the bottom of the running task's stack
+ *
+ * With #configAPP_STACK_GUARD set (make STACK_GUARD=1), one MPU region covers the lowest #STACK_GUARD_SIZE
+ * bytes of the stack of the running task, no access at all, and is moved to the next task's stack at each
+ * context switch (traceTASK_SWITCHED_IN, see FreeRTOSConfig.h). An overflow faults on its very first access
+ * past the stack, with the faulting instruction in the crash record, instead of being found at the next switch
+ * once it has already written over something else, so the kernel check of each switch
+ * (configCHECK_FOR_STACK_OVERFLOW) is left out. The rest of the memory map stays the default one (PRIVDEFENA),
+ * and the interrupts run on the main stack, which isn't guarded.
+ * The guard starts at the first #STACK_GUARD_SIZE boundary of the stack: #TASK_STACK buffers are aligned to
+ * it, so only the guard itself is lost, heap stacks lose up to 24 bytes more below it.
+ * This header is included by FreeRTOSConfig.h, so it can only depend on the C standard types.
+ */
+
+#ifndef STACK_GUARD_H_
+#define STACK_GUARD_H_
+
+/*! @brief Size of the guard, the smallest MPU region */
+#define STACK_GUARD_SIZE            32
+/*! @brief MPU region used, the highest numbered one takes priority over any other */
+#define STACK_GUARD_REGION          7
+
+#if configAPP_STACK_GUARD
+/*! @brief Enables the MPU and the memory management fault, no stack is guarded before the first context switch */
+void stack_guard_init( void );
+
+/*! @brief Moves the guard to a stack, from the context switch
+ *
+ * @param stack: Lowest address of the stack (pxStack of the task).
+ */
+void stack_guard_switch( const void * stack );
+
+/*! @brief Lets the running task read its own guard (high-water mark walk), the scheduler must be suspended */
+void stack_guard_suspend( void );
+
+/*! @brief Guards the running task's stack again, after #stack_guard_suspend */
+void stack_guard_resume( void );
+
+/*! @brief Tells if the memory management fault being handled was the guard, and turns the MPU off so the
+ * fault handler can read the exception frame even if it was stacked over the guard */
+uint8_t stack_guard_fault( void );
+
+/* Expanded inside vTaskSwitchContext (pxCurrentTCB) */
+#define STACK_GUARD_SWITCHED_IN()   stack_guard_switch( pxCurrentTCB->pxStack )
+#else
+#define STACK_GUARD_SWITCHED_IN()
+#endif
+
+#endif /*STACK_GUARD_H_*/
@@ -0,0 +1,75 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file stack_mon.h
+ *
+ * @brief Task stack usage telemetry
+ *
+ * Every task created with xTaskCreateWithStack (task_stack.h) is registered here with its stack depth, as are the
+ * idle and timer tasks once the scheduler runs. A periodic job (periodic.h) samples the stack high-water mark of
+ * each one every #STACK_MON_PERIOD, so the IPMI command reporting them never walks a stack itself, and suggests a
+ * depth for each task from the deepest use seen.
+ */
+
+#ifndef STACK_MON_H_
+#define STACK_MON_H_
+
+/*! @brief Most tasks followed */
+#define STACK_MON_MAX_TASKS         10
+/*! @brief Time between samples */
+#define STACK_MON_PERIOD            ( 1000 / portTICK_PERIOD_MS )
+/*! @brief Margin left above the deepest use by the recommended depth, in percent of that use */
+#define STACK_MON_MARGIN_PCT        25
+/*! @brief Smallest margin, in words (an exception frame and a few calls) */
+#define STACK_MON_MARGIN_MIN        32
+/*! @brief The recommended depths are rounded up to a multiple of this, in words */
+#define STACK_MON_ROUND             8
+
+/*! @brief Stack usage of a task */
+typedef struct stack_usage {
+    const char * name;
+    uint16_t depth;                         /*!< Stack size, in words */
+    uint16_t min_free;                      /*!< Fewest free words seen, up to the last sample */
+    uint16_t recommended;                   /*!< Suggested stack size, in words */
+} stack_usage;
+
+/*! @brief Starts the sampling job */
+void stack_mon_init( void );
+
+/*! @brief Follows a task
+ *
+ * @param task: Task handle.
+ * @param depth: Its stack size, in words, as given to xTaskCreate.
+ */
+void stack_mon_register( TaskHandle_t task, uint16_t depth );
+
+/*! @brief Number of tasks followed */
+uint8_t stack_mon_count( void );
+
+/*! @brief Stack usage of a followed task
+ *
+ * @param index: Position of the task, in registration order.
+ * @param usage: Where to copy its usage to.
+ * @return 1 on success, 0 if there's no such task
+ */
+uint8_t stack_mon_get( uint8_t index, stack_usage * usage );
+
+#endif /*STACK_MON_H_*/
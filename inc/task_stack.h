@@ -0,0 +1,62 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file task_stack.h
+ *
+ * @brief Task stacks in static buffers
+ *
+ * With #configAPP_STATIC_STACKS set, the stacks of the project tasks are arrays in the local SRAM
+ * (RamLoc16, see ram_sections.h), so their size shows up in the map file and their allocation
+ * can't fail. Otherwise they come from the FreeRTOS heap, as with xTaskCreate.
+ * Either way the task is registered with the stack usage telemetry (stack_mon.h).
+ * @code
+ * TASK_STACK( sensor_stack, SENSOR_STACK_DEPTH, 1 );
+ * xTaskCreateWithStack( SensorTask, "Sensors", SENSOR_STACK_DEPTH, NULL, SENSOR_TASK_PRIORITY, NULL, TASK_STACK_BUFFER( sensor_stack, 0 ) );
+ * @endcode
+ * @warning Must be included after ram_sections.h
+ */
+
+#ifndef TASK_STACK_H_
+#define TASK_STACK_H_
+
+#if configAPP_STATIC_STACKS
+/* The stack guard (stack_guard.h) starts at the first boundary of its size, aligned it takes nothing else */
+#if configAPP_STACK_GUARD
+#define TASK_STACK_ALIGN                STACK_GUARD_SIZE
+#else
+#define TASK_STACK_ALIGN                8
+#endif
+/*! @brief Declares the stacks of @p count tasks of @p depth words each */
+/* Not zeroed at reset, the kernel fills each stack when it creates the task */
+#define TASK_STACK( var, depth, count ) \
+    static StackType_t var[count][depth] __attribute__ ((aligned(TASK_STACK_ALIGN))) __NOINIT
+/*! @brief Stack buffer of the @p n th task declared by #TASK_STACK */
+#define TASK_STACK_BUFFER( var, n )     ( var[n] )
+#else
+#define TASK_STACK( var, depth, count ) extern int var##_unused
+#define TASK_STACK_BUFFER( var, n )     NULL
+#endif
+
+/*! @brief xTaskCreate, with the stack given by #TASK_STACK_BUFFER, also registering the task with #stack_mon_register */
+BaseType_t xTaskCreateWithStack( TaskFunction_t code, const char * name, uint16_t depth, void * params,
+                                 UBaseType_t prio, TaskHandle_t * handle, StackType_t * stack );
+
+#endif /*TASK_STACK_H_*/
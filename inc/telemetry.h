@@ -0,0 +1,65 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file telemetry.h
+ *
+ * @brief Sensor telemetry pushed to a subscribed collector over IPMB
+ *
+ * A collector subscribes once (custom Telemetry Subscribe command) to a set of sensors and a period
+ * instead of polling them through the MCH. Every period the sensors of the set that changed (see
+ * #sensor_take_changes) are sent to it in compact custom Telemetry Frame requests, with the asynchronous
+ * IPMB API; nothing is sent while nothing changes. One frame is in flight at a time: the changes that
+ * don't fit in it, or that were in a frame the collector didn't take, go in the next one with their
+ * reading of that moment.
+ * The timer and the IPMB callbacks hand their work to the IPMI dispatcher (#ipmi_defer), as event.c does.
+ * @warning Must be included after ipmb.h
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+/*! @brief Shortest push period */
+#define TELEMETRY_MIN_PERIOD_MS     250
+/*! @brief Collector address that stops the pushes */
+#define TELEMETRY_DISABLED          0x00
+/*! @brief Bytes of each sensor in a frame: sensor number, reading status and raw (SDR) reading */
+#define TELEMETRY_ENTRY_LEN         3
+/*! @brief Bytes of a frame before the entries: sequence number and entry count */
+#define TELEMETRY_HEADER_LEN        2
+/*! @brief Entries of one frame */
+#define TELEMETRY_FRAME_ENTRIES     ( ( IPMB_MAX_DATA_LEN - TELEMETRY_HEADER_LEN ) / TELEMETRY_ENTRY_LEN )
+
+/*! @brief Creates the push timer, the IPMB layer must be up (see #ipmb_init) */
+void telemetry_init( void );
+
+/*! @brief Subscribes a collector, replacing the previous one
+ *
+ *     The first frames after a subscription carry every sensor of the set.
+ * @param addr: Collector slave address (8 bit address), #TELEMETRY_DISABLED to stop.
+ * @param sensors: Sensor set, bit n for sensor n.
+ * @param period_ms: Time between pushes, at least #TELEMETRY_MIN_PERIOD_MS.
+ * @return 1 on success, 0 if the period is too short or the set is empty
+ */
+uint8_t telemetry_subscribe( uint8_t addr, uint32_t sensors, uint16_t period_ms );
+
+/*! @brief Frames sent since the subscription and, out of them, the ones the collector didn't take */
+void telemetry_get_stats( uint32_t * sent, uint32_t * failed );
+
+#endif /*TELEMETRY_H_*/
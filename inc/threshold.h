@@ -0,0 +1,106 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file threshold.h
+ *
+ * @brief Threshold evaluation of the sensor readings
+ *
+ * Every threshold sensor keeps its six thresholds and its hysteresis in RAM, loaded from its SDR and
+ * changed by the Set Sensor Threshold / Hysteresis commands. Each time a threshold is written,
+ * the assertion and deassertion levels are computed once in the raw reading domain, so the
+ * evaluation after each reading is a few integer compares. Events are only sent when a threshold
+ * changes state, and hysteresis keeps a reading hovering around a threshold from toggling it.
+ * @warning Must be included after i2c.h
+ */
+
+#ifndef THRESHOLD_H_
+#define THRESHOLD_H_
+
+/*! @brief Number of thresholds of a sensor */
+#define THRESHOLD_COUNT             6
+
+/*! @name Threshold bits, as in the threshold masks and the Get Sensor Reading comparison status
+ * @{
+ */
+#define THRESHOLD_LNC               0x01    /*!< Lower non-critical */
+#define THRESHOLD_LC                0x02    /*!< Lower critical */
+#define THRESHOLD_LNR               0x04    /*!< Lower non-recoverable */
+#define THRESHOLD_UNC               0x08    /*!< Upper non-critical */
+#define THRESHOLD_UC                0x10    /*!< Upper critical */
+#define THRESHOLD_UNR               0x20    /*!< Upper non-recoverable */
+#define THRESHOLD_UPPER             ( THRESHOLD_UNC | THRESHOLD_UC | THRESHOLD_UNR )
+#define THRESHOLD_ALL               0x3F
+/*! @} */
+
+/*! @brief #threshold_margin of a sensor without thresholds (or not evaluated yet) */
+#define THRESHOLD_MARGIN_NONE       0xFFFF
+
+/*! @brief Loads the thresholds and the hysteresis of every sensor from its SDR */
+void threshold_init( void );
+
+/*! @brief Compares a new reading against the thresholds of its sensor
+ *
+ * Only called by the sensor polling task. Sends a Platform Event for each threshold that changes state
+ * and has its event enabled in the SDR.
+ *
+ * @param sensor: Sensor number.
+ * @param value: Raw reading.
+ */
+void threshold_evaluate( uint8_t sensor, uint16_t value );
+
+/*! @brief Distance of the last evaluated reading to the nearest threshold, in raw counts
+ *
+ * 0 while some threshold is asserted, #THRESHOLD_MARGIN_NONE if the sensor has none. Only meaningful to the
+ * polling task, which is the one evaluating the readings.
+ */
+uint16_t threshold_margin( uint8_t sensor );
+
+/*! @brief Thresholds currently asserted, as @ref THRESHOLD_LNC "threshold bits" */
+uint8_t threshold_state( uint8_t sensor );
+
+/*! @brief Copies the raw thresholds, in the order of the threshold bits
+ *
+ * @return Readable threshold mask, 0 if there's no such sensor (or it has no thresholds)
+ */
+uint8_t threshold_get( uint8_t sensor, uint8_t * raw );
+
+/*! @brief Sets some thresholds
+ *
+ * @param sensor: Sensor number.
+ * @param mask: Thresholds to set.
+ * @param raw: Six raw thresholds, in the order of the threshold bits; the ones not in @p mask are ignored.
+ * @return 1 on success, 0 if some threshold in @p mask isn't settable (nothing is changed)
+ */
+uint8_t threshold_set( uint8_t sensor, uint8_t mask, const uint8_t * raw );
+
+/*! @brief Copies the positive and negative going hysteresis, raw
+ *
+ * @return 1 on success, 0 if there's no such sensor
+ */
+uint8_t threshold_get_hysteresis( uint8_t sensor, uint8_t * pos, uint8_t * neg );
+
+/*! @brief Sets the positive and negative going hysteresis, raw
+ *
+ * @return 1 on success, 0 if there's no such sensor or its hysteresis isn't settable
+ */
+uint8_t threshold_set_hysteresis( uint8_t sensor, uint8_t pos, uint8_t neg );
+
+#endif /*THRESHOLD_H_*/
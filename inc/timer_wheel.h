@@ -0,0 +1,87 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file timer_wheel.h
+ *
+ * @brief Protocol deadlines sharing a single software timer
+ *
+ * Retry backoffs, request timeouts and retransmits don't get a FreeRTOS timer each: they're #wheel_timer
+ * entries, owned by their module, in a hierarchical timer wheel of #WHEEL_LEVELS levels of #WHEEL_SLOTS slots
+ * (one tick, #WHEEL_SLOTS ticks and #WHEEL_SLOTS squared ticks per slot). Starting and stopping a timer links it
+ * in or out of a slot list, in O(1); a slot of the upper levels is moved down when the wheel reaches it. One
+ * FreeRTOS one-shot timer drives the wheel and is rearmed for the next slot holding timers, so nothing wakes up
+ * in between (tickless idle included), and the timers due on the same tick expire in one pass of the timer task.
+ * Deadlines further than #WHEEL_RANGE ticks go round the top level again, anything up to half the tick range works.
+ * Callbacks run in the timer task, like the FreeRTOS timer ones: they mustn't block and may start any timer again,
+ * their own one included.
+ * @code
+ * static wheel_timer retry;
+ * wheel_timer_init( &retry, prvRetry, NULL );
+ * wheel_timer_start( &retry, 100 / portTICK_PERIOD_MS );
+ * @endcode
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#define WHEEL_LEVELS                3
+#define WHEEL_SLOT_BITS             5
+#define WHEEL_SLOTS                 ( 1 << WHEEL_SLOT_BITS )
+/*! @brief Ticks covered by the wheel, from the next tick processed */
+#define WHEEL_RANGE                 ( 1UL << ( WHEEL_LEVELS * WHEEL_SLOT_BITS ) )
+
+/*! @brief Timer of the wheel, the storage is the caller's */
+typedef struct wheel_timer {
+    /* Managed by timer_wheel.c */
+    struct wheel_timer * next;
+    struct wheel_timer ** pprev;            /*!< Link pointing at this timer, NULL when it isn't pending */
+    TickType_t expiry;                      /*!< Tick it expires at */
+    uint8_t slot;                           /*!< Level * #WHEEL_SLOTS + slot of the list it's in */
+    /* Given to #wheel_timer_init */
+    void (* fn)( void * arg );              /*!< Called in the timer task, mustn't block */
+    void * arg;
+} wheel_timer;
+
+/*! @brief Sets the callback of a timer, before it's started for the first time
+ *
+ * @param timer: Timer, must stay valid while it's pending (static storage).
+ */
+void wheel_timer_init( wheel_timer * timer, void (* fn)( void * arg ), void * arg );
+
+/*! @brief Starts a timer, or restarts it from now if it's already pending
+ *
+ * From a task or a timer callback (not from an ISR), before or after the scheduler starts.
+ * @param delay: Ticks from now, 0 expires on the next pass of the wheel.
+ */
+void wheel_timer_start( wheel_timer * timer, TickType_t delay );
+
+/*! @brief Stops a timer, nothing happens if it isn't pending
+ *
+ * Once stopped its callback won't be called, unless it's already running.
+ * The driver isn't rearmed: if the timer was the next one due, the wheel still wakes up for it and finds nothing
+ * (a pass costs less than the timer command).
+ */
+void wheel_timer_stop( wheel_timer * timer );
+
+/*! @return 1 if the timer is pending */
+uint8_t wheel_timer_active( const wheel_timer * timer );
+
+#endif /*TIMER_WHEEL_H_*/
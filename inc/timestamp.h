@@ -0,0 +1,63 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file timestamp.h
+ *
+ * @brief Microsecond timestamps, from the free running timer of the boot timeline
+ *
+ * TIMER3 counts microseconds from reset (see boot_time.h), so reading it is all a timestamp takes,
+ * from a task or an interrupt. It wraps after 2^32 us (71 minutes): a time is only compared with
+ * another through their difference, #timestamp_elapsed or #timestamp_reached, which are right as long
+ * as the two are less than 35 minutes apart. The IPMB deadlines and latencies are kept this way, well
+ * below the tick resolution of the kernel timeouts.
+ * @code
+ * uint32_t deadline = timestamp_now() + TIMESTAMP_MS( 250 );
+ * ...
+ * if ( timestamp_reached( timestamp_now(), deadline ) ) {
+ * @endcode
+ * @warning Must be included after chip.h and boot_time.h
+ */
+
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+/*! @brief Milliseconds to timestamp units */
+#define TIMESTAMP_MS( ms )          ( (uint32_t) ( ms ) * 1000 )
+
+/*! @brief Current time, in microseconds */
+static inline uint32_t timestamp_now( void )
+{
+    return BOOT_TIME_TIMER->TC;
+}
+
+/*! @brief Microseconds from @p since to @p now, wrap-safe */
+static inline uint32_t timestamp_elapsed( uint32_t now, uint32_t since )
+{
+    return now - since;
+}
+
+/*! @brief Tells if @p now is at or past @p deadline, wrap-safe */
+static inline uint8_t timestamp_reached( uint32_t now, uint32_t deadline )
+{
+    return (int32_t) ( now - deadline ) >= 0;
+}
+
+#endif /*TIMESTAMP_H_*/
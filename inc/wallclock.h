@@ -0,0 +1,58 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file wallclock.h
+ *
+ * @brief Wall clock for the event, log and crash timestamps: the RTC, synchronized from the MCH
+ *
+ * The time of the MCH (Get SEL Time, seconds since 1970) is asked for #WALLCLOCK_SYNC_DELAY after boot and then
+ * every #WALLCLOCK_SYNC_PERIOD. In between, the time is the one of the last sync plus the ticks since, so a
+ * reading is a few loads and a multiply, with no lock and no bus access; it can be taken from an interrupt.
+ * The MCH time only has seconds: a local time within the second it returns is kept as it is, so the clock
+ * doesn't step back and forth at each sync.
+ *     Each sync also sets the on-chip RTC, and marks it as set in one of its general purpose registers: after a
+ * reset the clock starts from the RTC (to the second) until the next sync. The RTC needs its 32 kHz crystal and
+ * its supply kept up for that, without them the clock is unknown (0) after a power cycle until the MCH answers.
+ *     Every sync logs a "wallclock,sync" record with the time, from which tools/log_decode.py --wallclock dates
+ * the microsecond timestamps of all the log records, so the logs of many boards line up without a round trip per
+ * event.
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef WALLCLOCK_H_
+#define WALLCLOCK_H_
+
+/*! @brief First sync after boot, once IPMB is up */
+#define WALLCLOCK_SYNC_DELAY        ( 5000 / portTICK_PERIOD_MS )
+/*! @brief Time between syncs */
+#define WALLCLOCK_SYNC_PERIOD       ( 3600000 / portTICK_PERIOD_MS )
+/*! @brief Time before asking again after a failed sync */
+#define WALLCLOCK_SYNC_RETRY        ( 10000 / portTICK_PERIOD_MS )
+
+/*! @brief Starts the clock from the RTC if it was set before the reset, and the sync timer */
+void wallclock_init( void );
+
+/*! @brief Milliseconds since 1970-01-01 UTC, 0 while the time is unknown */
+uint64_t wallclock_ms( void );
+
+/*! @brief Seconds since 1970-01-01 UTC, 0 while the time is unknown */
+uint32_t wallclock_seconds( void );
+
+#endif /*WALLCLOCK_H_*/
@@ -0,0 +1,85 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file watchdog.h
+ *
+ * @brief Hardware watchdog fed by a task liveness monitor
+ *
+ * The critical tasks register once and then check in at least once per deadline, which only sets their
+ * bit in a word with an atomic OR (LDREX/STREX), so checking in costs a few cycles and works from any
+ * context. A task waiting for work blocks for at most #WATCHDOG_BLOCK_TIME, so it checks in while idle.
+ *     A monitor task at the lowest priority above idle collects the bits every #WATCHDOG_PERIOD. When
+ * every registered task has checked in within its deadline it feeds the watchdog; when one hasn't, the
+ * late task is kept in the crash record (crash.h) and the board resets. If the monitor itself can't
+ * run (a task hogging the CPU, interrupts stuck off), the watchdog resets the board after
+ * #WATCHDOG_TIMEOUT. The timer service task checks in through a periodic job (periodic.h).
+ * With #configAPP_WATCHDOG cleared (make WATCHDOG=0, for debugging sessions), the watchdog isn't started
+ * and the late tasks are only logged.
+ * @code
+ * watchdog_id wdg = watchdog_register( "IPMB_RX", WATCHDOG_DEADLINE );
+ * for ( ;; ) {
+ *     watchdog_checkin( wdg );
+ *     xQueueReceive( queue, &msg, WATCHDOG_BLOCK_TIME );
+ * }
+ * @endcode
+ * @warning Must be included after FreeRTOS.h
+ */
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+/*! @brief Monitor task stack, in words */
+#define WATCHDOG_STACK_DEPTH        configMINIMAL_STACK_SIZE
+/*! @brief Time between two checks of the tasks by the monitor */
+#define WATCHDOG_PERIOD             ( 250 / portTICK_PERIOD_MS )
+/*! @brief Hardware timeout, in watchdog clock ticks (IRC / 4: 1 us), well above a check period */
+#define WATCHDOG_TIMEOUT            4000000
+/*! @brief Default check in deadline of a task */
+#define WATCHDOG_DEADLINE           ( 2000 / portTICK_PERIOD_MS )
+/*! @brief Longest time a registered task should block waiting for work */
+#define WATCHDOG_BLOCK_TIME         ( 500 / portTICK_PERIOD_MS )
+/*! @brief Most tasks registered, one bit each */
+#define WATCHDOG_MAX_TASKS          16
+
+/*! @brief Bit of a registered task, 0 (checking in does nothing) if the table was full */
+typedef uint32_t watchdog_id;
+
+/*! @brief Check in bits set since the last check, see #watchdog_checkin */
+extern volatile uint32_t watchdog_alive;
+
+/*! @brief Starts the watchdog and the monitor task, before the scheduler */
+void watchdog_init( void );
+
+/*! @brief Adds the calling task (or any activity) to the monitored ones
+ *
+ * @param name: Reported when it's late, a string in flash (literal), as for log.h.
+ * @param deadline: Longest time between two check ins.
+ * @return ID to check in with
+ */
+watchdog_id watchdog_register( const char * name, TickType_t deadline );
+
+/*! @brief Tells the monitor a task is alive, from any context */
+static inline void watchdog_checkin( watchdog_id id )
+{
+    __atomic_fetch_or( &watchdog_alive, id, __ATOMIC_RELAXED );
+}
+
+#endif /*WATCHDOG_H_*/
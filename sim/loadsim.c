@@ -0,0 +1,526 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*!
+ * @file loadsim.c
+ *
+ * @brief IPMB load simulator (make loadsim)
+ *
+ * Replaces AFC_IPM.c in the simulator image: the MMC tasks run as usual (IPMB RX/TX, the IPMI dispatcher and
+ * workers, sensors, FRU), but the IPMB interface is on the mock I2C backend (see #vI2CMockAttach), so no crate
+ * is needed. One task plays the MCH: it hands request frames to the slave receiver, answers the requests the
+ * MMC sends, and times every response the MMC writes. First the capture of sim/sim_capture.h is replayed with
+ * its own timing, then synthetic requests are offered at each rate of #SIM_RATES for #SIM_STEP_MS, with
+ * back-to-back bursts and retries of the same sequence number mixed in. Each phase ends with a CSV line on the
+ * debug UART (115200 8N1):
+ * @code
+ * sim,phase,offered_per_s,sent,retries,answered,duplicates,cc_errors,dropped,drop_permille,rx_overruns,answered_per_s,p50_us,p90_us,p99_us,max_us
+ * sim,rate,200,1013,50,1013,50,0,0,0,0,202,310,420,1100,1300
+ * @endcode
+ * Dropped requests are the ones never answered (rx_overruns of them didn't even fit in the receive ring),
+ * duplicates are the answers to retries or to requests already answered. The latencies go from the frame being
+ * handed to the receiver to the response being written, with a 12% resolution.
+ * The bus time isn't simulated, so the figures are those of the firmware alone.
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "timers.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "board_defs.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmb_frame.h"
+#include "ipmi.h"
+#include "sensor.h"
+#include "fru.h"
+#include "stack_mon.h"
+#include "cpu_load.h"
+#include "mem_stats.h"
+#include "prof.h"
+#include "deferred.h"
+
+/*! @brief Synthetic request rates, in requests per second */
+#define SIM_RATES               { 50, 100, 200, 400, 800, 1600 }
+/*! @brief Length of each synthetic rate step */
+#define SIM_STEP_MS             5000
+/*! @brief Time left to the MMC to answer the last requests of a phase */
+#define SIM_DRAIN_MS            500
+/*! @brief Every SIM_RETRY_EVERY-th synthetic request is sent again one tick later, with the same sequence number */
+#define SIM_RETRY_EVERY         20
+/*! @brief Every SIM_BURST_PERIOD ms, SIM_BURST_LEN extra requests are sent back to back */
+#define SIM_BURST_PERIOD        250
+#define SIM_BURST_LEN           3
+/*! @brief Times the capture is replayed */
+#define SIM_REPLAY_LOOPS        3
+/*! @brief Latency histogram: 8 exact buckets, then 8 per power of 2 up to 2^20 us */
+#define SIM_HIST_BUCKETS        144
+#define SIM_SEQ_COUNT           64
+#define SIM_UART                LPC_UART0
+#define SIM_UART_BAUD           115200
+/* Stands for the bus and its interrupt, so it preempts the MMC tasks */
+#define SIM_TASK_PRIORITY       ( configMAX_PRIORITIES - 1 )
+#define SIM_STACK_DEPTH         ( configMINIMAL_STACK_SIZE * 3 )
+
+/*! @brief Request frame of the capture, as it went on the bus */
+typedef struct sim_capture_frame {
+    uint16_t delay_ms;                      /*!< Since the previous frame */
+    uint8_t len;
+    uint8_t data[IPMI_MSG_MAX_LENGTH];
+} sim_capture_frame;
+
+#include "sim_capture.h"
+
+/*! @brief Request of the synthetic mix */
+typedef struct sim_request {
+    uint8_t netfn;
+    uint8_t cmd;
+    uint8_t data_len;
+    uint8_t data[2];
+} sim_request;
+
+static const sim_request sim_mix[] = {
+    { NETFN_APP,    IPMI_GET_DEVICE_ID_CMD,         0, { 0 } },
+    { NETFN_SE,     IPMI_GET_SENSOR_READING_CMD,    1, { 0 } },
+    { NETFN_SE,     IPMI_GET_SENSOR_READING_CMD,    1, { 1 } },
+    { NETFN_GRPEXT, IPMI_PICMG_CMD_GET_PROPERTIES,  1, { 0 } },
+    { NETFN_SE,     IPMI_GET_SENSOR_READING_CMD,    1, { 2 } },
+    { NETFN_SE,     IPMI_GET_DEVICE_SDR_INFO_CMD,   0, { 0 } },
+    { NETFN_SE,     IPMI_GET_SENSOR_READING_CMD,    1, { 3 } },
+    { NETFN_SE,     IPMI_GET_SENSOR_THRESHOLD_CMD,  1, { 0 } },
+};
+
+#define SIM_MIX_LEN             ( sizeof(sim_mix) / sizeof(sim_mix[0]) )
+
+/*! @brief Counters of the running phase, shared with the mock transmitter (IPMB TX task) */
+typedef struct sim_stats {
+    uint32_t sent;
+    uint32_t retries;
+    uint32_t answered;
+    uint32_t duplicates;
+    uint32_t cc_errors;
+    uint32_t dropped;
+    uint32_t rx_overruns;
+    uint32_t max_us;
+    uint16_t hist[SIM_HIST_BUCKETS];
+} sim_stats;
+
+/*! @brief Start of each unanswered request, by sequence number */
+static uint32_t sim_start[SIM_SEQ_COUNT];
+static uint8_t sim_pending[SIM_SEQ_COUNT];
+static sim_stats stats;
+static uint8_t sim_mmc_addr;
+static uint32_t sim_cycles_per_us;
+
+static void prvSimPuts( const char * str )
+{
+    Chip_UART_SendBlocking( SIM_UART, str, strlen( str ) );
+}
+
+static void prvSimPutu( uint32_t value )
+{
+    char buf[11];
+    uint8_t i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + ( value % 10 );
+        value /= 10;
+    } while ( value );
+    prvSimPuts( &buf[i] );
+}
+
+static void prvSimUARTInit( void )
+{
+    Chip_IOCON_PinMux( LPC_IOCON, UART_DEBUG_PORT, UART_DEBUG_TX_PIN, IOCON_MODE_INACT, UART_DEBUG_PIN_FUNC );
+    Chip_IOCON_PinMux( LPC_IOCON, UART_DEBUG_PORT, UART_DEBUG_RX_PIN, IOCON_MODE_INACT, UART_DEBUG_PIN_FUNC );
+    Chip_UART_Init( SIM_UART );
+    Chip_UART_SetBaud( SIM_UART, SIM_UART_BAUD );
+    Chip_UART_ConfigData( SIM_UART, UART_LCR_WLEN8 | UART_LCR_SBS_1BIT );
+    Chip_UART_SetupFIFOS( SIM_UART, UART_FCR_FIFO_EN | UART_FCR_TRG_LEV2 );
+    Chip_UART_TXEnable( SIM_UART );
+}
+
+/* Bucket of a latency: exact below 8 us, then the 3 bits after the most significant one */
+static uint8_t prvSimBucket( uint32_t us )
+{
+    uint8_t msb;
+
+    if ( us < 8 ) {
+        return us;
+    }
+    msb = 31 - __builtin_clz( us );
+    if ( msb > 19 ) {
+        return SIM_HIST_BUCKETS - 1;
+    }
+    return ( msb - 2 ) * 8 + ( ( us >> ( msb - 3 ) ) & 0x07 );
+}
+
+/* Highest latency of a bucket */
+static uint32_t prvSimBucketMax( uint8_t bucket )
+{
+    uint8_t msb;
+
+    if ( bucket < 8 ) {
+        return bucket;
+    }
+    msb = bucket / 8 + 2;
+    return ( ( 8 + ( bucket % 8 ) + 1 ) << ( msb - 3 ) ) - 1;
+}
+
+static uint32_t prvSimPercentile( const sim_stats * phase, uint8_t percent )
+{
+    uint32_t target = ( phase->answered * percent + 99 ) / 100;
+    uint32_t count = 0;
+    uint8_t bucket;
+
+    for ( bucket = 0; bucket < SIM_HIST_BUCKETS; bucket++ ) {
+        count += phase->hist[bucket];
+        if ( ( count >= target ) && ( count > 0 ) ) {
+            return prvSimBucketMax( bucket );
+        }
+    }
+    return 0;
+}
+
+/* Hands a request frame to the MMC, retry if it repeats one that wasn't answered yet */
+static void prvSimSend( uint8_t * frame, uint8_t len, uint8_t retry )
+{
+    uint8_t seq = frame[4] >> 2;
+
+    taskENTER_CRITICAL();
+    if ( retry ) {
+        stats.retries++;
+    } else {
+        if ( sim_pending[seq] ) {
+            /* Sequence number wrapped before the previous one was answered */
+            stats.dropped++;
+        }
+        stats.sent++;
+        sim_pending[seq] = 1;
+        sim_start[seq] = DWT->CYCCNT;
+    }
+    taskEXIT_CRITICAL();
+
+    if ( !xI2CMockInject( IPMB_I2C, frame, len ) && !retry ) {
+        taskENTER_CRITICAL();
+        sim_pending[seq] = 0;
+        stats.rx_overruns++;
+        stats.dropped++;
+        taskEXIT_CRITICAL();
+    }
+}
+
+/* Mock transmitter: times the responses and answers the MMC requests (events) right away */
+static i2c_err prvSimTx( I2C_ID_T i2c_id, uint8_t addr, const uint8_t * tx_data, uint8_t tx_len )
+{
+    uint8_t reply[IPMB_RESP_HEADER_LENGTH + 1];
+    uint8_t seq;
+    uint32_t us;
+
+    if ( tx_len < IPMB_REQ_HEADER_LENGTH ) {
+        return i2c_err_FAILURE;
+    }
+    seq = tx_data[3] >> 2;
+
+    if ( !( ( tx_data[0] >> 2 ) & 0x01 ) ) {
+        /* Request from the MMC (byte 0 of the bus frame is the address, left out of tx_data) */
+        reply[0] = sim_mmc_addr;
+        reply[1] = ( ( ( tx_data[0] >> 2 ) + 1 ) << 2 ) | ( tx_data[3] & IPMB_SRC_LUN_MASK );
+        reply[2] = ipmb_calculate_chksum( reply, 2 );
+        reply[3] = addr << 1;
+        reply[4] = ( tx_data[3] & IPMB_SEQ_MASK ) | ( tx_data[0] & IPMB_DEST_LUN_MASK );
+        reply[5] = tx_data[4];
+        reply[6] = IPMI_CC_OK;
+        reply[7] = ipmb_calculate_chksum( &reply[3], 4 );
+        xI2CMockInject( i2c_id, reply, sizeof(reply) );
+        return i2c_err_SUCCESS;
+    }
+
+    taskENTER_CRITICAL();
+    if ( sim_pending[seq] ) {
+        sim_pending[seq] = 0;
+        us = ( DWT->CYCCNT - sim_start[seq] ) / sim_cycles_per_us;
+        stats.answered++;
+        if ( stats.hist[prvSimBucket( us )] < UINT16_MAX ) {
+            stats.hist[prvSimBucket( us )]++;
+        }
+        if ( us > stats.max_us ) {
+            stats.max_us = us;
+        }
+    } else {
+        stats.duplicates++;
+    }
+    if ( tx_data[5] != IPMI_CC_OK ) {
+        stats.cc_errors++;
+    }
+    taskEXIT_CRITICAL();
+
+    return i2c_err_SUCCESS;
+}
+
+static void prvSimPhaseStart( void )
+{
+    taskENTER_CRITICAL();
+    memset( &stats, 0, sizeof(stats) );
+    memset( sim_pending, 0, sizeof(sim_pending) );
+    taskEXIT_CRITICAL();
+}
+
+/* Waits for the last answers and prints the phase line */
+static void prvSimPhaseEnd( const char * phase, uint32_t offered, TickType_t start )
+{
+    sim_stats result;
+    TickType_t elapsed;
+    uint8_t seq;
+
+    vTaskDelay( SIM_DRAIN_MS / portTICK_PERIOD_MS );
+    elapsed = xTaskGetTickCount() - start;
+
+    taskENTER_CRITICAL();
+    for ( seq = 0; seq < SIM_SEQ_COUNT; seq++ ) {
+        if ( sim_pending[seq] ) {
+            sim_pending[seq] = 0;
+            stats.dropped++;
+        }
+    }
+    memcpy( &result, &stats, sizeof(result) );
+    taskEXIT_CRITICAL();
+
+    prvSimPuts( "sim," );
+    prvSimPuts( phase );
+    prvSimPuts( "," );
+    prvSimPutu( offered );
+    prvSimPuts( "," );
+    prvSimPutu( result.sent );
+    prvSimPuts( "," );
+    prvSimPutu( result.retries );
+    prvSimPuts( "," );
+    prvSimPutu( result.answered );
+    prvSimPuts( "," );
+    prvSimPutu( result.duplicates );
+    prvSimPuts( "," );
+    prvSimPutu( result.cc_errors );
+    prvSimPuts( "," );
+    prvSimPutu( result.dropped );
+    prvSimPuts( "," );
+    prvSimPutu( result.sent ? ( result.dropped * 1000 ) / result.sent : 0 );
+    prvSimPuts( "," );
+    prvSimPutu( result.rx_overruns );
+    prvSimPuts( "," );
+    prvSimPutu( elapsed ? ( result.answered * configTICK_RATE_HZ ) / elapsed : 0 );
+    prvSimPuts( "," );
+    prvSimPutu( prvSimPercentile( &result, 50 ) );
+    prvSimPuts( "," );
+    prvSimPutu( prvSimPercentile( &result, 90 ) );
+    prvSimPuts( "," );
+    prvSimPutu( prvSimPercentile( &result, 99 ) );
+    prvSimPuts( "," );
+    prvSimPutu( result.max_us );
+    prvSimPuts( "\r\n" );
+}
+
+/* Replays the capture with its own timing, retargeted to our address */
+static void prvSimReplay( void )
+{
+    uint8_t frame[IPMI_MSG_MAX_LENGTH];
+    TickType_t start;
+    uint8_t loop;
+    uint8_t i;
+
+    prvSimPhaseStart();
+    start = xTaskGetTickCount();
+
+    for ( loop = 0; loop < SIM_REPLAY_LOOPS; loop++ ) {
+        for ( i = 0; i < SIM_CAPTURE_LEN; i++ ) {
+            if ( sim_capture[i].delay_ms ) {
+                vTaskDelay( sim_capture[i].delay_ms / portTICK_PERIOD_MS );
+            }
+            memcpy( frame, sim_capture[i].data, sim_capture[i].len );
+            /* The message checksum doesn't cover the destination address */
+            frame[0] = sim_mmc_addr;
+            frame[2] = ipmb_calculate_chksum( frame, 2 );
+            prvSimSend( frame, sim_capture[i].len, sim_pending[frame[4] >> 2] );
+        }
+    }
+
+    prvSimPhaseEnd( "replay", 0, start );
+}
+
+/* Next request of the synthetic mix, encoded as it goes on the bus */
+static uint8_t prvSimBuild( uint8_t * frame, uint32_t n )
+{
+    const sim_request * req = &sim_mix[n % SIM_MIX_LEN];
+    ipmi_msg msg;
+
+    memset( &msg, 0, sizeof(msg) );
+    msg.dest_addr = sim_mmc_addr;
+    msg.netfn = req->netfn;
+    msg.src_addr = MCH_ADDRESS;
+    msg.seq = n % SIM_SEQ_COUNT;
+    msg.cmd = req->cmd;
+    msg.data_len = req->data_len;
+    memcpy( msg.data, req->data, req->data_len );
+
+    frame[0] = msg.dest_addr;
+    return ipmb_encode( &frame[1], &msg ) + 1;
+}
+
+static void prvSimRate( uint32_t rate )
+{
+    uint8_t frame[IPMI_MSG_MAX_LENGTH];
+    uint8_t retry[IPMI_MSG_MAX_LENGTH];
+    uint8_t retry_len = 0;
+    uint8_t len;
+    uint32_t credit = 0;
+    uint32_t n = 0;
+    uint32_t burst;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wake = start;
+    TickType_t tick;
+
+    prvSimPhaseStart();
+
+    for ( tick = 0; tick < SIM_STEP_MS / portTICK_PERIOD_MS; tick++ ) {
+        if ( retry_len ) {
+            prvSimSend( retry, retry_len, sim_pending[retry[4] >> 2] );
+            retry_len = 0;
+        }
+
+        credit += rate * portTICK_PERIOD_MS;
+        burst = ( ( tick * portTICK_PERIOD_MS ) % SIM_BURST_PERIOD == 0 ) ? SIM_BURST_LEN : 0;
+        while ( ( credit >= 1000 ) || burst ) {
+            if ( burst ) {
+                burst--;
+            } else {
+                credit -= 1000;
+            }
+            len = prvSimBuild( frame, n );
+            prvSimSend( frame, len, 0 );
+            if ( ( ++n % SIM_RETRY_EVERY ) == 0 ) {
+                memcpy( retry, frame, len );
+                retry_len = len;
+            }
+        }
+
+        vTaskDelayUntil( &wake, 1 );
+    }
+
+    prvSimPhaseEnd( "rate", rate, start );
+}
+
+static void prvSimTask( void * pvParameters )
+{
+    static const uint32_t rates[] = SIM_RATES;
+    uint8_t i;
+
+    (void) pvParameters;
+
+    /* Let the IPMB receiver register for the frames */
+    vTaskDelay( 100 / portTICK_PERIOD_MS );
+    sim_mmc_addr = get_ipmb_addr();
+    sim_cycles_per_us = configCPU_CLOCK_HZ / 1000000UL;
+
+    prvSimPuts( "sim,phase,offered_per_s,sent,retries,answered,duplicates,cc_errors,dropped,drop_permille,"
+                "rx_overruns,answered_per_s,p50_us,p90_us,p99_us,max_us\r\n" );
+
+    prvSimReplay();
+    for ( i = 0; i < sizeof(rates) / sizeof(rates[0]); i++ ) {
+        prvSimRate( rates[i] );
+    }
+
+    prvSimPuts( "done,mmc_addr," );
+    prvSimPutu( sim_mmc_addr );
+    prvSimPuts( "\r\n" );
+
+    vTaskSuspend( NULL );
+}
+
+int main( void )
+{
+    SystemCoreClockUpdate();
+    prvSimUARTInit();
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    PROF_INIT();
+
+    /* Same tasks as the MMC image, with the IPMB interface on the mock backend */
+    vI2CMockAttach( IPMB_I2C, prvSimTx );
+    stack_mon_init();
+    cpu_load_init();
+    deferred_init();
+    sensor_init();
+    fru_init();
+    ipmi_init();
+
+    xTaskCreate( prvSimTask, "Load Sim", SIM_STACK_DEPTH, NULL, SIM_TASK_PRIORITY, NULL );
+    vTaskStartScheduler();
+
+    for ( ;; );
+}
+
+/*-----------------------------------------------------------*/
+/* FreeRTOS hooks, the MMC ones live in AFC_IPM.c */
+
+void vApplicationStackOverflowHook ( TaskHandle_t pxTask, signed char * pcTaskName )
+{
+    (void) pxTask;
+    taskDISABLE_INTERRUPTS();
+    prvSimPuts( "error,stack_overflow," );
+    prvSimPuts( (const char *) pcTaskName );
+    prvSimPuts( "\r\n" );
+    for ( ; ; ) {}
+}
+
+void vApplicationMallocFailedHook ( void )
+{
+    mem_stats_malloc_failed();
+    prvSimPuts( "error,malloc_failed\r\n" );
+}
+
+void vConfigureTimerForRunTimeStats( void )
+{
+    /* Same setup as the MMC image: TIMER0 counting at 10 kHz */
+    Chip_TIMER_Init( LPC_TIMER0 );
+    Chip_TIMER_Reset( LPC_TIMER0 );
+    LPC_TIMER0->CTCR = 0x00;
+    LPC_TIMER0->PR = ( configCPU_CLOCK_HZ / 10000UL ) - 1UL;
+    LPC_TIMER0->TCR = 0x01;
+}
+
+void vAssertCalled( char* file, uint32_t line )
+{
+    taskDISABLE_INTERRUPTS();
+    prvSimPuts( "error,assert," );
+    prvSimPuts( file );
+    prvSimPuts( "," );
+    prvSimPutu( line );
+    prvSimPuts( "\r\n" );
+    for ( ; ; );
+}
@@ -0,0 +1,40 @@
+/* Generated by tools/ipmb_capture_to_c.py from sim/mch_bringup.cap, don't edit */
+
+#define SIM_CAPTURE_LEN 34
+
+static const sim_capture_frame sim_capture[SIM_CAPTURE_LEN] = {
+    {     0,  7, { 0x72, 0x18, 0x76, 0x20, 0x04, 0x01, 0xDB } }, /* line 3 */
+    {     5,  8, { 0x72, 0xB0, 0xDE, 0x20, 0x08, 0x00, 0x00, 0xD8 } }, /* line 5 */
+    {     4,  9, { 0x72, 0x10, 0x7E, 0x20, 0x0C, 0x00, 0x20, 0x00, 0xB4 } }, /* line 6 */
+    {     3,  7, { 0x72, 0x10, 0x7E, 0x20, 0x10, 0x20, 0xB0 } }, /* line 7 */
+    {     2,  7, { 0x72, 0x10, 0x7E, 0x20, 0x14, 0x22, 0xAA } }, /* line 8 */
+    {     1, 13, { 0x72, 0x10, 0x7E, 0x20, 0x18, 0x21, 0x01, 0x00, 0x00, 0x00, 0x00, 0x05, 0xA1 } }, /* line 9 */
+    {     2, 13, { 0x72, 0x10, 0x7E, 0x20, 0x1C, 0x21, 0x01, 0x00, 0x01, 0x00, 0x00, 0x05, 0x9C } }, /* line 10 */
+    {     1, 13, { 0x72, 0x10, 0x7E, 0x20, 0x20, 0x21, 0x01, 0x00, 0x02, 0x00, 0x00, 0x05, 0x97 } }, /* line 11 */
+    {     2, 13, { 0x72, 0x10, 0x7E, 0x20, 0x24, 0x21, 0x01, 0x00, 0x03, 0x00, 0x00, 0x05, 0x92 } }, /* line 12 */
+    {     1, 13, { 0x72, 0x10, 0x7E, 0x20, 0x28, 0x21, 0x01, 0x00, 0x04, 0x00, 0x00, 0x05, 0x8D } }, /* line 13 */
+    {     1, 13, { 0x72, 0x10, 0x7E, 0x20, 0x28, 0x21, 0x01, 0x00, 0x04, 0x00, 0x00, 0x05, 0x8D } }, /* line 14 */
+    {     2,  8, { 0x72, 0x28, 0x66, 0x20, 0x2C, 0x10, 0x00, 0xA4 } }, /* line 15 */
+    {     2, 11, { 0x72, 0x28, 0x66, 0x20, 0x30, 0x11, 0x00, 0x00, 0x00, 0x10, 0x8F } }, /* line 16 */
+    {     1, 11, { 0x72, 0x28, 0x66, 0x20, 0x34, 0x11, 0x00, 0x10, 0x00, 0x10, 0x7B } }, /* line 17 */
+    {     1, 11, { 0x72, 0x28, 0x66, 0x20, 0x38, 0x11, 0x00, 0x20, 0x00, 0x10, 0x67 } }, /* line 18 */
+    {     1, 11, { 0x72, 0x28, 0x66, 0x20, 0x3C, 0x11, 0x00, 0x30, 0x00, 0x10, 0x53 } }, /* line 19 */
+    {   100,  8, { 0x72, 0x10, 0x7E, 0x20, 0x40, 0x2D, 0x01, 0x72 } }, /* line 20 */
+    {     1,  8, { 0x72, 0x10, 0x7E, 0x20, 0x44, 0x2D, 0x02, 0x6D } }, /* line 21 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x48, 0x2D, 0x03, 0x68 } }, /* line 22 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x4C, 0x2D, 0x04, 0x63 } }, /* line 23 */
+    {     1,  8, { 0x72, 0x10, 0x7E, 0x20, 0x50, 0x27, 0x01, 0x68 } }, /* line 24 */
+    {   100,  8, { 0x72, 0x10, 0x7E, 0x20, 0x54, 0x2D, 0x01, 0x5E } }, /* line 25 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x58, 0x2D, 0x02, 0x59 } }, /* line 26 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x5C, 0x2D, 0x03, 0x54 } }, /* line 27 */
+    {     1,  8, { 0x72, 0x10, 0x7E, 0x20, 0x60, 0x2D, 0x04, 0x4F } }, /* line 28 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x64, 0x27, 0x01, 0x54 } }, /* line 29 */
+    {   100,  8, { 0x72, 0x10, 0x7E, 0x20, 0x68, 0x2D, 0x01, 0x4A } }, /* line 30 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x6C, 0x2D, 0x02, 0x45 } }, /* line 31 */
+    {     1,  8, { 0x72, 0x10, 0x7E, 0x20, 0x70, 0x2D, 0x03, 0x40 } }, /* line 32 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x74, 0x2D, 0x04, 0x3B } }, /* line 33 */
+    {     1,  8, { 0x72, 0x10, 0x7E, 0x20, 0x78, 0x27, 0x01, 0x40 } }, /* line 34 */
+    {     0,  7, { 0x72, 0x18, 0x76, 0x20, 0x7C, 0x01, 0x63 } }, /* line 35 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x80, 0x2D, 0x02, 0x31 } }, /* line 36 */
+    {     0,  8, { 0x72, 0x10, 0x7E, 0x20, 0x84, 0x2D, 0x03, 0x2C } }, /* line 37 */
+};
@@ -24,46 +24,44 @@
 #include "task.h"
 #include "queue.h"
 #include "semphr.h"
+#include "timers.h"
 
 /* Project includes */
 #include "chip.h"
 #include "board_defs.h"
+#include "gpio.h"
 #include "i2c.h"
 #include "led.h"
 #include "ipmb.h"
 #include "ipmi.h"
+#include "sensor.h"
+#include "fru.h"
+#include "ekey.h"
+#include "payload.h"
+#include "hotswap.h"
+#include "image.h"
+#include "config_store.h"
+#include "deferred.h"
+#include "hpm.h"
+#include "rtm.h"
+#include "fpga.h"
+#include "init_stage.h"
+#include "boot_time.h"
+#include "log.h"
+#include "crash.h"
+#include "watchdog.h"
+#include "mem_stats.h"
+#include "stack_mon.h"
+#include "cpu_load.h"
+#include "prof.h"
+#include "clock.h"
+#include "poh.h"
+#include "dma_copy.h"
 
-/* Priorities at which the tasks are created. */
-#define mainIPMBTEST_TASK_PRIORITY          ( IPMB_RXTASK_PRIORITY - 1 )
-#define mainMASTERTEST_TASK_PRIORITY        ( tskIDLE_PRIORITY + 1 )
-#define mainSLAVETEST_TASK_PRIORITY         ( tskIDLE_PRIORITY + 1 )
-
-/* LM75 Addresses */
-#define mainLM75_1_ADDR                     ((uint32_t) 0x4C)
-#define mainLM75_2_ADDR                     ((uint32_t) 0x4D)
-#define mainLM75_3_ADDR                     ((uint32_t) 0x4E)
-#define mainLM75_4_ADDR                     ((uint32_t) 0x4F)
-#define mainREAD_TEMP_FREQUENCY_MS          200
-
-//#define DEBUG_I2C0
-//#define DEBUG_I2C1
-//#define DEBUG_IPMB
-#define DEBUG_IPMI
-
-/* Tasks function prototypes */
-#ifdef DEBUG_I2C1
-static void prvMasterTestTask( void *pvParameters );
-#endif
-
-#ifdef DEBUG_I2C0
-static void prvSlaveTestTask( void *pvParameters );
-#endif
-
-#ifdef DEBUG_IPMB
-static void IPMBTestTask( void *pvParameters );
-#endif
 /* LED pins initialization */
 static void prvHardwareInit( void );
+/* Modules not needed to answer on IPMB, brought up once it does */
+static void prvDeferredInitTask( void *pvParameters );
 
 /*-----------------------------------------------------------*/
 
@@ -71,26 +69,47 @@ int main(void)
 {
     /* Configure LED pins */
     prvHardwareInit();
+    /* Cycle counter for the profiling probes, if they're built in */
+    PROF_INIT();
+    /* Image slots: a failed upgrade left by the boot loader is discarded before anything runs */
+    image_init();
+    boot_time_mark( BOOT_TIME_HW_INIT );
+    /* Start up stage bits, for the tasks waiting on the stages they depend on */
+    init_stage_init();
     /* Create project's tasks */
-#ifdef DEBUG_I2C0
-    vI2CInit(I2C0, I2C_Mode_IPMB);
-    xTaskCreate( prvSlaveTestTask, (const char*)"Slave Test", configMINIMAL_STACK_SIZE*2, ( void * ) NULL, mainMASTERTEST_TASK_PRIORITY, ( TaskHandle_t * ) NULL );
-#endif
 
-#ifdef DEBUG_I2C1
-    vI2CInit(I2C1, I2C_Mode_Local_Master);
-    xTaskCreate( prvMasterTestTask, (const char*)"Master Test", configMINIMAL_STACK_SIZE*2, ( void * ) NULL, mainSLAVETEST_TASK_PRIORITY, ( TaskHandle_t * ) NULL );
+    /* Stack usage sampling, the tasks register as they're created */
+    stack_mon_init();
+#if configAPP_STACK_GUARD
+    /* MPU on, the guard follows the running task from the first context switch */
+    stack_guard_init();
 #endif
-
-#ifdef DEBUG_IPMB
-    ipmb_init();
-    xTaskCreate ( IPMBTestTask, (const char*)"IPMB Test", configMINIMAL_STACK_SIZE*2, ( void * ) NULL, mainIPMBTEST_TASK_PRIORITY, ( TaskHandle_t * ) NULL );
+    /* CPU load sampling, from the run time stats */
+    cpu_load_init();
+#if configAPP_RESPONSE_TIME
+    /* Response times against the deadlines of the task plan (priorities.h) */
+    response_time_init();
 #endif
-
-#ifdef DEBUG_IPMI
+    /* Power-on hours and lifetime error totals, in the config store */
+    poh_init();
+    /* Interrupt bottom halves (I2C chain callbacks) */
+    deferred_init();
+    /* Task liveness monitor, the critical tasks register as they start */
+    watchdog_init();
+    /* Payload power rails, off until the hot swap machine activates the payload */
+    payload_init();
+    /* Hot swap handle */
+    hotswap_init();
+
+    /* IPMB and the IPMI dispatcher (the self tests are started from there, see selftest.h) */
     ipmi_init();
-#endif
+    /* RTM bridge, answers for the RTM on IPMB-L next to the IPMI dispatcher */
+    rtm_init();
+    boot_time_mark( BOOT_TIME_IPMI_INIT );
+    /* Sensors, FRU inventory and firmware upgrade, behind IPMB (see init_stage.h) */
+    xTaskCreate( prvDeferredInitTask, (const char*)"Init", INIT_STACK_DEPTH, ( void * ) NULL, INIT_TASK_PRIORITY, ( TaskHandle_t * ) NULL );
     /* Start the tasks running. */
+    boot_time_mark( BOOT_TIME_SCHEDULER );
     vTaskStartScheduler();
 
     /* If all is well we will never reach here as the scheduler will now be
@@ -99,125 +118,29 @@ int main(void)
     for( ;; );
 }
 /*-----------------------------------------------------------*/
-#ifdef DEBUG_I2C1
-static void prvMasterTestTask( void *pvParameters )
+static void prvDeferredInitTask( void *pvParameters )
 {
-    uint8_t rx_data[i2cMAX_MSG_LENGTH];
-#if 0
-    /* Variable that stores the actual stack used by this task */
-    uint8_t stack = uxTaskGetStackHighWaterMark( xTaskGetCurrentTaskHandle() );
-#endif
-    for( ;; )
-    {
-        /* Place this task in the blocked state until it is time to run again.
-           The block state is specified in ticks, the constant used converts ticks
-           to ms.  While in the blocked state this task will not consume any CPU
-           time. */
-        vTaskDelay( 50 / portTICK_PERIOD_MS );
-
-        /* Send I2C message to the queue  */
-        xI2CRead( I2C1, mainLM75_1_ADDR, rx_data, 2 );
-
-        if (*rx_data < 40){
-            prvToggleLED( LED_GREEN );
-        }
-    }
-}
-
-/*-----------------------------------------------------------*/
-#endif
-
-#ifdef DEBUG_I2C0
-void prvSlaveTestTask( void *pvParameters )
-{
-    uint8_t rx_buff[i2cMAX_MSG_LENGTH];
-    static uint8_t mch_retries;
-    for( ;; )
-    {
-        /* Place this task in the blocked state until it is time to run again.
-           The block state is specified in ticks, the constant used converts ticks
-           to ms.  While in the blocked state this task will not consume any CPU
-           time. */
-        xI2CSlaveTransfer( I2C0, rx_buff, portMAX_DELAY );
-        if (rx_buff[2] == 32){
-            mch_retries++;
-            if ( mch_retries == 3 ){
-                prvToggleLED( LED_RED );
-                mch_retries = 0;
-            }
-        }
-    }
-}
-#endif
-
-/*-----------------------------------------------------------*/
-#ifdef DEBUG_IPMB
-static void IPMBTestTask( void *pvParameters )
-{
-    static ipmi_msg rx_msg;
-    static ipmi_msg diff_rx_msg;
-    QueueHandle_t rx_queue;
-    uint8_t txbuf[] = { 0x00, /* Completion Code */
-                        0x0A, /* Dev ID */
-                        0x02, /* Dev Rev */
-                        0x05, /* Dev FW Rev UPPER */
-                        0x50, /* Dev FW Rev LOWER */
-                        0x02, /* IPMI Version 2.0 */
-                        0x1F, /* Dev Support */
-                        0x5A, /* Manufacturer ID LSB */
-                        0x31,
-                        0x00, /* ID MSB */
-                        0x01, /* Product ID LSB */
-                        0x01  /* Product ID MSB */
-    };
-
-    ipmb_register_rxqueue( &rx_queue );
-    for( ;; ) {
-        configASSERT( rx_queue );
-        xQueueReceive( rx_queue, &rx_msg, portMAX_DELAY);
-        /* Respond only to the GET_DEVICE_ID command (the only one implemented so far ) */
-        if (rx_msg.cmd == 1 && rx_msg.netfn == 0x06) {
-            if (ipmb_send_response( &rx_msg, txbuf, sizeof(txbuf)/sizeof(txbuf[0]) ) == ipmb_error_success) {;
-                prvToggleLED( LED_GREEN );
-            } else {
-                prvToggleLED( LED_RED );
-            }
-        } else {
-            /* We received an unknown message, save here for debug reasons */
-            diff_rx_msg = rx_msg;
-            prvToggleLED( LED_BLUE );
-        }
-    }
-}
-#endif
-
-void prvToggleLED( LED_id led )
-{
-    unsigned long ulLEDState;
-    unsigned long ulLEDport;
-    unsigned long ulLEDpin;
-
-    switch( led ){
-        case LED_BLUE:
-            ulLEDport = ledBLUE_PORT;
-            ulLEDpin = ledBLUE_PIN;
-            break;
-
-        case LED_GREEN:
-            ulLEDport = ledGREEN_PORT;
-            ulLEDpin = ledGREEN_PIN;
-            break;
-
-        case LED_RED:
-            ulLEDport = ledRED_PORT;
-            ulLEDpin = ledRED_PIN;
-            break;
-    }
-    /* Obtain the current P0 state. */
-    ulLEDState = Chip_GPIO_GetPinState(LPC_GPIO, ulLEDport, ulLEDpin);
-
-    /* Turn the LED off if it was on, and on if it was off. */
-    Chip_GPIO_SetPinState(LPC_GPIO, ulLEDport, ulLEDpin, !ulLEDState);
+    (void) pvParameters;
+
+    /* E-Keying port switches, registered before their bus comes up */
+    ekey_init();
+    /* Sensor buses and polling */
+    sensor_init();
+    /* FRU inventory, from the EEPROM on the sensor bus (loaded in the background, see fru.c) */
+    fru_init();
+    /* Firmware upgrade over IPMB */
+    hpm_init();
+    /* Payload FPGA loader (boards with its configuration wired to the MMC) */
+    fpga_init();
+    /* GPDMA memory copies, on the channel left once the streams above have theirs */
+    dma_copy_init();
+
+    /* Timeline in the log once the stages started above are all done */
+    init_wait( INIT_STAGES_ALL, portMAX_DELAY );
+    boot_time_log();
+
+    /* Its stack goes back to the heap */
+    vTaskDelete( NULL );
 }
 /*-----------------------------------------------------------*/
 
@@ -225,15 +148,21 @@ static void prvHardwareInit ( void )
 {
     /* Update clock register value */
     SystemCoreClockUpdate();
+    /* The timestamps stay in microseconds whatever the clock (see clock.h) */
+    clock_register( boot_time_clock );
+
+    /* Log drained to the debug UART, the records written until then are kept */
+    log_init();
+    /* Record left by a crash before the last reset, logged and kept for the Get Crash Record command */
+    crash_init();
+    /* Persistent settings, before the modules restoring theirs (the IAP needs the clock) */
+    config_init();
 
-    /* Init LED Pin */
     Chip_GPIO_Init(LPC_GPIO);
-    /* Set pin as output */
-    Chip_GPIO_SetPinDIR(LPC_GPIO, ledBLUE_PORT, ledBLUE_PIN, true);
-    Chip_GPIO_SetPinDIR(LPC_GPIO, ledGREEN_PORT, ledGREEN_PIN, true);
-    Chip_GPIO_SetPinDIR(LPC_GPIO, ledRED_PORT, ledRED_PIN, true);
+    /* LED pins and their timer */
+    led_init();
     /* Init GAddr test pin as output */
-    Chip_GPIO_SetPinDIR(LPC_GPIO, GA_TEST_PORT, GA_TEST_PIN, true);
+    GPIO_PIN_SET_DIR( GA_TEST, 1 );
 }
 /*-----------------------------------------------------------*/
 /* FreeRTOS Debug Functions */
@@ -241,14 +170,26 @@ static void prvHardwareInit ( void )
 #if (configCHECK_FOR_STACK_OVERFLOW == 1)
 void vApplicationStackOverflowHook ( TaskHandle_t pxTask, signed char * pcTaskName){
     (void) pxTask;
-    (void) pcTaskName;
     taskDISABLE_INTERRUPTS();
-    /* Place a breakpoint here, so we know when there's a stack overflow */
-    for ( ; ; ) {}
+    /* Kept for the next boot, then a watchdog reset (place a breakpoint here to stop on it instead) */
+    crash_stack_overflow( (const char *) pcTaskName );
+}
+#endif
+
+#if (configUSE_MALLOC_FAILED_HOOK == 1)
+void vApplicationMallocFailedHook ( void ){
+    /* Don't halt, the caller decides what a NULL means. Keep a record for the "Get Memory Statistics" command */
+    mem_stats_malloc_failed();
+    LOG( "heap,malloc_failed" );
 }
 #endif
 
 #if (configGENERATE_RUN_TIME_STATS == 1)
+static void prvRunTimeStatsClock( void )
+{
+    LPC_TIMER0->PR =  ( configCPU_CLOCK_HZ / 10000UL ) - 1UL;
+}
+
 void vConfigureTimerForRunTimeStats( void )
 {
     const unsigned long CTCR_CTM_TIMER = 0x00, TCR_COUNT_ENABLE = 0x01;
@@ -262,7 +203,8 @@ void vConfigureTimerForRunTimeStats( void )
 
     /* Prescale to a frequency that is good enough to get a decent resolution,
        but not too fast so as to overflow all the time. */
-    LPC_TIMER0->PR =  ( configCPU_CLOCK_HZ / 10000UL ) - 1UL;
+    prvRunTimeStatsClock();
+    clock_register( prvRunTimeStatsClock );
 
     /* Start the counter. */
     LPC_TIMER0->TCR = TCR_COUNT_ENABLE;
@@ -272,5 +214,6 @@ void vConfigureTimerForRunTimeStats( void )
 void vAssertCalled( char* file, uint32_t line) {
     taskDISABLE_INTERRUPTS();
     prvToggleLED(LED_RED);
-    for( ;; );
+    /* Kept for the next boot, then a watchdog reset */
+    crash_assert( file, line, (uint32_t) __builtin_return_address( 0 ) );
 }
@@ -0,0 +1,178 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file adc.c
+ *
+ * @brief On-chip ADC in burst mode, results moved by the GPDMA
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* Project includes */
+#include "chip.h"
+#include "adc.h"
+#include "log.h"
+#include "fpga.h"
+#include "dma_copy.h"
+#include "ram_sections.h"
+#include "clock.h"
+
+/*! @brief Channel of a conversion read from the global data register */
+#define ADC_GDR_CHANNEL( n )        ( ( ( n ) >> 24 ) & 0x7 )
+
+/*! @brief Pin of each ADC channel (AD0.0 to AD0.7) */
+static const struct {
+    uint8_t port;
+    uint8_t pin;
+    uint8_t func;
+} adc_pins[ADC_CHANNELS] = {
+    { 0, 23, IOCON_FUNC1 },
+    { 0, 24, IOCON_FUNC1 },
+    { 0, 25, IOCON_FUNC1 },
+    { 0, 26, IOCON_FUNC1 },
+    { 1, 30, IOCON_FUNC3 },
+    { 1, 31, IOCON_FUNC3 },
+    { 0, 3, IOCON_FUNC2 },
+    { 0, 2, IOCON_FUNC2 },
+};
+
+/*! @brief Conversions of one sweep, as read from the global data register (channel and result) */
+static uint32_t adc_dma_buf[ADC_CHANNELS * ADC_OVERSAMPLE] __RAM_AHB_NOINIT;
+/*! @brief Number of conversions in a sweep */
+static uint8_t adc_sweep_len;
+static uint8_t adc_dma_ch;
+static uint8_t adc_channels;
+
+/*! @brief Latest results, only written by the DMA interrupt (16 bit stores are atomic) */
+static volatile uint16_t adc_result[ADC_CHANNELS];
+/*! @brief Channels with a result */
+static volatile uint8_t adc_valid;
+static volatile uint32_t adc_sweep_count;
+/*! @brief Sampling setup, kept for the clock changes */
+static ADC_CLOCK_SETUP_T adc_setup;
+
+static void prvADCStartSweep( void )
+{
+    Chip_GPDMA_Transfer( LPC_GPDMA, adc_dma_ch, GPDMA_CONN_ADC, (uint32_t) adc_dma_buf,
+                         GPDMA_TRANSFERTYPE_P2M_CONTROLLER_DMA, adc_sweep_len );
+}
+
+/* Conversion clock divider for the new peripheral clock */
+static void prvADCClock( void )
+{
+    Chip_ADC_SetSampleRate( LPC_ADC, &adc_setup, ADC_SAMPLE_RATE );
+}
+
+void adc_init( uint8_t channels )
+{
+    uint8_t i;
+
+    adc_channels = channels;
+    adc_sweep_len = 0;
+
+    Chip_ADC_Init( LPC_ADC, &adc_setup );
+    prvADCClock();
+    clock_register( prvADCClock );
+    Chip_ADC_Int_SetGlobalCmd( LPC_ADC, DISABLE );
+
+    for ( i = 0; i < ADC_CHANNELS; i++ ) {
+        if ( channels & ( 1 << i ) ) {
+            Chip_IOCON_PinMux( LPC_IOCON, adc_pins[i].port, adc_pins[i].pin, IOCON_MODE_INACT, adc_pins[i].func );
+            Chip_ADC_EnableChannel( LPC_ADC, i, ENABLE );
+            /* Each conversion of the channel raises a DMA request (the ADC interrupt itself stays off) */
+            Chip_ADC_Int_SetChannelCmd( LPC_ADC, i, ENABLE );
+            adc_sweep_len += ADC_OVERSAMPLE;
+        }
+    }
+
+    if ( adc_sweep_len == 0 ) {
+        return;
+    }
+
+    /* The logger may have set the GPDMA up already (Chip_GPDMA_Init resets every channel) */
+    if ( !( LPC_SYSCTL->PCONP & ( 1 << SYSCTL_CLOCK_GPDMA ) ) ) {
+        Chip_GPDMA_Init( LPC_GPDMA );
+    }
+    adc_dma_ch = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, GPDMA_CONN_ADC );
+    NVIC_SetPriority( DMA_IRQn, DMA_IRQ_PRIORITY );
+    NVIC_EnableIRQ( DMA_IRQn );
+
+    prvADCStartSweep();
+    Chip_ADC_SetBurstCmd( LPC_ADC, ENABLE );
+}
+
+uint8_t adc_read( uint8_t channel, uint16_t * value )
+{
+    if ( ( channel >= ADC_CHANNELS ) || !( adc_valid & ( 1 << channel ) ) ) {
+        return 0;
+    }
+
+    *value = adc_result[channel];
+    return 1;
+}
+
+uint32_t adc_sweeps( void )
+{
+    return adc_sweep_count;
+}
+
+/* Averages the conversions of a completed sweep */
+static void prvADCDecimate( void )
+{
+    uint32_t sum[ADC_CHANNELS] = { 0 };
+    uint8_t count[ADC_CHANNELS] = { 0 };
+    uint8_t valid = 0;
+    uint8_t ch;
+    uint8_t i;
+
+    /* Burst mode may be anywhere in its round when the sweep starts, so each conversion is sorted out by its channel */
+    for ( i = 0; i < adc_sweep_len; i++ ) {
+        ch = ADC_GDR_CHANNEL( adc_dma_buf[i] );
+        sum[ch] += ADC_DR_RESULT( adc_dma_buf[i] );
+        count[ch]++;
+    }
+
+    for ( ch = 0; ch < ADC_CHANNELS; ch++ ) {
+        if ( count[ch] ) {
+            adc_result[ch] = sum[ch] / count[ch];
+            valid |= ( 1 << ch );
+        }
+    }
+
+    adc_valid |= ( valid & adc_channels );
+    adc_sweep_count++;
+}
+
+/* Shared with the channels of the logger (log.c), of the FPGA loader (fpga.c) and of the memory copies (dma_copy.c) */
+void DMA_IRQHandler( void )
+{
+    if ( ( adc_sweep_len != 0 ) && Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, adc_dma_ch ) ) {
+        /* SUCCESS: the sweep is complete, ERROR: bus error, the sweep is dropped */
+        if ( Chip_GPDMA_Interrupt( LPC_GPDMA, adc_dma_ch ) == SUCCESS ) {
+            prvADCDecimate();
+        }
+        prvADCStartSweep();
+    }
+    log_dma_irq();
+    fpga_dma_irq();
+    dma_copy_irq();
+}
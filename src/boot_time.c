@@ -0,0 +1,100 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file boot_time.c
+ *
+ * @brief Boot timeline record, on TIMER3
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* C Standard includes */
+#include "stddef.h"
+
+/* Project includes */
+#include "chip.h"
+#include "ram_sections.h"
+#include "boot_time.h"
+#include "log.h"
+
+#define BOOT_TIME_MAGIC             0x544F4F42  /* "BOOT" */
+
+/*! @brief Timeline of the current boot (of the last one, until ResetISR starts a new one) */
+typedef struct boot_time_record {
+    uint32_t magic;
+    uint32_t us[BOOT_TIME_COUNT];
+} boot_time_record;
+
+static boot_time_record boot_time __NOINIT;
+
+#define BOOT_TIME_NAME( id, name )  name,
+static const char * const boot_time_names[] = {
+    BOOT_TIME_MARKS( BOOT_TIME_NAME )
+};
+
+void boot_time_start( void )
+{
+    uint8_t i;
+
+    boot_time_timer_start();
+    boot_time.magic = BOOT_TIME_MAGIC;
+    for ( i = 0; i < BOOT_TIME_COUNT; i++ ) {
+        boot_time.us[i] = BOOT_TIME_NONE;
+    }
+    boot_time.us[BOOT_TIME_RESET] = BOOT_TIME_TIMER->TC;
+}
+
+void boot_time_clock( void )
+{
+    BOOT_TIME_TIMER->PR = ( Chip_Clock_GetPeripheralClockRate( BOOT_TIME_TIMER_PCLK ) / 1000000 ) - 1;
+}
+
+void boot_time_mark( boot_time_id id )
+{
+    if ( ( boot_time.magic == BOOT_TIME_MAGIC ) && ( boot_time.us[id] == BOOT_TIME_NONE ) ) {
+        boot_time.us[id] = BOOT_TIME_TIMER->TC;
+    }
+}
+
+uint32_t boot_time_get( uint8_t id )
+{
+    if ( ( boot_time.magic != BOOT_TIME_MAGIC ) || ( id >= BOOT_TIME_COUNT ) ) {
+        return BOOT_TIME_NONE;
+    }
+    return boot_time.us[id];
+}
+
+const char * boot_time_name( uint8_t id )
+{
+    return ( id < BOOT_TIME_COUNT ) ? boot_time_names[id] : NULL;
+}
+
+void boot_time_log( void )
+{
+    uint8_t i;
+
+    for ( i = 0; i < BOOT_TIME_COUNT; i++ ) {
+        if ( boot_time_get( i ) != BOOT_TIME_NONE ) {
+            LOG( "boot,%s,%u", boot_time_names[i], boot_time_get( i ) );
+        }
+    }
+}
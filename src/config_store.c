@@ -0,0 +1,592 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file config_store.c
+ *
+ * @brief Persistent settings log, in the flash sectors of #IMAGE_CONFIG_START
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "stddef.h"
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "image.h"
+#include "config_store.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "dma_copy.h"
+
+#define CONFIG_MAGIC                0x47464341  /* "ACFG" */
+#define CONFIG_SECTORS              2
+#define CONFIG_SECTOR_BASE( s )     ( IMAGE_CONFIG_START + ( s ) * ( IMAGE_CONFIG_SIZE / CONFIG_SECTORS ) )
+#define CONFIG_ROWS                 ( IMAGE_CONFIG_SIZE / CONFIG_SECTORS / IMAGE_ROW )
+#define CONFIG_ROW_HEADER           12
+#define CONFIG_PAYLOAD              ( IMAGE_ROW - CONFIG_ROW_HEADER )
+/* Key byte past the last record of a row (erased flash) */
+#define CONFIG_END                  0xFF
+#define CONFIG_NONE                 0xFF
+/* Record: key, length, value */
+#define CONFIG_RECORD_LEN( rec )    ( 2 + ( rec )[1] )
+#define CONFIG_TALLY_MAGIC          0x544E4341  /* "ACNT" */
+#define CONFIG_TALLY_HEADER         20
+/* Increments a tally row takes, one bit each */
+#define CONFIG_TALLY_BITS           ( ( IMAGE_ROW - CONFIG_TALLY_HEADER ) * 8 )
+
+/*! @brief Flash row of the log */
+typedef struct config_row {
+    uint32_t magic;                         /*!< #CONFIG_MAGIC */
+    uint32_t crc;                           /*!< CRC-32 of the rest of the row, generation included */
+    uint32_t generation;                    /*!< Of the sector, one more than the sector it was moved from (wrapping) */
+    uint8_t data[CONFIG_PAYLOAD];           /*!< Records, then #CONFIG_END */
+} config_row;
+
+/*! @brief Flash row of a counter, a #config_row with another magic
+ *
+ * The value is the base plus the bits programmed in the marks. An increment programs the next bits of the
+ * row in place (0 bits only, the rest of the IAP buffer left erased), without erasing it: the LPC17xx flash
+ * has no ECC, so a row can be programmed again as long as bits only go from 1 to 0. Hence the CRC only
+ * covers the header.
+ */
+typedef struct config_tally {
+    uint32_t magic;                         /*!< #CONFIG_TALLY_MAGIC */
+    uint32_t crc;                           /*!< CRC-32 of the generation, base and counter */
+    uint32_t generation;                    /*!< As in #config_row */
+    uint32_t base;                          /*!< Value of the counter when the row was written */
+    uint8_t counter;
+    uint8_t reserved[3];
+    uint8_t marks[IMAGE_ROW - CONFIG_TALLY_HEADER]; /*!< One 0 bit per increment, from bit 0 of the first byte */
+} config_tally;
+
+/*! @brief Latest record of each key in the flash, NULL if there's none (or it's a removal) */
+static const uint8_t * config_index[CONFIG_KEYS];
+/*! @brief Changes not written yet, the header is filled when the row is written */
+static config_row config_pending __RAM_AHB_NOINIT;
+static uint8_t config_pending_len;
+/*! @brief Offset + 1 of the latest record of each key in #config_pending, 0 if there's none */
+static uint8_t config_pending_off[CONFIG_KEYS];
+/*! @brief Changes queued, tells the task if some came while it was writing the pending ones */
+static uint32_t config_changes;
+/*! @brief Row being written, IAP source (word aligned, in RAM) */
+static config_row config_row_buf __RAM_AHB_NOINIT;
+
+/*! @brief Latest tally row of each counter in the flash, NULL if there's none */
+static const config_tally * config_tally_row[CONFIG_COUNTERS];
+/*! @brief Value of each counter in the flash, base of its tally row plus the marks */
+static uint32_t config_counter_stored[CONFIG_COUNTERS];
+/*! @brief Increments not written yet */
+static uint32_t config_counter_pending[CONFIG_COUNTERS];
+
+static uint8_t config_sector;               /* Active sector */
+static uint8_t config_next_row;             /* First erased row of the active sector */
+static uint32_t config_generation;
+/*! @brief Sector left valid by a move a reset interrupted, #CONFIG_NONE if there's none */
+static uint8_t config_old_sector = CONFIG_NONE;
+static TaskHandle_t config_task;
+
+TASK_STACK( config_stack, CONFIG_STACK_DEPTH, 1 );
+
+static const config_row * prvConfigRow( uint8_t sector, uint8_t row )
+{
+    return (const config_row *) ( CONFIG_SECTOR_BASE( sector ) + row * IMAGE_ROW );
+}
+
+static uint8_t prvConfigRowErased( const config_row * row )
+{
+    const uint32_t * word = (const uint32_t *) row;
+    uint8_t i;
+
+    for ( i = 0; i < IMAGE_ROW / 4; i++ ) {
+        if ( word[i] != 0xFFFFFFFF ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static uint8_t prvConfigRowValid( const config_row * row )
+{
+    return ( row->magic == CONFIG_MAGIC ) &&
+           ( row->crc == image_crc32( &row->generation, IMAGE_ROW - 8 ) );
+}
+
+static uint8_t prvConfigTallyValid( const config_row * row )
+{
+    const config_tally * tally = (const config_tally *) row;
+
+    return ( tally->magic == CONFIG_TALLY_MAGIC ) && ( tally->counter < CONFIG_COUNTERS ) &&
+           ( tally->crc == image_crc32( &tally->generation, CONFIG_TALLY_HEADER - 8 ) );
+}
+
+/* Increments marked in a tally row */
+static uint32_t prvConfigTallyMarks( const config_tally * tally )
+{
+    uint32_t marks = 0;
+    uint16_t i;
+
+    for ( i = 0; i < sizeof(tally->marks); i++ ) {
+        marks += 8 - __builtin_popcount( tally->marks[i] );
+    }
+    return marks;
+}
+
+/* Points a counter to a tally row, later ones winning */
+static void prvConfigReplayTally( const config_tally * tally )
+{
+    config_tally_row[tally->counter] = tally;
+    config_counter_stored[tally->counter] = tally->base + prvConfigTallyMarks( tally );
+}
+
+/* Points the index to the records of a flash row, later ones winning */
+static void prvConfigReplayRow( const config_row * row )
+{
+    const uint8_t * rec;
+    uint8_t off = 0;
+
+    while ( ( off + 2 <= CONFIG_PAYLOAD ) && ( row->data[off] != CONFIG_END ) ) {
+        rec = &row->data[off];
+        if ( off + CONFIG_RECORD_LEN( rec ) > CONFIG_PAYLOAD ) {
+            break;
+        }
+        if ( rec[0] < CONFIG_KEYS ) {
+            config_index[rec[0]] = ( rec[1] != 0 ) ? rec : NULL;
+        }
+        off += CONFIG_RECORD_LEN( rec );
+    }
+}
+
+/* Generation of a sector, from its first valid row
+ * @return 1 if the sector has one, 0 otherwise */
+static uint8_t prvConfigSectorGeneration( uint8_t sector, uint32_t * generation )
+{
+    const config_row * row;
+    uint8_t i;
+
+    for ( i = 0; i < CONFIG_ROWS; i++ ) {
+        row = prvConfigRow( sector, i );
+        if ( prvConfigRowErased( row ) ) {
+            break;
+        }
+        /* Same place in both kinds of rows */
+        if ( prvConfigRowValid( row ) || prvConfigTallyValid( row ) ) {
+            *generation = row->generation;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Replays the valid rows of a sector, up to its first erased row
+ * @return the first erased row, #CONFIG_ROWS if the sector is full */
+static uint8_t prvConfigReplaySector( uint8_t sector )
+{
+    const config_row * row;
+    uint8_t i;
+
+    for ( i = 0; i < CONFIG_ROWS; i++ ) {
+        row = prvConfigRow( sector, i );
+        if ( prvConfigRowErased( row ) ) {
+            break;
+        }
+        /* A torn row still takes its place */
+        if ( prvConfigRowValid( row ) ) {
+            prvConfigReplayRow( row );
+        } else if ( prvConfigTallyValid( row ) ) {
+            prvConfigReplayTally( (const config_tally *) row );
+        }
+    }
+    return i;
+}
+
+/* Writes #config_row_buf to the next row of the active sector and points the index to it
+ * @return 1 on success, 0 if the IAP failed (the row is lost) */
+static uint8_t prvConfigWriteRow( void )
+{
+    const config_row * row = prvConfigRow( config_sector, config_next_row );
+    uint8_t ret;
+
+    configASSERT( config_next_row < CONFIG_ROWS );
+
+    config_row_buf.magic = CONFIG_MAGIC;
+    config_row_buf.generation = config_generation;
+    config_row_buf.crc = image_crc32( &config_row_buf.generation, IMAGE_ROW - 8 );
+    ret = image_flash_write( (uint32_t) row, (const uint32_t *) &config_row_buf, IMAGE_ROW );
+    config_next_row++;
+
+    if ( ret && prvConfigRowValid( row ) ) {
+        taskENTER_CRITICAL();
+        prvConfigReplayRow( row );
+        taskEXIT_CRITICAL();
+        return 1;
+    }
+    return 0;
+}
+
+/* Writes a new tally row of a counter to the next row of the active sector, with no marks
+ * @return 1 on success, 0 if the IAP failed (the counter keeps its last row) */
+static uint8_t prvConfigWriteTally( uint8_t counter, uint32_t base )
+{
+    /* Same size as a config row, it's written from the same buffer */
+    config_tally * tally = (config_tally *) &config_row_buf;
+    const config_row * row = prvConfigRow( config_sector, config_next_row );
+    uint8_t ret;
+
+    configASSERT( config_next_row < CONFIG_ROWS );
+
+    memset( tally, 0xFF, IMAGE_ROW );
+    tally->magic = CONFIG_TALLY_MAGIC;
+    tally->generation = config_generation;
+    tally->base = base;
+    tally->counter = counter;
+    tally->crc = image_crc32( &tally->generation, CONFIG_TALLY_HEADER - 8 );
+    ret = image_flash_write( (uint32_t) row, (const uint32_t *) tally, IMAGE_ROW );
+    config_next_row++;
+
+    if ( ret && prvConfigTallyValid( row ) ) {
+        taskENTER_CRITICAL();
+        prvConfigReplayTally( (const config_tally *) row );
+        taskEXIT_CRITICAL();
+        return 1;
+    }
+    return 0;
+}
+
+/* Programs the marks of more increments in the tally row of a counter, which must have room for them */
+static void prvConfigMarkTally( uint8_t counter, uint32_t count )
+{
+    const config_tally * tally = config_tally_row[counter];
+    uint8_t * buf = (uint8_t *) &config_row_buf;
+    uint32_t marks = config_counter_stored[counter] - tally->base;
+    uint32_t i;
+
+    memset( buf, 0xFF, IMAGE_ROW );
+    for ( i = marks; i < marks + count; i++ ) {
+        buf[CONFIG_TALLY_HEADER + i / 8] &= ~( 1 << ( i % 8 ) );
+    }
+    image_flash_write( (uint32_t) tally, (const uint32_t *) buf, IMAGE_ROW );
+
+    /* Whatever made it to the flash, even from a failed write */
+    taskENTER_CRITICAL();
+    prvConfigReplayTally( tally );
+    taskEXIT_CRITICAL();
+}
+
+static uint8_t prvConfigTallyFits( uint8_t counter, uint32_t count )
+{
+    const config_tally * tally = config_tally_row[counter];
+
+    return ( tally != NULL ) && ( config_counter_stored[counter] - tally->base + count <= CONFIG_TALLY_BITS );
+}
+
+/* Copies the latest records and counters still in a sector to the active one, then erases it */
+static void prvConfigMove( uint8_t from )
+{
+    uint32_t start = CONFIG_SECTOR_BASE( from );
+    const uint8_t * rec;
+    uint8_t len = 0;
+    uint8_t key;
+
+    memset( config_row_buf.data, CONFIG_END, CONFIG_PAYLOAD );
+    for ( key = 0; key < CONFIG_KEYS; key++ ) {
+        /* Only the task changes the index, no need to lock to read it */
+        rec = config_index[key];
+        if ( ( rec == NULL ) || ( (uint32_t) rec < start ) || ( (uint32_t) rec >= start + IMAGE_CONFIG_SIZE / CONFIG_SECTORS ) ) {
+            continue;
+        }
+        if ( len + CONFIG_RECORD_LEN( rec ) > CONFIG_PAYLOAD ) {
+            prvConfigWriteRow();
+            memset( config_row_buf.data, CONFIG_END, CONFIG_PAYLOAD );
+            len = 0;
+        }
+        memcpy( &config_row_buf.data[len], rec, CONFIG_RECORD_LEN( rec ) );
+        len += CONFIG_RECORD_LEN( rec );
+    }
+    if ( len ) {
+        prvConfigWriteRow();
+    }
+
+    for ( key = 0; key < CONFIG_COUNTERS; key++ ) {
+        if ( ( (uint32_t) config_tally_row[key] >= start ) && ( (uint32_t) config_tally_row[key] < start + IMAGE_CONFIG_SIZE / CONFIG_SECTORS ) ) {
+            prvConfigWriteTally( key, config_counter_stored[key] );
+        }
+    }
+
+    image_flash_erase( IMAGE_SECTOR( start ), IMAGE_SECTOR( start ) );
+}
+
+/* Moves to the other sector if the active one is full
+ * @return 1 if it moved, 0 if there was room left */
+static uint8_t prvConfigMakeRoom( void )
+{
+    uint8_t old;
+
+    if ( config_next_row < CONFIG_ROWS ) {
+        return 0;
+    }
+
+    old = config_sector;
+    config_sector ^= 1;
+    config_generation++;
+    image_flash_erase( IMAGE_SECTOR( CONFIG_SECTOR_BASE( config_sector ) ), IMAGE_SECTOR( CONFIG_SECTOR_BASE( config_sector ) ) );
+    config_next_row = 0;
+    prvConfigMove( old );
+    return 1;
+}
+
+/* Copies the pending changes into the row buffer, out of the critical section so the copy can go through the
+ * GPDMA; again if a change came in the middle of it. Returns their length, changes is the count they're at */
+static uint8_t prvConfigSnapshot( uint32_t * changes )
+{
+    uint8_t len;
+    uint8_t torn;
+
+    do {
+        taskENTER_CRITICAL();
+        *changes = config_changes;
+        len = config_pending_len;
+        taskEXIT_CRITICAL();
+
+        dma_memcpy( config_row_buf.data, config_pending.data, CONFIG_PAYLOAD );
+
+        taskENTER_CRITICAL();
+        torn = ( *changes != config_changes );
+        taskEXIT_CRITICAL();
+    } while ( torn );
+
+    return len;
+}
+
+/* Writes the pending changes, moving to the other sector first if the active one is full */
+static void prvConfigFlush( void )
+{
+    uint32_t changes;
+    uint8_t len;
+
+    if ( config_old_sector != CONFIG_NONE ) {
+        prvConfigMove( config_old_sector );
+        config_old_sector = CONFIG_NONE;
+    }
+
+    len = prvConfigSnapshot( &changes );
+    if ( len == 0 ) {
+        return;
+    }
+
+    if ( prvConfigMakeRoom() ) {
+        /* The move used the row buffer, changes since the first copy are written with the rest */
+        prvConfigSnapshot( &changes );
+    }
+
+    if ( prvConfigWriteRow() ) {
+        taskENTER_CRITICAL();
+        /* Anything changed meanwhile keeps the pending row for the next write */
+        if ( changes == config_changes ) {
+            memset( config_pending.data, CONFIG_END, CONFIG_PAYLOAD );
+            config_pending_len = 0;
+            memset( config_pending_off, 0, sizeof(config_pending_off) );
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+/* Writes the pending increments of the counters */
+static void prvConfigCounterFlush( void )
+{
+    uint32_t pending;
+    uint32_t before;
+    uint32_t written;
+    uint8_t counter;
+
+    for ( counter = 0; counter < CONFIG_COUNTERS; counter++ ) {
+        taskENTER_CRITICAL();
+        pending = config_counter_pending[counter];
+        taskEXIT_CRITICAL();
+        if ( pending == 0 ) {
+            continue;
+        }
+
+        /* Only the task changes the stored values, no need to lock to read them */
+        before = config_counter_stored[counter];
+        if ( !prvConfigTallyFits( counter, pending ) ) {
+            /* A move gives the counter a fresh row */
+            prvConfigMakeRoom();
+        }
+        if ( prvConfigTallyFits( counter, pending ) ) {
+            prvConfigMarkTally( counter, pending );
+        } else {
+            prvConfigWriteTally( counter, before + pending );
+        }
+
+        taskENTER_CRITICAL();
+        written = config_counter_stored[counter] - before;
+        config_counter_pending[counter] -= ( written < pending ) ? written : pending;
+        taskEXIT_CRITICAL();
+    }
+}
+
+static void prvConfigTask( void * pvParameters )
+{
+    (void) pvParameters;
+
+    for ( ;; ) {
+        /* The first time round only finishes a move left by a reset */
+        prvConfigFlush();
+        prvConfigCounterFlush();
+        ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+        /* Changes come in bursts (one per sensor, per LED), they're written once they stop */
+        while ( ulTaskNotifyTake( pdTRUE, CONFIG_FLUSH_DELAY ) != 0 ) {
+        }
+    }
+}
+
+void config_init( void )
+{
+    uint32_t generation[CONFIG_SECTORS];
+    uint8_t valid[CONFIG_SECTORS];
+    uint8_t older;
+
+    memset( config_pending.data, CONFIG_END, CONFIG_PAYLOAD );
+
+    valid[0] = prvConfigSectorGeneration( 0, &generation[0] );
+    valid[1] = prvConfigSectorGeneration( 1, &generation[1] );
+    if ( valid[0] && valid[1] ) {
+        /* Interrupted move: the newer one has some of the records of the older one, those win */
+        config_sector = ( (int32_t) ( generation[1] - generation[0] ) > 0 ) ? 1 : 0;
+        older = config_sector ^ 1;
+        prvConfigReplaySector( older );
+        config_old_sector = older;
+    } else {
+        config_sector = valid[1] ? 1 : 0;
+    }
+    config_generation = valid[config_sector] ? generation[config_sector] : 0;
+    config_next_row = prvConfigReplaySector( config_sector );
+
+    xTaskCreateWithStack( prvConfigTask, (const char*)"Config", CONFIG_STACK_DEPTH, ( void * ) NULL, CONFIG_TASK_PRIORITY, &config_task, TASK_STACK_BUFFER( config_stack, 0 ) );
+}
+
+/* Latest record of a key, pending or in the flash, called in a critical section */
+static const uint8_t * prvConfigRecord( uint8_t key )
+{
+    if ( config_pending_off[key] ) {
+        return &config_pending.data[config_pending_off[key] - 1];
+    }
+    return config_index[key];
+}
+
+uint8_t config_get( uint8_t key, void * value, uint8_t len )
+{
+    const uint8_t * rec;
+    uint8_t ret = 0;
+
+    if ( ( key >= CONFIG_KEYS ) || ( len == 0 ) ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    rec = prvConfigRecord( key );
+    if ( ( rec != NULL ) && ( rec[1] == len ) ) {
+        memcpy( value, &rec[2], len );
+        ret = 1;
+    }
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+uint8_t config_set( uint8_t key, const void * value, uint8_t len )
+{
+    const uint8_t * rec;
+    uint8_t * dst;
+    uint8_t ret = 1;
+
+    if ( ( key >= CONFIG_KEYS ) || ( len > CONFIG_VALUE_MAX ) ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    rec = prvConfigRecord( key );
+    if ( ( rec == NULL ) ? ( len == 0 ) : ( ( rec[1] == len ) && ( ( len == 0 ) || ( memcmp( &rec[2], value, len ) == 0 ) ) ) ) {
+        /* Unchanged, the flash isn't worn for it */
+        taskEXIT_CRITICAL();
+        return 1;
+    }
+
+    if ( config_pending_off[key] && ( rec[1] == len ) ) {
+        dst = &config_pending.data[config_pending_off[key] - 1];
+    } else if ( config_pending_len + 2 + len <= CONFIG_PAYLOAD ) {
+        config_pending_off[key] = config_pending_len + 1;
+        dst = &config_pending.data[config_pending_len];
+        config_pending_len += 2 + len;
+    } else {
+        dst = NULL;
+        ret = 0;
+    }
+    if ( dst != NULL ) {
+        dst[0] = key;
+        dst[1] = len;
+        memcpy( &dst[2], value, len );
+        config_changes++;
+    }
+    taskEXIT_CRITICAL();
+
+    if ( config_task != NULL ) {
+        xTaskNotifyGive( config_task );
+    }
+    return ret;
+}
+
+void config_counter_add( uint8_t counter, uint32_t count )
+{
+    if ( counter >= CONFIG_COUNTERS ) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    config_counter_pending[counter] += count;
+    taskEXIT_CRITICAL();
+}
+
+uint32_t config_counter_get( uint8_t counter )
+{
+    uint32_t value;
+
+    if ( counter >= CONFIG_COUNTERS ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    value = config_counter_stored[counter] + config_counter_pending[counter];
+    taskEXIT_CRITICAL();
+
+    return value;
+}
+
+void config_counter_sync( void )
+{
+    if ( config_task != NULL ) {
+        xTaskNotifyGive( config_task );
+    }
+}
@@ -0,0 +1,212 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file cpu_load.c
+ *
+ * @brief Per task CPU load, from the FreeRTOS run time stats
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "cpu_load.h"
+#include "periodic.h"
+#include "metrics.h"
+
+typedef struct cpu_load_entry {
+    TaskHandle_t task;                      /*!< NULL for a free entry */
+    UBaseType_t number;
+    uint32_t last_counter;                  /*!< Task run time counter at the last sample */
+    uint8_t samples[CPU_LOAD_WINDOW];       /*!< Load of the last periods, ring indexed by cpu_load_pos */
+    uint8_t valid;                          /*!< Samples taken, up to #CPU_LOAD_WINDOW */
+    uint8_t priority;
+    uint8_t hot;                            /*!< Periods in a row above #CPU_LOAD_RUNAWAY */
+    uint8_t seen;
+} cpu_load_entry;
+
+static cpu_load_entry cpu_load[CPU_LOAD_MAX_TASKS];
+/* Filled by uxTaskGetSystemState, too big for the timer task stack */
+static TaskStatus_t cpu_load_status[CPU_LOAD_MAX_TASKS];
+static uint32_t cpu_load_last_total;
+static uint8_t cpu_load_pos;
+static uint32_t cpu_load_runaway_count;
+METRIC_COUNTER( "cpu.runaways", cpu_load_runaway_count );
+
+static cpu_load_entry * prvCpuLoadEntry( const TaskStatus_t * status )
+{
+    cpu_load_entry * free_entry = NULL;
+    uint8_t i;
+
+    for ( i = 0; i < CPU_LOAD_MAX_TASKS; i++ ) {
+        if ( cpu_load[i].task == NULL ) {
+            if ( free_entry == NULL ) {
+                free_entry = &cpu_load[i];
+            }
+        } else if ( cpu_load[i].number == status->xTaskNumber ) {
+            return &cpu_load[i];
+        }
+    }
+
+    /* New task, it gets its first load in the next period */
+    if ( free_entry ) {
+        memset( free_entry, 0, sizeof(cpu_load_entry) );
+        free_entry->task = status->xHandle;
+        free_entry->number = status->xTaskNumber;
+        free_entry->last_counter = status->ulRunTimeCounter;
+        free_entry->seen = 1;
+    }
+    return NULL;
+}
+
+static void prvCpuLoadSample( void * arg )
+{
+    const TaskStatus_t * status;
+    cpu_load_entry * entry;
+    uint32_t total;
+    uint32_t elapsed;
+    uint32_t load;
+    UBaseType_t count;
+    uint8_t i;
+
+    (void) arg;
+
+    count = uxTaskGetSystemState( cpu_load_status, CPU_LOAD_MAX_TASKS, &total );
+    if ( count == 0 ) {
+        /* More tasks than the table holds */
+        return;
+    }
+
+    /* Unsigned differences, so the counters may wrap */
+    elapsed = total - cpu_load_last_total;
+    cpu_load_last_total = total;
+    if ( elapsed == 0 ) {
+        return;
+    }
+
+    for ( i = 0; i < CPU_LOAD_MAX_TASKS; i++ ) {
+        cpu_load[i].seen = 0;
+    }
+
+    /* Only the readers lock, they run below the timer task and can't preempt it */
+    for ( i = 0; i < count; i++ ) {
+        status = &cpu_load_status[i];
+        entry = prvCpuLoadEntry( status );
+        if ( entry == NULL ) {
+            continue;
+        }
+
+        /* Doesn't overflow as long as a period is under 2^32 / CPU_LOAD_FULL run time counts (35 minutes) */
+        load = ( ( status->ulRunTimeCounter - entry->last_counter ) * CPU_LOAD_FULL ) / elapsed;
+        entry->last_counter = status->ulRunTimeCounter;
+        entry->samples[cpu_load_pos] = ( load > CPU_LOAD_FULL ) ? CPU_LOAD_FULL : load;
+        if ( entry->valid < CPU_LOAD_WINDOW ) {
+            entry->valid++;
+        }
+        entry->priority = status->uxCurrentPriority;
+        entry->seen = 1;
+
+        if ( ( load >= CPU_LOAD_RUNAWAY ) && ( status->xHandle != xTaskGetIdleTaskHandle() ) ) {
+            if ( entry->hot < CPU_LOAD_RUNAWAY_PERIODS ) {
+                if ( ++entry->hot == CPU_LOAD_RUNAWAY_PERIODS ) {
+                    cpu_load_runaway_count++;
+                }
+            }
+        } else {
+            entry->hot = 0;
+        }
+    }
+
+    /* Deleted tasks */
+    for ( i = 0; i < CPU_LOAD_MAX_TASKS; i++ ) {
+        if ( !cpu_load[i].seen ) {
+            cpu_load[i].task = NULL;
+        }
+    }
+
+    cpu_load_pos = ( cpu_load_pos + 1 ) % CPU_LOAD_WINDOW;
+}
+
+static periodic_job cpu_load_job = PERIODIC_JOB( "CPULoad", prvCpuLoadSample, NULL, CPU_LOAD_PERIOD, CPU_LOAD_PERIOD );
+
+void cpu_load_init( void )
+{
+    periodic_start( &cpu_load_job );
+}
+
+uint8_t cpu_load_count( void )
+{
+    uint8_t count = 0;
+    uint8_t i;
+
+    for ( i = 0; i < CPU_LOAD_MAX_TASKS; i++ ) {
+        if ( cpu_load[i].task && cpu_load[i].valid ) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint8_t cpu_load_get( uint8_t index, cpu_load_task * load )
+{
+    const cpu_load_entry * entry;
+    uint16_t sum = 0;
+    uint8_t last;
+    uint8_t i;
+    uint8_t n;
+    uint8_t ret = 0;
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < CPU_LOAD_MAX_TASKS; i++ ) {
+        entry = &cpu_load[i];
+        /* Tasks without a full period yet aren't reported */
+        if ( ( entry->task == NULL ) || ( entry->valid == 0 ) || ( index-- != 0 ) ) {
+            continue;
+        }
+
+        /* The last sample is the one before the ring position, the window the newest valid ones */
+        last = ( cpu_load_pos + CPU_LOAD_WINDOW - 1 ) % CPU_LOAD_WINDOW;
+        for ( n = 0; n < entry->valid; n++ ) {
+            sum += entry->samples[( last + CPU_LOAD_WINDOW - n ) % CPU_LOAD_WINDOW];
+        }
+
+        load->number = entry->number;
+        load->name = pcTaskGetTaskName( entry->task );
+        load->priority = entry->priority;
+        load->last = entry->samples[last];
+        load->window = sum / entry->valid;
+        load->runaway = ( entry->hot >= CPU_LOAD_RUNAWAY_PERIODS );
+        ret = 1;
+        break;
+    }
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+uint32_t cpu_load_runaways( void )
+{
+    return cpu_load_runaway_count;
+}
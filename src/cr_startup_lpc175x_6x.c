@@ -58,6 +58,10 @@ extern "C" {
 extern void SystemInit(void);
 #endif
 
+// Boot timeline, stamped from the first instruction on
+#include "chip.h"
+#include "boot_time.h"
+
 //*****************************************************************************
 //
 // Forward declaration of the default handlers. These are aliased.
@@ -221,21 +225,39 @@ void (* const g_pfnVectors[])(void) = {
 // are written as separate functions rather than being inlined within the
 // ResetISR() function in order to cope with MCUs with multiple banks of
 // memory.
+// The sections are word aligned and padded (ALIGN(4) in the linker script), so
+// both go by words, four per iteration (one LDM/STM pair) while there's room.
+// Buffers that don't need zeroing go to .noinit instead (see ram_sections.h).
 //*****************************************************************************
 __attribute__ ((section(".after_vectors")))
 void data_init(unsigned int romstart, unsigned int start, unsigned int len) {
     unsigned int *pulDest = (unsigned int*) start;
     unsigned int *pulSrc = (unsigned int*) romstart;
-    unsigned int loop;
-    for (loop = 0; loop < len; loop = loop + 4)
+    unsigned int *pulEnd = (unsigned int*) (start + len);
+    while (pulEnd - pulDest >= 4) {
+        pulDest[0] = pulSrc[0];
+        pulDest[1] = pulSrc[1];
+        pulDest[2] = pulSrc[2];
+        pulDest[3] = pulSrc[3];
+        pulDest += 4;
+        pulSrc += 4;
+    }
+    while (pulDest < pulEnd)
         *pulDest++ = *pulSrc++;
 }
 
 __attribute__ ((section(".after_vectors")))
 void bss_init(unsigned int start, unsigned int len) {
     unsigned int *pulDest = (unsigned int*) start;
-    unsigned int loop;
-    for (loop = 0; loop < len; loop = loop + 4)
+    unsigned int *pulEnd = (unsigned int*) (start + len);
+    while (pulEnd - pulDest >= 4) {
+        pulDest[0] = 0;
+        pulDest[1] = 0;
+        pulDest[2] = 0;
+        pulDest[3] = 0;
+        pulDest += 4;
+    }
+    while (pulDest < pulEnd)
         *pulDest++ = 0;
 }
 
@@ -266,6 +288,9 @@ ResetISR(void) {
     unsigned int LoadAddr, ExeAddr, SectionLen;
     unsigned int *SectionTableAddr;
 
+    // Start the boot timeline, before anything is copied or zeroed
+    boot_time_start();
+
     // Load base address of Global Section Table
     SectionTableAddr = &__data_section_table;
 
@@ -276,6 +301,7 @@ ResetISR(void) {
         SectionLen = *SectionTableAddr++;
         data_init(LoadAddr, ExeAddr, SectionLen);
     }
+    boot_time_mark(BOOT_TIME_DATA);
     // At this point, SectionTableAddr = &__bss_section_table;
     // Zero fill the bss segment
     while (SectionTableAddr < &__bss_section_table_end) {
@@ -283,10 +309,14 @@ ResetISR(void) {
         SectionLen = *SectionTableAddr++;
         bss_init(ExeAddr, SectionLen);
     }
+    boot_time_mark(BOOT_TIME_BSS);
 
 #if defined (__USE_CMSIS) || defined (__USE_LPCOPEN)
     SystemInit();
+    // The timer keeps counting microseconds on the PLL clock
+    boot_time_clock();
 #endif
+    boot_time_mark(BOOT_TIME_SYSTEM_INIT);
 
 #if defined (__cplusplus)
     //
@@ -0,0 +1,227 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file crash.c
+ *
+ * @brief Crash record, fault handlers and the watchdog reset after them
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "stddef.h"
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "image.h"
+#include "boot_time.h"
+#include "log.h"
+#include "ram_sections.h"
+#include "crash.h"
+#include "wallclock.h"
+
+#define CRASH_MAGIC                 0x48535243  /* "CRSH" */
+/*! @brief Watchdog timeout while the log is flushed, in case the handler itself faults (2 KB at 115200 baud take 180 ms) */
+#define CRASH_FLUSH_TIMEOUT         500000
+
+/*! @brief Record of the last crash, neither copied nor zeroed by the startup code */
+static crash_record crash __RAM_AHB_NOINIT;
+
+/* Called from the fault handlers' assembly, so it keeps its name */
+void crash_fault( uint32_t * frame, uint32_t reason ) __attribute__ ((used, noreturn));
+
+static uint32_t prvCrashCRC( void )
+{
+    return image_crc32( &crash.count, sizeof(crash) - offsetof(crash_record, count) );
+}
+
+static uint8_t prvCrashValid( void )
+{
+    return ( crash.magic == CRASH_MAGIC ) && ( crash.crc == prvCrashCRC() );
+}
+
+/* Runs the watchdog with a reset after timeout ticks, a watchdog already running gets the new timeout */
+static void prvCrashWatchdog( uint32_t timeout )
+{
+    Chip_WWDT_SetTimeOut( LPC_WWDT, timeout );
+    Chip_WWDT_SetOption( LPC_WWDT, WWDT_WDMOD_WDRESET );
+    /* Enables and feeds it, the interrupts are off so the feed sequence can't be split */
+    Chip_WWDT_Start( LPC_WWDT );
+}
+
+/* Starts a new record with what every crash has, counting the previous ones */
+static void prvCrashBegin( uint8_t reason )
+{
+    uint32_t count;
+    uint8_t i;
+
+    __disable_irq();
+    count = prvCrashValid() ? crash.count : 0;
+    /* From here on, even a fault in this code ends in a reset */
+    prvCrashWatchdog( CRASH_FLUSH_TIMEOUT );
+
+    memset( &crash, 0, sizeof(crash) );
+    crash.count = count + 1;
+    crash.uptime = BOOT_TIME_TIMER->TC;
+    crash.wallclock = wallclock_seconds();
+    crash.reason = reason;
+    if ( xTaskGetCurrentTaskHandle() != NULL ) {
+        strncpy( crash.task, pcTaskGetTaskName( NULL ), configMAX_TASK_NAME_LEN );
+    }
+    for ( i = 0; i < IPMB_STAT_COUNT; i++ ) {
+        crash.ipmb_stats[i] = ipmb_stats[i];
+    }
+    crash.log_len = log_last( crash.log, CRASH_LOG_LEN );
+}
+
+/* Seals the record, sends the log and resets */
+static void prvCrashEnd( void )
+{
+    crash.crc = prvCrashCRC();
+    crash.magic = CRASH_MAGIC;
+
+    LOG( "crash,%u,%x,%x,%u", crash.reason, crash.pc, crash.lr, crash.count );
+    log_panic_flush();
+
+    prvCrashWatchdog( CRASH_RESET_TIMEOUT );
+    for ( ; ; ) {
+    }
+}
+
+void crash_assert( const char * file, uint32_t line, uint32_t pc )
+{
+    size_t len = strlen( file );
+
+    prvCrashBegin( CRASH_ASSERT );
+    crash.pc = pc;
+    crash.line = line;
+    /* The end of the path is the part that tells the files apart */
+    if ( len > CRASH_FILE_LEN ) {
+        file += len - CRASH_FILE_LEN;
+    }
+    strncpy( crash.file, file, CRASH_FILE_LEN );
+
+    LOG( "fault,assert,%s,%u", file, line );
+    prvCrashEnd();
+}
+
+void crash_stack_overflow( const char * task )
+{
+    prvCrashBegin( CRASH_STACK_OVERFLOW );
+    /* The current task may not be the one that overflowed */
+    strncpy( crash.task, task, configMAX_TASK_NAME_LEN );
+
+    /* The name is in RAM (not readable by the decoder), its first 4 characters go as a little endian word */
+    LOG( "fault,stack_overflow,%x", crash.task[0] | ( crash.task[1] << 8 ) | ( crash.task[2] << 16 ) | ( crash.task[3] << 24 ) );
+    prvCrashEnd();
+}
+
+void crash_watchdog( const char * task )
+{
+    prvCrashBegin( CRASH_WATCHDOG );
+    strncpy( crash.task, task, configMAX_TASK_NAME_LEN );
+
+    LOG( "fault,watchdog,%s", task );
+    prvCrashEnd();
+}
+
+/* Exception frame: r0, r1, r2, r3, r12, lr, pc, xpsr */
+void crash_fault( uint32_t * frame, uint32_t reason )
+{
+#if configAPP_STACK_GUARD
+    /* Before anything reads the frame, which may be on the guard */
+    if ( stack_guard_fault() && ( reason == CRASH_MEM_FAULT ) ) {
+        reason = CRASH_STACK_OVERFLOW;
+    }
+#endif
+    prvCrashBegin( reason );
+    crash.sp = (uint32_t) frame;
+    crash.lr = frame[5];
+    crash.pc = frame[6];
+    crash.psr = frame[7];
+    crash.cfsr = SCB->CFSR;
+    crash.hfsr = SCB->HFSR;
+    crash.mmfar = SCB->MMFAR;
+    crash.bfar = SCB->BFAR;
+    prvCrashEnd();
+}
+
+/* Hands the frame stacked on the main or process stack (EXC_RETURN bit 2) to crash_fault */
+#define CRASH_FAULT_HANDLER( handler, reason )                  \
+    __attribute__ ((naked)) void handler( void )                \
+    {                                                           \
+        __asm volatile (                                        \
+            "tst lr, #4         \n"                             \
+            "ite eq             \n"                             \
+            "mrseq r0, msp      \n"                             \
+            "mrsne r0, psp      \n"                             \
+            "mov r1, %0         \n"                             \
+            "b crash_fault      \n"                             \
+            : : "i" ( reason ) );                               \
+    }
+
+/* Replace the weak spin loops of the startup code */
+CRASH_FAULT_HANDLER( HardFault_Handler, CRASH_HARD_FAULT )
+CRASH_FAULT_HANDLER( MemManage_Handler, CRASH_MEM_FAULT )
+CRASH_FAULT_HANDLER( BusFault_Handler, CRASH_BUS_FAULT )
+CRASH_FAULT_HANDLER( UsageFault_Handler, CRASH_USAGE_FAULT )
+CRASH_FAULT_HANDLER( NMI_Handler, CRASH_NMI )
+
+void crash_init( void )
+{
+    uint32_t cause = Chip_SYSCTL_GetSystemRSTStatus();
+
+    Chip_SYSCTL_ClearSystemRSTStatus( cause );
+    LOG( "reset,%x", cause );
+
+    /* The RAM content is random after a power cycle */
+    if ( ( cause & SYSCTL_RST_POR ) || !prvCrashValid() ) {
+        crash.magic = 0;
+        return;
+    }
+    LOG( "crash,previous,%u,%x,%x,%u", crash.reason, crash.pc, crash.lr, crash.count );
+}
+
+uint16_t crash_get( uint16_t offset, uint8_t * data, uint8_t len )
+{
+    if ( crash.magic != CRASH_MAGIC ) {
+        return 0;
+    }
+    if ( offset > sizeof(crash) ) {
+        offset = sizeof(crash);
+    }
+    if ( len > sizeof(crash) - offset ) {
+        len = sizeof(crash) - offset;
+    }
+    memcpy( data, (const uint8_t *) &crash + offset, len );
+    return sizeof(crash);
+}
+
+void crash_clear( void )
+{
+    crash.magic = 0;
+}
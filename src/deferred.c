@@ -0,0 +1,150 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file deferred.c
+ *
+ * @brief Deferred work daemon: interrupt bottom halves run by one task
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* Project includes */
+#include "deferred.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "metrics.h"
+
+#define DEFERRED_RING_MASK          ( DEFERRED_RING_LEN - 1 )
+
+/*! @brief Work item, #fn is NULL until it's published */
+typedef struct deferred_work {
+    PendedFunction_t fn;
+    void * arg;
+    uint32_t param;
+} deferred_work;
+
+static deferred_work deferred_ring[DEFERRED_RING_LEN];
+/* Slots claimed and slots run, free running; only the daemon moves the tail */
+static uint32_t deferred_head;
+static volatile uint32_t deferred_tail;
+
+static TaskHandle_t deferred_task;
+static deferred_stats deferred_counters;
+METRIC_COUNTER( "deferred.runs", deferred_counters.runs );
+METRIC_COUNTER( "deferred.full", deferred_counters.full );
+METRIC_GAUGE( "deferred.hwm", deferred_counters.high_water );
+TASK_STACK( deferred_stack, DEFERRED_STACK_DEPTH, 1 );
+
+/* Claims a slot and fills it, 0 if the ring is full */
+static uint8_t prvDeferredPut( PendedFunction_t fn, void * arg, uint32_t param )
+{
+    deferred_work * work;
+    uint32_t head = __atomic_load_n( &deferred_head, __ATOMIC_RELAXED );
+    uint32_t depth;
+
+    do {
+        depth = head - deferred_tail;
+        if ( depth >= DEFERRED_RING_LEN ) {
+            __atomic_fetch_add( &deferred_counters.full, 1, __ATOMIC_RELAXED );
+            return 0;
+        }
+    } while ( !__atomic_compare_exchange_n( &deferred_head, &head, head + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+    /* Only a statistic, a lost update between two producers just misses one */
+    if ( depth + 1 > deferred_counters.high_water ) {
+        deferred_counters.high_water = depth + 1;
+    }
+
+    work = &deferred_ring[head & DEFERRED_RING_MASK];
+    work->arg = arg;
+    work->param = param;
+    /* The daemon takes the slot once the function is there, with the arguments before it */
+    __atomic_store_n( &work->fn, fn, __ATOMIC_RELEASE );
+    return 1;
+}
+
+uint8_t deferred_call_from_isr( PendedFunction_t fn, void * arg, uint32_t param, portBASE_TYPE * woken )
+{
+    if ( !prvDeferredPut( fn, arg, param ) ) {
+        return 0;
+    }
+    if ( deferred_task != NULL ) {
+        vTaskNotifyGiveFromISR( deferred_task, woken );
+    }
+    return 1;
+}
+
+uint8_t deferred_call( PendedFunction_t fn, void * arg, uint32_t param )
+{
+    if ( !prvDeferredPut( fn, arg, param ) ) {
+        return 0;
+    }
+    if ( deferred_task != NULL ) {
+        xTaskNotifyGive( deferred_task );
+    }
+    return 1;
+}
+
+static void prvDeferredTask( void * pvParameters )
+{
+    deferred_work * work;
+    PendedFunction_t fn;
+    void * arg;
+    uint32_t param;
+
+    (void) pvParameters;
+
+    for ( ;; ) {
+        /* A slot claimed but not published yet stops the walk here, its producer notifies once it is */
+        while ( deferred_tail != __atomic_load_n( &deferred_head, __ATOMIC_RELAXED ) ) {
+            work = &deferred_ring[deferred_tail & DEFERRED_RING_MASK];
+            fn = __atomic_load_n( &work->fn, __ATOMIC_ACQUIRE );
+            if ( fn == NULL ) {
+                break;
+            }
+            arg = work->arg;
+            param = work->param;
+            /* Emptied before the tail moves on, so the producer that claims it next finds it unpublished */
+            __atomic_store_n( &work->fn, NULL, __ATOMIC_RELAXED );
+            __atomic_thread_fence( __ATOMIC_RELEASE );
+            deferred_tail++;
+
+            fn( arg, param );
+            deferred_counters.runs++;
+        }
+        ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+    }
+}
+
+void deferred_init( void )
+{
+    xTaskCreateWithStack( prvDeferredTask, (const char*)"Deferred", DEFERRED_STACK_DEPTH, ( void * ) NULL,
+                          DEFERRED_TASK_PRIORITY, &deferred_task, TASK_STACK_BUFFER( deferred_stack, 0 ) );
+}
+
+void deferred_get_stats( deferred_stats * stats )
+{
+    taskENTER_CRITICAL();
+    *stats = deferred_counters;
+    taskEXIT_CRITICAL();
+}
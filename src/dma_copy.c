@@ -0,0 +1,221 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file dma_copy.c
+ *
+ * @brief Bulk memory copies moved by the GPDMA
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+#include "semphr.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "deferred.h"
+#include "metrics.h"
+#include "dma_copy.h"
+
+/* RamAHB16 (afcipm_mem.ld) */
+#define DMA_COPY_RAM_START          0x2007C000UL
+#define DMA_COPY_RAM_END            ( DMA_COPY_RAM_START + 0x4000UL )
+/* Bytes of one GPDMA transfer, its size field counts 12 bits of words; longer copies are chained */
+#define DMA_COPY_XFER_MAX           ( 4095UL * 4 )
+#define DMA_COPY_NO_CHANNEL         0xFF
+
+static uint8_t dma_copy_ch = DMA_COPY_NO_CHANNEL;
+/*! @brief A copy owns the channel, from its start to the interrupt of its last transfer */
+static volatile uint8_t dma_copy_busy;
+/* Rest of the copy in flight, past the transfer running */
+static uint32_t dma_copy_src;
+static uint32_t dma_copy_dst;
+static uint32_t dma_copy_left;
+/* Told of the end: the callback of an asynchronous copy, or the semaphore of #dma_memcpy when it's NULL */
+static dma_copy_callback dma_copy_done;
+static void * dma_copy_ctx;
+static SemaphoreHandle_t dma_copy_sem;
+static volatile uint8_t dma_copy_ok;
+
+static uint32_t dma_copy_count;
+static uint32_t dma_copy_bytes;
+static uint32_t dma_copy_cpu;
+static uint32_t dma_copy_errors;
+METRIC_COUNTER( "dma.copies", dma_copy_count );
+METRIC_COUNTER( "dma.bytes", dma_copy_bytes );
+METRIC_COUNTER( "dma.cpu", dma_copy_cpu );
+METRIC_COUNTER( "dma.errors", dma_copy_errors );
+
+/* Whole words, both buffers in the AHB SRAM */
+static uint8_t prvDMACopyFits( const void * dst, const void * src, uint32_t len )
+{
+    uint32_t d = (uint32_t) dst;
+    uint32_t s = (uint32_t) src;
+
+    return ( len >= DMA_COPY_MIN ) && ( ( ( d | s | len ) & 3 ) == 0 ) &&
+           ( d >= DMA_COPY_RAM_START ) && ( d + len <= DMA_COPY_RAM_END ) &&
+           ( s >= DMA_COPY_RAM_START ) && ( s + len <= DMA_COPY_RAM_END );
+}
+
+/* Next transfer of the copy, 0 if the channel refused it */
+static uint8_t prvDMACopyNext( void )
+{
+    uint32_t len = ( dma_copy_left > DMA_COPY_XFER_MAX ) ? DMA_COPY_XFER_MAX : dma_copy_left;
+
+    if ( Chip_GPDMA_Transfer( LPC_GPDMA, dma_copy_ch, dma_copy_src, dma_copy_dst,
+                              GPDMA_TRANSFERTYPE_M2M_CONTROLLER_DMA, len ) != SUCCESS ) {
+        return 0;
+    }
+    dma_copy_src += len;
+    dma_copy_dst += len;
+    dma_copy_left -= len;
+    return 1;
+}
+
+/* Takes the channel and starts a copy, 0 if it's not for the GPDMA */
+static uint8_t prvDMACopyStart( void * dst, const void * src, uint32_t len, dma_copy_callback done, void * ctx )
+{
+    uint8_t claimed = 0;
+
+    if ( !prvDMACopyFits( dst, src, len ) ) {
+        return 0;
+    }
+    taskENTER_CRITICAL();
+    if ( ( dma_copy_ch != DMA_COPY_NO_CHANNEL ) && !dma_copy_busy ) {
+        dma_copy_busy = 1;
+        claimed = 1;
+    }
+    taskEXIT_CRITICAL();
+    if ( !claimed ) {
+        return 0;
+    }
+
+    /* All set before the first transfer, its interrupt reads them */
+    dma_copy_done = done;
+    dma_copy_ctx = ctx;
+    dma_copy_src = (uint32_t) src;
+    dma_copy_dst = (uint32_t) dst;
+    dma_copy_left = len;
+    if ( !prvDMACopyNext() ) {
+        dma_copy_busy = 0;
+        return 0;
+    }
+    METRIC_INC( dma_copy_count );
+    METRIC_ADD( dma_copy_bytes, len );
+    return 1;
+}
+
+/* Stops the channel, keeping it reserved (Chip_GPDMA_Stop would free it) */
+static void prvDMACopyStop( void )
+{
+    Chip_GPDMA_ChannelCmd( LPC_GPDMA, dma_copy_ch, DISABLE );
+    Chip_GPDMA_ClearIntPending( LPC_GPDMA, GPDMA_STATCLR_INTTC, dma_copy_ch );
+    Chip_GPDMA_ClearIntPending( LPC_GPDMA, GPDMA_STATCLR_INTERR, dma_copy_ch );
+}
+
+void dma_copy_init( void )
+{
+    /* The log takes channel 0 first thing (log_init), so 0 here means every channel is taken */
+    if ( !( LPC_SYSCTL->PCONP & ( 1 << SYSCTL_CLOCK_GPDMA ) ) ) {
+        Chip_GPDMA_Init( LPC_GPDMA );
+    }
+    dma_copy_sem = xSemaphoreCreateBinary();
+    configASSERT( dma_copy_sem );
+    dma_copy_ch = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, GPDMA_CONN_MEMORY );
+    if ( dma_copy_ch == 0 ) {
+        dma_copy_ch = DMA_COPY_NO_CHANNEL;
+        return;
+    }
+    NVIC_SetPriority( DMA_IRQn, DMA_IRQ_PRIORITY );
+    NVIC_EnableIRQ( DMA_IRQn );
+}
+
+void dma_memcpy( void * dst, const void * src, uint32_t len )
+{
+    if ( prvDMACopyStart( dst, src, len, NULL, NULL ) ) {
+        if ( xSemaphoreTake( dma_copy_sem, DMA_COPY_TIMEOUT ) != pdTRUE ) {
+            /* Stuck: stopped, and the give of an interrupt that came in the meantime taken back */
+            taskENTER_CRITICAL();
+            prvDMACopyStop();
+            dma_copy_ok = 0;
+            taskEXIT_CRITICAL();
+            xSemaphoreTake( dma_copy_sem, 0 );
+        }
+        dma_copy_busy = 0;
+        if ( dma_copy_ok ) {
+            return;
+        }
+        METRIC_INC( dma_copy_errors );
+    }
+    METRIC_INC( dma_copy_cpu );
+    memcpy( dst, src, len );
+}
+
+uint8_t dma_copy_async( void * dst, const void * src, uint32_t len, dma_copy_callback done, void * ctx )
+{
+    configASSERT( done );
+
+    if ( prvDMACopyStart( dst, src, len, done, ctx ) ) {
+        return 1;
+    }
+    METRIC_INC( dma_copy_cpu );
+    return 0;
+}
+
+void dma_copy_irq( void )
+{
+    portBASE_TYPE woken = pdFALSE;
+    BaseType_t queued;
+    uint8_t ok;
+
+    if ( !dma_copy_busy || ( dma_copy_ch == DMA_COPY_NO_CHANNEL ) ||
+         !Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, dma_copy_ch ) ) {
+        return;
+    }
+
+    /* SUCCESS: the transfer is done, ERROR: bus error, the rest of the copy is dropped */
+    ok = ( Chip_GPDMA_Interrupt( LPC_GPDMA, dma_copy_ch ) == SUCCESS );
+    if ( ok && ( dma_copy_left != 0 ) ) {
+        if ( prvDMACopyNext() ) {
+            return;
+        }
+        ok = 0;
+    }
+
+    if ( dma_copy_done == NULL ) {
+        /* dma_memcpy() gives the channel back once it's woken */
+        dma_copy_ok = ok;
+        xSemaphoreGiveFromISR( dma_copy_sem, &woken );
+    } else {
+        if ( !ok ) {
+            METRIC_INC( dma_copy_errors );
+        }
+        queued = deferred_call_from_isr( dma_copy_done, dma_copy_ctx, ok, &woken );
+        /* The deferred work ring is full, see DEFERRED_RING_LEN */
+        configASSERT( queued );
+        ( void ) queued;
+        dma_copy_busy = 0;
+    }
+    portYIELD_FROM_ISR( woken );
+}
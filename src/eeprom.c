@@ -0,0 +1,135 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file eeprom.c
+ *
+ * @brief Page writes to I2C EEPROMs, with ACK polling
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "i2c.h"
+#include "boot_time.h"
+#include "timestamp.h"
+#include "eeprom.h"
+
+static void prvEEPROMDone( xI2C_chain * chain, i2c_err error );
+
+/* Queues the page the write is at, or the last poll once they're all written */
+static uint8_t prvEEPROMSubmit( eeprom_op * op )
+{
+    const eeprom_dev * dev = op->dev;
+    uint16_t pos = op->offset + op->written;
+    uint8_t chunk = 0;
+    uint8_t n = 0;
+
+    if ( op->written < op->len ) {
+        /* Up to the end of the page, the device would wrap around to its start */
+        chunk = dev->page - ( pos & ( dev->page - 1 ) );
+        if ( chunk > op->len - op->written ) {
+            chunk = op->len - op->written;
+        }
+    } else {
+        /* Any address of the block whose cycle is running */
+        pos--;
+    }
+    op->chunk = chunk;
+
+    if ( dev->addr_len == 2 ) {
+        op->buf[n++] = pos >> 8;
+    }
+    op->buf[n++] = pos & 0xFF;
+    memcpy( &op->buf[n], &op->data[op->written], chunk );
+
+    op->xfer.addr = dev->addr | ( ( (uint32_t) pos >> ( dev->addr_len * 8 ) ) & 0x07 );
+    op->xfer.tx_data = op->buf;
+    op->xfer.tx_len = n + chunk;
+    op->xfer.rx_data = NULL;
+    op->xfer.rx_len = 0;
+    op->xfer.flags = I2C_XFER_POLL;
+    op->chain.xfer = &op->xfer;
+    op->chain.count = 1;
+    op->chain.callback = prvEEPROMDone;
+    op->chain.ctx = op;
+
+    return xI2CTransferAsync( dev->i2c_id, &op->chain ) == i2c_err_SUCCESS;
+}
+
+/* Attempt done (chain callback, deferred work daemon): next page, the same one again, or the end */
+static void prvEEPROMDone( xI2C_chain * chain, i2c_err error )
+{
+    eeprom_op * op = chain->ctx;
+    uint32_t now = timestamp_now();
+
+    if ( error == i2c_err_SLA_W_SENT_NACK ) {
+        /* Still programming the page before, the other chains of the bus went in the meantime */
+        if ( timestamp_reached( now, op->deadline ) ) {
+            op->callback( op, i2c_err_TIMEOUT );
+            return;
+        }
+        op->polls++;
+    } else if ( error != i2c_err_SUCCESS ) {
+        op->callback( op, error );
+        return;
+    } else if ( op->chunk == 0 ) {
+        op->callback( op, i2c_err_SUCCESS );
+        return;
+    } else {
+        /* Taken, its write cycle starts at the STOP */
+        op->written += op->chunk;
+        op->deadline = now + EEPROM_WRITE_TIMEOUT_US;
+    }
+
+    /* Same lengths as the first attempt, which was accepted */
+    if ( !prvEEPROMSubmit( op ) ) {
+        op->callback( op, i2c_err_FAILURE );
+    }
+}
+
+uint8_t eeprom_write( eeprom_op * op, const eeprom_dev * dev, uint16_t offset, const uint8_t * data, uint16_t len,
+                      eeprom_callback callback, void * ctx )
+{
+    configASSERT( ( dev->page <= EEPROM_PAGE_MAX ) && !( dev->page & ( dev->page - 1 ) ) );
+    configASSERT( callback && !op->chain.busy );
+
+    if ( ( len == 0 ) || ( offset >= dev->size ) || ( len > dev->size - offset ) ) {
+        return 0;
+    }
+
+    op->dev = dev;
+    op->offset = offset;
+    op->data = data;
+    op->len = len;
+    op->written = 0;
+    op->callback = callback;
+    op->ctx = ctx;
+    op->polls = 0;
+    /* The device may still be busy with a write of someone else */
+    op->deadline = timestamp_now() + EEPROM_WRITE_TIMEOUT_US;
+
+    return prvEEPROMSubmit( op );
+}
@@ -0,0 +1,341 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file ekey.c
+ *
+ * @brief AMC E-Keying: link states, applied to the port switches in batches
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "fru.h"
+#include "ekey.h"
+#include "board_defs.h"
+#include "log.h"
+
+/*! @brief Link descriptor of the connectivity records and its wanted state */
+typedef struct ekey_link {
+    uint32_t info;
+    uint8_t enabled;
+} ekey_link;
+
+/* Links and the AMC port of each lane of each channel, from the FRU, written by the dispatcher only */
+static ekey_link ekey_links[EKEY_LINKS_MAX];
+static uint8_t ekey_link_count;
+static uint8_t ekey_channel_port[EKEY_CHANNELS_MAX][4];
+static uint8_t ekey_channel_count;
+static uint8_t ekey_loaded;
+
+/*! @brief Ports enabled by the switches, and the ones being written (the chain is in flight while busy) */
+static uint32_t ekey_ports_applied;
+static uint32_t ekey_ports_writing;
+static uint8_t ekey_busy;
+static TimerHandle_t ekey_timer;
+
+#ifdef EKEY_PORTS
+/*! @brief Switch bit of an AMC port, from the board header */
+typedef struct ekey_port_bit {
+    uint8_t port;
+    uint8_t addr;
+    uint8_t reg;
+    uint8_t bit;
+} ekey_port_bit;
+
+#define EKEY_PORT_ENTRY( port, addr, reg, bit ) { port, addr, reg, bit },
+
+static const ekey_port_bit ekey_port_map[] = {
+    EKEY_PORTS( EKEY_PORT_ENTRY )
+};
+
+#define EKEY_PORT_COUNT             ( sizeof(ekey_port_map) / sizeof(ekey_port_map[0]) )
+
+static xI2C_chain ekey_chain;
+static xI2C_xfer ekey_xfer[EKEY_XFERS_MAX];
+static uint8_t ekey_tx[EKEY_XFERS_MAX][2];
+#endif
+
+/* Reads the connectivity records once, the FRU is loaded by then (the handlers wait for it) */
+static void prvEKeyLoad( void )
+{
+    uint8_t record[EKEY_RECORD_MAX];
+    uint8_t instance;
+    uint8_t len;
+    uint8_t pos;
+    uint8_t channels;
+    uint32_t desc;
+    uint8_t i;
+
+    if ( ekey_loaded ) {
+        return;
+    }
+    ekey_loaded = 1;
+
+    for ( instance = 0; ; instance++ ) {
+        len = fru_get_record( FRU_PICMG_MFG_ID, FRU_PICMG_P2P_CONNECTIVITY, instance, record, sizeof(record) );
+        if ( len == 0 ) {
+            break;
+        }
+        if ( len > sizeof(record) ) {
+            LOG( "ekey,record_cut,%u,%u", instance, len );
+            len = sizeof(record);
+        }
+
+        /* Manufacturer ID, record ID, version, then the OEM GUIDs, record type and channel count */
+        pos = 6 + 16 * record[5];
+        if ( ( len < 6 ) || ( pos + 2 > len ) ) {
+            continue;
+        }
+        pos++;
+        channels = record[pos++];
+
+        for ( i = 0; ( i < channels ) && ( pos + 3 <= len ); i++, pos += 3 ) {
+            if ( ekey_channel_count == EKEY_CHANNELS_MAX ) {
+                continue;
+            }
+            desc = record[pos] | ( record[pos + 1] << 8 ) | ( (uint32_t) record[pos + 2] << 16 );
+            ekey_channel_port[ekey_channel_count][0] = desc & 0x1F;
+            ekey_channel_port[ekey_channel_count][1] = ( desc >> 5 ) & 0x1F;
+            ekey_channel_port[ekey_channel_count][2] = ( desc >> 10 ) & 0x1F;
+            ekey_channel_port[ekey_channel_count][3] = ( desc >> 15 ) & 0x1F;
+            ekey_channel_count++;
+        }
+
+        /* Link descriptors, 5 bytes each up to the end of the record (the last one is the asymmetric match) */
+        for ( ; ( pos + 5 <= len ) && ( ekey_link_count < EKEY_LINKS_MAX ); pos += 5 ) {
+            ekey_links[ekey_link_count].info = record[pos] | ( record[pos + 1] << 8 ) | ( record[pos + 2] << 16 ) |
+                                               ( (uint32_t) record[pos + 3] << 24 );
+            ekey_links[ekey_link_count].enabled = 0;
+            ekey_link_count++;
+        }
+    }
+}
+
+/* AMC ports of the lanes of a link */
+static uint32_t prvEKeyLinkPorts( uint32_t info )
+{
+    uint8_t channel = EKEY_LINK_CHANNEL( info );
+    uint32_t ports = 0;
+    uint8_t lane;
+
+    if ( channel >= ekey_channel_count ) {
+        return 0;
+    }
+    for ( lane = 0; lane < 4; lane++ ) {
+        if ( ( EKEY_LINK_LANES( info ) & ( 1 << lane ) ) && ( ekey_channel_port[channel][lane] != EKEY_PORT_UNUSED ) ) {
+            ports |= ( 1UL << ekey_channel_port[channel][lane] );
+        }
+    }
+    return ports;
+}
+
+#ifdef EKEY_PORTS
+/* Switch registers written (chain callback, deferred work daemon) */
+static void prvEKeyApplied( xI2C_chain * chain, i2c_err error )
+{
+    (void) chain;
+
+    ekey_busy = 0;
+    if ( error == i2c_err_SUCCESS ) {
+        ekey_ports_applied = ekey_ports_writing;
+    } else {
+        LOG( "ekey,apply_failed,%u", error );
+    }
+    /* Changes that came in meanwhile, or another try */
+    xTimerChangePeriod( ekey_timer, EKEY_APPLY_DELAY, 0 );
+}
+#endif
+
+/* Brings the switches to the ports the enabled links need (timer service task) */
+static void prvEKeyApply( TimerHandle_t timer )
+{
+    uint32_t ports = 0;
+    uint8_t i;
+#ifdef EKEY_PORTS
+    uint32_t changed;
+    uint8_t count = 0;
+    uint8_t value;
+    uint8_t j;
+#endif
+
+    (void) timer;
+
+    if ( ekey_busy ) {
+        /* The chain callback restarts us */
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < ekey_link_count; i++ ) {
+        if ( ekey_links[i].enabled ) {
+            ports |= prvEKeyLinkPorts( ekey_links[i].info );
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if ( ports == ekey_ports_applied ) {
+        return;
+    }
+
+#ifdef EKEY_PORTS
+    /* One write per register holding a port that changes, with the bits of every port it holds */
+    changed = ports ^ ekey_ports_applied;
+    for ( i = 0; i < EKEY_PORT_COUNT; i++ ) {
+        if ( !( changed & ( 1UL << ekey_port_map[i].port ) ) ) {
+            continue;
+        }
+        for ( j = 0; j < count; j++ ) {
+            if ( ( ekey_xfer[j].addr == ekey_port_map[i].addr ) && ( ekey_tx[j][0] == ekey_port_map[i].reg ) ) {
+                break;
+            }
+        }
+        if ( j < count ) {
+            continue;
+        }
+
+        value = 0;
+        for ( j = 0; j < EKEY_PORT_COUNT; j++ ) {
+            if ( ( ekey_port_map[j].addr == ekey_port_map[i].addr ) && ( ekey_port_map[j].reg == ekey_port_map[i].reg ) &&
+                 ( ports & ( 1UL << ekey_port_map[j].port ) ) ) {
+                value |= ( 1 << ekey_port_map[j].bit );
+            }
+        }
+        ekey_tx[count][0] = ekey_port_map[i].reg;
+        ekey_tx[count][1] = value;
+        ekey_xfer[count].addr = ekey_port_map[i].addr;
+        ekey_xfer[count].tx_data = ekey_tx[count];
+        ekey_xfer[count].tx_len = 2;
+        ekey_xfer[count].rx_len = 0;
+        count++;
+    }
+
+    if ( count == 0 ) {
+        /* Only ports without a switch changed */
+        ekey_ports_applied = ports;
+        return;
+    }
+
+    ekey_chain.xfer = ekey_xfer;
+    ekey_chain.count = count;
+    ekey_chain.callback = prvEKeyApplied;
+    ekey_ports_writing = ports;
+    ekey_busy = 1;
+    if ( xI2CTransferAsync( EKEY_I2C, &ekey_chain ) != i2c_err_SUCCESS ) {
+        ekey_busy = 0;
+        xTimerChangePeriod( ekey_timer, EKEY_APPLY_DELAY, 0 );
+    }
+#else
+    ekey_ports_writing = ports;
+    ekey_ports_applied = ports;
+#endif
+}
+
+void ekey_init( void )
+{
+#ifdef EKEY_PORTS
+    uint8_t regs = 0;
+    uint8_t i;
+    uint8_t j;
+
+    for ( i = 0; i < EKEY_PORT_COUNT; i++ ) {
+        for ( j = 0; j < i; j++ ) {
+            if ( ( ekey_port_map[j].addr == ekey_port_map[i].addr ) && ( ekey_port_map[j].reg == ekey_port_map[i].reg ) ) {
+                break;
+            }
+        }
+        if ( j == i ) {
+            regs++;
+        }
+        if ( pxI2CDeviceInfo( EKEY_I2C, ekey_port_map[i].addr ) == NULL ) {
+            xI2CRegisterDevice( EKEY_I2C, ekey_port_map[i].addr, I2C_FAST_MODE_CLOCK );
+        }
+    }
+    /* Every register that may change fits in one chain */
+    configASSERT( regs <= EKEY_XFERS_MAX );
+#endif
+
+    ekey_timer = xTimerCreate( "EKey", EKEY_APPLY_DELAY, pdFALSE, NULL, prvEKeyApply );
+    configASSERT( ekey_timer );
+}
+
+uint8_t ekey_set_link( uint32_t info, uint8_t enable )
+{
+    uint8_t i;
+
+    prvEKeyLoad();
+
+    for ( i = 0; i < ekey_link_count; i++ ) {
+        if ( ekey_links[i].info == info ) {
+            break;
+        }
+    }
+    if ( i == ekey_link_count ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    ekey_links[i].enabled = enable ? 1 : 0;
+    taskEXIT_CRITICAL();
+
+    /* Restarted by every command, so a burst is applied once it's over */
+    xTimerChangePeriod( ekey_timer, EKEY_APPLY_DELAY, 0 );
+    return 1;
+}
+
+uint8_t ekey_get_links( uint8_t channel, uint32_t * info, uint8_t * state )
+{
+    uint8_t count = 0;
+    uint8_t i;
+
+    prvEKeyLoad();
+
+    for ( i = 0; ( i < ekey_link_count ) && ( count < EKEY_CHANNEL_LINKS_MAX ); i++ ) {
+        if ( EKEY_LINK_CHANNEL( ekey_links[i].info ) == channel ) {
+            info[count] = ekey_links[i].info;
+            state[count] = ekey_links[i].enabled;
+            count++;
+        }
+    }
+    return count;
+}
+
+void ekey_disable_all( void )
+{
+    uint8_t i;
+
+    if ( ekey_timer == NULL ) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < ekey_link_count; i++ ) {
+        ekey_links[i].enabled = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    xTimerChangePeriod( ekey_timer, EKEY_APPLY_DELAY, 0 );
+}
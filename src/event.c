@@ -0,0 +1,295 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file event.c
+ *
+ * @brief Platform Event messages sent to the event receiver
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmi.h"
+#include "event.h"
+#include "config_store.h"
+#include "wallclock.h"
+#include "timer_wheel.h"
+
+/*! @brief Queued events, from #event_head on; the head one is the one being sent */
+static ipmi_event event_queue[EVENT_QUEUE_LEN];
+static uint8_t event_head;
+static uint8_t event_len;
+/*! @brief The head event was handed to IPMB and isn't acknowledged yet, it can't be merged anymore */
+static uint8_t event_in_flight;
+/*! @brief Events lost because the queue was full */
+static uint32_t event_dropped;
+
+static uint8_t event_receiver_addr = MCH_ADDRESS;
+static uint8_t event_receiver_lun;
+
+static TickType_t event_retry_delay = EVENT_RETRY_MIN;
+static wheel_timer event_timer;
+
+/*! @brief History ring, the record numbered n is in slot n % EVENT_HISTORY_LEN */
+static event_record event_history[EVENT_HISTORY_LEN];
+/* Number of the next record and records kept (up to EVENT_HISTORY_LEN) */
+static uint16_t event_history_next;
+static uint8_t event_history_count;
+
+static void prvEventSend( void );
+
+/* Sends the head event again later, each try waits twice as long as the previous one */
+static void prvEventRetry( void )
+{
+    wheel_timer_start( &event_timer, event_retry_delay );
+
+    event_retry_delay <<= 1;
+    if ( event_retry_delay > EVENT_RETRY_MAX ) {
+        event_retry_delay = EVENT_RETRY_MAX;
+    }
+}
+
+/* Outcome of the head event, run by the IPMI dispatcher */
+static void prvEventDone( void * ctx, uint32_t taken )
+{
+    (void) ctx;
+
+    if ( !taken ) {
+        taskENTER_CRITICAL();
+        event_in_flight = 0;
+        if ( event_receiver_addr == EVENT_RECEIVER_DISABLED ) {
+            event_len = 0;
+        }
+        taskEXIT_CRITICAL();
+        prvEventRetry();
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    event_head = ( event_head + 1 ) % EVENT_QUEUE_LEN;
+    event_len--;
+    event_in_flight = 0;
+    taskEXIT_CRITICAL();
+
+    event_retry_delay = EVENT_RETRY_MIN;
+    prvEventSend();
+}
+
+/* Called from the IPMB or timer tasks, must not block; the rest is left to the dispatcher */
+static void prvEventSent( ipmi_msg * resp, ipmb_error error, void * ctx )
+{
+    /* A busy receiver hasn't taken the event yet, any other answer means it has */
+    uint32_t taken = ( error == ipmb_error_success ) && ( resp->completion_code != IPMI_CC_NODE_BUSY );
+
+    if ( !ipmi_defer( prvEventDone, ctx, taken ) ) {
+        prvEventDone( ctx, taken );
+    }
+}
+
+/* Hands the head event to IPMB, unless one is already there */
+static void prvEventSend( void )
+{
+    ipmi_msg req;
+    ipmi_event event;
+    uint8_t len = 0;
+
+    taskENTER_CRITICAL();
+    if ( event_in_flight || ( event_len == 0 ) || ( event_receiver_addr == EVENT_RECEIVER_DISABLED ) ) {
+        taskEXIT_CRITICAL();
+        return;
+    }
+    event_in_flight = 1;
+    event = event_queue[event_head];
+    req.dest_addr = event_receiver_addr;
+    taskEXIT_CRITICAL();
+
+    req.netfn = NETFN_SE;
+    req.cmd = IPMI_PLATFORM_EVENT_CMD;
+    req.data[len++] = EVENT_MSG_REV;
+    req.data[len++] = event.sensor_type;
+    req.data[len++] = event.sensor_num;
+    req.data[len++] = event.dir_type;
+    req.data[len++] = event.data[0];
+    req.data[len++] = event.data[1];
+    req.data[len++] = event.data[2];
+    req.data_len = len;
+
+    if ( ipmb_send_request_async( &req, prvEventSent, NULL ) != ipmb_error_success ) {
+        /* TX queue full or no sequence number free, the callback won't be called */
+        taskENTER_CRITICAL();
+        event_in_flight = 0;
+        taskEXIT_CRITICAL();
+        prvEventRetry();
+    }
+}
+
+static void prvEventRetried( void * ctx, uint32_t unused )
+{
+    (void) ctx;
+    (void) unused;
+
+    prvEventSend();
+}
+
+/* Called from the timer task, the retry is sent by the dispatcher like the rest */
+static void prvEventTimer( void * arg )
+{
+    (void) arg;
+
+    if ( !ipmi_defer( prvEventRetried, NULL, 0 ) ) {
+        prvEventSend();
+    }
+}
+
+void event_init( void )
+{
+    uint8_t saved[2];
+
+    /* Receiver given by the last Set Event Receiver, before the reset */
+    if ( config_get( CONFIG_KEY_EVENT_RECEIVER, saved, sizeof(saved) ) ) {
+        event_receiver_addr = saved[0];
+        event_receiver_lun = saved[1];
+    }
+
+    wheel_timer_init( &event_timer, prvEventTimer, NULL );
+}
+
+/* Adds an event to the history, from inside a critical section */
+static void prvEventRecord( const ipmi_event * event, uint32_t time, uint8_t flags )
+{
+    event_record * record = &event_history[event_history_next % EVENT_HISTORY_LEN];
+
+    record->time = time;
+    record->flags = flags;
+    record->sensor_num = event->sensor_num;
+    record->dir_type = event->dir_type;
+    record->data[0] = event->data[0];
+    record->data[1] = event->data[1];
+    record->data[2] = event->data[2];
+    event_history_next++;
+    if ( event_history_count < EVENT_HISTORY_LEN ) {
+        event_history_count++;
+    }
+}
+
+uint8_t event_post( const ipmi_event * event )
+{
+    uint32_t time = wallclock_seconds();
+    uint8_t flags = 0;
+    uint8_t first;
+    uint8_t i;
+    uint8_t slot;
+
+    if ( time == 0 ) {
+        time = xTaskGetTickCount() / ( 1000 / portTICK_PERIOD_MS );
+        flags = EVENT_HISTORY_UPTIME;
+    }
+
+    taskENTER_CRITICAL();
+    if ( ( event_timer.fn == NULL ) || ( event_receiver_addr == EVENT_RECEIVER_DISABLED ) ) {
+        prvEventRecord( event, time, flags | EVENT_HISTORY_NOT_SENT );
+        taskEXIT_CRITICAL();
+        return 0;
+    }
+
+    /* Newer state of an event still waiting: replace it, the one being sent can't be touched */
+    first = event_in_flight ? 1 : 0;
+    for ( i = first; i < event_len; i++ ) {
+        slot = ( event_head + i ) % EVENT_QUEUE_LEN;
+        if ( ( event_queue[slot].sensor_num == event->sensor_num ) &&
+             ( ( event_queue[slot].data[0] & 0x0F ) == ( event->data[0] & 0x0F ) ) ) {
+            event_queue[slot] = *event;
+            prvEventRecord( event, time, flags );
+            taskEXIT_CRITICAL();
+            return 1;
+        }
+    }
+
+    if ( event_len == EVENT_QUEUE_LEN ) {
+        event_dropped++;
+        prvEventRecord( event, time, flags | EVENT_HISTORY_NOT_SENT );
+        taskEXIT_CRITICAL();
+        return 0;
+    }
+
+    event_queue[( event_head + event_len ) % EVENT_QUEUE_LEN] = *event;
+    event_len++;
+    prvEventRecord( event, time, flags );
+    taskEXIT_CRITICAL();
+
+    prvEventSend();
+    return 1;
+}
+
+void event_set_receiver( uint8_t addr, uint8_t lun )
+{
+    uint8_t saved[2] = { addr, lun };
+
+    config_set( CONFIG_KEY_EVENT_RECEIVER, saved, sizeof(saved) );
+
+    taskENTER_CRITICAL();
+    event_receiver_addr = addr;
+    event_receiver_lun = lun;
+    if ( addr == EVENT_RECEIVER_DISABLED ) {
+        /* The one in flight is dropped when it completes or fails */
+        event_len = event_in_flight ? 1 : 0;
+    }
+    taskEXIT_CRITICAL();
+
+    event_retry_delay = EVENT_RETRY_MIN;
+    prvEventSend();
+}
+
+void event_get_receiver( uint8_t * addr, uint8_t * lun )
+{
+    taskENTER_CRITICAL();
+    *addr = event_receiver_addr;
+    *lun = event_receiver_lun;
+    taskEXIT_CRITICAL();
+}
+
+uint8_t event_history_read( uint16_t * cursor, event_record * records, uint8_t max )
+{
+    uint16_t first = *cursor;
+    uint16_t available;
+    uint8_t count;
+    uint8_t i;
+
+    taskENTER_CRITICAL();
+    available = event_history_next - first;
+    if ( available > event_history_count ) {
+        first = event_history_next - event_history_count;
+        available = event_history_count;
+    }
+    count = ( available < max ) ? available : max;
+    for ( i = 0; i < count; i++ ) {
+        records[i] = event_history[(uint16_t)( first + i ) % EVENT_HISTORY_LEN];
+    }
+    taskEXIT_CRITICAL();
+
+    *cursor = first;
+    return count;
+}
@@ -0,0 +1,486 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file fpga.c
+ *
+ * @brief Payload FPGA configuration (flash to FPGA stream through the GPDMA, FPGA task)
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/* LPCOpen includes */
+#include "chip.h"
+
+/* Project includes */
+#include "fpga.h"
+#include "board_defs.h"
+#include "gpio.h"
+#include "image.h"
+#include "log.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "watchdog.h"
+#include "boot_time.h"
+#include "timestamp.h"
+#include "clock.h"
+
+#ifdef FPGA_CFG_SSP
+
+/*! @name FPGA task notification bits
+ * @{
+ */
+#define FPGA_NOTIFY_START           0x01    /* #fpga_load */
+#define FPGA_NOTIFY_READ            0x02    /* Flash block received */
+#define FPGA_NOTIFY_SENT            0x04    /* Block written to the configuration SSP */
+#define FPGA_NOTIFY_ERROR           0x08    /* Bus error on one of the transfers */
+/*! @} */
+
+#define FPGA_SSP_DMA_TX( ssp )      ( ( ( ssp ) == LPC_SSP0 ) ? GPDMA_CONN_SSP0_Tx : GPDMA_CONN_SSP1_Tx )
+#define FPGA_SSP_DMA_RX( ssp )      ( ( ( ssp ) == LPC_SSP0 ) ? GPDMA_CONN_SSP0_Rx : GPDMA_CONN_SSP1_Rx )
+
+TASK_STACK( fpga_stack, FPGA_STACK_DEPTH, 1 );
+
+/*! @brief Stream buffers, read and written by the GPDMA (so in the AHB SRAM) */
+static uint8_t fpga_buf[2][FPGA_BLOCK_LEN] __RAM_AHB_NOINIT;
+static uint8_t fpga_ch_flash_tx;
+static uint8_t fpga_ch_flash_rx;
+static uint8_t fpga_ch_cfg_tx;
+static TaskHandle_t fpga_task;
+/* Held by a load for its whole length and by each mailbox burst, which may share an SSP with it */
+static SemaphoreHandle_t fpga_bus;
+/* Written by the FPGA task, and by fpga_load while no load runs */
+static volatile fpga_status fpga_stat;
+static uint32_t fpga_addr;
+
+#ifdef FPGA_MBOX_SSP
+/*! @brief Mailbox burst: command and first register index, then the bytes clocking the registers in (0) */
+static uint8_t fpga_mbox_tx[2 + 2 * FPGA_MBOX_REGS_MAX] __RAM_AHB;
+static uint8_t fpga_mbox_rx[2 + 2 * FPGA_MBOX_REGS_MAX] __RAM_AHB;
+static uint8_t fpga_ch_mbox_tx;
+static uint8_t fpga_ch_mbox_rx;
+static SemaphoreHandle_t fpga_mbox_done;
+static volatile uint8_t fpga_mbox_error;
+#endif
+
+/* Receives the next len bytes of the flash stream into buf. The flash ignores MOSI once it's sending, so
+ * the clocks are made by sending the buffer itself: each byte goes out before its place is written. */
+static void prvFPGARead( uint8_t * buf, uint32_t len )
+{
+    Chip_GPDMA_Transfer( LPC_GPDMA, fpga_ch_flash_rx, FPGA_SSP_DMA_RX( FPGA_FLASH_SSP ), (uint32_t) buf,
+                         GPDMA_TRANSFERTYPE_P2M_CONTROLLER_DMA, len );
+    Chip_GPDMA_Transfer( LPC_GPDMA, fpga_ch_flash_tx, (uint32_t) buf, FPGA_SSP_DMA_TX( FPGA_FLASH_SSP ),
+                         GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA, len );
+}
+
+static void prvFPGASend( const uint8_t * buf, uint32_t len )
+{
+    Chip_GPDMA_Transfer( LPC_GPDMA, fpga_ch_cfg_tx, (uint32_t) buf, FPGA_SSP_DMA_TX( FPGA_CFG_SSP ),
+                         GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA, len );
+}
+
+/* Stops a channel, keeping it reserved (Chip_GPDMA_Stop would free it) */
+static void prvFPGAStop( uint8_t ch )
+{
+    Chip_GPDMA_ChannelCmd( LPC_GPDMA, ch, DISABLE );
+    Chip_GPDMA_ClearIntPending( LPC_GPDMA, GPDMA_STATCLR_INTTC, ch );
+    Chip_GPDMA_ClearIntPending( LPC_GPDMA, GPDMA_STATCLR_INTERR, ch );
+}
+
+/* Waits for every bit of mask, 0 on a timeout or a bus error */
+static uint8_t prvFPGAWait( uint32_t mask )
+{
+    uint32_t bits;
+    uint32_t got = 0;
+
+    while ( ( got & mask ) != mask ) {
+        if ( xTaskNotifyWait( 0, mask | FPGA_NOTIFY_ERROR, &bits, FPGA_BLOCK_TIMEOUT ) == pdFALSE ) {
+            return 0;
+        }
+        if ( bits & FPGA_NOTIFY_ERROR ) {
+            return 0;
+        }
+        got |= bits;
+    }
+    return 1;
+}
+
+static void prvFPGAFinish( uint8_t error, uint32_t start )
+{
+    fpga_stat.elapsed_us = timestamp_elapsed( timestamp_now(), start );
+    fpga_stat.error = error;
+    fpga_stat.state = ( error == FPGA_ERR_NONE ) ? FPGA_LOADED : FPGA_FAILED;
+    LOG( "fpga,load,%u,%u,%x,%u", error, fpga_stat.sent, fpga_stat.crc, fpga_stat.elapsed_us );
+}
+
+/* Pulses PROGRAM_B and waits for the FPGA to be ready for a bitstream */
+static uint8_t prvFPGAProgram( void )
+{
+    TickType_t since;
+
+    /* Clears the configuration memory, INIT_B is held low meanwhile */
+    GPIO_PIN_CLEAR( FPGA_PROGRAM_B );
+    since = xTaskGetTickCount();
+    while ( GPIO_PIN_READ( FPGA_INIT_B ) ) {
+        if ( xTaskGetTickCount() - since > FPGA_INIT_TIMEOUT ) {
+            GPIO_PIN_SET( FPGA_PROGRAM_B );
+            return 0;
+        }
+        vTaskDelay( 1 );
+    }
+    GPIO_PIN_SET( FPGA_PROGRAM_B );
+
+    since = xTaskGetTickCount();
+    while ( !GPIO_PIN_READ( FPGA_INIT_B ) ) {
+        if ( xTaskGetTickCount() - since > FPGA_INIT_TIMEOUT ) {
+            return 0;
+        }
+        vTaskDelay( 1 );
+    }
+    return 1;
+}
+
+/* Reads the whole bitstream once with the flash selected, block k+1 coming in while block k goes to the FPGA */
+static uint8_t prvFPGAStream( watchdog_id wdg, uint32_t start )
+{
+    uint32_t len = fpga_stat.len;
+    uint32_t read;
+    uint32_t block;
+    uint32_t next;
+    uint32_t crc = 0xFFFFFFFF;
+    uint8_t k;
+
+    block = ( len < FPGA_BLOCK_LEN ) ? len : FPGA_BLOCK_LEN;
+    prvFPGARead( fpga_buf[0], block );
+    read = block;
+    if ( !prvFPGAWait( FPGA_NOTIFY_READ ) ) {
+        return FPGA_ERR_DMA;
+    }
+
+    for ( k = 0; fpga_stat.sent < len; k ^= 1 ) {
+        watchdog_checkin( wdg );
+
+        next = ( len - read < FPGA_BLOCK_LEN ) ? len - read : FPGA_BLOCK_LEN;
+        if ( next != 0 ) {
+            prvFPGARead( fpga_buf[k ^ 1], next );
+        }
+        prvFPGASend( fpga_buf[k], block );
+        /* While both transfers run */
+        crc = image_crc32_update( crc, fpga_buf[k], block );
+        if ( !prvFPGAWait( FPGA_NOTIFY_SENT | ( ( next != 0 ) ? FPGA_NOTIFY_READ : 0 ) ) ) {
+            return FPGA_ERR_DMA;
+        }
+        fpga_stat.sent += block;
+        fpga_stat.crc = ~crc;
+        fpga_stat.elapsed_us = timestamp_elapsed( timestamp_now(), start );
+        read += next;
+        block = next;
+
+        if ( !GPIO_PIN_READ( FPGA_INIT_B ) ) {
+            return FPGA_ERR_CRC;
+        }
+    }
+    return FPGA_ERR_NONE;
+}
+
+static void prvFPGALoad( watchdog_id wdg )
+{
+    uint8_t cmd[4] = { FPGA_FLASH_READ_CMD, ( fpga_addr >> 16 ) & 0xFF, ( fpga_addr >> 8 ) & 0xFF, fpga_addr & 0xFF };
+    uint32_t start = timestamp_now();
+    uint8_t error;
+    uint8_t n;
+
+    /* A mailbox burst only holds it for a few us */
+    if ( xSemaphoreTake( fpga_bus, FPGA_BLOCK_TIMEOUT ) != pdTRUE ) {
+        prvFPGAFinish( FPGA_ERR_DMA, start );
+        return;
+    }
+    if ( !prvFPGAProgram() ) {
+        xSemaphoreGive( fpga_bus );
+        prvFPGAFinish( FPGA_ERR_INIT, start );
+        return;
+    }
+
+    /* One Read command, the flash then sends its contents for as long as it's clocked */
+    GPIO_PIN_CLEAR( FPGA_FLASH_CS );
+    Chip_SSP_WriteFrames_Blocking( FPGA_FLASH_SSP, cmd, sizeof(cmd) );
+    Chip_SSP_Int_FlushData( FPGA_FLASH_SSP );
+    error = prvFPGAStream( wdg, start );
+    if ( error == FPGA_ERR_DMA ) {
+        prvFPGAStop( fpga_ch_flash_tx );
+        prvFPGAStop( fpga_ch_flash_rx );
+        prvFPGAStop( fpga_ch_cfg_tx );
+    }
+    GPIO_PIN_SET( FPGA_FLASH_CS );
+    Chip_SSP_Int_FlushData( FPGA_FLASH_SSP );
+
+    if ( error == FPGA_ERR_NONE ) {
+        /* Startup sequence: CCLK keeps running until DONE goes high (the data doesn't matter) */
+        for ( n = 0; ( n < FPGA_DONE_CLOCKS ) && !GPIO_PIN_READ( FPGA_DONE ); n++ ) {
+            while ( Chip_SSP_GetStatus( FPGA_CFG_SSP, SSP_STAT_TNF ) == RESET ) {
+            }
+            Chip_SSP_SendFrame( FPGA_CFG_SSP, 0xFF );
+        }
+        while ( Chip_SSP_GetStatus( FPGA_CFG_SSP, SSP_STAT_BSY ) == SET ) {
+        }
+        error = GPIO_PIN_READ( FPGA_DONE ) ? FPGA_ERR_NONE : FPGA_ERR_DONE;
+    }
+    /* Nothing is read back from the FPGA, its RX FIFO only overflowed */
+    Chip_SSP_Int_FlushData( FPGA_CFG_SSP );
+    xSemaphoreGive( fpga_bus );
+
+    prvFPGAFinish( error, start );
+}
+
+static void prvFPGATask( void * pvParameters )
+{
+    watchdog_id wdg = watchdog_register( "FPGA", WATCHDOG_DEADLINE );
+    uint32_t bits;
+
+    (void) pvParameters;
+
+    for ( ;; ) {
+        watchdog_checkin( wdg );
+        /* Also clears what an aborted load left */
+        if ( ( xTaskNotifyWait( 0, 0xFFFFFFFF, &bits, WATCHDOG_BLOCK_TIME ) == pdTRUE ) &&
+             ( bits & FPGA_NOTIFY_START ) ) {
+            /* The SSP only reaches FPGA_SSP_CLOCK on the full clock */
+            clock_boost( CLOCK_BOOST_FPGA, 1 );
+            prvFPGALoad( wdg );
+            clock_boost( CLOCK_BOOST_FPGA, 0 );
+        }
+    }
+}
+
+#define FPGA_SSP_PIN_MUX( port, pin, func ) \
+    Chip_IOCON_PinMux( LPC_IOCON, port, pin, IOCON_MODE_INACT, func );
+
+static void prvFPGASSPInit( LPC_SSP_T * ssp )
+{
+    Chip_SSP_Init( ssp );
+    Chip_SSP_SetFormat( ssp, SSP_BITS_8, SSP_FRAMEFORMAT_SPI, SSP_CLOCK_MODE0 );
+    Chip_SSP_SetMaster( ssp, 1 );
+    Chip_SSP_SetBitRate( ssp, FPGA_SSP_CLOCK );
+    Chip_SSP_DMA_Enable( ssp );
+    Chip_SSP_Enable( ssp );
+}
+
+/* Closest bit rate to FPGA_SSP_CLOCK on the new peripheral clock (the mailbox shares one of the two SSPs) */
+static void prvFPGASSPClock( void )
+{
+    Chip_SSP_SetBitRate( FPGA_FLASH_SSP, FPGA_SSP_CLOCK );
+    Chip_SSP_SetBitRate( FPGA_CFG_SSP, FPGA_SSP_CLOCK );
+}
+
+void fpga_init( void )
+{
+    FPGA_SSP_PINS( FPGA_SSP_PIN_MUX )
+
+    /* PROGRAM_B and the chip selects idle high, the FPGA keeps what it has */
+    GPIO_PIN_SET( FPGA_PROGRAM_B );
+    GPIO_PIN_SET_DIR( FPGA_PROGRAM_B, 1 );
+    GPIO_PIN_SET( FPGA_FLASH_CS );
+    GPIO_PIN_SET_DIR( FPGA_FLASH_CS, 1 );
+#ifdef FPGA_MBOX_SSP
+    GPIO_PIN_SET( FPGA_MBOX_CS );
+    GPIO_PIN_SET_DIR( FPGA_MBOX_CS, 1 );
+#endif
+    GPIO_PIN_SET_DIR( FPGA_INIT_B, 0 );
+    GPIO_PIN_SET_DIR( FPGA_DONE, 0 );
+
+    prvFPGASSPInit( FPGA_FLASH_SSP );
+    prvFPGASSPInit( FPGA_CFG_SSP );
+    clock_register( prvFPGASSPClock );
+
+    /* The ADC or the log may have set the GPDMA up already (Chip_GPDMA_Init resets every channel) */
+    if ( !( LPC_SYSCTL->PCONP & ( 1 << SYSCTL_CLOCK_GPDMA ) ) ) {
+        Chip_GPDMA_Init( LPC_GPDMA );
+    }
+    fpga_ch_flash_rx = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, FPGA_SSP_DMA_RX( FPGA_FLASH_SSP ) );
+    fpga_ch_flash_tx = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, FPGA_SSP_DMA_TX( FPGA_FLASH_SSP ) );
+    fpga_ch_cfg_tx = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, FPGA_SSP_DMA_TX( FPGA_CFG_SSP ) );
+#ifdef FPGA_MBOX_SSP
+    fpga_ch_mbox_rx = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, FPGA_SSP_DMA_RX( FPGA_MBOX_SSP ) );
+    fpga_ch_mbox_tx = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, FPGA_SSP_DMA_TX( FPGA_MBOX_SSP ) );
+    fpga_mbox_done = xSemaphoreCreateBinary();
+#endif
+    fpga_bus = xSemaphoreCreateMutex();
+    NVIC_SetPriority( DMA_IRQn, DMA_IRQ_PRIORITY );
+    NVIC_EnableIRQ( DMA_IRQn );
+
+    fpga_stat.state = GPIO_PIN_READ( FPGA_DONE ) ? FPGA_LOADED : FPGA_IDLE;
+
+    xTaskCreateWithStack( prvFPGATask, (const char*)"FPGA", FPGA_STACK_DEPTH, ( void * ) NULL, FPGA_TASK_PRIORITY, &fpga_task, TASK_STACK_BUFFER( fpga_stack, 0 ) );
+}
+
+uint8_t fpga_load( uint32_t addr, uint32_t len )
+{
+    uint8_t ret = 0;
+
+    if ( ( fpga_task == NULL ) || ( len == 0 ) ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    if ( fpga_stat.state != FPGA_LOADING ) {
+        fpga_addr = addr;
+        fpga_stat.len = len;
+        fpga_stat.sent = 0;
+        fpga_stat.crc = 0;
+        fpga_stat.elapsed_us = 0;
+        fpga_stat.error = FPGA_ERR_NONE;
+        fpga_stat.state = FPGA_LOADING;
+        ret = 1;
+    }
+    taskEXIT_CRITICAL();
+
+    if ( ret ) {
+        xTaskNotify( fpga_task, FPGA_NOTIFY_START, eSetBits );
+    }
+    return ret;
+}
+
+void fpga_get_status( fpga_status * status )
+{
+    taskENTER_CRITICAL();
+    *status = fpga_stat;
+    taskEXIT_CRITICAL();
+}
+
+const uint8_t * fpga_mbox_read( uint8_t first, uint8_t count )
+{
+#ifdef FPGA_MBOX_SSP
+    uint32_t len = 2 + 2 * count;
+    const uint8_t * regs = NULL;
+
+    if ( ( fpga_bus == NULL ) || ( count == 0 ) || ( count > FPGA_MBOX_REGS_MAX ) || !GPIO_PIN_READ( FPGA_DONE ) ) {
+        return NULL;
+    }
+    /* Not while a load holds the bus, the readings are only flagged unavailable meanwhile */
+    if ( xSemaphoreTake( fpga_bus, 0 ) != pdTRUE ) {
+        return NULL;
+    }
+
+    fpga_mbox_tx[0] = FPGA_MBOX_READ_CMD;
+    fpga_mbox_tx[1] = first;
+    fpga_mbox_error = 0;
+    Chip_SSP_Int_FlushData( FPGA_MBOX_SSP );
+    GPIO_PIN_CLEAR( FPGA_MBOX_CS );
+    Chip_GPDMA_Transfer( LPC_GPDMA, fpga_ch_mbox_rx, FPGA_SSP_DMA_RX( FPGA_MBOX_SSP ), (uint32_t) fpga_mbox_rx,
+                         GPDMA_TRANSFERTYPE_P2M_CONTROLLER_DMA, len );
+    Chip_GPDMA_Transfer( LPC_GPDMA, fpga_ch_mbox_tx, (uint32_t) fpga_mbox_tx, FPGA_SSP_DMA_TX( FPGA_MBOX_SSP ),
+                         GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA, len );
+
+    if ( xSemaphoreTake( fpga_mbox_done, FPGA_MBOX_TIMEOUT ) != pdTRUE ) {
+        prvFPGAStop( fpga_ch_mbox_tx );
+        prvFPGAStop( fpga_ch_mbox_rx );
+        /* In case it completed meanwhile */
+        xSemaphoreTake( fpga_mbox_done, 0 );
+    } else if ( !fpga_mbox_error ) {
+        /* The first two bytes came in while the command went out */
+        regs = &fpga_mbox_rx[2];
+    }
+    GPIO_PIN_SET( FPGA_MBOX_CS );
+    xSemaphoreGive( fpga_bus );
+
+    return regs;
+#else
+    (void) first;
+    (void) count;
+    return NULL;
+#endif
+}
+
+void fpga_dma_irq( void )
+{
+    BaseType_t woken = pdFALSE;
+    uint32_t bits = 0;
+
+    if ( fpga_task == NULL ) {
+        return;
+    }
+
+    /* The flash TX channel only makes the clocks, its RX channel tells when the block is in */
+    if ( Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, fpga_ch_flash_tx ) &&
+         ( Chip_GPDMA_Interrupt( LPC_GPDMA, fpga_ch_flash_tx ) != SUCCESS ) ) {
+        bits |= FPGA_NOTIFY_ERROR;
+    }
+    if ( Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, fpga_ch_flash_rx ) ) {
+        bits |= ( Chip_GPDMA_Interrupt( LPC_GPDMA, fpga_ch_flash_rx ) == SUCCESS ) ? FPGA_NOTIFY_READ : FPGA_NOTIFY_ERROR;
+    }
+    if ( Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, fpga_ch_cfg_tx ) ) {
+        bits |= ( Chip_GPDMA_Interrupt( LPC_GPDMA, fpga_ch_cfg_tx ) == SUCCESS ) ? FPGA_NOTIFY_SENT : FPGA_NOTIFY_ERROR;
+    }
+    if ( bits != 0 ) {
+        xTaskNotifyFromISR( fpga_task, bits, eSetBits, &woken );
+    }
+
+#ifdef FPGA_MBOX_SSP
+    if ( Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, fpga_ch_mbox_tx ) &&
+         ( Chip_GPDMA_Interrupt( LPC_GPDMA, fpga_ch_mbox_tx ) != SUCCESS ) ) {
+        fpga_mbox_error = 1;
+    }
+    if ( Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, fpga_ch_mbox_rx ) ) {
+        if ( Chip_GPDMA_Interrupt( LPC_GPDMA, fpga_ch_mbox_rx ) != SUCCESS ) {
+            fpga_mbox_error = 1;
+        }
+        xSemaphoreGiveFromISR( fpga_mbox_done, &woken );
+    }
+#endif
+    portYIELD_FROM_ISR( woken );
+}
+
+#else
+
+void fpga_init( void )
+{
+}
+
+uint8_t fpga_load( uint32_t addr, uint32_t len )
+{
+    (void) addr;
+    (void) len;
+    return 0;
+}
+
+const uint8_t * fpga_mbox_read( uint8_t first, uint8_t count )
+{
+    (void) first;
+    (void) count;
+    return NULL;
+}
+
+void fpga_get_status( fpga_status * status )
+{
+    status->state = FPGA_IDLE;
+    status->error = FPGA_ERR_NONE;
+    status->sent = 0;
+    status->len = 0;
+    status->crc = 0;
+    status->elapsed_us = 0;
+}
+
+void fpga_dma_irq( void )
+{
+}
+
+#endif /* FPGA_CFG_SSP */
@@ -0,0 +1,474 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file fru.c
+ *
+ * @brief FRU inventory of the board, cached in RAM and written behind to the EEPROM
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "eeprom.h"
+#include "fru.h"
+#include "init_stage.h"
+#include "ipmi_cache.h"
+#include "idle_job.h"
+#include "log.h"
+#include "device_id.h"
+
+/*! @brief Board FRU image, every length and checksum in it is computed at compile time */
+FRU_IMAGE( fru_image,
+           /* Board info area: manufacturer, name, serial number, part number */
+           DEVICE_MANUFACTURER_NAME, DEVICE_PRODUCT_NAME, "00000001", DEVICE_PART_NUMBER,
+           /* Product info area: manufacturer, name, part/model number, version, serial number */
+           DEVICE_MANUFACTURER_NAME, DEVICE_PRODUCT_NAME, DEVICE_PART_NUMBER, "3.0", "00000001" );
+
+#define FRU_PAGES                   ( FRU_EEPROM_SIZE / FRU_EEPROM_PAGE )
+#define FRU_LOAD_XFERS              ( FRU_EEPROM_SIZE / FRU_LOAD_CHUNK )
+
+/*! @brief RAM copy of the inventory, every FRU read is served from here */
+static uint8_t fru_cache[FRU_EEPROM_SIZE];
+static volatile fru_source fru_state;
+/*! @brief Pages changed in #fru_cache and not yet written to the EEPROM (one bit per page) */
+static uint32_t fru_dirty;
+
+static const eeprom_dev fru_eeprom = {
+    .i2c_id = FRU_EEPROM_I2C,
+    .addr = FRU_EEPROM_ADDR,
+    .addr_len = 1,
+    .size = FRU_EEPROM_SIZE,
+    .page = FRU_EEPROM_PAGE,
+};
+
+/*! @brief Drives both the boot load and the write-behind */
+static TimerHandle_t fru_timer;
+/*! @brief Set while the load or a write is on the bus */
+static uint8_t fru_busy;
+static xI2C_chain fru_chain;
+static xI2C_xfer fru_xfer[FRU_LOAD_XFERS];
+static uint8_t fru_load_addr[FRU_LOAD_XFERS];
+static eeprom_op fru_write_op;
+/*! @brief Entry of the index of the OEM multi-records, see #fru_get_record */
+typedef struct fru_mr_entry {
+    uint32_t mfg_id;
+    uint8_t record_id;
+    uint8_t instance;
+    uint8_t offset;                         /*!< Record data in #fru_cache, 0 for a free slot */
+    uint8_t len;
+} fru_mr_entry;
+
+static fru_mr_entry fru_mr_index[FRU_MR_INDEX_LEN];
+/*! @brief The index no longer matches #fru_cache (written since it was built) */
+static volatile uint8_t fru_mr_stale;
+/*! @brief Next part of #fru_cache the check job looks at: 0 the header, then the chassis, board and product areas */
+static uint8_t fru_check_part;
+
+const uint8_t * fru_default_image( uint16_t * len )
+{
+    *len = sizeof(fru_image);
+    return (const uint8_t *) &fru_image;
+}
+
+/* Sum of a block of bytes, modulo 256 */
+static uint8_t prvFRUSum( const uint8_t * data, uint16_t len )
+{
+    uint8_t sum = 0;
+
+    while ( len-- ) {
+        sum += *data++;
+    }
+    return sum;
+}
+
+/* Zero checksum of a block of bytes */
+static uint8_t prvFRUChecksumOk( const uint8_t * data, uint16_t len )
+{
+    return ( prvFRUSum( data, len ) == 0 );
+}
+
+static uint8_t prvFRUHeaderValid( const uint8_t * image )
+{
+    return ( image[0] == FRU_FORMAT_VERSION ) && prvFRUChecksumOk( image, FRU_BLOCK_SIZE );
+}
+
+/* Checks the info area at offset 2..4 of the header, one that isn't there is fine */
+static uint8_t prvFRUAreaValid( const uint8_t * image, uint8_t area )
+{
+    uint16_t start;
+    uint16_t len;
+
+    if ( image[area] == 0 ) {
+        return 1;
+    }
+    start = image[area] * FRU_BLOCK_SIZE;
+    if ( start + FRU_BLOCK_SIZE > FRU_EEPROM_SIZE ) {
+        return 0;
+    }
+    len = image[start + 1] * FRU_BLOCK_SIZE;
+    return ( len != 0 ) && ( start + len <= FRU_EEPROM_SIZE ) &&
+           ( image[start] == FRU_FORMAT_VERSION ) && prvFRUChecksumOk( &image[start], len );
+}
+
+/* Checks the common header and the board/product areas it points to */
+static uint8_t prvFRUImageValid( const uint8_t * image )
+{
+    uint8_t area;
+
+    if ( !prvFRUHeaderValid( image ) ) {
+        return 0;
+    }
+
+    /* Chassis, board and product info areas (offsets 2..4 of the header) */
+    for ( area = 2; area <= 4; area++ ) {
+        if ( !prvFRUAreaValid( image, area ) ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Home slot of a record in the index, the next ones are probed after it */
+static uint8_t prvFRUMRSlot( uint32_t mfg_id, uint8_t record_id, uint8_t instance )
+{
+    return ( mfg_id ^ ( mfg_id >> 8 ) ^ ( mfg_id >> 16 ) ^ record_id ^ ( instance << 3 ) ) % FRU_MR_INDEX_LEN;
+}
+
+/* Walks the multi-record area of #fru_cache into the index, skipping the records with a bad checksum. Called
+ * with the scheduler locked once the poller may read the cache, the walk is bounded by its 256 bytes */
+static void prvFRUMRIndex( void )
+{
+    uint16_t pos = fru_cache[5] * FRU_BLOCK_SIZE;
+    uint32_t mfg_id;
+    uint8_t instance;
+    uint8_t slot;
+    uint8_t len;
+    uint8_t n;
+    uint8_t i;
+
+    memset( fru_mr_index, 0, sizeof(fru_mr_index) );
+    fru_mr_stale = 0;
+
+    if ( ( pos == 0 ) || !prvFRUHeaderValid( fru_cache ) ) {
+        return;
+    }
+
+    for ( n = 0; n < FRU_MR_INDEX_LEN; ) {
+        if ( ( pos + FRU_MR_HEADER_LEN > FRU_EEPROM_SIZE ) ||
+             ( ( fru_cache[pos + 1] & 0x0F ) != FRU_MR_VERSION ) || !prvFRUChecksumOk( &fru_cache[pos], FRU_MR_HEADER_LEN ) ) {
+            LOG( "fru,mr_bad_header,%u", pos );
+            return;
+        }
+        len = fru_cache[pos + 2];
+        if ( pos + FRU_MR_HEADER_LEN + len > FRU_EEPROM_SIZE ) {
+            LOG( "fru,mr_bad_header,%u", pos );
+            return;
+        }
+
+        if ( (uint8_t)( fru_cache[pos + 3] + prvFRUSum( &fru_cache[pos + FRU_MR_HEADER_LEN], len ) ) != 0 ) {
+            LOG( "fru,mr_bad_checksum,%u", pos );
+        } else if ( ( fru_cache[pos] == FRU_MR_TYPE_OEM ) && ( len >= 4 ) ) {
+            mfg_id = fru_cache[pos + 5] | ( fru_cache[pos + 6] << 8 ) | ( (uint32_t) fru_cache[pos + 7] << 16 );
+
+            /* Instance: records with the same key already indexed */
+            instance = 0;
+            for ( i = 0; i < FRU_MR_INDEX_LEN; i++ ) {
+                if ( ( fru_mr_index[i].offset != 0 ) && ( fru_mr_index[i].mfg_id == mfg_id ) &&
+                     ( fru_mr_index[i].record_id == fru_cache[pos + 8] ) ) {
+                    instance++;
+                }
+            }
+
+            slot = prvFRUMRSlot( mfg_id, fru_cache[pos + 8], instance );
+            while ( fru_mr_index[slot].offset != 0 ) {
+                slot = ( slot + 1 ) % FRU_MR_INDEX_LEN;
+            }
+            fru_mr_index[slot].mfg_id = mfg_id;
+            fru_mr_index[slot].record_id = fru_cache[pos + 8];
+            fru_mr_index[slot].instance = instance;
+            fru_mr_index[slot].offset = pos + FRU_MR_HEADER_LEN;
+            fru_mr_index[slot].len = len;
+            n++;
+        }
+
+        if ( fru_cache[pos + 1] & FRU_MR_END_OF_LIST ) {
+            return;
+        }
+        pos += FRU_MR_HEADER_LEN + len;
+    }
+    LOG( "fru,mr_index_full,%u", pos );
+}
+
+/* Background check of the RAM copy (idle task), one part per slice. Changes not written yet may be
+ * halfway through a shelf manager update, so the pass is skipped while there are some */
+static uint8_t prvFRUCheckStep( void * arg )
+{
+    uint8_t ok;
+
+    (void) arg;
+
+    if ( ( fru_state == FRU_SOURCE_LOADING ) || fru_dirty ) {
+        fru_check_part = 0;
+        return IDLE_JOB_DONE;
+    }
+
+    ok = ( fru_check_part == 0 ) ? prvFRUHeaderValid( fru_cache ) : prvFRUAreaValid( fru_cache, fru_check_part + 1 );
+    if ( !ok ) {
+        LOG( "fru,check_failed,%u", fru_check_part );
+        fru_check_part = 0;
+        return IDLE_JOB_DONE;
+    }
+    if ( ++fru_check_part > 3 ) {
+        fru_check_part = 0;
+        return IDLE_JOB_DONE;
+    }
+    return IDLE_JOB_MORE;
+}
+
+static idle_job fru_check_job = IDLE_JOB( "FRU check", prvFRUCheckStep, NULL, FRU_CHECK_PERIOD );
+
+/* Marks the pages holding [offset, offset + count) as dirty */
+static uint32_t prvFRUPages( uint16_t offset, uint16_t count )
+{
+    uint32_t pages = 0;
+    uint16_t page;
+
+    for ( page = offset / FRU_EEPROM_PAGE; page <= ( offset + count - 1 ) / FRU_EEPROM_PAGE; page++ ) {
+        pages |= ( 1UL << page );
+    }
+    return pages;
+}
+
+/* Whole EEPROM read (chain callback, deferred work daemon) */
+static void prvFRULoaded( xI2C_chain * chain, i2c_err error )
+{
+    uint16_t len;
+    uint16_t i;
+    uint8_t blank = 1;
+
+    fru_busy = 0;
+
+    if ( ( error == i2c_err_SUCCESS ) && prvFRUImageValid( fru_cache ) ) {
+        prvFRUMRIndex();
+        fru_state = FRU_SOURCE_EEPROM;
+        init_stage_done( INIT_STAGE_FRU );
+        return;
+    }
+
+    if ( error == i2c_err_SUCCESS ) {
+        for ( i = 0; i < FRU_EEPROM_SIZE; i++ ) {
+            if ( fru_cache[i] != 0xFF ) {
+                blank = 0;
+                break;
+            }
+        }
+    }
+
+    memset( fru_cache, 0, sizeof(fru_cache) );
+    memcpy( fru_cache, fru_default_image( &len ), len );
+    prvFRUMRIndex();
+    fru_state = FRU_SOURCE_DEFAULT;
+    init_stage_done( INIT_STAGE_FRU );
+
+    /* A blank EEPROM gets the default image, a corrupted one is left alone for inspection */
+    if ( ( error == i2c_err_SUCCESS ) && blank ) {
+        taskENTER_CRITICAL();
+        fru_dirty = prvFRUPages( 0, len );
+        taskEXIT_CRITICAL();
+        xTimerChangePeriod( fru_timer, FRU_FLUSH_DELAY, 0 );
+    }
+}
+
+/* Run of pages written (EEPROM callback, deferred work daemon) */
+static void prvFRUWritten( eeprom_op * op, i2c_err error )
+{
+    TickType_t delay = FRU_FLUSH_DELAY;
+
+    fru_busy = 0;
+
+    if ( error != i2c_err_SUCCESS ) {
+        /* The whole run again later, the pages it did write may not have made it either */
+        taskENTER_CRITICAL();
+        fru_dirty |= prvFRUPages( op->offset, op->len );
+        taskEXIT_CRITICAL();
+        delay = FRU_WRITE_RETRY;
+        LOG( "fru,write_failed,%u,%u,%u", error, op->offset, op->written );
+    }
+
+    if ( fru_dirty ) {
+        /* Pages changed while this run was going on, or another run */
+        xTimerChangePeriod( fru_timer, delay, 0 );
+    }
+}
+
+/* Boot load, then write-behind of the dirty pages, a run of consecutive ones per expiration */
+static void prvFRUTimer( TimerHandle_t timer )
+{
+    uint32_t first;
+    uint32_t last;
+    uint8_t i;
+
+    if ( fru_busy ) {
+        /* The chain callback restarts us */
+        return;
+    }
+
+    if ( fru_state == FRU_SOURCE_LOADING ) {
+        for ( i = 0; i < FRU_LOAD_XFERS; i++ ) {
+            fru_load_addr[i] = i * FRU_LOAD_CHUNK;
+            fru_xfer[i].addr = FRU_EEPROM_ADDR;
+            fru_xfer[i].tx_data = &fru_load_addr[i];
+            fru_xfer[i].tx_len = 1;
+            fru_xfer[i].rx_data = &fru_cache[i * FRU_LOAD_CHUNK];
+            fru_xfer[i].rx_len = FRU_LOAD_CHUNK;
+        }
+        fru_chain.xfer = fru_xfer;
+        fru_chain.count = FRU_LOAD_XFERS;
+        fru_chain.callback = prvFRULoaded;
+
+        fru_busy = 1;
+        if ( xI2CTransferAsync( FRU_EEPROM_I2C, &fru_chain ) != i2c_err_SUCCESS ) {
+            fru_busy = 0;
+            configASSERT( 0 );
+        }
+        return;
+    }
+
+    if ( fru_dirty == 0 ) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    for ( first = 0; !( fru_dirty & ( 1UL << first ) ); first++ );
+    for ( last = first; ( last + 1 < FRU_PAGES ) && ( fru_dirty & ( 1UL << ( last + 1 ) ) ); last++ );
+    /* Cleared before the write, a write arriving meanwhile marks its pages again (the EEPROM driver copies
+     * each page as it goes out, a torn one is written again with the next run) */
+    fru_dirty &= ~prvFRUPages( first * FRU_EEPROM_PAGE, ( last - first + 1 ) * FRU_EEPROM_PAGE );
+    taskEXIT_CRITICAL();
+
+    /* Page after page as fast as the EEPROM takes them, see eeprom.h */
+    fru_busy = 1;
+    if ( !eeprom_write( &fru_write_op, &fru_eeprom, first * FRU_EEPROM_PAGE, &fru_cache[first * FRU_EEPROM_PAGE],
+                        ( last - first + 1 ) * FRU_EEPROM_PAGE, prvFRUWritten, NULL ) ) {
+        fru_busy = 0;
+        configASSERT( 0 );
+    }
+}
+
+void fru_init( void )
+{
+    configASSERT( FRU_PAGES <= 32 );
+
+    fru_state = FRU_SOURCE_LOADING;
+    xI2CRegisterDevice( FRU_EEPROM_I2C, FRU_EEPROM_ADDR, I2C_FAST_MODE_CLOCK );
+
+    /* The load runs once the scheduler (and the timer service task) is up */
+    fru_timer = xTimerCreate( "FRU", 1, pdFALSE, NULL, prvFRUTimer );
+    configASSERT( fru_timer );
+    xTimerStart( fru_timer, 0 );
+
+    idle_job_start( &fru_check_job );
+}
+
+fru_source fru_get_source( void )
+{
+    return fru_state;
+}
+
+uint16_t fru_size( void )
+{
+    return FRU_EEPROM_SIZE;
+}
+
+uint8_t fru_read( uint16_t offset, uint8_t * data, uint8_t count )
+{
+    if ( ( fru_state == FRU_SOURCE_LOADING ) || ( offset >= FRU_EEPROM_SIZE ) ) {
+        return 0;
+    }
+    if ( count > FRU_EEPROM_SIZE - offset ) {
+        count = FRU_EEPROM_SIZE - offset;
+    }
+
+    taskENTER_CRITICAL();
+    memcpy( data, &fru_cache[offset], count );
+    taskEXIT_CRITICAL();
+    return count;
+}
+
+uint8_t fru_write( uint16_t offset, const uint8_t * data, uint8_t count )
+{
+    if ( ( fru_state == FRU_SOURCE_LOADING ) || ( offset >= FRU_EEPROM_SIZE ) || ( count == 0 ) ) {
+        return 0;
+    }
+    if ( count > FRU_EEPROM_SIZE - offset ) {
+        count = FRU_EEPROM_SIZE - offset;
+    }
+
+    taskENTER_CRITICAL();
+    memcpy( &fru_cache[offset], data, count );
+    fru_dirty |= prvFRUPages( offset, count );
+    fru_mr_stale = 1;
+    taskEXIT_CRITICAL();
+    ipmi_cache_invalidate( IPMI_CACHE_FRU );
+
+    /* Restarted by every write, so a burst is committed once it's over */
+    xTimerChangePeriod( fru_timer, FRU_FLUSH_DELAY, 0 );
+    return count;
+}
+
+uint8_t fru_get_record( uint32_t mfg_id, uint8_t record_id, uint8_t instance, uint8_t * data, uint8_t max )
+{
+    fru_mr_entry * entry;
+    uint8_t slot;
+    uint8_t probes;
+    uint8_t len = 0;
+
+    if ( fru_state == FRU_SOURCE_LOADING ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    if ( fru_mr_stale ) {
+        prvFRUMRIndex();
+    }
+    slot = prvFRUMRSlot( mfg_id, record_id, instance );
+    for ( probes = 0; probes < FRU_MR_INDEX_LEN; probes++ ) {
+        entry = &fru_mr_index[slot];
+        if ( entry->offset == 0 ) {
+            break;
+        }
+        if ( ( entry->mfg_id == mfg_id ) && ( entry->record_id == record_id ) && ( entry->instance == instance ) ) {
+            len = entry->len;
+            memcpy( data, &fru_cache[entry->offset], ( len < max ) ? len : max );
+            break;
+        }
+        slot = ( slot + 1 ) % FRU_MR_INDEX_LEN;
+    }
+    taskEXIT_CRITICAL();
+
+    return len;
+}
@@ -0,0 +1,100 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file gpio_irq.c
+ *
+ * @brief GPIO edge interrupts, dispatched from EINT3
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Project includes */
+#include "chip.h"
+#include "gpio_irq.h"
+
+static struct {
+    uint8_t port;
+    uint8_t pin;
+    gpio_irq_handler handler;
+    void * arg;
+} gpio_irq_pins[GPIO_IRQ_MAX];
+static uint8_t gpio_irq_num;
+
+uint8_t gpio_irq_register( uint8_t port, uint8_t pin, gpio_irq_handler handler, void * arg )
+{
+    if ( ( ( port != GPIOINT_PORT0 ) && ( port != GPIOINT_PORT2 ) ) || ( gpio_irq_num == GPIO_IRQ_MAX ) ) {
+        return 0;
+    }
+
+    if ( gpio_irq_num == 0 ) {
+        Chip_GPIOINT_Init( LPC_GPIOINT );
+        NVIC_SetPriority( EINT3_IRQn, GPIO_IRQ_PRIORITY );
+        NVIC_EnableIRQ( EINT3_IRQn );
+    }
+
+    gpio_irq_enable( port, pin, GPIO_IRQ_NONE );
+    gpio_irq_pins[gpio_irq_num].port = port;
+    gpio_irq_pins[gpio_irq_num].pin = pin;
+    gpio_irq_pins[gpio_irq_num].handler = handler;
+    gpio_irq_pins[gpio_irq_num].arg = arg;
+    gpio_irq_num++;
+    return 1;
+}
+
+void gpio_irq_enable( uint8_t port, uint8_t pin, uint8_t edges )
+{
+    uint32_t mask = 1 << pin;
+    uint32_t rising;
+    uint32_t falling;
+    UBaseType_t saved;
+
+    /* The enable registers are shared by the pins of the port, and this may run in any context */
+    saved = portSET_INTERRUPT_MASK_FROM_ISR();
+    rising = Chip_GPIOINT_GetIntRising( LPC_GPIOINT, port ) & ~mask;
+    falling = Chip_GPIOINT_GetIntFalling( LPC_GPIOINT, port ) & ~mask;
+    Chip_GPIOINT_ClearIntStatus( LPC_GPIOINT, port, mask );
+    Chip_GPIOINT_SetIntRising( LPC_GPIOINT, port, rising | ( ( edges & GPIO_IRQ_RISING ) ? mask : 0 ) );
+    Chip_GPIOINT_SetIntFalling( LPC_GPIOINT, port, falling | ( ( edges & GPIO_IRQ_FALLING ) ? mask : 0 ) );
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( saved );
+}
+
+void EINT3_IRQHandler( void )
+{
+    portBASE_TYPE woken = pdFALSE;
+    uint32_t status[GPIOINT_PORT2 + 1];
+    uint8_t i;
+
+    status[GPIOINT_PORT0] = Chip_GPIOINT_GetStatusRising( LPC_GPIOINT, GPIOINT_PORT0 ) |
+                            Chip_GPIOINT_GetStatusFalling( LPC_GPIOINT, GPIOINT_PORT0 );
+    status[GPIOINT_PORT2] = Chip_GPIOINT_GetStatusRising( LPC_GPIOINT, GPIOINT_PORT2 ) |
+                            Chip_GPIOINT_GetStatusFalling( LPC_GPIOINT, GPIOINT_PORT2 );
+    Chip_GPIOINT_ClearIntStatus( LPC_GPIOINT, GPIOINT_PORT0, status[GPIOINT_PORT0] );
+    Chip_GPIOINT_ClearIntStatus( LPC_GPIOINT, GPIOINT_PORT2, status[GPIOINT_PORT2] );
+
+    for ( i = 0; i < gpio_irq_num; i++ ) {
+        if ( status[gpio_irq_pins[i].port] & ( 1 << gpio_irq_pins[i].pin ) ) {
+            gpio_irq_pins[i].handler( gpio_irq_pins[i].arg, &woken );
+        }
+    }
+    portEND_SWITCHING_ISR( woken );
+}
@@ -0,0 +1,306 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file hotswap.c
+ *
+ * @brief Hot swap handle, from its GPIO interrupt and a debounce timer, and the M-state machine
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "timers.h"
+
+/* Project includes */
+#include "chip.h"
+#include "board_defs.h"
+#include "gpio.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmi.h"
+#include "event.h"
+#include "led.h"
+#include "sdr.h"
+#include "board_sensors.h"
+#include "gpio_irq.h"
+#include "payload.h"
+#include "ekey.h"
+#include "hotswap.h"
+
+/*! @brief Event data 1 of a Hot Swap event: data 2 and 3 are used, current state in the offset */
+#define HOTSWAP_EVENT_DATA1( state )    ( 0xA0 | ( state ) )
+
+/*! @brief Action of a transition, run in the new state; returns the next event to run (#HOTSWAP_EVT_NONE if none) */
+typedef hotswap_event (* hotswap_action)( void );
+
+typedef struct hotswap_transition {
+    uint8_t state;
+    uint8_t event;
+    uint8_t next;
+    hotswap_action action;
+} hotswap_transition;
+
+/*! @brief Blue LED pattern of each state, see #led_set_local */
+typedef struct hotswap_led {
+    uint8_t set;                            /*!< 0 leaves the LED as it was */
+    uint8_t function;
+    uint8_t on_duration;
+} hotswap_led;
+
+static hotswap_event prvHotSwapPayloadOn( void );
+static hotswap_event prvHotSwapPayloadOff( void );
+static hotswap_event prvHotSwapPayloadReset( void );
+
+static const hotswap_transition hotswap_table[] = {
+    { HOTSWAP_M0, HOTSWAP_EVT_INSERTED,         HOTSWAP_M1, NULL },
+    { HOTSWAP_M1, HOTSWAP_EVT_HANDLE_CLOSED,    HOTSWAP_M2, NULL },
+    { HOTSWAP_M2, HOTSWAP_EVT_HANDLE_OPENED,    HOTSWAP_M1, NULL },
+    { HOTSWAP_M2, HOTSWAP_EVT_ACTIVATE,         HOTSWAP_M3, prvHotSwapPayloadOn },
+    { HOTSWAP_M2, HOTSWAP_EVT_DEACTIVATE,       HOTSWAP_M1, NULL },
+    { HOTSWAP_M3, HOTSWAP_EVT_ACTIVATED,        HOTSWAP_M4, NULL },
+    { HOTSWAP_M3, HOTSWAP_EVT_ACTIVATION_FAILED, HOTSWAP_M6, prvHotSwapPayloadOff },
+    { HOTSWAP_M3, HOTSWAP_EVT_HANDLE_OPENED,    HOTSWAP_M6, prvHotSwapPayloadOff },
+    { HOTSWAP_M3, HOTSWAP_EVT_DEACTIVATE,       HOTSWAP_M6, prvHotSwapPayloadOff },
+    { HOTSWAP_M4, HOTSWAP_EVT_HANDLE_OPENED,    HOTSWAP_M5, NULL },
+    { HOTSWAP_M4, HOTSWAP_EVT_DEACTIVATE,       HOTSWAP_M6, prvHotSwapPayloadOff },
+    { HOTSWAP_M4, HOTSWAP_EVT_COLD_RESET,       HOTSWAP_M4, prvHotSwapPayloadReset },
+    { HOTSWAP_M4, HOTSWAP_EVT_ACTIVATION_FAILED, HOTSWAP_M6, prvHotSwapPayloadOff },
+    { HOTSWAP_M5, HOTSWAP_EVT_HANDLE_CLOSED,    HOTSWAP_M4, NULL },
+    { HOTSWAP_M5, HOTSWAP_EVT_ACTIVATE,         HOTSWAP_M4, NULL },
+    { HOTSWAP_M5, HOTSWAP_EVT_DEACTIVATE,       HOTSWAP_M6, prvHotSwapPayloadOff },
+    { HOTSWAP_M6, HOTSWAP_EVT_DEACTIVATED,      HOTSWAP_M1, NULL },
+};
+
+#define HOTSWAP_TABLE_LEN           ( sizeof(hotswap_table) / sizeof(hotswap_table[0]) )
+
+/* Blinks: long is 900 ms on / 100 ms off, short is 100 ms on / 900 ms off */
+static const hotswap_led hotswap_leds[] = {
+    [HOTSWAP_M0] = { 1, LED_FUNC_OFF, 0 },
+    [HOTSWAP_M1] = { 1, LED_FUNC_ON, 0 },
+    [HOTSWAP_M2] = { 1, 10, 90 },
+    [HOTSWAP_M3] = { 1, LED_FUNC_OFF, 0 },
+    [HOTSWAP_M4] = { 1, LED_FUNC_OFF, 0 },
+    [HOTSWAP_M5] = { 1, 90, 10 },
+    [HOTSWAP_M6] = { 1, 90, 10 },
+    [HOTSWAP_M7] = { 0, 0, 0 },
+};
+
+static const uint8_t hotswap_cause[HOTSWAP_EVT_COUNT] = {
+    [HOTSWAP_EVT_HANDLE_CLOSED] = HOTSWAP_CAUSE_HANDLE,
+    [HOTSWAP_EVT_HANDLE_OPENED] = HOTSWAP_CAUSE_HANDLE,
+    [HOTSWAP_EVT_ACTIVATE] = HOTSWAP_CAUSE_SHELF_MANAGER,
+    [HOTSWAP_EVT_DEACTIVATE] = HOTSWAP_CAUSE_SHELF_MANAGER,
+    [HOTSWAP_EVT_ACTIVATION_FAILED] = HOTSWAP_CAUSE_UNEXPECTED,
+};
+
+/*! @brief Current M-state, only written by the timer task */
+static volatile uint8_t hotswap_state_cur = HOTSWAP_M0;
+
+static TimerHandle_t hotswap_debounce_timer;
+/*! @brief Debounced level, only written by the timer task (and #hotswap_init) */
+static volatile uint8_t hotswap_closed;
+static volatile uint32_t hotswap_changes;
+
+static uint8_t prvHotSwapReadHandle( void )
+{
+    return !GPIO_PIN_READ( HOT_SWAP_HANDLE );
+}
+
+static void prvHotSwapRun( hotswap_event event );
+
+/* Sequencer done callbacks, called in the timer task like the rest of the machine */
+static void prvHotSwapPayloadUp( uint8_t ok )
+{
+    prvHotSwapRun( ok ? HOTSWAP_EVT_ACTIVATED : HOTSWAP_EVT_ACTIVATION_FAILED );
+}
+
+static void prvHotSwapPayloadDown( uint8_t ok )
+{
+    (void) ok;
+
+    prvHotSwapRun( HOTSWAP_EVT_DEACTIVATED );
+}
+
+/* Second half of a cold reset, the payload stays in M4 */
+static void prvHotSwapResetDown( uint8_t ok )
+{
+    (void) ok;
+
+    if ( !payload_power( 1, prvHotSwapPayloadUp ) ) {
+        prvHotSwapRun( HOTSWAP_EVT_ACTIVATION_FAILED );
+    }
+}
+
+/* The sequence is pended to the timer task, which is running this: it starts as soon as the machine returns */
+static hotswap_event prvHotSwapPayloadOn( void )
+{
+    return payload_power( 1, prvHotSwapPayloadUp ) ? HOTSWAP_EVT_NONE : HOTSWAP_EVT_ACTIVATION_FAILED;
+}
+
+/* With the timer queue full the rails are left as they are, which is where an activation that couldn't start left them */
+static hotswap_event prvHotSwapPayloadOff( void )
+{
+    /* Out of M4 the module has no enabled links (AMC.0 E-Keying) */
+    ekey_disable_all();
+    return payload_power( 0, prvHotSwapPayloadDown ) ? HOTSWAP_EVT_NONE : HOTSWAP_EVT_DEACTIVATED;
+}
+
+static hotswap_event prvHotSwapPayloadReset( void )
+{
+    return payload_power( 0, prvHotSwapResetDown ) ? HOTSWAP_EVT_NONE : HOTSWAP_EVT_ACTIVATION_FAILED;
+}
+
+static void prvHotSwapEnter( uint8_t prev, uint8_t state, uint8_t cause )
+{
+    ipmi_event event;
+
+    hotswap_state_cur = state;
+
+    if ( hotswap_leds[state].set ) {
+        led_set_local( LED_BLUE, hotswap_leds[state].function, hotswap_leds[state].on_duration );
+    }
+
+    event.sensor_type = HOTSWAP_SENSOR_TYPE;
+    event.sensor_num = SENSOR_HOT_SWAP;
+    event.dir_type = SDR_EVENT_TYPE_SENSOR_SPECIFIC;
+    event.data[0] = HOTSWAP_EVENT_DATA1( state );
+    event.data[1] = ( cause << 4 ) | prev;
+    event.data[2] = FRU_DEVICE_ID;
+    event_post( &event );
+}
+
+/* Runs an event and the ones its actions chain, timer task only */
+static void prvHotSwapRun( hotswap_event event )
+{
+    const hotswap_transition * t;
+    uint8_t state;
+    uint8_t i;
+
+    while ( event != HOTSWAP_EVT_NONE ) {
+        state = hotswap_state_cur;
+
+        for ( i = 0; i < HOTSWAP_TABLE_LEN; i++ ) {
+            if ( ( hotswap_table[i].state == state ) && ( hotswap_table[i].event == event ) ) {
+                break;
+            }
+        }
+        if ( i == HOTSWAP_TABLE_LEN ) {
+            /* Not expected in this state */
+            return;
+        }
+
+        t = &hotswap_table[i];
+        if ( t->next != state ) {
+            prvHotSwapEnter( state, t->next, hotswap_cause[event] );
+        }
+        event = t->action ? t->action() : HOTSWAP_EVT_NONE;
+    }
+}
+
+static void prvHotSwapPended( void * param, uint32_t event )
+{
+    (void) param;
+
+    prvHotSwapRun( (hotswap_event) event );
+}
+
+/* First run of the machine, once the scheduler is up */
+static void prvHotSwapStart( void * param, uint32_t unused )
+{
+    (void) param;
+    (void) unused;
+
+    prvHotSwapRun( HOTSWAP_EVT_INSERTED );
+    if ( hotswap_closed ) {
+        prvHotSwapRun( HOTSWAP_EVT_HANDLE_CLOSED );
+    }
+}
+
+/* A debounced handle change, input of the hot swap state machine */
+static void prvHotSwapHandleEvent( uint8_t closed )
+{
+    hotswap_closed = closed;
+    hotswap_changes++;
+    prvHotSwapRun( closed ? HOTSWAP_EVT_HANDLE_CLOSED : HOTSWAP_EVT_HANDLE_OPENED );
+}
+
+static void prvHotSwapDebounce( TimerHandle_t timer )
+{
+    uint8_t closed;
+
+    (void) timer;
+
+    /* Unmask before reading, so a change from now on starts another debounce instead of being missed */
+    gpio_irq_enable( HOT_SWAP_HANDLE_PORT, HOT_SWAP_HANDLE_PIN, GPIO_IRQ_BOTH );
+    closed = prvHotSwapReadHandle();
+    if ( closed != hotswap_closed ) {
+        prvHotSwapHandleEvent( closed );
+    }
+}
+
+static void prvHotSwapHandleEdge( void * arg, portBASE_TYPE * woken )
+{
+    (void) arg;
+
+    /* Masked until the debounce is over. If the timer queue is full the pin stays unmasked, the next bounce tries again */
+    if ( xTimerStartFromISR( hotswap_debounce_timer, woken ) == pdPASS ) {
+        gpio_irq_enable( HOT_SWAP_HANDLE_PORT, HOT_SWAP_HANDLE_PIN, GPIO_IRQ_NONE );
+    }
+}
+
+void hotswap_init( void )
+{
+    hotswap_debounce_timer = xTimerCreate( "Handle", HOTSWAP_DEBOUNCE, pdFALSE, NULL, prvHotSwapDebounce );
+    configASSERT( hotswap_debounce_timer );
+
+    Chip_IOCON_PinMux( LPC_IOCON, HOT_SWAP_HANDLE_PORT, HOT_SWAP_HANDLE_PIN, IOCON_MODE_PULLUP, IOCON_FUNC0 );
+    GPIO_PIN_SET_DIR( HOT_SWAP_HANDLE, 0 );
+
+    /* No bouncing at power up */
+    hotswap_closed = prvHotSwapReadHandle();
+
+    gpio_irq_register( HOT_SWAP_HANDLE_PORT, HOT_SWAP_HANDLE_PIN, prvHotSwapHandleEdge, NULL );
+    gpio_irq_enable( HOT_SWAP_HANDLE_PORT, HOT_SWAP_HANDLE_PIN, GPIO_IRQ_BOTH );
+
+    /* The timer command queue exists since the debounce timer was created */
+    xTimerPendFunctionCall( prvHotSwapStart, NULL, 0, 0 );
+}
+
+uint8_t hotswap_handle_closed( void )
+{
+    return hotswap_closed;
+}
+
+uint32_t hotswap_handle_changes( void )
+{
+    return hotswap_changes;
+}
+
+hotswap_state hotswap_get_state( void )
+{
+    return hotswap_state_cur;
+}
+
+uint8_t hotswap_post( hotswap_event event )
+{
+    return xTimerPendFunctionCall( prvHotSwapPended, NULL, event, 0 ) == pdPASS;
+}
@@ -0,0 +1,646 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file hpm.c
+ *
+ * @brief HPM.1 upload into the slot not running, with the flash writes done by the HPM task
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "stddef.h"
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "ipmb.h"
+#include "ipmi.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "image.h"
+#include "init_stage.h"
+#include "hpm.h"
+#include "idle_job.h"
+#include "log.h"
+#include "clock.h"
+#include "lz4_stream.h"
+
+#if ( HPM_WRITE_CHUNK != 256 ) && ( HPM_WRITE_CHUNK != 512 ) && ( HPM_WRITE_CHUNK != 1024 ) && ( HPM_WRITE_CHUNK != 4096 )
+#error "HPM_WRITE_CHUNK must be a Chip_IAP_CopyRamToFlash size"
+#endif
+
+#if HPM_WRITE_CHUNK < IMAGE_ROW
+#error "HPM_WRITE_CHUNK must hold the header row"
+#endif
+
+#define HPM_QUEUE_LEN               ( HPM_BUFFERS + 2 )
+
+/*! @brief Whole chunks before the header row, the ones a delta upload can reuse */
+#define HPM_CHUNKS                  ( IMAGE_HEADER_OFFSET / HPM_WRITE_CHUNK )
+
+#if HPM_DELTA_CRCS > 8
+#error "The chunks of a manifest request must fit in the bitmap of its response"
+#endif
+
+/*! @brief Work of the HPM task */
+typedef enum hpm_op_id {
+    HPM_OP_ERASE,
+    HPM_OP_WRITE,
+    HPM_OP_VERIFY,
+    HPM_OP_ACTIVATE,
+    HPM_OP_COPY,
+} hpm_op_id;
+
+typedef struct hpm_op {
+    uint8_t op;
+    uint8_t buf;                            /*!< #HPM_OP_WRITE: buffer to write, #HPM_OP_COPY: bit i set to copy chunk offset + i */
+    uint32_t offset;                        /*!< #HPM_OP_WRITE: where in the slot, #HPM_OP_VERIFY: upload length, #HPM_OP_COPY: first chunk */
+} hpm_op;
+
+/*! @brief Upgrade states. The IPMI task moves out of the idle, upload and ready ones, the HPM task out of the others */
+typedef enum hpm_state {
+    HPM_IDLE,
+    HPM_ERASING,
+    HPM_UPLOAD,
+    HPM_FINISHING,
+    HPM_READY,                              /*!< Image uploaded and checked, waiting for Activate Firmware */
+    HPM_ACTIVATING,
+} hpm_state;
+
+static uint32_t hpm_buf[HPM_BUFFERS][HPM_WRITE_CHUNK / 4] __RAM_AHB_NOINIT;
+/*! @brief Chunk of the running image being copied, HPM task only */
+static uint32_t hpm_copy_buf[HPM_WRITE_CHUNK / 4] __RAM_AHB_NOINIT;
+/*! @brief Set by the IPMI task when a buffer is queued, cleared by the HPM task once it's written */
+static volatile uint8_t hpm_buf_busy[HPM_BUFFERS];
+
+static volatile uint8_t hpm_state_cur = HPM_IDLE;
+static volatile uint8_t hpm_status_cmd;
+static volatile uint8_t hpm_status_cc;
+/*! @brief An IAP write failed since the last erase, only the HPM task writes it */
+static volatile uint8_t hpm_write_failed;
+
+/* Upload progress, IPMI task only */
+static uint8_t hpm_fill;                    /*!< Buffer being filled */
+static uint16_t hpm_fill_len;
+static uint32_t hpm_offset;                 /*!< Bytes uploaded */
+static uint8_t hpm_block;                   /*!< Next block number */
+static uint8_t hpm_slot;                    /*!< Slot being upgraded */
+static uint16_t hpm_dest;                   /*!< Chunk the next full buffer goes to */
+
+/* Delta manifest, IPMI task only: chunks copied from the running image instead of uploaded */
+static uint8_t hpm_reuse[( HPM_CHUNKS + 7 ) / 8];
+static uint16_t hpm_reused;
+static uint16_t hpm_delta_first;            /*!< First chunk of the last manifest request, answered again on a retry */
+static uint16_t hpm_delta_next;
+static uint8_t hpm_delta_match;
+
+/* Compressed upload, IPMI task only */
+static uint8_t hpm_z;                       /*!< The upload is compressed */
+static uint8_t hpm_z_consumed;              /*!< Bytes of the current block decoded, it was answered NODE_BUSY */
+static uint32_t hpm_z_out;                  /*!< Bytes decoded */
+static lz4_stream hpm_z_stream;
+
+/*! @brief Header of the uploaded image, kept by the check for Activate Firmware */
+static image_header hpm_header;
+
+static QueueHandle_t hpm_queue;
+/* Background check of the running image: bytes done and CRC so far */
+static uint32_t hpm_scrub_offset;
+static uint32_t hpm_scrub_crc;
+TASK_STACK( hpm_stack, HPM_STACK_DEPTH, 1 );
+
+/* Long command started: Get Upgrade Status says it's in progress until the HPM task is done with it */
+static void prvHPMStatus( uint8_t cmd, uint8_t cc )
+{
+    taskENTER_CRITICAL();
+    hpm_status_cmd = cmd;
+    hpm_status_cc = cc;
+    taskEXIT_CRITICAL();
+}
+
+static uint8_t prvHPMErase( void )
+{
+    uint32_t base = IMAGE_SLOT_BASE( hpm_slot );
+
+    return image_flash_erase( IMAGE_SECTOR( base ), IMAGE_SECTOR( base + IMAGE_SLOT_SIZE - 1 ) );
+}
+
+/* Word of the running image as it reads once linked for the slot being upgraded: addresses in the running slot
+ * move to the other one, the rest (code, constants, RAM addresses) stays as it is */
+static uint32_t prvHPMRelocate( uint32_t word )
+{
+    uint32_t from = IMAGE_SLOT_BASE( hpm_slot ^ 1 );
+
+    if ( ( word >= from ) && ( word < from + IMAGE_SLOT_SIZE ) ) {
+        return word - from + IMAGE_SLOT_BASE( hpm_slot );
+    }
+    return word;
+}
+
+/* CRC of a chunk of the running image, relocated */
+static uint32_t prvHPMChunkCrc( uint16_t chunk )
+{
+    const uint32_t * src = (const uint32_t *) ( IMAGE_SLOT_BASE( hpm_slot ^ 1 ) + chunk * HPM_WRITE_CHUNK );
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t word;
+    uint16_t i;
+
+    for ( i = 0; i < HPM_WRITE_CHUNK / 4; i++ ) {
+        word = prvHPMRelocate( src[i] );
+        crc = image_crc32_update( crc, &word, sizeof(word) );
+    }
+    return ~crc;
+}
+
+/* Programs a chunk of the slot from the running image, relocated (HPM task) */
+static uint8_t prvHPMCopy( uint16_t chunk )
+{
+    const uint32_t * src = (const uint32_t *) ( IMAGE_SLOT_BASE( hpm_slot ^ 1 ) + chunk * HPM_WRITE_CHUNK );
+    uint16_t i;
+
+    for ( i = 0; i < HPM_WRITE_CHUNK / 4; i++ ) {
+        hpm_copy_buf[i] = prvHPMRelocate( src[i] );
+    }
+    return image_flash_write( IMAGE_SLOT_BASE( hpm_slot ) + chunk * HPM_WRITE_CHUNK, hpm_copy_buf, HPM_WRITE_CHUNK );
+}
+
+/* The upload ends with the header of the image: the whole image must match it, and start in its slot */
+static uint8_t prvHPMValid( uint32_t len )
+{
+    uint32_t base = IMAGE_SLOT_BASE( hpm_slot );
+    const uint32_t * vectors = (const uint32_t *) base;
+    uint32_t entry;
+
+    if ( hpm_write_failed || ( len < sizeof(image_header) + 8 ) ) {
+        return 0;
+    }
+    memcpy( &hpm_header, (const uint8_t *) base + len - sizeof(image_header), sizeof(image_header) );
+    if ( ( hpm_header.magic != IMAGE_MAGIC ) || ( hpm_header.length != len - sizeof(image_header) ) ||
+         ( hpm_header.image_crc != image_crc32( vectors, hpm_header.length ) ) ) {
+        return 0;
+    }
+    /* Linked for the other slot, it would start and crash */
+    entry = vectors[1] & ~1;
+    return ( vectors[1] & 1 ) && ( entry >= base ) && ( entry < base + hpm_header.length );
+}
+
+/* Header row with the next sequence number: the boot loader picks the slot after the reset */
+static uint8_t prvHPMActivate( void )
+{
+    uint32_t * row = hpm_buf[0];
+
+    memset( row, 0xFF, IMAGE_ROW );
+    hpm_header.sequence = image_get_header( hpm_slot ^ 1 )->sequence + 1;
+    hpm_header.header_crc = image_crc32( &hpm_header, offsetof(image_header, header_crc) );
+    memcpy( row, &hpm_header, sizeof(image_header) );
+
+    return image_flash_write( IMAGE_SLOT_BASE( hpm_slot ) + IMAGE_HEADER_OFFSET, row, IMAGE_ROW );
+}
+
+static void HPMTask( void * pvParameters )
+{
+    hpm_op op;
+    uint8_t ok;
+    uint8_t i;
+
+    (void) pvParameters;
+
+    for ( ;; ) {
+        xQueueReceive( hpm_queue, &op, portMAX_DELAY );
+        /* Erase, writes and CRC of the upgrade on the full clock, until the queue runs dry */
+        clock_boost( CLOCK_BOOST_HPM, 1 );
+
+        switch ( op.op ) {
+        case HPM_OP_ERASE:
+            hpm_write_failed = 0;
+            ok = prvHPMErase();
+            hpm_state_cur = ok ? HPM_UPLOAD : HPM_IDLE;
+            prvHPMStatus( IPMI_PICMG_CMD_HPM_INITIATE_UPGRADE_ACTION, ok ? IPMI_CC_OK : IPMI_CC_UNSPECIFIED_ERROR );
+            break;
+        case HPM_OP_WRITE:
+            if ( !image_flash_write( IMAGE_SLOT_BASE( hpm_slot ) + op.offset, hpm_buf[op.buf], HPM_WRITE_CHUNK ) ) {
+                hpm_write_failed = 1;
+            }
+            hpm_buf_busy[op.buf] = 0;
+            break;
+        case HPM_OP_COPY:
+            for ( i = 0; i < HPM_DELTA_CRCS; i++ ) {
+                if ( ( op.buf & ( 1 << i ) ) && !prvHPMCopy( op.offset + i ) ) {
+                    hpm_write_failed = 1;
+                }
+            }
+            break;
+        case HPM_OP_VERIFY:
+            /* Queued after the last write, the whole image is in flash */
+            ok = prvHPMValid( op.offset );
+            hpm_state_cur = ok ? HPM_READY : HPM_IDLE;
+            prvHPMStatus( IPMI_PICMG_CMD_HPM_FINISH_FIRMWARE_UPLOAD, ok ? IPMI_CC_OK : HPM_CC_CHECKSUM );
+            break;
+        case HPM_OP_ACTIVATE:
+            vTaskDelay( HPM_ACTIVATE_DELAY );
+            if ( prvHPMActivate() ) {
+                NVIC_SystemReset();
+            }
+            hpm_state_cur = HPM_IDLE;
+            prvHPMStatus( IPMI_PICMG_CMD_HPM_ACTIVATE_FIRMWARE, IPMI_CC_UNSPECIFIED_ERROR );
+            break;
+        default:
+            break;
+        }
+        if ( uxQueueMessagesWaiting( hpm_queue ) == 0 ) {
+            clock_boost( CLOCK_BOOST_HPM, 0 );
+        }
+    }
+}
+
+/* One slice of the check of the running image (idle task) */
+static uint8_t prvHPMScrubStep( void * arg )
+{
+    uint8_t slot = image_running_slot();
+    const image_header * header;
+    const uint8_t * base;
+    uint32_t len;
+
+    (void) arg;
+
+    /* Linked to run without the boot loader, there's no header to check against */
+    if ( ( slot == IMAGE_SLOT_NONE ) || !image_slot_valid( slot ) ) {
+        return IDLE_JOB_DONE;
+    }
+    header = image_get_header( slot );
+    base = (const uint8_t *) IMAGE_SLOT_BASE( slot );
+
+    if ( hpm_scrub_offset == 0 ) {
+        hpm_scrub_crc = 0xFFFFFFFF;
+    }
+    len = header->length - hpm_scrub_offset;
+    if ( len > HPM_SCRUB_SLICE ) {
+        len = HPM_SCRUB_SLICE;
+    }
+    hpm_scrub_crc = image_crc32_update( hpm_scrub_crc, base + hpm_scrub_offset, len );
+    hpm_scrub_offset += len;
+
+    if ( hpm_scrub_offset < header->length ) {
+        return IDLE_JOB_MORE;
+    }
+    if ( ~hpm_scrub_crc != header->image_crc ) {
+        LOG( "hpm,image_crc,%u,%x,%x", slot, ~hpm_scrub_crc, header->image_crc );
+    }
+    hpm_scrub_offset = 0;
+    return IDLE_JOB_DONE;
+}
+
+static idle_job hpm_scrub_job = IDLE_JOB( "Image check", prvHPMScrubStep, NULL, HPM_SCRUB_PERIOD );
+
+static uint8_t prvHPMQueue( uint8_t op, uint8_t buf, uint32_t offset )
+{
+    hpm_op item = { op, buf, offset };
+
+    return xQueueSend( hpm_queue, &item, 0 ) == pdTRUE;
+}
+
+void hpm_init( void )
+{
+    hpm_queue = xQueueCreate( HPM_QUEUE_LEN, sizeof(hpm_op) );
+    configASSERT( hpm_queue );
+    queue_stats_register( hpm_queue, "HPM" );
+
+    xTaskCreateWithStack( HPMTask, (const char*)"HPM", HPM_STACK_DEPTH, ( void * ) NULL, HPM_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( hpm_stack, 0 ) );
+    idle_job_start( &hpm_scrub_job );
+    init_stage_done( INIT_STAGE_HPM );
+}
+
+uint8_t hpm_components( void )
+{
+    uint8_t slot = image_running_slot();
+
+    return ( slot == IMAGE_SLOT_NONE ) ? 0 : HPM_COMPONENT( slot ^ 1 );
+}
+
+uint8_t hpm_initiate( uint8_t components, uint8_t action )
+{
+    /* Linked to run on its own, there's no other slot to write to */
+    if ( hpm_components() == 0 ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+    if ( ( components != hpm_components() ) ||
+         ( ( action != HPM_ACTION_PREPARE ) && ( action != HPM_ACTION_UPLOAD ) ) ) {
+        return IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    }
+    if ( ( hpm_state_cur == HPM_ERASING ) || ( hpm_state_cur == HPM_FINISHING ) || ( hpm_state_cur == HPM_ACTIVATING ) ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+
+    hpm_slot = image_running_slot() ^ 1;
+    hpm_state_cur = HPM_ERASING;
+    prvHPMStatus( IPMI_PICMG_CMD_HPM_INITIATE_UPGRADE_ACTION, HPM_CC_IN_PROGRESS );
+    if ( !prvHPMQueue( HPM_OP_ERASE, 0, 0 ) ) {
+        hpm_state_cur = HPM_IDLE;
+        prvHPMStatus( IPMI_PICMG_CMD_HPM_INITIATE_UPGRADE_ACTION, IPMI_CC_NODE_BUSY );
+        return IPMI_CC_NODE_BUSY;
+    }
+
+    hpm_fill_len = 0;
+    hpm_offset = 0;
+    hpm_block = 0;
+    hpm_dest = 0;
+    memset( hpm_reuse, 0, sizeof(hpm_reuse) );
+    hpm_reused = 0;
+    hpm_delta_next = 0;
+    hpm_z = 0;
+    return HPM_CC_IN_PROGRESS;
+}
+
+static uint8_t prvHPMReused( uint16_t chunk )
+{
+    return ( chunk < HPM_CHUNKS ) && ( hpm_reuse[chunk / 8] & ( 1 << ( chunk % 8 ) ) );
+}
+
+/* Slot offset of the next buffer of uploaded bytes: the next chunk the manifest didn't reuse */
+static uint32_t prvHPMNextChunk( void )
+{
+    while ( prvHPMReused( hpm_dest ) ) {
+        hpm_dest++;
+    }
+    return hpm_dest++ * HPM_WRITE_CHUNK;
+}
+
+uint8_t hpm_delta( uint16_t first, const uint8_t * crcs, uint8_t count, uint8_t * match )
+{
+    uint32_t crc;
+    uint8_t bits = 0;
+    uint8_t i;
+
+    if ( hpm_state_cur == HPM_ERASING ) {
+        return IPMI_CC_NODE_BUSY;
+    }
+    if ( hpm_state_cur != HPM_UPLOAD ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+    /* Response lost, the chunks are already set */
+    if ( ( hpm_delta_next != 0 ) && ( first == hpm_delta_first ) && ( first + count == hpm_delta_next ) ) {
+        *match = hpm_delta_match;
+        return IPMI_CC_OK;
+    }
+    /* The uploaded bytes are placed by the manifest, it must be complete before the first block */
+    if ( ( hpm_offset != 0 ) || hpm_z ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+    if ( ( first != hpm_delta_next ) || ( count == 0 ) || ( count > HPM_DELTA_CRCS ) ) {
+        return IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    }
+    if ( first + count > HPM_CHUNKS ) {
+        return IPMI_CC_OUT_OF_SPACE;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        crc = crcs[4 * i] | ( crcs[4 * i + 1] << 8 ) | ( crcs[4 * i + 2] << 16 ) | ( (uint32_t) crcs[4 * i + 3] << 24 );
+        if ( prvHPMChunkCrc( first + i ) == crc ) {
+            bits |= 1 << i;
+        }
+    }
+    /* The chunks are only marked once their copy is queued, a NODE_BUSY request comes again as it was */
+    if ( ( bits != 0 ) && !prvHPMQueue( HPM_OP_COPY, bits, first ) ) {
+        return IPMI_CC_NODE_BUSY;
+    }
+    for ( i = 0; i < count; i++ ) {
+        if ( bits & ( 1 << i ) ) {
+            hpm_reuse[( first + i ) / 8] |= 1 << ( ( first + i ) % 8 );
+            hpm_reused++;
+        }
+    }
+
+    hpm_delta_first = first;
+    hpm_delta_next = first + count;
+    hpm_delta_match = bits;
+    *match = bits;
+    return IPMI_CC_OK;
+}
+
+/* Queues the full buffer being filled and moves to the next one, 0 if that one is still being written */
+static uint8_t prvHPMFlush( void )
+{
+    uint8_t next = ( hpm_fill + 1 ) % HPM_BUFFERS;
+
+    if ( hpm_buf_busy[next] ) {
+        return 0;
+    }
+    hpm_buf_busy[hpm_fill] = 1;
+    if ( !prvHPMQueue( HPM_OP_WRITE, hpm_fill, prvHPMNextChunk() ) ) {
+        hpm_buf_busy[hpm_fill] = 0;
+        hpm_dest--;
+        return 0;
+    }
+    hpm_fill = next;
+    hpm_fill_len = 0;
+    return 1;
+}
+
+/* Decoded byte to the buffers */
+static uint8_t prvHPMZPut( uint8_t byte )
+{
+    if ( ( hpm_fill_len == HPM_WRITE_CHUNK ) && !prvHPMFlush() ) {
+        return 0;
+    }
+    ( (uint8_t *) hpm_buf[hpm_fill] )[hpm_fill_len++] = byte;
+    hpm_z_out++;
+    return 1;
+}
+
+/* Decoded byte read back: from the buffers for the last chunks, from the slot for the older ones, which the
+ * buffers were only taken again after writing */
+static uint8_t prvHPMZGet( uint16_t distance )
+{
+    uint32_t pos = hpm_z_out - distance;
+    uint32_t start = hpm_z_out - hpm_fill_len;
+    uint32_t back;
+
+    if ( pos >= start ) {
+        return ( (uint8_t *) hpm_buf[hpm_fill] )[pos - start];
+    }
+    back = ( start - pos + HPM_WRITE_CHUNK - 1 ) / HPM_WRITE_CHUNK;
+    if ( back < HPM_BUFFERS ) {
+        return ( (uint8_t *) hpm_buf[( hpm_fill + HPM_BUFFERS - back ) % HPM_BUFFERS] )[pos - ( start - back * HPM_WRITE_CHUNK )];
+    }
+    return ( (const uint8_t *) IMAGE_SLOT_BASE( hpm_slot ) )[pos];
+}
+
+static const lz4_sink hpm_z_sink = { prvHPMZPut, prvHPMZGet };
+
+/* Block of a compressed upload, the first one past the stream header */
+static uint8_t prvHPMUploadCompressed( const uint8_t * data, uint8_t len )
+{
+    hpm_z_consumed += lz4_stream_feed( &hpm_z_stream, &data[hpm_z_consumed], len - hpm_z_consumed, &hpm_z_sink );
+
+    if ( lz4_stream_failed( &hpm_z_stream ) ) {
+        return IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    }
+    if ( ( hpm_z_consumed < len ) || lz4_stream_pending( &hpm_z_stream ) ) {
+        return IPMI_CC_NODE_BUSY;
+    }
+
+    hpm_z_consumed = 0;
+    hpm_offset += len;
+    hpm_block++;
+    return IPMI_CC_OK;
+}
+
+uint8_t hpm_upload( uint8_t block, const uint8_t * data, uint8_t len )
+{
+    uint32_t total;
+    uint8_t * fill;
+    uint16_t room;
+
+    if ( hpm_state_cur == HPM_ERASING ) {
+        return IPMI_CC_NODE_BUSY;
+    }
+    if ( hpm_state_cur != HPM_UPLOAD ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+    if ( ( hpm_offset != 0 ) && ( block == (uint8_t) ( hpm_block - 1 ) ) ) {
+        return IPMI_CC_OK;
+    }
+    if ( ( block != hpm_block ) || ( len == 0 ) ) {
+        return IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    }
+
+    /* Compressed upload, told by its first block */
+    if ( ( hpm_offset == 0 ) && !hpm_z && ( len >= HPM_Z_HEADER_LEN ) &&
+         ( ( data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( (uint32_t) data[3] << 24 ) ) == HPM_Z_MAGIC ) ) {
+        total = data[4] | ( data[5] << 8 ) | ( data[6] << 16 ) | ( (uint32_t) data[7] << 24 );
+        /* The read back of the matches takes the chunks of the slot in order */
+        if ( hpm_reused != 0 ) {
+            return IPMI_CC_INV_DATA_FIELD_IN_REQ;
+        }
+        if ( total > IMAGE_HEADER_OFFSET ) {
+            return IPMI_CC_OUT_OF_SPACE;
+        }
+        lz4_stream_init( &hpm_z_stream, total );
+        hpm_z = 1;
+        hpm_z_consumed = HPM_Z_HEADER_LEN;
+        hpm_z_out = 0;
+    }
+    if ( hpm_z ) {
+        return prvHPMUploadCompressed( data, len );
+    }
+    if ( hpm_offset + hpm_reused * HPM_WRITE_CHUNK + len > IMAGE_HEADER_OFFSET ) {
+        return IPMI_CC_OUT_OF_SPACE;
+    }
+
+    /* A block fills at most one buffer, it's only taken once the one after it is free */
+    room = HPM_WRITE_CHUNK - hpm_fill_len;
+    fill = (uint8_t *) hpm_buf[hpm_fill];
+    if ( len < room ) {
+        memcpy( &fill[hpm_fill_len], data, len );
+        hpm_fill_len += len;
+    } else {
+        memcpy( &fill[hpm_fill_len], data, room );
+        hpm_fill_len = HPM_WRITE_CHUNK;
+        if ( !prvHPMFlush() ) {
+            hpm_fill_len -= room;
+            return IPMI_CC_NODE_BUSY;
+        }
+        hpm_fill_len = len - room;
+        memcpy( hpm_buf[hpm_fill], &data[room], hpm_fill_len );
+    }
+
+    hpm_offset += len;
+    hpm_block++;
+    return IPMI_CC_OK;
+}
+
+uint8_t hpm_finish( uint8_t component, uint32_t len )
+{
+    uint8_t * fill;
+
+    if ( component != hpm_slot ) {
+        return IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    }
+    if ( hpm_state_cur != HPM_UPLOAD ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+    if ( ( len != hpm_offset + hpm_reused * HPM_WRITE_CHUNK ) || ( hpm_z && !lz4_stream_done( &hpm_z_stream ) ) ) {
+        return HPM_CC_INVALID_LENGTH;
+    }
+    /* The image is checked from the decoded length */
+    if ( hpm_z ) {
+        len = hpm_z_out;
+    }
+    /* Room for the last chunk and the check, the copies of a delta upload may still take the queue (asked again) */
+    if ( uxQueueSpacesAvailable( hpm_queue ) < ( ( hpm_fill_len != 0 ) ? 2 : 1 ) ) {
+        return IPMI_CC_NODE_BUSY;
+    }
+
+    hpm_state_cur = HPM_FINISHING;
+    prvHPMStatus( IPMI_PICMG_CMD_HPM_FINISH_FIRMWARE_UPLOAD, HPM_CC_IN_PROGRESS );
+
+    /* Last chunk padded as erased flash, only the HPM task takes from the queue so the room checked above stays */
+    if ( hpm_fill_len != 0 ) {
+        fill = (uint8_t *) hpm_buf[hpm_fill];
+        memset( &fill[hpm_fill_len], 0xFF, HPM_WRITE_CHUNK - hpm_fill_len );
+        hpm_buf_busy[hpm_fill] = 1;
+        prvHPMQueue( HPM_OP_WRITE, hpm_fill, prvHPMNextChunk() );
+        hpm_fill_len = 0;
+    }
+    prvHPMQueue( HPM_OP_VERIFY, 0, len );
+
+    return HPM_CC_IN_PROGRESS;
+}
+
+uint8_t hpm_abort( void )
+{
+    if ( ( hpm_state_cur == HPM_ERASING ) || ( hpm_state_cur == HPM_FINISHING ) || ( hpm_state_cur == HPM_ACTIVATING ) ) {
+        return HPM_CC_IN_PROGRESS;
+    }
+
+    /* Writes still queued go on, the next Initiate Upgrade Action erases after them */
+    hpm_state_cur = HPM_IDLE;
+    hpm_fill_len = 0;
+    hpm_offset = 0;
+    hpm_reused = 0;
+    hpm_z = 0;
+    return IPMI_CC_OK;
+}
+
+uint8_t hpm_activate( void )
+{
+    if ( hpm_state_cur != HPM_READY ) {
+        return IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    }
+    if ( !prvHPMQueue( HPM_OP_ACTIVATE, 0, 0 ) ) {
+        return IPMI_CC_NODE_BUSY;
+    }
+    hpm_state_cur = HPM_ACTIVATING;
+    prvHPMStatus( IPMI_PICMG_CMD_HPM_ACTIVATE_FIRMWARE, HPM_CC_IN_PROGRESS );
+    return IPMI_CC_OK;
+}
+
+void hpm_get_status( uint8_t * cmd, uint8_t * cc )
+{
+    taskENTER_CRITICAL();
+    *cmd = hpm_status_cmd;
+    *cc = hpm_status_cc;
+    taskEXIT_CRITICAL();
+}
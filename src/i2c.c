@@ -30,14 +30,27 @@
 #include "task.h"
 #include "queue.h"
 #include "semphr.h"
+#include "timers.h"
 
 /* C Standard includes */
-#include "stdio.h"
 #include "string.h"
 
 /* Project includes */
 #include "i2c.h"
 #include "board_defs.h"
+#include "gpio.h"
+#include "prof.h"
+#include "ram_sections.h"
+#if I2C_TRACE
+#include "ring_buffer.h"
+#endif
+#if I2C_SNOOP
+#include "log.h"
+#include "periodic.h"
+#include "deferred.h"
+#include "clock.h"
+#include "metrics.h"
+#endif
 
 /* Project definitions */
 /*! @todo Move these definitions to a LPC17x specific header, so we have a more generic macro */
@@ -50,21 +63,40 @@
 #define I2CADDR_READ( id )          LPC_I2Cx(id)->ADR0
 #define I2CMASK( id, val )          LPC_I2Cx(id)->MASK[0] = val
 
+/*! @brief Pins of each I2C interface, from the board variant */
+#define I2C_PINS_ENTRY( id, port, sda, scl, func ) \
+    [id] = { .sda_port = port, .sda_pin = sda, .scl_port = port, .scl_pin = scl, .pin_func = func },
+
+const xI2C_pins_t i2c_pins[I2C_NUM_INTERFACE] = {
+    BOARD_I2C_PINS( I2C_PINS_ENTRY )
+};
+
 /*! @brief Configuration struct for each I2C interface */
 xI2C_Config i2c_cfg[] = {
     {
         .reg = LPC_I2C0,
         .irq = I2C0_IRQn,
         .mode = I2C_Mode_IPMB,
-        .pins = {
-            .sda_port = I2C0_PORT,
-            .sda_pin = I2C0_SDA_PIN,
-            .scl_port = I2C0_PORT,
-            .scl_pin = I2C0_SCL_PIN,
-            .pin_func = I2C0_PIN_FUNC
-        },
+        .clock_rate = I2C_STANDARD_MODE_CLOCK,
         .master_task_id = NULL,
         .slave_task_id = NULL,
+        .slave_rx_wr = 0,
+        .slave_rx_rd = 0,
+        .slave_rx_start = I2C_SLAVE_RX_NONE,
+        .slave_rx_addr = 0,
+        .slave_addr = { 0 },
+        .slave_rx_dropped = 0,
+        .arb_lost = 0,
+        .timeouts = 0,
+        .arb_retries = 0,
+        .master_pending = 0,
+        .slave_busy = 0,
+        .bus_free_at = 0,
+        .deferred_starts = 0,
+        .bus_recoveries = 0,
+        .chain_head = NULL,
+        .chain_tail = NULL,
+        .chain_pos = 0,
         .rx_cnt = 0,
         .tx_cnt = 0,
     },
@@ -72,15 +104,26 @@ xI2C_Config i2c_cfg[] = {
         .reg = LPC_I2C1,
         .irq = I2C1_IRQn,
         .mode = I2C_Mode_Local_Master,
-        .pins = {
-            .sda_port = I2C1_PORT,
-            .sda_pin = I2C1_SDA_PIN,
-            .scl_port = I2C1_PORT,
-            .scl_pin = I2C1_SCL_PIN,
-            .pin_func = I2C1_PIN_FUNC
-        },
+        .clock_rate = I2C_STANDARD_MODE_CLOCK,
         .master_task_id = NULL,
         .slave_task_id = NULL,
+        .slave_rx_wr = 0,
+        .slave_rx_rd = 0,
+        .slave_rx_start = I2C_SLAVE_RX_NONE,
+        .slave_rx_addr = 0,
+        .slave_addr = { 0 },
+        .slave_rx_dropped = 0,
+        .arb_lost = 0,
+        .timeouts = 0,
+        .arb_retries = 0,
+        .master_pending = 0,
+        .slave_busy = 0,
+        .bus_free_at = 0,
+        .deferred_starts = 0,
+        .bus_recoveries = 0,
+        .chain_head = NULL,
+        .chain_tail = NULL,
+        .chain_pos = 0,
         .rx_cnt = 0,
         .tx_cnt = 0,
     },
@@ -88,20 +131,43 @@ xI2C_Config i2c_cfg[] = {
         .reg = LPC_I2C2,
         .irq = I2C2_IRQn,
         .mode = I2C_Mode_Local_Master,
-        .pins = {
-            .sda_port = I2C2_PORT,
-            .sda_pin = I2C2_SDA_PIN,
-            .scl_port = I2C2_PORT,
-            .scl_pin = I2C2_SCL_PIN,
-            .pin_func = I2C2_PIN_FUNC
-        },
+        .clock_rate = I2C_STANDARD_MODE_CLOCK,
         .master_task_id = NULL,
         .slave_task_id = NULL,
+        .slave_rx_wr = 0,
+        .slave_rx_rd = 0,
+        .slave_rx_start = I2C_SLAVE_RX_NONE,
+        .slave_rx_addr = 0,
+        .slave_addr = { 0 },
+        .slave_rx_dropped = 0,
+        .arb_lost = 0,
+        .timeouts = 0,
+        .arb_retries = 0,
+        .master_pending = 0,
+        .slave_busy = 0,
+        .bus_free_at = 0,
+        .deferred_starts = 0,
+        .bus_recoveries = 0,
+        .chain_head = NULL,
+        .chain_tail = NULL,
+        .chain_pos = 0,
         .rx_cnt = 0,
         .tx_cnt = 0,
     }
 };
 
+/* Link counters of each interface */
+#define I2C_METRICS( n )                                                \
+    METRIC_COUNTER( "i2c" #n ".arb_lost", i2c_cfg[n].arb_lost );        \
+    METRIC_COUNTER( "i2c" #n ".rx_dropped", i2c_cfg[n].slave_rx_dropped ); \
+    METRIC_COUNTER( "i2c" #n ".timeouts", i2c_cfg[n].timeouts );        \
+    METRIC_COUNTER( "i2c" #n ".recoveries", i2c_cfg[n].bus_recoveries ); \
+    METRIC_COUNTER( "i2c" #n ".deferred", i2c_cfg[n].deferred_starts )
+
+I2C_METRICS( 0 );
+I2C_METRICS( 1 );
+I2C_METRICS( 2 );
+
 /*! @brief Array of mutexes to access #i2c_cfg global struct
  *
  * Each I2C interface has its own mutex and it must be taken
@@ -110,344 +176,1796 @@ xI2C_Config i2c_cfg[] = {
  */
 static SemaphoreHandle_t I2C_mutex[3];
 
-void vI2C_ISR( uint8_t i2c_id );
+#if I2C_TRACE
+/*! @brief Bus trace ring and its storage, see #vI2CTraceEnable */
+static RINGBUFF_T i2c_trace_ring;
+static xI2C_trace_entry i2c_trace_buf[I2C_TRACE_LEN] __RAM_AHB_NOINIT;
+static volatile uint8_t i2c_trace_on;
+static uint32_t i2c_trace_dropped;
+#endif
+
+#if I2C_SNOOP
+/*! @name Snoop capture, see #xI2CSnoopEnable
+ * The ISR is the only writer of the ring and the export job its only reader, the indexes run free.
+ * @{
+ */
+#define I2C_SNOOP_OFF               0       /*!< Frame for one of our addresses (or capture stopped) */
+#define I2C_SNOOP_CAPTURE           1       /*!< Frame for another address, received into the ring */
+#define I2C_SNOOP_DROP              2       /*!< Frame for another address, the ring had no room */
+
+static xI2C_snoop_frame i2c_snoop_ring[I2C_SNOOP_LEN] __RAM_AHB_NOINIT;
+static volatile uint8_t i2c_snoop_wr;
+static volatile uint8_t i2c_snoop_rd;
+/* Interface being captured, I2C_NUM_INTERFACE if none */
+static volatile uint8_t i2c_snoop_id = I2C_NUM_INTERFACE;
+static uint32_t i2c_snoop_captured;
+static uint32_t i2c_snoop_dropped;
+static void prvI2CSnoopExport( void * arg );
+static periodic_job i2c_snoop_job = PERIODIC_JOB( "I2C Snoop", prvI2CSnoopExport, NULL, I2C_SNOOP_EXPORT_PERIOD, 0 );
+/*! @} */
+#endif
+
+/*! @brief Devices registered with #xI2CRegisterDevice, used to choose each interface clock rate */
+static xI2C_device i2c_devices[I2C_MAX_DEVICES];
+static uint8_t i2c_device_count;
+
+/*! @brief Our IPMB address, resolved from the GA pins by vI2CInit (0 while unknown)
+ * @see get_ipmb_addr()
+ */
+static volatile uint8_t ipmb_addr;
+#if IPMB_ADDR_RECHECK_PERIOD
+static TimerHandle_t ipmb_addr_timer;
+static void vIPMBAddrRecheck( TimerHandle_t timer );
+#endif
+
+#if configAPP_I2C_MOCK
+/*! @brief Mock transmitter of each interface, NULL for the ones on a real bus */
+static i2c_mock_tx i2c_mock[I2C_NUM_INTERFACE];
+static void prvI2CMockInit( I2C_ID_T i2c_id, I2C_Mode mode );
+#endif
+
+#if I2C_ISR_IN_RAM
+#define I2C_ISR_ATTR __RAMFUNC
+#else
+#define I2C_ISR_ATTR
+#endif
+
+I2C_ISR_ATTR void vI2C_ISR( uint8_t i2c_id );
+static uint32_t prvI2CBusClock( I2C_ID_T i2c_id );
+static void prvI2CDeviceResult( I2C_ID_T i2c_id, uint8_t addr, i2c_err error );
+static i2c_err prvI2CChainResults( xI2C_chain * chain );
+
+I2C_ISR_ATTR void I2C0_IRQHandler( void )
+{
+    KERNEL_TRACE_ISR_ENTER();
+    vI2C_ISR( I2C0 );
+    KERNEL_TRACE_ISR_EXIT();
+}
+
+I2C_ISR_ATTR void I2C1_IRQHandler( void )
+{
+    KERNEL_TRACE_ISR_ENTER();
+    vI2C_ISR( I2C1 );
+    KERNEL_TRACE_ISR_EXIT();
+}
+
+I2C_ISR_ATTR void I2C2_IRQHandler( void )
+{
+    KERNEL_TRACE_ISR_ENTER();
+    vI2C_ISR( I2C2 );
+    KERNEL_TRACE_ISR_EXIT();
+}
+
+#define I2C_CON_FLAGS (I2C_AA | I2C_SI | I2C_STO | I2C_STA)
+
+/*! @brief SMBus PEC, CRC-8 with polynomial x^8 + x^2 + x + 1 (0x07), one entry per value of crc ^ byte */
+static const uint8_t i2c_crc8_table[256] = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+    0x70, 0x77, 0x7E, 0x79, 0x6C, 0x6B, 0x62, 0x65, 0x48, 0x4F, 0x46, 0x41, 0x54, 0x53, 0x5A, 0x5D,
+    0xE0, 0xE7, 0xEE, 0xE9, 0xFC, 0xFB, 0xF2, 0xF5, 0xD8, 0xDF, 0xD6, 0xD1, 0xC4, 0xC3, 0xCA, 0xCD,
+    0x90, 0x97, 0x9E, 0x99, 0x8C, 0x8B, 0x82, 0x85, 0xA8, 0xAF, 0xA6, 0xA1, 0xB4, 0xB3, 0xBA, 0xBD,
+    0xC7, 0xC0, 0xC9, 0xCE, 0xDB, 0xDC, 0xD5, 0xD2, 0xFF, 0xF8, 0xF1, 0xF6, 0xE3, 0xE4, 0xED, 0xEA,
+    0xB7, 0xB0, 0xB9, 0xBE, 0xAB, 0xAC, 0xA5, 0xA2, 0x8F, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9D, 0x9A,
+    0x27, 0x20, 0x29, 0x2E, 0x3B, 0x3C, 0x35, 0x32, 0x1F, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0D, 0x0A,
+    0x57, 0x50, 0x59, 0x5E, 0x4B, 0x4C, 0x45, 0x42, 0x6F, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7D, 0x7A,
+    0x89, 0x8E, 0x87, 0x80, 0x95, 0x92, 0x9B, 0x9C, 0xB1, 0xB6, 0xBF, 0xB8, 0xAD, 0xAA, 0xA3, 0xA4,
+    0xF9, 0xFE, 0xF7, 0xF0, 0xE5, 0xE2, 0xEB, 0xEC, 0xC1, 0xC6, 0xCF, 0xC8, 0xDD, 0xDA, 0xD3, 0xD4,
+    0x69, 0x6E, 0x67, 0x60, 0x75, 0x72, 0x7B, 0x7C, 0x51, 0x56, 0x5F, 0x58, 0x4D, 0x4A, 0x43, 0x44,
+    0x19, 0x1E, 0x17, 0x10, 0x05, 0x02, 0x0B, 0x0C, 0x21, 0x26, 0x2F, 0x28, 0x3D, 0x3A, 0x33, 0x34,
+    0x4E, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5C, 0x5B, 0x76, 0x71, 0x78, 0x7F, 0x6A, 0x6D, 0x64, 0x63,
+    0x3E, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2C, 0x2B, 0x06, 0x01, 0x08, 0x0F, 0x1A, 0x1D, 0x14, 0x13,
+    0xAE, 0xA9, 0xA0, 0xA7, 0xB2, 0xB5, 0xBC, 0xBB, 0x96, 0x91, 0x98, 0x9F, 0x8A, 0x8D, 0x84, 0x83,
+    0xDE, 0xD9, 0xD0, 0xD7, 0xC2, 0xC5, 0xCC, 0xCB, 0xE6, 0xE1, 0xE8, 0xEF, 0xFA, 0xFD, 0xF4, 0xF3,
+};
+
+/* PEC of the bytes so far followed by one more. Once the PEC byte itself is added, a correct one leaves 0 */
+#define I2C_CRC8( crc, byte )       ( i2c_crc8_table[(uint8_t) ( ( crc ) ^ ( byte ) )] )
+
+/* Index of an interface context in #i2c_cfg */
+#define I2C_CFG_ID( cfg )           ( (uint8_t)( ( cfg ) - i2c_cfg ) )
+
+/*! @brief Handler of one I2STAT state
+ *
+ * Receives the interface context and the control flags to be cleared (all of them by default),
+ * and returns them with the ones to be set removed, see the end of #vI2C_ISR.
+ */
+typedef uint32_t (* i2c_state_handler)( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken );
+
+/* Runs the callback of an asynchronous chain, from the deferred work daemon */
+static void prvI2CChainCallback( void * chain, uint32_t unused )
+{
+    xI2C_chain * done = (xI2C_chain *) chain;
+
+    done->callback( done, prvI2CChainResults( done ) );
+}
+
+/* Tells the owner of a chain that it ended. Called from the ISR (woken != NULL) or from a critical section */
+I2C_ISR_ATTR static void prvI2CChainComplete( xI2C_chain * chain, portBASE_TYPE * woken )
+{
+    BaseType_t queued;
+
+    chain->busy = 0;
+    if ( chain->callback == NULL ) {
+        if ( woken ) {
+            vTaskNotifyGiveFromISR( chain->caller, woken );
+        } else {
+            xTaskNotifyGive( chain->caller );
+        }
+    } else {
+        /* Deferred, the callback may call the driver again */
+        if ( woken ) {
+            queued = deferred_call_from_isr( prvI2CChainCallback, chain, 0, woken );
+        } else {
+            queued = deferred_call( prvI2CChainCallback, chain, 0 );
+        }
+        /* The deferred work ring is full, see DEFERRED_RING_LEN */
+        configASSERT( queued );
+        ( void ) queued;
+    }
+}
+
+/* Copies a chain transfer into the interface message, so the ISR runs it as a normal one */
+I2C_ISR_ATTR static void prvI2CLoadXfer( xI2C_Config * cfg, uint8_t addr, const uint8_t * tx_data, uint8_t tx_len,
+                                          uint8_t rx_len, uint8_t flags )
+{
+    memcpy( cfg->msg.tx_data, tx_data, tx_len );
+    cfg->msg.i2c_id = I2C_CFG_ID( cfg );
+    cfg->msg.addr = addr;
+    cfg->msg.tx_len = tx_len;
+    cfg->msg.rx_len = rx_len;
+    cfg->msg.flags = flags;
+    cfg->msg.error = i2c_err_SUCCESS;
+    if ( flags & I2C_XFER_PEC ) {
+        /* One byte more on the bus: sent after the last write, or read after the last byte of the answer */
+        if ( rx_len > 0 ) {
+            cfg->msg.rx_len++;
+        } else {
+            cfg->msg.tx_len++;
+        }
+    }
+}
+
+/* Loads the transfer of a chain at chain_pos, for a scan list the next entry of its mask from there.
+ * Returns 0 if the chain has nothing left */
+I2C_ISR_ATTR static uint8_t prvI2CChainLoad( xI2C_Config * cfg, xI2C_chain * chain )
+{
+    const xI2C_scan_entry * entry;
+    xI2C_xfer * xfer;
+
+    if ( chain->scan != NULL ) {
+        while ( ( cfg->chain_pos < chain->count ) && !( chain->mask & ( 1UL << cfg->chain_pos ) ) ) {
+            cfg->chain_pos++;
+        }
+    }
+    if ( cfg->chain_pos >= chain->count ) {
+        return 0;
+    }
+
+    if ( chain->scan != NULL ) {
+        entry = &chain->scan[cfg->chain_pos];
+        prvI2CLoadXfer( cfg, entry->addr, entry->tx_data, entry->tx_len, entry->rx_len, entry->flags );
+    } else {
+        xfer = &chain->xfer[cfg->chain_pos];
+        prvI2CLoadXfer( cfg, xfer->addr, xfer->tx_data, xfer->tx_len, xfer->rx_len, xfer->flags );
+    }
+    return 1;
+}
+
+/* Tells if the chain being run has a transfer after the current one */
+I2C_ISR_ATTR static uint8_t prvI2CChainHasNext( xI2C_Config * cfg )
+{
+    xI2C_chain * chain = cfg->chain_head;
+
+    return ( chain != NULL ) && ( chain->scan == NULL ) && ( cfg->chain_pos + 1 < chain->count );
+}
+
+/* Stores the result of the transfer just run, from the interface message */
+I2C_ISR_ATTR static void prvI2CChainStore( xI2C_Config * cfg, xI2C_chain * chain )
+{
+    const xI2C_scan_entry * entry;
+    xI2C_xfer * xfer;
+
+    if ( chain->scan != NULL ) {
+        entry = &chain->scan[cfg->chain_pos];
+        chain->result[cfg->chain_pos] = cfg->msg.error;
+        if ( ( cfg->msg.error == i2c_err_SUCCESS ) && ( entry->rx_len > 0 ) ) {
+            memcpy( chain->dest + entry->slot * chain->stride, cfg->msg.rx_data, entry->rx_len );
+        }
+        return;
+    }
+
+    xfer = &chain->xfer[cfg->chain_pos];
+    xfer->error = cfg->msg.error;
+    if ( ( xfer->error == i2c_err_SUCCESS ) && ( xfer->rx_len > 0 ) ) {
+        memcpy( xfer->rx_data, cfg->msg.rx_data, xfer->rx_len );
+    }
+}
+
+/*! @brief Ends the current master transfer (successfully or not)
+ *
+ * Without a pending chain, the task that started the transfer is notified. Otherwise the
+ * result is stored in the chain descriptor and the next transfer (of the same chain or of
+ * the next queued one) is loaded, so the ISR can start it right away with a new START.
+ * Only the task owning a chain is woken up, once all its transfers are done.
+ *
+ * @return 1 if a new transfer must be started, 0 if the bus goes idle
+ */
+I2C_ISR_ATTR static uint8_t prvI2CMasterDone( xI2C_Config * cfg, portBASE_TYPE * woken )
+{
+    xI2C_chain * chain = cfg->chain_head;
+
+    cfg->arb_retries = 0;
+
+    if ( chain == NULL ) {
+        vTaskNotifyGiveFromISR( cfg->master_task_id, woken );
+        return 0;
+    }
+
+    prvI2CChainStore( cfg, chain );
+    cfg->chain_pos++;
+    if ( prvI2CChainLoad( cfg, chain ) ) {
+        return 1;
+    }
+
+    /* Chain finished, hand the bus to the next one */
+    prvI2CChainComplete( chain, woken );
+    cfg->chain_head = chain->next;
+    if ( chain->next == NULL ) {
+        cfg->chain_tail = NULL;
+        return 0;
+    }
+
+    /* Queued chains have something to run, see prvI2CChainSubmit */
+    cfg->chain_pos = 0;
+    prvI2CChainLoad( cfg, chain->next );
+    return 1;
+}
+
+/* Master transfer finished (or failed): send a STOP and, if a chain has more work queued, a START right after it */
+I2C_ISR_ATTR static uint32_t prvI2CMasterStop( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    cclr &= ~I2C_STO;
+    cfg->bus_free_at = DWT->CYCCNT;
+    if ( prvI2CMasterDone( cfg, woken ) ) {
+        /* Next transfer of the chain */
+        cclr &= ~I2C_STA;
+    }
+    return cclr;
+}
+
+/*! @name I2STAT state handlers
+ * @{
+ */
+I2C_ISR_ATTR static uint32_t prvI2CStateIgnore( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* Slave Transmitter and General Call states aren't implemented */
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateBusError( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* The STOP sent to recover leaves the interface not addressed */
+    cfg->slave_busy = 0;
+    cfg->bus_free_at = DWT->CYCCNT;
+    if ( cfg->master_pending ) {
+        /* Held back for a slave frame the error ended (see prvI2CMasterStart) */
+        cfg->master_pending = 0;
+        cclr &= ~I2C_STA;
+    }
+    return cclr & ~I2C_STO;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateStart( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    uint8_t sla = ( cfg->msg.addr << 1 ) | ( cfg->msg.tx_len == 0 );
+
+    cfg->rx_cnt = 0;
+    cfg->tx_cnt = 0;
+    /* Write Slave Address in the I2C bus, if there's nothing
+     * to transmit, the last bit (R/W) will be set to 1 */
+    cfg->pec = I2C_CRC8( 0, sla );
+    cfg->reg->DAT = sla;
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateRepeatedStart( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* Read phase of a combined transfer (see xI2CWriteRead), the
+     * bytes were already transmitted, so address the slave for reading */
+    uint8_t sla = ( cfg->msg.addr << 1 ) | 1;
+
+    if ( ( cfg->msg.tx_len == 0 ) || ( cfg->tx_cnt < cfg->msg.tx_len ) ) {
+        /* Next transfer of a burst (I2C_XFER_RESTART), nothing sent yet: its PEC
+         * starts over from its own SLA, not from the transfer before it */
+        return prvI2CStateStart( cfg, cclr, woken );
+    }
+
+    cfg->rx_cnt = 0;
+    cfg->pec = I2C_CRC8( cfg->pec, sla );
+    cfg->reg->DAT = sla;
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateDataSendAck( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    uint8_t data;
+
+    /* Also used for SLA+W ACK'd, which sends the first data byte */
+    if ( cfg->msg.tx_len != cfg->tx_cnt ) {
+        data = cfg->msg.tx_data[cfg->tx_cnt++];
+        if ( ( cfg->msg.flags & I2C_XFER_PEC ) && ( cfg->msg.rx_len == 0 ) && ( cfg->tx_cnt == cfg->msg.tx_len ) ) {
+            /* Last byte of a PEC write, the code of all the ones before it */
+            data = cfg->pec;
+        }
+        cfg->pec = I2C_CRC8( cfg->pec, data );
+        cfg->reg->DAT = data;
+        return cclr;
+    }
+
+    if ( cfg->msg.rx_len > 0 ) {
+        /* Bytes to be read back, keep the bus and issue a repeated START */
+        return cclr & ~I2C_STA;
+    }
+
+    if ( ( cfg->msg.flags & I2C_XFER_RESTART ) && prvI2CChainHasNext( cfg ) ) {
+        /* Next write of a burst, the repeated START addresses its slave (see prvI2CStateRepeatedStart) */
+        prvI2CMasterDone( cfg, woken );
+        cfg->tx_cnt = 0;
+        return cclr & ~I2C_STA;
+    }
+
+    /* If there's no more data to be transmitted,
+     * finish the communication and notify the caller task */
+    return prvI2CMasterStop( cfg, cclr, woken );
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaWNack( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    cfg->msg.error = i2c_err_SLA_W_SENT_NACK;
+    return prvI2CMasterStop( cfg, cclr, woken );
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateDataSentNack( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    cfg->msg.error = i2c_err_DATA_SENT_NACK;
+    return prvI2CMasterStop( cfg, cclr, woken );
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateArbLost( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    cfg->arb_lost++;
+    if ( cfg->arb_retries < I2C_ARB_LOST_RETRIES ) {
+        /* Another master won the bus, send the whole transfer again (from
+         * the START state) as soon as the bus is free, the caller keeps waiting */
+        cfg->arb_retries++;
+        return cclr & ~I2C_STA;
+    }
+
+    /* Give up, so the caller can retry it later */
+    cfg->msg.error = i2c_err_FAILURE;
+    if ( prvI2CMasterDone( cfg, woken ) ) {
+        /* Next transfer of the chain, started once the bus is free */
+        cclr &= ~I2C_STA;
+    }
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaRAck( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* SLA+R has been transmitted and ACK'd
+     * If we want to receive only 1 byte, return NACK on the next byte */
+    if ( cfg->msg.rx_len > 1 ) {
+        /* If we expect to receive more than 1 byte,
+         * return ACK on the next byte */
+        cclr &= ~I2C_AA;
+    }
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaRNack( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* Notify the error */
+    cfg->msg.error = i2c_err_SLA_R_SENT_NACK;
+    return prvI2CMasterStop( cfg, cclr, woken );
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateDataRecvAck( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    uint8_t data = cfg->reg->DAT;
+
+    cfg->pec = I2C_CRC8( cfg->pec, data );
+    if ( cfg->rx_cnt < i2cMAX_MSG_LENGTH - 1 ) {
+        cfg->msg.rx_data[cfg->rx_cnt++] = data;
+        if ( cfg->rx_cnt != cfg->msg.rx_len - 1 ) {
+            cclr &= ~I2C_AA;
+        }
+    }
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateDataRecvNack( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    uint8_t data = cfg->reg->DAT;
+
+    cfg->msg.rx_data[cfg->rx_cnt++] = data;
+    cfg->pec = I2C_CRC8( cfg->pec, data );
+    if ( ( cfg->msg.flags & I2C_XFER_PEC ) && ( cfg->pec != 0 ) ) {
+        /* The PEC was the last byte, folded in it leaves 0 if nothing was corrupted */
+        cfg->msg.error = i2c_err_PEC;
+    }
+    /* There's no more data to be received */
+    return prvI2CMasterStop( cfg, cclr, woken );
+}
+
+/*! @name Slave receive FIFO
+ * The ISR (or the mock backend) writes the frames, the receiver task reads them, see #xI2CSlaveReceive.
+ * @{
+ */
+
+/* Keeps the frame stores before the index store that publishes them */
+#define I2C_COMPILER_BARRIER()      __asm volatile ( "" ::: "memory" )
+
+/*! @brief Offset where a new frame can be received, #I2C_SLAVE_RX_NONE if the unread ones leave no room
+ *
+ * The receiver task only ever frees room, so the answer holds until the frame is published.
+ */
+I2C_ISR_ATTR static uint8_t prvI2CSlaveReserve( xI2C_Config * cfg )
+{
+    uint8_t wr = cfg->slave_rx_wr;
+    uint8_t rd = cfg->slave_rx_rd;
+
+    if ( wr >= rd ) {
+        if ( I2C_SLAVE_RX_FIFO_LEN - wr >= I2C_SLAVE_RX_RECORD_MAX ) {
+            return wr;
+        }
+        /* Not enough room before the end, start over at offset 0 (strictly before rd, full isn't empty) */
+        if ( rd > I2C_SLAVE_RX_RECORD_MAX ) {
+            return 0;
+        }
+    } else if ( rd - wr > I2C_SLAVE_RX_RECORD_MAX ) {
+        return wr;
+    }
+    return I2C_SLAVE_RX_NONE;
+}
+
+/*! @brief Hands the frame received at \p start over to the receiver task */
+I2C_ISR_ATTR static void prvI2CSlavePublish( xI2C_Config * cfg, uint8_t start, uint8_t len, uint8_t addr )
+{
+    uint8_t * hdr = &cfg->slave_rx_fifo[start];
+    uint32_t stamp = DWT->CYCCNT;
+    uint8_t wr = cfg->slave_rx_wr;
+
+    hdr[0] = len;
+    hdr[1] = stamp & 0xFF;
+    hdr[2] = ( stamp >> 8 ) & 0xFF;
+    hdr[3] = ( stamp >> 16 ) & 0xFF;
+    hdr[4] = stamp >> 24;
+    hdr[5] = addr;
+    if ( ( start != wr ) && ( wr < I2C_SLAVE_RX_FIFO_LEN ) ) {
+        /* Wrapped to offset 0, end the data where the last frame ends */
+        cfg->slave_rx_fifo[wr] = 0;
+    }
+    I2C_COMPILER_BARRIER();
+    cfg->slave_rx_wr = start + I2C_SLAVE_RX_HDR + len;
+}
+
+/*! @brief Stores a received byte in the frame being received, unless it's being dropped */
+I2C_ISR_ATTR static void prvI2CSlaveStore( xI2C_Config * cfg, uint8_t data )
+{
+    if ( cfg->slave_rx_start != I2C_SLAVE_RX_NONE ) {
+        cfg->slave_rx_fifo[cfg->slave_rx_start + I2C_SLAVE_RX_HDR + cfg->rx_cnt] = data;
+    }
+#if I2C_SNOOP
+    else if ( cfg->slave_rx_snoop == I2C_SNOOP_CAPTURE ) {
+        i2c_snoop_ring[i2c_snoop_wr & ( I2C_SNOOP_LEN - 1 )].data[cfg->rx_cnt] = data;
+    }
+#endif
+    cfg->rx_cnt++;
+}
+/*! @} */
+
+#if I2C_SNOOP
+/*! @brief Tells if a slave address (8 bit form) is one of ours, the main one or an extra one */
+I2C_ISR_ATTR static uint8_t prvI2CSlaveOwnAddr( xI2C_Config * cfg, uint8_t addr )
+{
+    uint8_t i;
+
+    if ( addr == ( cfg->reg->ADR0 & 0xFE ) ) {
+        return 1;
+    }
+    for ( i = 0; i < I2C_SLAVE_ADDR_EXTRA; i++ ) {
+        if ( cfg->slave_addr[i] == addr ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*! @brief Sends a frame seen through the widened mask to the snoop ring instead of the receive FIFO */
+I2C_ISR_ATTR static void prvI2CSnoopBegin( xI2C_Config * cfg )
+{
+    if ( prvI2CSlaveOwnAddr( cfg, cfg->slave_rx_addr ) ) {
+        return;
+    }
+    cfg->slave_rx_start = I2C_SLAVE_RX_NONE;
+    i2c_snoop_captured++;
+    if ( (uint8_t) ( i2c_snoop_wr - i2c_snoop_rd ) < I2C_SNOOP_LEN ) {
+        cfg->slave_rx_snoop = I2C_SNOOP_CAPTURE;
+    } else {
+        cfg->slave_rx_snoop = I2C_SNOOP_DROP;
+        i2c_snoop_dropped++;
+    }
+}
+
+/*! @brief Publishes the snooped frame to the export job, nothing of it is left for the receiver task */
+I2C_ISR_ATTR static void prvI2CSnoopEnd( xI2C_Config * cfg )
+{
+    xI2C_snoop_frame * frame = &i2c_snoop_ring[i2c_snoop_wr & ( I2C_SNOOP_LEN - 1 )];
+
+    if ( cfg->slave_rx_snoop == I2C_SNOOP_CAPTURE ) {
+        frame->timestamp = DWT->CYCCNT;
+        frame->i2c_id = cfg->msg.i2c_id;
+        frame->len = cfg->rx_cnt;
+        I2C_COMPILER_BARRIER();
+        i2c_snoop_wr++;
+    }
+    cfg->slave_rx_snoop = I2C_SNOOP_OFF;
+    cfg->rx_cnt = 0;
+}
+#endif
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaveAddressed( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    cfg->msg.i2c_id = I2C_CFG_ID( cfg );
+    cfg->rx_cnt = 0;
+    cfg->slave_busy = 1;
+    /* The bytes go straight to the FIFO, the receiver task can't see them before the STOP publishes the frame */
+    cfg->slave_rx_start = prvI2CSlaveReserve( cfg );
+    /* The data register holds the address byte that matched, one of ADR0 to ADR3 */
+    cfg->slave_rx_addr = cfg->reg->DAT & 0xFE;
+#if I2C_SNOOP
+    if ( i2c_snoop_id == cfg->msg.i2c_id ) {
+        prvI2CSnoopBegin( cfg );
+    }
+#endif
+    if ( cfg->mode == I2C_Mode_IPMB ) {
+        prvI2CSlaveStore( cfg, cfg->slave_rx_addr );
+        cclr &= ~I2C_AA;
+    }
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateArbLostSlaveAddressed( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* We lost the bus to a master that is addressing us: receive its frame
+     * first and restart ours after its STOP (see prvI2CStateSlaveStop) */
+    cfg->arb_lost++;
+    if ( cfg->arb_retries < I2C_ARB_LOST_RETRIES ) {
+        cfg->arb_retries++;
+        cfg->master_pending = 1;
+    } else {
+        cfg->msg.error = i2c_err_FAILURE;
+        cfg->master_pending = prvI2CMasterDone( cfg, woken );
+    }
+    return prvI2CStateSlaveAddressed( cfg, cclr, woken );
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaveDataAck( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    /* Checks if the buffer is full */
+    if ( cfg->rx_cnt < i2cMAX_MSG_LENGTH ) {
+        prvI2CSlaveStore( cfg, cfg->reg->DAT );
+        cclr &= ~I2C_AA;
+    }
+    return cclr;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaveDataNack( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+    cfg->msg.error = i2c_err_SLA_DATA_RECV_NACK;
+    /* Not addressed anymore, there won't be a STOP state for this frame */
+    cfg->slave_busy = 0;
+    return cclr & ~I2C_AA;
+}
+
+I2C_ISR_ATTR static uint32_t prvI2CStateSlaveStop( xI2C_Config * cfg, uint32_t cclr, portBASE_TYPE * woken )
+{
+#if I2C_SNOOP
+    if ( cfg->slave_rx_snoop != I2C_SNOOP_OFF ) {
+        prvI2CSnoopEnd( cfg );
+    }
+#endif
+    /* The frame length goes in its FIFO header, msg belongs to the master side */
+    if ( ( ( cfg->rx_cnt > 0 ) && ( cfg->mode == I2C_Mode_Local_Master ) ) ||
+         ( ( cfg->rx_cnt > 1 ) && ( cfg->mode == I2C_Mode_IPMB ) ) ) {
+        if ( cfg->slave_rx_start != I2C_SLAVE_RX_NONE ) {
+            prvI2CSlavePublish( cfg, cfg->slave_rx_start, cfg->rx_cnt, cfg->slave_rx_addr );
+            if ( cfg->slave_task_id ) {
+                vTaskNotifyGiveFromISR( cfg->slave_task_id, woken );
+            }
+        } else {
+            /* The FIFO had no room when we were addressed */
+            cfg->slave_rx_dropped++;
+        }
+    }
+    cfg->slave_rx_start = I2C_SLAVE_RX_NONE;
+    cfg->slave_busy = 0;
+    cfg->bus_free_at = DWT->CYCCNT;
+
+    if ( cfg->master_pending ) {
+        /* Our master transfer lost the bus to this frame (or waited for it), START again once the bus is free */
+        cfg->master_pending = 0;
+        cclr &= ~I2C_STA;
+    }
+
+    return cclr & ~I2C_AA;
+}
+/*@}*/
+
+/*! @brief I2STAT dispatch table
+ *
+ * Status codes are multiples of 8, so STAT>>3 indexes a dense 32 entry table.
+ */
+static const i2c_state_handler i2c_state_table[32] = {
+    [0 ... 31]                                  = prvI2CStateIgnore,
+    [I2C_STAT_BUS_ERROR >> 3]                   = prvI2CStateBusError,
+    [I2C_STAT_START >> 3]                       = prvI2CStateStart,
+    [I2C_STAT_REPEATED_START >> 3]              = prvI2CStateRepeatedStart,
+    [I2C_STAT_SLA_W_SENT_ACK >> 3]              = prvI2CStateDataSendAck,
+    [I2C_STAT_SLA_W_SENT_NACK >> 3]             = prvI2CStateSlaWNack,
+    [I2C_STAT_DATA_SENT_ACK >> 3]               = prvI2CStateDataSendAck,
+    [I2C_STAT_DATA_SENT_NACK >> 3]              = prvI2CStateDataSentNack,
+    [I2C_STAT_ARB_LOST >> 3]                    = prvI2CStateArbLost,
+    [I2C_STAT_SLA_R_SENT_ACK >> 3]              = prvI2CStateSlaRAck,
+    [I2C_STAT_SLA_R_SENT_NACK >> 3]             = prvI2CStateSlaRNack,
+    [I2C_STAT_DATA_RECV_ACK >> 3]               = prvI2CStateDataRecvAck,
+    [I2C_STAT_DATA_RECV_NACK >> 3]              = prvI2CStateDataRecvNack,
+    [I2C_STAT_SLA_W_RECV_ACK >> 3]              = prvI2CStateSlaveAddressed,
+    [I2C_STAT_ARB_LOST_SLA_W_RECV_ACK >> 3]     = prvI2CStateArbLostSlaveAddressed,
+    [I2C_STAT_SLA_DATA_RECV_ACK >> 3]           = prvI2CStateSlaveDataAck,
+    [I2C_STAT_SLA_DATA_RECV_NACK >> 3]          = prvI2CStateSlaveDataNack,
+    [I2C_STAT_SLA_STOP_REP_START >> 3]          = prvI2CStateSlaveStop,
+};
+
+/*! @brief I2C common interrupt service routine
+ *
+ * I2STAT register is handled inside this function, through a table of state handlers indexed by the status code.
+ *    
+ * When a full message is trasmitted or received, the task whose handle is written to #i2c_cfg is notified, unblocking it. It also happens when an error occurs.
+ * @warning Slave Transmitter mode states are not implemented in this driver and are just ignored.
+ */
+I2C_ISR_ATTR void vI2C_ISR( uint8_t i2c_id )
+{
+    PROF_SCOPE( PROF_I2C_ISR );
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    portBASE_TYPE xI2CSemaphoreWokeTask = pdFALSE;
+    uint32_t stat = cfg->reg->STAT;
+    uint32_t cclr;
+
+#if I2C_TRACE
+    if ( i2c_trace_on ) {
+        xI2C_trace_entry entry = { DWT->CYCCNT, i2c_id, stat, cfg->reg->DAT };
+
+        if ( !RingBuffer_Insert( &i2c_trace_ring, &entry ) ) {
+            i2c_trace_dropped++;
+        }
+    }
+#endif
+
+    /* I2C status handling */
+    cclr = i2c_state_table[ ( stat >> 3 ) & 0x1F ]( cfg, I2C_CON_FLAGS, &xI2CSemaphoreWokeTask );
+
+    if ( !( cclr & I2C_STO ) ) {
+        /* Keep listening as slave once the STOP is sent */
+        cclr &= ~I2C_AA;
+    }
+    /* Flags removed from cclr are set, the remaining ones (always including SI) are cleared */
+    cfg->reg->CONSET = cclr ^ I2C_CON_FLAGS;
+    cfg->reg->CONCLR = cclr;
+
+    if (xI2CSemaphoreWokeTask == pdTRUE) {
+        portYIELD_FROM_ISR(pdTRUE);
+    }
+}
+
+/* SCL dividers for the new peripheral clock, on every bus that's up */
+static void prvI2CClock( void )
+{
+    I2C_ID_T i2c_id;
+
+    for ( i2c_id = 0; i2c_id < I2C_NUM_INTERFACE; i2c_id++ ) {
+        if ( I2C_mutex[i2c_id] != NULL ) {
+            Chip_I2C_SetClockRate( i2c_id, i2c_cfg[i2c_id].clock_rate );
+        }
+    }
+}
+
+void vI2CInit( I2C_ID_T i2c_id, I2C_Mode mode )
+{
+    static uint8_t clock_hooked;
+    uint8_t sla_addr;
+
+#if configAPP_I2C_MOCK
+    if ( i2c_mock[i2c_id] ) {
+        prvI2CMockInit( i2c_id, mode );
+        return;
+    }
+#endif
+
+    /* The bus free time (see prvI2CMasterStart) and the received frames are timed with the core cycle counter */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    /*! @todo Maybe wrap these functions, or use some board-specific defines
+     * so this code is generic enough to be applied on other hardware.
+     * Example: (if using LPC17xx and LPCOpen library)
+     * @code
+     * #define PIN_FUNC_CFG( port, pin, func ) Chip_IOCON_PinMux(...)
+     * @endcode
+    */
+    Chip_IOCON_PinMux( LPC_IOCON, i2c_pins[i2c_id].sda_port, i2c_pins[i2c_id].sda_pin, IOCON_MODE_INACT, i2c_pins[i2c_id].pin_func );
+    Chip_IOCON_PinMux( LPC_IOCON, i2c_pins[i2c_id].scl_port, i2c_pins[i2c_id].scl_pin, IOCON_MODE_INACT, i2c_pins[i2c_id].pin_func );
+    Chip_IOCON_EnableOD( LPC_IOCON, i2c_pins[i2c_id].sda_port, i2c_pins[i2c_id].sda_pin );
+    Chip_IOCON_EnableOD( LPC_IOCON, i2c_pins[i2c_id].scl_port, i2c_pins[i2c_id].scl_pin );
+    NVIC_SetPriority(i2c_cfg[i2c_id].irq, I2C_IRQ_PRIORITY);
+    NVIC_EnableIRQ( i2c_cfg[i2c_id].irq );
+
+    /* Create mutex for accessing the shared memory (i2c_cfg) */
+    I2C_mutex[i2c_id] = xSemaphoreCreateMutex();
+
+    if ( !clock_hooked ) {
+        clock_hooked = clock_register( prvI2CClock );
+    }
+
+    /* Make sure that the mutex is freed */
+    xSemaphoreGive( I2C_mutex[i2c_id] );
+
+    /* Set I2C operating mode */
+    if( xSemaphoreTake( I2C_mutex[i2c_id], 0 ) ) {
+        i2c_cfg[i2c_id].mode = mode;
+        i2c_cfg[i2c_id].clock_rate = prvI2CBusClock( i2c_id );
+        xSemaphoreGive( I2C_mutex[i2c_id] );
+    }
+
+    /* Enable and configure I2C clock */
+    Chip_I2C_Init( i2c_id );
+    Chip_I2C_SetClockRate( i2c_id, i2c_cfg[i2c_id].clock_rate );
+
+    /* Enable I2C interface (Master Mode only) */
+    I2CCONSET( i2c_id, I2C_I2EN );
+
+    if ( mode == I2C_Mode_IPMB )
+    {
+        /* Configure Slave Address, resolving our geographic address once for everyone
+         * (the RTM local bus answers at the same address as IPMB-L) */
+        sla_addr = get_ipmb_addr( );
+        I2CADDR_WRITE( i2c_id, sla_addr );
+#if IPMB_ADDR_RECHECK_PERIOD
+        if ( ipmb_addr_timer == NULL ) {
+            ipmb_addr_timer = xTimerCreate( "GA Check", IPMB_ADDR_RECHECK_PERIOD, pdTRUE, NULL, vIPMBAddrRecheck );
+            xTimerStart( ipmb_addr_timer, 0 );
+        }
+#endif
+
+        /* Exact match, the other addresses get registers of their own (xI2CSlaveAddAddress) */
+        I2CMASK( i2c_id, 0x00 );
+
+        /* Enable slave mode */
+        I2CCONSET( i2c_id, I2C_AA );
+    }
+
+    /* Clear I2C0 interrupt (just in case) */
+    I2CCONCLR( i2c_id, I2C_SI );
+
+} /* End of vI2C_Init */
+
+#if I2C_TRACE
+void vI2CTraceEnable( uint8_t enable )
+{
+    static uint8_t ring_ready;
+
+    if ( enable ) {
+        if ( !ring_ready ) {
+            RingBuffer_Init( &i2c_trace_ring, i2c_trace_buf, sizeof(xI2C_trace_entry), I2C_TRACE_LEN );
+            ring_ready = 1;
+        }
+        /* Timestamps come from the core cycle counter */
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        i2c_trace_dropped = 0;
+    }
+    i2c_trace_on = enable;
+}
+
+uint8_t xI2CTraceRead( xI2C_trace_entry * entries, uint8_t max )
+{
+    if ( i2c_trace_ring.data == NULL ) {
+        return 0;
+    }
+    return RingBuffer_PopMult( &i2c_trace_ring, entries, max );
+}
+
+uint8_t xI2CTracePending( void )
+{
+    if ( i2c_trace_ring.data == NULL ) {
+        return 0;
+    }
+    return RingBuffer_GetCount( &i2c_trace_ring );
+}
+
+uint32_t ulI2CTraceDropped( void )
+{
+    return i2c_trace_dropped;
+}
+#endif
+
+/* Highest clock rate supported by every device registered on the interface */
+static uint32_t prvI2CBusClock( I2C_ID_T i2c_id )
+{
+    uint32_t rate = I2C_FAST_MODE_CLOCK;
+    uint8_t found = 0;
+    uint8_t i;
+
+    if ( i2c_cfg[i2c_id].mode == I2C_Mode_IPMB ) {
+        /* IPMB-L is specified at 100 kHz, whatever the devices on it */
+        return I2C_STANDARD_MODE_CLOCK;
+    }
+
+    for ( i = 0; i < i2c_device_count; i++ ) {
+        if ( i2c_devices[i].i2c_id == i2c_id ) {
+            found = 1;
+            if ( i2c_devices[i].max_clock < rate ) {
+                rate = i2c_devices[i].max_clock;
+            }
+        }
+    }
+
+    /* Unknown devices may be on the bus, stay in Standard-mode */
+    return found ? rate : I2C_STANDARD_MODE_CLOCK;
+}
+
+i2c_err xI2CRegisterDevice( I2C_ID_T i2c_id, uint8_t addr, uint32_t max_clock )
+{
+    uint32_t rate;
+
+    if ( i2c_device_count >= I2C_MAX_DEVICES ) {
+        return i2c_err_FAILURE;
+    }
+
+    i2c_devices[i2c_device_count].i2c_id = i2c_id;
+    i2c_devices[i2c_device_count].addr = addr;
+    i2c_devices[i2c_device_count].max_clock = max_clock;
+    i2c_device_count++;
+
+    rate = prvI2CBusClock( i2c_id );
+    if ( rate != i2c_cfg[i2c_id].clock_rate ) {
+        i2c_cfg[i2c_id].clock_rate = rate;
+        /* Before vI2CInit the rate is only recorded, it's applied when the clock is enabled */
+        if ( I2C_mutex[i2c_id] != NULL ) {
+            Chip_I2C_SetClockRate( i2c_id, rate );
+        }
+    }
+
+    return i2c_err_SUCCESS;
+}
+
+/* Registry entry of a device, NULL if it wasn't registered */
+static xI2C_device * prvI2CFindDevice( I2C_ID_T i2c_id, uint8_t addr )
+{
+    uint8_t i;
+
+    for ( i = 0; i < i2c_device_count; i++ ) {
+        if ( ( i2c_devices[i].i2c_id == i2c_id ) && ( i2c_devices[i].addr == addr ) ) {
+            return &i2c_devices[i];
+        }
+    }
+    return NULL;
+}
+
+/* Updates the health of a device after a master transfer to it */
+static void prvI2CDeviceResult( I2C_ID_T i2c_id, uint8_t addr, i2c_err error )
+{
+    xI2C_device * dev = prvI2CFindDevice( i2c_id, addr );
+
+    if ( dev == NULL ) {
+        return;
+    }
+
+    switch ( error ) {
+    case i2c_err_SUCCESS:
+    case i2c_err_DATA_SENT_NACK:
+        /* The device answered its address, it's alive */
+        if ( dev->failures | dev->quarantined ) {
+            taskENTER_CRITICAL();
+            dev->failures = 0;
+            dev->quarantined = 0;
+            dev->backoff = 0;
+            taskEXIT_CRITICAL();
+        }
+        break;
+
+    case i2c_err_SLA_R_SENT_NACK:
+    case i2c_err_SLA_W_SENT_NACK:
+    case i2c_err_TIMEOUT:
+        taskENTER_CRITICAL();
+        dev->errors++;
+        if ( dev->failures < 0xFF ) {
+            dev->failures++;
+        }
+        if ( dev->quarantined ) {
+            /* The retry failed too, wait longer before the next one */
+            dev->backoff = ( dev->backoff >= ( I2C_BACKOFF_MAX / 2 ) ) ? I2C_BACKOFF_MAX : dev->backoff * 2;
+            dev->retry_at = xTaskGetTickCount() + dev->backoff;
+        } else if ( dev->failures >= I2C_QUARANTINE_FAILURES ) {
+            dev->quarantined = 1;
+            dev->backoff = I2C_BACKOFF_MIN;
+            dev->retry_at = xTaskGetTickCount() + dev->backoff;
+        }
+        taskEXIT_CRITICAL();
+        break;
+
+    default:
+        /* Lost arbitration, too long, not sent at all: says nothing about the device */
+        break;
+    }
+}
+
+uint8_t xI2CDeviceAvailable( I2C_ID_T i2c_id, uint8_t addr )
+{
+    xI2C_device * dev = prvI2CFindDevice( i2c_id, addr );
+
+    if ( ( dev == NULL ) || !dev->quarantined ) {
+        return 1;
+    }
+    /* Wrap-safe: the backoff is far below half the tick range */
+    return ( (TickType_t)( xTaskGetTickCount() - dev->retry_at ) < ( (TickType_t) ~0 >> 1 ) );
+}
+
+const xI2C_device * pxI2CDeviceInfo( I2C_ID_T i2c_id, uint8_t addr )
+{
+    return prvI2CFindDevice( i2c_id, addr );
+}
+
+void vI2CDeviceReset( I2C_ID_T i2c_id, uint8_t addr )
+{
+    xI2C_device * dev = prvI2CFindDevice( i2c_id, addr );
+
+    if ( dev == NULL ) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    dev->failures = 0;
+    dev->quarantined = 0;
+    dev->errors = 0;
+    dev->backoff = 0;
+    taskEXIT_CRITICAL();
+}
+
+/* Time a master transfer may take: 9 clocks per byte (address bytes included) plus I2C_TIMEOUT_MARGIN */
+static TickType_t prvI2CXferTimeout( I2C_ID_T i2c_id, uint32_t bytes )
+{
+    uint32_t us = ( bytes * 9 * 1000000UL ) / i2c_cfg[i2c_id].clock_rate;
+
+    return ( us / 1000 ) / portTICK_PERIOD_MS + I2C_TIMEOUT_MARGIN;
+}
+
+/* Waits for the end of a single master transfer, recovering the bus if it takes too long */
+static i2c_err prvI2CWaitMaster( I2C_ID_T i2c_id, uint32_t bytes )
+{
+    if ( ulTaskNotifyTake( pdTRUE, prvI2CXferTimeout( i2c_id, bytes ) ) == pdTRUE ) {
+        return i2c_cfg[i2c_id].msg.error;
+    }
+
+    i2c_cfg[i2c_id].timeouts++;
+    vI2CBusRecover( i2c_id );
+    /* Drop a completion that may have slipped in after the timeout */
+    ulTaskNotifyTake( pdTRUE, 0 );
+    return i2c_err_TIMEOUT;
+}
+
+static void prvI2CDelayHalfBit( void )
+{
+    volatile uint32_t n = I2C_RECOVERY_DELAY_LOOPS;
+
+    while ( n-- );
+}
+
+/* Completes every queued chain with i2c_err_TIMEOUT (the transfers that already ended keep their result) */
+static void prvI2CAbortChains( I2C_ID_T i2c_id )
+{
+    xI2C_chain * chain;
+    uint8_t i;
+
+    taskENTER_CRITICAL();
+    for ( chain = i2c_cfg[i2c_id].chain_head; chain != NULL; chain = chain->next ) {
+        i = ( chain == i2c_cfg[i2c_id].chain_head ) ? i2c_cfg[i2c_id].chain_pos : 0;
+        for ( ; i < chain->count; i++ ) {
+            if ( chain->scan == NULL ) {
+                chain->xfer[i].error = i2c_err_TIMEOUT;
+            } else if ( chain->mask & ( 1UL << i ) ) {
+                chain->result[i] = i2c_err_TIMEOUT;
+            }
+        }
+        prvI2CChainComplete( chain, NULL );
+    }
+    i2c_cfg[i2c_id].chain_head = NULL;
+    i2c_cfg[i2c_id].chain_tail = NULL;
+    taskEXIT_CRITICAL();
+}
+
+void vI2CBusRecover( I2C_ID_T i2c_id )
+{
+    const xI2C_pins_t * pins = &i2c_pins[i2c_id];
+    uint8_t i;
+
+    NVIC_DisableIRQ( i2c_cfg[i2c_id].irq );
+    /* Disabling the interface also resets its state machine */
+    I2CCONCLR( i2c_id, ( I2C_I2EN | I2C_STA | I2C_AA | I2C_SI ) );
+
+    /* Take the lines over as (open-drain) GPIOs, both released */
+    gpio_set( pins->scl_port, pins->scl_pin );
+    gpio_set( pins->sda_port, pins->sda_pin );
+    gpio_set_dir( pins->scl_port, pins->scl_pin, 1 );
+    gpio_set_dir( pins->sda_port, pins->sda_pin, 1 );
+    Chip_IOCON_PinMux( LPC_IOCON, pins->scl_port, pins->scl_pin, IOCON_MODE_INACT, IOCON_FUNC0 );
+    Chip_IOCON_PinMux( LPC_IOCON, pins->sda_port, pins->sda_pin, IOCON_MODE_INACT, IOCON_FUNC0 );
+
+    /* Clock out whatever the slave still wants to send, until it releases SDA */
+    for ( i = 0; ( i < 9 ) && !gpio_read( pins->sda_port, pins->sda_pin ); i++ ) {
+        gpio_clear( pins->scl_port, pins->scl_pin );
+        prvI2CDelayHalfBit();
+        gpio_set( pins->scl_port, pins->scl_pin );
+        prvI2CDelayHalfBit();
+    }
+
+    /* STOP condition: SDA rises while SCL is high */
+    gpio_clear( pins->scl_port, pins->scl_pin );
+    prvI2CDelayHalfBit();
+    gpio_clear( pins->sda_port, pins->sda_pin );
+    prvI2CDelayHalfBit();
+    gpio_set( pins->scl_port, pins->scl_pin );
+    prvI2CDelayHalfBit();
+    gpio_set( pins->sda_port, pins->sda_pin );
+    prvI2CDelayHalfBit();
+
+    /* Give the pins back to the interface */
+    Chip_IOCON_PinMux( LPC_IOCON, pins->sda_port, pins->sda_pin, IOCON_MODE_INACT, pins->pin_func );
+    Chip_IOCON_PinMux( LPC_IOCON, pins->scl_port, pins->scl_pin, IOCON_MODE_INACT, pins->pin_func );
+
+    prvI2CAbortChains( i2c_id );
+    i2c_cfg[i2c_id].arb_retries = 0;
+    i2c_cfg[i2c_id].master_pending = 0;
+    i2c_cfg[i2c_id].slave_busy = 0;
+    i2c_cfg[i2c_id].bus_free_at = DWT->CYCCNT;
+    i2c_cfg[i2c_id].bus_recoveries++;
+
+    Chip_I2C_SetClockRate( i2c_id, i2c_cfg[i2c_id].clock_rate );
+    I2CCONSET( i2c_id, I2C_I2EN );
+    if ( i2c_cfg[i2c_id].mode == I2C_Mode_IPMB ) {
+        /* Listen to our slave address again */
+        I2CCONSET( i2c_id, I2C_AA );
+    }
+
+    NVIC_ClearPendingIRQ( i2c_cfg[i2c_id].irq );
+    NVIC_EnableIRQ( i2c_cfg[i2c_id].irq );
+}
+
+/*! @brief Starts the master transfer loaded in the interface message
+ *
+ * Clearing the control flags while a frame addressed to us is coming in would take the state of the slave
+ * receiver away from the ISR (a pending SI, the AA of the next byte). Such a transfer is held back instead
+ * (#xI2C_Config::master_pending) and prvI2CStateSlaveStop starts it right after the STOP of the frame.
+ * Otherwise the START isn't requested before the bus free time (t_BUF) since the last STOP has gone by.
+ */
+static void prvI2CMasterStart( I2C_ID_T i2c_id )
+{
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    uint32_t bus_free_ns = ( cfg->clock_rate > I2C_STANDARD_MODE_CLOCK ) ? I2C_BUS_FREE_NS_FAST : I2C_BUS_FREE_NS_STANDARD;
+    uint32_t bus_free = ( SystemCoreClock / 1000000 ) * bus_free_ns / 1000;
+
+    /* A few microseconds at most, not worth a context switch */
+    while ( ( DWT->CYCCNT - cfg->bus_free_at ) < bus_free );
+
+    taskENTER_CRITICAL();
+    /* An address match not handled yet counts as a frame being received */
+    if ( cfg->slave_busy || ( cfg->reg->CONSET & I2C_SI ) ) {
+        cfg->master_pending = 1;
+        cfg->deferred_starts++;
+    } else {
+        I2CCONCLR( i2c_id, ( I2C_SI | I2C_STO | I2C_STA | I2C_AA));
+        I2CCONSET( i2c_id, ( I2C_I2EN | I2C_STA ) );
+    }
+    taskEXIT_CRITICAL();
+}
+
+uint8_t * pxI2CWriteReserve( I2C_ID_T i2c_id, uint32_t timeout )
+{
+    /* Take the mutex to access the shared memory, it's given back by xI2CWriteCommit */
+    if ( xSemaphoreTake( I2C_mutex[i2c_id], timeout ) != pdTRUE ) {
+        return NULL;
+    }
+
+    return i2c_cfg[i2c_id].msg.tx_data;
+}
+
+i2c_err xI2CWriteCommit( I2C_ID_T i2c_id, uint8_t addr, uint8_t tx_len )
+{
+    i2c_err error;
+
+    /* Checks if the message fits in our buffer */
+    if ( tx_len >= i2cMAX_MSG_LENGTH ) {
+        xSemaphoreGive( I2C_mutex[i2c_id] );
+        return i2c_err_MAX_LENGTH;
+    }
+
+#if configAPP_I2C_MOCK
+    if ( i2c_mock[i2c_id] ) {
+        /* No bus to wait for, the mock reads the buffer before it's given back */
+        error = i2c_mock[i2c_id]( i2c_id, addr, i2c_cfg[i2c_id].msg.tx_data, tx_len );
+        xSemaphoreGive( I2C_mutex[i2c_id] );
+        return error;
+    }
+#endif
+
+    if ( !xI2CDeviceAvailable( i2c_id, addr ) ) {
+        xSemaphoreGive( I2C_mutex[i2c_id] );
+        return i2c_err_QUARANTINED;
+    }
+
+    /* Populate the i2c config struct, the tx buffer was already written by the caller */
+    i2c_cfg[i2c_id].msg.i2c_id = i2c_id;
+    i2c_cfg[i2c_id].msg.addr = addr;
+    i2c_cfg[i2c_id].msg.tx_len = tx_len;
+    i2c_cfg[i2c_id].msg.rx_len = 0;
+    i2c_cfg[i2c_id].msg.flags = 0;
+    i2c_cfg[i2c_id].msg.error = i2c_err_SUCCESS;
+    i2c_cfg[i2c_id].master_task_id = xTaskGetCurrentTaskHandle();
+
+    xSemaphoreGive( I2C_mutex[i2c_id] );
+
+    /* Trigger the i2c interruption, the ISR streams the bytes straight from the tx buffer */
+    KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CMasterStart( i2c_id );
+
+    /* Address byte included */
+    error = prvI2CWaitMaster( i2c_id, tx_len + 1 );
+    KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CDeviceResult( i2c_id, addr, error );
+    return error;
+}
+
+i2c_err xI2CWrite( I2C_ID_T i2c_id, uint8_t addr, uint8_t * tx_data, uint8_t tx_len )
+{
+    uint8_t * tx_buf;
+
+    /* Checks if the message will fit in our buffer */
+    if ( tx_len >= i2cMAX_MSG_LENGTH ) {
+        return i2c_err_MAX_LENGTH;
+    }
+
+    if ( !xI2CDeviceAvailable( i2c_id, addr ) ) {
+        return i2c_err_QUARANTINED;
+    }
+
+    tx_buf = pxI2CWriteReserve( i2c_id, 10 );
+    if ( tx_buf == NULL ) {
+        return i2c_err_FAILURE;
+    }
+
+    memcpy( tx_buf, tx_data, tx_len );
+
+    return xI2CWriteCommit( i2c_id, addr, tx_len );
+}
+
+i2c_err xI2CRead( I2C_ID_T i2c_id, uint8_t addr, uint8_t * rx_data, uint8_t rx_len )
+{
+    i2c_err error;
+
+    if ( !xI2CDeviceAvailable( i2c_id, addr ) ) {
+        return i2c_err_QUARANTINED;
+    }
+
+    /* Take the mutex to access shared memory */
+    xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
+
+    i2c_cfg[i2c_id].msg.i2c_id = i2c_id;
+    i2c_cfg[i2c_id].msg.addr = addr;
+    i2c_cfg[i2c_id].msg.tx_len = 0;
+    i2c_cfg[i2c_id].msg.rx_len = rx_len;
+    i2c_cfg[i2c_id].msg.flags = 0;
+    i2c_cfg[i2c_id].msg.error = i2c_err_SUCCESS;
+    i2c_cfg[i2c_id].master_task_id = xTaskGetCurrentTaskHandle();
+
+    xSemaphoreGive( I2C_mutex[i2c_id] );
+
+    /* Trigger the i2c interruption */
+    KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CMasterStart( i2c_id );
 
-void I2C0_IRQHandler( void )
-{
-    vI2C_ISR( I2C0 );
-}
+    /* Wait here until the message is received */
+    error = prvI2CWaitMaster( i2c_id, rx_len + 1 );
+    KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CDeviceResult( i2c_id, addr, error );
+    if ( error != i2c_err_TIMEOUT ){
+        /* Debug asserts */
+        configASSERT(rx_data);
+        configASSERT(i2c_cfg[i2c_id].msg.rx_data);
 
-void I2C1_IRQHandler( void )
-{
-    vI2C_ISR( I2C1 );
+        xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
+        /* Copy the received message to the given pointer */
+        memcpy (rx_data, i2c_cfg[i2c_id].msg.rx_data, i2c_cfg[i2c_id].msg.rx_len );
+        xSemaphoreGive( I2C_mutex[i2c_id] );
+    }
+    return error;
 }
 
-void I2C2_IRQHandler( void )
+i2c_err xI2CWriteRead( I2C_ID_T i2c_id, uint8_t addr, uint8_t * tx_data, uint8_t tx_len, uint8_t * rx_data, uint8_t rx_len )
 {
-    vI2C_ISR( I2C2 );
-}
+    i2c_err error;
 
-#define I2C_CON_FLAGS (I2C_AA | I2C_SI | I2C_STO | I2C_STA)
+    /* Checks if both parts fit in our buffers */
+    if ( ( tx_len >= i2cMAX_MSG_LENGTH ) || ( rx_len >= i2cMAX_MSG_LENGTH ) ) {
+        return i2c_err_MAX_LENGTH;
+    }
 
+    if ( !xI2CDeviceAvailable( i2c_id, addr ) ) {
+        return i2c_err_QUARANTINED;
+    }
 
-/*! @brief I2C common interrupt service routine
- *
- * I2STAT register is handled inside this function, a state-machine-like implementation for I2C interface.
- *    
- * When a full message is trasmitted or received, the task whose handle is written to #i2c_cfg is notified, unblocking it. It also happens when an error occurs.
- * @warning Slave Transmitter mode states are not implemented in this driver and are just ignored.
- */
-void vI2C_ISR( uint8_t i2c_id )
-{
-    /* Declare local variables */
-    portBASE_TYPE xI2CSemaphoreWokeTask;
+    /* Take the mutex to access shared memory */
+    xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
 
-    /* Initialize variables */
-    xI2CSemaphoreWokeTask = pdFALSE;
-    uint32_t cclr = I2C_CON_FLAGS;
+    memcpy( i2c_cfg[i2c_id].msg.tx_data, tx_data, tx_len );
+    i2c_cfg[i2c_id].msg.i2c_id = i2c_id;
+    i2c_cfg[i2c_id].msg.addr = addr;
+    i2c_cfg[i2c_id].msg.tx_len = tx_len;
+    i2c_cfg[i2c_id].msg.rx_len = rx_len;
+    i2c_cfg[i2c_id].msg.flags = 0;
+    i2c_cfg[i2c_id].msg.error = i2c_err_SUCCESS;
+    i2c_cfg[i2c_id].master_task_id = xTaskGetCurrentTaskHandle();
 
-    /* I2C status handling */
-    switch ( I2CSTAT( i2c_id ) ){
-    case I2C_STAT_START:
-    case I2C_STAT_REPEATED_START:
-        i2c_cfg[i2c_id].rx_cnt = 0;
-        i2c_cfg[i2c_id].tx_cnt = 0;
-        /* Write Slave Address in the I2C bus, if there's nothing
-         * to transmit, the last bit (R/W) will be set to 1 */
-        I2CDAT_WRITE( i2c_id, ( i2c_cfg[i2c_id].msg.addr << 1 ) | ( i2c_cfg[i2c_id].msg.tx_len == 0 ) );
-        break;
+    xSemaphoreGive( I2C_mutex[i2c_id] );
 
-    case I2C_STAT_SLA_W_SENT_ACK:
-        /* Send first data byte */
-        I2CDAT_WRITE( i2c_id, i2c_cfg[i2c_id].msg.tx_data[i2c_cfg[i2c_id].tx_cnt] );
-        i2c_cfg[i2c_id].tx_cnt++;
-        break;
+    /* Trigger the i2c interruption, the ISR switches to reading by itself after the last transmitted byte */
+    KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CMasterStart( i2c_id );
 
-    case I2C_STAT_SLA_W_SENT_NACK:
-        cclr &= ~I2C_STO;
-        i2c_cfg[i2c_id].msg.error = i2c_err_SLA_W_SENT_NACK;
-        vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].master_task_id, &xI2CSemaphoreWokeTask );
-        break;
+    /* Only one notification, at the end of the whole transfer (or on error) */
+    error = prvI2CWaitMaster( i2c_id, tx_len + rx_len + 2 );
+    KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CDeviceResult( i2c_id, addr, error );
+    if ( error == i2c_err_SUCCESS ) {
+        configASSERT(rx_data);
+        memcpy( rx_data, i2c_cfg[i2c_id].msg.rx_data, rx_len );
+    }
+    return error;
+}
 
-    case I2C_STAT_DATA_SENT_ACK:
-        /* Transmit the remaining bytes */
-        if ( i2c_cfg[i2c_id].msg.tx_len != i2c_cfg[i2c_id].tx_cnt ){
-            I2CDAT_WRITE( i2c_id, i2c_cfg[i2c_id].msg.tx_data[i2c_cfg[i2c_id].tx_cnt] );
-            i2c_cfg[i2c_id].tx_cnt++;
-        } else {
-            /* If there's no more data to be transmitted,
-             * finish the communication and notify the caller task */
-            cclr &= ~I2C_STO;
-            vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].master_task_id, &xI2CSemaphoreWokeTask );
+/* Checks every transfer of a chain fits in our buffers, returns the total bytes on the bus (0 if something is too long) */
+static uint32_t prvI2CChainBytes( xI2C_xfer * xfer, uint8_t count )
+{
+    uint32_t bytes = 0;
+    uint8_t i;
+    uint8_t pec;
+
+    for ( i = 0; i < count; i++ ) {
+        pec = ( xfer[i].flags & I2C_XFER_PEC ) ? 1 : 0;
+        if ( ( xfer[i].tx_len + pec >= i2cMAX_MSG_LENGTH ) || ( xfer[i].rx_len + pec >= i2cMAX_MSG_LENGTH ) ) {
+            return 0;
         }
-        break;
+        configASSERT( ( xfer[i].rx_len == 0 ) || xfer[i].rx_data );
+        /* Address bytes of both phases included */
+        bytes += xfer[i].tx_len + xfer[i].rx_len + pec + 2;
+    }
+    return bytes;
+}
 
-    case I2C_STAT_DATA_SENT_NACK:
-        cclr &= ~I2C_STO;
-        i2c_cfg[i2c_id].msg.error = i2c_err_DATA_SENT_NACK;
-        vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].master_task_id, &xI2CSemaphoreWokeTask );
-
-    case I2C_STAT_SLA_R_SENT_ACK:
-        /* SLA+R has been transmitted and ACK'd
-         * If we want to receive only 1 byte, return NACK on the next byte */
-        if ( i2c_cfg[i2c_id].msg.rx_len > 1 ){
-             /* If we expect to receive more than 1 byte,
-             * return ACK on the next byte */
-            cclr &= ~I2C_AA;
+/* Same for the entries of a scan list in its mask */
+static uint32_t prvI2CScanBytes( const xI2C_chain * chain )
+{
+    const xI2C_scan_entry * entry;
+    uint32_t bytes = 0;
+    uint8_t i;
+    uint8_t pec;
+
+    for ( i = 0; i < chain->count; i++ ) {
+        if ( !( chain->mask & ( 1UL << i ) ) ) {
+            continue;
         }
-        break;
+        entry = &chain->scan[i];
+        pec = ( entry->flags & I2C_XFER_PEC ) ? 1 : 0;
+        if ( ( entry->tx_len > sizeof(entry->tx_data) ) || ( entry->rx_len + pec >= i2cMAX_MSG_LENGTH ) ) {
+            return 0;
+        }
+        bytes += entry->tx_len + entry->rx_len + pec + 2;
+    }
+    return bytes;
+}
 
-    case I2C_STAT_DATA_RECV_ACK:
-        if ( i2c_cfg[i2c_id].rx_cnt < i2cMAX_MSG_LENGTH - 1 ){
-            i2c_cfg[i2c_id].msg.rx_data[i2c_cfg[i2c_id].rx_cnt] = I2CDAT_READ( i2c_id );
-            i2c_cfg[i2c_id].rx_cnt++;
-            if (i2c_cfg[i2c_id].rx_cnt != (i2c_cfg[i2c_id].msg.rx_len) - 1 ){
-                cclr &= ~I2C_AA;
+/* Device health of the transfers of an ended chain, returns its first error */
+static i2c_err prvI2CChainResults( xI2C_chain * chain )
+{
+    i2c_err error = i2c_err_SUCCESS;
+    i2c_err result;
+    uint8_t addr;
+    uint8_t i;
+
+    for ( i = 0; i < chain->count; i++ ) {
+        if ( chain->scan != NULL ) {
+            if ( !( chain->mask & ( 1UL << i ) ) ) {
+                continue;
             }
+            addr = chain->scan[i].addr;
+            result = chain->result[i];
+        } else {
+            addr = chain->xfer[i].addr;
+            result = chain->xfer[i].error;
         }
-        break;
+        /* A polled device NACKing is busy, not failing: the owner polls again */
+        if ( ( chain->scan != NULL ) || !( chain->xfer[i].flags & I2C_XFER_POLL ) ||
+             ( result != i2c_err_SLA_W_SENT_NACK ) ) {
+            prvI2CDeviceResult( chain->i2c_id, addr, result );
+        }
+        if ( ( error == i2c_err_SUCCESS ) && ( result != i2c_err_SUCCESS ) ) {
+            error = result;
+        }
+    }
+    return error;
+}
 
-    case I2C_STAT_DATA_RECV_NACK:
-        i2c_cfg[i2c_id].msg.rx_data[i2c_cfg[i2c_id].rx_cnt] = I2CDAT_READ( i2c_id );
-        i2c_cfg[i2c_id].rx_cnt++;
-        cclr &= ~I2C_STO;
-        /* There's no more data to be received */
-        vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].master_task_id, &xI2CSemaphoreWokeTask );
-        break;
+/* Appends a chain to the interface queue, starting it if the bus is idle. It must have something to run */
+static void prvI2CChainSubmit( I2C_ID_T i2c_id, xI2C_chain * chain )
+{
+    uint8_t idle;
+
+    chain->next = NULL;
+    chain->busy = 1;
+
+    /* The I2C interrupt runs below configMAX_SYSCALL_INTERRUPT_PRIORITY, so the queue can't change under us */
+    taskENTER_CRITICAL();
+    idle = ( i2c_cfg[i2c_id].chain_head == NULL );
+    if ( idle ) {
+        i2c_cfg[i2c_id].chain_head = chain;
+        i2c_cfg[i2c_id].chain_pos = 0;
+        prvI2CChainLoad( &i2c_cfg[i2c_id], chain );
+    } else {
+        i2c_cfg[i2c_id].chain_tail->next = chain;
+    }
+    i2c_cfg[i2c_id].chain_tail = chain;
+    taskEXIT_CRITICAL();
 
-    case I2C_STAT_SLA_R_SENT_NACK:
-	cclr &= ~I2C_STO;
-        /* Notify the error */
-        i2c_cfg[i2c_id].msg.error = i2c_err_SLA_R_SENT_NACK;
-        vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].master_task_id, &xI2CSemaphoreWokeTask );
-        break;
+    if ( idle ) {
+        /* Otherwise the ISR starts our chain as soon as the previous one ends */
+        prvI2CMasterStart( i2c_id );
+    }
+}
 
-        /* Slave Mode */
-    case I2C_STAT_SLA_W_RECV_ACK:
-    case I2C_STAT_ARB_LOST_SLA_W_RECV_ACK:
-        i2c_cfg[i2c_id].msg.i2c_id = i2c_id;
-        i2c_cfg[i2c_id].rx_cnt = 0;
-        if ( i2c_cfg[i2c_id].mode == I2C_Mode_IPMB ){
-            i2c_cfg[i2c_id].msg.rx_data[i2c_cfg[i2c_id].rx_cnt] = I2CADDR_READ(i2c_id);
+i2c_err xI2CTransferAsync( I2C_ID_T i2c_id, xI2C_chain * chain )
+{
+    configASSERT( chain->callback );
+    configASSERT( chain->count > 0 );
 
-            //if (i2c_cfg[i2c_id].rx_cnt > 1) {
-        	cclr &= ~I2C_AA;
-            //}
+    if ( prvI2CChainBytes( chain->xfer, chain->count ) == 0 ) {
+        return i2c_err_MAX_LENGTH;
+    }
 
+    chain->caller = NULL;
+    chain->i2c_id = i2c_id;
+    chain->scan = NULL;
+    prvI2CChainSubmit( i2c_id, chain );
+    return i2c_err_SUCCESS;
+}
 
-            i2c_cfg[i2c_id].rx_cnt++;
+i2c_err xI2CScanStart( I2C_ID_T i2c_id, xI2C_chain * chain )
+{
+    configASSERT( chain->scan && chain->result );
+    configASSERT( chain->count <= 32 );
+    configASSERT( !chain->busy );
+
+    chain->i2c_id = i2c_id;
+    chain->caller = ( chain->callback == NULL ) ? xTaskGetCurrentTaskHandle() : NULL;
+    if ( chain->count < 32 ) {
+        chain->mask &= ( 1UL << chain->count ) - 1;
+    }
+    if ( chain->mask == 0 ) {
+        /* Nothing to wait for, xI2CScanWait returns right away */
+        return i2c_err_SUCCESS;
+    }
+    if ( prvI2CScanBytes( chain ) == 0 ) {
+        return i2c_err_MAX_LENGTH;
+    }
 
-        }
+    prvI2CChainSubmit( i2c_id, chain );
+    return i2c_err_SUCCESS;
+}
 
+i2c_err xI2CScanWait( xI2C_chain * chain )
+{
+    I2C_ID_T i2c_id = chain->i2c_id;
+    TickType_t timeout;
 
-        break;
+    configASSERT( chain->callback == NULL );
 
-    case I2C_STAT_SLA_DATA_RECV_ACK:
-        /* Checks if the buffer is full */
-        if ( i2c_cfg[i2c_id].rx_cnt < i2cMAX_MSG_LENGTH ){
-            i2c_cfg[i2c_id].msg.rx_data[i2c_cfg[i2c_id].rx_cnt] = I2CDAT_READ( i2c_id );
-            i2c_cfg[i2c_id].rx_cnt++;
-            cclr &= ~I2C_AA;
+    if ( chain->mask == 0 ) {
+        return i2c_err_SUCCESS;
+    }
+
+    timeout = prvI2CXferTimeout( i2c_id, prvI2CScanBytes( chain ) );
+    /* Each ended scan gives one notification, taken one at a time: one taken here for another
+     * scan of ours is one its own wait won't need */
+    while ( chain->busy ) {
+        if ( ( ulTaskNotifyTake( pdFALSE, timeout ) == 0 ) && chain->busy &&
+             ( i2c_cfg[i2c_id].chain_head == chain ) ) {
+            i2c_cfg[i2c_id].timeouts++;
+            /* Ends our chain, with a notification of its own */
+            vI2CBusRecover( i2c_id );
+            ulTaskNotifyTake( pdFALSE, 0 );
         }
-        break;
+    }
 
-    case I2C_STAT_SLA_DATA_RECV_NACK:
-        cclr &= ~I2C_AA;
-        i2c_cfg[i2c_id].msg.error = i2c_err_SLA_DATA_RECV_NACK;
-        break;
+    return prvI2CChainResults( chain );
+}
 
-    case I2C_STAT_SLA_STOP_REP_START:
-        i2c_cfg[i2c_id].msg.rx_len = i2c_cfg[i2c_id].rx_cnt;
-        if (((i2c_cfg[i2c_id].rx_cnt > 0) && (i2c_cfg[i2c_id].mode == I2C_Mode_Local_Master ))) {
-        		vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].slave_task_id, &xI2CSemaphoreWokeTask );
-    	}
-        if (((i2c_cfg[i2c_id].rx_cnt > 1) && (i2c_cfg[i2c_id].mode == I2C_Mode_IPMB ))) {
-            vTaskNotifyGiveFromISR( i2c_cfg[i2c_id].slave_task_id, &xI2CSemaphoreWokeTask );
+#if configAPP_I2C_MOCK
+/* Chain on a mocked interface: its writes go to the mock one after the other, there's nothing to read from */
+static i2c_err prvI2CMockChain( I2C_ID_T i2c_id, xI2C_xfer * xfer, uint8_t count )
+{
+    i2c_err error = i2c_err_SUCCESS;
+    uint8_t i;
+
+    for ( i = 0; i < count; i++ ) {
+        xfer[i].error = ( xfer[i].rx_len == 0 ) ? i2c_mock[i2c_id]( i2c_id, xfer[i].addr, xfer[i].tx_data, xfer[i].tx_len ) :
+                                                  i2c_err_FAILURE;
+        if ( ( error == i2c_err_SUCCESS ) && ( xfer[i].error != i2c_err_SUCCESS ) ) {
+            error = xfer[i].error;
         }
+    }
+    return error;
+}
+#endif
 
-        cclr &= ~I2C_AA;
-        break;
+i2c_err xI2CTransferChain( I2C_ID_T i2c_id, xI2C_xfer * xfer, uint8_t count )
+{
+    xI2C_chain chain;
+    uint32_t bytes;
 
-    case I2C_STATUS_BUSERR:
-	cclr &= ~I2C_STO;
-	break;
-    default:
-        break;
+    if ( count == 0 ) {
+        return i2c_err_SUCCESS;
     }
 
-	if (!(cclr & I2C_CON_STO)) {
-		//if (slave_active != 0) {
-			cclr &= ~I2C_CON_AA;
-		//}
-		I2CCONSET(i2c_id, cclr ^ I2C_CON_FLAGS);
-		I2CCONCLR(i2c_id, cclr);
-		asm("nop");
-	} else {
-		I2CCONSET(i2c_id, cclr ^ I2C_CON_FLAGS);
-		I2CCONCLR(i2c_id, cclr);
-	}
-
+    bytes = prvI2CChainBytes( xfer, count );
+    if ( bytes == 0 ) {
+        return i2c_err_MAX_LENGTH;
+    }
 
-    if (xI2CSemaphoreWokeTask == pdTRUE) {
-        portYIELD_FROM_ISR(pdTRUE);
+#if configAPP_I2C_MOCK
+    if ( i2c_mock[i2c_id] ) {
+        return prvI2CMockChain( i2c_id, xfer, count );
     }
+#endif
+
+    /* The descriptor lives in our stack, we only return once the ISR is done with it */
+    chain.xfer = xfer;
+    chain.count = count;
+    chain.caller = xTaskGetCurrentTaskHandle();
+    chain.callback = NULL;
+    chain.ctx = NULL;
+    chain.i2c_id = i2c_id;
+    chain.scan = NULL;
+    KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+    prvI2CChainSubmit( i2c_id, &chain );
+
+    /* The time only counts once our chain owns the bus, the ones queued before us have their own timeout */
+    while ( ulTaskNotifyTake( pdTRUE, prvI2CXferTimeout( i2c_id, bytes ) ) != pdTRUE ) {
+        if ( i2c_cfg[i2c_id].chain_head == &chain ) {
+            i2c_cfg[i2c_id].timeouts++;
+            /* Also ends our own chain (notifying us) */
+            vI2CBusRecover( i2c_id );
+            ulTaskNotifyTake( pdTRUE, 0 );
+            break;
+        }
+    }
+    KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_I2C + i2c_id, KERNEL_TRACE_CORR() );
+
+    return prvI2CChainResults( &chain );
 }
 
-void vI2CInit( I2C_ID_T i2c_id, I2C_Mode mode )
+void vI2CSlaveRegister ( I2C_ID_T i2c_id, TaskHandle_t task )
 {
-    char pcI2C_Tag[4];
-    uint8_t sla_addr;
+    /* A single store, the ISR only reads it */
+    i2c_cfg[i2c_id].slave_task_id = task;
+}
 
-    sprintf( pcI2C_Tag, "I2C%u", i2c_id );
-    /*! @todo Maybe wrap these functions, or use some board-specific defines
-     * so this code is generic enough to be applied on other hardware.
-     * Example: (if using LPC17xx and LPCOpen library)
-     * @code
-     * #define PIN_FUNC_CFG( port, pin, func ) Chip_IOCON_PinMux(...)
-     * @endcode
-    */
-    Chip_IOCON_PinMux( LPC_IOCON, i2c_cfg[i2c_id].pins.sda_port, i2c_cfg[i2c_id].pins.sda_pin, IOCON_MODE_INACT, i2c_cfg[i2c_id].pins.pin_func );
-    Chip_IOCON_PinMux( LPC_IOCON, i2c_cfg[i2c_id].pins.scl_port, i2c_cfg[i2c_id].pins.scl_pin, IOCON_MODE_INACT, i2c_cfg[i2c_id].pins.pin_func );
-    Chip_IOCON_EnableOD( LPC_IOCON, i2c_cfg[i2c_id].pins.sda_port, i2c_cfg[i2c_id].pins.sda_pin );
-    Chip_IOCON_EnableOD( LPC_IOCON, i2c_cfg[i2c_id].pins.scl_port, i2c_cfg[i2c_id].pins.scl_pin );
-    NVIC_SetPriority(i2c_cfg[i2c_id].irq, configMAX_SYSCALL_INTERRUPT_PRIORITY);
-    NVIC_EnableIRQ( i2c_cfg[i2c_id].irq );
+uint8_t xI2CSlaveReceive ( I2C_ID_T i2c_id, uint8_t ** rx_frame, uint32_t timeout )
+{
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    uint8_t rd;
 
-    /* Create mutex for accessing the shared memory (i2c_cfg) */
-    I2C_mutex[i2c_id] = xSemaphoreCreateMutex();
+    configASSERT(rx_frame);
 
-    /* Make sure that the mutex is freed */
-    xSemaphoreGive( I2C_mutex[i2c_id] );
+    /* The first caller becomes the receiver if none was registered, there's only one per interface */
+    if ( cfg->slave_task_id == NULL ) {
+        vI2CSlaveRegister( i2c_id, xTaskGetCurrentTaskHandle() );
+    }
+    configASSERT( cfg->slave_task_id == xTaskGetCurrentTaskHandle() );
 
-    /* Set I2C operating mode */
-    if( xSemaphoreTake( I2C_mutex[i2c_id], 0 ) ) {
-        i2c_cfg[i2c_id].mode = mode;
-        xSemaphoreGive( I2C_mutex[i2c_id] );
+    /* Function blocks here until a message is received, frames that
+     * arrived in the meantime are already waiting in the FIFO */
+    while ( cfg->slave_rx_rd == cfg->slave_rx_wr ) {
+        if ( ulTaskNotifyTake( pdTRUE, timeout ) != pdTRUE ) {
+            return 0;
+        }
     }
 
-    /* Enable and configure I2C clock */
-    Chip_I2C_Init( i2c_id );
-    Chip_I2C_SetClockRate( i2c_id, 100000 );
+    /* Past the end of the data, the next frame is at offset 0 */
+    rd = cfg->slave_rx_rd;
+    if ( ( rd == I2C_SLAVE_RX_FIFO_LEN ) || ( cfg->slave_rx_fifo[rd] == 0 ) ) {
+        rd = 0;
+        cfg->slave_rx_rd = rd;
+    }
+    *rx_frame = &cfg->slave_rx_fifo[rd + I2C_SLAVE_RX_HDR];
 
-    /* Enable I2C interface (Master Mode only) */
-    I2CCONSET( i2c_id, I2C_I2EN );
+    /* Return message length */
+    return cfg->slave_rx_fifo[rd];
+}
 
-    if ( mode == I2C_Mode_IPMB )
-    {
-        /* Configure Slave Address */
-        sla_addr = get_ipmb_addr( );
-        I2CADDR_WRITE( i2c_id, sla_addr );
+void vI2CSlaveReleaseFrame ( I2C_ID_T i2c_id )
+{
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    uint8_t rd = cfg->slave_rx_rd;
 
-        /* Configure Slave Address Mask */
-        I2CMASK( i2c_id, 0xFE);
+    /* Only the receiver task moves the read index, no lock needed */
+    cfg->slave_rx_rd = rd + I2C_SLAVE_RX_HDR + cfg->slave_rx_fifo[rd];
+}
 
-        /* Enable slave mode */
-        I2CCONSET( i2c_id, I2C_AA );
-    }
+uint32_t ulI2CSlaveFrameStamp ( I2C_ID_T i2c_id )
+{
+    const uint8_t * hdr = &i2c_cfg[i2c_id].slave_rx_fifo[i2c_cfg[i2c_id].slave_rx_rd];
 
-    /* Clear I2C0 interrupt (just in case) */
-    I2CCONCLR( i2c_id, I2C_SI );
+    return hdr[1] | ( hdr[2] << 8 ) | ( hdr[3] << 16 ) | ( (uint32_t) hdr[4] << 24 );
+}
 
-} /* End of vI2C_Init */
+uint8_t ucI2CSlaveFrameAddr ( I2C_ID_T i2c_id )
+{
+    const uint8_t * hdr = &i2c_cfg[i2c_id].slave_rx_fifo[i2c_cfg[i2c_id].slave_rx_rd];
 
-i2c_err xI2CWrite( I2C_ID_T i2c_id, uint8_t addr, uint8_t * tx_data, uint8_t tx_len )
+    return hdr[5];
+}
+
+/* Programs the address register of an extra slot (ADR1 to ADR3), 0 disables it */
+static void prvI2CSlaveAddrWrite( I2C_ID_T i2c_id, uint8_t slot, uint8_t addr )
 {
-    /* Checks if the message will fit in our buffer */
-    if ( tx_len >= i2cMAX_MSG_LENGTH ) {
-        return i2c_err_MAX_LENGTH;
+    volatile uint32_t * adr = &LPC_I2Cx( i2c_id )->ADR1;
+
+#if configAPP_I2C_MOCK
+    if ( i2c_mock[i2c_id] ) {
+        return;
+    }
+#endif
+    LPC_I2Cx( i2c_id )->MASK[slot + 1] = 0x00;
+    adr[slot] = addr;
+}
+
+uint8_t xI2CSlaveAddAddress ( I2C_ID_T i2c_id, uint8_t addr )
+{
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    uint8_t slot = I2C_SLAVE_ADDR_EXTRA;
+    uint8_t i;
+
+    addr &= 0xFE;
+    configASSERT( addr != 0 );
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < I2C_SLAVE_ADDR_EXTRA; i++ ) {
+        if ( cfg->slave_addr[i] == addr ) {
+            taskEXIT_CRITICAL();
+            return 1;
+        }
+        if ( ( cfg->slave_addr[i] == 0 ) && ( slot == I2C_SLAVE_ADDR_EXTRA ) ) {
+            slot = i;
+        }
     }
+    if ( slot < I2C_SLAVE_ADDR_EXTRA ) {
+        cfg->slave_addr[slot] = addr;
+        prvI2CSlaveAddrWrite( i2c_id, slot, addr );
+    }
+    taskEXIT_CRITICAL();
 
-    /* Take the mutex to access the shared memory */
-    if (xSemaphoreTake( I2C_mutex[i2c_id], 10 ) == pdTRUE) {
-    xSemaphoreTake( I2C_mutex[i2c_id], 10 );
+    return slot < I2C_SLAVE_ADDR_EXTRA;
+}
 
-    /* Populate the i2c config struct */
-    i2c_cfg[i2c_id].msg.i2c_id = i2c_id;
-    i2c_cfg[i2c_id].msg.addr = addr;
-    memcpy(i2c_cfg[i2c_id].msg.tx_data, tx_data, tx_len);
-    i2c_cfg[i2c_id].msg.tx_len = tx_len;
-    i2c_cfg[i2c_id].msg.rx_len = 0;
-    i2c_cfg[i2c_id].master_task_id = xTaskGetCurrentTaskHandle();
+void vI2CSlaveRemoveAddress ( I2C_ID_T i2c_id, uint8_t addr )
+{
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    uint8_t i;
 
-    xSemaphoreGive( I2C_mutex[i2c_id] );
-    } else {
-    	return i2c_err_FAILURE;
+    addr &= 0xFE;
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < I2C_SLAVE_ADDR_EXTRA; i++ ) {
+        if ( ( addr != 0 ) && ( cfg->slave_addr[i] == addr ) ) {
+            cfg->slave_addr[i] = 0;
+            prvI2CSlaveAddrWrite( i2c_id, i, 0 );
+        }
     }
+    taskEXIT_CRITICAL();
+}
 
-    /* Trigger the i2c interruption */
-    /* @bug Is it safe to set the flag right now? Won't it stop another ongoing message that is being received for example? */
-    I2CCONCLR( i2c_id, ( I2C_SI | I2C_STO | I2C_STA | I2C_AA));
-    I2CCONSET( i2c_id, ( I2C_I2EN | I2C_STA ) );
+uint8_t xI2CSlaveTransfer ( I2C_ID_T i2c_id, uint8_t * rx_data, uint32_t timeout )
+{
+    uint8_t * rx_frame;
+    uint8_t rx_len;
 
-    if ( ulTaskNotifyTake( pdTRUE, portMAX_DELAY ) == pdTRUE ){
-        /* Include the error in i2c_cfg global structure */
-	//I2CCONSET(i2c_id, I2C_I2EN | I2C_AA );
-        return i2c_cfg[i2c_id].msg.error;
+    /* Debug asserts */
+    configASSERT(rx_data);
+
+    rx_len = xI2CSlaveReceive( i2c_id, &rx_frame, timeout );
+    if ( rx_len > 0 ) {
+        /* Copy the rx buffer to the pointer given */
+        memcpy( rx_data, rx_frame, rx_len );
+        vI2CSlaveReleaseFrame( i2c_id );
     }
 
-    /* Should not get here, so return failure */
-    return i2c_err_FAILURE;
+    /* Return message length */
+    return rx_len;
 }
 
-i2c_err xI2CRead( I2C_ID_T i2c_id, uint8_t addr, uint8_t * rx_data, uint8_t rx_len )
+#if I2C_SNOOP
+uint8_t xI2CSnoopEnable( I2C_ID_T i2c_id, uint8_t enable )
 {
-    /* Take the mutex to access shared memory */
-    xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
+    static uint8_t exporting;
 
-    i2c_cfg[i2c_id].msg.i2c_id = i2c_id;
-    i2c_cfg[i2c_id].msg.addr = addr;
-    i2c_cfg[i2c_id].msg.tx_len = 0;
-    i2c_cfg[i2c_id].msg.rx_len = rx_len;
-    i2c_cfg[i2c_id].master_task_id = xTaskGetCurrentTaskHandle();
+    if ( i2c_cfg[i2c_id].mode != I2C_Mode_IPMB ) {
+        return 0;
+    }
+#if configAPP_I2C_MOCK
+    if ( i2c_mock[i2c_id] ) {
+        return 0;
+    }
+#endif
 
-    xSemaphoreGive( I2C_mutex[i2c_id] );
+    if ( !enable ) {
+        if ( i2c_snoop_id == i2c_id ) {
+            I2CMASK( i2c_id, 0x00 );
+            i2c_snoop_id = I2C_NUM_INTERFACE;
+        }
+        return 1;
+    }
 
-    /* Trigger the i2c interruption */
-    /* Is it safe to set the flag right now? Won't it stop another ongoing message that is being received for example? */
-    I2CCONSET( i2c_id, ( I2C_I2EN | I2C_STA ) );
+    if ( ( i2c_snoop_id != I2C_NUM_INTERFACE ) && ( i2c_snoop_id != i2c_id ) ) {
+        return 0;
+    }
+    if ( !exporting ) {
+        exporting = periodic_start( &i2c_snoop_job );
+        if ( !exporting ) {
+            return 0;
+        }
+    }
 
-    /* Wait here until the message is received */
-    if ( ulTaskNotifyTake( pdTRUE, portMAX_DELAY ) == pdTRUE ){
-        /* Debug asserts */
-        configASSERT(rx_data);
-        configASSERT(i2c_cfg[i2c_id].msg.rx_data);
+    /* Timestamps come from the core cycle counter */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
-        xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
-        /* Copy the received message to the given pointer */
-        memcpy (rx_data, i2c_cfg[i2c_id].msg.rx_data, i2c_cfg[i2c_id].msg.rx_len );
-        xSemaphoreGive( I2C_mutex[i2c_id] );
+    taskENTER_CRITICAL();
+    i2c_snoop_captured = 0;
+    i2c_snoop_dropped = 0;
+    i2c_snoop_id = i2c_id;
+    taskEXIT_CRITICAL();
+
+    /* Every address matches, prvI2CSnoopBegin sorts the frames out */
+    I2CMASK( i2c_id, 0xFE );
+    return 1;
+}
+
+uint32_t ulI2CSnoopCaptured( void )
+{
+    return i2c_snoop_captured;
+}
+
+uint32_t ulI2CSnoopDropped( void )
+{
+    return i2c_snoop_dropped;
+}
+
+/*! @brief Periodic job (timer task): writes the oldest captured frames to the log */
+static void prvI2CSnoopExport( void * arg )
+{
+    xI2C_snoop_frame * frame;
+    uint32_t word[4];
+    uint8_t chunk;
+    uint8_t n;
+    uint8_t i;
+
+    (void) arg;
+
+    for ( n = 0; ( n < I2C_SNOOP_EXPORT_MAX ) && ( i2c_snoop_rd != i2c_snoop_wr ); n++ ) {
+        /* The frame is read after the index that published it */
+        I2C_COMPILER_BARRIER();
+        frame = &i2c_snoop_ring[i2c_snoop_rd & ( I2C_SNOOP_LEN - 1 )];
+        LOG( "i2c,snoop,%u,%u,%u", frame->timestamp, frame->i2c_id, frame->len );
+        for ( i = 0; i < frame->len; i += sizeof(word) ) {
+            chunk = ( frame->len - i < sizeof(word) ) ? frame->len - i : sizeof(word);
+            memset( word, 0, sizeof(word) );
+            memcpy( word, &frame->data[i], chunk );
+            LOG( "i2c,snoop_data,%x,%x,%x,%x", word[0], word[1], word[2], word[3] );
+        }
+        I2C_COMPILER_BARRIER();
+        i2c_snoop_rd++;
     }
-    return i2c_cfg[i2c_id].msg.error;
 }
+#endif
 
-uint8_t xI2CSlaveTransfer ( I2C_ID_T i2c_id, uint8_t * rx_data, uint32_t timeout )
+#if configAPP_I2C_MOCK
+/*
+ *==============================================================
+ * MOCK BACKEND
+ *==============================================================
+*/
+
+void vI2CMockAttach( I2C_ID_T i2c_id, i2c_mock_tx tx )
 {
-    /* Take the mutex to access shared memory */
-    xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
+    i2c_mock[i2c_id] = tx;
+}
 
-    /* Register this task as the one to be notified when a message comes */
-    i2c_cfg[i2c_id].slave_task_id = xTaskGetCurrentTaskHandle();
+/* vI2CInit of a mocked interface: the driver state only, no pins, peripheral or interrupt */
+static void prvI2CMockInit( I2C_ID_T i2c_id, I2C_Mode mode )
+{
+    I2C_mutex[i2c_id] = xSemaphoreCreateMutex();
+    i2c_cfg[i2c_id].mode = mode;
+    i2c_cfg[i2c_id].clock_rate = prvI2CBusClock( i2c_id );
 
-    /* Relase mutex */
-    xSemaphoreGive( I2C_mutex[i2c_id] );
+    if ( mode == I2C_Mode_IPMB ) {
+        ipmb_addr = probe_ipmb_addr( );
+    }
+}
 
-    /* Function blocks here until a message is received */
-    if ( ulTaskNotifyTake( pdTRUE, timeout ) == pdTRUE )
-    {
-            /* Debug asserts */
-            configASSERT(rx_data);
-            configASSERT(i2c_cfg[i2c_id].msg.rx_data);
-
-            xSemaphoreTake( I2C_mutex[i2c_id], portMAX_DELAY );
-            /* Copy the rx buffer to the pointer given */
-            memcpy( rx_data, i2c_cfg[i2c_id].msg.rx_data, i2c_cfg[i2c_id].msg.rx_len );
-            xSemaphoreGive( I2C_mutex[i2c_id] );
-    } else {
+uint8_t xI2CMockInject( I2C_ID_T i2c_id, const uint8_t * frame, uint8_t len )
+{
+    xI2C_Config * cfg = &i2c_cfg[i2c_id];
+    TaskHandle_t receiver;
+    uint8_t start;
+
+    configASSERT( ( len > 0 ) && ( len <= i2cMAX_MSG_LENGTH ) );
+
+    /* Same reception as the ISR's, the critical section stands for it */
+    taskENTER_CRITICAL();
+    start = prvI2CSlaveReserve( cfg );
+    if ( start == I2C_SLAVE_RX_NONE ) {
+        cfg->slave_rx_dropped++;
+        taskEXIT_CRITICAL();
         return 0;
     }
-    /* Return message length */
-    return i2c_cfg[i2c_id].msg.rx_len;
+    memcpy( &cfg->slave_rx_fifo[start + I2C_SLAVE_RX_HDR], frame, len );
+    prvI2CSlavePublish( cfg, start, len, ( cfg->mode == I2C_Mode_IPMB ) ? frame[0] : 0 );
+    receiver = cfg->slave_task_id;
+    taskEXIT_CRITICAL();
+
+    if ( receiver ) {
+        xTaskNotifyGive( receiver );
+    }
+    return 1;
 }
+#endif
 
 /*
  *==============================================================
@@ -503,13 +2021,13 @@ unsigned char IPMBL_TABLE[IPMBL_TABLE_SIZE] = {
  *  | UUU | 222 | 26 | 0xA2 |
  */
 #define GPIO_GA_DELAY 10
-uint8_t get_ipmb_addr( void )
+uint8_t probe_ipmb_addr( void )
 {
     uint8_t ga0, ga1, ga2;
     uint8_t index;
 
     /* Set the test pin and read all GA pins */
-    Chip_GPIO_SetPinState(LPC_GPIO, GA_TEST_PORT, GA_TEST_PIN, 1);
+    GPIO_PIN_SET( GA_TEST );
 
     /* when using NAMC-EXT-RTM at least 11 instruction cycles required
      *  to have correct GA value after GA_TEST_PIN changes */
@@ -520,13 +2038,13 @@ uint8_t get_ipmb_addr( void )
 	}
 
 
-    ga0 = Chip_GPIO_GetPinState(LPC_GPIO, GA0_PORT, GA0_PIN);
-    ga1 = Chip_GPIO_GetPinState(LPC_GPIO, GA1_PORT, GA1_PIN);
-    ga2 = Chip_GPIO_GetPinState(LPC_GPIO, GA2_PORT, GA2_PIN);
+    ga0 = GPIO_PIN_READ( GA0 );
+    ga1 = GPIO_PIN_READ( GA1 );
+    ga2 = GPIO_PIN_READ( GA2 );
 
     /* Clear the test pin and see if any GA pin has changed is value,
      * meaning that it is unconnected */
-    Chip_GPIO_SetPinState(LPC_GPIO, GA_TEST_PORT, GA_TEST_PIN, 0);
+    GPIO_PIN_CLEAR( GA_TEST );
 
     /* when using NAMC-EXT-RTM at least 11 instruction cycles required
      *  to have correct GA value after GA_TEST_PIN changes */
@@ -537,17 +2055,17 @@ uint8_t get_ipmb_addr( void )
 	}
 
 
-    if ( ga0 != Chip_GPIO_GetPinState(LPC_GPIO, GA0_PORT, GA0_PIN) )
+    if ( ga0 != GPIO_PIN_READ( GA0 ) )
     {
         ga0 = UNCONNECTED;
     }
 
-    if ( ga1 != Chip_GPIO_GetPinState(LPC_GPIO, GA1_PORT, GA1_PIN) )
+    if ( ga1 != GPIO_PIN_READ( GA1 ) )
     {
         ga1 = UNCONNECTED;
     }
 
-    if ( ga2 != Chip_GPIO_GetPinState(LPC_GPIO, GA2_PORT, GA2_PIN) )
+    if ( ga2 != GPIO_PIN_READ( GA2 ) )
     {
         ga2 = UNCONNECTED;
     }
@@ -564,3 +2082,34 @@ uint8_t get_ipmb_addr( void )
 }
 #undef GPIO_GA_DELAY
 
+uint8_t get_ipmb_addr( void )
+{
+    /* GA pins are only probed if nobody has configured the IPMB interface yet */
+    if ( ipmb_addr == 0 ) {
+        ipmb_addr = probe_ipmb_addr();
+    }
+    return ipmb_addr;
+}
+
+#if IPMB_ADDR_RECHECK_PERIOD
+/*! @brief Timer callback that probes the GA pins again
+ *
+ * Only a valid address different from the cached one is applied (a glitch reading the pins returns 0),
+ * and the slave address register of every interface in IPMB mode follows it.
+ */
+static void vIPMBAddrRecheck( TimerHandle_t timer )
+{
+    uint8_t addr = probe_ipmb_addr();
+    uint8_t i;
+
+    if ( ( addr != 0 ) && ( addr != ipmb_addr ) ) {
+        ipmb_addr = addr;
+        for ( i = 0; i < I2C_NUM_INTERFACE; i++ ) {
+            if ( i2c_cfg[i].mode == I2C_Mode_IPMB ) {
+                I2CADDR_WRITE( i, addr );
+            }
+        }
+    }
+}
+#endif
+
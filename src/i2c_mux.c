@@ -0,0 +1,206 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file i2c_mux.c
+ *
+ * @brief Cached channel selection for devices behind I2C switches
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "i2c_mux.h"
+
+/*! @brief Registered switch */
+typedef struct {
+    I2C_ID_T i2c_id;               /*!< Interface the switch is connected to */
+    uint8_t addr;                  /*!< Switch slave address */
+    uint8_t current;               /*!< Selected channel, #I2C_MUX_CHANNEL_UNKNOWN if not known */
+    SemaphoreHandle_t lock;        /*!< Keeps the selection and the transfer together */
+} xI2C_mux;
+
+static xI2C_mux i2c_mux[I2C_MUX_MAX];
+static uint8_t i2c_mux_count;
+
+uint8_t xI2CMuxRegister( I2C_ID_T i2c_id, uint8_t addr )
+{
+    xI2C_mux * m;
+
+    if ( i2c_mux_count >= I2C_MUX_MAX ) {
+        return I2C_MUX_INVALID;
+    }
+
+    m = &i2c_mux[i2c_mux_count];
+    m->i2c_id = i2c_id;
+    m->addr = addr;
+    m->current = I2C_MUX_CHANNEL_UNKNOWN;
+    m->lock = xSemaphoreCreateMutex();
+    configASSERT( m->lock );
+
+    return i2c_mux_count++;
+}
+
+/* Writes the control byte, unless the channel is already selected. Must be called with the switch locked */
+static i2c_err prvMuxSelect( xI2C_mux * m, uint8_t channel )
+{
+    uint8_t ctrl = ( 1 << channel );
+    i2c_err err;
+
+    if ( m->current == channel ) {
+        return i2c_err_SUCCESS;
+    }
+
+    err = xI2CWrite( m->i2c_id, m->addr, &ctrl, 1 );
+    m->current = ( err == i2c_err_SUCCESS ) ? channel : I2C_MUX_CHANNEL_UNKNOWN;
+    return err;
+}
+
+/* Locks the switch and selects the channel, returns NULL (switch unlocked) if it fails */
+static xI2C_mux * prvMuxAcquire( uint8_t mux, uint8_t channel, i2c_err * err )
+{
+    xI2C_mux * m;
+
+    configASSERT( ( mux < i2c_mux_count ) && ( channel < I2C_MUX_CHANNELS ) );
+    m = &i2c_mux[mux];
+
+    xSemaphoreTake( m->lock, portMAX_DELAY );
+    *err = prvMuxSelect( m, channel );
+    if ( *err != i2c_err_SUCCESS ) {
+        xSemaphoreGive( m->lock );
+        return NULL;
+    }
+    return m;
+}
+
+static void prvMuxRelease( xI2C_mux * m, i2c_err err )
+{
+    if ( err == i2c_err_TIMEOUT ) {
+        /* The bus was recovered in the middle of something, don't trust the cached channel */
+        m->current = I2C_MUX_CHANNEL_UNKNOWN;
+    }
+    xSemaphoreGive( m->lock );
+}
+
+i2c_err xI2CMuxWrite( uint8_t mux, uint8_t channel, uint8_t addr, uint8_t * tx_data, uint8_t tx_len )
+{
+    xI2C_mux * m;
+    i2c_err err;
+
+    m = prvMuxAcquire( mux, channel, &err );
+    if ( m == NULL ) {
+        return err;
+    }
+
+    err = xI2CWrite( m->i2c_id, addr, tx_data, tx_len );
+    prvMuxRelease( m, err );
+    return err;
+}
+
+i2c_err xI2CMuxRead( uint8_t mux, uint8_t channel, uint8_t addr, uint8_t * rx_data, uint8_t rx_len )
+{
+    xI2C_mux * m;
+    i2c_err err;
+
+    m = prvMuxAcquire( mux, channel, &err );
+    if ( m == NULL ) {
+        return err;
+    }
+
+    err = xI2CRead( m->i2c_id, addr, rx_data, rx_len );
+    prvMuxRelease( m, err );
+    return err;
+}
+
+i2c_err xI2CMuxWriteRead( uint8_t mux, uint8_t channel, uint8_t addr, uint8_t * tx_data, uint8_t tx_len, uint8_t * rx_data, uint8_t rx_len )
+{
+    xI2C_mux * m;
+    i2c_err err;
+
+    m = prvMuxAcquire( mux, channel, &err );
+    if ( m == NULL ) {
+        return err;
+    }
+
+    err = xI2CWriteRead( m->i2c_id, addr, tx_data, tx_len, rx_data, rx_len );
+    prvMuxRelease( m, err );
+    return err;
+}
+
+i2c_err xI2CMuxBatch( uint8_t mux, xI2C_mux_xfer * xfer, uint8_t count )
+{
+    xI2C_mux * m;
+    xI2C_xfer chain[I2C_MUX_BATCH_MAX];
+    uint8_t order[I2C_MUX_BATCH_MAX];
+    uint8_t key[I2C_MUX_BATCH_MAX];
+    uint8_t first;
+    uint8_t i, j, n, tmp;
+    i2c_err err, ret = i2c_err_SUCCESS;
+
+    configASSERT( ( mux < i2c_mux_count ) && ( count <= I2C_MUX_BATCH_MAX ) );
+    m = &i2c_mux[mux];
+
+    xSemaphoreTake( m->lock, portMAX_DELAY );
+
+    /* Stable insertion sort by channel, rotated so the selected channel comes first */
+    first = ( m->current == I2C_MUX_CHANNEL_UNKNOWN ) ? 0 : m->current;
+    for ( i = 0; i < count; i++ ) {
+        configASSERT( xfer[i].channel < I2C_MUX_CHANNELS );
+        key[i] = ( xfer[i].channel - first ) & ( I2C_MUX_CHANNELS - 1 );
+        for ( j = i; ( j > 0 ) && ( key[order[j-1]] > key[i] ); j-- ) {
+            order[j] = order[j-1];
+        }
+        order[j] = i;
+    }
+
+    for ( i = 0; i < count; i = j ) {
+        /* Collect the group of transfers on the same channel */
+        for ( j = i, n = 0; ( j < count ) && ( xfer[order[j]].channel == xfer[order[i]].channel ); j++ ) {
+            chain[n++] = xfer[order[j]].xfer;
+        }
+
+        err = prvMuxSelect( m, xfer[order[i]].channel );
+        if ( err == i2c_err_SUCCESS ) {
+            err = xI2CTransferChain( m->i2c_id, chain, n );
+        } else {
+            /* Don't talk to the devices of the channel still selected */
+            for ( tmp = 0; tmp < n; tmp++ ) {
+                chain[tmp].error = i2c_err_FAILURE;
+            }
+        }
+
+        for ( tmp = 0; tmp < n; tmp++ ) {
+            xfer[order[i + tmp]].xfer.error = chain[tmp].error;
+        }
+
+        if ( err == i2c_err_TIMEOUT ) {
+            m->current = I2C_MUX_CHANNEL_UNKNOWN;
+        }
+        if ( ret == i2c_err_SUCCESS ) {
+            ret = err;
+        }
+    }
+
+    xSemaphoreGive( m->lock );
+    return ret;
+}
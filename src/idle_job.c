@@ -0,0 +1,101 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file idle_job.c
+ *
+ * @brief Background maintenance jobs, run by the idle task in short slices
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Project includes */
+#include "idle_job.h"
+
+/* A pass is due once the tick is at most half the tick range past its due tick (the ticks wrap) */
+#define IDLE_JOB_REACHED( now, tick )   ( (TickType_t) ( ( now ) - ( tick ) ) < ( portMAX_DELAY / 2 ) )
+
+static idle_job * idle_jobs[IDLE_JOB_MAX_JOBS];
+static volatile uint8_t idle_job_num;
+/* Job given the last slice, the search for the next one starts after it */
+static uint8_t idle_job_last;
+
+uint8_t idle_job_start( idle_job * job )
+{
+    configASSERT( job->step );
+
+    job->due = xTaskGetTickCount();
+    job->active = 0;
+    job->passes = 0;
+    job->slices = 0;
+
+    taskENTER_CRITICAL();
+    if ( idle_job_num >= IDLE_JOB_MAX_JOBS ) {
+        taskEXIT_CRITICAL();
+        return 0;
+    }
+    idle_jobs[idle_job_num] = job;
+    idle_job_num++;
+    taskEXIT_CRITICAL();
+    return 1;
+}
+
+uint8_t idle_job_pending( void )
+{
+    TickType_t now = xTaskGetTickCount();
+    uint8_t i;
+
+    for ( i = 0; i < idle_job_num; i++ ) {
+        if ( idle_jobs[i]->active || IDLE_JOB_REACHED( now, idle_jobs[i]->due ) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Called by the idle task on every pass of its loop, with the scheduler running */
+void vApplicationIdleHook( void )
+{
+    TickType_t now = xTaskGetTickCount();
+    idle_job * job;
+    uint8_t num = idle_job_num;
+    uint8_t n;
+    uint8_t i;
+
+    for ( n = 1; n <= num; n++ ) {
+        i = ( idle_job_last + n ) % num;
+        job = idle_jobs[i];
+
+        if ( !job->active && !IDLE_JOB_REACHED( now, job->due ) ) {
+            continue;
+        }
+
+        job->active = 1;
+        job->slices++;
+        if ( job->step( job->arg ) == IDLE_JOB_DONE ) {
+            job->active = 0;
+            job->passes++;
+            job->due = xTaskGetTickCount() + job->period;
+        }
+        idle_job_last = i;
+        return;
+    }
+}
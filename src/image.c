@@ -0,0 +1,192 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file image.c
+ *
+ * @brief Slot headers, image selection and IAP flash helpers (linked into the boot loader too)
+ */
+
+/* C Standard includes */
+#include "stddef.h"
+
+/* Project includes */
+#include "chip.h"
+#include "ram_sections.h"
+#include "image.h"
+
+#define IMAGE_RAM_START             0x10000000
+#define IMAGE_RAM_END               0x10004000
+
+/* Start of the vector table of the running image, from the linker script */
+extern uint8_t __vectors_start__;
+
+/* Keeps anything else off the boot note, which the loader writes at the start of RamLoc16 */
+static image_boot_state image_boot_reserved __attribute__ ((used, section(".bss.$RESERVED")));
+
+static uint32_t image_row[IMAGE_ROW / 4] __RAM_AHB_NOINIT;
+
+uint32_t image_crc32_update( uint32_t crc, const void * data, uint32_t len )
+{
+    const uint8_t * p = data;
+    uint8_t bit;
+
+    while ( len-- ) {
+        crc ^= *p++;
+        for ( bit = 0; bit < 8; bit++ ) {
+            crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -( crc & 1 ) );
+        }
+    }
+    return crc;
+}
+
+uint32_t image_crc32( const void * data, uint32_t len )
+{
+    return ~image_crc32_update( 0xFFFFFFFF, data, len );
+}
+
+const image_header * image_get_header( uint8_t slot )
+{
+    return (const image_header *) ( IMAGE_SLOT_BASE( slot ) + IMAGE_HEADER_OFFSET );
+}
+
+uint8_t image_slot_valid( uint8_t slot )
+{
+    const image_header * header = image_get_header( slot );
+    const uint32_t * vectors = (const uint32_t *) IMAGE_SLOT_BASE( slot );
+
+    if ( ( header->magic != IMAGE_MAGIC ) || ( header->length > IMAGE_HEADER_OFFSET ) ||
+         ( header->header_crc != image_crc32( header, offsetof(image_header, header_crc) ) ) ) {
+        return 0;
+    }
+    /* Written erased or for the other slot */
+    if ( ( vectors[0] <= IMAGE_RAM_START ) || ( vectors[0] > IMAGE_RAM_END ) ) {
+        return 0;
+    }
+    return ( vectors[1] & 1 ) && ( ( vectors[1] & ~1 ) >= IMAGE_SLOT_BASE( slot ) ) &&
+           ( ( vectors[1] & ~1 ) < IMAGE_SLOT_BASE( slot ) + header->length );
+}
+
+uint8_t image_slot_confirmed( uint8_t slot )
+{
+    return *(const uint32_t *) ( IMAGE_SLOT_BASE( slot ) + IMAGE_CONFIRM_OFFSET ) == IMAGE_CONFIRM_MAGIC;
+}
+
+uint8_t image_select( uint8_t failed )
+{
+    uint8_t best = IMAGE_SLOT_NONE;
+    uint8_t slot;
+
+    for ( slot = 0; slot < IMAGE_SLOTS; slot++ ) {
+        if ( !image_slot_valid( slot ) || ( ( slot == failed ) && !image_slot_confirmed( slot ) ) ) {
+            continue;
+        }
+        if ( ( best == IMAGE_SLOT_NONE ) ||
+             ( (int32_t) ( image_get_header( slot )->sequence - image_get_header( best )->sequence ) > 0 ) ) {
+            best = slot;
+        }
+    }
+    /* A failed image is still better than none */
+    if ( ( best == IMAGE_SLOT_NONE ) && ( failed < IMAGE_SLOTS ) && image_slot_valid( failed ) ) {
+        best = failed;
+    }
+    return best;
+}
+
+uint8_t image_flash_erase( uint32_t first, uint32_t last )
+{
+    uint32_t sector;
+    uint8_t ret = IAP_CMD_SUCCESS;
+
+    for ( sector = first; ( sector <= last ) && ( ret == IAP_CMD_SUCCESS ); sector++ ) {
+        __disable_irq();
+        if ( Chip_IAP_BlankCheckSector( sector, sector ) != IAP_CMD_SUCCESS ) {
+            ret = Chip_IAP_PreSectorForReadWrite( sector, sector );
+            if ( ret == IAP_CMD_SUCCESS ) {
+                ret = Chip_IAP_EraseSector( sector, sector );
+            }
+        }
+        __enable_irq();
+    }
+    return ret == IAP_CMD_SUCCESS;
+}
+
+uint8_t image_flash_write( uint32_t addr, const uint32_t * buf, uint32_t len )
+{
+    uint8_t ret;
+
+    __disable_irq();
+    ret = Chip_IAP_PreSectorForReadWrite( IMAGE_SECTOR( addr ), IMAGE_SECTOR( addr + len - 1 ) );
+    if ( ret == IAP_CMD_SUCCESS ) {
+        ret = Chip_IAP_CopyRamToFlash( addr, (uint32_t *) buf, len );
+    }
+    __enable_irq();
+
+    return ret == IAP_CMD_SUCCESS;
+}
+
+uint8_t image_running_slot( void )
+{
+    uint8_t slot;
+
+    for ( slot = 0; slot < IMAGE_SLOTS; slot++ ) {
+        if ( (uint32_t) &__vectors_start__ == IMAGE_SLOT_BASE( slot ) ) {
+            return slot;
+        }
+    }
+    return IMAGE_SLOT_NONE;
+}
+
+void image_init( void )
+{
+    volatile image_boot_state * state = IMAGE_BOOT_STATE;
+    uint8_t failed = state->failed;
+    uint32_t header;
+
+    (void) image_boot_reserved;
+
+    if ( ( state->magic != IMAGE_BOOT_TRIAL ) || ( failed >= IMAGE_SLOTS ) || ( failed == image_running_slot() ) ) {
+        return;
+    }
+    /* Started again, the loader would keep falling back on every reset: its header goes */
+    if ( !image_slot_confirmed( failed ) ) {
+        header = IMAGE_SLOT_BASE( failed ) + IMAGE_HEADER_OFFSET;
+        image_flash_erase( IMAGE_SECTOR( header ), IMAGE_SECTOR( header ) );
+    }
+    state->failed = IMAGE_SLOT_NONE;
+}
+
+void image_confirm( void )
+{
+    uint8_t slot = image_running_slot();
+    uint32_t i;
+
+    if ( slot == IMAGE_SLOT_NONE ) {
+        return;
+    }
+    if ( !image_slot_confirmed( slot ) ) {
+        for ( i = 0; i < IMAGE_ROW / 4; i++ ) {
+            image_row[i] = 0xFFFFFFFF;
+        }
+        image_row[0] = IMAGE_CONFIRM_MAGIC;
+        image_flash_write( IMAGE_SLOT_BASE( slot ) + IMAGE_CONFIRM_OFFSET, image_row, IMAGE_ROW );
+    }
+    IMAGE_BOOT_STATE->magic = IMAGE_BOOT_CONFIRMED;
+}
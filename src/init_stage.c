@@ -0,0 +1,94 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file init_stage.c
+ *
+ * @brief Start up stages done and their ticks
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+
+/* Project includes */
+#include "chip.h"
+#include "init_stage.h"
+#include "boot_time.h"
+
+/* What the handlers check, the event group is for the tasks waiting */
+static volatile uint8_t init_done_mask;
+static EventGroupHandle_t init_group;
+static TickType_t init_tick[INIT_STAGES];
+
+void init_stage_init( void )
+{
+    init_group = xEventGroupCreate();
+    configASSERT( init_group );
+    xEventGroupSetBits( init_group, init_done_mask );
+}
+
+void init_stage_done( init_stage stage )
+{
+    configASSERT( stage < INIT_STAGES );
+    /* The stages are the last boot timeline marks */
+    configASSERT( BOOT_TIME_STAGES + INIT_STAGES == BOOT_TIME_COUNT );
+
+    /* Tick first, a reader seeing the bit finds it */
+    init_tick[stage] = xTaskGetTickCount();
+    boot_time_mark( BOOT_TIME_STAGES + stage );
+    taskENTER_CRITICAL();
+    init_done_mask |= INIT_STAGE_BIT( stage );
+    taskEXIT_CRITICAL();
+
+    /* The builds without init_stage_init() (bench, load simulator) don't wait for stages */
+    if ( init_group != NULL ) {
+        xEventGroupSetBits( init_group, INIT_STAGE_BIT( stage ) );
+    }
+}
+
+uint8_t init_wait( uint8_t stages, TickType_t ticks )
+{
+    if ( init_ready( stages ) ) {
+        return 1;
+    }
+    configASSERT( init_group );
+    return ( xEventGroupWaitBits( init_group, stages, pdFALSE, pdTRUE, ticks ) & stages ) == stages;
+}
+
+uint8_t init_ready( uint8_t stages )
+{
+    return ( init_done_mask & stages ) == stages;
+}
+
+uint8_t init_stages_done( void )
+{
+    return init_done_mask;
+}
+
+uint8_t init_stage_tick( init_stage stage, TickType_t * tick )
+{
+    if ( ( stage >= INIT_STAGES ) || !( init_done_mask & INIT_STAGE_BIT( stage ) ) ) {
+        return 0;
+    }
+    *tick = init_tick[stage];
+    return 1;
+}
@@ -31,403 +31,1606 @@
 /* Project includes */
 #include "i2c.h"
 #include "ipmb.h"
+#include "ipmb_frame.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "mem_pool.h"
+#include "prof.h"
 #include "board_defs.h"
 #include "led.h"
+#include "watchdog.h"
+#include "chip.h"
+#include "boot_time.h"
+#include "timestamp.h"
+#include "metrics.h"
+#include "timer_wheel.h"
 
 ipmb_error ipmb_notify_client ( ipmi_msg_cfg * msg_cfg );
-ipmb_error ipmb_assert_chksum ( uint8_t * buffer, uint8_t buffer_len );
-uint8_t ipmb_calculate_chksum ( uint8_t * buffer, uint8_t range );
-ipmb_error ipmb_encode ( uint8_t * buffer, ipmi_msg * msg );
-ipmb_error ipmb_decode ( ipmi_msg * msg, uint8_t * buffer, uint8_t len );
-
-/* Macro to check is the message is a response (odd netfn) */
-#define IS_RESPONSE(msg) (msg.netfn & 0x01)
+static ipmb_client * ipmb_find_client ( ipmi_msg * msg );
+static ipmb_proxy_handler ipmb_find_proxy ( uint8_t addr );
+uint8_t ipmb_alloc_seq ( uint8_t dest_addr, uint8_t netfn, uint8_t * seq );
+ipmb_error ipmb_register_outstanding ( ipmi_msg_cfg * req_cfg );
+void ipmb_release_outstanding ( ipmi_msg * req );
+uint8_t ipmb_match_outstanding ( ipmi_msg * resp, ipmb_outstanding_req * match );
+static void ipmb_outstanding_timeout ( void * arg );
+void ipmb_request_failed ( ipmi_msg_cfg * req_cfg );
+ipmb_resp_cache_result ipmb_cache_check_request ( ipmi_msg_cfg * req_cfg, ipmi_msg * replay );
+ipmb_error ipmb_cache_match_response ( ipmi_msg * resp );
+void ipmb_cache_store_response ( ipmi_msg * resp );
+void ipmb_cache_release ( ipmi_msg * resp );
+void ipmb_schedule_retry ( ipmi_msg_cfg * msg_cfg );
+static void ipmb_tx_done ( ipmi_msg_cfg * msg_cfg, ipmb_error error );
+
+/* IPMB-L alone, or IPMB-A and IPMB-B of a redundant IPMB (see IPMB_I2C_B) */
+#ifdef IPMB_I2C_B
+#define IPMB_LINKS              2
+#else
+#define IPMB_LINKS              1
+#endif
+
+/*! @brief I2C interface the IPMB runs on */
+typedef struct ipmb_link {
+    I2C_ID_T i2c_id;
+    const char * name;                  /*!< Of its RX task (and watchdog) */
+    uint8_t failures;                   /*!< Writes failed in a row, up to #IPMB_LINK_FAILURES */
+    TickType_t down_since;              /*!< Tick it was left out of the rotation, while #failures is #IPMB_LINK_FAILURES */
+} ipmb_link;
 
 /* Local variables */
+static ipmb_link ipmb_links[IPMB_LINKS] = {
+    { .i2c_id = IPMB_I2C, .name = "IPMB_RX" },
+#ifdef IPMB_I2C_B
+    { .i2c_id = IPMB_I2C_B, .name = "IPMB_RX_B" },
+#endif
+};
+/* Link the next request goes out on */
+static uint8_t ipmb_link_turn;
+TASK_STACK( ipmb_tx_stack, IPMB_TASK_STACK_DEPTH, 1 );
+TASK_STACK( ipmb_rx_stack, IPMB_TASK_STACK_DEPTH, IPMB_LINKS );
 QueueHandle_t ipmb_txqueue = NULL;
-QueueHandle_t client_queue = NULL;
+static QueueHandle_t ipmb_txqueue_resp = NULL;
+static SemaphoreHandle_t ipmb_tx_pending = NULL;
+volatile uint32_t ipmb_stats[IPMB_STAT_COUNT];
+static ipmb_client clients[IPMB_MAX_CLIENTS];
+static uint8_t client_count;
+static ipmb_proxy proxies[IPMB_MAX_PROXIES];
+static uint8_t proxy_count;
+static mem_pool ipmb_rx_pool;
+static ipmb_rx_frame rx_frames[IPMB_RX_POOL_LEN] __RAM_AHB_NOINIT;
+static mem_pool ipmb_tx_pool;
+static ipmi_msg_cfg tx_frames[IPMB_TX_POOL_LEN] __RAM_AHB_NOINIT;
 static uint8_t current_seq;
-static ipmi_msg_cfg last_sent_req;
-static ipmi_msg_cfg last_received_req;
+static ipmb_seq_context seq_ctx[IPMB_SEQ_CONTEXTS];
+static uint8_t seq_ctx_next;
+static ipmb_outstanding_req outstanding_req[IPMB_MAX_OUTSTANDING_REQ];
+/* Deadline of the asynchronous request of each outstanding slot */
+static wheel_timer outstanding_timer[IPMB_MAX_OUTSTANDING_REQ];
+static ipmb_resp_cache_entry resp_cache[IPMB_RESP_CACHE_LEN];
+static ipmi_msg_cfg retry_msg[IPMB_RETRY_SLOTS];
+/* Message of each retry slot: its copy in retry_msg for a request, the pool frame itself for a response */
+static ipmi_msg_cfg * retry_frame[IPMB_RETRY_SLOTS];
+static wheel_timer retry_timer[IPMB_RETRY_SLOTS];
+static volatile uint8_t retry_in_use[IPMB_RETRY_SLOTS];
+static uint32_t retry_jitter_seed;
+METRIC_COUNTER( "ipmb.rx_frames", ipmb_stats[IPMB_STAT_RX_FRAMES] );
+METRIC_COUNTER( "ipmb.rx_chksum", ipmb_stats[IPMB_STAT_RX_CHKSUM_ERR] );
+METRIC_COUNTER( "ipmb.rx_malformed", ipmb_stats[IPMB_STAT_RX_MALFORMED] );
+METRIC_COUNTER( "ipmb.rx_dup_req", ipmb_stats[IPMB_STAT_RX_DUP_REQ] );
+METRIC_COUNTER( "ipmb.rx_unmatched", ipmb_stats[IPMB_STAT_RX_UNMATCHED_RESP] );
+METRIC_COUNTER( "ipmb.tx_frames", ipmb_stats[IPMB_STAT_TX_FRAMES] );
+METRIC_COUNTER( "ipmb.tx_retries", ipmb_stats[IPMB_STAT_TX_RETRIES] );
+METRIC_COUNTER( "ipmb.tx_failures", ipmb_stats[IPMB_STAT_TX_FAILURES] );
+METRIC_COUNTER( "ipmb.timeouts", ipmb_stats[IPMB_STAT_TIMEOUTS] );
+METRIC_COUNTER( "ipmb.queue_full", ipmb_stats[IPMB_STAT_QUEUE_FULL] );
+METRIC_COUNTER( "ipmb.rate_limited", ipmb_stats[IPMB_STAT_RATE_LIMITED] );
+METRIC_COUNTER( "ipmb.failovers", ipmb_stats[IPMB_STAT_LINK_FAILOVERS] );
+METRIC_COUNTER( "ipmb.link_down", ipmb_stats[IPMB_STAT_LINK_DOWN] );
+METRIC_COUNTER( "ipmb.tx_bursts", ipmb_stats[IPMB_STAT_TX_BURSTS] );
+
+#if IPMB_LATENCY_STATS
+static ipmb_latency_hist latency_hist[IPMB_LATENCY_SLOTS];
+/* Response times of all the commands together, same buckets, not saturated */
+static uint32_t latency_all[IPMB_LATENCY_BUCKETS];
+METRIC_HISTOGRAM( "ipmb.resp_us", latency_all );
+
+static void ipmb_latency_record ( uint8_t netfn, uint8_t cmd, uint32_t elapsed );
+#endif
+
+/*! @brief Puts a message in the TX queue of its priority class and wakes up the TX task
+ *
+ * Responses go to #ipmb_txqueue_resp, by pointer to their TX pool frame, requests to #ipmb_txqueue, by value.
+ * One count of #ipmb_tx_pending is given per queued message.
+ */
+static BaseType_t ipmb_tx_post ( ipmi_msg_cfg * msg_cfg, TickType_t ticks_to_wait, BaseType_t to_front )
+{
+    QueueHandle_t queue = ipmb_txqueue;
+    const void * item = msg_cfg;
+    BaseType_t ret;
 
-void IPMB_TXTask ( void * pvParameters )
+    if ( IS_RESPONSE( msg_cfg->buffer ) ) {
+        queue = ipmb_txqueue_resp;
+        item = &msg_cfg;
+    }
+
+    if ( to_front ) {
+        ret = xQueueSendToFront( queue, item, ticks_to_wait );
+    } else {
+        ret = xQueueSend( queue, item, ticks_to_wait );
+    }
+
+    if ( ret == pdTRUE ) {
+        xSemaphoreGive( ipmb_tx_pending );
+    } else {
+        IPMB_STAT_INC( IPMB_STAT_QUEUE_FULL );
+    }
+    return ret;
+}
+
+/*! @brief Takes a frame from the TX pool, with every delivery field reset
+ *
+ * The pool is in NOINIT RAM, so a frame may hold anything left from before (or from power up): whatever the caller
+ * doesn't set itself must not be read by the TX task.
+ * @return The frame, NULL if the pool is exhausted
+ */
+static ipmi_msg_cfg * ipmb_tx_frame_alloc ( void )
 {
-  static ipmi_msg_cfg current_msg_tx;
-  static uint8_t ipmb_buffer_tx[IPMI_MSG_MAX_LENGTH];
+    ipmi_msg_cfg * frame = mem_pool_alloc( &ipmb_tx_pool );
+
+    if ( frame != NULL ) {
+        frame->retries = 0;
+        frame->completion = NULL;
+        frame->timestamp = 0;
+        frame->callback = NULL;
+        frame->callback_ctx = NULL;
+        frame->link = IPMB_LINK_ANY;
+        frame->corr = 0;
+    }
+    return frame;
+}
 
-  for ( ;; ) {
-    xQueueReceive( ipmb_txqueue, &current_msg_tx, portMAX_DELAY);
+/*! @brief Takes the message a pending count of #ipmb_tx_pending stands for, responses first
+ *
+ * After #IPMB_TX_RESP_BURST responses in a row, a waiting request is sent before the next response, so requests can't starve.
+ * @return The response frame, or @p req_buf with the request copied into it, NULL if both queues are empty
+ */
+static ipmi_msg_cfg * ipmb_tx_pick ( ipmi_msg_cfg * req_buf )
+{
+    static uint8_t resp_burst = 0;
+    ipmi_msg_cfg * resp;
 
+    if ( ( resp_burst < IPMB_TX_RESP_BURST ) && ( xQueueReceive( ipmb_txqueue_resp, &resp, 0 ) == pdTRUE ) ) {
+        resp_burst++;
+        return resp;
+    }
 
-    if ( IS_RESPONSE(current_msg_tx.buffer) ) {
-      /* We're sending a response */
+    resp_burst = 0;
+    if ( xQueueReceive( ipmb_txqueue, req_buf, 0 ) == pdTRUE ) {
+        return req_buf;
+    }
+    /* No request waiting, the pending count belongs to a response (if it doesn't stand for nothing) */
+    if ( xQueueReceive( ipmb_txqueue_resp, &resp, 0 ) != pdTRUE ) {
+        return NULL;
+    }
+    return resp;
+}
 
-      /**********************************/
-      /*       Error checking  	        */
-      /**********************************/
+/*! @brief Waits for the next message to be sent
+ * @return Same as #ipmb_tx_pick, never NULL
+ */
+static ipmi_msg_cfg * ipmb_tx_next ( ipmi_msg_cfg * req_buf, watchdog_id wdg )
+{
+    ipmi_msg_cfg * msg;
 
-      /* Match with previous request */
-      if ( current_msg_tx.buffer.seq != last_received_req.buffer.seq ) {
-	xTaskNotify( current_msg_tx.caller_task, ipmb_error_invalid_req , eSetValueWithOverwrite);
-	continue;
-      }
+    do {
+        /* Idle is alive too, the watchdog only wants a sign of life every block time */
+        while ( xSemaphoreTake( ipmb_tx_pending, WATCHDOG_BLOCK_TIME ) != pdTRUE ) {
+            watchdog_checkin( wdg );
+        }
+        watchdog_checkin( wdg );
 
-      /* Check if the response was built in time, comparing the timeout value with the matching request */
-      if ((xTaskGetTickCount() - last_received_req.timestamp) >= IPMB_MSG_TIMEOUT ) {
-	xTaskNotify( current_msg_tx.caller_task ,ipmb_error_timeout , eSetValueWithOverwrite);
-	continue;
-      }
+        /* A count with no message behind it is simply used up */
+        msg = ipmb_tx_pick( req_buf );
+    } while ( msg == NULL );
 
-      /* See if we've already tried sending this message 3 times */
-      if ( current_msg_tx.retries > IPMB_MAX_RETRIES ) {
-	xTaskNotify( current_msg_tx.caller_task ,ipmb_error_failure , eSetValueWithOverwrite);
-	continue;
-      }
+    return msg;
+}
+
+/*! @brief Gets the next message without waiting, for the rest of a burst
+ * @return Same as #ipmb_tx_pick, NULL if nothing is queued
+ */
+static ipmi_msg_cfg * ipmb_tx_poll ( ipmi_msg_cfg * req_buf )
+{
+    if ( xSemaphoreTake( ipmb_tx_pending, 0 ) != pdTRUE ) {
+        return NULL;
+    }
+    return ipmb_tx_pick( req_buf );
+}
+
+/*! @brief Ends the transmission of a message: completes its sender and gives a response frame back to the TX pool */
+static void ipmb_tx_done ( ipmi_msg_cfg * msg_cfg, ipmb_error error )
+{
+    ipmb_completion * done = msg_cfg->completion;
+
+    if ( done != NULL ) {
+        /* Unless the sender gave up on this frame meanwhile */
+        taskENTER_CRITICAL();
+        if ( done->pending == msg_cfg ) {
+            done->status = error;
+            done->pending = NULL;
+            xSemaphoreGive( done->signal );
+        }
+        taskEXIT_CRITICAL();
+    }
+    if ( mem_pool_owns( &ipmb_tx_pool, msg_cfg ) ) {
+        mem_pool_free( &ipmb_tx_pool, msg_cfg );
+    }
+}
+
+/*! @brief Tells if a link is in the rotation, one left out comes back once #IPMB_LINK_HOLDOFF is over */
+static uint8_t ipmb_link_up ( uint8_t link )
+{
+    return ( ipmb_links[link].failures < IPMB_LINK_FAILURES ) ||
+           ( ( xTaskGetTickCount() - ipmb_links[link].down_since ) >= IPMB_LINK_HOLDOFF );
+}
+
+/*! @brief Counts the outcome of a write on a link, a stuck bus takes it out of the rotation at once */
+static void ipmb_link_result ( uint8_t link, i2c_err err )
+{
+    ipmb_link * l = &ipmb_links[link];
+
+    if ( err == i2c_err_SUCCESS ) {
+        l->failures = 0;
+        return;
+    }
+    if ( IPMB_LINKS == 1 ) {
+        /* Nowhere else to go */
+        return;
+    }
+    if ( ( err == i2c_err_TIMEOUT ) || ( l->failures + 1 >= IPMB_LINK_FAILURES ) ) {
+        /* Also after a failed try at the end of the holdoff, which starts again */
+        l->failures = IPMB_LINK_FAILURES;
+        l->down_since = xTaskGetTickCount();
+        IPMB_STAT_INC( IPMB_STAT_LINK_DOWN );
+    } else {
+        l->failures++;
+    }
+}
+
+/*! @brief Link a message goes out on first: the one its request came in on for a response, the next one in turn
+ * otherwise, skipping the links out of the rotation (if they all are, the first choice is used anyway) */
+static uint8_t ipmb_link_pick ( ipmi_msg_cfg * msg_cfg )
+{
+    uint8_t link = msg_cfg->link;
+    uint8_t i;
+
+    if ( ( link >= IPMB_LINKS ) || !ipmb_link_up( link ) ) {
+        link = ipmb_link_turn;
+        ipmb_link_turn = ( ipmb_link_turn + 1 ) % IPMB_LINKS;
+    }
+    for ( i = 0; ( i < IPMB_LINKS ) && !ipmb_link_up( link ); i++ ) {
+        link = ( link + 1 ) % IPMB_LINKS;
+    }
+    return link;
+}
 
-      /**********************************/
-      /* Try sending the message	*/
-      /**********************************/
+/*! @brief Encodes a message straight into the I2C driver transmit buffer of a link and sends it */
+static i2c_err ipmb_link_write ( uint8_t link, ipmi_msg * msg )
+{
+    I2C_ID_T i2c_id = ipmb_links[link].i2c_id;
+    uint8_t * tx_buf = pxI2CWriteReserve( i2c_id, IPMB_I2C_RESERVE_TIMEOUT );
+    i2c_err err;
 
-      /* Encode the message buffer to the IPMB format */
-      ipmb_encode( &ipmb_buffer_tx[0], &current_msg_tx.buffer );
+    if ( tx_buf == NULL ) {
+        return i2c_err_FAILURE;
+    }
 
-      if ( xI2CWrite( IPMB_I2C, current_msg_tx.buffer.dest_addr >> 1, &ipmb_buffer_tx[1], current_msg_tx.buffer.data_len + IPMB_RESP_HEADER_LENGTH ) != i2c_err_SUCCESS ) {
-	/* Message couldn't be transmitted right now, increase retry counter and try again later */
-	current_msg_tx.retries++;
-	xQueueSendToFront( ipmb_txqueue, &current_msg_tx, 0 );
+    err = xI2CWriteCommit( i2c_id, msg->dest_addr >> 1, ipmb_encode( tx_buf, msg ) );
+    if ( err == i2c_err_SUCCESS ) {
+        IPMB_STAT_INC( IPMB_STAT_TX_FRAMES );
+    }
+    ipmb_link_result( link, err );
+    return err;
+}
 
-      }else{
-	/* Success case*/
-	xTaskNotify( current_msg_tx.caller_task , ipmb_error_success, eSetValueWithOverwrite);
+/*! @brief Sends a message, on the other link right away if the first one fails (NACK'd, arbitration, stuck bus)
+ *
+ * The retry backoff of the TX task is only for a message no link could take.
+ */
+static i2c_err ipmb_write_frame ( ipmi_msg_cfg * msg_cfg )
+{
+    uint8_t link = ipmb_link_pick( msg_cfg );
+    uint8_t other = ( link + 1 ) % IPMB_LINKS;
+    i2c_err err;
+
+    err = ipmb_link_write( link, &msg_cfg->buffer );
+    if ( ( err != i2c_err_SUCCESS ) && ( other != link ) && ipmb_link_up( other ) ) {
+        err = ipmb_link_write( other, &msg_cfg->buffer );
+        if ( err == i2c_err_SUCCESS ) {
+            IPMB_STAT_INC( IPMB_STAT_LINK_FAILOVERS );
+        }
+    }
+    return err;
+}
+
+/*! @brief Sends the frames of a burst picked for a link as one chain, back to back with repeated STARTs
+ *
+ * A single frame goes with #ipmb_link_write. The result of each frame is written to @p err.
+ */
+static void ipmb_link_burst ( uint8_t link, ipmi_msg_cfg ** burst, const uint8_t * links, i2c_err * err, uint8_t count )
+{
+    /* Only the TX task sends, so the chain and its frames can be static (the driver copies each frame when it starts it) */
+    static uint8_t burst_buf[IPMB_TX_BURST][i2cMAX_MSG_LENGTH];
+    static xI2C_xfer xfer[IPMB_TX_BURST];
+    I2C_ID_T i2c_id = ipmb_links[link].i2c_id;
+    uint8_t pos[IPMB_TX_BURST];
+    uint8_t picked = 0;
+    uint8_t addr;
+    uint8_t n = 0;
+    uint8_t i;
+
+    for ( i = 0; i < count; i++ ) {
+        if ( links[i] == link ) {
+            pos[picked++] = i;
+        }
+    }
+    if ( picked <= 1 ) {
+        if ( picked == 1 ) {
+            err[pos[0]] = ipmb_link_write( link, &burst[pos[0]]->buffer );
+        }
+        return;
+    }
+
+    /* Quarantined destinations are left out, the others are compacted to the front of pos */
+    for ( i = 0; i < picked; i++ ) {
+        addr = burst[pos[i]]->buffer.dest_addr >> 1;
+        if ( !xI2CDeviceAvailable( i2c_id, addr ) ) {
+            err[pos[i]] = i2c_err_QUARANTINED;
+            continue;
+        }
+        pos[n] = pos[i];
+        xfer[n].addr = addr;
+        xfer[n].tx_data = burst_buf[n];
+        xfer[n].tx_len = ipmb_encode( burst_buf[n], &burst[pos[i]]->buffer );
+        xfer[n].rx_data = NULL;
+        xfer[n].rx_len = 0;
+        xfer[n].flags = I2C_XFER_RESTART;
+        /* Left as is if the chain is refused before it runs */
+        xfer[n].error = i2c_err_MAX_LENGTH;
+        n++;
+    }
+    if ( n == 0 ) {
+        return;
+    }
+
+    xI2CTransferChain( i2c_id, xfer, n );
+    for ( i = 0; i < n; i++ ) {
+        err[pos[i]] = xfer[i].error;
+        if ( xfer[i].error == i2c_err_SUCCESS ) {
+            IPMB_STAT_INC( IPMB_STAT_TX_FRAMES );
+            if ( i > 0 ) {
+                IPMB_STAT_INC( IPMB_STAT_TX_BURSTS );
+            }
+        }
+        ipmb_link_result( link, xfer[i].error );
+    }
+}
+
+/*! @brief Sends the messages of a burst, each on the link #ipmb_link_pick gives it and on the other one if that fails
+ *
+ * The ones going out on the same link are written back to back. The result of each message is written to @p err.
+ */
+static void ipmb_write_burst ( ipmi_msg_cfg ** burst, i2c_err * err, uint8_t count )
+{
+    uint8_t links[IPMB_TX_BURST];
+    uint8_t link;
+    uint8_t other;
+    uint8_t i;
+
+    if ( count == 1 ) {
+        err[0] = ipmb_write_frame( burst[0] );
+        return;
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        links[i] = ipmb_link_pick( burst[i] );
+    }
+    for ( link = 0; link < IPMB_LINKS; link++ ) {
+        ipmb_link_burst( link, burst, links, err, count );
+    }
+
+    for ( i = 0; i < count; i++ ) {
+        other = ( links[i] + 1 ) % IPMB_LINKS;
+        if ( ( err[i] != i2c_err_SUCCESS ) && ( other != links[i] ) && ipmb_link_up( other ) ) {
+            err[i] = ipmb_link_write( other, &burst[i]->buffer );
+            if ( err[i] == i2c_err_SUCCESS ) {
+                IPMB_STAT_INC( IPMB_STAT_LINK_FAILOVERS );
+            }
+        }
+    }
+}
+
+/*! @brief Checks a message before it's sent, the ones that must not go out anymore are ended here
+ * @return 1 if the message is to be sent
+ */
+static uint8_t ipmb_tx_ready ( ipmi_msg_cfg * msg )
+{
+  ipmb_error tx_error;
+
+  if ( IS_RESPONSE(msg->buffer) ) {
+    /* We're sending a response */
+
+    /**********************************/
+    /*       Error checking  	        */
+    /**********************************/
+
+    /* Match with a previous request and check if the response was built in time,
+       comparing the timeout value with the matching request arrival */
+    tx_error = ipmb_cache_match_response( &msg->buffer );
+    if ( tx_error != ipmb_error_success ) {
+      if ( tx_error == ipmb_error_timeout ) {
+	IPMB_STAT_INC( IPMB_STAT_TIMEOUTS );
       }
+      ipmb_tx_done( msg, tx_error );
+      return 0;
+    }
+
+    /* See if we've already tried sending this message 3 times */
+    if ( msg->retries > IPMB_MAX_RETRIES ) {
+      IPMB_STAT_INC( IPMB_STAT_TX_FAILURES );
+      ipmb_cache_release( &msg->buffer );
+      ipmb_tx_done( msg, ipmb_error_failure );
+      return 0;
+    }
+    return 1;
+  }
+
+  /* Get the time when the message is first sent */
+  if ( msg->retries == 0 ) {
+    msg->timestamp = timestamp_now();
 
-      /***************************************/
-      /* Sending new outgoing request        */
-      /***************************************/
+    /* Reserve a slot for the response before it has any chance to arrive */
+    if ( ipmb_register_outstanding( msg ) != ipmb_error_success ) {
+      ipmb_request_failed( msg );
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*! @brief Ends the transmission of a message once it was written, or schedules its retry */
+static void ipmb_tx_sent ( ipmi_msg_cfg * msg, i2c_err err )
+{
+  if ( IS_RESPONSE(msg->buffer) ) {
+    if ( err != i2c_err_SUCCESS ) {
+      /* Message couldn't be transmitted right now, increase retry counter and try again later */
+      msg->retries++;
+      ipmb_schedule_retry( msg );
 
     }else{
+      /* Success case, keep the response so a retried request can be answered again */
+      ipmb_cache_store_response( &msg->buffer );
+      ipmb_tx_done( msg, ipmb_error_success );
+    }
+    return;
+  }
 
-      /* Get the time when the message is first sent */
-      if ( current_msg_tx.retries == 0 ) {
-	current_msg_tx.timestamp = xTaskGetTickCount();
-      }
+  /* A request sent is completed later, by its response or the timeout of its outstanding entry */
+  if ( err != i2c_err_SUCCESS ) {
 
-      ipmb_encode( &ipmb_buffer_tx[0], &current_msg_tx.buffer );
+    msg->retries++;
 
-      if ( xI2CWrite( IPMB_I2C, current_msg_tx.buffer.dest_addr >> 1, &ipmb_buffer_tx[1], current_msg_tx.buffer.data_len + IPMB_REQ_HEADER_LENGTH ) != i2c_err_SUCCESS) {
+    if( msg->retries > IPMB_MAX_RETRIES ){
+      IPMB_STAT_INC( IPMB_STAT_TX_FAILURES );
+      ipmb_release_outstanding( &msg->buffer );
+      ipmb_request_failed( msg );
+    }else{
+      ipmb_schedule_retry( msg );
+    }
 
-	current_msg_tx.retries++;
+  }
+}
 
-	if( current_msg_tx.retries > IPMB_MAX_RETRIES ){
-	  xTaskNotify ( current_msg_tx.caller_task, ipmb_error_failure, eSetValueWithOverwrite);
-	}else{
-	  xQueueSendToFront( ipmb_txqueue, &current_msg_tx, 0 );
-	}
+void IPMB_TXTask ( void * pvParameters )
+{
+  /* Requests are copied out of their queue, responses stay in their pool frame */
+  static ipmi_msg_cfg req_buf[IPMB_TX_BURST];
+  ipmi_msg_cfg * burst[IPMB_TX_BURST];
+  i2c_err err[IPMB_TX_BURST];
+  ipmi_msg_cfg * msg;
+  uint8_t count;
+  uint8_t i;
+  watchdog_id wdg = watchdog_register( "IPMB_TX", WATCHDOG_DEADLINE );
 
-      } else {
-	/* Request was successfully sent, keep a copy here for future comparison */
-	last_sent_req = current_msg_tx;
-	xTaskNotify ( current_msg_tx.caller_task, ipmb_error_success, eSetValueWithOverwrite);
+  for ( ;; ) {
+    /* Everything queued by the time the first message is taken goes in the same burst */
+    count = 0;
+    msg = ipmb_tx_next( &req_buf[0], wdg );
+    do {
+      if ( ipmb_tx_ready( msg ) ) {
+	KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_TX, msg->corr );
+	burst[count++] = msg;
       }
+    } while ( ( count < IPMB_TX_BURST ) && ( ( msg = ipmb_tx_poll( &req_buf[count] ) ) != NULL ) );
+
+    if ( count == 0 ) {
+      continue;
+    }
+
+    /**********************************/
+    /* Try sending the messages	*/
+    /**********************************/
+
+    ipmb_write_burst( burst, err, count );
+    for ( i = 0; i < count; i++ ) {
+      KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_TX, burst[i]->corr );
+      ipmb_tx_sent( burst[i], err[i] );
     }
   }
 }
 
 
 
+/*! @brief Correlation ID of the next frame received, on any link */
+static uint16_t ipmb_corr_next ( void )
+{
+  static uint16_t last;
+  uint16_t corr;
+
+  taskENTER_CRITICAL();
+  if ( ++last == 0 ) {
+    last = 1;
+  }
+  corr = last;
+  taskEXIT_CRITICAL();
+
+  return corr;
+}
+
 void IPMB_RXTask ( void *pvParameters )
 {
-  ipmi_msg_cfg current_msg_rx;
-  uint8_t ipmb_buffer_rx[IPMI_MSG_MAX_LENGTH];
+  ipmb_link * link = (ipmb_link *) pvParameters;
+  uint8_t link_id = link - ipmb_links;
+  ipmb_rx_frame * frame;
+  ipmi_msg_cfg * current_msg_rx;
+  static ipmi_msg_cfg replay_buf[IPMB_LINKS];
+  ipmi_msg_cfg * replay_msg = &replay_buf[link_id];
+  ipmi_msg_cfg * replay_frame;
+  ipmb_outstanding_req match;
+  ipmb_proxy_handler proxy;
+  uint8_t * rx_frame;
   uint8_t rx_len;
+  ipmb_error rx_error;
+  watchdog_id wdg = watchdog_register( link->name, WATCHDOG_DEADLINE );
+
+  /* The receiver of the link for good, frames arriving before the first wait are kept in the driver FIFO */
+  vI2CSlaveRegister( link->i2c_id, xTaskGetCurrentTaskHandle() );
 
   for ( ;; ) {
-    /* Checks if there's any incoming messages (the task remains blocked here) */
-    configASSERT(ipmb_buffer_rx);
-    rx_len = xI2CSlaveTransfer( IPMB_I2C, &ipmb_buffer_rx[0], portMAX_DELAY );
+    /* Wakes up at least every IPMB_MSG_TIMEOUT (below), a stuck I2C wait stops the check ins */
+    watchdog_checkin( wdg );
+
+    /* Get a free frame from the pool, the incoming message will be decoded directly into it */
+    while ( ( frame = mem_pool_alloc( &ipmb_rx_pool ) ) == NULL ) {
+        vTaskDelay( IPMB_RX_POOL_WAIT );
+    }
+    current_msg_rx = &frame->msg;
+
+    /* Checks if there's any incoming messages (the task remains blocked here).
+       The bytes are read in place from the I2C driver receive ring */
+    rx_len = xI2CSlaveReceive( link->i2c_id, &rx_frame, IPMB_MSG_TIMEOUT );
 
-    if ( rx_len > 0 ) {
+    /* Perform a checksum test on the message, if it doesn't pass, just ignore it.
+       Following the IPMB specs, we have no way to know if we're the one who should
+       receive it. In MicroTCA crates with star topology for IPMB, we are assured we
+       are the recipients, however, malformed messages may be safely ignored as the
+       MCMC should take care of retrying. */
 
-      /* Perform a checksum test on the message, if it doesn't pass, just ignore it.
-	 Following the IPMB specs, we have no way to know if we're the one who should
-	 receive it. In MicroTCA crates with star topology for IPMB, we are assured we
-	 are the recipients, however, malformed messages may be safely ignored as the
-	 MCMC should take care of retrying. */
+    if ( rx_len == 0 ) {
+      ipmb_release_msg( &current_msg_rx->buffer );
+      continue;
+    }
 
-      if ( ipmb_assert_chksum( ipmb_buffer_rx, rx_len ) != ipmb_error_success ) {
-	continue;
+    /* Both checksums are verified while the frame is decoded */
+    current_msg_rx->corr = ipmb_corr_next();
+    KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_RX, current_msg_rx->corr );
+    rx_error = ipmb_decode( &current_msg_rx->buffer, rx_frame, rx_len );
+    frame->stamp[IPMB_STAMP_RX] = ulI2CSlaveFrameStamp( link->i2c_id );
+    vI2CSlaveReleaseFrame( link->i2c_id );
+    KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_RX, current_msg_rx->corr );
+    current_msg_rx->link = link_id;
+    if ( rx_error != ipmb_error_success ) {
+      IPMB_STAT_INC( ( rx_error == ipmb_error_msg_length ) ? IPMB_STAT_RX_MALFORMED : IPMB_STAT_RX_CHKSUM_ERR );
+      ipmb_release_msg( &current_msg_rx->buffer );
+      continue;
+    }
+    IPMB_STAT_INC( IPMB_STAT_RX_FRAMES );
+
+    if ( IS_RESPONSE(current_msg_rx->buffer ) ) {
+      /* The message is a response, look for the request that is waiting for it (in time) */
+      if ( !ipmb_match_outstanding( &current_msg_rx->buffer, &match ) ) {
+	/* If we received a response that doesn't match a previously sent request, just discard it */
+	IPMB_STAT_INC( IPMB_STAT_RX_UNMATCHED_RESP );
+	ipmb_release_msg( &current_msg_rx->buffer );
+      } else if ( match.callback ) {
+	/* Asynchronous request: complete it right here, the frame goes back to the pool afterwards */
+	match.callback( &current_msg_rx->buffer, ipmb_error_success, match.callback_ctx );
+	ipmb_release_msg( &current_msg_rx->buffer );
+      } else {
+	/* If we received a response that doesn't match a previously sent request, just discard it */
+	ipmb_release_msg( &current_msg_rx->buffer );
       }
 
-      /* Maybe clear the msg_cfg struct before writing new data into it */
-      ipmb_decode( &current_msg_rx.buffer, ipmb_buffer_rx, rx_len );
-
-      if ( IS_RESPONSE(current_msg_rx.buffer ) ) {
-	/* The message is a response, check if it's been received in time */
-	if ( (xTaskGetTickCount() - last_sent_req.timestamp) < IPMB_MSG_TIMEOUT ) {
-	  /* Seq number checking is enough to match the messages */
-	  if ( current_msg_rx.buffer.seq == last_sent_req.buffer.seq ) {
-	    ipmb_notify_client ( &current_msg_rx );
-	  }
-	  /* If we received a response that doesn't match a previously sent request, just discard it */
+    }else {
+
+      /* The received message is a request */
+      /* Start counting the time, so we know if our response will be built in time */
+      current_msg_rx->timestamp = timestamp_now();
+
+      /* Check if this is a repeated request (same requester, SEQ, NetFN and CMD).
+	 If we've already answered it, send the same response again without bothering
+	 the client. If it's still being handled, just ignore this message, since it'll
+	 be responded shortly. */
+      switch ( ipmb_cache_check_request( current_msg_rx, &replay_msg->buffer ) ) {
+      case ipmb_cache_replay:
+	IPMB_STAT_INC( IPMB_STAT_RX_DUP_REQ );
+	/* Sent from a TX pool frame like every response, dropped if the pool is exhausted */
+	replay_frame = ipmb_tx_frame_alloc();
+	if ( replay_frame != NULL ) {
+	  memcpy( &replay_frame->buffer, &replay_msg->buffer, sizeof(ipmi_msg) );
+	  replay_frame->link = link_id;
+	  replay_frame->corr = current_msg_rx->corr;
+	  ipmb_tx_post( replay_frame, 0, pdFALSE );
+	}
+	ipmb_release_msg( &current_msg_rx->buffer );
+	break;
+
+      case ipmb_cache_new:
+	proxy = ipmb_find_proxy( current_msg_rx->buffer.dest_addr );
+	if ( proxy != NULL ) {
+	  /* Sent to a FRU we stand for, its handler now owns the frame */
+	  proxy( &current_msg_rx->buffer );
+	} else {
+	  /* Notify the client about the new request, it now owns the frame */
+	  KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_QUEUE, current_msg_rx->corr );
+	  ipmb_notify_client ( current_msg_rx );
 	}
+	break;
+
+      case ipmb_cache_full:
+	/* Its response would find no entry and be dropped, the requester retries it */
+	IPMB_STAT_INC( IPMB_STAT_QUEUE_FULL );
+	ipmb_release_msg( &current_msg_rx->buffer );
+	break;
+
+      default:
+	IPMB_STAT_INC( IPMB_STAT_RX_DUP_REQ );
+	ipmb_release_msg( &current_msg_rx->buffer );
+	break;
+      }
+    }
+  }
+}
 
-      }else {
+/*! @brief Timer callback of a retry slot, puts the message back in the TX queue
+ *
+ * Called from the timer service task. If the TX queue is full the timer is restarted, so the message is never lost.
+ */
+static void ipmb_retry_timer_cb ( void * arg )
+{
+    uint32_t slot = (uint32_t) arg;
 
-	/* The received message is a request */
-	/* Check if this is a repeated request (same SEQ), in this case just ignore
-	   this message, since it'll be responded shortly (I hope) */
-//	if ( current_msg_rx.buffer.seq != last_received_req.buffer.seq ) {
+    if ( ipmb_tx_post( retry_frame[slot], 0, pdFALSE ) == pdTRUE ) {
+        retry_in_use[slot] = 0;
+    } else {
+        wheel_timer_start( &retry_timer[slot], IPMB_RETRY_BACKOFF );
+    }
+}
 
-	  /* Start counting the time, so we know if our response will be built in time */
-	  current_msg_rx.timestamp = xTaskGetTickCount();
-	  /* Save the message to pair with the future response */
-	  last_received_req = current_msg_rx;
+/*! @brief Schedules the retransmission of a message that couldn't be sent
+ *
+ * The message (a request is copied, a response keeps its TX pool frame) takes a free retry slot and goes back
+ * to the TX queue when the slot timer expires, after an exponential backoff with random jitter. The TX task keeps
+ * sending the other queued messages meanwhile.
+ * If all slots are busy, the message is put back at the front of the TX queue as before.
+ */
+void ipmb_schedule_retry ( ipmi_msg_cfg * msg_cfg )
+{
+    TickType_t delay;
+    uint8_t i;
 
-	  /* Notify the client about the new request */
-	  ipmb_notify_client ( &current_msg_rx );
-	//}
-      }
+    IPMB_STAT_INC( IPMB_STAT_TX_RETRIES );
+
+    for ( i = 0; i < IPMB_RETRY_SLOTS; i++ ) {
+        if ( !retry_in_use[i] ) {
+            break;
+        }
     }
-  }
+
+    if ( i == IPMB_RETRY_SLOTS ) {
+        ipmb_tx_post( msg_cfg, 0, pdTRUE );
+        return;
+    }
+
+    /* Xorshift jitter, so boards sharing the bus don't retry in lockstep */
+    retry_jitter_seed ^= retry_jitter_seed << 13;
+    retry_jitter_seed ^= retry_jitter_seed >> 17;
+    retry_jitter_seed ^= retry_jitter_seed << 5;
+
+    delay = ( IPMB_RETRY_BACKOFF << ( msg_cfg->retries - 1 ) ) + ( retry_jitter_seed % ( IPMB_RETRY_BACKOFF + 1 ) );
+
+    if ( IS_RESPONSE( msg_cfg->buffer ) ) {
+        retry_frame[i] = msg_cfg;
+    } else {
+        memcpy( &retry_msg[i], msg_cfg, sizeof(ipmi_msg_cfg) );
+        retry_frame[i] = &retry_msg[i];
+    }
+    retry_in_use[i] = 1;
+
+    wheel_timer_start( &retry_timer[i], ( delay > 0 ) ? delay : 1 );
 }
 
 void ipmb_init ( void )
 {
-    vI2CInit( IPMB_I2C, I2C_Mode_IPMB );
+    uint8_t i;
+
+    /* The received frames are stamped with the core cycle counter (see ipmb_stamp) */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    for ( i = 0; i < IPMB_LINKS; i++ ) {
+        vI2CInit( ipmb_links[i].i2c_id, I2C_Mode_IPMB );
+    }
+
+#if IPMB_LATENCY_STATS
+    /* Histogram buckets start zeroed, just mark all slots as unused */
+    for ( i = 0; i < IPMB_LATENCY_SLOTS; i++ ) {
+        latency_hist[i].netfn = 0xFF;
+    }
+#endif
+
+    mem_pool_init( &ipmb_rx_pool, "IPMB_RX", rx_frames, sizeof(ipmb_rx_frame), IPMB_RX_POOL_LEN );
+    mem_pool_init( &ipmb_tx_pool, "IPMB_TX", tx_frames, sizeof(ipmi_msg_cfg), IPMB_TX_POOL_LEN );
+
     ipmb_txqueue = xQueueCreate( IPMB_TXQUEUE_LEN, sizeof(ipmi_msg_cfg) );
-    vQueueAddToRegistry( ipmb_txqueue, "IPMB_TX_QUEUE");
-    xTaskCreate( IPMB_TXTask, (const char*)"IPMB_TX", configMINIMAL_STACK_SIZE*2, ( void * ) NULL, IPMB_TXTASK_PRIORITY, ( TaskHandle_t * ) NULL );
-    xTaskCreate( IPMB_RXTask, (const char*)"IPMB_RX", configMINIMAL_STACK_SIZE*2, ( void * ) NULL, IPMB_RXTASK_PRIORITY, ( TaskHandle_t * ) NULL );
+    queue_stats_register( ipmb_txqueue, "IPMB_TX_QUEUE" );
+    ipmb_txqueue_resp = xQueueCreate( IPMB_TX_RESP_QUEUE_LEN, sizeof(ipmi_msg_cfg *) );
+    queue_stats_register( ipmb_txqueue_resp, "IPMB_TX_RESP_Q" );
+    ipmb_tx_pending = xSemaphoreCreateCounting( IPMB_TXQUEUE_LEN + IPMB_TX_RESP_QUEUE_LEN, 0 );
+
+    /* The timer argument is the retry or outstanding slot index */
+    for ( i = 0; i < IPMB_RETRY_SLOTS; i++ ) {
+        wheel_timer_init( &retry_timer[i], ipmb_retry_timer_cb, ( void * ) (uint32_t) i );
+    }
+    for ( i = 0; i < IPMB_MAX_OUTSTANDING_REQ; i++ ) {
+        wheel_timer_init( &outstanding_timer[i], ipmb_outstanding_timeout, ( void * ) (uint32_t) i );
+    }
+    retry_jitter_seed = get_ipmb_addr();
+    xTaskCreateWithStack( IPMB_TXTask, (const char*)"IPMB_TX", IPMB_TASK_STACK_DEPTH, ( void * ) NULL, IPMB_TXTASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( ipmb_tx_stack, 0 ) );
+    for ( i = 0; i < IPMB_LINKS; i++ ) {
+        xTaskCreateWithStack( IPMB_RXTask, ipmb_links[i].name, IPMB_TASK_STACK_DEPTH, &ipmb_links[i], IPMB_RXTASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( ipmb_rx_stack, i ) );
+    }
 }
 
-ipmb_error ipmb_send_request ( ipmi_msg * req )
+ipmb_error ipmb_send_request_async ( ipmi_msg * req, ipmb_req_callback callback, void * ctx )
 {
     ipmi_msg_cfg req_cfg;
 
-    /* Builds the message according to the IPMB specification */
+    configASSERT( callback );
 
-    /* Copies data from the msg struct passed by caller */
     memcpy( &(req_cfg.buffer), req, sizeof(ipmi_msg));
-    /* Write necessary fields (should be garbage data by now) */
-    req_cfg.buffer.dest_addr = MCH_ADDRESS;
+    if ( req_cfg.buffer.dest_addr == 0 ) {
+        req_cfg.buffer.dest_addr = MCH_ADDRESS;
+    }
     req_cfg.buffer.dest_LUN = 0;
     req_cfg.buffer.src_addr = get_ipmb_addr();
     req_cfg.buffer.src_LUN = 0;
-    req_cfg.buffer.seq = current_seq++;
-    req_cfg.caller_task = xTaskGetCurrentTaskHandle();
-
-    /* Blocks here until is able put message in tx queue */
-    if (xQueueSend( ipmb_txqueue, &req_cfg, 1) != pdTRUE ){
+    if ( !ipmb_alloc_seq( req_cfg.buffer.dest_addr, req_cfg.buffer.netfn, &req_cfg.buffer.seq ) ) {
         return ipmb_error_failure;
     }
+    req_cfg.retries = 0;
+    req_cfg.callback = callback;
+    req_cfg.callback_ctx = ctx;
+    req_cfg.link = IPMB_LINK_ANY;
+    req_cfg.corr = KERNEL_TRACE_CORR();
+
+    if ( ipmb_tx_post( &req_cfg, 0, pdFALSE ) != pdTRUE ) {
+        ipmb_release_outstanding( &req_cfg.buffer );
+        return ipmb_error_failure;
+    }
+
+    return ipmb_error_success;
+}
+
+ipmi_msg * ipmb_response_alloc ( ipmi_msg * req, TickType_t ticks_to_wait )
+{
+    ipmi_msg_cfg * frame;
+
+    while ( ( frame = ipmb_tx_frame_alloc() ) == NULL ) {
+        if ( ticks_to_wait < IPMB_TX_POOL_WAIT ) {
+            return NULL;
+        }
+        vTaskDelay( IPMB_TX_POOL_WAIT );
+        ticks_to_wait -= IPMB_TX_POOL_WAIT;
+    }
 
-    /* Use this notification to block the function while the response does not arrive */
-    return ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+    /* Builds the connection header according to the IPMB specification, from the request it answers */
+    frame->buffer.dest_addr = req->src_addr;
+    frame->buffer.netfn = req->netfn + 1;
+    frame->buffer.dest_LUN = req->src_LUN;
+    frame->buffer.src_addr = req->dest_addr;
+    frame->buffer.seq = req->seq;
+    frame->buffer.src_LUN = req->dest_LUN;
+    frame->buffer.cmd = req->cmd;
+    frame->buffer.completion_code = 0;
+    frame->buffer.data_len = 0;
+    /* Back on the link of a request received from the IPMB (the message is the first field of its frame) */
+    frame->link = mem_pool_owns( &ipmb_rx_pool, req ) ? ( (ipmi_msg_cfg *) req )->link : IPMB_LINK_ANY;
+    frame->corr = ipmb_corr( req );
+
+    return &frame->buffer;
 }
 
-ipmb_error ipmb_send_response ( ipmi_msg * req, ipmi_msg * resp )
+void ipmb_response_queue ( ipmi_msg * resp )
 {
-    ipmi_msg_cfg resp_cfg;
+    /* The message is the first field of its pool frame, and the queue has room for the whole pool */
+    ipmb_tx_post( (ipmi_msg_cfg *) resp, 0, pdFALSE );
+}
 
-    /* Builds the message according to the IPMB specification */
+ipmb_error ipmb_completion_init ( ipmb_completion * done )
+{
+    done->signal = xSemaphoreCreateBinary();
+    done->pending = NULL;
+    done->status = ipmb_error_unknown;
 
-    /* Copies data from the response msg struct passed by caller */
-    memcpy( &(resp_cfg.buffer), resp, sizeof(ipmi_msg));
+    return ( done->signal != NULL ) ? ipmb_error_success : ipmb_error_failure;
+}
 
-    /* Write necessary fields (should be garbage data by now) */
-    resp_cfg.buffer.dest_addr = req->src_addr;
-    resp_cfg.buffer.netfn = req->netfn + 1;
-    resp_cfg.buffer.dest_LUN = req->src_LUN;
-    resp_cfg.buffer.src_addr = req->dest_addr;
-    resp_cfg.buffer.seq = req->seq;
-    resp_cfg.buffer.src_LUN = req->dest_LUN;
-    resp_cfg.buffer.cmd = req->cmd;
-    resp_cfg.caller_task = xTaskGetCurrentTaskHandle();
-    resp_cfg.retries = 0;
+ipmb_error ipmb_response_send ( ipmi_msg * resp, ipmb_completion * done )
+{
+    ipmi_msg_cfg * frame = (ipmi_msg_cfg *) resp;
+    ipmb_error status = ipmb_error_failure;
+
+    /* Only this frame can give the signal from now on */
+    done->pending = frame;
+    frame->completion = done;
+    ipmb_tx_post( frame, 0, pdFALSE );
+
+    if ( xSemaphoreTake( done->signal, IPMB_RESP_SEND_TIMEOUT ) == pdTRUE ) {
+        return done->status;
+    }
+
+    taskENTER_CRITICAL();
+    if ( done->pending == NULL ) {
+        /* Completed right after the wait ran out, take the signal it gave */
+        xSemaphoreTake( done->signal, 0 );
+        status = done->status;
+    }
+    done->pending = NULL;
+    taskEXIT_CRITICAL();
+
+    return status;
+}
+
+/*! @brief Copies a response built by the caller into a TX pool frame */
+static ipmi_msg * ipmb_response_copy ( ipmi_msg * req, ipmi_msg * resp, TickType_t ticks_to_wait )
+{
+    ipmi_msg * frame = ipmb_response_alloc( req, ticks_to_wait );
 
-    /* Blocks here until is able put message in tx queue */
-    if (xQueueSend( ipmb_txqueue, &resp_cfg, portMAX_DELAY) != pdTRUE ){
+    if ( frame != NULL ) {
+        frame->completion_code = resp->completion_code;
+        frame->data_len = resp->data_len;
+        memcpy( frame->data, resp->data, resp->data_len );
+    }
+    return frame;
+}
+
+ipmb_error ipmb_queue_response ( ipmi_msg * req, ipmi_msg * resp )
+{
+    ipmi_msg * frame = ipmb_response_copy( req, resp, CLIENT_NOTIFY_TIMEOUT );
+
+    if ( frame == NULL ) {
         return ipmb_error_failure;
     }
+    /* Nobody waits for the transmission outcome */
+    ipmb_response_queue( frame );
+    return ipmb_error_success;
+}
 
-    /* Use this notification to block the function while the response does not arrive */
-    /* BUG: if you are using ticks wait you can not notify with value = 0 (ipmb_error_success)
-     * you can not distinct between timeout and ipmb_error_success */
-    if ( ulTaskNotifyTake( pdTRUE, 1000 ) == ipmb_error_unknown ){
-    	// timeout??
+ipmb_error ipmb_send_response ( ipmi_msg * req, ipmi_msg * resp, ipmb_completion * done )
+{
+    ipmi_msg * frame = ipmb_response_copy( req, resp, IPMB_MSG_TIMEOUT );
+
+    if ( frame == NULL ) {
         return ipmb_error_failure;
     }
-    if (ipmb_error_success)
-    	return ipmb_error_success;
-    else
-    	return ipmb_error_failure;
+    return ipmb_response_send( frame, done );
 }
 
-/*! @brief Notifies the client that a new request has arrived and copies the message to its queue.
- * This function receives a message wrapped in a ipmi_msg_cfg struct and copies only the ipmi_msg
- * field to the client queue.
- * Also, if a task has registered its handle in the caller_task field, notify it.
+/*! @brief Notifies the client that a new request has arrived and passes the message to its queue.
+ * This function receives a message wrapped in a ipmi_msg_cfg struct (inside a pool frame) and queues
+ * only a pointer to its ipmi_msg field to the client queue, handing the frame ownership to the client.
  *
  * @param[in] msg_cfg The message that arrived, wrapped in the configuration struct ipmi_msg_cfg.
  *
- * @retval ipmb_error_success The message was successfully copied.
- * @retval ipmb_error_timeout The client_queue was full.
+ * @retval ipmb_error_success The message was successfully queued.
+ * @retval ipmb_error_timeout The client queue was full, the frame was returned to the pool.
+ * @retval ipmb_error_invalid_req No client wants this message, the frame was returned to the pool.
  */
 ipmb_error ipmb_notify_client ( ipmi_msg_cfg * msg_cfg )
 {
-    configASSERT( client_queue );
+    ipmi_msg * msg;
+    ipmb_client * client;
+
     configASSERT( msg_cfg != NULL )
+
     /* Sends only the ipmi msg, not the control struct */
-    if ( xQueueSend( client_queue, &(msg_cfg->buffer), CLIENT_NOTIFY_TIMEOUT ) ) {
-        if ( msg_cfg->caller_task ) {
-            xTaskNotifyGive( msg_cfg->caller_task );
-        }
+    msg = &(msg_cfg->buffer);
+    client = ipmb_find_client( msg );
+    if ( client == NULL ) {
+        ipmb_release_msg( msg );
+        return ipmb_error_invalid_req;
+    }
+
+    if ( xQueueSend( client->queue, &msg, CLIENT_NOTIFY_TIMEOUT ) ) {
         return ipmb_error_success;
     }
+    IPMB_STAT_INC( IPMB_STAT_QUEUE_FULL );
+    ipmb_release_msg( msg );
     return ipmb_error_timeout;
 }
 
-ipmb_error ipmb_register_rxqueue ( QueueHandle_t * queue )
+/*! @brief Finds the client that must receive a message
+ *
+ * The most specific matching filter wins (NetFN and CMD, then NetFN only, then anything),
+ * ties go to the client registered first.
+ *
+ * @return Matching client or NULL if nobody wants this message.
+ */
+static ipmb_client * ipmb_find_client ( ipmi_msg * msg )
 {
+    ipmb_client * best = NULL;
+    uint8_t best_score = 0;
+    uint8_t score;
+    uint8_t i;
+
+    for ( i = 0; i < client_count; i++ ) {
+        ipmb_client * client = &clients[i];
+
+        if ( !( client->flags & IPMB_CLIENT_REQUESTS ) ) {
+            continue;
+        }
+        /* Responses are filtered by the NetFN of their request */
+        if ( ( client->netfn != IPMB_FILTER_ANY ) && ( client->netfn != ( msg->netfn & ~0x01 ) ) ) {
+            continue;
+        }
+        if ( ( client->cmd != IPMB_FILTER_ANY ) && ( client->cmd != msg->cmd ) ) {
+            continue;
+        }
+
+        score = 1 + ( client->netfn != IPMB_FILTER_ANY ) + ( client->cmd != IPMB_FILTER_ANY );
+        if ( score > best_score ) {
+            best = client;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+ipmb_error ipmb_register_client ( QueueHandle_t * queue, uint8_t netfn, uint8_t cmd, uint8_t flags )
+{
+    ipmb_error ret = ipmb_error_success;
+
     configASSERT( queue != NULL );
 
-    *queue = xQueueCreate( IPMB_CLIENT_QUEUE_LEN, sizeof(ipmi_msg) );
+    *queue = xQueueCreate( IPMB_CLIENT_QUEUE_LEN, sizeof(ipmi_msg *) );
+    if ( *queue == NULL ) {
+        return ipmb_error_queue_creation;
+    }
 
-    /* Copies the queue handler so we know where to write */
-    client_queue = *queue;
-    if ( *queue ) {
-        return ipmb_error_success;
+    /* The RX task reads the table without locking, publish the entry before the count */
+    taskENTER_CRITICAL();
+    if ( client_count < IPMB_MAX_CLIENTS ) {
+        clients[client_count].queue = *queue;
+        clients[client_count].netfn = netfn;
+        clients[client_count].cmd = cmd;
+        clients[client_count].flags = flags;
+        client_count++;
     } else {
-        return ipmb_error_queue_creation;
+        ret = ipmb_error_queue_creation;
+    }
+    taskEXIT_CRITICAL();
+
+    if ( ret != ipmb_error_success ) {
+        vQueueDelete( *queue );
+        *queue = NULL;
+    } else {
+        queue_stats_register( *queue, "IPMB_CLIENT" );
     }
+    return ret;
+}
+
+ipmb_error ipmb_register_rxqueue ( QueueHandle_t * queue )
+{
+    return ipmb_register_client( queue, IPMB_FILTER_ANY, IPMB_FILTER_ANY, IPMB_CLIENT_REQUESTS );
 }
 
-/*! @brief Calculate the IPMB message checksum byte.
- * The cheksum byte is calculated by perfoming a simple 8bit 2's complement of the sum of all previous bytes.
- * Since we're using a unsigned int to hold the checksum value, we only need to subtract all bytes from it.
- * @param buffer Pointer to the message bytes.
- * @param range How many bytes will be used in the calculation.
+/*! @brief Finds the handler of the requests sent to one of the proxy addresses
  *
- * @return Checksum of the specified bytes of the buffer.
+ * @return Handler or NULL if the address is our own (or nobody answers for it).
  */
-uint8_t ipmb_calculate_chksum ( uint8_t * buffer, uint8_t range )
+static ipmb_proxy_handler ipmb_find_proxy ( uint8_t addr )
 {
-    configASSERT( buffer != NULL );
-    uint8_t chksum = 0;
     uint8_t i;
-    for ( i = 0; i < range; i++ ) {
-        chksum -= buffer[i];
+
+    for ( i = 0; i < proxy_count; i++ ) {
+        if ( proxies[i].addr == addr ) {
+            return proxies[i].handler;
+        }
     }
-    return chksum;
+    return NULL;
 }
 
-/*! @brief Asserts the input message checksums by comparing them with our calculated ones.
+ipmb_error ipmb_register_proxy ( uint8_t addr, ipmb_proxy_handler handler )
+{
+    ipmb_error ret = ipmb_error_failure;
+    uint8_t i;
+
+    configASSERT( handler != NULL );
+
+    /* The RX task reads the table without locking, publish the entry before the count */
+    taskENTER_CRITICAL();
+    if ( proxy_count < IPMB_MAX_PROXIES ) {
+        proxies[proxy_count].addr = addr;
+        proxies[proxy_count].handler = handler;
+        proxy_count++;
+        ret = ipmb_error_success;
+    }
+    taskEXIT_CRITICAL();
+
+    if ( ret != ipmb_error_success ) {
+        return ret;
+    }
+
+    /* Only frames to an address registered above can be received, on every link */
+    for ( i = 0; i < IPMB_LINKS; i++ ) {
+        if ( !xI2CSlaveAddAddress( ipmb_links[i].i2c_id, addr ) ) {
+            while ( i-- > 0 ) {
+                vI2CSlaveRemoveAddress( ipmb_links[i].i2c_id, addr );
+            }
+            taskENTER_CRITICAL();
+            proxy_count--;
+            taskEXIT_CRITICAL();
+            return ipmb_error_failure;
+        }
+    }
+    return ret;
+}
+
+void ipmb_release_msg ( ipmi_msg * msg )
+{
+    /* The message is the first field of its pool frame */
+    ipmb_rx_frame * frame = (ipmb_rx_frame *) msg;
+
+    mem_pool_free( &ipmb_rx_pool, frame );
+}
+
+uint32_t ipmb_request_budget ( ipmi_msg * req )
+{
+    ipmb_rx_frame * frame = (ipmb_rx_frame *) req;
+    uint32_t elapsed = timestamp_elapsed( timestamp_now(), frame->msg.timestamp );
+
+    if ( elapsed >= IPMB_MSG_TIMEOUT_US ) {
+        return 0;
+    }
+    return IPMB_MSG_TIMEOUT_US - elapsed;
+}
+
+void ipmb_stamp ( ipmi_msg * msg, ipmb_stamp_id id )
+{
+    ipmb_rx_frame * frame = (ipmb_rx_frame *) msg;
+
+    frame->stamp[id] = DWT->CYCCNT;
+}
+
+uint32_t ipmb_get_stamp ( ipmi_msg * msg, ipmb_stamp_id id )
+{
+    ipmb_rx_frame * frame = (ipmb_rx_frame *) msg;
+
+    return frame->stamp[id];
+}
+
+uint16_t ipmb_corr ( ipmi_msg * msg )
+{
+    /* The message is the first field of its pool frame */
+    return mem_pool_owns( &ipmb_rx_pool, msg ) ? ( (ipmi_msg_cfg *) msg )->corr : 0;
+}
+
+/*! @brief Allocates the sequence number of a new request and reserves its outstanding table slot
+ *
+ * Each (rsSA, NetFN) pair has its own counter, so a burst towards one responder doesn't make the sequence
+ * numbers of other ones jump. A new pair starts from the global counter, which keeps numbers recently
+ * used on the bus from being handed out again right away. The number is only taken if its slot
+ * (seq masked by #IPMB_MAX_OUTSTANDING_REQ) is free or expired, and the slot stays reserved until
+ * #ipmb_register_outstanding (or #ipmb_release_outstanding) claims it.
  *
- * @param buffer Pointer to the message bytes.
- * @param buffer_len Size of the message.
+ * @param[in] dest_addr Responder slave address (rsSA)
+ * @param[in] netfn Request NetFN
+ * @param[out] seq Allocated sequence number (6 bits)
  *
- * @retval ipmb_error_success The message's checksum bytes are correct, therefore the message is valid.
- * @retval ipmb_error_hdr_chksum The header checksum byte is invalid.
- * @retval ipmb_error_hdr_chksum The final checksum byte is invalid.
+ * @return 1 on success, 0 if every slot of the outstanding table is busy.
  */
-ipmb_error ipmb_assert_chksum ( uint8_t * buffer, uint8_t buffer_len )
+uint8_t ipmb_alloc_seq ( uint8_t dest_addr, uint8_t netfn, uint8_t * seq )
 {
-    configASSERT( buffer );
+    ipmb_seq_context * ctx = NULL;
+    ipmb_outstanding_req * entry;
+    uint32_t now = timestamp_now();
+    uint8_t candidate;
+    uint8_t i;
+    uint8_t found = 0;
 
-    uint8_t header_chksum = buffer[2];
-    uint8_t msg_chksum = buffer[buffer_len-1];
-    uint8_t calc_header_chksum = ipmb_calculate_chksum( buffer, IPMI_HEADER_CHECKSUM_POSITION );
-    uint8_t calc_msg_chksum = ipmb_calculate_chksum( buffer, buffer_len-1 );
-    if ( header_chksum == calc_header_chksum ) {
-        if ( msg_chksum == calc_msg_chksum ) {
-            return ipmb_error_success;
+    taskENTER_CRITICAL();
+    for ( i = 0; i < IPMB_SEQ_CONTEXTS; i++ ) {
+        if ( seq_ctx[i].valid && ( seq_ctx[i].dest_addr == dest_addr ) && ( seq_ctx[i].netfn == netfn ) ) {
+            ctx = &seq_ctx[i];
+            break;
         }
-        return ipmb_error_hdr_chksum;
-    }
-    return ipmb_error_msg_chksum;
-}
-
-/*! @brief Encode IPMI msg struct to a byte formatted buffer
- *
- * This function formats the ipmi_msg struct fields into a byte array, following the specification:
- *
- *| IPMB Messages  |         |          |         |        |
- *|----------------+---------+----------+---------+--------|
- *|                | REQUEST | RESPONSE | Bit Len | Byte # |
- *|----------------+---------+----------+---------+--------|
- *| Connection     | rsSA    | rqSA     |       8 |      1 |
- *| Header         | NetFN   | NetFN    |       6 |      2 |
- *|                | rsLUN   | rqLUN    |       2 |      2 |
- *|----------------+---------+----------+---------+--------|
- *| Header Chksum  | Chksum  | Chksum   |       8 |      3 |
- *|----------------+---------+----------+---------+--------|
- *|                | rqSA    | rsSA     |       8 |      4 |
- *| Callback Info  | rqSeq   | rqSeq    |       6 |      5 |
- *|                | rqLUN   | rsLUN    |       2 |      5 |
- *|----------------+---------+----------+---------+--------|
- *| Command        | CMD     | CMD      |       8 |      6 |
- *|----------------+---------+----------+---------+--------|
- *| Data           |         | CC       |       8 |      7 |
- *|                | Data    | Data     |     8*N |    7+N |
- *|----------------+---------+----------+---------+--------|
- *| Message Chksum | Chksum  | Checksum |       8 |  7+N+1 |
- *|----------------+---------+----------+---------+--------|
- *
- * @param[out] buffer Byte buffer which will hold the formatted message
- * @param[in] msg The message struct to be formatted
- *
- * @retval ipmb_error_success The message was successfully formatted
+    }
+    if ( ctx == NULL ) {
+        /* Recycle the contexts in a round-robin fashion */
+        ctx = &seq_ctx[seq_ctx_next];
+        seq_ctx_next = ( seq_ctx_next + 1 ) % IPMB_SEQ_CONTEXTS;
+        ctx->valid = 1;
+        ctx->dest_addr = dest_addr;
+        ctx->netfn = netfn;
+        ctx->seq = current_seq;
+    }
+
+    candidate = ctx->seq;
+    for ( i = 0; i < IPMB_MAX_OUTSTANDING_REQ; i++ ) {
+        candidate = ( candidate + 1 ) & IPMB_SEQ_MAX;
+        entry = &outstanding_req[candidate & (IPMB_MAX_OUTSTANDING_REQ - 1)];
+        if ( ( entry->in_use == IPMB_OUTSTANDING_FREE ) || timestamp_reached( now, entry->deadline ) ) {
+            /* Asynchronous requests past their deadline still have to be reported by ipmb_outstanding_timeout */
+            if ( ( entry->in_use == IPMB_OUTSTANDING_SENT ) && entry->callback ) {
+                continue;
+            }
+            entry->in_use = IPMB_OUTSTANDING_RESERVED;
+            entry->dest_addr = dest_addr;
+            entry->netfn = netfn;
+            entry->seq = candidate;
+            entry->callback = NULL;
+            /* Keeps the slot while the request waits in the TX queue */
+            entry->deadline = now + IPMB_MSG_TIMEOUT_US;
+            ctx->seq = candidate;
+            current_seq = candidate;
+            *seq = candidate;
+            found = 1;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return found;
+}
+
+/*! @brief Reserves an entry in the outstanding requests table for a request about to be sent.
+ *
+ * The slot is selected by the request sequence number, so a slot can only be busy if
+ * #IPMB_MAX_OUTSTANDING_REQ requests are still waiting for their responses. Expired entries
+ * are silently reused.
+ *
+ * @param[in] req_cfg Request (and its send timestamp) to be registered.
+ *
+ * @retval ipmb_error_success The request was registered.
+ * @retval ipmb_error_failure The slot is still held by a request that didn't time out yet.
+ */
+ipmb_error ipmb_register_outstanding ( ipmi_msg_cfg * req_cfg )
+{
+    ipmb_outstanding_req * entry = &outstanding_req[req_cfg->buffer.seq & (IPMB_MAX_OUTSTANDING_REQ - 1)];
+    ipmb_error ret = ipmb_error_success;
+
+    taskENTER_CRITICAL();
+    if ( ( entry->in_use == IPMB_OUTSTANDING_RESERVED ) &&
+         ( entry->seq == req_cfg->buffer.seq ) && ( entry->dest_addr == req_cfg->buffer.dest_addr ) ) {
+        /* Our own reservation, made by ipmb_alloc_seq */
+    } else if ( entry->in_use && !timestamp_reached( req_cfg->timestamp, entry->deadline ) ) {
+        /* Entry deadline is still in the future */
+        ret = ipmb_error_failure;
+    }
+
+    if ( ret == ipmb_error_success ) {
+        entry->dest_addr = req_cfg->buffer.dest_addr;
+        entry->netfn = req_cfg->buffer.netfn;
+        entry->cmd = req_cfg->buffer.cmd;
+        entry->seq = req_cfg->buffer.seq;
+        entry->callback = req_cfg->callback;
+        entry->callback_ctx = req_cfg->callback_ctx;
+        entry->deadline = req_cfg->timestamp + IPMB_MSG_TIMEOUT_US;
+        entry->in_use = IPMB_OUTSTANDING_SENT;
+    }
+    taskEXIT_CRITICAL();
+
+    /* One tick more, so the deadline (in microseconds) is always past when it expires */
+    if ( ( ret == ipmb_error_success ) && req_cfg->callback ) {
+        wheel_timer_start( &outstanding_timer[entry - outstanding_req], IPMB_MSG_TIMEOUT + 1 );
+    }
+
+    return ret;
+}
+
+/*! @brief Frees the outstanding table entry held by a request that couldn't be sent
+ *
+ * @param[in] req Request that was previously registered.
  */
-ipmb_error ipmb_encode ( uint8_t * buffer, ipmi_msg * msg )
-{
-    configASSERT( msg );
-    configASSERT( buffer );
-    /* Use this variable to address the buffer dynamically */
-    uint8_t i = 0;
-
-    buffer[i++] = msg->dest_addr;
-    buffer[i++] = ( ( ( msg->netfn << 2 ) & IPMB_NETFN_MASK ) | ( msg->dest_LUN & IPMB_DEST_LUN_MASK ) );
-    buffer[i++] = ipmb_calculate_chksum( &buffer[0], IPMI_HEADER_CHECKSUM_POSITION );
-    buffer[i++] = msg->src_addr;
-    buffer[i++] = ( ( ( msg->seq << 2 ) & IPMB_SEQ_MASK ) | ( msg->src_LUN & IPMB_SRC_LUN_MASK ) );
-    buffer[i++] = msg->cmd;
-    buffer[i++] = msg->completion_code;
-    memcpy (&buffer[i], &msg->data[0], msg->data_len);
-    i += msg->data_len;
-    buffer[i] = ipmb_calculate_chksum( &buffer[0], i );
+void ipmb_release_outstanding ( ipmi_msg * req )
+{
+    ipmb_outstanding_req * entry = &outstanding_req[req->seq & (IPMB_MAX_OUTSTANDING_REQ - 1)];
 
-    return ipmb_error_success;
+    taskENTER_CRITICAL();
+    if ( entry->in_use && ( entry->seq == req->seq ) && ( entry->dest_addr == req->dest_addr ) ) {
+        entry->in_use = IPMB_OUTSTANDING_FREE;
+        wheel_timer_stop( &outstanding_timer[entry - outstanding_req] );
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*! @brief Matches an incoming response with the outstanding request it answers
+ *
+ * The lookup is O(1): the response sequence number selects the slot and the
+ * (rsSA, NetFN, CMD, Seq) key is then compared. A matched entry is removed from the table.
+ *
+ * @param[in] resp Decoded response message.
+ * @param[out] match Copy of the matched entry, so the caller can complete the request outside the critical section.
+ *
+ * @return 1 if a request waiting for this response was found (in time), 0 otherwise.
+ */
+uint8_t ipmb_match_outstanding ( ipmi_msg * resp, ipmb_outstanding_req * match )
+{
+    ipmb_outstanding_req * entry = &outstanding_req[resp->seq & (IPMB_MAX_OUTSTANDING_REQ - 1)];
+    uint8_t matched = 0;
+    uint32_t now = timestamp_now();
+
+    taskENTER_CRITICAL();
+    if ( ( entry->in_use == IPMB_OUTSTANDING_SENT ) &&
+         ( entry->seq == resp->seq ) &&
+         ( entry->dest_addr == resp->src_addr ) &&
+         ( (entry->netfn + 1) == resp->netfn ) &&
+         ( entry->cmd == resp->cmd ) ) {
+        if ( !timestamp_reached( now, entry->deadline ) ) {
+            *match = *entry;
+            matched = 1;
+            entry->in_use = IPMB_OUTSTANDING_FREE;
+            wheel_timer_stop( &outstanding_timer[entry - outstanding_req] );
+        } else if ( entry->callback == NULL ) {
+            IPMB_STAT_INC( IPMB_STAT_TIMEOUTS );
+            entry->in_use = IPMB_OUTSTANDING_FREE;
+        }
+        /* Late asynchronous requests are left for ipmb_outstanding_timeout to report the timeout */
+    }
+    taskEXIT_CRITICAL();
+
+    return matched;
 }
 
-/*! @brief Decodes a buffer and copies to its specific fields in a ipmi_msg struct
+/*! @brief Completes an asynchronous request whose deadline has passed with #ipmb_error_timeout
  *
- * @param[out] msg Pointer to a ipmi_msg struct which will hold the decoded message
- * @param[in] buffer Pointer to a byte array that will be decoded
- * @param[in] len Length of \p buffer
+ * Timer callback of its outstanding slot, called from the timer service task. Expired entries of blocking
+ * requests have no timer, they're simply overwritten by new ones.
+ * The timer counts ticks and the deadline is in microseconds: if the ticks got ahead of the TIMER3 clock (tickless
+ * idle correction, core clock switch) the timer is started again for the time left, or the slot would never be freed.
+ */
+static void ipmb_outstanding_timeout ( void * arg )
+{
+    ipmb_outstanding_req * entry = &outstanding_req[(uint32_t) arg];
+    ipmb_req_callback callback = NULL;
+    uint32_t left = 0;
+    uint32_t now;
+    void * ctx;
+
+    taskENTER_CRITICAL();
+    if ( ( entry->in_use == IPMB_OUTSTANDING_SENT ) && entry->callback ) {
+        now = timestamp_now();
+        if ( timestamp_reached( now, entry->deadline ) ) {
+            callback = entry->callback;
+            ctx = entry->callback_ctx;
+            entry->in_use = IPMB_OUTSTANDING_FREE;
+        } else {
+            left = timestamp_elapsed( entry->deadline, now );
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if ( left ) {
+        /* One tick more, as when it was first started */
+        wheel_timer_start( &outstanding_timer[(uint32_t) arg], left / ( 1000 * portTICK_PERIOD_MS ) + 1 );
+    }
+
+    if ( callback ) {
+        IPMB_STAT_INC( IPMB_STAT_TIMEOUTS );
+        callback( NULL, ipmb_error_timeout, ctx );
+    }
+}
+
+/*! @brief Reports a request that couldn't be sent to its completion callback */
+void ipmb_request_failed ( ipmi_msg_cfg * req_cfg )
+{
+    if ( req_cfg->callback ) {
+        req_cfg->callback( NULL, ipmb_error_failure, req_cfg->callback_ctx );
+    }
+}
+
+/*! @brief Looks up an incoming request in the response replay cache
+ *
+ * A request is considered a retry when the same requester sends the same (Seq, NetFN, CMD) within #IPMB_DUP_REQ_WINDOW.
+ * New requests take a free entry or the least recently used answered one, and are marked as pending until their
+ * response is sent. A pending entry is never taken over while its response can still be sent in time, or that
+ * response would be dropped for having no request.
  *
- * @retval ipmb_error_success The message was successfully decoded
+ * @param[in] req_cfg Incoming request, with its arrival timestamp already set.
+ * @param[out] replay Filled with the cached response when the request has already been answered.
+ *
+ * @retval ipmb_cache_new The request must be delivered to the client.
+ * @retval ipmb_cache_in_progress A retry of a request still being handled, drop it.
+ * @retval ipmb_cache_replay A retry of an answered request, @p replay must be sent again.
+ * @retval ipmb_cache_full Every entry holds a request still being handled, drop it.
  */
-ipmb_error ipmb_decode ( ipmi_msg * msg, uint8_t * buffer, uint8_t len )
-{
-    configASSERT( msg );
-    configASSERT( buffer );
-    /* Use this variable to address the buffer dynamically */
-    uint8_t i = 0;
-
-    msg->dest_addr = buffer[i++];
-    msg->netfn = buffer[i] >> 2;
-    msg->dest_LUN = ( buffer[i++] & IPMB_DEST_LUN_MASK );
-    msg->hdr_chksum = buffer[i++];
-    msg->src_addr = buffer[i++];
-    msg->seq = buffer[i] >> 2;
-    msg->src_LUN = ( buffer[i++] & IPMB_SRC_LUN_MASK );
-    msg->cmd = buffer[i++];
-    /* Checks if the message is a response and if so, fills the completion code field */
-    if ( IS_RESPONSE( (*msg) ) ) {
-        msg->completion_code = buffer[i++];
-    }
-    msg->data_len = len - i;
-    memcpy( &msg->data[0], &buffer[i], msg->data_len);
+ipmb_resp_cache_result ipmb_cache_check_request ( ipmi_msg_cfg * req_cfg, ipmi_msg * replay )
+{
+    ipmi_msg * req = &req_cfg->buffer;
+    ipmb_resp_cache_entry * entry;
+    ipmb_resp_cache_entry * lru = NULL;
+    ipmb_resp_cache_result ret = ipmb_cache_new;
+    uint8_t i;
 
-    return ipmb_error_success;
+    taskENTER_CRITICAL();
+    for ( i = 0; i < IPMB_RESP_CACHE_LEN; i++ ) {
+        entry = &resp_cache[i];
+
+        if ( entry->state == ipmb_cache_free ) {
+            lru = entry;
+            continue;
+        }
+
+        if ( ( entry->rq_addr == req->src_addr ) && ( entry->seq == req->seq ) &&
+             ( entry->netfn == req->netfn ) && ( entry->cmd == req->cmd ) &&
+             ( timestamp_elapsed( req_cfg->timestamp, entry->timestamp ) < IPMB_DUP_REQ_WINDOW ) ) {
+            break;
+        }
+
+        if ( ( entry->state == ipmb_cache_pending ) &&
+             ( timestamp_elapsed( req_cfg->timestamp, entry->timestamp ) < IPMB_MSG_TIMEOUT_US ) ) {
+            /* Still being handled, its response must find it */
+            continue;
+        }
+
+        if ( ( lru == NULL ) ||
+             ( ( lru->state != ipmb_cache_free ) && !timestamp_reached( entry->timestamp, lru->timestamp ) ) ) {
+            /* This entry was used before the current LRU candidate */
+            lru = entry;
+        }
+    }
+
+    if ( i < IPMB_RESP_CACHE_LEN ) {
+        if ( entry->state == ipmb_cache_done ) {
+            /* Restart the response deadline for this retry */
+            entry->timestamp = req_cfg->timestamp;
+            memcpy( replay, &entry->resp, sizeof(ipmi_msg) );
+            ret = ipmb_cache_replay;
+        } else {
+            ret = ipmb_cache_in_progress;
+        }
+    } else if ( lru == NULL ) {
+        ret = ipmb_cache_full;
+    } else {
+        lru->state = ipmb_cache_pending;
+        lru->rq_addr = req->src_addr;
+        lru->seq = req->seq;
+        lru->netfn = req->netfn;
+        lru->cmd = req->cmd;
+        lru->timestamp = req_cfg->timestamp;
+#if IPMB_LATENCY_STATS
+        lru->rx_stamp = req_cfg->timestamp;
+#endif
+    }
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+/*! @brief Finds the cache entry of the request answered by @p resp
+ *
+ * @return Pointer to the matching entry or NULL if there's none. Must be called inside a critical section.
+ */
+static ipmb_resp_cache_entry * ipmb_cache_find ( ipmi_msg * resp )
+{
+    uint8_t i;
+
+    for ( i = 0; i < IPMB_RESP_CACHE_LEN; i++ ) {
+        if ( ( resp_cache[i].state != ipmb_cache_free ) &&
+             ( resp_cache[i].rq_addr == resp->dest_addr ) && ( resp_cache[i].seq == resp->seq ) &&
+             ( ( resp_cache[i].netfn + 1 ) == resp->netfn ) && ( resp_cache[i].cmd == resp->cmd ) ) {
+            return &resp_cache[i];
+        }
+    }
+    return NULL;
+}
+
+/*! @brief Pairs an outgoing response with the request it answers
+ *
+ * @param[in] resp Response about to be sent.
+ *
+ * @retval ipmb_error_success The request was found and the response is still in time.
+ * @retval ipmb_error_invalid_req There's no matching request.
+ * @retval ipmb_error_timeout The response took longer than #IPMB_MSG_TIMEOUT to be built.
+ */
+ipmb_error ipmb_cache_match_response ( ipmi_msg * resp )
+{
+    ipmb_resp_cache_entry * entry;
+    ipmb_error ret = ipmb_error_success;
+
+    taskENTER_CRITICAL();
+    entry = ipmb_cache_find( resp );
+    if ( entry == NULL ) {
+        ret = ipmb_error_invalid_req;
+    } else if ( timestamp_elapsed( timestamp_now(), entry->timestamp ) >= IPMB_MSG_TIMEOUT_US ) {
+        /* The requester has given up on this one, let a retry run the handler again */
+        if ( entry->state == ipmb_cache_pending ) {
+            entry->state = ipmb_cache_free;
+        }
+        ret = ipmb_error_timeout;
+    }
+    taskEXIT_CRITICAL();
+
+    return ret;
+}
+
+/*! @brief Keeps a copy of a response that has been sent, so it can be replayed */
+void ipmb_cache_store_response ( ipmi_msg * resp )
+{
+    ipmb_resp_cache_entry * entry;
+#if IPMB_LATENCY_STATS
+    uint32_t elapsed = 0;
+    uint8_t first_answer = 0;
+#endif
+
+    taskENTER_CRITICAL();
+    entry = ipmb_cache_find( resp );
+    if ( entry != NULL ) {
+#if IPMB_LATENCY_STATS
+        /* Replayed responses aren't measured, they never go through a handler */
+        if ( entry->state == ipmb_cache_pending ) {
+            elapsed = timestamp_elapsed( timestamp_now(), entry->rx_stamp );
+            first_answer = 1;
+        }
+#endif
+        memcpy( &entry->resp, resp, sizeof(ipmi_msg) );
+        entry->state = ipmb_cache_done;
+    }
+    taskEXIT_CRITICAL();
+
+#if IPMB_LATENCY_STATS
+    if ( first_answer ) {
+        ipmb_latency_record( resp->netfn - 1, resp->cmd, elapsed );
+    }
+#endif
+}
+
+/*! @brief Drops a pending cache entry whose response couldn't be sent */
+void ipmb_cache_release ( ipmi_msg * resp )
+{
+    ipmb_resp_cache_entry * entry;
+
+    taskENTER_CRITICAL();
+    entry = ipmb_cache_find( resp );
+    if ( ( entry != NULL ) && ( entry->state == ipmb_cache_pending ) ) {
+        entry->state = ipmb_cache_free;
+    }
+    taskEXIT_CRITICAL();
+}
+
+uint32_t ipmb_get_stat ( ipmb_stat_id id )
+{
+    const xI2C_Config * cfg;
+    uint32_t sum = 0;
+    uint8_t i;
+
+    /* Counters of the I2C driver, of all the links together */
+    for ( i = 0; i < IPMB_LINKS; i++ ) {
+        cfg = &i2c_cfg[ipmb_links[i].i2c_id];
+        switch ( id ) {
+        case IPMB_STAT_I2C_ARB_LOST:
+            sum += cfg->arb_lost;
+            break;
+        case IPMB_STAT_I2C_RX_OVERRUN:
+            sum += cfg->slave_rx_dropped;
+            break;
+        case IPMB_STAT_I2C_TIMEOUTS:
+            sum += cfg->timeouts;
+            break;
+        case IPMB_STAT_I2C_BUS_RECOVERIES:
+            sum += cfg->bus_recoveries;
+            break;
+        case IPMB_STAT_I2C_DEFERRED_STARTS:
+            sum += cfg->deferred_starts;
+            break;
+        default:
+            return ( id < IPMB_STAT_COUNT ) ? ipmb_stats[id] : 0;
+        }
+    }
+    return sum;
+}
+
+void ipmb_clear_stats ( void )
+{
+    xI2C_Config * cfg;
+    uint8_t link;
+
+    /* A counter incremented while clearing may be lost, which is fine for statistics */
+    memset( (void *) ipmb_stats, 0, sizeof(ipmb_stats) );
+    for ( link = 0; link < IPMB_LINKS; link++ ) {
+        cfg = &i2c_cfg[ipmb_links[link].i2c_id];
+        cfg->arb_lost = 0;
+        cfg->slave_rx_dropped = 0;
+        cfg->timeouts = 0;
+        cfg->bus_recoveries = 0;
+        cfg->deferred_starts = 0;
+    }
+#if IPMB_LATENCY_STATS
+    uint8_t i;
+    for ( i = 0; i < IPMB_LATENCY_SLOTS; i++ ) {
+        memset( latency_hist[i].bucket, 0, sizeof(latency_hist[i].bucket) );
+    }
+#endif
+}
+
+#if IPMB_LATENCY_STATS
+/*! @brief Adds a response time to the histogram of its request NetFN/CMD
+ *
+ * Only called from the IPMB TX task, which is also the only one assigning histogram slots.
+ * When all the slots are taken by other commands, the sample is dropped.
+ */
+static void ipmb_latency_record ( uint8_t netfn, uint8_t cmd, uint32_t elapsed )
+{
+    ipmb_latency_hist * hist = NULL;
+    uint8_t bucket;
+    uint8_t i;
+
+    /* log2 bucket: number of significant bits of the elapsed time */
+    bucket = ( elapsed == 0 ) ? 0 : ( 32 - __builtin_clz( elapsed ) );
+    if ( bucket >= IPMB_LATENCY_BUCKETS ) {
+        bucket = IPMB_LATENCY_BUCKETS - 1;
+    }
+    METRIC_INC( latency_all[bucket] );
+
+    for ( i = 0; i < IPMB_LATENCY_SLOTS; i++ ) {
+        if ( ( latency_hist[i].netfn == netfn ) && ( latency_hist[i].cmd == cmd ) ) {
+            hist = &latency_hist[i];
+            break;
+        }
+        if ( latency_hist[i].netfn == 0xFF ) {
+            hist = &latency_hist[i];
+            hist->cmd = cmd;
+            hist->netfn = netfn;
+            break;
+        }
+    }
+
+    if ( hist == NULL ) {
+        return;
+    }
+
+    if ( hist->bucket[bucket] != 0xFFFF ) {
+        hist->bucket[bucket]++;
+    }
+}
+#endif
+
+const ipmb_latency_hist * ipmb_get_latency_hist ( uint8_t slot )
+{
+#if IPMB_LATENCY_STATS
+    if ( ( slot < IPMB_LATENCY_SLOTS ) && ( latency_hist[slot].netfn != 0xFF ) ) {
+        return &latency_hist[slot];
+    }
+#endif
+    return NULL;
 }
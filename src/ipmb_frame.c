@@ -0,0 +1,212 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file ipmb_frame.c
+ *
+ * @brief IPMB frame encoding, decoding and checksums
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "ipmb.h"
+#include "ipmb_frame.h"
+#include "prof.h"
+#include "ram_sections.h"
+
+/*! @brief Calculate the IPMB message checksum byte.
+ * The cheksum byte is calculated by perfoming a simple 8bit 2's complement of the sum of all previous bytes.
+ * Since we're using a unsigned int to hold the checksum value, we only need to subtract all bytes from it.
+ * @param buffer Pointer to the message bytes.
+ * @param range How many bytes will be used in the calculation.
+ *
+ * @return Checksum of the specified bytes of the buffer.
+ */
+__RAMFUNC_HOT uint8_t ipmb_calculate_chksum ( uint8_t * buffer, uint8_t range )
+{
+    PROF_SCOPE( PROF_IPMB_CHKSUM );
+    configASSERT( buffer != NULL );
+    uint8_t chksum = 0;
+    uint8_t i;
+    for ( i = 0; i < range; i++ ) {
+        chksum -= buffer[i];
+    }
+    return chksum;
+}
+
+/*! @brief Encode IPMI msg struct to a byte formatted buffer
+ *
+ * This function formats the ipmi_msg struct fields into a byte array, following the specification:
+ *
+ *| IPMB Messages  |         |          |         |        |
+ *|----------------+---------+----------+---------+--------|
+ *|                | REQUEST | RESPONSE | Bit Len | Byte # |
+ *|----------------+---------+----------+---------+--------|
+ *| Connection     | rsSA    | rqSA     |       8 |      1 |
+ *| Header         | NetFN   | NetFN    |       6 |      2 |
+ *|                | rsLUN   | rqLUN    |       2 |      2 |
+ *|----------------+---------+----------+---------+--------|
+ *| Header Chksum  | Chksum  | Chksum   |       8 |      3 |
+ *|----------------+---------+----------+---------+--------|
+ *|                | rqSA    | rsSA     |       8 |      4 |
+ *| Callback Info  | rqSeq   | rqSeq    |       6 |      5 |
+ *|                | rqLUN   | rsLUN    |       2 |      5 |
+ *|----------------+---------+----------+---------+--------|
+ *| Command        | CMD     | CMD      |       8 |      6 |
+ *|----------------+---------+----------+---------+--------|
+ *| Data           |         | CC       |       8 |      7 |
+ *|                | Data    | Data     |     8*N |    7+N |
+ *|----------------+---------+----------+---------+--------|
+ *| Message Chksum | Chksum  | Checksum |       8 |  7+N+1 |
+ *|----------------+---------+----------+---------+--------|
+ *
+ * The destination address (byte #1) is sent by the I2C driver as the slave address, so it isn't written in
+ * \p buffer, but it's still covered by both checksums.
+ *
+ * @param[out] buffer Byte buffer which will hold the formatted message, starting at the NetFN byte
+ * @param[in] msg The message struct to be formatted
+ *
+ * @return Amount of bytes written in \p buffer
+ */
+uint8_t ipmb_encode ( uint8_t * buffer, ipmi_msg * msg )
+{
+    PROF_SCOPE( PROF_IPMB_ENCODE );
+    configASSERT( msg );
+    configASSERT( buffer );
+    /* Use this variable to address the buffer dynamically */
+    uint8_t i = 0;
+
+    buffer[i++] = ( ( ( msg->netfn << 2 ) & IPMB_NETFN_MASK ) | ( msg->dest_LUN & IPMB_DEST_LUN_MASK ) );
+    buffer[i++] = ipmb_calculate_chksum( &buffer[0], IPMI_HEADER_CHECKSUM_POSITION - 1 ) - msg->dest_addr;
+    buffer[i++] = msg->src_addr;
+    buffer[i++] = ( ( ( msg->seq << 2 ) & IPMB_SEQ_MASK ) | ( msg->src_LUN & IPMB_SRC_LUN_MASK ) );
+    buffer[i++] = msg->cmd;
+    /* Only responses carry the completion code */
+    if ( IS_RESPONSE( (*msg) ) ) {
+        buffer[i++] = msg->completion_code;
+    }
+    memcpy (&buffer[i], &msg->data[0], msg->data_len);
+    i += msg->data_len;
+    buffer[i] = ipmb_calculate_chksum( &buffer[0], i ) - msg->dest_addr;
+
+    return i + 1;
+}
+
+/*! @brief Adds the four bytes of a word to a checksum accumulator
+ *
+ * The bytes are summed in two 16-bit lanes, which can't overflow on a frame of #IPMI_MSG_MAX_LENGTH bytes.
+ * The lanes are folded back by #ipmb_fold_chksum.
+ */
+static inline uint32_t ipmb_sum_word ( uint32_t acc, uint32_t word )
+{
+    return acc + ( word & 0x00FF00FF ) + ( ( word >> 8 ) & 0x00FF00FF );
+}
+
+static inline uint8_t ipmb_fold_chksum ( uint32_t acc )
+{
+    return (uint8_t) ( ( acc & 0xFFFF ) + ( acc >> 16 ) );
+}
+
+/*! @brief Validates and decodes a buffer into its specific fields in a ipmi_msg struct
+ *
+ * The frame is checked and decoded in a single pass: the length and the header checksum are
+ * checked before anything is copied, then the data bytes are copied word by word while being added
+ * to the message checksum.
+ *
+ * @param[out] msg Pointer to a ipmi_msg struct which will hold the decoded message
+ * @param[in] buffer Pointer to a byte array that will be decoded (including the final checksum byte)
+ * @param[in] len Length of \p buffer
+ *
+ * @retval ipmb_error_success The message was successfully decoded
+ * @retval ipmb_error_msg_length The buffer is too short to hold the header and checksums
+ * @retval ipmb_error_hdr_chksum The header checksum byte is invalid.
+ * @retval ipmb_error_msg_chksum The final checksum byte is invalid, \p msg contents are undefined.
+ */
+__RAMFUNC_HOT ipmb_error ipmb_decode ( ipmi_msg * msg, uint8_t * buffer, uint8_t len )
+{
+    PROF_SCOPE( PROF_IPMB_DECODE );
+    configASSERT( msg );
+    configASSERT( buffer );
+    /* Use this variable to address the buffer dynamically */
+    uint8_t i = 0;
+    uint8_t hdr_len;
+    uint32_t acc;
+    uint32_t word;
+
+    if ( ( len < IPMB_REQ_HEADER_LENGTH + 1 ) || ( len > IPMI_MSG_MAX_LENGTH ) ) {
+        return ipmb_error_msg_length;
+    }
+
+    /* The header checksum makes the sum of the first 3 bytes zero */
+    acc = buffer[0] + buffer[1] + buffer[2];
+    if ( (uint8_t) acc != 0 ) {
+        return ipmb_error_hdr_chksum;
+    }
+
+    /* Responses carry the completion code in the header */
+    hdr_len = ( ( buffer[1] >> 2 ) & 0x01 ) ? IPMB_RESP_HEADER_LENGTH : IPMB_REQ_HEADER_LENGTH;
+    if ( len < hdr_len + 1 ) {
+        return ipmb_error_msg_length;
+    }
+
+    msg->dest_addr = buffer[i++];
+    msg->netfn = buffer[i] >> 2;
+    msg->dest_LUN = ( buffer[i++] & IPMB_DEST_LUN_MASK );
+    i++;
+    msg->src_addr = buffer[i++];
+    msg->seq = buffer[i] >> 2;
+    msg->src_LUN = ( buffer[i++] & IPMB_SRC_LUN_MASK );
+    msg->cmd = buffer[i++];
+    acc += msg->src_addr + buffer[4] + msg->cmd;
+    /* Checks if the message is a response and if so, fills the completion code field */
+    if ( IS_RESPONSE( (*msg) ) ) {
+        msg->completion_code = buffer[i++];
+        acc += msg->completion_code;
+    }
+    msg->data_len = len - i - 1;
+    acc += buffer[len - 1];
+
+    /* Copy and sum the data field a word at a time, both pointers may be unaligned,
+     * which the Cortex-M3 handles on single word loads and stores */
+    uint8_t * dst = &msg->data[0];
+    for ( ; ( i + sizeof(word) ) < len; i += sizeof(word), dst += sizeof(word) ) {
+        memcpy( &word, &buffer[i], sizeof(word) );
+        memcpy( dst, &word, sizeof(word) );
+        acc = ipmb_sum_word( acc, word );
+    }
+    for ( ; i < ( len - 1 ); i++ ) {
+        *dst++ = buffer[i];
+        acc += buffer[i];
+    }
+
+    /* The message checksum makes the sum of the whole frame zero */
+    if ( ipmb_fold_chksum( acc ) != 0 ) {
+        return ipmb_error_msg_chksum;
+    }
+
+    return ipmb_error_success;
+}
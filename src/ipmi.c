@@ -29,167 +29,562 @@
 #include "string.h"
 
 /* Project includes */
+#include "i2c.h"
 #include "ipmb.h"
 #include "ipmi.h"
+#include "ipmi_cache.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "mem_pool.h"
+#include "mem_stats.h"
+#include "stack_mon.h"
+#include "cpu_load.h"
+#include "prof.h"
+#include "sensor.h"
+#include "sdr.h"
+#include "threshold.h"
+#include "event.h"
+#include "telemetry.h"
+#include "ekey.h"
+#include "fru.h"
 #include "board_defs.h"
 #include "led.h"
+#include "board_sensors.h"
+#include "hotswap.h"
+#include "image.h"
+#include "init_stage.h"
+#include "boot_time.h"
+#include "crash.h"
+#include "fpga.h"
+#include "hpm.h"
+#include "watchdog.h"
+#include "device_id.h"
+#include "config_store.h"
+#include "poh.h"
+#include "metrics.h"
+#include "wallclock.h"
+#include "selftest.h"
 
 /* Local variables */
 QueueHandle_t ipmi_rxqueue = NULL;
+QueueHandle_t ipmi_workqueue = NULL;
+/* Work queue of the handlers flagged IPMI_HANDLER_SLOW */
+QueueHandle_t ipmi_slow_workqueue = NULL;
+static QueueHandle_t ipmi_deferqueue = NULL;
+/* The dispatcher blocks on both queues above at once */
+static QueueSetHandle_t ipmi_queue_set = NULL;
 
+/* Work item handed to the workers. The request itself is not copied,
+   it stays in its IPMB receive pool frame until the response is sent */
 struct req_param_struct{
-  ipmi_msg req_received;
+  ipmi_msg * req_received;
   t_req_handler req_handler;
+  /* Counted in ipmi_secondary_busy (LUN other than 0, fast workers only) */
+  uint8_t secondary;
 };
 
-#define MAX_HANDLERS 20
-t_req_handler_record handlers[MAX_HANDLERS]={
-  {
-    .netfn	 = NETFN_GRPEXT,
-    .cmd	 = IPMI_PICMG_CMD_GET_PROPERTIES,
-    .req_handler = ipmi_picmg_get_properties
-  },
-  {
-    .netfn	 = NETFN_GRPEXT,
-    .cmd	 = IPMI_PICMG_CMD_SET_FRU_LED_STATE,
-    .req_handler = ipmi_picmg_set_led
-  },
-  {
-    .netfn	 = NETFN_SE,
-    .cmd	 = IPMI_SET_EVENT_RECEIVER_CMD,
-    .req_handler = ipmi_se_set_receiver
-  },
-  {
-    .netfn	 = NETFN_APP,
-    .cmd	 = IPMI_GET_DEVICE_ID_CMD,
-    .req_handler = ipmi_app_get_device_id
-  }
+/* Deferred work item, see ipmi_defer() */
+struct deferred_work{
+  ipmi_deferred_fn fn;
+  void * ctx;
+  uint32_t arg;
+};
+
+/* Request taken in by the dispatcher, waiting for its turn */
+struct pending_req{
+  ipmi_msg * req;
+  uint8_t requester;
+};
+
+/* Token bucket of a source address, see ipmi_admit() */
+struct requester{
+  uint8_t used;
+  uint8_t addr;
+  uint8_t pending;
+  uint32_t credit;
+  TickType_t last;
 };
 
+#define IPMI_REQUESTER_CREDIT_MAX ((uint32_t) IPMI_REQUESTER_BURST * configTICK_RATE_HZ)
+
+static struct pending_req ipmi_pending[IPMI_PENDING_LEN];
+static uint8_t ipmi_pending_count;
+static struct requester ipmi_requesters[IPMI_REQUESTERS];
+static uint8_t ipmi_last_served;
+/* Requests to a LUN other than 0 handed to the workers and not done yet */
+static volatile uint8_t ipmi_secondary_busy;
+
+static void ipmi_admit ( ipmi_msg * req );
+static ipmi_msg * ipmi_next_pending ( void );
+static void ipmi_dispatch ( ipmi_msg * req );
+static void ipmi_run_inline ( ipmi_msg * req, const t_req_handler_record * record );
+static void ipmi_worker_run ( struct req_param_struct * req_param, ipmb_completion * done );
+static uint8_t ipmi_sensor_status ( uint8_t sensor, const sensor_reading * reading );
+
+TASK_STACK( ipmi_worker_stack, IPMI_HANDLER_STACK_DEPTH, IPMI_HANDLER_WORKERS );
+TASK_STACK( ipmi_slow_worker_stack, IPMI_SLOW_HANDLER_STACK_DEPTH, IPMI_SLOW_HANDLER_WORKERS );
+TASK_STACK( ipmi_dispatcher_stack, IPMI_TASK_STACK_DEPTH, 1 );
 
 void IPMITask ( void * pvParameters )
 {
-  ipmi_msg req_received;
-  t_req_handler req_handler = (t_req_handler) 0;
+  ipmi_msg * req;
+  struct deferred_work work;
+  watchdog_id wdg = watchdog_register( "IPMI", WATCHDOG_DEADLINE );
+
+  /* Answering requests is as far as a new image has to get to be kept */
+  image_confirm();
+  init_stage_done( INIT_STAGE_CORE );
 
   for ( ;; ){
-    /* Received request and handler function must be allocated
-       dynamically so they can be passed to the dynamically-created
-       handler tasks. These tasks must also free the memory after use */
+    watchdog_checkin( wdg );
+
+    /* The received requests are first taken in by ipmi_admit(), then
+       dispatched one at a time, each requester in turn. Deferred work
+       waits on the same queue set and only runs once the requests
+       taken in are dispatched. It only blocks when there's nothing
+       left to dispatch. */
 
-    if(xQueueReceive( ipmi_rxqueue, &req_received , portMAX_DELAY ) == pdFALSE){
-      configASSERT(pdFALSE);
+    if (xQueueSelectFromSet( ipmi_queue_set, ipmi_pending_count ? 0 : WATCHDOG_BLOCK_TIME ) != NULL){
+      /* The set holds one entry per item queued to either queue, so one
+         item can be taken from whichever of them goes first */
+      if (xQueueReceive( ipmi_rxqueue, &req, 0 ) == pdTRUE){
+        ipmi_admit( req );
+      }else if (xQueueReceive( ipmi_deferqueue, &work, 0 ) == pdTRUE){
+        while ( (req = ipmi_next_pending()) != NULL ){
+          ipmi_dispatch( req );
+        }
+        work.fn( work.ctx, work.arg );
+      }
+      /* Everything waiting is taken in before choosing whose turn it is */
       continue;
     }
 
-    req_handler = (t_req_handler) 0;
-    req_handler = ipmi_retrieve_handler(req_received.netfn, req_received.cmd);
-
-    if (req_handler != 0){
-      
-      /* TODO: create unique name for each created task, probably
-	 related to netfn and command */
-      struct req_param_struct *req_param = pvPortMalloc(sizeof(struct req_param_struct));
-      req_param->req_received = req_received;
-      req_param->req_handler = req_handler;
-      
-      if (xTaskCreate(IPMI_handler_task ,(const char*)"IPMB_handler_task", configMINIMAL_STACK_SIZE*2, req_param, IPMI_HANDLER_TASK_PRIORITY,  (TaskHandle_t *) NULL ) == pdFALSE ){
-	  /* TODO: handle this problem */
+    req = ipmi_next_pending();
+    if (req != NULL){
+      ipmi_dispatch( req );
+    }
+  }
+}
+
+/**
+ * @brief Finds the requester slot of a source address. A new address
+ * gets the slot heard from the longest ago, with a full bucket,
+ * preferably one with no request waiting.
+ *
+ * @param addr Source address of the request
+ * @param now Current tick
+ *
+ * @return Index of the slot
+ */
+static uint8_t ipmi_requester_slot ( uint8_t addr, TickType_t now )
+{
+  uint8_t i;
+  uint8_t lru = 0;
+
+  for ( i = 0; i < IPMI_REQUESTERS; i++ ){
+    if ( ipmi_requesters[i].used && (ipmi_requesters[i].addr == addr) ){
+      return i;
+    }
+    if ( !ipmi_requesters[i].used ){
+      lru = i;
+      break;
+    }
+    if ( ( (ipmi_requesters[i].pending == 0) && (ipmi_requesters[lru].pending != 0) ) ||
+         ( ( (ipmi_requesters[i].pending == 0) == (ipmi_requesters[lru].pending == 0) ) &&
+           ( (TickType_t)(now - ipmi_requesters[i].last) > (TickType_t)(now - ipmi_requesters[lru].last) ) ) ){
+      lru = i;
+    }
+  }
+
+  /* Not found, the address takes over the slot (its waiting requests
+     now take turns with the new ones) */
+  ipmi_requesters[lru].used = 1;
+  ipmi_requesters[lru].addr = addr;
+  ipmi_requesters[lru].credit = IPMI_REQUESTER_CREDIT_MAX;
+  ipmi_requesters[lru].last = now;
+  return lru;
+}
+
+/**
+ * @brief Takes in a request received from IPMB. It's answered
+ * NODE_BUSY at once if its requester is over its rate
+ * (#IPMI_REQUESTER_RATE, token bucket of #IPMI_REQUESTER_BURST
+ * requests), otherwise it waits for its turn (ipmi_next_pending()).
+ *
+ * @param req Request from the IPMB receive pool
+ */
+static void ipmi_admit ( ipmi_msg * req )
+{
+  TickType_t now = xTaskGetTickCount();
+  struct requester * requester;
+  TickType_t elapsed;
+  uint8_t slot;
+
+  if (req->netfn & 0x01){
+    /* Responses are not handled by the dispatcher */
+    ipmb_release_msg( req );
+    return;
+  }
+
+  slot = ipmi_requester_slot( req->src_addr, now );
+  requester = &ipmi_requesters[slot];
+
+  /* Credit in 1/configTICK_RATE_HZ of a request, refilled by
+     IPMI_REQUESTER_RATE per tick */
+  elapsed = now - requester->last;
+  requester->last = now;
+  if ( elapsed >= IPMI_REQUESTER_CREDIT_MAX / IPMI_REQUESTER_RATE ){
+    requester->credit = IPMI_REQUESTER_CREDIT_MAX;
+  }else{
+    requester->credit += elapsed * IPMI_REQUESTER_RATE;
+    if ( requester->credit > IPMI_REQUESTER_CREDIT_MAX ){
+      requester->credit = IPMI_REQUESTER_CREDIT_MAX;
+    }
+  }
+
+  /* The MCH drives the hot swap and is never held back */
+  if ( req->src_addr != MCH_ADDRESS ){
+    if ( requester->credit < configTICK_RATE_HZ ){
+      IPMB_STAT_INC( IPMB_STAT_RATE_LIMITED );
+      ipmi_send_completion_code( req, IPMI_CC_NODE_BUSY );
+      return;
+    }
+    requester->credit -= configTICK_RATE_HZ;
+  }
+
+  /* Can't be full, there are no more requests than IPMB receive frames */
+  if ( ipmi_pending_count == IPMI_PENDING_LEN ){
+    ipmi_send_completion_code( req, IPMI_CC_NODE_BUSY );
+    return;
+  }
+  ipmi_pending[ipmi_pending_count].req = req;
+  ipmi_pending[ipmi_pending_count].requester = slot;
+  ipmi_pending_count++;
+  requester->pending++;
+}
+
+/**
+ * @brief Takes the oldest waiting request of the next requester, after
+ * the one served last, that has any. Requests to LUN 0 (the management
+ * commands) all go before the ones to the other LUNs.
+ *
+ * @return The request, NULL if none is waiting
+ */
+static ipmi_msg * ipmi_next_pending ( void )
+{
+  uint8_t any_lun;
+  uint8_t i;
+  uint8_t j;
+  uint8_t slot;
+  ipmi_msg * req;
+
+  for ( any_lun = 0; any_lun < 2; any_lun++ ){
+    for ( i = 1; i <= IPMI_REQUESTERS; i++ ){
+      slot = (ipmi_last_served + i) % IPMI_REQUESTERS;
+      if ( ipmi_requesters[slot].pending == 0 ){
+        continue;
       }
-      
-    }else{
-      ipmb_error error_code;
-      ipmi_msg response;
-      /* If there is no function handler, use data from received
-	 message to send "invalid command" response (IPMI table 5-2,
-	 page 44). */
 
-      response.completion_code = IPMI_CC_INV_CMD;
-      response.data_len = 0;
-      error_code = ipmb_send_response(&req_received, &response);
+      for ( j = 0; j < ipmi_pending_count; j++ ){
+        if ( (ipmi_pending[j].requester == slot) && (any_lun || (ipmi_pending[j].req->dest_LUN == 0)) ){
+          req = ipmi_pending[j].req;
+          ipmi_pending_count--;
+          memmove( &ipmi_pending[j], &ipmi_pending[j + 1], (ipmi_pending_count - j) * sizeof(ipmi_pending[0]) );
+          ipmi_requesters[slot].pending--;
+          ipmi_last_served = slot;
+          return req;
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Runs the handler of a request, or hands it to a worker.
+ *
+ * The received request pointer and handler function are passed to the
+ * work queue, where one of the worker tasks will pick them up, the slow
+ * handlers to the queue of the slow workers so they never take the
+ * workers of the quick ones.
+ * Handlers flagged as inline are run right here instead. Whoever sends
+ * the response gives the request back to the IPMB pool.
+ *
+ * @param req Request taken in by ipmi_admit()
+ */
+static void ipmi_dispatch ( ipmi_msg * req )
+{
+  struct req_param_struct req_param;
+  const t_req_handler_record * record;
+  QueueHandle_t workqueue;
+
+  req_param.req_received = req;
+  ipmb_stamp( req_param.req_received, IPMB_STAMP_DISPATCH );
+  KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_QUEUE, ipmb_corr( req ) );
+
+  record = ipmi_retrieve_handler(req->dest_LUN, req_param.req_received->netfn, req_param.req_received->cmd);
 
-      configASSERT(error_code);
+  if (record != 0){
+    req_param.req_handler = record->req_handler;
+    workqueue = (record->flags & IPMI_HANDLER_SLOW) ? ipmi_slow_workqueue : ipmi_workqueue;
+    req_param.secondary = (req->dest_LUN != 0) && (workqueue == ipmi_workqueue);
+
+    if ( !init_ready( (record->flags & IPMI_HANDLER_NEEDS_MASK) >> IPMI_HANDLER_NEEDS_SHIFT ) ){
+      /* Its data isn't there yet (staged start up, see init_stage.h) */
+      ipmi_send_completion_code( req_param.req_received, IPMI_CC_NODE_BUSY );
+
+    }else if (record->flags & IPMI_HANDLER_INLINE){
+      ipmi_run_inline( req_param.req_received, record );
+
+    }else if ( ( uxQueueMessagesWaiting( workqueue ) > 0 ) &&
+               ( ipmb_request_budget( req_param.req_received ) < IPMI_HANDLER_MIN_BUDGET ) ){
+      /* Waited too long already and every worker is busy, it would
+         only be picked up once it's too late to answer */
+      ipmi_send_completion_code( req_param.req_received, IPMI_CC_NODE_BUSY );
+
+    }else if ( req_param.secondary && (ipmi_secondary_busy >= IPMI_SECONDARY_LUN_WORKERS) ){
+      /* The other workers are kept for LUN 0, whatever the load on
+         the other LUNs */
+      ipmi_send_completion_code( req_param.req_received, IPMI_CC_NODE_BUSY );
+
+    }else{
+      if ( req_param.secondary ){
+        taskENTER_CRITICAL();
+        ipmi_secondary_busy++;
+        taskEXIT_CRITICAL();
+      }
+      if (xQueueSend( workqueue, &req_param, 0 ) != pdTRUE){
+        /* All workers are busy and the work queue is full, tell the
+           requester to try again later instead of waiting here */
+        if ( req_param.secondary ){
+          taskENTER_CRITICAL();
+          ipmi_secondary_busy--;
+          taskEXIT_CRITICAL();
+        }
+        ipmi_send_completion_code( req_param.req_received, IPMI_CC_NODE_BUSY );
+      }
     }
+
+  }else{
+    /* If there is no function handler, use data from received
+       message to send "invalid command" response (IPMI table 5-2,
+       page 44). */
+    ipmi_send_completion_code( req_param.req_received, IPMI_CC_INV_CMD );
   }
 }
 
+/**
+ * @brief Runs a trivial handler in the dispatcher context and queues
+ * its response, avoiding the hand-off to a worker task.
+ *
+ * The response of a handler flagged with #IPMI_HANDLER_CACHE is
+ * copied from the cache instead when the same request was answered
+ * since its subsystem last changed.
+ *
+ * @param req Request to be handled
+ * @param record Handler flagged with #IPMI_HANDLER_INLINE
+ */
+static void ipmi_run_inline ( ipmi_msg * req, const t_req_handler_record * record )
+{
+  /* Built straight into its TX frame, never waits for one */
+  ipmi_msg * response = ipmb_response_alloc( req, 0 );
+  uint8_t cache = (record->flags & IPMI_HANDLER_CACHE_MASK) >> IPMI_HANDLER_CACHE_SHIFT;
+  uint32_t tag;
 
-/** 
- * This task is created dynamically each time there is an IPMI request
- * demanding response. It receives a pointer to a struct contaning
- * both the function handler and the request to treated, and must free
- * this struct memory and itself before finishing.
- * 
- * @param pvParameters pointer to req_param_struct contaning
- * req_handler and req_received. This is dynamically allocated memory
- * and should be freed before quitting.
+  if ( response == NULL ){
+    ipmb_release_msg(req);
+    return;
+  }
+
+  if ( cache && ipmi_cache_lookup( req, cache - 1, response, &tag ) ){
+    ipmb_response_queue(response);
+    ipmb_release_msg(req);
+    return;
+  }
+
+  response->completion_code = IPMI_CC_OUT_OF_SPACE;
+  ipmb_stamp( req, IPMB_STAMP_HANDLER );
+  /* The I2C transfers of the handler are tagged with the request too */
+  KERNEL_TRACE_CORR_SET( ipmb_corr( req ) );
+  KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_HANDLER, ipmb_corr( req ) );
+  {
+    PROF_SCOPE( PROF_IPMI_HANDLER );
+    record->req_handler(req, response);
+  }
+  KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_HANDLER, ipmb_corr( req ) );
+  KERNEL_TRACE_CORR_SET( 0 );
+
+  if ( cache ){
+    ipmi_cache_store( req, cache - 1, tag, response );
+  }
+
+  ipmb_response_queue(response);
+  ipmb_release_msg(req);
+}
+
+/**
+ * @brief Sends a response with no data, only the given completion code.
+ *
+ * The request is given back to the IPMB receive pool afterwards.
+ *
+ * @param req Request being answered
+ * @param completion_code Completion code to be sent
+ */
+void ipmi_send_completion_code ( ipmi_msg * req, uint8_t completion_code )
+{
+  /* Called from the dispatcher, don't wait for a frame nor for the transmission */
+  ipmi_msg * response = ipmb_response_alloc( req, 0 );
+
+  if ( response != NULL ){
+    response->completion_code = completion_code;
+    ipmb_response_queue(response);
+  }
+  ipmb_release_msg(req);
+}
+
+/**
+ * One of the #IPMI_HANDLER_WORKERS or #IPMI_SLOW_HANDLER_WORKERS tasks
+ * created by ipmi_init(). Each worker blocks on the work queue of its
+ * class, runs the handler of the request it receives and sends its
+ * response, so no task or memory has to be allocated per request.
+ *
+ * @param pvParameters Work queue the worker serves.
  */
 void IPMI_handler_task( void * pvParameters){
-  struct req_param_struct * req_param = (struct req_param_struct *) pvParameters;
-  ipmi_msg response;
-  ipmb_error response_error;
+  QueueHandle_t workqueue = (QueueHandle_t) pvParameters;
+  struct req_param_struct req_param;
+  ipmb_completion response_done;
+  ipmb_error init_error;
+  watchdog_id wdg = watchdog_register( (workqueue == ipmi_slow_workqueue) ? "IPMI Slow" : "IPMI Worker",
+                                       WATCHDOG_DEADLINE );
 
-  ipmi_msg * test1 = &req_param->req_received;
+  /* Signalled by the IPMB TX task as soon as each response is on the wire */
+  init_error = ipmb_completion_init( &response_done );
+  configASSERT( init_error == ipmb_error_success );
+  (void) init_error;
 
-  response.completion_code = IPMI_CC_OUT_OF_SPACE;
-  response.data_len = 0;
-  /* Call user-defined function, give request data and retrieve required response */
-  req_param->req_handler(&(req_param->req_received), &response);
+  for ( ;; ){
+    watchdog_checkin( wdg );
+    if ( xQueueReceive( workqueue, &req_param, WATCHDOG_BLOCK_TIME ) != pdTRUE ){
+      continue;
+    }
+
+    ipmi_worker_run( &req_param, &response_done );
+    if ( req_param.secondary ){
+      taskENTER_CRITICAL();
+      ipmi_secondary_busy--;
+      taskEXIT_CRITICAL();
+    }
+  }
+}
+
+/**
+ * @brief Runs the handler of a request taken from the work queue and
+ * sends its response.
+ *
+ * @param req_param Work item, the request goes back to the IPMB pool
+ * @param done Completion object of the worker
+ */
+static void ipmi_worker_run ( struct req_param_struct * req_param, ipmb_completion * done )
+{
+  ipmi_msg * response;
+
+  if ( ipmb_request_budget( req_param->req_received ) < IPMI_HANDLER_MIN_BUDGET ){
+    /* Queued behind slower requests, answer right away instead of
+       running a handler whose response would be dropped */
+    ipmi_send_completion_code( req_param->req_received, IPMI_CC_NODE_BUSY );
+    return;
+  }
 
-  response_error = ipmb_send_response(&(req_param->req_received), &response);
+  /* The handler writes the response straight into its TX frame, with the header already filled in */
+  response = ipmb_response_alloc( req_param->req_received, IPMB_MSG_TIMEOUT );
+  if ( response == NULL ){
+    /* Every frame is still on its way out, the requester will retry */
+    ipmb_release_msg(req_param->req_received);
+    return;
+  }
+  response->completion_code = IPMI_CC_OUT_OF_SPACE;
+  ipmb_stamp( req_param->req_received, IPMB_STAMP_HANDLER );
+  KERNEL_TRACE_CORR_SET( ipmb_corr( req_param->req_received ) );
+  KERNEL_TRACE_SPAN_START( KERNEL_TRACE_SPAN_HANDLER, ipmb_corr( req_param->req_received ) );
+  /* Call user-defined function, give request data and retrieve required response */
+  {
+    PROF_SCOPE( PROF_IPMI_HANDLER );
+    req_param->req_handler(req_param->req_received, response);
+  }
+  KERNEL_TRACE_SPAN_STOP( KERNEL_TRACE_SPAN_HANDLER, ipmb_corr( req_param->req_received ) );
+  KERNEL_TRACE_CORR_SET( 0 );
 
-  /* In case of error during IPMB response, the MMC may wait for a
-     new command from the MCH. Check this for debugging purposes
-     only. */
-  configASSERT(response_error==ipmb_error_success);
+  /* A response that couldn't be sent is in the IPMB statistics, the
+     requester retries the request */
+  ipmb_response_send(response, done);
+  ipmb_release_msg(req_param->req_received);
+}
 
-  vPortFree(req_param);
+uint8_t ipmi_defer ( ipmi_deferred_fn fn, void * ctx, uint32_t arg )
+{
+  struct deferred_work work = { fn, ctx, arg };
 
-  vTaskDelete(NULL);
+  if (ipmi_deferqueue == NULL){
+    return 0;
+  }
+  return xQueueSend( ipmi_deferqueue, &work, 0 ) == pdTRUE;
 }
 
 /* Initializes the IPMI Dispatcher:
+ * -> Indexes the registered command handlers
  * -> Initializes the IPMB Layer
  * -> Registers the RX queue for incoming requests
+ * -> Creates the deferred work queue and the queue set of the dispatcher
+ * -> Creates the work queues and the pools of handler tasks, quick and slow
  * -> Creates the IPMI task
  */
 void ipmi_init ( void )
 {
+    uint8_t i;
+
+    ipmi_build_handler_index();
     ipmb_init();
+    /* Sensor events go out through IPMB */
+    event_init();
+    telemetry_init();
+    /* Wall clock, synchronized from the MCH */
+    wallclock_init();
+    /* Self tests and load generators, idle until started */
+    selftest_init();
     ipmb_register_rxqueue( &ipmi_rxqueue );
-    xTaskCreate( IPMITask, (const char*)"IPMI Dispatcher", configMINIMAL_STACK_SIZE*2, ( void * ) NULL, IPMI_TASK_PRIORITY, ( TaskHandle_t * ) NULL );
-}
-
-
-/** 
- * @brief Finds a handler associated with a given netfunction and command.
- * 
- * @param netfn 8-bit network function code
- * @param cmd 8-bit command code
- * 
- * @return Pointer to the function which will handle this command, as defined in the netfn handler list.
- */
-t_req_handler ipmi_retrieve_handler(uint8_t netfn, uint8_t cmd){
-  uint8_t cur_handler;
-  t_req_handler handler = 0;
 
-  for(cur_handler = 0; cur_handler < MAX_HANDLERS; cur_handler++)
-    {
+    /* Both queues are still empty, the scheduler isn't running yet */
+    ipmi_deferqueue = xQueueCreate( IPMI_DEFER_QUEUE_LEN, sizeof(struct deferred_work) );
+    queue_stats_register( ipmi_deferqueue, "IPMI_DEFER" );
+    ipmi_queue_set = xQueueCreateSet( IPMB_CLIENT_QUEUE_LEN + IPMI_DEFER_QUEUE_LEN );
+    xQueueAddToSet( ipmi_rxqueue, ipmi_queue_set );
+    xQueueAddToSet( ipmi_deferqueue, ipmi_queue_set );
 
-      if( (handlers[cur_handler].netfn == netfn) && \
-	  (handlers[cur_handler].cmd == cmd))
-	{
-	  handler = handlers[cur_handler].req_handler;
-	  break;
-	}
+    ipmi_workqueue = xQueueCreate( IPMI_WORKQUEUE_LEN, sizeof(struct req_param_struct) );
+    queue_stats_register( ipmi_workqueue, "IPMI_WORKQUEUE" );
+    for ( i = 0; i < IPMI_HANDLER_WORKERS; i++ ) {
+        xTaskCreateWithStack( IPMI_handler_task, (const char*)"IPMI Worker", IPMI_HANDLER_STACK_DEPTH, ( void * ) ipmi_workqueue, IPMI_HANDLER_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( ipmi_worker_stack, i ) );
+    }
+    ipmi_slow_workqueue = xQueueCreate( IPMI_SLOW_WORKQUEUE_LEN, sizeof(struct req_param_struct) );
+    queue_stats_register( ipmi_slow_workqueue, "IPMI_SLOWQUEUE" );
+    for ( i = 0; i < IPMI_SLOW_HANDLER_WORKERS; i++ ) {
+        xTaskCreateWithStack( IPMI_handler_task, (const char*)"IPMI Slow", IPMI_SLOW_HANDLER_STACK_DEPTH, ( void * ) ipmi_slow_workqueue, IPMI_SLOW_HANDLER_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( ipmi_slow_worker_stack, i ) );
     }
 
-  return handler;
+    xTaskCreateWithStack( IPMITask, (const char*)"IPMI Dispatcher", IPMI_TASK_STACK_DEPTH, ( void * ) NULL, IPMI_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( ipmi_dispatcher_stack, 0 ) );
 }
 
+
+IPMI_HANDLER_FLAGS(NETFN_APP, IPMI_GET_DEVICE_ID_CMD, ipmi_app_get_device_id, IPMI_HANDLER_INLINE | IPMI_HANDLER_CACHE(IPMI_CACHE_STATIC));
+
+/* Whole Get Device ID response, built by the compiler (device_id.h) */
+static const device_id_rsp device_id = DEVICE_ID_RSP;
+
 /** 
  * Handler for GET Device ID command as in IPMI v2.0 section 20.1 for
- * more information.
+ * more information. The response is the constant #device_id.
  * 
  * @param req pointer to request message
  *
@@ -198,30 +593,13 @@ t_req_handler ipmi_retrieve_handler(uint8_t netfn, uint8_t cmd){
  * @return 
  */
 void ipmi_app_get_device_id ( ipmi_msg *req, ipmi_msg * rsp ){
-  int len = rsp->data_len = 0;
-
+  memcpy( rsp->data, &device_id, sizeof(device_id) );
+  rsp->data_len = sizeof(device_id);
   rsp->completion_code = IPMI_CC_OK;
-
-
-  /** \todo: several bits of hardcoded information. Organize it so it
-      makes more sense and is easier to modify. */
-  
-  rsp->data[len++] = 0x0A; /* Dev ID */
-  rsp->data[len++] = 0x02; /* Dev Rev */
-  rsp->data[len++] = 0x05; /* Dev FW Rev UPPER */
-  rsp->data[len++] = 0x50; /* Dev FW Rev LOWER */
-  rsp->data[len++] = 0x02; /* IPMI Version 2.0 */
-  rsp->data[len++] = 0x1F; /* Dev Support */
-  rsp->data[len++] = 0x5A; /* Manufacturer ID LSB */
-  rsp->data[len++] = 0x31; /* Manufacturer ID MSB */
-  rsp->data[len++] = 0x00; /* ID MSB */
-  rsp->data[len++] = 0x01; /* Product ID LSB */
-  rsp->data[len++] = 0x01; /* Product ID MSB */
-
-  rsp->data_len = len;
-
 }
 
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_GET_PROPERTIES, ipmi_picmg_get_properties, IPMI_HANDLER_INLINE | IPMI_HANDLER_CACHE(IPMI_CACHE_STATIC));
+
 /** @fn ipmi_msg ipmi_picmg_get_properties(ipmi_msg * request, ipmi_msg * response)
  * 
  * @brief handler for GET Properties request. To be called by IPMI
@@ -246,6 +624,8 @@ void ipmi_picmg_get_properties ( ipmi_msg *req, ipmi_msg *rsp )
     rsp->data_len = len;
 }
 
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_SET_EVENT_RECEIVER_CMD, ipmi_se_set_receiver, IPMI_HANDLER_INLINE);
+
 /** 
  * @brief Handler for "Set Event Receiver" command, as on IPMIv2 1.1
  * section 29.1.
@@ -253,39 +633,2541 @@ void ipmi_picmg_get_properties ( ipmi_msg *req, ipmi_msg *rsp )
  * This handler should set (or reset) the address to which IPMI events
  * will be sent. Also, disable sending events if command 0xFF is received.
  * 
+ * Request data: [0] receiver slave address, [1] receiver LUN (bits 1:0).
+ *
  * @param req Incoming request to be handled and answered.
  * 
  * @return ipmi_msg response with data, data_lenght and completion
  * code. Other fields will be completed by the system.
  */
 void ipmi_se_set_receiver ( ipmi_msg *req, ipmi_msg *rsp){
-    
-  /** \todo: actually enable/disable sending events*/
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 2 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  event_set_receiver( req->data[0], req->data[1] & 0x03 );
+  rsp->completion_code = IPMI_CC_OK;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_GET_EVENT_RECEIVER_CMD, ipmi_se_get_receiver, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Get Event Receiver" command, as on IPMIv2 1.1
+ * section 29.2.
+ *
+ * Response data: [0] receiver slave address (0xFF if the events are
+ * disabled), [1] receiver LUN.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_get_receiver ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint8_t addr;
+  uint8_t lun;
+  uint8_t len = 0;
+
+  event_get_receiver( &addr, &lun );
+
   rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = addr;
+  rsp->data[len++] = lun;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_GET_SENSOR_READING_CMD, ipmi_se_get_sensor_reading, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for "Get Sensor Reading" command, as on IPMIv2 1.1
+ * section 35.14.
+ *
+ * Answered from the sensor store (see sensor_get_reading()), without
+ * any I2C traffic. The sensor number is the index in the board sensor
+ * table. A reading that failed or is older than #SENSOR_STALE_PERIODS
+ * periods is flagged as unavailable. The threshold comparison status
+ * is the one of the last good reading. The FRU Hot Swap sensor gives
+ * the current M-state, bit n for Mn.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_get_sensor_reading ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  sensor_reading reading;
+  uint8_t len = 0;
+
   rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( req->data[0] == SENSOR_HOT_SWAP ) {
+    rsp->completion_code = IPMI_CC_OK;
+    rsp->data[len++] = 0;
+    rsp->data[len++] = IPMI_SENSOR_EVENT_MSGS_ENABLED | IPMI_SENSOR_SCANNING_ENABLED;
+    rsp->data[len++] = 1 << hotswap_get_state();
+    rsp->data_len = len;
+    return;
+  }
+
+  if ( !sensor_get_reading( req->data[0], &reading ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+  /* Teaches the poller when this sensor is asked for */
+  sensor_note_request( req->data[0], &reading );
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = reading.value & 0xFF;
+  rsp->data[len++] = ipmi_sensor_status( req->data[0], &reading );
+  rsp->data[len++] = threshold_state( req->data[0] );
+  rsp->data_len = len;
 }
 
+/* Byte 2 of the Get Sensor Reading response */
+static uint8_t ipmi_sensor_status ( uint8_t sensor, const sensor_reading * reading )
+{
+  return IPMI_SENSOR_EVENT_MSGS_ENABLED | IPMI_SENSOR_SCANNING_ENABLED |
+    ( sensor_reading_stale( sensor, reading ) ? IPMI_SENSOR_READING_UNAVAILABLE : 0 );
+}
 
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_SET_SENSOR_HYSTERESIS_CMD, ipmi_se_set_sensor_hysteresis, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
 
-/** @fn ipmi_msg ipmi_picmg_set_led(ipmi_msg * request, ipmi_msg * response)
- * 
- * @brief handler for "Set FRU LED State"" request. Check IPMI 2.0
- * table 3-31 for more information.
+/**
+ * @brief Handler for "Set Sensor Hysteresis" command, as on IPMIv2 1.1
+ * section 35.6.
  *
- * @param[in] request Request to be handled and answered. Contains
- * which LED should be set, how it should be set and other commands.
+ * Request data: [0] sensor number, [1] reserved (0xFF), [2] positive
+ * going hysteresis, [3] negative going hysteresis, both raw.
  *
- * @return ipmi_msg Response to be sent, must have data, data length
- * and completion code members filled.
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
  */
-void ipmi_picmg_set_led ( ipmi_msg *req, ipmi_msg *rsp )
+void ipmi_se_set_sensor_hysteresis ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  rsp->data_len = 0;
+
+  if ( req->data_len < 4 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( req->data[0] >= sensor_count() ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  if ( !threshold_set_hysteresis( req->data[0], req->data[2], req->data[3] ) ) {
+    rsp->completion_code = IPMI_CC_ILL_SENSOR_OR_RECORD;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_GET_SENSOR_HYSTERESIS_CMD, ipmi_se_get_sensor_hysteresis, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for "Get Sensor Hysteresis" command, as on IPMIv2 1.1
+ * section 35.7.
+ *
+ * Request data: [0] sensor number, [1] reserved (0xFF).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_get_sensor_hysteresis ( ipmi_msg *req, ipmi_msg *rsp )
 {
-  /* TODO: actually implement set led funtion */
+  uint8_t pos;
+  uint8_t neg;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( !threshold_get_hysteresis( req->data[0], &pos, &neg ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
 
   rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = pos;
+  rsp->data[len++] = neg;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_SET_SENSOR_THRESHOLD_CMD, ipmi_se_set_sensor_threshold, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
 
+/**
+ * @brief Handler for "Set Sensor Thresholds" command, as on IPMIv2 1.1
+ * section 35.8.
+ *
+ * Request data: [0] sensor number, [1] mask of the thresholds to set,
+ * [2..7] lower non-critical, lower critical, lower non-recoverable,
+ * upper non-critical, upper critical and upper non-recoverable, raw.
+ * The new levels are used from the next reading on.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_set_sensor_threshold ( ipmi_msg *req, ipmi_msg *rsp )
+{
   rsp->data_len = 0;
-  rsp->data[rsp->data_len++] = IPMI_PICMG_GRP_EXT;
 
+  if ( req->data_len < 2 + THRESHOLD_COUNT ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( req->data[0] >= sensor_count() ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  if ( req->data[1] & ~THRESHOLD_ALL ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  if ( !threshold_set( req->data[0], req->data[1], &req->data[2] ) ) {
+    rsp->completion_code = IPMI_CC_ILL_SENSOR_OR_RECORD;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_GET_SENSOR_THRESHOLD_CMD, ipmi_se_get_sensor_threshold, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for "Get Sensor Thresholds" command, as on IPMIv2 1.1
+ * section 35.9.
+ *
+ * Request data: [0] sensor number.
+ * Response data: [0] readable threshold mask, [1..6] thresholds in the
+ * order of Set Sensor Thresholds (0 when not readable).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_get_sensor_threshold ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( req->data[0] >= sensor_count() ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = threshold_get( req->data[0], &rsp->data[1] );
+  rsp->data_len = 1 + THRESHOLD_COUNT;
+}
+
+
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_GET_DEVICE_SDR_INFO_CMD, ipmi_se_get_device_sdr_info, IPMI_HANDLER_INLINE | IPMI_HANDLER_CACHE(IPMI_CACHE_STATIC));
+
+/**
+ * @brief Handler for "Get Device SDR Info" command, as on IPMIv2 1.1
+ * section 35.2.
+ *
+ * Request data: [0] (optional) bit 0 set to get the number of records
+ * instead of the number of sensors.
+ * The repository is static, so no population change indicator is sent.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_get_device_sdr_info ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint8_t len = 0;
+
+  rsp->completion_code = IPMI_CC_OK;
+  if ( ( req->data_len > 0 ) && ( req->data[0] & 0x01 ) ) {
+    rsp->data[len++] = sdr_count();
+  } else {
+    rsp->data[len++] = sdr_sensor_count();
+  }
+  /* Static sensor population, sensors on LUN 0 only */
+  rsp->data[len++] = 0x01;
+  rsp->data_len = len;
 }
 
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_GET_DEVICE_SDR_CMD, ipmi_se_get_device_sdr, IPMI_HANDLER_INLINE | IPMI_HANDLER_CACHE(IPMI_CACHE_SDR));
+
+/**
+ * @brief Handler for "Get Device SDR" command, as on IPMIv2 1.1
+ * section 35.3.
+ *
+ * Request data: [0-1] reservation ID, [2-3] record ID, [4] offset into
+ * the record, [5] bytes to read (#IPMI_SDR_READ_ALL for the whole record).
+ * Response data: [0-1] next record ID (#SDR_RECORD_LAST after the last
+ * one), then the record bytes. Partial reads (offset other than 0) need
+ * a valid reservation; a whole record that doesn't fit in one response
+ * is answered with #IPMI_CC_CANT_RET_NUM_REQ_BYTES, so the requester
+ * falls back to partial reads.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_get_device_sdr ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t reservation;
+  uint16_t record_id;
+  uint16_t next;
+  uint8_t offset;
+  uint8_t count;
+  uint8_t rec_len;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 6 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  reservation = req->data[0] | ( req->data[1] << 8 );
+  record_id = req->data[2] | ( req->data[3] << 8 );
+  offset = req->data[4];
+  count = req->data[5];
+
+  if ( ( offset != 0 ) && !sdr_reservation_valid( reservation ) ) {
+    rsp->completion_code = IPMI_CC_RES_CANCELED;
+    return;
+  }
+
+  if ( record_id == SDR_RECORD_LAST ) {
+    record_id = sdr_count() - 1;
+  }
+
+  /* Resumes the previous chunk when this one follows it */
+  rec_len = sdr_locate( reservation, record_id, offset, &next );
+  if ( ( rec_len == 0 ) || ( offset >= rec_len ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  if ( ( count == IPMI_SDR_READ_ALL ) || ( count > rec_len - offset ) ) {
+    count = rec_len - offset;
+  }
+  if ( count > IPMI_SDR_MAX_READ ) {
+    rsp->completion_code = IPMI_CC_CANT_RET_NUM_REQ_BYTES;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = next & 0xFF;
+  rsp->data[len++] = next >> 8;
+  sdr_read( record_id, offset, &rsp->data[len], count );
+  len += count;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_SE, IPMI_RESERVE_DEVICE_SDR_REPOSITORY_CMD, ipmi_se_reserve_device_sdr, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Reserve Device SDR Repository" command, as on
+ * IPMIv2 1.1 section 35.4. The new reservation cancels the previous one.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_se_reserve_device_sdr ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t reservation = sdr_reserve();
+  uint8_t len = 0;
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = reservation & 0xFF;
+  rsp->data[len++] = reservation >> 8;
+  rsp->data_len = len;
+}
+
+
+
+IPMI_HANDLER_FLAGS(NETFN_STORAGE, IPMI_GET_FRU_INVENTORY_AREA_INFO_CMD, ipmi_storage_get_fru_info, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_FRU)) | IPMI_HANDLER_CACHE(IPMI_CACHE_STATIC));
+
+/**
+ * @brief Handler for "Get FRU Inventory Area Info" command, as on
+ * IPMIv2 1.1 section 34.1.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_storage_get_fru_info ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t size = fru_size();
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( req->data[0] != FRU_DEVICE_ID ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = size & 0xFF;
+  rsp->data[len++] = size >> 8;
+  /* Accessed by bytes */
+  rsp->data[len++] = 0x00;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_STORAGE, IPMI_READ_FRU_DATA_CMD, ipmi_storage_read_fru_data, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_FRU)) | IPMI_HANDLER_CACHE(IPMI_CACHE_FRU));
+
+/**
+ * @brief Handler for "Read FRU Data" command, as on IPMIv2 1.1
+ * section 34.2. Served from the RAM copy of the inventory (see
+ * fru_read()), never from the EEPROM.
+ *
+ * Request data: [0] FRU device ID, [1-2] offset, [3] count (cut to
+ * #IPMI_FRU_MAX_READ). Response data: [0] count returned, then the data.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_storage_read_fru_data ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t offset;
+  uint8_t count;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 4 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( req->data[0] != FRU_DEVICE_ID ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+  if ( fru_get_source() == FRU_SOURCE_LOADING ) {
+    rsp->completion_code = IPMI_CC_NODE_BUSY;
+    return;
+  }
+
+  offset = req->data[1] | ( req->data[2] << 8 );
+  count = req->data[3];
+  if ( count > IPMI_FRU_MAX_READ ) {
+    count = IPMI_FRU_MAX_READ;
+  }
+
+  count = fru_read( offset, &rsp->data[1], count );
+  if ( count == 0 ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = count;
+  rsp->data_len = count + 1;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_STORAGE, IPMI_WRITE_FRU_DATA_CMD, ipmi_storage_write_fru_data, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_FRU)));
+
+/**
+ * @brief Handler for "Write FRU Data" command, as on IPMIv2 1.1
+ * section 34.3. Only the RAM copy is changed here, the EEPROM is
+ * written behind (see fru_write()).
+ *
+ * Request data: [0] FRU device ID, [1-2] offset, [3..] data.
+ * Response data: [0] count written.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_storage_write_fru_data ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t offset;
+  uint8_t count;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 4 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( req->data[0] != FRU_DEVICE_ID ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+  if ( fru_get_source() == FRU_SOURCE_LOADING ) {
+    rsp->completion_code = IPMI_CC_NODE_BUSY;
+    return;
+  }
+
+  offset = req->data[1] | ( req->data[2] << 8 );
+  count = fru_write( offset, &req->data[3], req->data_len - 3 );
+  if ( count == 0 ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = count;
+  rsp->data_len = 1;
+}
+
+/* Checks the PICMG identifier and FRU device ID the PICMG FRU commands start with */
+static uint8_t ipmi_picmg_fru_check ( ipmi_msg *req, ipmi_msg *rsp, uint8_t len )
+{
+  rsp->data_len = 0;
+  rsp->data[rsp->data_len++] = IPMI_PICMG_GRP_EXT;
+
+  if ( req->data_len < len ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return 0;
+  }
+  if ( ( req->data[0] != IPMI_PICMG_GRP_EXT ) || ( req->data[1] != FRU_DEVICE_ID ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return 0;
+  }
+  rsp->completion_code = IPMI_CC_OK;
+  return 1;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_FRU_CONTROL, ipmi_picmg_fru_control, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "FRU Control", as on PICMG 3.0 table 3-25. Only
+ * the mandatory cold reset is supported, it's run by the hot swap
+ * state machine (in M4 only).
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID, [2] FRU control option.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_fru_control ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_fru_check( req, rsp, 3 ) ) {
+    return;
+  }
+
+  if ( req->data[2] != IPMI_PICMG_FRU_CONTROL_COLD_RESET ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+  if ( !hotswap_post( HOTSWAP_EVT_COLD_RESET ) ) {
+    rsp->completion_code = IPMI_CC_NODE_BUSY;
+  }
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_FRU_CONTROL_CAPABILITIES, ipmi_picmg_fru_control_caps, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "FRU Control Capabilities", as on PICMG 3.0
+ * table 3-26.
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID.
+ * Response data: [0] PICMG ID, [1] FRU control capabilities (none
+ * beyond the cold reset).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_fru_control_caps ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_fru_check( req, rsp, 2 ) ) {
+    return;
+  }
+
+  rsp->data[rsp->data_len++] = 0;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_SET_FRU_ACTIVATION, ipmi_picmg_set_fru_activation, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Set FRU Activation", as on PICMG 3.0 table 3-23.
+ * The request is handed to the hot swap state machine, which ignores
+ * it in the states it doesn't apply to.
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID, [2] 0 to deactivate,
+ * 1 to activate.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_set_fru_activation ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_fru_check( req, rsp, 3 ) ) {
+    return;
+  }
+
+  if ( req->data[2] > IPMI_PICMG_FRU_ACTIVATE ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+  if ( !hotswap_post( req->data[2] == IPMI_PICMG_FRU_ACTIVATE ? HOTSWAP_EVT_ACTIVATE : HOTSWAP_EVT_DEACTIVATE ) ) {
+    rsp->completion_code = IPMI_CC_NODE_BUSY;
+  }
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_GET_FRU_LED_PROPERTIES, ipmi_picmg_get_led_properties, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Get FRU LED Properties", as on PICMG 3.0
+ * table 3-29.
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID.
+ * Response data: [0] PICMG ID, [1] general status LEDs (bit n for
+ * LED n), [2] number of application specific LEDs.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_get_led_properties ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_fru_check( req, rsp, 2 ) ) {
+    return;
+  }
+
+  /* Blue LED, LED1 and LED2, no application specific ones */
+  rsp->data[rsp->data_len++] = ( 1 << LED_COUNT ) - 1;
+  rsp->data[rsp->data_len++] = 0;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_GET_LED_COLOR_CAPABILITIES, ipmi_picmg_get_led_color, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Get LED Color Capabilities", as on PICMG 3.0
+ * table 3-30.
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID, [2] LED ID.
+ * Response data: [0] PICMG ID, [1] colors (bit n for color n),
+ * [2] default color in local control state, [3] default color in
+ * override state.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_get_led_color ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  const led_caps * caps;
+
+  if ( !ipmi_picmg_fru_check( req, rsp, 3 ) ) {
+    return;
+  }
+
+  caps = led_get_caps( req->data[2] );
+  if ( caps == NULL ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  rsp->data[rsp->data_len++] = caps->colors;
+  rsp->data[rsp->data_len++] = caps->local_color;
+  rsp->data[rsp->data_len++] = caps->override_color;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_SET_FRU_LED_STATE, ipmi_picmg_set_led, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Set FRU LED State", as on PICMG 3.0 table 3-31.
+ * Only changes the LED states, the LED timer interrupt does the rest
+ * (see led.h).
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID, [2] LED ID (0xFF for
+ * all), [3] LED function, [4] on duration (blink, tens of ms) or lamp
+ * test duration (hundreds of ms), [5] color.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_set_led ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_fru_check( req, rsp, 6 ) ) {
+    return;
+  }
+
+  if ( !led_set_override( req->data[2], req->data[3], req->data[4], req->data[5] ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+  }
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_GET_FRU_LED_STATE, ipmi_picmg_get_led, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for "Get FRU LED State", as on PICMG 3.0 table 3-32.
+ *
+ * Request data: [0] PICMG ID, [1] FRU device ID, [2] LED ID.
+ * Response data: [0] PICMG ID, [1] LED states, [2-4] local control
+ * function, on duration and color, then if overridden [5-7] override
+ * function, on duration and color, then if in lamp test [8] its
+ * duration.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_get_led ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  led_state state;
+
+  if ( !ipmi_picmg_fru_check( req, rsp, 3 ) ) {
+    return;
+  }
+
+  if ( !led_get_state( req->data[2], &state ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  rsp->data[rsp->data_len++] = state.states;
+  rsp->data[rsp->data_len++] = state.local.function;
+  rsp->data[rsp->data_len++] = state.local.on_duration;
+  rsp->data[rsp->data_len++] = state.local.color;
+  /* The override fields are also sent with a lamp test, they come before its duration */
+  if ( state.states & ( LED_STATE_OVERRIDE | LED_STATE_LAMP_TEST ) ) {
+    rsp->data[rsp->data_len++] = state.override.function;
+    rsp->data[rsp->data_len++] = state.override.on_duration;
+    rsp->data[rsp->data_len++] = state.override.color;
+  }
+  if ( state.states & LED_STATE_LAMP_TEST ) {
+    rsp->data[rsp->data_len++] = state.lamp_test_duration;
+  }
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_SET_AMC_PORT_STATE, ipmi_picmg_set_amc_port_state, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_FRU)));
+
+/**
+ * @brief Handler for "Set AMC Port State", as on AMC.0 table 3-27. The
+ * link must be one of the link descriptors of the module's connectivity
+ * records; the port switches follow shortly after (see ekey_set_link()).
+ *
+ * Request data: [0] PICMG ID, [1..4] Link Info (LS byte first), [5]
+ * state (1 enable, 0 disable). On-carrier devices aren't supported.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_set_amc_port_state ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t info;
+
+  rsp->data_len = 0;
+  rsp->data[rsp->data_len++] = IPMI_PICMG_GRP_EXT;
+
+  if ( req->data_len < 6 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( ( req->data[0] != IPMI_PICMG_GRP_EXT ) || ( req->data[5] > 1 ) || ( req->data_len > 6 ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  info = req->data[1] | ( req->data[2] << 8 ) | ( req->data[3] << 16 ) | ( (uint32_t) req->data[4] << 24 );
+  rsp->completion_code = ekey_set_link( info, req->data[5] ) ? IPMI_CC_OK : IPMI_CC_INV_DATA_FIELD_IN_REQ;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_GET_AMC_PORT_STATE, ipmi_picmg_get_amc_port_state, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_FRU)));
+
+/**
+ * @brief Handler for "Get AMC Port State", as on AMC.0 table 3-28.
+ *
+ * Request data: [0] PICMG ID, [1] AMC channel ID.
+ * Response data: [0] PICMG ID, then for each link of the channel (up to
+ * #EKEY_CHANNEL_LINKS_MAX): Link Info (4 bytes, LS byte first) and state.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_get_amc_port_state ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t info[EKEY_CHANNEL_LINKS_MAX];
+  uint8_t state[EKEY_CHANNEL_LINKS_MAX];
+  uint8_t count;
+  uint8_t i;
+
+  rsp->data_len = 0;
+  rsp->data[rsp->data_len++] = IPMI_PICMG_GRP_EXT;
+
+  if ( req->data_len < 2 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( ( req->data[0] != IPMI_PICMG_GRP_EXT ) || ( req->data_len > 2 ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  count = ekey_get_links( req->data[1], info, state );
+  for ( i = 0; i < count; i++ ) {
+    rsp->data[rsp->data_len++] = info[i] & 0xFF;
+    rsp->data[rsp->data_len++] = ( info[i] >> 8 ) & 0xFF;
+    rsp->data[rsp->data_len++] = ( info[i] >> 16 ) & 0xFF;
+    rsp->data[rsp->data_len++] = info[i] >> 24;
+    rsp->data[rsp->data_len++] = state[i];
+  }
+  rsp->completion_code = IPMI_CC_OK;
+}
+
+/* Checks the PICMG identifier the HPM.1 commands start with */
+static uint8_t ipmi_picmg_hpm_check ( ipmi_msg *req, ipmi_msg *rsp, uint8_t len )
+{
+  rsp->data_len = 0;
+  rsp->data[rsp->data_len++] = IPMI_PICMG_GRP_EXT;
+
+  if ( req->data_len < len ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return 0;
+  }
+  if ( req->data[0] != IPMI_PICMG_GRP_EXT ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return 0;
+  }
+  rsp->completion_code = IPMI_CC_OK;
+  return 1;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_GET_UPGRADE_CAPABILITIES, ipmi_picmg_hpm_get_capabilities, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Get Target Upgrade Capabilities", as on HPM.1
+ * table 3-3.
+ *
+ * Request data: [0] PICMG ID.
+ * Response data: [0] PICMG ID, [1] HPM.1 version, [2] global
+ * capabilities, [3] upgrade timeout, [4] self-test timeout, [5]
+ * rollback timeout, [6] inaccessibility timeout, [7] components.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_get_capabilities ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_hpm_check( req, rsp, 1 ) ) {
+    return;
+  }
+
+  rsp->data[rsp->data_len++] = IPMI_HPM_VERSION;
+  rsp->data[rsp->data_len++] = IPMI_HPM_GLOBAL_CAPABILITIES;
+  rsp->data[rsp->data_len++] = IPMI_HPM_UPGRADE_TIMEOUT;
+  rsp->data[rsp->data_len++] = 0;
+  rsp->data[rsp->data_len++] = IPMI_HPM_ROLLBACK_TIMEOUT;
+  rsp->data[rsp->data_len++] = IPMI_HPM_INACCESSIBILITY_TIMEOUT;
+  rsp->data[rsp->data_len++] = hpm_components();
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_GET_COMPONENT_PROPERTIES, ipmi_picmg_hpm_get_component_properties, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Get Component Properties", as on HPM.1 table
+ * 3-5. The component is the image slot not running; its version is
+ * the one of its header, 0.0 while it holds no valid image. There's
+ * no deferred image, so only the general properties, current version
+ * and description are answered.
+ *
+ * Request data: [0] PICMG ID, [1] component ID, [2] selector.
+ * Response data: [0] PICMG ID, [1..] the selected property.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_get_component_properties ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  const char * desc = IPMI_HPM_DESCRIPTION;
+  uint8_t slot = req->data[1];
+  uint16_t version = 0;
+  uint8_t i;
+
+  if ( !ipmi_picmg_hpm_check( req, rsp, 3 ) ) {
+    return;
+  }
+  if ( ( slot >= IMAGE_SLOTS ) || !( hpm_components() & HPM_COMPONENT( slot ) ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  switch ( req->data[2] ) {
+  case IPMI_HPM_PROP_GENERAL:
+    rsp->data[rsp->data_len++] = IPMI_HPM_COMPONENT_PROPERTIES;
+    break;
+  case IPMI_HPM_PROP_CURRENT_VERSION:
+    if ( image_slot_valid( slot ) ) {
+      version = image_get_header( slot )->version;
+    }
+    rsp->data[rsp->data_len++] = version >> 8;
+    rsp->data[rsp->data_len++] = version & 0xFF;
+    for ( i = 0; i < 4; i++ ) {
+      rsp->data[rsp->data_len++] = 0;
+    }
+    break;
+  case IPMI_HPM_PROP_DESCRIPTION:
+    /* "AFC MMC A" or "AFC MMC B" */
+    for ( i = 0; i < IPMI_HPM_DESCRIPTION_LEN; i++ ) {
+      if ( i < sizeof(IPMI_HPM_DESCRIPTION) - 1 ) {
+        rsp->data[rsp->data_len++] = desc[i];
+      } else if ( i == sizeof(IPMI_HPM_DESCRIPTION) - 1 ) {
+        rsp->data[rsp->data_len++] = ' ';
+      } else if ( i == sizeof(IPMI_HPM_DESCRIPTION) ) {
+        rsp->data[rsp->data_len++] = 'A' + slot;
+      } else {
+        rsp->data[rsp->data_len++] = 0;
+      }
+    }
+    break;
+  default:
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    break;
+  }
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_ABORT_FIRMWARE_UPGRADE, ipmi_picmg_hpm_abort, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Abort Firmware Upgrade", as on HPM.1 table 3-6.
+ * Refused (0x80) while an erase, the final writes or the activation
+ * are going on.
+ *
+ * Request data: [0] PICMG ID.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_abort ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_hpm_check( req, rsp, 1 ) ) {
+    return;
+  }
+
+  rsp->completion_code = hpm_abort();
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_INITIATE_UPGRADE_ACTION, ipmi_picmg_hpm_initiate, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Initiate Upgrade Action", as on HPM.1 table
+ * 3-7. Prepare and upload for upgrade erase the staging region, which
+ * goes on after the response (0x80, see Get Upgrade Status).
+ *
+ * Request data: [0] PICMG ID, [1] components, [2] upgrade action.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_initiate ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_hpm_check( req, rsp, 3 ) ) {
+    return;
+  }
+
+  rsp->completion_code = hpm_initiate( req->data[1], req->data[2] );
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_UPLOAD_FIRMWARE_BLOCK, ipmi_picmg_hpm_upload, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Upload Firmware Block", as on HPM.1 table 3-8.
+ * The block is only copied to RAM here, the flash is written by the
+ * HPM task; NODE_BUSY asks for the block again when it's behind.
+ *
+ * Request data: [0] PICMG ID, [1] block number, [2..] image data.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_upload ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_hpm_check( req, rsp, 3 ) ) {
+    return;
+  }
+
+  rsp->completion_code = hpm_upload( req->data[1], &req->data[2], req->data_len - 2 );
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_FINISH_FIRMWARE_UPLOAD, ipmi_picmg_hpm_finish, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Finish Firmware Upload", as on HPM.1 table 3-9.
+ * The last writes and the image check go on after the response (0x80,
+ * see Get Upgrade Status).
+ *
+ * Request data: [0] PICMG ID, [1] component ID, [2..5] image length,
+ * LSB first.
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_finish ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t len;
+
+  if ( !ipmi_picmg_hpm_check( req, rsp, 6 ) ) {
+    return;
+  }
+
+  len = req->data[2] | ( req->data[3] << 8 ) | ( req->data[4] << 16 ) | ( (uint32_t) req->data[5] << 24 );
+  rsp->completion_code = hpm_finish( req->data[1], len );
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_GET_UPGRADE_STATUS, ipmi_picmg_hpm_get_status, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Get Upgrade Status", as on HPM.1 table 3-10.
+ *
+ * Request data: [0] PICMG ID.
+ * Response data: [0] PICMG ID, [1] last long duration command, [2] its
+ * completion code (0x80 while it runs).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_get_status ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint8_t cmd;
+  uint8_t cc;
+
+  if ( !ipmi_picmg_hpm_check( req, rsp, 1 ) ) {
+    return;
+  }
+
+  hpm_get_status( &cmd, &cc );
+  rsp->data[rsp->data_len++] = cmd;
+  rsp->data[rsp->data_len++] = cc;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_GRPEXT, IPMI_PICMG_CMD_HPM_ACTIVATE_FIRMWARE, ipmi_picmg_hpm_activate, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for "Activate Firmware", as on HPM.1 table 3-11. The
+ * MMC copies the uploaded image in place and resets once this
+ * response is out.
+ *
+ * Request data: [0] PICMG ID, [1] rollback override policy (optional,
+ * there's no rollback).
+ * Response data: [0] PICMG ID.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_picmg_hpm_activate ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  if ( !ipmi_picmg_hpm_check( req, rsp, 1 ) ) {
+    return;
+  }
+
+  rsp->completion_code = hpm_activate();
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_HPM_DELTA_MANIFEST, ipmi_custom_hpm_delta_manifest, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_HPM)));
+
+/**
+ * @brief Handler for the custom "HPM Delta Manifest" command, between
+ * Initiate Upgrade Action and the first Upload Firmware Block: the
+ * chunks whose CRC matches the running image are copied from it and
+ * left out of the upload (see #hpm_delta).
+ *
+ * Request data: [0..1] first chunk, LS byte first, then the CRC-32 of
+ * 1 to #HPM_DELTA_CRCS chunks, 4 bytes each, LS byte first.
+ * Response data: [0] chunks copied, bit i for the first chunk + i.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_hpm_delta_manifest ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint8_t match = 0;
+
+  rsp->data_len = 0;
+
+  if ( ( req->data_len < 2 + 4 ) || ( ( req->data_len - 2 ) % 4 != 0 ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  rsp->completion_code = hpm_delta( req->data[0] | ( req->data[1] << 8 ), &req->data[2], ( req->data_len - 2 ) / 4, &match );
+  if ( rsp->completion_code == IPMI_CC_OK ) {
+    rsp->data[rsp->data_len++] = match;
+  }
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_IPMB_STATISTICS, ipmi_custom_get_ipmb_stats, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get IPMB Statistics" command.
+ *
+ * Modeled after the Bridge "Get Statistics" command, but the IPMB
+ * counters (see #ipmb_stat_id) are 32 bits wide, so they're read a
+ * few at a time.
+ *
+ * Request data: [0] index of the first counter (optional, 0 if missing).
+ * Response data: [0] total number of counters, then up to
+ * #IPMI_IPMB_STATS_PER_RESP counters, LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_ipmb_stats ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint8_t id = ( req->data_len > 0 ) ? req->data[0] : 0;
+  uint8_t len = 0;
+  uint8_t n;
+  uint32_t value;
+
+  if ( id >= IPMB_STAT_COUNT ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    rsp->data_len = 0;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = IPMB_STAT_COUNT;
+
+  for ( n = 0; ( n < IPMI_IPMB_STATS_PER_RESP ) && ( id < IPMB_STAT_COUNT ); n++, id++ ) {
+    value = ipmb_get_stat( id );
+    rsp->data[len++] = value & 0xFF;
+    rsp->data[len++] = ( value >> 8 ) & 0xFF;
+    rsp->data[len++] = ( value >> 16 ) & 0xFF;
+    rsp->data[len++] = ( value >> 24 ) & 0xFF;
+  }
+
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_CLEAR_IPMB_STATISTICS, ipmi_custom_clear_ipmb_stats, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Clear IPMB Statistics" command, resets
+ * all the IPMB and I2C link counters.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_clear_ipmb_stats ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  ipmb_clear_stats();
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = 0;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_IPMB_LATENCY, ipmi_custom_get_ipmb_latency, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get IPMB Latency" command, reads the
+ * response time histogram of one of the request NetFN/CMD pairs
+ * handled so far (see #ipmb_latency_hist).
+ *
+ * Request data: [0] histogram slot, [1] first bucket (optional, 0 if missing).
+ * Response data: [0] NetFN, [1] CMD, [2] number of buckets, then up to
+ * #IPMI_IPMB_LATENCY_PER_RESP buckets, LS byte first. An unused slot
+ * is answered with #IPMI_CC_REQ_DATA_NOT_PRESENT, so the slots can be
+ * read in order until this completion code comes back.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_ipmb_latency ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  const ipmb_latency_hist * hist;
+  uint8_t bucket;
+  uint8_t len = 0;
+  uint8_t n;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  bucket = ( req->data_len > 1 ) ? req->data[1] : 0;
+  if ( bucket >= IPMB_LATENCY_BUCKETS ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  hist = ipmb_get_latency_hist( req->data[0] );
+  if ( hist == NULL ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = hist->netfn;
+  rsp->data[len++] = hist->cmd;
+  rsp->data[len++] = IPMB_LATENCY_BUCKETS;
+
+  for ( n = 0; ( n < IPMI_IPMB_LATENCY_PER_RESP ) && ( bucket < IPMB_LATENCY_BUCKETS ); n++, bucket++ ) {
+    rsp->data[len++] = hist->bucket[bucket] & 0xFF;
+    rsp->data[len++] = hist->bucket[bucket] >> 8;
+  }
+
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_SENSOR_READINGS, ipmi_custom_get_sensor_readings, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for the custom "Get Sensor Readings" command, reads
+ * several sensors in one go, from the sensor store.
+ *
+ * Request data: [0] selection (#IPMI_SENSOR_SELECT_RANGE or
+ * #IPMI_SENSOR_SELECT_BITMAP), [1] first sensor to look at (0, or the
+ * token of the previous response), then for a range [2] last sensor
+ * (inclusive), for a bitmap [2..] one bit per sensor, LS bit of byte 2
+ * being sensor 0.
+ * Response data: [0] token to send in [1] to get the following
+ * readings (#IPMI_SENSOR_READINGS_DONE when there are no more), then
+ * up to #IPMI_SENSOR_READINGS_PER_RESP selected sensors, in order,
+ * each as bytes 1 to 3 of the Get Sensor Reading response.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_sensor_readings ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  sensor_reading reading;
+  uint8_t count = sensor_count();
+  uint8_t last;
+  uint8_t n = 0;
+  uint8_t len = 1;
+  uint8_t i;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 3 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  switch ( req->data[0] ) {
+  case IPMI_SENSOR_SELECT_RANGE:
+    last = ( req->data[2] < count ) ? req->data[2] : count - 1;
+    break;
+
+  case IPMI_SENSOR_SELECT_BITMAP:
+    last = count - 1;
+    break;
+
+  default:
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  rsp->data[0] = IPMI_SENSOR_READINGS_DONE;
+
+  for ( i = req->data[1]; ( i <= last ) && ( i < count ); i++ ) {
+    if ( ( req->data[0] == IPMI_SENSOR_SELECT_BITMAP ) &&
+         ( ( 2 + i / 8 >= req->data_len ) || !( req->data[2 + i / 8] & ( 1 << ( i % 8 ) ) ) ) ) {
+      continue;
+    }
+
+    if ( n == IPMI_SENSOR_READINGS_PER_RESP ) {
+      /* Full, the client asks again from this one */
+      rsp->data[0] = i;
+      break;
+    }
+
+    sensor_get_reading( i, &reading );
+    rsp->data[len++] = reading.value & 0xFF;
+    rsp->data[len++] = ipmi_sensor_status( i, &reading );
+    rsp->data[len++] = threshold_state( i );
+    n++;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_SENSOR_STATISTICS, ipmi_custom_get_sensor_stats, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for the custom "Get Sensor Statistics" command, gives
+ * the minimum, maximum and average reading of a sensor since its
+ * statistics were last cleared.
+ *
+ * Request data: [0] sensor number.
+ * Response data: [0..1] minimum, [2..3] maximum, [4..5] running
+ * average, [6..9] number of samples, all LS byte first and in the
+ * units of the sensor readings (signed 16 bit).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_sensor_stats ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  sensor_reading reading;
+  int16_t average;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( !sensor_get_reading( req->data[0], &reading ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  average = SENSOR_STATS_AVERAGE( &reading.stats );
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = reading.stats.min & 0xFF;
+  rsp->data[len++] = ( reading.stats.min >> 8 ) & 0xFF;
+  rsp->data[len++] = reading.stats.max & 0xFF;
+  rsp->data[len++] = ( reading.stats.max >> 8 ) & 0xFF;
+  rsp->data[len++] = average & 0xFF;
+  rsp->data[len++] = ( average >> 8 ) & 0xFF;
+  rsp->data[len++] = reading.stats.count & 0xFF;
+  rsp->data[len++] = ( reading.stats.count >> 8 ) & 0xFF;
+  rsp->data[len++] = ( reading.stats.count >> 16 ) & 0xFF;
+  rsp->data[len++] = reading.stats.count >> 24;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_CLEAR_SENSOR_STATISTICS, ipmi_custom_clear_sensor_stats, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for the custom "Clear Sensor Statistics" command,
+ * restarts the statistics of a sensor from its next reading.
+ *
+ * Request data: [0] sensor number, or 0xFF for every sensor.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_clear_sensor_stats ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( ( req->data[0] != SENSOR_ALL ) && ( req->data[0] >= sensor_count() ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+    return;
+  }
+
+  sensor_reset_stats( req->data[0] );
+  rsp->completion_code = IPMI_CC_OK;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_SENSOR_STREAM, ipmi_custom_sensor_stream, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for the custom "Sensor Stream" command, starts or stops
+ * the telemetry stream of the sensor store to the debug UART log (see
+ * sensor_stream()), so monitoring needs no requests over IPMB.
+ *
+ * Request data: [0..1] period in ms (LS byte first), 0 to stop, at least
+ * #SENSOR_STREAM_MIN_MS otherwise.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_sensor_stream ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  rsp->data_len = 0;
+
+  if ( req->data_len < 2 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  rsp->completion_code = sensor_stream( req->data[0] | ( req->data[1] << 8 ) ) ? IPMI_CC_OK : IPMI_CC_PARAM_OUT_OF_RANGE;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_SET_SENSOR_DEADBAND, ipmi_custom_set_sensor_deadband, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for the custom "Set Sensor Deadband" command, sets how far
+ * a reading must move before the change consumers (the telemetry stream)
+ * see it, see sensor_set_deadband().
+ *
+ * Request data: [0] sensor number, [1..2] deadband in raw counts (LS byte
+ * first).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_set_sensor_deadband ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  rsp->data_len = 0;
+
+  if ( req->data_len < 3 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  rsp->completion_code = sensor_set_deadband( req->data[0], req->data[1] | ( req->data[2] << 8 ) ) ? IPMI_CC_OK : IPMI_CC_ILL_SENSOR_OR_RECORD;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_TELEMETRY_SUBSCRIBE, ipmi_custom_telemetry_subscribe, IPMI_HANDLER_INLINE | IPMI_HANDLER_NEEDS(INIT_STAGE_BIT(INIT_STAGE_SENSORS)));
+
+/**
+ * @brief Handler for the custom "Telemetry Subscribe" command, makes the
+ * MMC push the changes of a set of sensors to a collector (see
+ * telemetry_subscribe()) instead of being polled for them.
+ *
+ * Request data: [0] collector address (8 bit address, 0 to stop), [1..4]
+ * sensor set, bit n for sensor n, [5..6] period in ms (both LS byte
+ * first, ignored when stopping).
+ * Response data: frames sent under the previous subscription and frames
+ * the collector didn't take (4 bytes each, LS byte first).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_telemetry_subscribe ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t sensors;
+  uint32_t sent;
+  uint32_t failed;
+  uint8_t len = 0;
+  uint8_t i;
+
+  rsp->data_len = 0;
+
+  if ( ( req->data_len < 1 ) || ( ( req->data[0] != TELEMETRY_DISABLED ) && ( req->data_len < 7 ) ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  telemetry_get_stats( &sent, &failed );
+
+  sensors = ( req->data_len < 7 ) ? 0 : ( req->data[1] | ( req->data[2] << 8 ) | ( req->data[3] << 16 ) | ( (uint32_t) req->data[4] << 24 ) );
+  if ( !telemetry_subscribe( req->data[0], sensors, ( req->data_len < 7 ) ? 0 : ( req->data[5] | ( req->data[6] << 8 ) ) ) ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  for ( i = 0; i < 4; i++ ) {
+    rsp->data[len++] = ( sent >> ( 8 * i ) ) & 0xFF;
+  }
+  for ( i = 0; i < 4; i++ ) {
+    rsp->data[len++] = ( failed >> ( 8 * i ) ) & 0xFF;
+  }
+  rsp->data_len = len;
+  rsp->completion_code = IPMI_CC_OK;
+}
+
+#if I2C_TRACE
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_I2C_TRACE, ipmi_custom_i2c_trace, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "I2C Trace" command, controls the I2C
+ * bus trace recorder (see vI2CTraceEnable()) and reads it out.
+ *
+ * Request data: [0] operation (#IPMI_I2C_TRACE_STOP, #IPMI_I2C_TRACE_START
+ * or #IPMI_I2C_TRACE_READ).
+ * Response data (read only): [0] entries still waiting after this
+ * response, [1] events dropped because the ring was full (saturated at
+ * 255), then up to #IPMI_I2C_TRACE_PER_RESP entries: timestamp (4 bytes,
+ * LS byte first), bus, STAT and data byte.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_i2c_trace ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  xI2C_trace_entry entry[IPMI_I2C_TRACE_PER_RESP];
+  uint32_t dropped;
+  uint8_t count;
+  uint8_t pending;
+  uint8_t len = 0;
+  uint8_t n;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  switch ( req->data[0] ) {
+  case IPMI_I2C_TRACE_STOP:
+  case IPMI_I2C_TRACE_START:
+    vI2CTraceEnable( req->data[0] == IPMI_I2C_TRACE_START );
+    rsp->completion_code = IPMI_CC_OK;
+    return;
+
+  case IPMI_I2C_TRACE_READ:
+    break;
+
+  default:
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  count = xI2CTraceRead( entry, IPMI_I2C_TRACE_PER_RESP );
+  pending = xI2CTracePending();
+
+  dropped = ulI2CTraceDropped();
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = pending;
+  rsp->data[len++] = ( dropped > 0xFF ) ? 0xFF : dropped;
+
+  for ( n = 0; n < count; n++ ) {
+    rsp->data[len++] = entry[n].timestamp & 0xFF;
+    rsp->data[len++] = ( entry[n].timestamp >> 8 ) & 0xFF;
+    rsp->data[len++] = ( entry[n].timestamp >> 16 ) & 0xFF;
+    rsp->data[len++] = entry[n].timestamp >> 24;
+    rsp->data[len++] = entry[n].i2c_id;
+    rsp->data[len++] = entry[n].stat;
+    rsp->data[len++] = entry[n].data;
+  }
+
+  rsp->data_len = len;
+}
+#endif
+
+#if I2C_SNOOP
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_I2C_SNOOP, ipmi_custom_i2c_snoop, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "I2C Snoop" command, starts or stops the
+ * capture of the frames sent to the other addresses of the IPMB bus (see
+ * xI2CSnoopEnable()). The frames are exported on the debug UART log.
+ *
+ * Request data: [0] operation (#IPMI_I2C_SNOOP_STOP or
+ * #IPMI_I2C_SNOOP_START).
+ * Response data: frames captured since the last start (4 bytes), then the
+ * ones dropped because the ring was full (4 bytes), LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_i2c_snoop ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t captured;
+  uint32_t dropped;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( req->data[0] > IPMI_I2C_SNOOP_START ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+  if ( !xI2CSnoopEnable( IPMB_I2C, req->data[0] == IPMI_I2C_SNOOP_START ) ) {
+    rsp->completion_code = IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    return;
+  }
+
+  captured = ulI2CSnoopCaptured();
+  dropped = ulI2CSnoopDropped();
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = captured & 0xFF;
+  rsp->data[len++] = ( captured >> 8 ) & 0xFF;
+  rsp->data[len++] = ( captured >> 16 ) & 0xFF;
+  rsp->data[len++] = captured >> 24;
+  rsp->data[len++] = dropped & 0xFF;
+  rsp->data[len++] = ( dropped >> 8 ) & 0xFF;
+  rsp->data[len++] = ( dropped >> 16 ) & 0xFF;
+  rsp->data[len++] = dropped >> 24;
+  rsp->data_len = len;
+}
+#endif
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_FPGA_LOAD, ipmi_custom_fpga_load, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "FPGA Load" command, starts loading the
+ * payload FPGA from its flash (see fpga.h) and reports how it goes.
+ *
+ * Request data: [0] operation (#IPMI_FPGA_LOAD_STATUS or
+ * #IPMI_FPGA_LOAD_START), then for a start [1..3] flash address of the
+ * bitstream and [4..7] its length, LS byte first.
+ * Response data: [0] state, [1] error (fpga_state, fpga_error), then the
+ * bytes sent, the bitstream length, the CRC-32 of the bytes sent and the
+ * load time in us, 4 bytes each, LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_fpga_load ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  fpga_status status;
+  uint32_t values[4];
+  uint8_t len = 0;
+  uint8_t i;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  switch ( req->data[0] ) {
+  case IPMI_FPGA_LOAD_STATUS:
+    break;
+
+  case IPMI_FPGA_LOAD_START:
+    if ( req->data_len < 8 ) {
+      rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+      return;
+    }
+    if ( !fpga_load( req->data[1] | ( req->data[2] << 8 ) | ( req->data[3] << 16 ),
+                     req->data[4] | ( req->data[5] << 8 ) | ( req->data[6] << 16 ) | ( (uint32_t) req->data[7] << 24 ) ) ) {
+      /* Already loading, or no FPGA on this board */
+      rsp->completion_code = IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+      return;
+    }
+    break;
+
+  default:
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  fpga_get_status( &status );
+  values[0] = status.sent;
+  values[1] = status.len;
+  values[2] = status.crc;
+  values[3] = status.elapsed_us;
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = status.state;
+  rsp->data[len++] = status.error;
+  for ( i = 0; i < 4; i++ ) {
+    rsp->data[len++] = values[i] & 0xFF;
+    rsp->data[len++] = ( values[i] >> 8 ) & 0xFF;
+    rsp->data[len++] = ( values[i] >> 16 ) & 0xFF;
+    rsp->data[len++] = values[i] >> 24;
+  }
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_MEMORY_STATISTICS, ipmi_custom_get_memory_stats, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Memory Statistics" command, gives
+ * the heap usage or the usage of one of the block pools.
+ *
+ * Request data: [0] page, 0 for the heap, n for the pool n-1.
+ * Heap page response data: [0..1] heap size, [2..3] free bytes,
+ * [4..5] fewest free bytes ever, [6..7] largest free block, [8] free
+ * blocks, [9] number of pools, [10..11] failed allocations, [12..15]
+ * caller of the first failed allocation, [16..17] bytes it asked for.
+ * Pool page response data: [0..1] block size, [2..3] blocks,
+ * [4..5] blocks in use, [6..7] most blocks ever in use, [8..11] failed
+ * allocations, [12..] pool name. Everything is LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_memory_stats ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  heap_stats heap;
+  malloc_failure failure;
+  const mem_pool * pool;
+  const char * name;
+  uint8_t pools = 0;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( req->data[0] == 0 ) {
+    mem_stats_get_heap( &heap );
+    mem_stats_get_malloc_failure( &failure );
+    while ( mem_pool_get( pools ) != NULL ) {
+      pools++;
+    }
+
+    rsp->data[len++] = heap.total & 0xFF;
+    rsp->data[len++] = ( heap.total >> 8 ) & 0xFF;
+    rsp->data[len++] = heap.free & 0xFF;
+    rsp->data[len++] = ( heap.free >> 8 ) & 0xFF;
+    rsp->data[len++] = heap.min_free & 0xFF;
+    rsp->data[len++] = ( heap.min_free >> 8 ) & 0xFF;
+    rsp->data[len++] = heap.largest_free & 0xFF;
+    rsp->data[len++] = ( heap.largest_free >> 8 ) & 0xFF;
+    rsp->data[len++] = ( heap.free_blocks > 0xFF ) ? 0xFF : heap.free_blocks;
+    rsp->data[len++] = pools;
+    rsp->data[len++] = ( failure.count > 0xFFFF ) ? 0xFF : ( failure.count & 0xFF );
+    rsp->data[len++] = ( failure.count > 0xFFFF ) ? 0xFF : ( ( failure.count >> 8 ) & 0xFF );
+    rsp->data[len++] = failure.caller & 0xFF;
+    rsp->data[len++] = ( failure.caller >> 8 ) & 0xFF;
+    rsp->data[len++] = ( failure.caller >> 16 ) & 0xFF;
+    rsp->data[len++] = failure.caller >> 24;
+    rsp->data[len++] = failure.size & 0xFF;
+    rsp->data[len++] = ( failure.size >> 8 ) & 0xFF;
+  } else {
+    pool = mem_pool_get( req->data[0] - 1 );
+    if ( pool == NULL ) {
+      rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+      return;
+    }
+
+    /* The counters are read without locking, each one is a single aligned access */
+    rsp->data[len++] = pool->block_size & 0xFF;
+    rsp->data[len++] = pool->block_size >> 8;
+    rsp->data[len++] = pool->count & 0xFF;
+    rsp->data[len++] = pool->count >> 8;
+    rsp->data[len++] = pool->used & 0xFF;
+    rsp->data[len++] = pool->used >> 8;
+    rsp->data[len++] = pool->high_water & 0xFF;
+    rsp->data[len++] = pool->high_water >> 8;
+    rsp->data[len++] = pool->exhausted & 0xFF;
+    rsp->data[len++] = ( pool->exhausted >> 8 ) & 0xFF;
+    rsp->data[len++] = ( pool->exhausted >> 16 ) & 0xFF;
+    rsp->data[len++] = pool->exhausted >> 24;
+    for ( name = pool->name; *name && ( len < IPMB_MAX_DATA_LEN - 1 ); name++ ) {
+      rsp->data[len++] = *name;
+    }
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_STACK_USAGE, ipmi_custom_get_stack_usage, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Stack Usage" command, gives the
+ * stack size of a task, the deepest use seen and the size it could be
+ * given instead.
+ *
+ * Request data: [0] task index.
+ * Response data: [0] number of tasks, [1..2] stack size, [3..4] fewest
+ * free words seen, [5..6] recommended stack size, [7..] task name. The
+ * sizes are in words, LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_stack_usage ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  stack_usage usage;
+  const char * name;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( !stack_mon_get( req->data[0], &usage ) ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  rsp->data[len++] = stack_mon_count();
+  rsp->data[len++] = usage.depth & 0xFF;
+  rsp->data[len++] = usage.depth >> 8;
+  rsp->data[len++] = usage.min_free & 0xFF;
+  rsp->data[len++] = usage.min_free >> 8;
+  rsp->data[len++] = usage.recommended & 0xFF;
+  rsp->data[len++] = usage.recommended >> 8;
+  for ( name = usage.name; *name && ( len < IPMB_MAX_DATA_LEN - 1 ); name++ ) {
+    rsp->data[len++] = *name;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_QUEUE_STATISTICS, ipmi_custom_get_queue_stats, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Queue Statistics" command, gives
+ * the depth counters of one of the registered queues (queue_stats.h).
+ *
+ * Request data: [0] queue index, [1] (optional) 1 to restart its
+ * counters once read.
+ * Response data: [0] number of queues, [1] length, [2] items waiting,
+ * [3] most items ever waiting, [4..7] sends that blocked, [8..11] sends
+ * that failed, [12..15] time spent by blocked senders in ms, [16..]
+ * queue name. The counters are LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_queue_stats ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  queue_usage usage;
+  uint32_t values[3];
+  const char * name;
+  uint8_t len = 0;
+  uint8_t i;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( !queue_stats_get( req->data[0], &usage ) ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+  if ( ( req->data_len > 1 ) && ( req->data[1] == 1 ) ) {
+    queue_stats_clear( req->data[0] );
+  }
+
+  values[0] = usage.blocked;
+  values[1] = usage.failed;
+  values[2] = usage.wait_ticks * portTICK_PERIOD_MS;
+
+  rsp->data[len++] = queue_stats_count();
+  rsp->data[len++] = usage.length;
+  rsp->data[len++] = usage.waiting;
+  rsp->data[len++] = usage.high_water;
+  for ( i = 0; i < 3; i++ ) {
+    rsp->data[len++] = values[i] & 0xFF;
+    rsp->data[len++] = ( values[i] >> 8 ) & 0xFF;
+    rsp->data[len++] = ( values[i] >> 16 ) & 0xFF;
+    rsp->data[len++] = values[i] >> 24;
+  }
+  for ( name = usage.name; *name && ( len < IPMB_MAX_DATA_LEN - 1 ); name++ ) {
+    rsp->data[len++] = *name;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_CPU_LOAD, ipmi_custom_get_cpu_load, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get CPU Load" command, gives the CPU
+ * share taken by each task, or the name of one task.
+ *
+ * Request data: [0] first task index, [1] (optional) task number whose
+ * name is wanted instead.
+ * Response data: [0] number of tasks, [1] next task index (0xFF when
+ * done), [2] runaway detections (saturated to 0xFF), then 4 bytes per
+ * task: task number, priority (bit 7 set while flagged as a runaway),
+ * load during the last second and average load over the window, in
+ * 0.5 % steps.
+ * Name response data: [0] task number, [1..] name.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_cpu_load ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  cpu_load_task load = { 0 };
+  const char * name;
+  uint32_t runaways;
+  uint8_t count;
+  uint8_t index;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  count = cpu_load_count();
+
+  if ( req->data_len >= 2 ) {
+    for ( index = 0; cpu_load_get( index, &load ); index++ ) {
+      if ( load.number == req->data[1] ) {
+        break;
+      }
+    }
+    if ( ( load.name == NULL ) || ( load.number != req->data[1] ) ) {
+      rsp->completion_code = IPMI_CC_REQ_DATA_NOT_PRESENT;
+      return;
+    }
+    rsp->data[len++] = load.number;
+    for ( name = load.name; *name && ( len < IPMB_MAX_DATA_LEN - 1 ); name++ ) {
+      rsp->data[len++] = *name;
+    }
+    rsp->completion_code = IPMI_CC_OK;
+    rsp->data_len = len;
+    return;
+  }
+
+  if ( ( req->data[0] >= count ) && ( count > 0 ) ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  runaways = cpu_load_runaways();
+  rsp->data[len++] = count;
+  rsp->data[len++] = 0xFF;
+  rsp->data[len++] = ( runaways > 0xFF ) ? 0xFF : runaways;
+
+  for ( index = req->data[0]; cpu_load_get( index, &load ); index++ ) {
+    if ( len + 4 > IPMB_MAX_DATA_LEN - 1 ) {
+      rsp->data[1] = index;
+      break;
+    }
+    rsp->data[len++] = load.number;
+    rsp->data[len++] = ( load.priority & 0x7F ) | ( load.runaway ? 0x80 : 0x00 );
+    rsp->data[len++] = load.last;
+    rsp->data[len++] = load.window;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+#if configAPP_KERNEL_TRACE
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_KERNEL_TRACE, ipmi_custom_kernel_trace, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Kernel Trace" command, controls the
+ * scheduler, queue and interrupt trace recorder (see kernel_trace.h)
+ * and reads it out.
+ *
+ * Request data: [0] operation (#IPMI_KERNEL_TRACE_STOP,
+ * #IPMI_KERNEL_TRACE_START, #IPMI_KERNEL_TRACE_READ or
+ * #IPMI_KERNEL_TRACE_STREAM), [1..2] offset of the first byte to read
+ * (read only, 0 is the start of the oldest record, LS byte first).
+ * Response data (read only): [0..1] bytes of records in the ring, [2]
+ * core clock in MHz, [3..6] cycle count before the oldest record (LS
+ * byte first), then up to #IPMI_KERNEL_TRACE_PER_RESP bytes of records
+ * (packed, see kernel_trace.h).
+ * The trace must be stopped to be read. Stream sends the whole ring to
+ * the debug UART instead (kernel_trace_stream), much faster than reading
+ * it here. tools/kernel_trace_decode.py turns the responses into a
+ * timeline.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_kernel_trace ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t offset;
+  uint16_t held;
+  uint32_t base;
+  uint8_t len = 0;
+  uint8_t n;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  switch ( req->data[0] ) {
+  case IPMI_KERNEL_TRACE_STOP:
+  case IPMI_KERNEL_TRACE_START:
+    kernel_trace_enable( req->data[0] == IPMI_KERNEL_TRACE_START );
+    rsp->completion_code = IPMI_CC_OK;
+    return;
+
+  case IPMI_KERNEL_TRACE_STREAM:
+    rsp->completion_code = kernel_trace_stream() ? IPMI_CC_OK : IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+    return;
+
+  case IPMI_KERNEL_TRACE_READ:
+    break;
+
+  default:
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  if ( req->data_len < 3 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  offset = req->data[1] | ( req->data[2] << 8 );
+  held = kernel_trace_length();
+  base = kernel_trace_base();
+
+  rsp->data[len++] = held & 0xFF;
+  rsp->data[len++] = held >> 8;
+  rsp->data[len++] = configCPU_CLOCK_HZ / 1000000;
+  rsp->data[len++] = base & 0xFF;
+  rsp->data[len++] = ( base >> 8 ) & 0xFF;
+  rsp->data[len++] = ( base >> 16 ) & 0xFF;
+  rsp->data[len++] = base >> 24;
+
+  if ( offset < held ) {
+    n = kernel_trace_read( offset, &rsp->data[len], IPMI_KERNEL_TRACE_PER_RESP );
+    if ( n == 0 ) {
+      /* Still recording */
+      rsp->completion_code = IPMI_CC_NOT_SUPPORTED_PRESENT_STATE;
+      return;
+    }
+    len += n;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+#endif
+
+#if configAPP_PROFILE
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_PROFILE, ipmi_custom_get_profile, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Profile" command, gives the cycle
+ * counts measured by a profiling probe (see prof.h).
+ *
+ * Request data: [0] probe id (#prof_probe), [1] (optional) 1 to clear
+ * the probe once read.
+ * Response data: [0] number of probes, [1..4] measurements, [5..12]
+ * total cycles, [13..16] fewest cycles, [17..20] most cycles, [21] core
+ * clock in MHz, all LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_profile ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  prof_stats stats;
+  uint8_t len = 0;
+  uint8_t i;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( !prof_get( req->data[0], &stats, ( req->data_len >= 2 ) && ( req->data[1] == 1 ) ) ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+
+  if ( stats.count == 0 ) {
+    stats.min = 0;
+  }
+
+  rsp->data[len++] = PROF_PROBE_COUNT;
+  for ( i = 0; i < 4; i++ ) {
+    rsp->data[len++] = ( stats.count >> ( 8 * i ) ) & 0xFF;
+  }
+  for ( i = 0; i < 8; i++ ) {
+    rsp->data[len++] = ( stats.total >> ( 8 * i ) ) & 0xFF;
+  }
+  for ( i = 0; i < 4; i++ ) {
+    rsp->data[len++] = ( stats.min >> ( 8 * i ) ) & 0xFF;
+  }
+  for ( i = 0; i < 4; i++ ) {
+    rsp->data[len++] = ( stats.max >> ( 8 * i ) ) & 0xFF;
+  }
+  rsp->data[len++] = configCPU_CLOCK_HZ / 1000000;
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+#endif
+
+#if configAPP_RESPONSE_TIME
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_RESPONSE_TIMES, ipmi_custom_get_response_times, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Response Times" command, gives the
+ * worst response time of a task against its deadline (see
+ * response_time.h).
+ *
+ * Request data: [0] task index, [1] (optional) 1 to start all the
+ * measurements over once read.
+ * Response data: [0] number of tasks, [1] task number, [2] priority,
+ * [3] flags (RESPONSE_TIME_AT_RISK, ...), [4..5] deadline in ms,
+ * [6..9] worst response time in us, [10..13] wake ups measured,
+ * [14..15] wake ups past the deadline (saturated), [16..] task name.
+ * The values are LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_response_times ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  response_time_stats stats;
+  uint16_t deadline_ms;
+  uint16_t misses;
+  const char * name;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  if ( !response_time_get( req->data[0], &stats ) ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    return;
+  }
+  if ( ( req->data_len > 1 ) && ( req->data[1] == 1 ) ) {
+    response_time_clear();
+  }
+
+  deadline_ms = stats.deadline_us / 1000;
+  misses = ( stats.misses > 0xFFFF ) ? 0xFFFF : stats.misses;
+
+  rsp->data[len++] = response_time_count();
+  rsp->data[len++] = stats.number;
+  rsp->data[len++] = stats.priority;
+  rsp->data[len++] = stats.flags;
+  rsp->data[len++] = deadline_ms & 0xFF;
+  rsp->data[len++] = deadline_ms >> 8;
+  rsp->data[len++] = stats.worst_us & 0xFF;
+  rsp->data[len++] = ( stats.worst_us >> 8 ) & 0xFF;
+  rsp->data[len++] = ( stats.worst_us >> 16 ) & 0xFF;
+  rsp->data[len++] = stats.worst_us >> 24;
+  rsp->data[len++] = stats.wakeups & 0xFF;
+  rsp->data[len++] = ( stats.wakeups >> 8 ) & 0xFF;
+  rsp->data[len++] = ( stats.wakeups >> 16 ) & 0xFF;
+  rsp->data[len++] = stats.wakeups >> 24;
+  rsp->data[len++] = misses & 0xFF;
+  rsp->data[len++] = misses >> 8;
+  for ( name = stats.name; *name && ( len < IPMB_MAX_DATA_LEN - 1 ); name++ ) {
+    rsp->data[len++] = *name;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+#endif
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_ECHO, ipmi_custom_echo, IPMI_HANDLER_INLINE);
+
+/* Microseconds between two core cycle counts, saturated to 16 bits */
+static uint16_t ipmi_echo_elapsed_us ( uint32_t from, uint32_t to )
+{
+  uint32_t us = ( to - from ) / ( configCPU_CLOCK_HZ / 1000000 );
+
+  return ( us > 0xFFFF ) ? 0xFFFF : us;
+}
+
+/**
+ * @brief Handler for the custom "Echo" command, returns the request
+ * payload with the time the request spent in each stage of the MMC, to
+ * measure the IPMB round trip from the shelf manager.
+ *
+ * Request data: [0..n] payload, up to IPMI_MAX_DATA_LEN -
+ * IPMI_ECHO_TIMING_LEN bytes.
+ * Response data: [0..1] microseconds from the end of the frame (I2C
+ * STOP) to the IPMI dispatcher, [2..3] from the dispatcher to this
+ * handler, [4..5] from this handler start to the response being queued
+ * to IPMB TX, all LS byte first and saturated at 0xFFFF, [6..] the
+ * payload.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_echo ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t rx = ipmb_get_stamp( req, IPMB_STAMP_RX );
+  uint32_t dispatch = ipmb_get_stamp( req, IPMB_STAMP_DISPATCH );
+  uint32_t handler = ipmb_get_stamp( req, IPMB_STAMP_HANDLER );
+  uint16_t us;
+  uint8_t len = 0;
+
+  rsp->data_len = 0;
+
+  if ( req->data_len > IPMI_MAX_DATA_LEN - IPMI_ECHO_TIMING_LEN ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+
+  memcpy( &rsp->data[IPMI_ECHO_TIMING_LEN], req->data, req->data_len );
+
+  us = ipmi_echo_elapsed_us( rx, dispatch );
+  rsp->data[len++] = us & 0xFF;
+  rsp->data[len++] = us >> 8;
+  us = ipmi_echo_elapsed_us( dispatch, handler );
+  rsp->data[len++] = us & 0xFF;
+  rsp->data[len++] = us >> 8;
+  /* The dispatcher queues the response to IPMB TX as soon as this returns */
+  us = ipmi_echo_elapsed_us( handler, DWT->CYCCNT );
+  rsp->data[len++] = us & 0xFF;
+  rsp->data[len++] = us >> 8;
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len + req->data_len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_INIT_STATUS, ipmi_custom_get_init_status, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Init Status" command, returns the
+ * start up stages done (see init_stage.h) and when.
+ *
+ * Request data: none.
+ * Response data: [0] mask of the stages done (bit n for stage n), [1]
+ * number of stages, then for each stage the milliseconds from the
+ * scheduler start to it being done, LS byte first, 0xFFFF if it isn't
+ * done yet (saturated to 0xFFFE).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_init_status ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  TickType_t tick;
+  uint32_t ms;
+  uint8_t len = 0;
+  uint8_t i;
+
+  (void) req;
+
+  rsp->data[len++] = init_stages_done();
+  rsp->data[len++] = INIT_STAGES;
+  for ( i = 0; i < INIT_STAGES; i++ ) {
+    ms = 0xFFFF;
+    if ( init_stage_tick( i, &tick ) ) {
+      ms = tick * portTICK_PERIOD_MS;
+      if ( ms > 0xFFFE ) {
+        ms = 0xFFFE;
+      }
+    }
+    rsp->data[len++] = ms & 0xFF;
+    rsp->data[len++] = ms >> 8;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_BOOT_TIMELINE, ipmi_custom_get_boot_timeline, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Boot Timeline" command, returns the
+ * time from reset to each start up step (see boot_time.h).
+ *
+ * Request data: [0] first mark to return.
+ * Response data: [0] number of marks, [1] number of marks returned (up to
+ * #IPMI_BOOT_TIMELINE_MARKS), then the microseconds from reset to each of
+ * them, LS byte first, 0xFFFFFFFF if it isn't reached.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_boot_timeline ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t us;
+  uint8_t first;
+  uint8_t count;
+  uint8_t len = 0;
+  uint8_t i;
+
+  if ( req->data_len < 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    rsp->data_len = 0;
+    return;
+  }
+  first = req->data[0];
+  if ( first > BOOT_TIME_COUNT ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    rsp->data_len = 0;
+    return;
+  }
+
+  count = BOOT_TIME_COUNT - first;
+  if ( count > IPMI_BOOT_TIMELINE_MARKS ) {
+    count = IPMI_BOOT_TIMELINE_MARKS;
+  }
+  rsp->data[len++] = BOOT_TIME_COUNT;
+  rsp->data[len++] = count;
+  for ( i = first; i < first + count; i++ ) {
+    us = boot_time_get( i );
+    rsp->data[len++] = us & 0xFF;
+    rsp->data[len++] = ( us >> 8 ) & 0xFF;
+    rsp->data[len++] = ( us >> 16 ) & 0xFF;
+    rsp->data[len++] = us >> 24;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_CRASH_RECORD, ipmi_custom_get_crash_record, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Crash Record" command, reads the
+ * record left by a crash before the last reset (see crash.h).
+ *
+ * Request data: [0..1] offset in the record, LS byte first.
+ * Response data: [0..1] size of the record, LS byte first, 0 if there's
+ * none, then up to #IPMI_CRASH_RECORD_CHUNK bytes of it from the offset.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_crash_record ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t offset;
+  uint16_t size;
+  uint8_t count = IPMI_CRASH_RECORD_CHUNK;
+
+  if ( req->data_len < 2 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    rsp->data_len = 0;
+    return;
+  }
+  offset = req->data[0] | ( req->data[1] << 8 );
+
+  size = crash_get( offset, &rsp->data[2], count );
+  if ( offset > size ) {
+    rsp->completion_code = IPMI_CC_PARAM_OUT_OF_RANGE;
+    rsp->data_len = 0;
+    return;
+  }
+  if ( count > size - offset ) {
+    count = size - offset;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = size & 0xFF;
+  rsp->data[1] = size >> 8;
+  rsp->data_len = 2 + count;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_CLEAR_CRASH_RECORD, ipmi_custom_clear_crash_record, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Clear Crash Record" command, forgets the
+ * record and restarts the crash count.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_clear_crash_record ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  (void) req;
+
+  crash_clear();
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data_len = 0;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CHASSIS, IPMI_GET_POH_COUNTER_CMD, ipmi_chassis_get_poh_counter, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the "Get POH Counter" command, the power-on hours
+ * kept in the config store (see poh.h).
+ *
+ * Response data: [0] minutes per count, [1..4] counter, LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_chassis_get_poh_counter ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint32_t value = config_counter_get( CONFIG_COUNTER_POH );
+
+  (void) req;
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = POH_MINUTES_PER_COUNT;
+  rsp->data[1] = value & 0xFF;
+  rsp->data[2] = ( value >> 8 ) & 0xFF;
+  rsp->data[3] = ( value >> 16 ) & 0xFF;
+  rsp->data[4] = ( value >> 24 ) & 0xFF;
+  rsp->data_len = 5;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_LIFETIME_COUNTERS, ipmi_custom_get_lifetime_counters, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Lifetime Counters" command, the
+ * counters of the config store, which survive resets and the Clear IPMB
+ * Statistics command (see the CONFIG_COUNTER_* counters).
+ *
+ * Response data: [0] number of counters, then every counter, LS byte first.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_lifetime_counters ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint8_t len = 0;
+  uint8_t counter;
+  uint32_t value;
+
+  (void) req;
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[len++] = CONFIG_COUNTERS;
+
+  for ( counter = 0; counter < CONFIG_COUNTERS; counter++ ) {
+    value = config_counter_get( counter );
+    rsp->data[len++] = value & 0xFF;
+    rsp->data[len++] = ( value >> 8 ) & 0xFF;
+    rsp->data[len++] = ( value >> 16 ) & 0xFF;
+    rsp->data[len++] = ( value >> 24 ) & 0xFF;
+  }
+
+  rsp->data_len = len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_METRICS, ipmi_custom_get_metrics, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Metrics" command, a page of the
+ * metrics registry (see metrics.h).
+ *
+ * A scraper reads the names once, then polls the values page by page,
+ * from element 0 until the next element comes back as #METRICS_END.
+ *
+ * Request data: [0] #METRICS_PAGE_VALUES or #METRICS_PAGE_NAMES,
+ * [1..2] first element, LS byte first (optional, 0 if missing).
+ * Response data: [0..1] first element of the next page, LS byte first,
+ * #METRICS_END after the last one, then the TLVs (see #metrics_dump).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_metrics ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  uint16_t element = 0;
+  uint8_t len;
+
+  if ( ( req->data_len < 1 ) || ( req->data_len == 2 ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    rsp->data_len = 0;
+    return;
+  }
+  if ( req->data[0] > METRICS_PAGE_NAMES ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    rsp->data_len = 0;
+    return;
+  }
+  if ( req->data_len >= 3 ) {
+    element = req->data[1] | ( req->data[2] << 8 );
+  }
+
+  len = metrics_dump( req->data[0], &element, &rsp->data[2], IPMI_MAX_DATA_LEN - 2 );
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = element & 0xFF;
+  rsp->data[1] = element >> 8;
+  rsp->data_len = 2 + len;
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_SELF_TEST, ipmi_custom_self_test, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Self Test" command, starts or stops a
+ * self test or load generator (see selftest.h). Its results are read
+ * with Get Metrics.
+ *
+ * Request data: none to only get the test running, or [0] test
+ * (#SELFTEST_NONE to stop), [1..2] seconds to run it, LS byte first
+ * (0 until stopped), then up to #SELFTEST_PARAM_MAX parameters.
+ * Response data: [0] test running, #SELFTEST_NONE if none (a test just
+ * started may not show yet).
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_self_test ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  rsp->data_len = 0;
+
+  if ( ( req->data_len != 0 ) && ( ( req->data_len < 3 ) || ( req->data_len > 3 + SELFTEST_PARAM_MAX ) ) ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    return;
+  }
+  if ( ( req->data_len != 0 ) &&
+       !selftest_start( req->data[0], req->data[1] | ( req->data[2] << 8 ), &req->data[3], req->data_len - 3 ) ) {
+    rsp->completion_code = IPMI_CC_INV_DATA_FIELD_IN_REQ;
+    return;
+  }
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[rsp->data_len++] = selftest_running();
+}
+
+IPMI_HANDLER_FLAGS(NETFN_CUSTOM, IPMI_CUSTOM_CMD_GET_EVENT_HISTORY, ipmi_custom_get_event_history, IPMI_HANDLER_INLINE);
+
+/**
+ * @brief Handler for the custom "Get Event History" command, a page of
+ * the events posted since boot, sent to the receiver or not (see event.h).
+ *
+ * Request data: [0..1] number of the first event wanted, LS byte first
+ * (optional, 0 if missing: the oldest one kept).
+ * Response data: [0..1] number of the first event returned, LS byte
+ * first, [2] events returned (0 once the newest one was read), then
+ * #IPMI_EVENT_HISTORY_RECORD_LEN bytes per event: time (4 bytes, LS byte
+ * first), flags, sensor number, event direction and type, event data 1
+ * to 3. The next page starts at the first number plus the count.
+ *
+ * @param req Incoming request to be handled and answered.
+ * @param rsp Response with data, data length and completion code.
+ */
+void ipmi_custom_get_event_history ( ipmi_msg *req, ipmi_msg *rsp )
+{
+  event_record records[IPMI_EVENT_HISTORY_RECORDS];
+  uint16_t cursor = 0;
+  uint8_t count;
+  uint8_t len = 3;
+  uint8_t i;
+
+  if ( req->data_len == 1 ) {
+    rsp->completion_code = IPMI_CC_REQ_DATA_INV_LENGTH;
+    rsp->data_len = 0;
+    return;
+  }
+  if ( req->data_len >= 2 ) {
+    cursor = req->data[0] | ( req->data[1] << 8 );
+  }
+
+  count = event_history_read( &cursor, records, IPMI_EVENT_HISTORY_RECORDS );
+
+  rsp->completion_code = IPMI_CC_OK;
+  rsp->data[0] = cursor & 0xFF;
+  rsp->data[1] = cursor >> 8;
+  rsp->data[2] = count;
+  for ( i = 0; i < count; i++ ) {
+    rsp->data[len++] = records[i].time & 0xFF;
+    rsp->data[len++] = ( records[i].time >> 8 ) & 0xFF;
+    rsp->data[len++] = ( records[i].time >> 16 ) & 0xFF;
+    rsp->data[len++] = ( records[i].time >> 24 ) & 0xFF;
+    rsp->data[len++] = records[i].flags;
+    rsp->data[len++] = records[i].sensor_num;
+    rsp->data[len++] = records[i].dir_type;
+    rsp->data[len++] = records[i].data[0];
+    rsp->data[len++] = records[i].data[1];
+    rsp->data[len++] = records[i].data[2];
+  }
+  rsp->data_len = len;
+}
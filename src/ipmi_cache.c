@@ -0,0 +1,138 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file ipmi_cache.c
+ *
+ * @brief Response cache of the read-only IPMI commands
+ *
+ * Besides critical sections it doesn't use the kernel, so it also builds natively against the host shim
+ * (make bench-host, see host/bench_host.c).
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "ipmb.h"
+#include "ipmi.h"
+#include "ipmi_cache.h"
+
+typedef struct ipmi_cache_entry {
+    uint32_t hash;                          /*!< Of the key, 0 while the entry was never filled */
+    uint32_t tag;                           /*!< Epoch count of the subsystem when the response was built */
+    uint8_t lun;
+    uint8_t netfn;
+    uint8_t cmd;
+    uint8_t epoch;
+    uint8_t req_len;
+    uint8_t req[IPMI_CACHE_REQ_MAX];
+    uint8_t data_len;
+    uint8_t data[IPMB_MAX_DATA_LEN];
+} ipmi_cache_entry;
+
+static ipmi_cache_entry ipmi_cache[IPMI_CACHE_ENTRIES];
+
+/* Bumped by ipmi_cache_invalidate(), they start at 1 so an empty entry never matches */
+static volatile uint32_t ipmi_cache_count[IPMI_CACHE_EPOCHS] = { [0 ... IPMI_CACHE_EPOCHS - 1] = 1 };
+
+/* FNV-1a of the key, never 0 */
+static uint32_t prvCacheHash( const ipmi_msg * req )
+{
+    uint32_t hash = 2166136261UL;
+    uint8_t i;
+
+    hash = ( hash ^ req->dest_LUN ) * 16777619UL;
+    hash = ( hash ^ req->netfn ) * 16777619UL;
+    hash = ( hash ^ req->cmd ) * 16777619UL;
+    for ( i = 0; i < req->data_len; i++ ) {
+        hash = ( hash ^ req->data[i] ) * 16777619UL;
+    }
+    return hash ? hash : 1;
+}
+
+static uint8_t prvCacheMatch( const ipmi_cache_entry * entry, const ipmi_msg * req, uint32_t hash )
+{
+    return ( entry->hash == hash ) && ( entry->lun == req->dest_LUN ) && ( entry->netfn == req->netfn ) &&
+        ( entry->cmd == req->cmd ) && ( entry->req_len == req->data_len ) &&
+        ( memcmp( entry->req, req->data, req->data_len ) == 0 );
+}
+
+void ipmi_cache_invalidate( ipmi_cache_epoch epoch )
+{
+    configASSERT( epoch < IPMI_CACHE_EPOCHS );
+
+    taskENTER_CRITICAL();
+    ipmi_cache_count[epoch]++;
+    taskEXIT_CRITICAL();
+}
+
+uint8_t ipmi_cache_lookup( const ipmi_msg * req, ipmi_cache_epoch epoch, ipmi_msg * resp, uint32_t * tag )
+{
+    uint32_t hash;
+    const ipmi_cache_entry * entry;
+
+    configASSERT( epoch < IPMI_CACHE_EPOCHS );
+
+    /* Read before the handler runs, a change while it does makes its response stale at once */
+    *tag = ipmi_cache_count[epoch];
+    if ( req->data_len > IPMI_CACHE_REQ_MAX ) {
+        return 0;
+    }
+
+    hash = prvCacheHash( req );
+    entry = &ipmi_cache[hash & ( IPMI_CACHE_ENTRIES - 1 )];
+    if ( !prvCacheMatch( entry, req, hash ) || ( entry->epoch != epoch ) || ( entry->tag != *tag ) ) {
+        return 0;
+    }
+
+    resp->completion_code = IPMI_CC_OK;
+    resp->data_len = entry->data_len;
+    memcpy( resp->data, entry->data, entry->data_len );
+    return 1;
+}
+
+void ipmi_cache_store( const ipmi_msg * req, ipmi_cache_epoch epoch, uint32_t tag, const ipmi_msg * resp )
+{
+    uint32_t hash;
+    ipmi_cache_entry * entry;
+
+    if ( ( req->data_len > IPMI_CACHE_REQ_MAX ) || ( resp->completion_code != IPMI_CC_OK ) ) {
+        return;
+    }
+
+    /* Last one in wins the slot */
+    hash = prvCacheHash( req );
+    entry = &ipmi_cache[hash & ( IPMI_CACHE_ENTRIES - 1 )];
+    entry->hash = hash;
+    entry->tag = tag;
+    entry->lun = req->dest_LUN;
+    entry->netfn = req->netfn;
+    entry->cmd = req->cmd;
+    entry->epoch = epoch;
+    entry->req_len = req->data_len;
+    memcpy( entry->req, req->data, req->data_len );
+    entry->data_len = resp->data_len;
+    memcpy( entry->data, resp->data, resp->data_len );
+}
@@ -0,0 +1,211 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file ipmi_dispatch.c
+ *
+ * @brief IPMI handler lookup
+ *
+ * Indexes the handler records of the .ipmi_handlers section and the ones registered at run time, and
+ * finds the one of a (lun, netfn, cmd) key. Each LUN has its own commands, in the same table.
+ * Besides configASSERT and critical sections it doesn't use the kernel, so it also builds natively against the host shim
+ * (make bench-host, see host/bench_host.c).
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "ipmb.h"
+#include "ipmi.h"
+#include "prof.h"
+
+/* Handler records registered with IPMI_HANDLER(), placed by the
+   linker between these symbols (see afcipm.ld) */
+extern const t_req_handler_record __ipmi_handlers_start[];
+extern const t_req_handler_record __ipmi_handlers_end[];
+
+/* Open-addressing hash table built at boot from the handler records.
+   Each slot holds the index of a record, the section ones first and
+   then the run time ones, so the whole lookup structure costs
+   IPMI_HANDLER_HASH_SIZE bytes of RAM besides the run time records. */
+static uint8_t handler_index[IPMI_HANDLER_HASH_SIZE];
+/* Records of the .ipmi_handlers section */
+static uint8_t handler_count;
+/* Handlers added by ipmi_register_handler(), a free one has no
+   netfn/cmd pair in the index */
+static t_req_handler_record runtime_handlers[IPMI_RUNTIME_HANDLERS];
+static uint8_t runtime_used[IPMI_RUNTIME_HANDLERS];
+
+#define IPMI_HANDLER_SLOT_EMPTY 0xFF
+/* Left by ipmi_unregister_handler(), the probe sequences go on past it */
+#define IPMI_HANDLER_SLOT_DELETED 0xFE
+
+/* Multiplicative (Fibonacci) hash of the (lun, netfn, cmd) key (netfn
+   is 6 bits wide), the product taken modulo 2^32 (unsigned long is
+   wider on a host build) */
+#define IPMI_HANDLER_HASH(lun, netfn, cmd) \
+  ((uint8_t)((uint32_t)((((uint32_t)(lun) << 14) | ((uint32_t)(netfn) << 8) | (cmd)) * 2654435761UL) >> (32 - IPMI_HANDLER_HASH_BITS)))
+
+/* Record of an index entry */
+static const t_req_handler_record * ipmi_handler_record ( uint8_t index ){
+  if ( index < handler_count ){
+    return &__ipmi_handlers_start[index];
+  }
+  return &runtime_handlers[index - handler_count];
+}
+
+/**
+ * @brief Walks the probe sequence of a (lun, netfn, cmd) key.
+ *
+ * @param free Set to the first empty or deleted slot seen, where the
+ * key would be inserted. May be NULL.
+ *
+ * @return Slot of the key, IPMI_HANDLER_HASH_SIZE if it's not there.
+ */
+static uint16_t ipmi_find_slot ( uint8_t lun, uint8_t netfn, uint8_t cmd, uint16_t * free ){
+  uint8_t slot = IPMI_HANDLER_HASH(lun, netfn, cmd);
+  uint8_t probes;
+  uint8_t index;
+  const t_req_handler_record * record;
+
+  if ( free ){
+    *free = IPMI_HANDLER_HASH_SIZE;
+  }
+
+  for ( probes = 0; probes < IPMI_HANDLER_HASH_SIZE; probes++ ){
+    index = handler_index[slot];
+    if ( index >= IPMI_HANDLER_SLOT_DELETED ){
+      if ( free && ( *free == IPMI_HANDLER_HASH_SIZE ) ){
+        *free = slot;
+      }
+      if ( index == IPMI_HANDLER_SLOT_EMPTY ){
+        break;
+      }
+    }else{
+      record = ipmi_handler_record( index );
+      if ( (record->netfn == netfn) && (record->cmd == cmd) && (record->lun == lun) ){
+        return slot;
+      }
+    }
+
+    slot = (slot + 1) & (IPMI_HANDLER_HASH_SIZE - 1);
+  }
+
+  return IPMI_HANDLER_HASH_SIZE;
+}
+
+/** 
+ * @brief Finds a handler associated with a given LUN, netfunction and command.
+ * 
+ * @param lun LUN the request is addressed to (its dest_LUN)
+ * @param netfn 8-bit network function code
+ * @param cmd 8-bit command code
+ * 
+ * The (lun, netfn, cmd) key is hashed into the index built by
+ * ipmi_build_handler_index(), so the lookup takes constant time on
+ * average, hit or miss.
+ *
+ * @return Pointer to the record of the function which will handle this command, or NULL if there's none.
+ */
+const t_req_handler_record * ipmi_retrieve_handler(uint8_t lun, uint8_t netfn, uint8_t cmd){
+  PROF_SCOPE( PROF_IPMI_LOOKUP );
+  uint16_t slot = ipmi_find_slot( lun, netfn, cmd, NULL );
+
+  if ( slot == IPMI_HANDLER_HASH_SIZE ){
+    return 0;
+  }
+  return ipmi_handler_record( handler_index[slot] );
+}
+
+/**
+ * @brief Indexes the handler records from the .ipmi_handlers section
+ * into the lookup hash table. Must run before the dispatcher starts.
+ */
+void ipmi_build_handler_index ( void ){
+  uint8_t i;
+  uint16_t slot;
+  uint16_t found;
+
+  handler_count = __ipmi_handlers_end - __ipmi_handlers_start;
+
+  /* Keep the load factor low enough so probe sequences stay short,
+     with every run time handler registered too */
+  configASSERT( handler_count + IPMI_RUNTIME_HANDLERS <= (IPMI_HANDLER_HASH_SIZE * 3) / 4 );
+
+  memset( handler_index, IPMI_HANDLER_SLOT_EMPTY, sizeof(handler_index) );
+  memset( runtime_used, 0, sizeof(runtime_used) );
+
+  for ( i = 0; i < handler_count; i++ ){
+    found = ipmi_find_slot( __ipmi_handlers_start[i].lun, __ipmi_handlers_start[i].netfn, __ipmi_handlers_start[i].cmd, &slot );
+    /* Each (lun, netfn, cmd) key must be registered only once */
+    configASSERT( found == IPMI_HANDLER_HASH_SIZE );
+    (void) found;
+    handler_index[slot] = i;
+  }
+}
+
+uint8_t ipmi_register_handler ( uint8_t lun, uint8_t netfn, uint8_t cmd, t_req_handler fn, uint8_t flags ){
+  uint16_t slot;
+  uint8_t i;
+  uint8_t ret = 0;
+
+  taskENTER_CRITICAL();
+  for ( i = 0; ( i < IPMI_RUNTIME_HANDLERS ) && runtime_used[i]; i++ ){
+  }
+  if ( ( i < IPMI_RUNTIME_HANDLERS ) && ( lun < IPMI_LUNS ) &&
+       ( ipmi_find_slot( lun, netfn, cmd, &slot ) == IPMI_HANDLER_HASH_SIZE ) ){
+    /* The record is complete before the dispatcher can find it */
+    runtime_handlers[i].lun = lun;
+    runtime_handlers[i].netfn = netfn;
+    runtime_handlers[i].cmd = cmd;
+    runtime_handlers[i].flags = flags;
+    runtime_handlers[i].req_handler = fn;
+    runtime_used[i] = 1;
+    handler_index[slot] = handler_count + i;
+    ret = 1;
+  }
+  taskEXIT_CRITICAL();
+
+  return ret;
+}
+
+uint8_t ipmi_unregister_handler ( uint8_t lun, uint8_t netfn, uint8_t cmd ){
+  uint16_t slot;
+  uint8_t ret = 0;
+
+  taskENTER_CRITICAL();
+  slot = ipmi_find_slot( lun, netfn, cmd, NULL );
+  /* The section handlers stay */
+  if ( ( slot != IPMI_HANDLER_HASH_SIZE ) && ( handler_index[slot] >= handler_count ) ){
+    /* The record is left as it is, the dispatcher may have just found it */
+    runtime_used[handler_index[slot] - handler_count] = 0;
+    handler_index[slot] = IPMI_HANDLER_SLOT_DELETED;
+    ret = 1;
+  }
+  taskEXIT_CRITICAL();
+
+  return ret;
+}
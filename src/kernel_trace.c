@@ -0,0 +1,241 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file kernel_trace.c
+ *
+ * @brief Scheduler, queue and interrupt trace recorder
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Project includes */
+#include "chip.h"
+#include "kernel_trace.h"
+#include "log.h"
+#include "ram_sections.h"
+
+#if configAPP_KERNEL_TRACE
+
+#define KERNEL_TRACE_MAGIC          0x4B545243  /* "KTRC" */
+
+static uint8_t kernel_trace_ring[KERNEL_TRACE_LEN] __RAM_AHB_NOINIT;
+/*! @brief Position in the ring, kept with it across a soft reset (#magic is only right once a trace was started) */
+static struct {
+    uint32_t magic;
+    uint32_t head;                          /*!< Bytes written since the trace started, free running */
+    uint32_t tail;                          /*!< Start of the oldest record, free running */
+    uint32_t base;                          /*!< Cycle count the delta of the oldest record is relative to */
+    uint32_t last;                          /*!< Cycle count of the newest record */
+} kernel_trace_pos __RAM_AHB_NOINIT;
+static volatile uint8_t kernel_trace_on;
+/* The ring oldest first, in up to two parts, while it's streamed to the log */
+static log_block kernel_trace_blocks[2];
+static volatile uint8_t kernel_trace_streaming;
+
+static void prvKernelTraceSent( log_block * block )
+{
+    (void) block;
+    kernel_trace_streaming--;
+}
+
+static uint8_t prvKernelTraceByte( uint32_t pos )
+{
+    return kernel_trace_ring[pos & ( KERNEL_TRACE_LEN - 1 )];
+}
+
+/* Overwrites the oldest record: its delta moves to the base, so the one after it keeps its time */
+static void prvKernelTraceDrop( void )
+{
+    uint32_t pos = kernel_trace_pos.tail;
+    uint32_t delta = 0;
+    uint8_t shift = 0;
+    uint8_t header = prvKernelTraceByte( pos );
+    uint8_t byte;
+
+    pos += 2;
+    do {
+        byte = prvKernelTraceByte( pos++ );
+        delta |= (uint32_t) ( byte & 0x7F ) << shift;
+        shift += 7;
+    } while ( byte & 0x80 );
+
+    kernel_trace_pos.base += delta;
+    kernel_trace_pos.tail = pos + ( ( header & KERNEL_TRACE_HAS_ARG ) ? 2 : 0 );
+}
+
+void kernel_trace_record( uint8_t event, uint8_t id, uint32_t arg )
+{
+    uint8_t rec[KERNEL_TRACE_RECORD_MAX];
+    uint32_t delta;
+    uint32_t now;
+    uint32_t pos;
+    uint8_t len = 2;
+    uint8_t i;
+    UBaseType_t mask;
+
+    if ( !kernel_trace_on ) {
+        return;
+    }
+
+    /* Called from tasks, the scheduler and interrupts, the mask also covers nesting */
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    now = DWT->CYCCNT;
+    delta = now - kernel_trace_pos.last;
+    kernel_trace_pos.last = now;
+
+    rec[0] = event;
+    rec[1] = id;
+    while ( delta >= 0x80 ) {
+        rec[len++] = ( delta & 0x7F ) | 0x80;
+        delta >>= 7;
+    }
+    rec[len++] = delta;
+    arg &= 0xFFFF;
+    if ( arg != 0 ) {
+        rec[0] |= KERNEL_TRACE_HAS_ARG;
+        rec[len++] = arg & 0xFF;
+        rec[len++] = arg >> 8;
+    }
+
+    while ( KERNEL_TRACE_LEN - ( kernel_trace_pos.head - kernel_trace_pos.tail ) < len ) {
+        prvKernelTraceDrop();
+    }
+    pos = kernel_trace_pos.head;
+    for ( i = 0; i < len; i++ ) {
+        kernel_trace_ring[( pos + i ) & ( KERNEL_TRACE_LEN - 1 )] = rec[i];
+    }
+    kernel_trace_pos.head = pos + len;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+}
+
+void kernel_trace_isr( uint8_t event )
+{
+    kernel_trace_record( event, __get_IPSR() & 0xFF, 0 );
+}
+
+void kernel_trace_span_record( uint8_t event, uint8_t span, uint16_t corr )
+{
+    if ( corr != 0 ) {
+        kernel_trace_record( event, span, corr );
+    }
+}
+
+void kernel_trace_corr_set( uint16_t corr )
+{
+    vTaskSetApplicationTaskTag( NULL, (TaskHookFunction_t) (uint32_t) corr );
+}
+
+uint16_t kernel_trace_corr( void )
+{
+    return (uint32_t) xTaskGetApplicationTaskTag( NULL );
+}
+
+void kernel_trace_enable( uint8_t enable )
+{
+    if ( enable && kernel_trace_streaming ) {
+        return;
+    }
+    if ( enable ) {
+        kernel_trace_on = 0;
+        /* Timestamps come from the core cycle counter */
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        kernel_trace_pos.head = 0;
+        kernel_trace_pos.tail = 0;
+        kernel_trace_pos.last = DWT->CYCCNT;
+        kernel_trace_pos.base = kernel_trace_pos.last;
+        kernel_trace_pos.magic = KERNEL_TRACE_MAGIC;
+    }
+    kernel_trace_on = enable;
+}
+
+uint16_t kernel_trace_length( void )
+{
+    if ( kernel_trace_pos.magic != KERNEL_TRACE_MAGIC ) {
+        return 0;
+    }
+    return kernel_trace_pos.head - kernel_trace_pos.tail;
+}
+
+uint32_t kernel_trace_base( void )
+{
+    return kernel_trace_pos.base;
+}
+
+uint8_t kernel_trace_read( uint16_t offset, uint8_t * buf, uint8_t len )
+{
+    uint16_t held = kernel_trace_length();
+    uint8_t i;
+
+    if ( kernel_trace_on || ( offset >= held ) ) {
+        return 0;
+    }
+
+    if ( len > held - offset ) {
+        len = held - offset;
+    }
+    for ( i = 0; i < len; i++ ) {
+        buf[i] = prvKernelTraceByte( kernel_trace_pos.tail + offset + i );
+    }
+    return len;
+}
+
+uint8_t kernel_trace_stream( void )
+{
+    uint32_t oldest;
+    uint16_t held = kernel_trace_length();
+    uint8_t total;
+    uint8_t parts;
+
+    if ( kernel_trace_on || kernel_trace_streaming || ( held == 0 ) ) {
+        return 0;
+    }
+
+    oldest = kernel_trace_pos.tail & ( KERNEL_TRACE_LEN - 1 );
+    LOG( "ktrace,stream,%u,%u,%x", held, configCPU_CLOCK_HZ / 1000000, kernel_trace_pos.base );
+
+    kernel_trace_blocks[0].data = &kernel_trace_ring[oldest];
+    kernel_trace_blocks[0].len = ( KERNEL_TRACE_LEN - oldest < held ) ? KERNEL_TRACE_LEN - oldest : held;
+    kernel_trace_blocks[1].data = kernel_trace_ring;
+    kernel_trace_blocks[1].len = held - kernel_trace_blocks[0].len;
+
+    /* Counted before queueing, the first one may be sent right away */
+    total = ( kernel_trace_blocks[1].len != 0 ) ? 2 : 1;
+    kernel_trace_streaming = total;
+    for ( parts = 0; parts < total; parts++ ) {
+        kernel_trace_blocks[parts].tag = LOG_BLOCK_KERNEL_TRACE;
+        kernel_trace_blocks[parts].done = prvKernelTraceSent;
+        if ( !log_send_block( &kernel_trace_blocks[parts] ) ) {
+            break;
+        }
+    }
+    if ( parts < total ) {
+        /* The queued ones still count down */
+        portENTER_CRITICAL();
+        kernel_trace_streaming -= total - parts;
+        portEXIT_CRITICAL();
+    }
+    return parts != 0;
+}
+
+#endif
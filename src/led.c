@@ -0,0 +1,340 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file led.c
+ *
+ * @brief FRU LED states, run by the TIMER1 match interrupt
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Project includes */
+#include "chip.h"
+#include "board_defs.h"
+#include "gpio.h"
+#include "led.h"
+#include "config_store.h"
+#include "clock.h"
+
+#define LED_TIMER                   LPC_TIMER1
+#define LED_TIMER_IRQ               TIMER1_IRQn
+#define LED_TIMER_PCLK              SYSCTL_PCLK_TIMER1
+#define LED_TIMER_MATCH             0
+/*! @brief Override kept in the settings: states & #LED_STATE_OVERRIDE, function, on duration, color */
+#define LED_CONFIG_LEN              4
+/*! @brief Timer counts per second, so the counter is in ms */
+#define LED_TIMER_HZ                1000
+
+/*! @brief Units of the blink and lamp test durations, in timer counts */
+#define LED_BLINK_UNIT              10
+#define LED_LAMP_TEST_UNIT          100
+
+/*! @brief Pin and capabilities of each LED */
+static const struct {
+    uint8_t port;
+    uint8_t pin;
+    led_caps caps;
+} led_hw[LED_COUNT] = {
+    [LED_BLUE]  = { ledBLUE_PORT, ledBLUE_PIN, { 1 << LED_COLOR_BLUE, LED_COLOR_BLUE, LED_COLOR_BLUE } },
+    [LED_RED]   = { ledRED_PORT, ledRED_PIN, { 1 << LED_COLOR_RED, LED_COLOR_RED, LED_COLOR_RED } },
+    [LED_GREEN] = { ledGREEN_PORT, ledGREEN_PIN, { 1 << LED_COLOR_GREEN, LED_COLOR_GREEN, LED_COLOR_GREEN } },
+};
+
+/*! @brief States of each LED, changed by the tasks in a critical section (the timer interrupt is masked by it)
+ * and only read by the interrupt, except the lamp test bit which it clears when the test ends */
+static led_state led_states[LED_COUNT];
+
+/*! @brief LEDs whose state changed, the interrupt restarts them */
+static volatile uint8_t led_restart;
+
+/*! @name Interrupt only
+ * @{
+ */
+static uint8_t led_lit;                     /*!< LEDs on */
+static uint8_t led_timed;                   /*!< LEDs with a transition at #led_next */
+static uint32_t led_next[LED_COUNT];        /*!< Timer count of the next transition */
+/*! @} */
+
+static void prvLEDDrive( uint8_t led, uint8_t on )
+{
+    gpio_write( led_hw[led].port, led_hw[led].pin, on );
+    if ( on ) {
+        led_lit |= ( 1 << led );
+    } else {
+        led_lit &= ~( 1 << led );
+    }
+}
+
+/* Enters the state in effect, from its start */
+static void prvLEDStart( uint8_t led, uint32_t now )
+{
+    const led_state * state = &led_states[led];
+    const led_pattern * pattern = ( state->states & LED_STATE_OVERRIDE ) ? &state->override : &state->local;
+
+    led_timed &= ~( 1 << led );
+
+    if ( state->states & LED_STATE_LAMP_TEST ) {
+        prvLEDDrive( led, 1 );
+        led_next[led] = now + state->lamp_test_duration * LED_LAMP_TEST_UNIT;
+        led_timed |= ( 1 << led );
+        return;
+    }
+
+    if ( pattern->function == LED_FUNC_OFF ) {
+        prvLEDDrive( led, 0 );
+    } else if ( pattern->function == LED_FUNC_ON ) {
+        prvLEDDrive( led, 1 );
+    } else {
+        /* Blinks start with the on part */
+        prvLEDDrive( led, 1 );
+        led_next[led] = now + pattern->on_duration * LED_BLINK_UNIT;
+        led_timed |= ( 1 << led );
+    }
+}
+
+/* The transition at led_next is due */
+static void prvLEDExpire( uint8_t led, uint32_t now )
+{
+    led_state * state = &led_states[led];
+    const led_pattern * pattern = ( state->states & LED_STATE_OVERRIDE ) ? &state->override : &state->local;
+    uint8_t on;
+
+    if ( state->states & LED_STATE_LAMP_TEST ) {
+        /* Back to whatever the LED was doing */
+        state->states &= ~LED_STATE_LAMP_TEST;
+        prvLEDStart( led, now );
+        return;
+    }
+
+    /* From the transition time, not from now, so a late interrupt doesn't stretch the pattern */
+    on = !( led_lit & ( 1 << led ) );
+    prvLEDDrive( led, on );
+    led_next[led] += ( on ? pattern->on_duration : pattern->function ) * LED_BLINK_UNIT;
+}
+
+void TIMER1_IRQHandler( void )
+{
+    uint32_t now;
+    uint32_t next;
+    uint8_t restart;
+    uint8_t first;
+    uint8_t led;
+
+    Chip_TIMER_ClearMatch( LED_TIMER, LED_TIMER_MATCH );
+
+    /* Also pended by the state changes, with no match */
+    restart = led_restart;
+    led_restart = 0;
+
+    for ( ;; ) {
+        now = Chip_TIMER_ReadCount( LED_TIMER );
+
+        for ( led = 0; led < LED_COUNT; led++ ) {
+            if ( restart & ( 1 << led ) ) {
+                prvLEDStart( led, now );
+            } else if ( ( led_timed & ( 1 << led ) ) && ( (int32_t) ( led_next[led] - now ) <= 0 ) ) {
+                prvLEDExpire( led, now );
+            }
+        }
+        restart = 0;
+
+        if ( led_timed == 0 ) {
+            Chip_TIMER_MatchDisableInt( LED_TIMER, LED_TIMER_MATCH );
+            return;
+        }
+
+        /* Wake up at the earliest transition */
+        first = 1;
+        for ( led = 0; led < LED_COUNT; led++ ) {
+            if ( ( led_timed & ( 1 << led ) ) && ( first || ( (int32_t) ( led_next[led] - next ) < 0 ) ) ) {
+                next = led_next[led];
+                first = 0;
+            }
+        }
+        Chip_TIMER_SetMatch( LED_TIMER, LED_TIMER_MATCH, next );
+        Chip_TIMER_MatchEnableInt( LED_TIMER, LED_TIMER_MATCH );
+
+        /* The match only fires on equality, run again if the counter already got there */
+        if ( (int32_t) ( next - Chip_TIMER_ReadCount( LED_TIMER ) ) > 0 ) {
+            return;
+        }
+    }
+}
+
+/* Timer ticks at LED_TIMER_HZ on the current peripheral clock */
+static void prvLEDClock( void )
+{
+    Chip_TIMER_PrescaleSet( LED_TIMER, Chip_Clock_GetPeripheralClockRate( LED_TIMER_PCLK ) / LED_TIMER_HZ - 1 );
+}
+
+void led_init( void )
+{
+    uint8_t saved[LED_CONFIG_LEN];
+    uint8_t led;
+
+    for ( led = 0; led < LED_COUNT; led++ ) {
+        gpio_set_dir( led_hw[led].port, led_hw[led].pin, 1 );
+        led_states[led].states = LED_STATE_LOCAL;
+        led_states[led].local.function = LED_FUNC_OFF;
+        led_states[led].local.color = led_hw[led].caps.local_color;
+        led_states[led].override.color = led_hw[led].caps.override_color;
+        /* Override set by the Shelf Manager before the reset */
+        if ( config_get( CONFIG_KEY_LED( led ), saved, LED_CONFIG_LEN ) ) {
+            led_states[led].states |= saved[0] & LED_STATE_OVERRIDE;
+            led_states[led].override.function = saved[1];
+            led_states[led].override.on_duration = saved[2];
+            led_states[led].override.color = saved[3];
+        }
+    }
+
+    Chip_TIMER_Init( LED_TIMER );
+    Chip_TIMER_Reset( LED_TIMER );
+    prvLEDClock();
+    clock_register( prvLEDClock );
+    Chip_TIMER_Enable( LED_TIMER );
+
+    NVIC_SetPriority( LED_TIMER_IRQ, LED_IRQ_PRIORITY );
+    NVIC_EnableIRQ( LED_TIMER_IRQ );
+
+    led_restart = ( 1 << LED_COUNT ) - 1;
+    NVIC_SetPendingIRQ( LED_TIMER_IRQ );
+}
+
+const led_caps * led_get_caps( uint8_t led )
+{
+    if ( led >= LED_COUNT ) {
+        return NULL;
+    }
+    return &led_hw[led].caps;
+}
+
+static uint8_t prvLEDValidPattern( uint8_t function, uint8_t on_duration )
+{
+    if ( ( function == LED_FUNC_OFF ) || ( function == LED_FUNC_ON ) ) {
+        return 1;
+    }
+    return ( function <= LED_FUNC_BLINK_MAX ) && ( on_duration > 0 ) && ( on_duration <= LED_FUNC_BLINK_MAX );
+}
+
+uint8_t led_set_local( uint8_t led, uint8_t function, uint8_t on_duration )
+{
+    if ( ( led >= LED_COUNT ) || !prvLEDValidPattern( function, on_duration ) ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    led_states[led].local.function = function;
+    led_states[led].local.on_duration = on_duration;
+    led_restart |= ( 1 << led );
+    taskEXIT_CRITICAL();
+
+    NVIC_SetPendingIRQ( LED_TIMER_IRQ );
+    return 1;
+}
+
+uint8_t led_set_override( uint8_t led, uint8_t function, uint8_t on_duration, uint8_t color )
+{
+    uint8_t saved[LED_CONFIG_LEN];
+    uint8_t first = led;
+    uint8_t last = led;
+    led_state * state;
+
+    if ( led == LED_ALL ) {
+        first = 0;
+        last = LED_COUNT - 1;
+    } else if ( led >= LED_COUNT ) {
+        return 0;
+    }
+
+    if ( function == LED_FUNC_LAMP_TEST ) {
+        if ( on_duration > LED_LAMP_TEST_MAX ) {
+            return 0;
+        }
+    } else if ( ( function != LED_FUNC_LOCAL ) && !prvLEDValidPattern( function, on_duration ) ) {
+        return 0;
+    }
+    if ( ( color != LED_COLOR_DONT_CHANGE ) && ( color != LED_COLOR_DEFAULT ) ) {
+        for ( led = first; led <= last; led++ ) {
+            if ( ( color > LED_COLOR_WHITE ) || !( led_hw[led].caps.colors & ( 1 << color ) ) ) {
+                return 0;
+            }
+        }
+    }
+
+    taskENTER_CRITICAL();
+    for ( led = first; led <= last; led++ ) {
+        state = &led_states[led];
+
+        if ( function == LED_FUNC_LAMP_TEST ) {
+            state->states |= LED_STATE_LAMP_TEST;
+            state->lamp_test_duration = on_duration;
+        } else if ( function == LED_FUNC_LOCAL ) {
+            state->states &= ~LED_STATE_OVERRIDE;
+        } else {
+            state->states |= LED_STATE_OVERRIDE;
+            state->override.function = function;
+            state->override.on_duration = on_duration;
+        }
+
+        if ( color == LED_COLOR_DEFAULT ) {
+            state->override.color = led_hw[led].caps.override_color;
+        } else if ( color != LED_COLOR_DONT_CHANGE ) {
+            state->override.color = color;
+        }
+        led_restart |= ( 1 << led );
+    }
+    taskEXIT_CRITICAL();
+
+    NVIC_SetPendingIRQ( LED_TIMER_IRQ );
+
+    /* Lamp tests end by themselves, the rest is kept across a reset */
+    if ( function != LED_FUNC_LAMP_TEST ) {
+        for ( led = first; led <= last; led++ ) {
+            state = &led_states[led];
+            saved[0] = state->states & LED_STATE_OVERRIDE;
+            saved[1] = state->override.function;
+            saved[2] = state->override.on_duration;
+            saved[3] = state->override.color;
+            config_set( CONFIG_KEY_LED( led ), saved, LED_CONFIG_LEN );
+        }
+    }
+    return 1;
+}
+
+uint8_t led_get_state( uint8_t led, led_state * state )
+{
+    if ( led >= LED_COUNT ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    *state = led_states[led];
+    taskEXIT_CRITICAL();
+    return 1;
+}
+
+void prvToggleLED( LED_id led )
+{
+    /* Straight to the port registers, callable with the interrupts disabled */
+    gpio_toggle( led_hw[led].port, led_hw[led].pin );
+}
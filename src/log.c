@@ -0,0 +1,314 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file log.c
+ *
+ * @brief Binary log ring and its DMA drain to UART0
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "board_defs.h"
+#include "boot_time.h"
+#include "periodic.h"
+#include "log.h"
+#include "clock.h"
+#include "ram_sections.h"
+
+/*! @brief Records not sent yet, read by the GPDMA (so in the AHB SRAM) */
+static uint8_t log_ring[LOG_RING_LEN] __RAM_AHB_NOINIT;
+/* Bytes written and bytes sent, free running; the DMA transfer in flight starts at log_tail */
+static uint32_t log_head;
+static uint32_t log_tail;
+static uint32_t log_dma_len;
+/* Queued blocks, oldest first; the transfer in flight is the first one when log_dma_block is set */
+static log_block * log_blocks;
+static log_block * log_blocks_last;
+static uint8_t log_dma_block;
+static uint8_t log_seq;
+static uint32_t log_drops;
+static uint8_t log_dma_ch;
+static volatile uint8_t log_on;
+
+/* Starts a transfer of the oldest bytes of the ring if the DMA is idle, called under the interrupt mask */
+static void prvLogDrain( void )
+{
+    uint32_t off = log_tail & ( LOG_RING_LEN - 1 );
+    uint32_t end = log_head;
+    uint32_t len;
+
+    if ( !log_on || ( log_dma_len != 0 ) ) {
+        return;
+    }
+
+    /* The oldest block goes once the ring is sent up to the end of its header */
+    if ( log_blocks != NULL ) {
+        if ( log_tail == log_blocks->pos ) {
+            log_dma_block = 1;
+            log_dma_len = log_blocks->len;
+            Chip_GPDMA_Transfer( LPC_GPDMA, log_dma_ch, (uint32_t) log_blocks->data, GPDMA_CONN_UART0_Tx,
+                                 GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA, log_blocks->len );
+            return;
+        }
+        end = log_blocks->pos;
+    }
+
+    len = end - log_tail;
+    if ( len == 0 ) {
+        return;
+    }
+
+    /* Up to the end of the ring, the rest goes with the next transfer */
+    if ( len > LOG_RING_LEN - off ) {
+        len = LOG_RING_LEN - off;
+    }
+    if ( len > LOG_DMA_MAX ) {
+        len = LOG_DMA_MAX;
+    }
+    log_dma_len = len;
+    Chip_GPDMA_Transfer( LPC_GPDMA, log_dma_ch, (uint32_t) &log_ring[off], GPDMA_CONN_UART0_Tx,
+                         GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA, len );
+}
+
+static void prvLogPeriodic( void * arg )
+{
+    UBaseType_t mask;
+
+    (void) arg;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    prvLogDrain();
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+}
+
+static periodic_job log_job = PERIODIC_JOB( "Log", prvLogPeriodic, NULL, LOG_DRAIN_PERIOD, 0 );
+
+/* Stamps a record or block header with the sequence and timestamp and copies it into the ring, called under
+ * the interrupt mask so both go in ring order. The sequence number is taken even if there's no room. */
+static uint8_t prvLogPut( uint8_t * rec, uint32_t len )
+{
+    uint32_t off;
+    uint32_t first;
+    uint32_t now;
+
+    rec[2] = log_seq++;
+    now = BOOT_TIME_TIMER->TC;
+    memcpy( &rec[5], &now, 4 );
+    if ( LOG_RING_LEN - ( log_head - log_tail ) < len ) {
+        return 0;
+    }
+    off = log_head & ( LOG_RING_LEN - 1 );
+    first = ( len < LOG_RING_LEN - off ) ? len : LOG_RING_LEN - off;
+    memcpy( &log_ring[off], rec, first );
+    memcpy( log_ring, &rec[first], len - first );
+    log_head += len;
+    return 1;
+}
+
+void log_record( uint16_t id, uint8_t nargs, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3 )
+{
+    uint8_t rec[LOG_RECORD_MAX];
+    UBaseType_t mask;
+
+    rec[0] = LOG_SYNC;
+    rec[1] = nargs;
+    rec[3] = id & 0xFF;
+    rec[4] = id >> 8;
+    /* Little endian core, the arguments go as they are */
+    memcpy( &rec[LOG_HEADER_LEN], &a0, 4 );
+    memcpy( &rec[LOG_HEADER_LEN + 4], &a1, 4 );
+    memcpy( &rec[LOG_HEADER_LEN + 8], &a2, 4 );
+    memcpy( &rec[LOG_HEADER_LEN + 12], &a3, 4 );
+
+    /* Called from tasks and interrupts */
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    if ( !prvLogPut( rec, LOG_HEADER_LEN + 4 * nargs ) ) {
+        log_drops++;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+}
+
+uint8_t log_send_block( log_block * block )
+{
+    uint8_t header[LOG_HEADER_LEN];
+    log_block * queued;
+    uint8_t ret = 0;
+    UBaseType_t mask;
+
+    if ( ( block->len == 0 ) || ( block->len > LOG_BLOCK_MAX ) ) {
+        return 0;
+    }
+
+    header[0] = LOG_SYNC_BLOCK;
+    header[1] = block->tag;
+    header[3] = block->len & 0xFF;
+    header[4] = block->len >> 8;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    for ( queued = log_blocks; ( queued != NULL ) && ( queued != block ); queued = queued->next ) {
+    }
+    if ( ( queued == NULL ) && prvLogPut( header, LOG_HEADER_LEN ) ) {
+        block->pos = log_head;
+        block->next = NULL;
+        if ( log_blocks == NULL ) {
+            log_blocks = block;
+        } else {
+            log_blocks_last->next = block;
+        }
+        log_blocks_last = block;
+        prvLogDrain();
+        ret = 1;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+
+    return ret;
+}
+
+/* Baud divisor for the new peripheral clock; the GPDMA is held meanwhile, a THR write with DLAB set would go to DLL */
+static void prvLogClock( void )
+{
+    LPC_GPDMA->CH[log_dma_ch].CONFIG |= GPDMA_DMACCxConfig_H;
+    while ( LPC_GPDMA->CH[log_dma_ch].CONFIG & GPDMA_DMACCxConfig_A ) {
+    }
+    Chip_UART_SetBaud( LOG_UART, LOG_UART_BAUD );
+    LPC_GPDMA->CH[log_dma_ch].CONFIG &= ~GPDMA_DMACCxConfig_H;
+}
+
+void log_init( void )
+{
+    Chip_IOCON_PinMux( LPC_IOCON, UART_DEBUG_PORT, UART_DEBUG_TX_PIN, IOCON_MODE_INACT, UART_DEBUG_PIN_FUNC );
+    Chip_IOCON_PinMux( LPC_IOCON, UART_DEBUG_PORT, UART_DEBUG_RX_PIN, IOCON_MODE_INACT, UART_DEBUG_PIN_FUNC );
+    Chip_UART_Init( LOG_UART );
+    Chip_UART_SetBaud( LOG_UART, LOG_UART_BAUD );
+    Chip_UART_ConfigData( LOG_UART, UART_LCR_WLEN8 | UART_LCR_SBS_1BIT );
+    /* The TX FIFO raises the DMA requests */
+    Chip_UART_SetupFIFOS( LOG_UART, UART_FCR_FIFO_EN | UART_FCR_TX_RS | UART_FCR_DMAMODE_SEL | UART_FCR_TRG_LEV0 );
+    Chip_UART_TXEnable( LOG_UART );
+
+    /* The ADC may have set the GPDMA up already (Chip_GPDMA_Init resets every channel) */
+    if ( !( LPC_SYSCTL->PCONP & ( 1 << SYSCTL_CLOCK_GPDMA ) ) ) {
+        Chip_GPDMA_Init( LPC_GPDMA );
+    }
+    log_dma_ch = Chip_GPDMA_GetFreeChannel( LPC_GPDMA, GPDMA_CONN_UART0_Tx );
+    NVIC_SetPriority( DMA_IRQn, DMA_IRQ_PRIORITY );
+    NVIC_EnableIRQ( DMA_IRQn );
+
+    clock_register( prvLogClock );
+
+    log_on = 1;
+    periodic_start( &log_job );
+}
+
+uint32_t log_dropped( void )
+{
+    return log_drops;
+}
+
+uint32_t log_last( uint8_t * data, uint32_t len )
+{
+    uint32_t off;
+    uint32_t first;
+
+    if ( len > log_head ) {
+        len = log_head;
+    }
+    off = ( log_head - len ) & ( LOG_RING_LEN - 1 );
+    first = ( len < LOG_RING_LEN - off ) ? len : LOG_RING_LEN - off;
+    memcpy( data, &log_ring[off], first );
+    memcpy( &data[first], log_ring, len - first );
+    return len;
+}
+
+void log_dma_irq( void )
+{
+    log_block * block;
+
+    if ( !log_on || ( log_dma_len == 0 ) || !Chip_GPDMA_IntGetStatus( LPC_GPDMA, GPDMA_STAT_INT, log_dma_ch ) ) {
+        return;
+    }
+
+    /* A bus error loses the transfer, the bytes are skipped all the same */
+    Chip_GPDMA_Interrupt( LPC_GPDMA, log_dma_ch );
+    if ( log_dma_block ) {
+        log_dma_block = 0;
+        block = log_blocks;
+        log_blocks = block->next;
+        /* May queue it again */
+        if ( block->done != NULL ) {
+            block->done( block );
+        }
+    } else {
+        log_tail += log_dma_len;
+    }
+    log_dma_len = 0;
+    prvLogDrain();
+}
+
+void log_panic_flush( void )
+{
+    uint32_t off;
+    uint32_t end;
+    uint32_t len;
+
+    if ( !log_on ) {
+        return;
+    }
+
+    /* Lets the transfer in flight end, its interrupt won't be taken */
+    if ( log_dma_len != 0 ) {
+        while ( LPC_GPDMA->ENBLDCHNS & ( 1 << log_dma_ch ) ) {
+        }
+        if ( log_dma_block ) {
+            log_dma_block = 0;
+            log_blocks = log_blocks->next;
+        } else {
+            log_tail += log_dma_len;
+        }
+        log_dma_len = 0;
+    }
+
+    /* Blocks in their place, their done callbacks aren't called */
+    while ( ( log_head != log_tail ) || ( log_blocks != NULL ) ) {
+        end = log_head;
+        if ( log_blocks != NULL ) {
+            if ( log_tail == log_blocks->pos ) {
+                Chip_UART_SendBlocking( LOG_UART, log_blocks->data, log_blocks->len );
+                log_blocks = log_blocks->next;
+                continue;
+            }
+            end = log_blocks->pos;
+        }
+        off = log_tail & ( LOG_RING_LEN - 1 );
+        len = end - log_tail;
+        if ( len > LOG_RING_LEN - off ) {
+            len = LOG_RING_LEN - off;
+        }
+        Chip_UART_SendBlocking( LOG_UART, &log_ring[off], len );
+        log_tail += len;
+    }
+}
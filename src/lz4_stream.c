@@ -0,0 +1,166 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file lz4_stream.c
+ *
+ * @brief Streaming LZ4 block decoder
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* Project includes */
+#include "lz4_stream.h"
+
+/* Shortest match, added to the match length of the token */
+#define LZ4_MIN_MATCH               4
+/* Length nibble telling more length bytes follow */
+#define LZ4_LEN_MORE                15
+
+enum lz4_state {
+    LZ4_TOKEN,
+    LZ4_LITERAL_LEN,
+    LZ4_LITERALS,
+    LZ4_OFFSET_LO,
+    LZ4_OFFSET_HI,
+    LZ4_MATCH_LEN,
+    LZ4_MATCH,
+    LZ4_DONE,
+    LZ4_FAILED,
+};
+
+void lz4_stream_init( lz4_stream * stream, uint32_t total )
+{
+    stream->total = total;
+    stream->left = total;
+    stream->count = 0;
+    stream->offset = 0;
+    stream->token = 0;
+    stream->state = ( total == 0 ) ? LZ4_DONE : LZ4_TOKEN;
+}
+
+/* Literals or match of the sequence known, the state that copies them */
+static uint8_t prvLz4Copy( lz4_stream * stream, uint8_t state )
+{
+    return ( stream->count > stream->left ) ? LZ4_FAILED : state;
+}
+
+uint16_t lz4_stream_feed( lz4_stream * stream, const uint8_t * in, uint16_t len, const lz4_sink * sink )
+{
+    uint16_t i = 0;
+    uint8_t byte;
+
+    for ( ;; ) {
+        /* States writing output */
+        switch ( stream->state ) {
+        case LZ4_LITERALS:
+            while ( stream->count != 0 ) {
+                if ( ( i == len ) || !sink->put( in[i] ) ) {
+                    return i;
+                }
+                i++;
+                stream->count--;
+                stream->left--;
+            }
+            /* The last sequence of a block is its literals */
+            stream->state = ( stream->left == 0 ) ? LZ4_DONE : LZ4_OFFSET_LO;
+            continue;
+        case LZ4_MATCH:
+            while ( stream->count != 0 ) {
+                if ( !sink->put( sink->get( stream->offset ) ) ) {
+                    return i;
+                }
+                stream->count--;
+                stream->left--;
+            }
+            stream->state = ( stream->left == 0 ) ? LZ4_DONE : LZ4_TOKEN;
+            continue;
+        case LZ4_DONE:
+        case LZ4_FAILED:
+            if ( i < len ) {
+                stream->state = LZ4_FAILED;
+            }
+            return i;
+        default:
+            break;
+        }
+
+        /* States reading the sequence header */
+        if ( i == len ) {
+            return i;
+        }
+        byte = in[i++];
+        switch ( stream->state ) {
+        case LZ4_TOKEN:
+            stream->token = byte;
+            stream->count = byte >> 4;
+            stream->state = ( stream->count == LZ4_LEN_MORE ) ? LZ4_LITERAL_LEN : prvLz4Copy( stream, LZ4_LITERALS );
+            break;
+        case LZ4_LITERAL_LEN:
+            stream->count += byte;
+            if ( byte != 255 ) {
+                stream->state = prvLz4Copy( stream, LZ4_LITERALS );
+            }
+            break;
+        case LZ4_OFFSET_LO:
+            stream->offset = byte;
+            stream->state = LZ4_OFFSET_HI;
+            break;
+        case LZ4_OFFSET_HI:
+            stream->offset |= byte << 8;
+            if ( ( stream->offset == 0 ) || ( stream->offset > stream->total - stream->left ) ) {
+                stream->state = LZ4_FAILED;
+                break;
+            }
+            stream->count = stream->token & 0x0F;
+            if ( stream->count == LZ4_LEN_MORE ) {
+                stream->state = LZ4_MATCH_LEN;
+            } else {
+                stream->count += LZ4_MIN_MATCH;
+                stream->state = prvLz4Copy( stream, LZ4_MATCH );
+            }
+            break;
+        case LZ4_MATCH_LEN:
+            stream->count += byte;
+            if ( byte != 255 ) {
+                stream->count += LZ4_MIN_MATCH;
+                stream->state = prvLz4Copy( stream, LZ4_MATCH );
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+uint8_t lz4_stream_pending( const lz4_stream * stream )
+{
+    return ( stream->state == LZ4_MATCH ) && ( stream->count != 0 );
+}
+
+uint8_t lz4_stream_done( const lz4_stream * stream )
+{
+    return stream->state == LZ4_DONE;
+}
+
+uint8_t lz4_stream_failed( const lz4_stream * stream )
+{
+    return stream->state == LZ4_FAILED;
+}
@@ -0,0 +1,112 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file mem_pool.c
+ *
+ * @brief Fixed size block pools
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* Project includes */
+#include "mem_pool.h"
+
+/*! @brief Pools registered by #mem_pool_init */
+static mem_pool * mem_pools[MEM_POOL_MAX];
+static uint8_t mem_pool_num;
+
+void mem_pool_init( mem_pool * pool, const char * name, void * storage, uint16_t block_size, uint16_t count )
+{
+    uint8_t * block;
+    uint16_t i;
+
+    configASSERT( ( block_size >= sizeof(void *) ) && ( ( block_size & 0x03 ) == 0 ) );
+    configASSERT( ( ( (uint32_t) storage ) & 0x03 ) == 0 );
+
+    pool->name = name;
+    pool->base = storage;
+    pool->block_size = block_size;
+    pool->count = count;
+    pool->used = 0;
+    pool->high_water = 0;
+    pool->exhausted = 0;
+
+    /* Each free block holds the address of the next one */
+    pool->free = NULL;
+    for ( i = count; i > 0; i-- ) {
+        block = &pool->base[( i - 1 ) * block_size];
+        *(void **) block = pool->free;
+        pool->free = block;
+    }
+
+    configASSERT( mem_pool_num < MEM_POOL_MAX );
+    mem_pools[mem_pool_num++] = pool;
+}
+
+void * mem_pool_alloc( mem_pool * pool )
+{
+    UBaseType_t mask;
+    void * block;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    block = pool->free;
+    if ( block ) {
+        pool->free = *(void **) block;
+        if ( ++pool->used > pool->high_water ) {
+            pool->high_water = pool->used;
+        }
+    } else {
+        pool->exhausted++;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+
+    return block;
+}
+
+void mem_pool_free( mem_pool * pool, void * block )
+{
+    UBaseType_t mask;
+
+    configASSERT( mem_pool_owns( pool, block ) );
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    *(void **) block = pool->free;
+    pool->free = block;
+    pool->used--;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+}
+
+uint8_t mem_pool_owns( const mem_pool * pool, const void * block )
+{
+    const uint8_t * p = block;
+
+    return ( p >= pool->base ) && ( p < &pool->base[pool->count * pool->block_size] ) &&
+           ( ( ( p - pool->base ) % pool->block_size ) == 0 );
+}
+
+const mem_pool * mem_pool_get( uint8_t index )
+{
+    if ( index >= mem_pool_num ) {
+        return NULL;
+    }
+    return mem_pools[index];
+}
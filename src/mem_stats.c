@@ -0,0 +1,91 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file mem_stats.c
+ *
+ * @brief Heap usage and allocation failures
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Project includes */
+#include "mem_stats.h"
+#include "ram_sections.h"
+#include "metrics.h"
+
+/* Heap storage (configAPPLICATION_ALLOCATED_HEAP), out of the local SRAM */
+uint8_t ucHeap[ configTOTAL_HEAP_SIZE ] __RAM_AHB_NOINIT;
+
+/* Caller and size of the last failed allocation, from traceMALLOC */
+static void * last_failed_caller;
+static size_t last_failed_size;
+
+static malloc_failure failures;
+
+static uint32_t prvMemStatsFree( void )
+{
+    return xPortGetFreeHeapSize();
+}
+
+static uint32_t prvMemStatsMinFree( void )
+{
+    return xPortGetMinimumEverFreeHeapSize();
+}
+
+METRIC_GAUGE_FN( "heap.free", prvMemStatsFree );
+METRIC_GAUGE_FN( "heap.min_free", prvMemStatsMinFree );
+METRIC_COUNTER( "heap.malloc_fail", failures.count );
+
+void mem_stats_get_heap( heap_stats * stats )
+{
+    size_t largest;
+
+    stats->total = configTOTAL_HEAP_SIZE - portBYTE_ALIGNMENT;
+    stats->free_blocks = xPortGetFreeBlockCount( &largest );
+    stats->largest_free = largest;
+    stats->free = xPortGetFreeHeapSize();
+    stats->min_free = xPortGetMinimumEverFreeHeapSize();
+}
+
+void mem_stats_get_malloc_failure( malloc_failure * failure )
+{
+    taskENTER_CRITICAL();
+    *failure = failures;
+    taskEXIT_CRITICAL();
+}
+
+void mem_stats_malloc_trace( void * caller, size_t size )
+{
+    last_failed_caller = caller;
+    last_failed_size = size;
+}
+
+void mem_stats_malloc_failed( void )
+{
+    taskENTER_CRITICAL();
+    if ( failures.count++ == 0 ) {
+        failures.caller = (uint32_t) last_failed_caller;
+        failures.size = last_failed_size;
+    }
+    taskEXIT_CRITICAL();
+}
@@ -0,0 +1,154 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file metrics.c
+ *
+ * @brief Metrics registry dump, see metrics.h
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "metrics.h"
+
+extern const metric_desc __metrics_start[];
+extern const metric_desc __metrics_end[];
+
+/* LEB128: 7 bits per byte, LS group first, the high bit set on all bytes but the last */
+#define METRIC_VARINT_MAX           5
+
+uint16_t metrics_count( void )
+{
+    return __metrics_end - __metrics_start;
+}
+
+static uint32_t prvMetricRead( const metric_desc * desc, uint8_t i )
+{
+    if ( desc->read != NULL ) {
+        return desc->read();
+    }
+    switch ( desc->size ) {
+    case 1:
+        return ( (const volatile uint8_t *) desc->value )[i];
+    case 2:
+        return ( (const volatile uint16_t *) desc->value )[i];
+    default:
+        return ( (const volatile uint32_t *) desc->value )[i];
+    }
+}
+
+static uint8_t prvMetricVarint( uint8_t * buf, uint32_t value )
+{
+    uint8_t len = 0;
+
+    while ( value >= 0x80 ) {
+        buf[len++] = ( value & 0x7F ) | 0x80;
+        value >>= 7;
+    }
+    buf[len++] = value;
+    return len;
+}
+
+/* Descriptor TLV of a metric, the name cut to the room left if @p cut is set
+ * @return bytes written, 0 if it doesn't fit */
+static uint8_t prvMetricName( const metric_desc * desc, uint8_t * buf, uint8_t size, uint8_t cut )
+{
+    uint8_t len = strlen( desc->name );
+
+    if ( size < 3 + len ) {
+        if ( !cut || ( size < 3 + 1 ) ) {
+            return 0;
+        }
+        len = size - 3;
+    }
+    buf[0] = desc->type;
+    buf[1] = 1 + len;
+    buf[2] = desc->count;
+    memcpy( &buf[3], desc->name, len );
+    return 3 + len;
+}
+
+/* Values TLV of a metric, from one of its elements
+ * @return bytes written, 0 if not even one element fits; *done is set to the elements written */
+static uint8_t prvMetricValues( const metric_desc * desc, uint8_t first, uint8_t * buf, uint8_t size, uint8_t * done )
+{
+    uint8_t tmp[METRIC_VARINT_MAX];
+    uint8_t len = 2;
+    uint8_t n;
+    uint8_t i;
+
+    for ( i = first; i < desc->count; i++ ) {
+        n = prvMetricVarint( tmp, prvMetricRead( desc, i ) );
+        if ( len + n > size ) {
+            break;
+        }
+        memcpy( &buf[len], tmp, n );
+        len += n;
+    }
+
+    *done = i - first;
+    if ( *done == 0 ) {
+        return 0;
+    }
+    buf[0] = desc->type;
+    buf[1] = len - 2;
+    return len;
+}
+
+uint8_t metrics_dump( uint8_t page, uint16_t * element, uint8_t * buf, uint8_t size )
+{
+    const metric_desc * desc;
+    uint16_t first = 0;
+    uint8_t elements;
+    uint8_t done;
+    uint8_t len = 0;
+    uint8_t n;
+
+    for ( desc = __metrics_start; desc < __metrics_end; desc++, first += elements ) {
+        elements = ( page == METRICS_PAGE_VALUES ) ? desc->count : 1;
+        if ( *element >= first + elements ) {
+            continue;
+        }
+
+        if ( page == METRICS_PAGE_VALUES ) {
+            n = prvMetricValues( desc, *element - first, &buf[len], size - len, &done );
+        } else {
+            /* A name too long for an empty page would never be dumped */
+            n = prvMetricName( desc, &buf[len], size - len, len == 0 );
+            done = 1;
+        }
+        if ( n == 0 ) {
+            return len;
+        }
+        len += n;
+        *element += done;
+        if ( *element < first + elements ) {
+            /* Split histogram, the page is full */
+            return len;
+        }
+    }
+
+    *element = METRICS_END;
+    return len;
+}
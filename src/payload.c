@@ -0,0 +1,203 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file payload.c
+ *
+ * @brief Payload power sequencer, a thread of the timer task woken by the power good interrupts
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* Project includes */
+#include "chip.h"
+#include "board_defs.h"
+#include "gpio.h"
+#include "gpio_irq.h"
+#include "timer_wheel.h"
+#include "pt.h"
+#include "payload.h"
+
+typedef struct payload_rail {
+    uint8_t en_port;
+    uint8_t en_pin;
+    uint8_t pg_port;                        /*!< #PAYLOAD_NO_PG if there's no power good signal */
+    uint8_t pg_pin;
+    uint16_t timeout_ms;
+} payload_rail;
+
+#define PAYLOAD_RAIL_ENTRY( name, en_port, en_pin, pg_port, pg_pin, timeout ) \
+    { en_port, en_pin, pg_port, pg_pin, timeout },
+
+static const payload_rail payload_rails[] = {
+    PAYLOAD_RAILS( PAYLOAD_RAIL_ENTRY )
+};
+
+#define PAYLOAD_RAIL_COUNT          ( sizeof(payload_rails) / sizeof(payload_rails[0]) )
+
+/* Only changed in the timer task */
+static volatile uint8_t payload_state_cur = PAYLOAD_OFF;
+static uint8_t payload_target;              /*!< 1 powering up, 0 powering down */
+static uint8_t payload_level;               /*!< Rails enabled, from the first one */
+static uint8_t payload_wait_rail;           /*!< Rail of the step in progress */
+static uint8_t payload_failed;
+static payload_callback payload_done;
+static uint32_t payload_fault_count;
+
+static PT_THREAD( prvPayloadSequence( pt_thread * pt ) );
+
+static pt_thread payload_thread = PT_THREAD_INIT( prvPayloadSequence, NULL );
+
+static uint8_t prvPayloadPowerGood( const payload_rail * rail )
+{
+    return gpio_read( rail->pg_port, rail->pg_pin );
+}
+
+/* Rail of the step in progress where it was asked to be, by its power good signal */
+static uint8_t prvPayloadRailSettled( void )
+{
+    const payload_rail * rail = &payload_rails[payload_wait_rail];
+
+    return ( rail->pg_port != PAYLOAD_NO_PG ) && ( prvPayloadPowerGood( rail ) == payload_target );
+}
+
+/* The step in progress is over, with the rail where it was asked to be or timed out */
+static void prvPayloadStepDone( void )
+{
+    const payload_rail * rail = &payload_rails[payload_wait_rail];
+
+    if ( rail->pg_port == PAYLOAD_NO_PG ) {
+        /* Settled */
+        return;
+    }
+    gpio_irq_enable( rail->pg_port, rail->pg_pin, GPIO_IRQ_NONE );
+
+    /* A power good edge whose wake couldn't be pended still gets here at the timeout */
+    if ( prvPayloadPowerGood( rail ) != payload_target ) {
+        payload_fault_count++;
+        if ( payload_target ) {
+            /* Take the rails already up down again */
+            payload_failed = 1;
+            payload_target = 0;
+            payload_state_cur = PAYLOAD_POWERING_DOWN;
+        }
+    }
+}
+
+static void prvPayloadFinish( void )
+{
+    payload_callback done = payload_done;
+
+    payload_state_cur = payload_target ? PAYLOAD_ON : PAYLOAD_OFF;
+    payload_done = NULL;
+    if ( done ) {
+        done( payload_target || !payload_failed );
+    }
+}
+
+/* One rail after the other towards payload_target, which a failed rail turns to 0 */
+static PT_THREAD( prvPayloadSequence( pt_thread * pt ) )
+{
+    const payload_rail * rail;
+    TickType_t wait;
+
+    PT_BEGIN( pt );
+
+    while ( payload_target ? ( payload_level < PAYLOAD_RAIL_COUNT ) : ( payload_level > 0 ) ) {
+        payload_wait_rail = payload_target ? payload_level++ : --payload_level;
+        rail = &payload_rails[payload_wait_rail];
+        gpio_write( rail->en_port, rail->en_pin, payload_target );
+
+        if ( rail->pg_port != PAYLOAD_NO_PG ) {
+            gpio_irq_enable( rail->pg_port, rail->pg_pin, payload_target ? GPIO_IRQ_RISING : GPIO_IRQ_FALLING );
+        }
+        wait = rail->timeout_ms / portTICK_PERIOD_MS;
+        if ( wait == 0 ) {
+            wait = 1;
+        }
+        pt_timeout( pt, wait );
+        /* Checked after unmasking, an edge in between is caught either way */
+        PT_WAIT_UNTIL( pt, prvPayloadRailSettled() || pt_expired( pt ) );
+
+        prvPayloadStepDone();
+    }
+    prvPayloadFinish();
+
+    PT_END( pt );
+}
+
+static void prvPayloadPowerGoodEdge( void * arg, portBASE_TYPE * woken )
+{
+    const payload_rail * rail = arg;
+
+    /* Once per step, the sequence checks the signal from here */
+    gpio_irq_enable( rail->pg_port, rail->pg_pin, GPIO_IRQ_NONE );
+    pt_wake_from_isr( &payload_thread, woken );
+}
+
+static void prvPayloadStart( void * done, uint32_t on )
+{
+    const payload_rail * rail = &payload_rails[payload_wait_rail];
+
+    /* Whatever the step in progress was waiting for doesn't matter anymore */
+    if ( rail->pg_port != PAYLOAD_NO_PG ) {
+        gpio_irq_enable( rail->pg_port, rail->pg_pin, GPIO_IRQ_NONE );
+    }
+
+    payload_target = on;
+    payload_done = (payload_callback) done;
+    payload_failed = 0;
+    payload_state_cur = on ? PAYLOAD_POWERING_UP : PAYLOAD_POWERING_DOWN;
+    pt_start( &payload_thread );
+}
+
+void payload_init( void )
+{
+    const payload_rail * rail;
+    uint8_t i;
+
+    for ( i = 0; i < PAYLOAD_RAIL_COUNT; i++ ) {
+        rail = &payload_rails[i];
+        gpio_clear( rail->en_port, rail->en_pin );
+        gpio_set_dir( rail->en_port, rail->en_pin, 1 );
+        if ( rail->pg_port != PAYLOAD_NO_PG ) {
+            gpio_set_dir( rail->pg_port, rail->pg_pin, 0 );
+            gpio_irq_register( rail->pg_port, rail->pg_pin, prvPayloadPowerGoodEdge, (void *) rail );
+        }
+    }
+}
+
+uint8_t payload_power( uint8_t on, payload_callback done )
+{
+    return xTimerPendFunctionCall( prvPayloadStart, (void *) done, on, 0 ) == pdPASS;
+}
+
+payload_state payload_get_state( void )
+{
+    return payload_state_cur;
+}
+
+uint32_t payload_faults( void )
+{
+    return payload_fault_count;
+}
@@ -0,0 +1,110 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file periodic.c
+ *
+ * @brief Periodic jobs sharing a single software timer
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* Project includes */
+#include "periodic.h"
+
+/* A job is due once the tick is at most half the tick range past its due tick (the ticks wrap) */
+#define PERIODIC_REACHED( now, tick )   ( (TickType_t) ( ( now ) - ( tick ) ) < ( portMAX_DELAY / 2 ) )
+
+static periodic_job * periodic_jobs[PERIODIC_MAX_JOBS];
+static volatile uint8_t periodic_num;
+static TimerHandle_t periodic_timer;
+/* A rearm for the next tick is in the timer command queue, the jobs started meanwhile don't post another one */
+static volatile uint8_t periodic_kick_pending;
+
+static void prvPeriodicRun( TimerHandle_t timer )
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    periodic_job * job;
+    uint8_t i;
+
+    /* Before reading the jobs, so one started from now on posts its own rearm */
+    periodic_kick_pending = 0;
+
+    for ( i = 0; i < periodic_num; i++ ) {
+        job = periodic_jobs[i];
+
+        if ( PERIODIC_REACHED( now, job->due ) ) {
+            job->run( job->arg );
+            job->runs++;
+            job->due += job->period;
+            while ( PERIODIC_REACHED( now, job->due ) ) {
+                job->due += job->period;
+                job->skipped++;
+            }
+        }
+
+        if ( (TickType_t) ( job->due - now ) < wait ) {
+            wait = job->due - now;
+        }
+    }
+
+    if ( wait != portMAX_DELAY ) {
+        /* Allowed from a timer callback with no block time */
+        xTimerChangePeriod( timer, wait, 0 );
+    }
+}
+
+uint8_t periodic_start( periodic_job * job )
+{
+    uint8_t kick;
+
+    configASSERT( job->period > 0 );
+
+    if ( periodic_timer == NULL ) {
+        periodic_timer = xTimerCreate( "Periodic", 1, pdFALSE, NULL, prvPeriodicRun );
+        configASSERT( periodic_timer );
+    }
+
+    job->due = xTaskGetTickCount() + job->phase;
+    job->runs = 0;
+    job->skipped = 0;
+
+    taskENTER_CRITICAL();
+    if ( periodic_num >= PERIODIC_MAX_JOBS ) {
+        taskEXIT_CRITICAL();
+        return 0;
+    }
+    periodic_jobs[periodic_num] = job;
+    periodic_num++;
+    kick = !periodic_kick_pending;
+    periodic_kick_pending = 1;
+    taskEXIT_CRITICAL();
+
+    /* Run the timer on the next tick, it then rearms itself for the job due first, this one included */
+    if ( kick && ( xTimerChangePeriod( periodic_timer, 1, 0 ) != pdPASS ) ) {
+        /* Timer command queue full (configTIMER_QUEUE_LENGTH), the next job started retries */
+        periodic_kick_pending = 0;
+    }
+    return 1;
+}
@@ -0,0 +1,79 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file poh.c
+ *
+ * @brief Power-on hours and lifetime IPMB error totals, kept by the config store
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "ipmb.h"
+#include "config_store.h"
+#include "periodic.h"
+#include "poh.h"
+
+/*! @brief Counter totalling an IPMB statistic */
+typedef struct poh_stat {
+    uint8_t counter;
+    ipmb_stat_id stat;
+} poh_stat;
+
+static const poh_stat poh_stats[] = {
+    { CONFIG_COUNTER_IPMB_RX_ERRORS, IPMB_STAT_RX_CHKSUM_ERR },
+    { CONFIG_COUNTER_IPMB_RX_ERRORS, IPMB_STAT_RX_MALFORMED },
+    { CONFIG_COUNTER_IPMB_TX_FAILURES, IPMB_STAT_TX_FAILURES },
+    { CONFIG_COUNTER_IPMB_TIMEOUTS, IPMB_STAT_TIMEOUTS },
+    { CONFIG_COUNTER_I2C_RECOVERIES, IPMB_STAT_I2C_BUS_RECOVERIES },
+};
+
+#define POH_STATS                   ( sizeof(poh_stats) / sizeof(poh_stats[0]) )
+
+/*! @brief Value of each statistic at the last run */
+static uint32_t poh_last[POH_STATS];
+
+static void prvPOHCount( void * arg )
+{
+    uint32_t value;
+    uint8_t i;
+
+    (void) arg;
+
+    config_counter_add( CONFIG_COUNTER_POH, 1 );
+    for ( i = 0; i < POH_STATS; i++ ) {
+        value = ipmb_get_stat( poh_stats[i].stat );
+        /* Lower after a Clear IPMB Statistics, all of it is new */
+        config_counter_add( poh_stats[i].counter, ( value >= poh_last[i] ) ? value - poh_last[i] : value );
+        poh_last[i] = value;
+    }
+    config_counter_sync();
+}
+
+static periodic_job poh_job = PERIODIC_JOB( "POH", prvPOHCount, NULL, POH_PERIOD, POH_PERIOD );
+
+void poh_init( void )
+{
+    periodic_start( &poh_job );
+}
@@ -0,0 +1,90 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file prof.c
+ *
+ * @brief Cycle count probes on the hot paths
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "prof.h"
+
+#if configAPP_PROFILE
+
+static prof_stats prof_table[PROF_PROBE_COUNT];
+
+void prof_init( void )
+{
+    uint8_t i;
+
+    for ( i = 0; i < PROF_PROBE_COUNT; i++ ) {
+        prof_table[i].min = UINT32_MAX;
+    }
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void prof_end( const prof_scope * scope )
+{
+    uint32_t cycles = DWT->CYCCNT - scope->start;
+    prof_stats * stats = &prof_table[scope->probe];
+    UBaseType_t mask;
+
+    /* Probes run in tasks and in interrupts */
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    stats->count++;
+    stats->total += cycles;
+    if ( cycles < stats->min ) {
+        stats->min = cycles;
+    }
+    if ( cycles > stats->max ) {
+        stats->max = cycles;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+}
+
+uint8_t prof_get( uint8_t probe, prof_stats * stats, uint8_t clear )
+{
+    UBaseType_t mask;
+
+    if ( probe >= PROF_PROBE_COUNT ) {
+        return 0;
+    }
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    *stats = prof_table[probe];
+    if ( clear ) {
+        memset( &prof_table[probe], 0, sizeof(prof_stats) );
+        prof_table[probe].min = UINT32_MAX;
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+
+    return 1;
+}
+
+#endif
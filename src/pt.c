@@ -0,0 +1,117 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file pt.c
+ *
+ * @brief Stackless threads of the state machine drivers, all run in the timer task
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* Project includes */
+#include "timer_wheel.h"
+#include "pt.h"
+
+static void prvPTRun( pt_thread * pt )
+{
+    if ( !pt->running ) {
+        return;
+    }
+    if ( pt->fn( pt ) == PT_ENDED ) {
+        pt->running = 0;
+        wheel_timer_stop( &pt->timer );
+    }
+}
+
+static void prvPTPended( void * param, uint32_t unused )
+{
+    pt_thread * pt = param;
+
+    (void) unused;
+
+    /* A wake from now on pends another run, it may come after the thread checked its condition */
+    pt->pended = 0;
+    prvPTRun( pt );
+}
+
+static void prvPTExpired( void * arg )
+{
+    pt_thread * pt = arg;
+
+    pt->expired = 1;
+    prvPTRun( pt );
+}
+
+void pt_start( pt_thread * pt )
+{
+    wheel_timer_stop( &pt->timer );
+    wheel_timer_init( &pt->timer, prvPTExpired, pt );
+    pt->lc = 0;
+    pt->expired = 0;
+    pt->running = 1;
+    prvPTRun( pt );
+}
+
+uint8_t pt_wake( pt_thread * pt )
+{
+    uint8_t pend;
+
+    taskENTER_CRITICAL();
+    pend = !pt->pended;
+    pt->pended = 1;
+    taskEXIT_CRITICAL();
+
+    if ( pend && ( xTimerPendFunctionCall( prvPTPended, pt, 0, 0 ) != pdPASS ) ) {
+        pt->pended = 0;
+        return 0;
+    }
+    return 1;
+}
+
+uint8_t pt_wake_from_isr( pt_thread * pt, portBASE_TYPE * woken )
+{
+    UBaseType_t mask;
+    uint8_t pend;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    pend = !pt->pended;
+    pt->pended = 1;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+
+    if ( pend && ( xTimerPendFunctionCallFromISR( prvPTPended, pt, 0, woken ) != pdPASS ) ) {
+        pt->pended = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void pt_timeout( pt_thread * pt, TickType_t ticks )
+{
+    pt->expired = 0;
+    wheel_timer_start( &pt->timer, ticks );
+}
+
+uint8_t pt_expired( const pt_thread * pt )
+{
+    return pt->expired;
+}
@@ -0,0 +1,162 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file queue_stats.c
+ *
+ * @brief Queue depth telemetry
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* Project includes */
+#include "queue_stats.h"
+
+typedef struct queue_stats_entry {
+    QueueHandle_t queue;
+    const char * name;
+    uint8_t length;
+    uint8_t high_water;
+    uint8_t senders;                        /*!< Tasks blocked on it since the last operation */
+    TickType_t stamp;                       /*!< Tick of the last operation */
+    uint32_t blocked;
+    uint32_t failed;
+    uint32_t wait_ticks;
+} queue_stats_entry;
+
+static queue_stats_entry queue_stats_table[QUEUE_STATS_MAX];
+static volatile uint8_t queue_stats_used;
+
+uint8_t queue_stats_register( void * queue, const char * name )
+{
+    queue_stats_entry * entry;
+    uint8_t index;
+
+    taskENTER_CRITICAL();
+    index = queue_stats_used;
+    if ( index < QUEUE_STATS_MAX ) {
+        entry = &queue_stats_table[index];
+        entry->queue = queue;
+        entry->name = name;
+        entry->length = uxQueueMessagesWaiting( queue ) + uxQueueSpacesAvailable( queue );
+        entry->high_water = uxQueueMessagesWaiting( queue );
+        entry->stamp = xTaskGetTickCount();
+        /* The hooks only look at the entry once it's counted */
+        queue_stats_used = index + 1;
+        vQueueSetQueueNumber( queue, index + 1 );
+    }
+    taskEXIT_CRITICAL();
+
+    if ( index >= QUEUE_STATS_MAX ) {
+        return 0;
+    }
+    vQueueAddToRegistry( queue, name );
+    return 1;
+}
+
+uint8_t queue_stats_count( void )
+{
+    return queue_stats_used;
+}
+
+uint8_t queue_stats_get( uint8_t index, queue_usage * usage )
+{
+    queue_stats_entry * entry;
+
+    if ( index >= queue_stats_used ) {
+        return 0;
+    }
+    entry = &queue_stats_table[index];
+
+    taskENTER_CRITICAL();
+    /* Blocked senders so far count up to now */
+    entry->wait_ticks += entry->senders * (TickType_t) ( xTaskGetTickCount() - entry->stamp );
+    entry->stamp = xTaskGetTickCount();
+    usage->name = entry->name;
+    usage->length = entry->length;
+    usage->waiting = uxQueueMessagesWaiting( entry->queue );
+    usage->high_water = entry->high_water;
+    usage->blocked = entry->blocked;
+    usage->failed = entry->failed;
+    usage->wait_ticks = entry->wait_ticks;
+    taskEXIT_CRITICAL();
+    return 1;
+}
+
+void queue_stats_clear( uint8_t index )
+{
+    queue_stats_entry * entry;
+
+    if ( index >= queue_stats_used ) {
+        return;
+    }
+    entry = &queue_stats_table[index];
+
+    taskENTER_CRITICAL();
+    entry->high_water = uxQueueMessagesWaiting( entry->queue );
+    entry->blocked = 0;
+    entry->failed = 0;
+    entry->wait_ticks = 0;
+    entry->stamp = xTaskGetTickCount();
+    taskEXIT_CRITICAL();
+}
+
+void queue_stats_hook( uint8_t number, uint8_t waiting, uint8_t senders, queue_stats_op op )
+{
+    queue_stats_entry * entry;
+    UBaseType_t mask;
+    TickType_t now;
+
+    if ( ( number == 0 ) || ( number > queue_stats_used ) ) {
+        return;
+    }
+    entry = &queue_stats_table[number - 1];
+
+    /* Blocking is traced with the scheduler suspended, an interrupt may send to the queue meanwhile */
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    now = xTaskGetTickCountFromISR();
+    entry->wait_ticks += entry->senders * (TickType_t) ( now - entry->stamp );
+    entry->stamp = now;
+
+    switch ( op ) {
+    case QUEUE_STATS_SEND:
+        if ( ( waiting < entry->length ) && ( waiting + 1 > entry->high_water ) ) {
+            entry->high_water = waiting + 1;
+        }
+        break;
+    case QUEUE_STATS_RECEIVE:
+        /* The room left wakes up one of them */
+        if ( senders > 0 ) {
+            senders--;
+        }
+        break;
+    case QUEUE_STATS_BLOCK:
+        entry->blocked++;
+        senders++;
+        break;
+    case QUEUE_STATS_FAIL:
+        entry->failed++;
+        break;
+    }
+    entry->senders = senders;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR( mask );
+}
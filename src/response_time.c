@@ -0,0 +1,215 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file response_time.c
+ *
+ * @brief Worst response time of each task, against the deadline of the task plan
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "boot_time.h"
+#include "timestamp.h"
+#include "periodic.h"
+#include "log.h"
+
+#if configAPP_RESPONSE_TIME
+
+/*! @brief Task of the plan */
+typedef struct response_time_plan {
+    const char * name;
+    uint8_t priority;
+    uint16_t deadline_ms;
+} response_time_plan;
+
+#define RESPONSE_TIME_PLAN_ENTRY( name, priority, instances, period, deadline )    { name, priority, deadline },
+
+static const response_time_plan response_time_plan_table[] = {
+    TASK_PLAN( RESPONSE_TIME_PLAN_ENTRY )
+};
+
+#define RESPONSE_TIME_PLAN_LEN      ( sizeof(response_time_plan_table) / sizeof(response_time_plan_table[0]) )
+
+/*! @brief Measurements, indexed by task number - 1 (the kernel numbers the tasks from 1, in creation order) */
+static response_time_stats response_time_tasks[TASK_PLAN_TASKS];
+/*! @brief Time each task was made ready, while #response_time_pending has its bit */
+static uint32_t response_time_release[TASK_PLAN_TASKS];
+static uint32_t response_time_pending;
+/*! @brief Tasks looked up in the plan already, one bit per task */
+static uint32_t response_time_planned;
+/*! @brief Set by the first check, the hooks do nothing before */
+static uint8_t response_time_running;
+
+void response_time_ready( uint32_t number )
+{
+    /* Tasks beyond the plan aren't followed, neither are they counted */
+    if ( !response_time_running || ( number == 0 ) || ( number > TASK_PLAN_TASKS ) ) {
+        return;
+    }
+    if ( !( response_time_pending & ( 1UL << ( number - 1 ) ) ) ) {
+        response_time_release[number - 1] = timestamp_now();
+        response_time_pending |= 1UL << ( number - 1 );
+    }
+}
+
+void response_time_switched_out( uint32_t number, const char * name, uint8_t blocked )
+{
+    response_time_stats * task;
+    uint32_t elapsed;
+
+    if ( !response_time_running || ( number == 0 ) || ( number > TASK_PLAN_TASKS ) ) {
+        return;
+    }
+
+    task = &response_time_tasks[number - 1];
+    if ( task->number == 0 ) {
+        /* First time seen, the check job looks its deadline up */
+        strncpy( task->name, name, RESPONSE_TIME_NAME_LEN - 1 );
+        task->number = number;
+    }
+
+    if ( !blocked || !( response_time_pending & ( 1UL << ( number - 1 ) ) ) ) {
+        return;
+    }
+    response_time_pending &= ~( 1UL << ( number - 1 ) );
+
+    elapsed = timestamp_elapsed( timestamp_now(), response_time_release[number - 1] );
+    task->wakeups++;
+    if ( elapsed > task->worst_us ) {
+        task->worst_us = elapsed;
+    }
+    if ( ( task->deadline_us != 0 ) && ( elapsed > task->deadline_us ) ) {
+        task->misses++;
+        task->flags |= RESPONSE_TIME_MISSED;
+    }
+}
+
+/* Deadline and priority of a task new to the check, from its name */
+static void prvResponseTimePlan( response_time_stats * task )
+{
+    uint8_t i;
+
+    for ( i = 0; i < RESPONSE_TIME_PLAN_LEN; i++ ) {
+        if ( strncmp( task->name, response_time_plan_table[i].name, RESPONSE_TIME_NAME_LEN - 1 ) == 0 ) {
+            task->priority = response_time_plan_table[i].priority;
+            task->deadline_us = TIMESTAMP_MS( response_time_plan_table[i].deadline_ms );
+            return;
+        }
+    }
+    task->flags |= RESPONSE_TIME_UNPLANNED;
+}
+
+/* Runs in the timer task */
+static void prvResponseTimeCheck( void * arg )
+{
+    response_time_stats * task;
+    uint32_t worst;
+    uint32_t deadline;
+    uint8_t at_risk;
+    uint8_t i;
+
+    (void) arg;
+
+    response_time_running = 1;
+
+    for ( i = 0; i < TASK_PLAN_TASKS; i++ ) {
+        task = &response_time_tasks[i];
+        if ( task->number == 0 ) {
+            continue;
+        }
+
+        taskENTER_CRITICAL();
+        if ( !( response_time_planned & ( 1UL << i ) ) ) {
+            prvResponseTimePlan( task );
+            response_time_planned |= 1UL << i;
+        }
+        worst = task->worst_us;
+        deadline = task->deadline_us;
+        /* Checked against the deadline divided first, so a long one doesn't overflow */
+        at_risk = ( deadline != 0 ) && !( task->flags & RESPONSE_TIME_AT_RISK ) &&
+                  ( worst / RESPONSE_TIME_RISK >= deadline / 100 );
+        if ( at_risk ) {
+            task->flags |= RESPONSE_TIME_AT_RISK;
+        }
+        taskEXIT_CRITICAL();
+
+        if ( at_risk ) {
+            LOG( "rtime,at_risk,%u,%u,%u", task->number, worst, deadline );
+        }
+    }
+}
+
+static periodic_job response_time_job = PERIODIC_JOB( "RTime", prvResponseTimeCheck, NULL, RESPONSE_TIME_PERIOD, RESPONSE_TIME_PERIOD );
+
+void response_time_init( void )
+{
+    periodic_start( &response_time_job );
+}
+
+uint8_t response_time_count( void )
+{
+    uint8_t count = 0;
+    uint8_t i;
+
+    for ( i = 0; i < TASK_PLAN_TASKS; i++ ) {
+        if ( response_time_tasks[i].number != 0 ) {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint8_t response_time_get( uint8_t index, response_time_stats * stats )
+{
+    uint8_t i;
+
+    for ( i = 0; i < TASK_PLAN_TASKS; i++ ) {
+        if ( ( response_time_tasks[i].number != 0 ) && ( index-- == 0 ) ) {
+            taskENTER_CRITICAL();
+            *stats = response_time_tasks[i];
+            taskEXIT_CRITICAL();
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void response_time_clear( void )
+{
+    uint8_t i;
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < TASK_PLAN_TASKS; i++ ) {
+        response_time_tasks[i].worst_us = 0;
+        response_time_tasks[i].wakeups = 0;
+        response_time_tasks[i].misses = 0;
+        response_time_tasks[i].flags &= RESPONSE_TIME_UNPLANNED;
+    }
+    taskEXIT_CRITICAL();
+}
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file rtm.c
+ *
+ * @brief Bridge of the IPMB-L requests to the RTM MMC (outstanding slots, response cache and RTM task)
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* LPCOpen includes (barriers) */
+#include "chip.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmb_frame.h"
+#include "ipmi.h"
+#include "rtm.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "board_defs.h"
+#include "watchdog.h"
+#include "boot_time.h"
+#include "timestamp.h"
+
+#ifdef RTM_I2C
+
+TASK_STACK( rtm_stack, RTM_STACK_DEPTH, 1 );
+
+static rtm_bridge_req rtm_req[RTM_MAX_OUTSTANDING];
+static rtm_cache_entry rtm_cache[RTM_CACHE_LEN];
+static uint32_t rtm_cache_clock;
+static uint8_t rtm_seq;
+/* Each counter is written by a single task, the IPMB RX one or the RTM one */
+static volatile uint32_t rtm_stats[RTM_STAT_COUNT];
+
+#define RTM_STAT_INC( id )  ( rtm_stats[(id)]++ )
+
+/* Request data bytes its answer depends on, 0 if the answer can't be cached */
+static uint8_t prvRTMCacheKey( ipmi_msg * req, uint8_t * key )
+{
+    if ( req->netfn == NETFN_STORAGE ) {
+        if ( ( req->cmd == IPMI_READ_FRU_DATA_CMD ) && ( req->data_len >= 4 ) ) {
+            /* FRU ID, offset and count */
+            memcpy( key, &req->data[0], 4 );
+            return 4;
+        }
+        if ( ( req->cmd == IPMI_GET_FRU_INVENTORY_AREA_INFO_CMD ) && ( req->data_len >= 1 ) ) {
+            key[0] = req->data[0];
+            return 1;
+        }
+    } else if ( ( req->netfn == NETFN_SE ) && ( req->cmd == IPMI_GET_DEVICE_SDR_CMD ) && ( req->data_len >= 6 ) ) {
+        /* Record ID, offset and count, the reservation ID before them is left out */
+        memcpy( key, &req->data[2], 4 );
+        return 4;
+    }
+    return 0;
+}
+
+static uint8_t prvRTMCacheMatch( rtm_cache_entry * entry, ipmi_msg * req, uint8_t * key, uint8_t key_len )
+{
+    return entry->valid && ( entry->netfn == req->netfn ) && ( entry->cmd == req->cmd ) &&
+           ( entry->key_len == key_len ) && ( memcmp( entry->key, key, key_len ) == 0 );
+}
+
+/* Copies the cached answer of a request, 0 if there's none. Called from the IPMB RX task */
+static uint8_t prvRTMCacheLookup( ipmi_msg * req, ipmi_msg * resp )
+{
+    uint8_t key[RTM_CACHE_KEY_MAX];
+    uint8_t key_len = prvRTMCacheKey( req, key );
+    uint8_t hit = 0;
+    uint8_t i;
+
+    if ( key_len == 0 ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < RTM_CACHE_LEN; i++ ) {
+        if ( prvRTMCacheMatch( &rtm_cache[i], req, key, key_len ) ) {
+            rtm_cache[i].age = ++rtm_cache_clock;
+            memcpy( resp, &rtm_cache[i].resp, sizeof(ipmi_msg) );
+            hit = 1;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return hit;
+}
+
+/* Keeps a successful answer, in place of the least recently used one. Called from the RTM task */
+static void prvRTMCacheStore( ipmi_msg * req, ipmi_msg * resp )
+{
+    rtm_cache_entry * victim = &rtm_cache[0];
+    uint8_t key[RTM_CACHE_KEY_MAX];
+    uint8_t key_len = prvRTMCacheKey( req, key );
+    uint8_t i;
+
+    if ( ( key_len == 0 ) || ( resp->completion_code != IPMI_CC_OK ) ) {
+        return;
+    }
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < RTM_CACHE_LEN; i++ ) {
+        if ( !rtm_cache[i].valid || prvRTMCacheMatch( &rtm_cache[i], req, key, key_len ) ) {
+            victim = &rtm_cache[i];
+            break;
+        }
+        if ( rtm_cache[i].age < victim->age ) {
+            victim = &rtm_cache[i];
+        }
+    }
+    victim->valid = 1;
+    victim->netfn = req->netfn;
+    victim->cmd = req->cmd;
+    victim->key_len = key_len;
+    memcpy( victim->key, key, key_len );
+    victim->age = ++rtm_cache_clock;
+    memcpy( &victim->resp, resp, sizeof(ipmi_msg) );
+    taskEXIT_CRITICAL();
+}
+
+static void prvRTMCacheFlush( void )
+{
+    uint8_t i;
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < RTM_CACHE_LEN; i++ ) {
+        rtm_cache[i].valid = 0;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/* Moves a slot from one state to RTM_REQ_DONE, 0 if it isn't in that state (anymore) */
+static uint8_t prvRTMClaim( rtm_bridge_req * slot, uint8_t state )
+{
+    uint8_t claimed;
+
+    taskENTER_CRITICAL();
+    claimed = ( slot->state == state );
+    if ( claimed ) {
+        slot->state = RTM_REQ_DONE;
+    }
+    taskEXIT_CRITICAL();
+
+    return claimed;
+}
+
+/* Answers the original request of a claimed slot on IPMB-L and frees it */
+static void prvRTMAnswer( rtm_bridge_req * slot, ipmi_msg * resp )
+{
+    ipmb_queue_response( &slot->req, resp );
+    __DMB();
+    slot->state = RTM_REQ_FREE;
+}
+
+/* Chain callback, in the deferred work daemon: the frame was sent (or not) and the slot buffers are ours again */
+static void prvRTMSent( xI2C_chain * chain, i2c_err error )
+{
+    rtm_bridge_req * slot = chain->ctx;
+
+    if ( error != i2c_err_SUCCESS ) {
+        /* Answered by the next sweep, unless the RTM got it after all and already answered */
+        taskENTER_CRITICAL();
+        if ( slot->state == RTM_REQ_SENT ) {
+            slot->state = RTM_REQ_FAILED;
+        }
+        taskEXIT_CRITICAL();
+    }
+    __DMB();
+    slot->chain_busy = 0;
+}
+
+/* Proxy handler of the RTM address, in the IPMB RX task: answers from the cache or forwards the request */
+static void prvRTMRequest( ipmi_msg * req )
+{
+    /* Only ever called from the IPMB RX task, they don't need to take its stack */
+    static ipmi_msg resp;
+    static ipmi_msg local;
+    rtm_bridge_req * slot = NULL;
+    uint32_t budget;
+    uint8_t i;
+
+    if ( prvRTMCacheLookup( req, &resp ) ) {
+        RTM_STAT_INC( RTM_STAT_CACHE_HITS );
+        ipmb_queue_response( req, &resp );
+        ipmb_release_msg( req );
+        return;
+    }
+
+    /* A slot is only taken once the driver is done with its chain, the state is set once it's filled */
+    taskENTER_CRITICAL();
+    for ( i = 0; i < RTM_MAX_OUTSTANDING; i++ ) {
+        if ( ( rtm_req[i].state == RTM_REQ_FREE ) && !rtm_req[i].chain_busy ) {
+            slot = &rtm_req[i];
+            slot->chain_busy = 1;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if ( slot == NULL ) {
+        RTM_STAT_INC( RTM_STAT_BUSY );
+        resp.completion_code = IPMI_CC_NODE_BUSY;
+        resp.data_len = 0;
+        ipmb_queue_response( req, &resp );
+        ipmb_release_msg( req );
+        return;
+    }
+
+    if ( ( req->netfn == NETFN_STORAGE ) && ( req->cmd == IPMI_WRITE_FRU_DATA_CMD ) ) {
+        prvRTMCacheFlush();
+    }
+
+    /* Our timeout answer must still reach the requester in time */
+    budget = ipmb_request_budget( req );
+    memcpy( &slot->req, req, sizeof(ipmi_msg) );
+    ipmb_release_msg( req );
+
+    rtm_seq = ( rtm_seq + 1 ) & IPMB_SEQ_MAX;
+    slot->seq = rtm_seq;
+    slot->deadline = timestamp_now() + ( ( budget < RTM_RESP_TIMEOUT_US ) ? budget : RTM_RESP_TIMEOUT_US );
+
+    /* Same request on the local bus, from us and with our own sequence number */
+    memcpy( &local, &slot->req, sizeof(ipmi_msg) );
+    local.dest_addr = RTM_MMC_ADDR;
+    local.src_addr = get_ipmb_addr();
+    local.src_LUN = 0;
+    local.seq = slot->seq;
+
+    slot->xfer.addr = RTM_MMC_ADDR >> 1;
+    slot->xfer.tx_data = slot->frame;
+    slot->xfer.tx_len = ipmb_encode( slot->frame, &local );
+    slot->xfer.rx_data = NULL;
+    slot->xfer.rx_len = 0;
+    slot->chain.xfer = &slot->xfer;
+    slot->chain.count = 1;
+    slot->chain.callback = prvRTMSent;
+    slot->chain.ctx = slot;
+
+    __DMB();
+    slot->state = RTM_REQ_SENT;
+    RTM_STAT_INC( RTM_STAT_FORWARDED );
+    if ( xI2CTransferAsync( RTM_I2C, &slot->chain ) != i2c_err_SUCCESS ) {
+        slot->state = RTM_REQ_FAILED;
+        slot->chain_busy = 0;
+    }
+}
+
+/* Relays an answer of the RTM to the request waiting for it */
+static void prvRTMResponse( ipmi_msg * resp )
+{
+    rtm_bridge_req * slot;
+    uint8_t i;
+
+    for ( i = 0; i < RTM_MAX_OUTSTANDING; i++ ) {
+        slot = &rtm_req[i];
+        if ( ( slot->state == RTM_REQ_SENT ) && ( slot->seq == resp->seq ) && ( resp->src_addr == RTM_MMC_ADDR ) &&
+             ( resp->netfn == slot->req.netfn + 1 ) && ( resp->cmd == slot->req.cmd ) &&
+             prvRTMClaim( slot, RTM_REQ_SENT ) ) {
+            RTM_STAT_INC( RTM_STAT_ANSWERED );
+            if ( ( slot->req.netfn == NETFN_STORAGE ) && ( slot->req.cmd == IPMI_WRITE_FRU_DATA_CMD ) ) {
+                /* A read forwarded in the meantime may have cached the old bytes */
+                prvRTMCacheFlush();
+            } else {
+                prvRTMCacheStore( &slot->req, resp );
+            }
+            prvRTMAnswer( slot, resp );
+            return;
+        }
+    }
+    RTM_STAT_INC( RTM_STAT_UNMATCHED );
+}
+
+/* Answers the slots the RTM didn't answer in time and the ones the local bus couldn't send */
+static void prvRTMSweep( void )
+{
+    static ipmi_msg resp;
+    rtm_bridge_req * slot;
+    uint32_t now = timestamp_now();
+    uint8_t i;
+
+    for ( i = 0; i < RTM_MAX_OUTSTANDING; i++ ) {
+        slot = &rtm_req[i];
+        if ( ( slot->state == RTM_REQ_SENT ) && timestamp_reached( now, slot->deadline ) &&
+             prvRTMClaim( slot, RTM_REQ_SENT ) ) {
+            RTM_STAT_INC( RTM_STAT_TIMEOUTS );
+            resp.completion_code = IPMI_CC_TIMEOUT;
+        } else if ( prvRTMClaim( slot, RTM_REQ_FAILED ) ) {
+            RTM_STAT_INC( RTM_STAT_FAILURES );
+            resp.completion_code = IPMI_CC_DESTINATION_UNAVAILABLE;
+        } else {
+            continue;
+        }
+        /* The RTM may have been pulled out or replaced */
+        prvRTMCacheFlush();
+        resp.data_len = 0;
+        prvRTMAnswer( slot, &resp );
+    }
+}
+
+static void prvRTMTask( void * pvParameters )
+{
+    static ipmi_msg resp;
+    uint8_t * rx_frame;
+    uint8_t rx_len;
+    ipmb_error rx_error;
+    watchdog_id wdg = watchdog_register( "RTM", WATCHDOG_DEADLINE );
+
+    (void) pvParameters;
+
+    vI2CSlaveRegister( RTM_I2C, xTaskGetCurrentTaskHandle() );
+
+    for ( ;; ) {
+        watchdog_checkin( wdg );
+
+        /* Frames are read in place from the driver receive ring, like the IPMB RX task does */
+        rx_len = xI2CSlaveReceive( RTM_I2C, &rx_frame, RTM_SWEEP_PERIOD );
+        if ( rx_len > 0 ) {
+            rx_error = ipmb_decode( &resp, rx_frame, rx_len );
+            vI2CSlaveReleaseFrame( RTM_I2C );
+            if ( ( rx_error == ipmb_error_success ) && IS_RESPONSE( resp ) ) {
+                prvRTMResponse( &resp );
+            } else {
+                RTM_STAT_INC( RTM_STAT_UNMATCHED );
+            }
+        }
+        prvRTMSweep();
+    }
+}
+
+void rtm_init( void )
+{
+    /* IPMB mode, the RTM MMC answers as a master */
+    vI2CInit( RTM_I2C, I2C_Mode_IPMB );
+
+    if ( ipmb_register_proxy( RTM_IPMB_ADDR( get_ipmb_addr() ), prvRTMRequest ) != ipmb_error_success ) {
+        return;
+    }
+    xTaskCreateWithStack( prvRTMTask, (const char*)"RTM", RTM_STACK_DEPTH, ( void * ) NULL, RTM_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( rtm_stack, 0 ) );
+}
+
+uint32_t rtm_get_stat( rtm_stat_id id )
+{
+    if ( id >= RTM_STAT_COUNT ) {
+        return 0;
+    }
+    return rtm_stats[id];
+}
+
+#else
+
+void rtm_init( void )
+{
+}
+
+uint32_t rtm_get_stat( rtm_stat_id id )
+{
+    (void) id;
+    return 0;
+}
+
+#endif /* RTM_I2C */
@@ -0,0 +1,278 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file sdr.c
+ *
+ * @brief Device SDR repository (records, index and reservations)
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "stddef.h"
+#include "string.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "sdr.h"
+#include "threshold.h"
+#include "board_defs.h"
+#include "board_sensors.h"
+#include "hotswap.h"
+#include "ipmi_cache.h"
+#include "device_id.h"
+
+#define SDR_MMC_NAME                DEVICE_MMC_NAME
+/* FRU inventory, IPMB event generator, sensor device */
+#define SDR_MMC_CAPABILITIES        0x29
+
+static const sdr_mc_locator sdr_mmc = SDR_MC_LOCATOR( SDR_MMC_NAME, SDR_MMC_CAPABILITIES );
+
+/* Sensor records, from the board table */
+#define SDR_SENSOR_RECORD( id, bus, addr, driver, period, sdr, name ) \
+    sdr( SENSOR_##id, name ),
+
+static const sdr_full_sensor sdr_sensor[] = {
+    BOARD_SENSORS( SDR_SENSOR_RECORD )
+};
+
+/* FRU Hot Swap sensor: one offset per M-state, all of them sent as events */
+#define SDR_HOT_SWAP_NAME           "FRU Hot Swap"
+
+static const sdr_full_sensor sdr_hot_swap = SDR_FULL_SENSOR( SENSOR_HOT_SWAP, SDR_HOT_SWAP_NAME,
+    .sensor_type = HOTSWAP_SENSOR_TYPE,
+    .event_type = SDR_EVENT_TYPE_SENSOR_SPECIFIC,
+    .capabilities = SDR_CAP_AUTO_REARM | SDR_CAP_EVENTS_GLOBAL,
+    .assert_mask = { 0xFF, 0x00 },
+    .reading_mask = { 0xFF, 0x00 },
+    .units1 = SDR_UNITS_NO_READING );
+
+/* Integer conversion of each sensor, from the same parameters as its record */
+#define SDR_SENSOR_LINEAR( id, bus, addr, driver, period, sdr, name ) \
+    SDR_LINEAR_CONV( sdr##_LINEAR ),
+
+static const sdr_linear sdr_linear_table[] = {
+    BOARD_SENSORS( SDR_SENSOR_LINEAR )
+};
+
+/*! @brief Repository index, the record ID is the position in this table */
+typedef struct sdr_entry {
+    const void * record;
+    uint8_t len;                            /*!< Whole record, header included */
+} sdr_entry;
+
+#define SDR_SENSOR_ENTRY( id, bus, addr, driver, period, sdr, name ) \
+    { &sdr_sensor[SENSOR_##id], SDR_RECORD_LEN( sdr_full_sensor, name ) },
+
+static const sdr_entry sdr_repository[] = {
+    { &sdr_mmc, SDR_RECORD_LEN( sdr_mc_locator, SDR_MMC_NAME ) },
+    BOARD_SENSORS( SDR_SENSOR_ENTRY )
+    { &sdr_hot_swap, SDR_RECORD_LEN( sdr_full_sensor, SDR_HOT_SWAP_NAME ) },
+};
+
+#define SDR_COUNT                   ( sizeof(sdr_repository) / sizeof(sdr_repository[0]) )
+
+/*! @brief Current reservation ID */
+static uint16_t sdr_reservation;
+
+/*! @brief Position right after the last chunk read, see #sdr_locate */
+typedef struct sdr_cursor {
+    uint16_t reservation;                   /*!< Reservation it belongs to */
+    uint16_t record_id;
+    uint16_t next;                          /*!< Record after #record_id */
+    uint8_t offset;
+    uint8_t len;                            /*!< Length of #record_id, 0 when the cursor is unused */
+} sdr_cursor;
+
+static sdr_cursor sdr_pos;
+
+uint16_t sdr_count( void )
+{
+    return SDR_COUNT;
+}
+
+uint8_t sdr_sensor_count( void )
+{
+    return BOARD_SENSOR_COUNT + 1;
+}
+
+uint8_t sdr_record_len( uint16_t record_id )
+{
+    if ( record_id >= SDR_COUNT ) {
+        return 0;
+    }
+    return sdr_repository[record_id].len;
+}
+
+const sdr_full_sensor * sdr_get_sensor( uint8_t sensor )
+{
+    if ( sensor == SENSOR_HOT_SWAP ) {
+        return &sdr_hot_swap;
+    }
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return NULL;
+    }
+    return &sdr_sensor[sensor];
+}
+
+/* Divides, rounding to the nearest integer */
+static int32_t prvSDRDivRound( int32_t num, int32_t den )
+{
+    if ( ( num < 0 ) != ( den < 0 ) ) {
+        return ( num - den / 2 ) / den;
+    }
+    return ( num + den / 2 ) / den;
+}
+
+int32_t sdr_raw_to_milli( uint8_t sensor, uint16_t raw )
+{
+    const sdr_linear * lin;
+    int32_t x;
+    int32_t inner;
+
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+
+    lin = &sdr_linear_table[sensor];
+    x = ( lin->format == SDR_UNITS_2S_COMPLEMENT ) ? (int8_t) raw : ( raw & 0xFF );
+    inner = lin->m * x + lin->b;
+
+    if ( lin->div == 1 ) {
+        return inner * lin->mul;
+    }
+    return prvSDRDivRound( inner, lin->div );
+}
+
+uint8_t sdr_milli_to_raw( uint8_t sensor, int32_t milli )
+{
+    const sdr_linear * lin;
+    int32_t inner;
+    int32_t x;
+    int32_t min;
+    int32_t max;
+
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+
+    lin = &sdr_linear_table[sensor];
+    inner = ( lin->div == 1 ) ? prvSDRDivRound( milli, lin->mul ) : milli * lin->div;
+    x = ( lin->m != 0 ) ? prvSDRDivRound( inner - lin->b, lin->m ) : 0;
+
+    if ( lin->format == SDR_UNITS_2S_COMPLEMENT ) {
+        min = -128;
+        max = 127;
+    } else {
+        min = 0;
+        max = 255;
+    }
+    if ( x < min ) {
+        x = min;
+    } else if ( x > max ) {
+        x = max;
+    }
+    return x & 0xFF;
+}
+
+/* Points the cursor at the start of a record */
+static void prvSDRCursorSet( uint16_t reservation, uint16_t record_id, uint8_t offset )
+{
+    sdr_pos.reservation = reservation;
+    sdr_pos.record_id = record_id;
+    sdr_pos.offset = offset;
+    sdr_pos.len = sdr_record_len( record_id );
+    sdr_pos.next = ( record_id + 1 < SDR_COUNT ) ? record_id + 1 : SDR_RECORD_LAST;
+}
+
+uint8_t sdr_locate( uint16_t reservation, uint16_t record_id, uint8_t offset, uint16_t * next )
+{
+    if ( ( sdr_pos.len == 0 ) || ( sdr_pos.reservation != reservation ) || ( sdr_pos.record_id != record_id ) ||
+         ( sdr_pos.offset != offset ) ) {
+        prvSDRCursorSet( reservation, record_id, offset );
+    }
+    *next = sdr_pos.next;
+    return sdr_pos.len;
+}
+
+void sdr_read( uint16_t record_id, uint8_t offset, uint8_t * data, uint8_t count )
+{
+    const uint8_t * record = sdr_repository[record_id].record;
+    uint8_t i;
+
+    configASSERT( offset + count <= sdr_repository[record_id].len );
+
+    memcpy( data, &record[offset], count );
+
+    /* Where the next chunk should start */
+    if ( ( sdr_pos.record_id == record_id ) && ( sdr_pos.offset == offset ) && ( sdr_pos.len != 0 ) ) {
+        sdr_pos.offset += count;
+        if ( ( sdr_pos.offset == sdr_pos.len ) && ( sdr_pos.next != SDR_RECORD_LAST ) ) {
+            prvSDRCursorSet( sdr_pos.reservation, sdr_pos.next, 0 );
+        }
+    }
+
+    /* Header and owner fields aren't in the flash copy, chunks past them are copied as they are */
+    if ( offset > SDR_OWNER_ID_OFFSET ) {
+        return;
+    }
+    for ( i = offset; i < offset + count; i++ ) {
+        switch ( i ) {
+        case 0:
+            data[i - offset] = record_id & 0xFF;
+            break;
+        case 1:
+            data[i - offset] = record_id >> 8;
+            break;
+        case SDR_OWNER_ID_OFFSET:
+            data[i - offset] = get_ipmb_addr();
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+uint16_t sdr_reserve( void )
+{
+    uint16_t reservation;
+
+    taskENTER_CRITICAL();
+    if ( ++sdr_reservation == 0 ) {
+        sdr_reservation = 1;
+    }
+    reservation = sdr_reservation;
+    taskEXIT_CRITICAL();
+
+    /* The cursor of the old reservation is gone with it */
+    sdr_pos.len = 0;
+
+    /* Partial reads of the old reservation must now be refused */
+    ipmi_cache_invalidate( IPMI_CACHE_SDR );
+
+    return reservation;
+}
+
+uint8_t sdr_reservation_valid( uint16_t reservation )
+{
+    return ( reservation != 0 ) && ( reservation == sdr_reservation );
+}
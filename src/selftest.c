@@ -0,0 +1,318 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file selftest.c
+ *
+ * @brief Self tests and load generators, started and stopped at run time
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "chip.h"
+#include "boot_time.h"
+#include "timestamp.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmb_frame.h"
+#include "ipmi.h"
+#include "sensor.h"
+#include "selftest.h"
+#include "metrics.h"
+#include "clock.h"
+#include "watchdog.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "log.h"
+
+/*! @brief Test asked for, taken by the task when #selftest_pending is set */
+typedef struct selftest_request {
+    uint8_t test;
+    uint16_t seconds;                       /*!< 0 until stopped */
+    uint8_t param[SELFTEST_PARAM_MAX];
+    uint8_t len;                            /*!< Bytes of #param given, the others take their default */
+} selftest_request;
+
+/*! @brief Results of the last test, zeroed when the next one starts */
+typedef struct selftest_results {
+    uint32_t elapsed_ms;
+    uint32_t i2c_frames;                    /*!< Loopback frames acknowledged */
+    uint32_t i2c_bytes;                     /*!< Bytes of these frames, slave address included */
+    uint32_t i2c_errors;                    /*!< Loopback writes that failed */
+    uint32_t flood_sent;                    /*!< Requests handed to IPMB */
+    uint32_t flood_ok;                      /*!< Requests answered */
+    uint32_t flood_errors;                  /*!< Requests not sent or not answered in time */
+    uint32_t flood_us;                      /*!< Total latency of the answered requests */
+    uint32_t flood_max_us;
+    uint32_t sweep_reads;                   /*!< New readings seen */
+    uint32_t sweep_late;                    /*!< Readings that came later than the period of their sensor */
+    uint32_t sweep_max_gap_ms;              /*!< Longest time between two readings, past the period of the sensor */
+} selftest_results;
+
+static selftest_results selftest_res;
+static selftest_request selftest_req;
+static volatile uint8_t selftest_pending;
+static uint8_t selftest_test = SELFTEST_NONE;
+/*! @brief Requests of the IPMB flood not completed yet, this test's or a previous one's */
+static uint8_t selftest_in_flight;
+
+static TaskHandle_t selftest_task;
+TASK_STACK( selftest_stack, SELFTEST_STACK_DEPTH, 1 );
+
+METRIC_GAUGE( "selftest.test", selftest_test );
+METRIC_GAUGE( "selftest.elapsed_ms", selftest_res.elapsed_ms );
+METRIC_COUNTER( "selftest.i2c_frames", selftest_res.i2c_frames );
+METRIC_COUNTER( "selftest.i2c_bytes", selftest_res.i2c_bytes );
+METRIC_COUNTER( "selftest.i2c_errors", selftest_res.i2c_errors );
+METRIC_COUNTER( "selftest.flood_sent", selftest_res.flood_sent );
+METRIC_COUNTER( "selftest.flood_ok", selftest_res.flood_ok );
+METRIC_COUNTER( "selftest.flood_errors", selftest_res.flood_errors );
+METRIC_COUNTER( "selftest.flood_us", selftest_res.flood_us );
+METRIC_GAUGE( "selftest.flood_max_us", selftest_res.flood_max_us );
+METRIC_COUNTER( "selftest.sweep_reads", selftest_res.sweep_reads );
+METRIC_COUNTER( "selftest.sweep_late", selftest_res.sweep_late );
+METRIC_GAUGE( "selftest.sweep_max_gap_ms", selftest_res.sweep_max_gap_ms );
+
+/* Checks in and tells if the test goes on: not replaced or stopped, and not over */
+static uint8_t prvSelftestContinue( watchdog_id wdg, TickType_t start, uint16_t seconds )
+{
+    TickType_t elapsed = xTaskGetTickCount() - start;
+
+    watchdog_checkin( wdg );
+    METRIC_SET( selftest_res.elapsed_ms, elapsed * portTICK_PERIOD_MS );
+    if ( selftest_pending ) {
+        return 0;
+    }
+    return ( seconds == 0 ) || ( elapsed < (TickType_t) seconds * ( 1000 / portTICK_PERIOD_MS ) );
+}
+
+/* Parameter n of the test, dflt if it wasn't given */
+static uint8_t prvSelftestParam( const selftest_request * req, uint8_t n, uint8_t dflt )
+{
+    return ( n < req->len ) ? req->param[n] : dflt;
+}
+
+static void prvSelftestI2CLoopback( const selftest_request * req, watchdog_id wdg, TickType_t start )
+{
+    static uint8_t initialized;
+    static ipmi_msg msg;
+    static uint8_t frame[IPMI_MSG_MAX_LENGTH];
+    uint8_t len;
+    uint8_t i;
+
+    if ( !initialized ) {
+#ifndef RTM_I2C
+        /* Otherwise the RTM bridge has the interface up already */
+        vI2CInit( SELFTEST_I2C_MASTER, I2C_Mode_Local_Master );
+#endif
+        initialized = 1;
+    }
+
+    memset( &msg, 0, sizeof(msg) );
+    msg.dest_addr = get_ipmb_addr();
+    msg.netfn = NETFN_APP + 1;
+    msg.src_addr = MCH_ADDRESS;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.completion_code = IPMI_CC_OK;
+    msg.data_len = prvSelftestParam( req, 0, SELFTEST_LOOPBACK_DATA_MAX );
+    for ( i = 0; i < msg.data_len; i++ ) {
+        msg.data[i] = i;
+    }
+
+    while ( prvSelftestContinue( wdg, start, req->seconds ) ) {
+        msg.seq++;
+        len = ipmb_encode( frame, &msg );
+        if ( xI2CWrite( SELFTEST_I2C_MASTER, msg.dest_addr >> 1, frame, len ) == i2c_err_SUCCESS ) {
+            METRIC_INC( selftest_res.i2c_frames );
+            METRIC_ADD( selftest_res.i2c_bytes, len + 1 );
+        } else {
+            METRIC_INC( selftest_res.i2c_errors );
+            /* Not wired, no point in hammering the bus */
+            vTaskDelay( 1 );
+        }
+    }
+}
+
+/* Called from the IPMB or timer tasks, must not block; ctx holds the timestamp of the request */
+static void prvSelftestFloodDone( ipmi_msg * resp, ipmb_error error, void * ctx )
+{
+    uint32_t latency = timestamp_elapsed( timestamp_now(), (uint32_t) (uintptr_t) ctx );
+
+    (void) resp;
+
+    if ( error == ipmb_error_success ) {
+        METRIC_INC( selftest_res.flood_ok );
+        METRIC_ADD( selftest_res.flood_us, latency );
+        if ( latency > selftest_res.flood_max_us ) {
+            METRIC_SET( selftest_res.flood_max_us, latency );
+        }
+    } else {
+        METRIC_INC( selftest_res.flood_errors );
+    }
+    __atomic_fetch_sub( &selftest_in_flight, 1, __ATOMIC_RELAXED );
+    xTaskNotifyGive( selftest_task );
+}
+
+static void prvSelftestIPMBFlood( const selftest_request * req, watchdog_id wdg, TickType_t start )
+{
+    ipmi_msg msg;
+    uint8_t depth = prvSelftestParam( req, 1, SELFTEST_FLOOD_DEPTH );
+
+    msg.dest_addr = prvSelftestParam( req, 0, MCH_ADDRESS );
+    msg.netfn = NETFN_APP;
+    msg.cmd = IPMI_GET_DEVICE_ID_CMD;
+    msg.data_len = 0;
+
+    while ( prvSelftestContinue( wdg, start, req->seconds ) ) {
+        if ( __atomic_load_n( &selftest_in_flight, __ATOMIC_RELAXED ) >= depth ) {
+            /* Woken up by the completions, the timeouts included */
+            ulTaskNotifyTake( pdTRUE, WATCHDOG_BLOCK_TIME );
+            continue;
+        }
+        __atomic_fetch_add( &selftest_in_flight, 1, __ATOMIC_RELAXED );
+        METRIC_INC( selftest_res.flood_sent );
+        if ( ipmb_send_request_async( &msg, prvSelftestFloodDone, (void *) (uintptr_t) timestamp_now() ) != ipmb_error_success ) {
+            /* TX queue full, the callback won't be called */
+            __atomic_fetch_sub( &selftest_in_flight, 1, __ATOMIC_RELAXED );
+            METRIC_INC( selftest_res.flood_errors );
+            vTaskDelay( 1 );
+        }
+    }
+}
+
+static void prvSelftestSensorSweep( const selftest_request * req, watchdog_id wdg, TickType_t start )
+{
+    TickType_t last[SENSOR_MAX];
+    sensor_reading reading;
+    const sensor_desc * desc;
+    uint32_t gap_ms;
+    uint8_t count = sensor_count();
+    uint8_t sensor;
+
+    for ( sensor = 0; sensor < count; sensor++ ) {
+        sensor_get_reading( sensor, &reading );
+        last[sensor] = reading.timestamp;
+    }
+
+    while ( prvSelftestContinue( wdg, start, req->seconds ) ) {
+        /* No sensor is read twice in a poll period */
+        vTaskDelay( SENSOR_POLL_PERIOD );
+        for ( sensor = 0; sensor < count; sensor++ ) {
+            desc = sensor_get_desc( sensor );
+            sensor_get_reading( sensor, &reading );
+            gap_ms = ( xTaskGetTickCount() - last[sensor] ) * portTICK_PERIOD_MS;
+            if ( reading.timestamp != last[sensor] ) {
+                gap_ms = ( reading.timestamp - last[sensor] ) * portTICK_PERIOD_MS;
+                last[sensor] = reading.timestamp;
+                METRIC_INC( selftest_res.sweep_reads );
+                /* The poller runs every SENSOR_POLL_PERIOD, a read can't be closer than that to its time */
+                if ( gap_ms > desc->period_ms + SENSOR_POLL_PERIOD * portTICK_PERIOD_MS ) {
+                    METRIC_INC( selftest_res.sweep_late );
+                }
+            }
+            /* Also while a sensor isn't read at all */
+            if ( ( gap_ms > desc->period_ms ) && ( gap_ms - desc->period_ms > selftest_res.sweep_max_gap_ms ) ) {
+                METRIC_SET( selftest_res.sweep_max_gap_ms, gap_ms - desc->period_ms );
+            }
+        }
+    }
+}
+
+/*! @brief Test table, indexed by test number */
+static void (* const selftest_run[SELFTEST_COUNT])( const selftest_request * req, watchdog_id wdg, TickType_t start ) = {
+    [SELFTEST_I2C_LOOPBACK] = prvSelftestI2CLoopback,
+    [SELFTEST_IPMB_FLOOD] = prvSelftestIPMBFlood,
+    [SELFTEST_SENSOR_SWEEP] = prvSelftestSensorSweep,
+};
+
+static void prvSelftestTask( void * pvParameters )
+{
+    watchdog_id wdg = watchdog_register( "SelfTest", WATCHDOG_DEADLINE );
+    selftest_request req;
+
+    (void) pvParameters;
+
+    for ( ;; ) {
+        watchdog_checkin( wdg );
+        ulTaskNotifyTake( pdTRUE, WATCHDOG_BLOCK_TIME );
+
+        taskENTER_CRITICAL();
+        if ( !selftest_pending ) {
+            taskEXIT_CRITICAL();
+            continue;
+        }
+        req = selftest_req;
+        selftest_pending = 0;
+        taskEXIT_CRITICAL();
+
+        if ( req.test == SELFTEST_NONE ) {
+            continue;
+        }
+
+        memset( &selftest_res, 0, sizeof(selftest_res) );
+        METRIC_SET( selftest_test, req.test );
+        LOG( "selftest,start,%u,%u", req.test, req.seconds );
+        clock_boost( CLOCK_BOOST_SELFTEST, 1 );
+        selftest_run[req.test]( &req, wdg, xTaskGetTickCount() );
+        clock_boost( CLOCK_BOOST_SELFTEST, 0 );
+        LOG( "selftest,done,%u,%u", req.test, selftest_res.elapsed_ms );
+        METRIC_SET( selftest_test, SELFTEST_NONE );
+    }
+}
+
+uint8_t selftest_start( uint8_t test, uint16_t seconds, const uint8_t * param, uint8_t len )
+{
+    if ( ( selftest_task == NULL ) || ( test >= SELFTEST_COUNT ) || ( len > SELFTEST_PARAM_MAX ) ) {
+        return 0;
+    }
+    if ( ( test == SELFTEST_I2C_LOOPBACK ) && ( len >= 1 ) && ( param[0] > SELFTEST_LOOPBACK_DATA_MAX ) ) {
+        return 0;
+    }
+    if ( ( test == SELFTEST_IPMB_FLOOD ) && ( len >= 2 ) && ( ( param[1] == 0 ) || ( param[1] > IPMB_MAX_OUTSTANDING_REQ ) ) ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    selftest_req.test = test;
+    selftest_req.seconds = seconds;
+    memcpy( selftest_req.param, param, len );
+    selftest_req.len = len;
+    selftest_pending = 1;
+    taskEXIT_CRITICAL();
+
+    xTaskNotifyGive( selftest_task );
+    return 1;
+}
+
+uint8_t selftest_running( void )
+{
+    return selftest_test;
+}
+
+void selftest_init( void )
+{
+    xTaskCreateWithStack( prvSelftestTask, (const char*)"SelfTest", SELFTEST_STACK_DEPTH, ( void * ) NULL, SELFTEST_TASK_PRIORITY, &selftest_task, TASK_STACK_BUFFER( selftest_stack, 0 ) );
+}
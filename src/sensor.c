@@ -0,0 +1,864 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file sensor.c
+ *
+ * @brief Board sensor table, polling task and reading store
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* LPCOpen includes (barriers) */
+#include "chip.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "sensor.h"
+#include "threshold.h"
+#include "adc.h"
+#include "fpga.h"
+#include "board_defs.h"
+#include "board_sensors.h"
+#include "init_stage.h"
+#include "watchdog.h"
+#include "log.h"
+#include "metrics.h"
+
+/*! @brief LM75 temperature register */
+#define LM75_TEMP_REG               0x00
+
+/* LM75 temperature register: MSB is the integer part in degrees Celsius (two's complement), the LSB only adds 0.5 C */
+static uint16_t prvLM75Decode( const uint8_t * rx )
+{
+    /* Sign extended, the low byte is still the raw SDR reading */
+    return (int8_t) rx[0];
+}
+
+static const sensor_driver lm75_driver = {
+    .tx_data = { LM75_TEMP_REG },
+    .tx_len = 1,
+    .rx_len = 2,
+    .max_clock = I2C_FAST_MODE_CLOCK,
+    .decode = prvLM75Decode,
+};
+
+/* On-chip ADC channel, the reading is the latest decimated result */
+static uint8_t prvADCRead( uint8_t channel, uint8_t * rx )
+{
+    uint16_t value;
+
+    if ( !adc_read( channel, &value ) ) {
+        return 0;
+    }
+    rx[0] = value & 0xFF;
+    rx[1] = value >> 8;
+    return 1;
+}
+
+/* 12 bit result, the SDR reading is its 8 most significant bits */
+static uint16_t prvADCDecode( const uint8_t * rx )
+{
+    return ( rx[0] | ( rx[1] << 8 ) ) >> 4;
+}
+
+static const sensor_driver adc_driver = {
+    .rx_len = 2,
+    .decode = prvADCDecode,
+    .read = prvADCRead,
+};
+
+/* FPGA mailbox register, MS byte first */
+static uint16_t prvFPGARegDecode( const uint8_t * rx )
+{
+    return ( rx[0] << 8 ) | rx[1];
+}
+
+static const sensor_driver fpga_reg_driver = {
+    .rx_len = 2,
+    .decode = prvFPGARegDecode,
+};
+
+/*! @name INA220 power monitor registers
+ * @{
+ */
+#define INA220_CONFIG_REG           0x00
+#define INA220_SHUNT_REG            0x01
+#define INA220_BUS_REG              0x02
+#define INA220_POWER_REG            0x03
+#define INA220_CALIBRATION_REG      0x05
+/*! @} */
+
+/* Configuration: 32 V bus range, +-40 mV shunt range, shunt and bus converted continuously */
+#define INA220_CONFIG_BRNG_32V      ( 1 << 13 )
+#define INA220_CONFIG_MODE_CONT     0x07
+#define INA220_CONFIG_BADC( adc )   ( ( adc ) << 7 )
+#define INA220_CONFIG_SADC( adc )   ( ( adc ) << 3 )
+/* ADC setting averaging 2^n 12 bit samples (n up to 7), each one taking 532 us */
+#define INA220_ADC_AVERAGE( n )     ( 0x08 | ( n ) )
+#define INA220_SAMPLE_US            532
+#define INA220_AVERAGE_MAX          7
+/* Current LSB of 1 mA: CAL = 0.04096 / ( 1 mA * shunt ), power LSB = 20 mW */
+#define INA220_CALIBRATION          ( 40960 / INA220_SHUNT_MOHM )
+
+/* Averages as many samples as fit in the period, so each read gets a fresh result of the whole interval
+ * instead of the last 532 us of it: both channels are converted in turn, 2^n samples each */
+static void prvINA220Setup( I2C_ID_T i2c_id, uint8_t addr, uint16_t period_ms )
+{
+    uint8_t config[3];
+    uint8_t calibration[3];
+    uint16_t value;
+    uint8_t n = 0;
+    xI2C_xfer xfer[2] = {
+        { .addr = addr, .tx_data = config, .tx_len = sizeof(config) },
+        { .addr = addr, .tx_data = calibration, .tx_len = sizeof(calibration) },
+    };
+
+    while ( ( n < INA220_AVERAGE_MAX ) && ( 2UL * ( 2UL << n ) * INA220_SAMPLE_US <= period_ms * 1000UL ) ) {
+        n++;
+    }
+
+    value = INA220_CONFIG_BRNG_32V | INA220_CONFIG_BADC( INA220_ADC_AVERAGE( n ) ) |
+            INA220_CONFIG_SADC( INA220_ADC_AVERAGE( n ) ) | INA220_CONFIG_MODE_CONT;
+    config[0] = INA220_CONFIG_REG;
+    config[1] = value >> 8;
+    config[2] = value & 0xFF;
+    calibration[0] = INA220_CALIBRATION_REG;
+    calibration[1] = INA220_CALIBRATION >> 8;
+    calibration[2] = INA220_CALIBRATION & 0xFF;
+
+    /* A missing device is counted by the bus health like any failed read, the polling carries on */
+    if ( xI2CTransferChain( i2c_id, xfer, 2 ) != i2c_err_SUCCESS ) {
+        LOG( "sensor,ina220_setup_failed,%u,%u", i2c_id, addr );
+    }
+}
+
+/* Clamps a register scaled to the SDR reading into its 8 bits */
+static uint16_t prvINA220Clamp( int32_t value, int32_t min, int32_t max )
+{
+    if ( value < min ) {
+        value = min;
+    } else if ( value > max ) {
+        value = max;
+    }
+    return (uint16_t) value;
+}
+
+/* Shunt voltage, 10 uV per count (two's complement, MS byte first), read as 320 uV per count, sign extended */
+static uint16_t prvINA220ShuntDecode( const uint8_t * rx )
+{
+    int16_t shunt = (int16_t) ( ( rx[0] << 8 ) | rx[1] );
+
+    return prvINA220Clamp( shunt / 32, -128, 127 );
+}
+
+/* Bus voltage, 4 mV per count in bits 15:3, read as 64 mV per count */
+static uint16_t prvINA220BusDecode( const uint8_t * rx )
+{
+    return prvINA220Clamp( ( ( rx[0] << 8 ) | rx[1] ) >> 7, 0, 255 );
+}
+
+/* Power, 20 mW per count (from the calibration), read as 320 mW per count */
+static uint16_t prvINA220PowerDecode( const uint8_t * rx )
+{
+    return prvINA220Clamp( ( ( rx[0] << 8 ) | rx[1] ) >> 4, 0, 255 );
+}
+
+#define INA220_DRIVER( reg, decoder )               \
+    {                                               \
+        .tx_data = { reg },                         \
+        .tx_len = 1,                                \
+        .rx_len = 2,                                \
+        .max_clock = I2C_FAST_MODE_CLOCK,           \
+        .decode = decoder,                          \
+        .setup = prvINA220Setup,                    \
+    }
+
+static const sensor_driver ina220_shunt_driver = INA220_DRIVER( INA220_SHUNT_REG, prvINA220ShuntDecode );
+static const sensor_driver ina220_bus_driver = INA220_DRIVER( INA220_BUS_REG, prvINA220BusDecode );
+static const sensor_driver ina220_power_driver = INA220_DRIVER( INA220_POWER_REG, prvINA220PowerDecode );
+
+#define SENSOR_TABLE_ENTRY( id, bus, addr, driver, period, sdr, name ) \
+    { bus, addr, &driver, period },
+
+/*! @brief Board sensors (see board_sensors.h), the index in this table is the sensor number */
+static const sensor_desc sensor_table[] = {
+    BOARD_SENSORS( SENSOR_TABLE_ENTRY )
+};
+
+#define SENSOR_COUNT                ( sizeof(sensor_table) / sizeof(sensor_table[0]) )
+
+/*! @brief Store slot of a sensor, see #sensor_get_reading
+ *
+ * Only the polling task writes it: the new reading goes to copy[(seq + 1) & 1], then seq is
+ * incremented, which hands that copy to the readers.
+ */
+typedef struct sensor_slot {
+    volatile uint32_t seq;
+    sensor_reading copy[2];
+} sensor_slot;
+
+/*! @brief Last reading of each sensor */
+static sensor_slot sensor_store[SENSOR_COUNT];
+/*! @brief Tick at which each sensor has to be read again */
+static TickType_t sensor_next_due[SENSOR_COUNT];
+/*! @brief Current rate of each sensor, its table period is shifted right by this much (adaptive polling) */
+static uint8_t sensor_rate_shift[SENSOR_COUNT];
+/*! @brief Deadband of each sensor, in raw counts (see #sensor_set_deadband) */
+static uint16_t sensor_deadband[SENSOR_COUNT];
+/* Value and status of each sensor at its last change, only used by the poller */
+static int16_t sensor_changed_value[SENSOR_COUNT];
+static uint8_t sensor_changed_status[SENSOR_COUNT];
+/*! @brief Change mask of each consumer, set by the poller and cleared by #sensor_take_changes */
+static volatile uint32_t sensor_changes[SENSOR_CONSUMERS];
+/*! @brief Sensors whose statistics restart at their next reading */
+static volatile uint32_t sensor_stats_reset;
+/*! @brief Failed reads, of all the sensors */
+static uint32_t sensor_read_errors;
+METRIC_COUNTER( "sensor.read_err", sensor_read_errors );
+/*! @brief Request cadence learned for a sensor, see #sensor_note_request
+ *
+ * Written by the IPMI task only, read by the poller.
+ */
+typedef struct sensor_cadence {
+    TickType_t last;                        /*!< Tick of the last request */
+    TickType_t period;                      /*!< Estimated time between requests, 0 while unknown */
+    uint8_t lock;                           /*!< Intervals in a row that matched #period, up to #SENSOR_PREFETCH_LOCK */
+} sensor_cadence;
+
+static sensor_cadence sensor_requests[SENSOR_COUNT];
+/* Get Sensor Reading requests answered and the total age of their readings, for the mean staleness */
+static uint32_t sensor_served;
+static uint32_t sensor_served_age_ms;
+/*! @brief Reads moved earlier to land before an expected request */
+static uint32_t sensor_prefetches;
+METRIC_COUNTER( "sensor.served", sensor_served );
+METRIC_COUNTER( "sensor.served_age_ms", sensor_served_age_ms );
+METRIC_COUNTER( "sensor.prefetch", sensor_prefetches );
+/*! @brief Telemetry snapshot, read by the GPDMA (so in the AHB SRAM) */
+static sensor_snapshot sensor_snap[SENSOR_MAX] __RAM_AHB_NOINIT;
+static log_block sensor_snap_block;
+static volatile uint8_t sensor_snap_queued;
+/* Telemetry period in ticks (0: stopped) and tick of the next snapshot */
+static volatile TickType_t sensor_stream_period;
+static TickType_t sensor_stream_due;
+/*! @brief Scan list of the I2C sensors, entry i reads sensor i (built once by #sensor_init), see #xI2CScanStart */
+static xI2C_scan_entry sensor_scan[SENSOR_COUNT];
+/* Written by the I2C interrupts, one slot and one result per sensor */
+static uint8_t sensor_raw[SENSOR_COUNT][SENSOR_RX_MAX];
+static i2c_err sensor_scan_result[SENSOR_COUNT];
+/*! @brief Sweep of each bus: the whole list, with the sensors of the bus that are due in the mask */
+static xI2C_chain sensor_sweep[I2C_NUM_INTERFACE];
+
+static void SensorTask( void * pvParameters );
+
+TASK_STACK( sensor_stack, SENSOR_STACK_DEPTH, 1 );
+
+/* Tells if no sensor before this one in the table reads the same device */
+static uint8_t prvSensorFirstOfDevice( uint8_t sensor )
+{
+    uint8_t i;
+
+    for ( i = 0; i < sensor; i++ ) {
+        if ( ( sensor_table[i].i2c_id == sensor_table[sensor].i2c_id ) &&
+             ( sensor_table[i].addr == sensor_table[sensor].addr ) ) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void sensor_init( void )
+{
+    uint8_t bus_used[I2C_NUM_INTERFACE] = { 0 };
+    uint8_t adc_channels = 0;
+    uint8_t i;
+
+    configASSERT( SENSOR_COUNT <= SENSOR_MAX );
+    /* One bit of the sweep masks per sensor */
+    configASSERT( SENSOR_MAX <= 32 );
+
+    threshold_init();
+
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        configASSERT( sensor_table[i].driver->rx_len <= SENSOR_RX_MAX );
+        sensor_deadband[i] = SENSOR_DEADBAND_DEFAULT;
+        if ( sensor_table[i].i2c_id == SENSOR_LOCAL ) {
+            if ( sensor_table[i].driver == &adc_driver ) {
+                adc_channels |= ( 1 << sensor_table[i].addr );
+            }
+            continue;
+        }
+        if ( sensor_table[i].i2c_id == SENSOR_FPGA ) {
+            continue;
+        }
+        /* Several sensors may share a device (different registers) */
+        if ( pxI2CDeviceInfo( sensor_table[i].i2c_id, sensor_table[i].addr ) == NULL ) {
+            xI2CRegisterDevice( sensor_table[i].i2c_id, sensor_table[i].addr, sensor_table[i].driver->max_clock );
+        }
+        bus_used[sensor_table[i].i2c_id] = 1;
+
+        sensor_scan[i].addr = sensor_table[i].addr;
+        memcpy( sensor_scan[i].tx_data, sensor_table[i].driver->tx_data, sizeof(sensor_scan[i].tx_data) );
+        sensor_scan[i].tx_len = sensor_table[i].driver->tx_len;
+        sensor_scan[i].rx_len = sensor_table[i].driver->rx_len;
+        sensor_scan[i].slot = i;
+    }
+
+    for ( i = 0; i < I2C_NUM_INTERFACE; i++ ) {
+        sensor_sweep[i].scan = sensor_scan;
+        sensor_sweep[i].count = SENSOR_COUNT;
+        sensor_sweep[i].dest = &sensor_raw[0][0];
+        sensor_sweep[i].stride = SENSOR_RX_MAX;
+        sensor_sweep[i].result = sensor_scan_result;
+    }
+
+    /* The devices are registered first, so each bus comes up at the right clock */
+    for ( i = 0; i < I2C_NUM_INTERFACE; i++ ) {
+        if ( bus_used[i] ) {
+            vI2CInit( i, I2C_Mode_Local_Master );
+        }
+    }
+
+    /* Once per device, before the first sweep reads it */
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        if ( ( sensor_table[i].i2c_id < I2C_NUM_INTERFACE ) && ( sensor_table[i].driver->setup != NULL ) &&
+             prvSensorFirstOfDevice( i ) ) {
+            sensor_table[i].driver->setup( sensor_table[i].i2c_id, sensor_table[i].addr, sensor_table[i].period_ms );
+        }
+    }
+
+    /* Sampled in the background, the poller only picks up the results */
+    if ( adc_channels ) {
+        adc_init( adc_channels );
+    }
+
+    xTaskCreateWithStack( SensorTask, (const char*)"Sensors", SENSOR_STACK_DEPTH, ( void * ) NULL, SENSOR_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( sensor_stack, 0 ) );
+    init_stage_done( INIT_STAGE_SENSORS );
+}
+
+/* Sensor period in ticks, at least one scheduler round */
+static TickType_t prvSensorPeriod( uint8_t sensor )
+{
+    TickType_t period = sensor_table[sensor].period_ms / portTICK_PERIOD_MS;
+
+    return ( period < SENSOR_POLL_PERIOD ) ? SENSOR_POLL_PERIOD : period;
+}
+
+/* Period of the current rate of a sensor, in ticks */
+static TickType_t prvSensorAdaptivePeriod( uint8_t sensor )
+{
+    TickType_t period = ( sensor_table[sensor].period_ms / portTICK_PERIOD_MS ) >> sensor_rate_shift[sensor];
+
+    return ( period < SENSOR_POLL_PERIOD ) ? SENSOR_POLL_PERIOD : period;
+}
+
+uint8_t sensor_count( void )
+{
+    return SENSOR_COUNT;
+}
+
+const sensor_desc * sensor_get_desc( uint8_t sensor )
+{
+    if ( sensor >= SENSOR_COUNT ) {
+        return NULL;
+    }
+    return &sensor_table[sensor];
+}
+
+uint8_t sensor_get_reading( uint8_t sensor, sensor_reading * reading )
+{
+    sensor_slot * slot;
+    uint32_t seq;
+
+    if ( sensor >= SENSOR_COUNT ) {
+        return 0;
+    }
+
+    slot = &sensor_store[sensor];
+    do {
+        seq = slot->seq;
+        __DMB();
+        *reading = slot->copy[seq & 1];
+        __DMB();
+        /* Published once meanwhile: the other copy was written, ours is intact */
+    } while ( (uint32_t)( slot->seq - seq ) > 1 );
+
+    return 1;
+}
+
+void sensor_reset_stats( uint8_t sensor )
+{
+    taskENTER_CRITICAL();
+    if ( sensor == SENSOR_ALL ) {
+        sensor_stats_reset = ( 1UL << SENSOR_COUNT ) - 1;
+    } else if ( sensor < SENSOR_COUNT ) {
+        sensor_stats_reset |= ( 1UL << sensor );
+    }
+    taskEXIT_CRITICAL();
+}
+
+uint8_t sensor_stream( uint16_t period_ms )
+{
+    if ( ( period_ms != 0 ) && ( period_ms < SENSOR_STREAM_MIN_MS ) ) {
+        return 0;
+    }
+    /* The first snapshot has every sensor, the next ones only the changes */
+    taskENTER_CRITICAL();
+    sensor_changes[SENSOR_CONSUMER_STREAM] = ( 1UL << SENSOR_COUNT ) - 1;
+    taskEXIT_CRITICAL();
+    sensor_stream_period = period_ms / portTICK_PERIOD_MS;
+    return 1;
+}
+
+uint8_t sensor_set_deadband( uint8_t sensor, uint16_t deadband )
+{
+    if ( sensor >= SENSOR_COUNT ) {
+        return 0;
+    }
+    sensor_deadband[sensor] = deadband;
+    return 1;
+}
+
+uint32_t sensor_take_changes( uint8_t consumer )
+{
+    uint32_t changes;
+
+    configASSERT( consumer < SENSOR_CONSUMERS );
+
+    taskENTER_CRITICAL();
+    changes = sensor_changes[consumer];
+    sensor_changes[consumer] = 0;
+    taskEXIT_CRITICAL();
+
+    return changes;
+}
+
+void sensor_note_request( uint8_t sensor, const sensor_reading * reading )
+{
+    sensor_cadence * cadence;
+    TickType_t now = xTaskGetTickCount();
+    TickType_t interval;
+    TickType_t tolerance;
+
+    if ( sensor >= SENSOR_COUNT ) {
+        return;
+    }
+
+    sensor_served++;
+    if ( reading->status != 0 ) {
+        sensor_served_age_ms += ( now - reading->timestamp ) * portTICK_PERIOD_MS;
+    }
+
+    cadence = &sensor_requests[sensor];
+    interval = now - cadence->last;
+    if ( interval < SENSOR_POLL_PERIOD ) {
+        return;
+    }
+    cadence->last = now;
+
+    if ( interval > SENSOR_PREFETCH_MAX_PERIOD ) {
+        /* First request, or a gap too long to be a cadence */
+        cadence->period = 0;
+        cadence->lock = 0;
+        return;
+    }
+
+    tolerance = cadence->period / 8 + SENSOR_POLL_PERIOD;
+    if ( ( cadence->period != 0 ) && ( interval + tolerance >= cadence->period ) && ( interval <= cadence->period + tolerance ) ) {
+        /* Same cadence, follow its drift a quarter at a time */
+        cadence->period = cadence->period + ( (int32_t)( interval - cadence->period ) / 4 );
+        if ( cadence->lock < SENSOR_PREFETCH_LOCK ) {
+            cadence->lock++;
+        }
+    } else {
+        cadence->period = interval;
+        cadence->lock = 0;
+    }
+}
+
+uint8_t sensor_reading_stale( uint8_t sensor, const sensor_reading * reading )
+{
+    if ( ( sensor >= SENSOR_COUNT ) || !( reading->status & SENSOR_READING_VALID ) ) {
+        return 1;
+    }
+
+    return ( (TickType_t)( xTaskGetTickCount() - reading->timestamp ) > ( prvSensorPeriod( sensor ) * SENSOR_STALE_PERIODS ) );
+}
+
+/* Adds a sample to the statistics of a sensor, O(1) and integer only */
+static void prvSensorStats( uint8_t sensor, sensor_stats * stats, int16_t value )
+{
+    uint32_t mask = ( 1UL << sensor );
+
+    if ( sensor_stats_reset & mask ) {
+        taskENTER_CRITICAL();
+        sensor_stats_reset &= ~mask;
+        taskEXIT_CRITICAL();
+        stats->count = 0;
+    }
+
+    if ( stats->count == 0 ) {
+        stats->min = value;
+        stats->max = value;
+        stats->ewma = (int32_t) value << SENSOR_EWMA_SHIFT;
+    } else {
+        if ( value < stats->min ) {
+            stats->min = value;
+        }
+        if ( value > stats->max ) {
+            stats->max = value;
+        }
+        stats->ewma += value - ( stats->ewma >> SENSOR_EWMA_SHIFT );
+    }
+
+    if ( stats->count != (uint32_t) ~0 ) {
+        stats->count++;
+    }
+}
+
+/* Picks the rate of a sensor from its new reading: fastest near a threshold, otherwise fast enough to get
+ * #SENSOR_ADAPT_SAMPLES reads before the threshold is reached at the current rate of change. A faster rate
+ * is taken at once, a slower one a step at a time, so a noisy reading doesn't bounce between the two. */
+static void prvSensorAdapt( uint8_t sensor, int16_t previous, int16_t value )
+{
+    uint16_t margin = threshold_margin( sensor );
+    uint32_t step;
+    uint32_t rate;
+    uint8_t shift = 0;
+
+    if ( margin == THRESHOLD_MARGIN_NONE ) {
+        sensor_rate_shift[sensor] = 0;
+        return;
+    }
+
+    if ( margin <= SENSOR_ADAPT_NEAR ) {
+        shift = SENSOR_ADAPT_SHIFT_MAX;
+    } else {
+        /* Change over one table period, from the change since the last read at the current rate */
+        step = ( value > previous ) ? ( value - previous ) : ( previous - value );
+        rate = ( step << sensor_rate_shift[sensor] ) * SENSOR_ADAPT_SAMPLES;
+        while ( ( shift < SENSOR_ADAPT_SHIFT_MAX ) && ( ( rate >> shift ) >= margin ) ) {
+            shift++;
+        }
+    }
+
+    if ( shift > sensor_rate_shift[sensor] ) {
+        /* The next read was scheduled at the old rate, bring it forward */
+        sensor_next_due[sensor] -= prvSensorAdaptivePeriod( sensor );
+        sensor_rate_shift[sensor] = shift;
+        sensor_next_due[sensor] += prvSensorAdaptivePeriod( sensor );
+    } else if ( shift < sensor_rate_shift[sensor] ) {
+        sensor_rate_shift[sensor]--;
+    }
+}
+
+/* Flags a reading to every consumer if it moved past the deadband of its sensor or changed status */
+static void prvSensorChanged( uint8_t sensor, const sensor_reading * reading )
+{
+    int16_t value = (int16_t) reading->value;
+    int32_t moved = (int32_t) value - sensor_changed_value[sensor];
+    uint8_t i;
+
+    if ( moved < 0 ) {
+        moved = -moved;
+    }
+    if ( ( reading->status == sensor_changed_status[sensor] ) &&
+         ( !( reading->status & SENSOR_READING_VALID ) || ( moved <= sensor_deadband[sensor] ) ) ) {
+        return;
+    }
+    sensor_changed_value[sensor] = value;
+    sensor_changed_status[sensor] = reading->status;
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < SENSOR_CONSUMERS; i++ ) {
+        sensor_changes[i] |= ( 1UL << sensor );
+    }
+    taskEXIT_CRITICAL();
+}
+
+/* Stores the result of a sensor read */
+static void prvSensorUpdate( uint8_t sensor, i2c_err error, const uint8_t * rx )
+{
+    sensor_slot * slot = &sensor_store[sensor];
+    uint32_t seq = slot->seq;
+    sensor_reading * next = &slot->copy[( seq + 1 ) & 1];
+
+    if ( error != i2c_err_SUCCESS ) {
+        /* Keep the last good value, only flag it */
+        METRIC_INC( sensor_read_errors );
+        *next = slot->copy[seq & 1];
+        next->status = SENSOR_READING_UNAVAILABLE;
+    } else {
+        next->value = sensor_table[sensor].driver->decode( rx );
+        next->timestamp = xTaskGetTickCount();
+        next->status = SENSOR_READING_VALID;
+        next->stats = slot->copy[seq & 1].stats;
+        prvSensorStats( sensor, &next->stats, (int16_t) next->value );
+    }
+
+    /* The copy must be complete before readers are pointed to it */
+    __DMB();
+    slot->seq = seq + 1;
+
+    prvSensorChanged( sensor, next );
+
+    /* A failed read leaves the threshold state (and the rate) as it was */
+    if ( error == i2c_err_SUCCESS ) {
+        threshold_evaluate( sensor, next->value );
+        /* The first reading has nothing to compare with */
+        prvSensorAdapt( sensor, ( next->stats.count > 1 ) ? (int16_t) slot->copy[seq & 1].value : (int16_t) next->value,
+                        (int16_t) next->value );
+    }
+}
+
+/* Moves the next read of a sensor earlier to land SENSOR_PREFETCH_LEAD before the last request expected until then */
+static TickType_t prvSensorPrefetch( uint8_t sensor, TickType_t now, TickType_t next )
+{
+    TickType_t last = sensor_requests[sensor].last;
+    TickType_t period = sensor_requests[sensor].period;
+    TickType_t early;
+
+    if ( ( sensor_requests[sensor].lock < SENSOR_PREFETCH_LOCK ) || ( period == 0 ) ||
+         ( (TickType_t)( now - last ) > SENSOR_PREFETCH_MISSES * period ) ) {
+        return next;
+    }
+
+    /* Time from that request, in (next - period, next], back to next */
+    early = (TickType_t)( next + SENSOR_PREFETCH_LEAD - last ) % period;
+    if ( ( early == 0 ) || ( early >= (TickType_t)( next - now ) ) ) {
+        /* Already there, or no request expected in time */
+        return next;
+    }
+    METRIC_INC( sensor_prefetches );
+    return next - early;
+}
+
+/* Tells if a sensor is due and, if so, schedules its next read */
+static uint8_t prvSensorDue( uint8_t sensor, TickType_t now )
+{
+    TickType_t period;
+
+    /* Wrap-safe: not due yet if the next deadline is still ahead of us */
+    if ( (TickType_t)( now - sensor_next_due[sensor] ) >= ( (TickType_t) ~0 >> 1 ) ) {
+        return 0;
+    }
+
+    period = prvSensorAdaptivePeriod( sensor );
+    sensor_next_due[sensor] += period;
+    if ( (TickType_t)( now - sensor_next_due[sensor] ) < ( (TickType_t) ~0 >> 1 ) ) {
+        /* Fell more than a period behind, don't try to catch up */
+        sensor_next_due[sensor] = now + period;
+    }
+    sensor_next_due[sensor] = prvSensorPrefetch( sensor, now, sensor_next_due[sensor] );
+    return 1;
+}
+
+/* Reads every local sensor that is due, straight from its driver */
+static void prvSensorPollLocal( TickType_t now )
+{
+    uint8_t rx[SENSOR_RX_MAX];
+    uint8_t i;
+
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        if ( ( sensor_table[i].i2c_id != SENSOR_LOCAL ) || !prvSensorDue( i, now ) ) {
+            continue;
+        }
+
+        if ( sensor_table[i].driver->read( sensor_table[i].addr, rx ) ) {
+            prvSensorUpdate( i, i2c_err_SUCCESS, rx );
+        } else {
+            prvSensorUpdate( i, i2c_err_FAILURE, NULL );
+        }
+    }
+}
+
+/* Starts the sweep of the sensors of a bus that are due: the interrupt reads them all into sensor_raw */
+static void prvSensorScanStart( I2C_ID_T i2c_id, TickType_t now )
+{
+    const sensor_desc * desc;
+    uint32_t mask = 0;
+    uint8_t i;
+
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        desc = &sensor_table[i];
+
+        if ( ( desc->i2c_id != i2c_id ) || !prvSensorDue( i, now ) ) {
+            continue;
+        }
+
+        if ( !xI2CDeviceAvailable( i2c_id, desc->addr ) ) {
+            prvSensorUpdate( i, i2c_err_QUARANTINED, NULL );
+            continue;
+        }
+        mask |= ( 1UL << i );
+    }
+
+    sensor_sweep[i2c_id].mask = mask;
+    if ( xI2CScanStart( i2c_id, &sensor_sweep[i2c_id] ) != i2c_err_SUCCESS ) {
+        /* Entries are checked against SENSOR_RX_MAX by sensor_init, can't happen */
+        sensor_sweep[i2c_id].mask = 0;
+    }
+}
+
+/* Waits for the sweep of a bus and stores its readings, each sensor with its own result */
+static void prvSensorScanEnd( I2C_ID_T i2c_id )
+{
+    uint32_t mask = sensor_sweep[i2c_id].mask;
+    uint8_t i;
+
+    if ( mask == 0 ) {
+        return;
+    }
+
+    xI2CScanWait( &sensor_sweep[i2c_id] );
+
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        if ( mask & ( 1UL << i ) ) {
+            prvSensorUpdate( i, sensor_scan_result[i], sensor_raw[i] );
+        }
+    }
+}
+
+/* Reads every FPGA register sensor that is due with one mailbox burst, spanning the lowest to the highest register */
+static void prvSensorPollFPGA( TickType_t now )
+{
+    static uint8_t index[SENSOR_MAX];
+    const uint8_t * regs;
+    uint8_t first = 0xFF;
+    uint8_t last = 0;
+    uint8_t n = 0;
+    uint8_t i;
+
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        if ( ( sensor_table[i].i2c_id != SENSOR_FPGA ) || !prvSensorDue( i, now ) ) {
+            continue;
+        }
+        if ( sensor_table[i].addr < first ) {
+            first = sensor_table[i].addr;
+        }
+        if ( sensor_table[i].addr > last ) {
+            last = sensor_table[i].addr;
+        }
+        index[n++] = i;
+    }
+
+    if ( n == 0 ) {
+        return;
+    }
+
+    regs = ( last - first < FPGA_MBOX_REGS_MAX ) ? fpga_mbox_read( first, last - first + 1 ) : NULL;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( regs != NULL ) {
+            prvSensorUpdate( index[i], i2c_err_SUCCESS, &regs[2 * ( sensor_table[index[i]].addr - first )] );
+        } else {
+            prvSensorUpdate( index[i], i2c_err_FAILURE, NULL );
+        }
+    }
+}
+
+static void prvSensorSnapSent( log_block * block )
+{
+    (void) block;
+    sensor_snap_queued = 0;
+}
+
+/* Snapshot of the store for the telemetry stream; the task is its only writer, so it reads it directly */
+static void prvSensorStream( TickType_t now )
+{
+    const sensor_reading * reading;
+    uint32_t changes;
+    uint8_t count = 0;
+    uint8_t i;
+
+    if ( ( sensor_stream_period == 0 ) || sensor_snap_queued || ( (int32_t)( now - sensor_stream_due ) < 0 ) ) {
+        return;
+    }
+    sensor_stream_due = now + sensor_stream_period;
+
+    /* Only the sensors that changed since the last snapshot, nothing is sent if none did */
+    changes = sensor_take_changes( SENSOR_CONSUMER_STREAM );
+    if ( changes == 0 ) {
+        return;
+    }
+
+    while ( changes ) {
+        i = SENSOR_CHANGE_NEXT( changes );
+        changes &= ~( 1UL << i );
+
+        reading = &sensor_store[i].copy[sensor_store[i].seq & 1];
+        sensor_snap[count].sensor = i;
+        sensor_snap[count].status = reading->status;
+        sensor_snap[count].value = reading->value;
+        sensor_snap[count].timestamp = reading->timestamp;
+        sensor_snap[count].average = reading->stats.count ? SENSOR_STATS_AVERAGE( &reading->stats ) : 0;
+        sensor_snap[count].count = ( reading->stats.count > 0xFFFF ) ? 0xFFFF : reading->stats.count;
+        count++;
+    }
+
+    sensor_snap_block.data = sensor_snap;
+    sensor_snap_block.len = count * sizeof(sensor_snapshot);
+    sensor_snap_block.tag = LOG_BLOCK_SENSORS;
+    sensor_snap_block.done = prvSensorSnapSent;
+    /* Set first, the block may go out (and be done) before log_send_block returns */
+    sensor_snap_queued = 1;
+    if ( !log_send_block( &sensor_snap_block ) ) {
+        sensor_snap_queued = 0;
+    }
+}
+
+/*! @brief Sensor polling task
+ *
+ * Wakes up every #SENSOR_POLL_PERIOD and reads the sensors that are due. The I2C ones are read by one
+ * scan list sweep per bus, all the buses at the same time, while the task reads the local and FPGA ones;
+ * it then waits for each sweep once. Then takes the telemetry snapshot if it's due.
+ */
+static void SensorTask( void * pvParameters )
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    watchdog_id wdg = watchdog_register( "Sensors", WATCHDOG_DEADLINE );
+    uint8_t i;
+
+    for ( i = 0; i < SENSOR_COUNT; i++ ) {
+        sensor_next_due[i] = last_wake;
+    }
+
+    for ( ;; ) {
+        vTaskDelayUntil( &last_wake, SENSOR_POLL_PERIOD );
+        watchdog_checkin( wdg );
+
+        for ( i = 0; i < I2C_NUM_INTERFACE; i++ ) {
+            prvSensorScanStart( i, last_wake );
+        }
+        prvSensorPollLocal( last_wake );
+        prvSensorPollFPGA( last_wake );
+        for ( i = 0; i < I2C_NUM_INTERFACE; i++ ) {
+            prvSensorScanEnd( i );
+        }
+        prvSensorStream( last_wake );
+    }
+}
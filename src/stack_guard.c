@@ -0,0 +1,105 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file stack_guard.c
+ *
+ * @brief MPU guard region at the bottom of the running task's stack
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+
+/* Project includes */
+#include "chip.h"
+#include "stack_guard.h"
+#include "ram_sections.h"
+
+#if configAPP_STACK_GUARD
+
+/* Memory management fault status (CFSR bits 7:0) */
+#define STACK_GUARD_MSTKERR         ( 1UL << 4 )    /* Stacking for an exception entry */
+#define STACK_GUARD_MMARVALID       ( 1UL << 7 )    /* MMFAR holds the faulting address */
+
+/* Region size field, log2( #STACK_GUARD_SIZE ) - 1 */
+#define STACK_GUARD_RASR_SIZE       4
+/* No access at all, not executable */
+#define STACK_GUARD_RASR            ( MPU_RASR_XN_Msk | ( 0UL << MPU_RASR_AP_Pos ) | \
+                                      ( STACK_GUARD_RASR_SIZE << MPU_RASR_SIZE_Pos ) | MPU_RASR_ENABLE_Msk )
+
+/* Base of the guard of the running task, 0 before the first switch */
+static uint32_t stack_guard_base;
+
+void stack_guard_init( void )
+{
+    MPU->RNR = STACK_GUARD_REGION;
+    MPU->RASR = 0;
+    /* Without it the fault would escalate to a hard fault */
+    SCB->SHCSR |= SCB_SHCSR_MEMFAULTENA_Msk;
+    MPU->CTRL = MPU_CTRL_PRIVDEFENA_Msk | MPU_CTRL_ENABLE_Msk;
+    __DSB();
+    __ISB();
+}
+
+__RAMFUNC_HOT void stack_guard_switch( const void * stack )
+{
+    stack_guard_base = ( (uint32_t) stack + STACK_GUARD_SIZE - 1 ) & ~( STACK_GUARD_SIZE - 1 );
+
+    /* RBAR with VALID selects the region itself, RASR keeps the same value from task to task */
+    MPU->RBAR = stack_guard_base | MPU_RBAR_VALID_Msk | STACK_GUARD_REGION;
+    MPU->RASR = STACK_GUARD_RASR;
+    /* The exception return of the context switch is the barrier the new setting needs */
+}
+
+void stack_guard_suspend( void )
+{
+    MPU->RNR = STACK_GUARD_REGION;
+    MPU->RASR = 0;
+    __DSB();
+    __ISB();
+}
+
+void stack_guard_resume( void )
+{
+    MPU->RNR = STACK_GUARD_REGION;
+    MPU->RASR = STACK_GUARD_RASR;
+    __DSB();
+    __ISB();
+}
+
+uint8_t stack_guard_fault( void )
+{
+    uint32_t status = SCB->CFSR & 0xFF;
+    uint32_t addr = SCB->MMFAR;
+
+    MPU->CTRL = 0;
+    __DSB();
+    __ISB();
+
+    if ( stack_guard_base == 0 ) {
+        return 0;
+    }
+    /* The exception frame didn't fit (the task's stack pointer was already down to the guard) */
+    if ( status & STACK_GUARD_MSTKERR ) {
+        return 1;
+    }
+    return ( status & STACK_GUARD_MMARVALID ) && ( addr - stack_guard_base < STACK_GUARD_SIZE );
+}
+
+#endif
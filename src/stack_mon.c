@@ -0,0 +1,141 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file stack_mon.c
+ *
+ * @brief Task stack usage telemetry
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* Project includes */
+#include "stack_mon.h"
+#include "periodic.h"
+
+typedef struct stack_mon_entry {
+    TaskHandle_t task;
+    uint16_t depth;
+    uint16_t min_free;
+} stack_mon_entry;
+
+static stack_mon_entry stack_mon[STACK_MON_MAX_TASKS];
+static uint8_t stack_mon_num;
+
+/* Free words of a task's stack, never reached */
+static uint16_t prvStackMonFree( TaskHandle_t task )
+{
+    uint16_t free;
+
+#if configAPP_STACK_GUARD
+    /* The walk starts at the bottom of the stack, in the guard when it's the running task's own */
+    vTaskSuspendAll();
+    stack_guard_suspend();
+    free = uxTaskGetStackHighWaterMark( task );
+    stack_guard_resume();
+    xTaskResumeAll();
+    /* The guard is never written, it can't be used either */
+    free = ( free > STACK_GUARD_SIZE / sizeof(StackType_t) ) ? free - STACK_GUARD_SIZE / sizeof(StackType_t) : 0;
+#else
+    free = uxTaskGetStackHighWaterMark( task );
+#endif
+    return free;
+}
+
+void stack_mon_register( TaskHandle_t task, uint16_t depth )
+{
+    stack_mon_entry * entry;
+
+    if ( ( task == NULL ) || ( stack_mon_num >= STACK_MON_MAX_TASKS ) ) {
+        return;
+    }
+
+    entry = &stack_mon[stack_mon_num];
+    entry->task = task;
+    entry->depth = depth;
+    entry->min_free = prvStackMonFree( task );
+
+    taskENTER_CRITICAL();
+    stack_mon_num++;
+    taskEXIT_CRITICAL();
+}
+
+static void prvStackMonSample( void * arg )
+{
+    static uint8_t kernel_tasks_registered;
+    uint8_t i;
+
+    (void) arg;
+
+    /* The kernel creates its tasks when the scheduler starts */
+    if ( !kernel_tasks_registered ) {
+        stack_mon_register( xTaskGetIdleTaskHandle(), configMINIMAL_STACK_SIZE );
+        stack_mon_register( xTimerGetTimerDaemonTaskHandle(), configTIMER_TASK_STACK_DEPTH );
+        kernel_tasks_registered = 1;
+    }
+
+    /* The high-water mark only goes down, the sample just saves walking the stack when it's asked for */
+    for ( i = 0; i < stack_mon_num; i++ ) {
+        stack_mon[i].min_free = prvStackMonFree( stack_mon[i].task );
+    }
+}
+
+/* Half a period out of phase with the CPU load sampling, which has the same period */
+static periodic_job stack_mon_job = PERIODIC_JOB( "StackMon", prvStackMonSample, NULL, STACK_MON_PERIOD, STACK_MON_PERIOD / 2 );
+
+void stack_mon_init( void )
+{
+    periodic_start( &stack_mon_job );
+}
+
+uint8_t stack_mon_count( void )
+{
+    return stack_mon_num;
+}
+
+uint8_t stack_mon_get( uint8_t index, stack_usage * usage )
+{
+    const stack_mon_entry * entry;
+    uint16_t used;
+    uint16_t margin;
+    uint16_t recommended;
+
+    if ( index >= stack_mon_num ) {
+        return 0;
+    }
+
+    entry = &stack_mon[index];
+    usage->name = pcTaskGetTaskName( entry->task );
+    usage->depth = entry->depth;
+    usage->min_free = entry->min_free;
+
+    used = entry->depth - entry->min_free;
+    margin = ( used * STACK_MON_MARGIN_PCT ) / 100;
+    if ( margin < STACK_MON_MARGIN_MIN ) {
+        margin = STACK_MON_MARGIN_MIN;
+    }
+    recommended = used + margin;
+    usage->recommended = ( recommended + STACK_MON_ROUND - 1 ) & ~( STACK_MON_ROUND - 1 );
+
+    return 1;
+}
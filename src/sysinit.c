@@ -35,10 +35,27 @@
  #include "board.h"
  #endif
 
+#include "FreeRTOS.h"
+#include "log.h"
+#include "clock.h"
+
 /*****************************************************************************
  * Private types/enumerations/variables
  ****************************************************************************/
 
+/* CCLKSEL values of the full and of the steady clock */
+static uint32_t clock_full_sel;
+static uint32_t clock_steady_sel;
+
+/* Users of the full clock, one bit each */
+static uint8_t clock_users;
+
+static clock_hook clock_hooks[CLOCK_HOOKS_MAX];
+static uint8_t clock_hook_count;
+
+/* In port.c, reloads the SysTick from SystemCoreClock */
+void vPortSetupTimerInterrupt(void);
+
 /*****************************************************************************
  * Public types/enumerations/variables
  ****************************************************************************/
@@ -52,6 +69,49 @@ const uint32_t RTCOscRateIn = 32768;
  * Private functions
  ****************************************************************************/
 
+/* Flash access time for a CPU clock: one more CPU clock every 20MHz, 5 clocks at most
+   (FLASHTIM_100MHZ_CPU, also the one of the 120MHz parts without power boost) */
+static FMC_FLASHTIM_T clockFlashTime(uint32_t hz)
+{
+	uint32_t clks = (hz - 1) / 20000000;
+
+	return (clks > FLASHTIM_100MHZ_CPU) ? FLASHTIM_100MHZ_CPU : (FMC_FLASHTIM_T) clks;
+}
+
+/* Switches the CPU clock divider, with the interrupts disabled */
+static void clockSetDivider(uint32_t sel)
+{
+	uint32_t hz = Chip_Clock_GetMainClockRate() / (sel + 1);
+
+	/* Flash slowed down before the CPU speeds up, sped up after it slows down */
+	if (hz > SystemCoreClock) {
+		Chip_SYSCTL_SetFLASHAccess(clockFlashTime(hz));
+	}
+	Chip_Clock_SetCPUClockDiv(sel);
+	if (hz < SystemCoreClock) {
+		Chip_SYSCTL_SetFLASHAccess(clockFlashTime(hz));
+	}
+	SystemCoreClockUpdate();
+}
+
+/* Keeps the divider PLL0 was locked with for the boosts, then drops to the steady clock */
+static void clockInit(void)
+{
+	uint32_t pll = Chip_Clock_GetMainClockRate();
+
+	clock_full_sel = Chip_Clock_GetCPUClockDiv() - 1;
+	clock_steady_sel = (pll + CLOCK_STEADY_HZ - 1) / CLOCK_STEADY_HZ - 1;
+	if (clock_steady_sel < clock_full_sel) {
+		clock_steady_sel = clock_full_sel;
+	}
+	if (clock_steady_sel > 0xFF) {
+		clock_steady_sel = 0xFF;
+	}
+
+	SystemCoreClockUpdate();
+	clockSetDivider(clock_steady_sel);
+}
+
 /*****************************************************************************
  * Public functions
  ****************************************************************************/
@@ -86,4 +146,47 @@ void SystemInit(void)
 	/* Setup system clocking and muxing */
 	Board_SystemInit();
 #endif
+
+	/* Steady clock until a job asks for the full one */
+	clockInit();
+}
+
+/* Registers a hook called on every change of the CPU clock */
+uint8_t clock_register(clock_hook hook)
+{
+	if (clock_hook_count >= CLOCK_HOOKS_MAX) {
+		return 0;
+	}
+	clock_hooks[clock_hook_count++] = hook;
+	return 1;
+}
+
+/* Sets or clears the full clock request of a user */
+void clock_boost(uint8_t user, uint8_t on)
+{
+	uint32_t sel;
+	uint8_t i;
+	uint8_t changed;
+
+	__disable_irq();
+	if (on) {
+		clock_users |= user;
+	}
+	else {
+		clock_users &= ~user;
+	}
+	sel = (clock_users != 0) ? clock_full_sel : clock_steady_sel;
+	changed = (sel != Chip_Clock_GetCPUClockDiv() - 1);
+	if (changed) {
+		clockSetDivider(sel);
+		vPortSetupTimerInterrupt();
+		for (i = 0; i < clock_hook_count; i++) {
+			clock_hooks[i]();
+		}
+	}
+	__enable_irq();
+
+	if (changed) {
+		LOG("clock,set,%u,%x", SystemCoreClock, clock_users);
+	}
 }
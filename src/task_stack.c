@@ -0,0 +1,50 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file task_stack.c
+ *
+ * @brief Task creation with static stacks
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* Project includes */
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "stack_mon.h"
+
+BaseType_t xTaskCreateWithStack( TaskFunction_t code, const char * name, uint16_t depth, void * params,
+                                 UBaseType_t prio, TaskHandle_t * handle, StackType_t * stack )
+{
+    TaskHandle_t task = NULL;
+    BaseType_t ret;
+
+    ret = xTaskGenericCreate( code, name, depth, params, prio, &task, stack, NULL );
+    if ( ret == pdPASS ) {
+        stack_mon_register( task, depth );
+    }
+    if ( handle ) {
+        *handle = task;
+    }
+    return ret;
+}
@@ -0,0 +1,214 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file telemetry.c
+ *
+ * @brief Sensor telemetry pushed to a subscribed collector over IPMB
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "timers.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmi.h"
+#include "sensor.h"
+#include "telemetry.h"
+#include "clock.h"
+
+static uint8_t telemetry_addr = TELEMETRY_DISABLED;
+static uint32_t telemetry_sensors;
+/*! @brief Subscribed sensors that changed and weren't sent yet */
+static uint32_t telemetry_pending;
+/*! @brief A frame was handed to IPMB and isn't answered yet, with these sensors */
+static uint8_t telemetry_in_flight;
+static uint32_t telemetry_in_frame;
+/*! @brief Frames handed to IPMB since the subscription (the low byte numbers them) and the ones not taken */
+static uint32_t telemetry_sent;
+static uint32_t telemetry_failed;
+
+static TimerHandle_t telemetry_timer;
+
+static void prvTelemetrySend( void );
+
+/* Outcome of the frame in flight, run by the IPMI dispatcher; arg holds its sensors if it wasn't taken */
+static void prvTelemetryDone( void * ctx, uint32_t lost )
+{
+    (void) ctx;
+
+    taskENTER_CRITICAL();
+    telemetry_in_flight = 0;
+    telemetry_pending |= lost & telemetry_sensors;
+    taskEXIT_CRITICAL();
+
+    if ( lost ) {
+        /* Tried again at the next period, with the readings of then */
+        telemetry_failed++;
+        return;
+    }
+    /* What didn't fit goes right away */
+    prvTelemetrySend();
+}
+
+/* Called from the IPMB or timer tasks, must not block; the rest is left to the dispatcher */
+static void prvTelemetrySent( ipmi_msg * resp, ipmb_error error, void * ctx )
+{
+    uint32_t lost = ( ( error == ipmb_error_success ) && ( resp->completion_code != IPMI_CC_NODE_BUSY ) ) ? 0 : telemetry_in_frame;
+
+    if ( !ipmi_defer( prvTelemetryDone, ctx, lost ) ) {
+        prvTelemetryDone( ctx, lost );
+    }
+}
+
+/* Hands a frame with as many pending sensors as fit to IPMB, unless one is already there */
+static void prvTelemetrySend( void )
+{
+    ipmi_msg req;
+    sensor_reading reading;
+    uint32_t pending;
+    uint32_t in_frame = 0;
+    uint8_t count = 0;
+    uint8_t len = TELEMETRY_HEADER_LEN;
+    uint8_t sensor;
+
+    taskENTER_CRITICAL();
+    if ( telemetry_in_flight || ( telemetry_pending == 0 ) || ( telemetry_addr == TELEMETRY_DISABLED ) ) {
+        taskEXIT_CRITICAL();
+        return;
+    }
+    telemetry_in_flight = 1;
+    pending = telemetry_pending;
+    req.dest_addr = telemetry_addr;
+    taskEXIT_CRITICAL();
+
+    while ( pending && ( count < TELEMETRY_FRAME_ENTRIES ) ) {
+        sensor = SENSOR_CHANGE_NEXT( pending );
+        pending &= ~( 1UL << sensor );
+        in_frame |= ( 1UL << sensor );
+
+        sensor_get_reading( sensor, &reading );
+        req.data[len++] = sensor;
+        req.data[len++] = sensor_reading_stale( sensor, &reading ) ? SENSOR_READING_UNAVAILABLE : reading.status;
+        req.data[len++] = reading.value & 0xFF;
+        count++;
+    }
+
+    req.netfn = NETFN_CUSTOM;
+    req.cmd = IPMI_CUSTOM_CMD_TELEMETRY_FRAME;
+    req.data[0] = telemetry_sent & 0xFF;
+    req.data[1] = count;
+    req.data_len = len;
+
+    taskENTER_CRITICAL();
+    telemetry_pending &= ~in_frame;
+    telemetry_in_frame = in_frame;
+    taskEXIT_CRITICAL();
+
+    telemetry_sent++;
+    if ( ipmb_send_request_async( &req, prvTelemetrySent, NULL ) != ipmb_error_success ) {
+        /* TX queue full or no sequence number free, the callback won't be called */
+        prvTelemetryDone( NULL, in_frame );
+    }
+}
+
+/* Once per period, run by the dispatcher: the changes since the last one become pending */
+static void prvTelemetryTick( void * ctx, uint32_t unused )
+{
+    uint32_t changes = sensor_take_changes( SENSOR_CONSUMER_PUSH );
+
+    (void) ctx;
+    (void) unused;
+
+    taskENTER_CRITICAL();
+    telemetry_pending |= changes & telemetry_sensors;
+    taskEXIT_CRITICAL();
+
+    prvTelemetrySend();
+}
+
+/* Called from the timer task, the frame is built by the dispatcher like the rest */
+static void prvTelemetryTimer( TimerHandle_t timer )
+{
+    (void) timer;
+
+    if ( !ipmi_defer( prvTelemetryTick, NULL, 0 ) ) {
+        prvTelemetryTick( NULL, 0 );
+    }
+}
+
+void telemetry_init( void )
+{
+    telemetry_timer = xTimerCreate( "Telemetry", TELEMETRY_MIN_PERIOD_MS / portTICK_PERIOD_MS, pdTRUE, NULL, prvTelemetryTimer );
+    configASSERT( telemetry_timer );
+}
+
+uint8_t telemetry_subscribe( uint8_t addr, uint32_t sensors, uint16_t period_ms )
+{
+    if ( telemetry_timer == NULL ) {
+        return 0;
+    }
+
+    if ( addr == TELEMETRY_DISABLED ) {
+        xTimerStop( telemetry_timer, 0 );
+        taskENTER_CRITICAL();
+        telemetry_addr = TELEMETRY_DISABLED;
+        telemetry_sensors = 0;
+        telemetry_pending = 0;
+        taskEXIT_CRITICAL();
+        clock_boost( CLOCK_BOOST_TELEMETRY, 0 );
+        return 1;
+    }
+
+    if ( sensor_count() < 32 ) {
+        sensors &= ( 1UL << sensor_count() ) - 1;
+    }
+    if ( ( period_ms < TELEMETRY_MIN_PERIOD_MS ) || ( sensors == 0 ) ) {
+        return 0;
+    }
+
+    /* Whatever changed before the subscription is in the first frames anyway */
+    sensor_take_changes( SENSOR_CONSUMER_PUSH );
+
+    taskENTER_CRITICAL();
+    telemetry_addr = addr;
+    telemetry_sensors = sensors;
+    telemetry_pending = sensors;
+    telemetry_sent = 0;
+    telemetry_failed = 0;
+    taskEXIT_CRITICAL();
+
+    /* The sensor sweeps and the frames keep coming while subscribed */
+    clock_boost( CLOCK_BOOST_TELEMETRY, 1 );
+    xTimerChangePeriod( telemetry_timer, period_ms / portTICK_PERIOD_MS, 0 );
+    prvTelemetrySend();
+    return 1;
+}
+
+void telemetry_get_stats( uint32_t * sent, uint32_t * failed )
+{
+    taskENTER_CRITICAL();
+    *sent = telemetry_sent;
+    *failed = telemetry_failed;
+    taskEXIT_CRITICAL();
+}
@@ -0,0 +1,384 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file threshold.c
+ *
+ * @brief Threshold evaluation of the sensor readings
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+
+/* C Standard includes */
+#include "string.h"
+
+/* Project includes */
+#include "i2c.h"
+#include "sdr.h"
+#include "event.h"
+#include "threshold.h"
+#include "board_defs.h"
+#include "board_sensors.h"
+#include "config_store.h"
+
+/*! @brief Settings kept for a sensor: its thresholds, then the positive and negative hysteresis */
+#define THRESHOLD_CONFIG_LEN        ( THRESHOLD_COUNT + 2 )
+
+/*! @brief Event offset of each threshold (going low for the lower ones, going high for the upper ones) */
+static const uint8_t threshold_offset[THRESHOLD_COUNT] = { 0x00, 0x02, 0x04, 0x07, 0x09, 0x0B };
+
+/*! @brief Thresholds of a sensor
+ *
+ * The levels are only written by the IPMI handlers and copied by the poller inside a critical section;
+ * the state is only written by the poller.
+ */
+typedef struct threshold_sensor {
+    const sdr_full_sensor * sdr;
+    uint8_t raw[THRESHOLD_COUNT];           /*!< As set, given back by Get Sensor Threshold */
+    int16_t assert_level[THRESHOLD_COUNT];  /*!< Reading at (or past) which the threshold asserts */
+    int16_t deassert_level[THRESHOLD_COUNT];/*!< Reading past which the threshold deasserts, hysteresis applied */
+    uint8_t pos_hyst;
+    uint8_t neg_hyst;
+    uint8_t readable;                       /*!< Thresholds in use */
+    uint8_t settable;
+    uint8_t assert_events;                  /*!< Thresholds sending an event when they assert */
+    uint8_t deassert_events;                /*!< Thresholds sending an event when they deassert */
+    uint8_t state;                          /*!< Thresholds asserted */
+    uint16_t margin;                        /*!< See #threshold_margin */
+} threshold_sensor;
+
+static threshold_sensor threshold_table[BOARD_SENSOR_COUNT];
+
+/* Raw reading or threshold compared as a signed number, whatever the analog format */
+static int16_t prvThresholdNormalize( const threshold_sensor * ts, uint8_t raw )
+{
+    if ( ( ts->sdr->units1 & SDR_UNITS_FORMAT_MASK ) == SDR_UNITS_2S_COMPLEMENT ) {
+        return (int8_t) raw;
+    }
+    return raw;
+}
+
+/* Thresholds sending an event, from an SDR event mask */
+static uint8_t prvThresholdEventMask( const uint8_t * mask )
+{
+    uint16_t events = mask[0] | ( mask[1] << 8 );
+    uint8_t bits = 0;
+    uint8_t i;
+
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        if ( events & ( 1 << threshold_offset[i] ) ) {
+            bits |= ( 1 << i );
+        }
+    }
+    return bits;
+}
+
+/* Recomputes the levels of a sensor, called with the scheduler locked if the poller is running */
+static void prvThresholdLevels( threshold_sensor * ts )
+{
+    uint8_t i;
+
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        ts->assert_level[i] = prvThresholdNormalize( ts, ts->raw[i] );
+        /* Upper thresholds deassert below the level, lower ones above */
+        if ( ( 1 << i ) & THRESHOLD_UPPER ) {
+            ts->deassert_level[i] = ts->assert_level[i] - ts->pos_hyst;
+        } else {
+            ts->deassert_level[i] = ts->assert_level[i] + ts->neg_hyst;
+        }
+    }
+}
+
+/* Thresholds set over IPMI before the reset, the ones still settable */
+static void prvThresholdRestore( threshold_sensor * ts, uint8_t sensor )
+{
+    uint8_t saved[THRESHOLD_CONFIG_LEN];
+    uint8_t i;
+
+    if ( !config_get( CONFIG_KEY_THRESHOLD( sensor ), saved, THRESHOLD_CONFIG_LEN ) ) {
+        return;
+    }
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        if ( ts->settable & ( 1 << i ) ) {
+            ts->raw[i] = saved[i];
+        }
+    }
+    if ( ( ts->sdr->capabilities & SDR_CAP_HYSTERESIS_MASK ) == SDR_CAP_HYSTERESIS_SETTABLE ) {
+        ts->pos_hyst = saved[THRESHOLD_COUNT];
+        ts->neg_hyst = saved[THRESHOLD_COUNT + 1];
+    }
+}
+
+/* Keeps the thresholds of a sensor across a reset */
+static void prvThresholdSave( const threshold_sensor * ts, uint8_t sensor )
+{
+    uint8_t saved[THRESHOLD_CONFIG_LEN];
+
+    taskENTER_CRITICAL();
+    memcpy( saved, ts->raw, THRESHOLD_COUNT );
+    saved[THRESHOLD_COUNT] = ts->pos_hyst;
+    saved[THRESHOLD_COUNT + 1] = ts->neg_hyst;
+    taskEXIT_CRITICAL();
+
+    config_set( CONFIG_KEY_THRESHOLD( sensor ), saved, THRESHOLD_CONFIG_LEN );
+}
+
+void threshold_init( void )
+{
+    threshold_sensor * ts;
+    const sdr_full_sensor * sdr;
+    uint8_t i;
+
+    for ( i = 0; i < BOARD_SENSOR_COUNT; i++ ) {
+        ts = &threshold_table[i];
+        sdr = sdr_get_sensor( i );
+        ts->sdr = sdr;
+        ts->margin = THRESHOLD_MARGIN_NONE;
+
+        if ( sdr->event_type != SDR_EVENT_TYPE_THRESHOLD ) {
+            continue;
+        }
+
+        ts->raw[0] = sdr->lower_noncritical;
+        ts->raw[1] = sdr->lower_critical;
+        ts->raw[2] = sdr->lower_nonrecover;
+        ts->raw[3] = sdr->upper_noncritical;
+        ts->raw[4] = sdr->upper_critical;
+        ts->raw[5] = sdr->upper_nonrecover;
+        ts->pos_hyst = sdr->pos_hysteresis;
+        ts->neg_hyst = sdr->neg_hysteresis;
+        ts->readable = sdr->reading_mask[0] & THRESHOLD_ALL;
+        ts->settable = sdr->reading_mask[1] & THRESHOLD_ALL;
+        ts->assert_events = prvThresholdEventMask( sdr->assert_mask );
+        ts->deassert_events = prvThresholdEventMask( sdr->deassert_mask );
+        prvThresholdRestore( ts, i );
+        prvThresholdLevels( ts );
+    }
+}
+
+static void prvThresholdEvent( const threshold_sensor * ts, uint8_t sensor, uint8_t threshold, uint8_t deassert, uint8_t reading )
+{
+    ipmi_event event;
+
+    event.sensor_type = ts->sdr->sensor_type;
+    event.sensor_num = sensor;
+    event.dir_type = ( deassert ? EVENT_DEASSERTION : 0 ) | SDR_EVENT_TYPE_THRESHOLD;
+    event.data[0] = EVENT_DATA1_THRESHOLD( threshold_offset[threshold] );
+    event.data[1] = reading;
+    event.data[2] = ts->raw[threshold];
+
+    event_post( &event );
+}
+
+void threshold_evaluate( uint8_t sensor, uint16_t value )
+{
+    threshold_sensor * ts;
+    int16_t assert_level[THRESHOLD_COUNT];
+    int16_t deassert_level[THRESHOLD_COUNT];
+    int16_t reading;
+    uint8_t readable;
+    uint8_t state;
+    uint8_t changed;
+    uint8_t bit;
+    uint8_t i;
+    uint16_t margin;
+    uint16_t distance;
+
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return;
+    }
+
+    ts = &threshold_table[sensor];
+    if ( ts->readable == 0 ) {
+        return;
+    }
+
+    /* Consistent set of levels, Set Sensor Threshold may run meanwhile */
+    taskENTER_CRITICAL();
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        assert_level[i] = ts->assert_level[i];
+        deassert_level[i] = ts->deassert_level[i];
+    }
+    readable = ts->readable;
+    taskEXIT_CRITICAL();
+
+    reading = prvThresholdNormalize( ts, value & 0xFF );
+    state = ts->state;
+
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        bit = ( 1 << i );
+
+        if ( !( readable & bit ) ) {
+            state &= ~bit;
+        } else if ( bit & THRESHOLD_UPPER ) {
+            if ( reading >= assert_level[i] ) {
+                state |= bit;
+            } else if ( reading < deassert_level[i] ) {
+                state &= ~bit;
+            }
+        } else {
+            if ( reading <= assert_level[i] ) {
+                state |= bit;
+            } else if ( reading > deassert_level[i] ) {
+                state &= ~bit;
+            }
+        }
+    }
+
+    changed = state ^ ts->state;
+    ts->state = state;
+
+    margin = THRESHOLD_MARGIN_NONE;
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        bit = ( 1 << i );
+        if ( !( readable & bit ) ) {
+            continue;
+        }
+        if ( state & bit ) {
+            distance = 0;
+        } else if ( bit & THRESHOLD_UPPER ) {
+            distance = assert_level[i] - reading;
+        } else {
+            distance = reading - assert_level[i];
+        }
+        if ( distance < margin ) {
+            margin = distance;
+        }
+    }
+    ts->margin = margin;
+
+    /* Only transitions are reported, a reading staying past a threshold sends nothing more */
+    for ( i = 0; changed && ( i < THRESHOLD_COUNT ); i++ ) {
+        bit = ( 1 << i );
+        if ( !( changed & bit ) ) {
+            continue;
+        }
+        changed &= ~bit;
+
+        if ( state & bit ) {
+            if ( ts->assert_events & bit ) {
+                prvThresholdEvent( ts, sensor, i, 0, value & 0xFF );
+            }
+        } else if ( ts->deassert_events & bit ) {
+            prvThresholdEvent( ts, sensor, i, 1, value & 0xFF );
+        }
+    }
+}
+
+uint16_t threshold_margin( uint8_t sensor )
+{
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return THRESHOLD_MARGIN_NONE;
+    }
+    return threshold_table[sensor].margin;
+}
+
+uint8_t threshold_state( uint8_t sensor )
+{
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+    return threshold_table[sensor].state;
+}
+
+uint8_t threshold_get( uint8_t sensor, uint8_t * raw )
+{
+    threshold_sensor * ts;
+    uint8_t i;
+
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+
+    ts = &threshold_table[sensor];
+    taskENTER_CRITICAL();
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        raw[i] = ( ts->readable & ( 1 << i ) ) ? ts->raw[i] : 0;
+    }
+    taskEXIT_CRITICAL();
+
+    return ts->readable;
+}
+
+uint8_t threshold_set( uint8_t sensor, uint8_t mask, const uint8_t * raw )
+{
+    threshold_sensor * ts;
+    uint8_t i;
+
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+
+    ts = &threshold_table[sensor];
+    if ( mask & ~ts->settable ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    for ( i = 0; i < THRESHOLD_COUNT; i++ ) {
+        if ( mask & ( 1 << i ) ) {
+            ts->raw[i] = raw[i];
+        }
+    }
+    prvThresholdLevels( ts );
+    taskEXIT_CRITICAL();
+
+    prvThresholdSave( ts, sensor );
+    return 1;
+}
+
+uint8_t threshold_get_hysteresis( uint8_t sensor, uint8_t * pos, uint8_t * neg )
+{
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    *pos = threshold_table[sensor].pos_hyst;
+    *neg = threshold_table[sensor].neg_hyst;
+    taskEXIT_CRITICAL();
+
+    return 1;
+}
+
+uint8_t threshold_set_hysteresis( uint8_t sensor, uint8_t pos, uint8_t neg )
+{
+    threshold_sensor * ts;
+
+    if ( sensor >= BOARD_SENSOR_COUNT ) {
+        return 0;
+    }
+
+    ts = &threshold_table[sensor];
+    if ( ( ts->sdr->capabilities & SDR_CAP_HYSTERESIS_MASK ) != SDR_CAP_HYSTERESIS_SETTABLE ) {
+        return 0;
+    }
+
+    taskENTER_CRITICAL();
+    ts->pos_hyst = pos;
+    ts->neg_hyst = neg;
+    prvThresholdLevels( ts );
+    taskEXIT_CRITICAL();
+
+    prvThresholdSave( ts, sensor );
+    return 1;
+}
@@ -0,0 +1,339 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file timer_wheel.c
+ *
+ * @brief Protocol deadlines sharing a single software timer
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+/* Project includes */
+#include "timer_wheel.h"
+#include "idle_job.h"
+#include "metrics.h"
+
+/* A tick is reached once the wheel is at most half the tick range past it (the ticks wrap) */
+#define WHEEL_REACHED( now, tick )  ( (TickType_t) ( ( now ) - ( tick ) ) < ( portMAX_DELAY / 2 ) )
+#define WHEEL_MASK                  ( WHEEL_SLOTS - 1 )
+/* Slot of a tick at a level, and the tick the slots of that level start from */
+#define WHEEL_INDEX( tick, level )  ( ( ( tick ) >> ( ( level ) * WHEEL_SLOT_BITS ) ) & WHEEL_MASK )
+#define WHEEL_START( tick, level )  ( ( ( tick ) >> ( ( level ) * WHEEL_SLOT_BITS ) ) << ( ( level ) * WHEEL_SLOT_BITS ) )
+/* wheel_timer.slot of a timer taken out of the wheel to expire */
+#define WHEEL_NO_SLOT               0xFF
+/* Longest wait for room in the timer command queue when the driver is armed from a task */
+#define WHEEL_KICK_WAIT             ( 10 / portTICK_PERIOD_MS )
+/* Period of the idle check arming the driver again after a command that couldn't be queued */
+#define WHEEL_REARM_PERIOD          ( 1000 / portTICK_PERIOD_MS )
+
+static wheel_timer * wheel_slot[WHEEL_LEVELS][WHEEL_SLOTS];
+/*! @brief Slots holding timers, one bit per slot of each level */
+static uint32_t wheel_busy[WHEEL_LEVELS];
+/*! @brief Next tick to process, the slots of the ticks before it are empty */
+static TickType_t wheel_base;
+/*! @brief Timers of the tick being processed, waiting for their callback */
+static wheel_timer * wheel_expired;
+static TimerHandle_t wheel_driver;
+/*! @brief Tick the driver is armed for, valid while #wheel_armed is set */
+static TickType_t wheel_wakeup;
+static uint8_t wheel_armed;
+/*! @brief A pass is going on, it arms the driver for the timers started meanwhile once it's done */
+static uint8_t wheel_running;
+
+static uint32_t wheel_passes;
+static uint32_t wheel_expirations;
+static uint32_t wheel_cascades;
+static uint32_t wheel_kick_failures;
+METRIC_COUNTER( "wheel.passes", wheel_passes );
+METRIC_COUNTER( "wheel.expired", wheel_expirations );
+METRIC_COUNTER( "wheel.kick_failed", wheel_kick_failures );
+
+static uint8_t prvWheelRearm( void * arg );
+static idle_job wheel_rearm_job = IDLE_JOB( "Wheel", prvWheelRearm, NULL, WHEEL_REARM_PERIOD );
+METRIC_COUNTER( "wheel.cascaded", wheel_cascades );
+
+/* Bits of a slot bitmap, from slot first on: bit n is slot ( first + n ) % WHEEL_SLOTS */
+static uint32_t prvWheelRotate( uint32_t busy, uint32_t first )
+{
+    first &= WHEEL_MASK;
+    return ( first == 0 ) ? busy : ( busy >> first ) | ( busy << ( WHEEL_SLOTS - first ) );
+}
+
+static void prvWheelLink( wheel_timer ** head, wheel_timer * timer )
+{
+    timer->next = *head;
+    if ( timer->next != NULL ) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+/* Takes a pending timer out of its list, from inside a critical section */
+static void prvWheelUnlink( wheel_timer * timer )
+{
+    uint8_t level = timer->slot / WHEEL_SLOTS;
+    uint8_t index = timer->slot % WHEEL_SLOTS;
+
+    *timer->pprev = timer->next;
+    if ( timer->next != NULL ) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->pprev = NULL;
+
+    if ( ( timer->slot != WHEEL_NO_SLOT ) && ( wheel_slot[level][index] == NULL ) ) {
+        wheel_busy[level] &= ~( 1UL << index );
+    }
+}
+
+/* Puts a timer in the slot of its expiry, from inside a critical section.
+ * A level holds the timers due before the wheel gets past its slots again: its current slot was already moved
+ * down (or is moved down before the tick is processed), so a delta of up to the level span maps to one slot only. */
+static void prvWheelInsert( wheel_timer * timer )
+{
+    TickType_t tick = timer->expiry;
+    TickType_t delta;
+    uint8_t level;
+
+    if ( WHEEL_REACHED( wheel_base, tick ) ) {
+        /* Already due, expires on the next pass */
+        tick = wheel_base;
+    }
+    delta = tick - wheel_base;
+    if ( delta >= WHEEL_RANGE ) {
+        /* Too far for the wheel, goes round the top level and is put back in when it comes down */
+        tick = wheel_base + WHEEL_RANGE - 1;
+        delta = WHEEL_RANGE - 1;
+    }
+
+    level = 0;
+    while ( ( level < WHEEL_LEVELS - 1 ) && ( ( delta >> ( ( level + 1 ) * WHEEL_SLOT_BITS ) ) != 0 ) ) {
+        level++;
+    }
+
+    timer->slot = level * WHEEL_SLOTS + WHEEL_INDEX( tick, level );
+    prvWheelLink( &wheel_slot[level][WHEEL_INDEX( tick, level )], timer );
+    wheel_busy[level] |= 1UL << WHEEL_INDEX( tick, level );
+}
+
+/* Next tick with work from wheel_base on (a slot of level 0 to expire or one above to move down), 0 if the wheel is empty */
+static uint8_t prvWheelNext( TickType_t * next )
+{
+    TickType_t first;
+    TickType_t tick;
+    uint32_t busy;
+    uint8_t found = 0;
+    uint8_t level;
+
+    for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+        /* First tick at or after wheel_base starting a slot of this level */
+        first = ( wheel_base + ( 1UL << ( level * WHEEL_SLOT_BITS ) ) - 1 ) >> ( level * WHEEL_SLOT_BITS );
+        busy = prvWheelRotate( wheel_busy[level], first );
+        if ( busy == 0 ) {
+            continue;
+        }
+        tick = ( first + __builtin_ctz( busy ) ) << ( level * WHEEL_SLOT_BITS );
+        if ( !found || ( (TickType_t) ( tick - wheel_base ) < (TickType_t) ( *next - wheel_base ) ) ) {
+            *next = tick;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/* Moves the timers of a slot down the wheel, from inside a critical section */
+static void prvWheelCascade( uint8_t level, uint8_t index )
+{
+    wheel_timer * timer = wheel_slot[level][index];
+    wheel_timer * next;
+
+    wheel_slot[level][index] = NULL;
+    wheel_busy[level] &= ~( 1UL << index );
+    for ( ; timer != NULL; timer = next ) {
+        next = timer->next;
+        prvWheelInsert( timer );
+        wheel_cascades++;
+    }
+}
+
+/* Timer command queue full (configTIMER_QUEUE_LENGTH): left unarmed, the next timer started or prvWheelRearm retries */
+static void prvWheelKickFailed( void )
+{
+    taskENTER_CRITICAL();
+    wheel_armed = 0;
+    wheel_kick_failures++;
+    taskEXIT_CRITICAL();
+}
+
+/* Idle job: arms the driver again if timers are pending and its last command couldn't be queued */
+static uint8_t prvWheelRearm( void * arg )
+{
+    TickType_t next;
+    uint8_t kick;
+
+    (void) arg;
+
+    taskENTER_CRITICAL();
+    kick = !wheel_armed && !wheel_running && prvWheelNext( &next );
+    if ( kick ) {
+        /* The pass finds out when the next one is really due */
+        wheel_armed = 1;
+        wheel_wakeup = xTaskGetTickCount() + 1;
+    }
+    taskEXIT_CRITICAL();
+
+    /* The idle task mustn't block */
+    if ( kick && ( xTimerChangePeriod( wheel_driver, 1, 0 ) != pdPASS ) ) {
+        prvWheelKickFailed();
+    }
+    return IDLE_JOB_DONE;
+}
+
+/* Driver timer callback: processes the ticks with work up to now, then rearms for the next one */
+static void prvWheelRun( TimerHandle_t driver )
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t next;
+    wheel_timer * timer;
+    wheel_timer * list;
+    uint8_t level;
+    uint8_t index;
+    uint8_t pending;
+
+    taskENTER_CRITICAL();
+    wheel_passes++;
+    wheel_running = 1;
+    while ( prvWheelNext( &next ) && WHEEL_REACHED( now, next ) ) {
+        wheel_base = next;
+
+        /* Upper levels first, at the ticks where their slots start */
+        for ( level = WHEEL_LEVELS - 1; level > 0; level-- ) {
+            if ( WHEEL_START( wheel_base, level ) == wheel_base ) {
+                prvWheelCascade( level, WHEEL_INDEX( wheel_base, level ) );
+            }
+        }
+
+        /* The timers started again by the callbacks go to a later tick */
+        index = WHEEL_INDEX( wheel_base, 0 );
+        list = wheel_slot[0][index];
+        wheel_slot[0][index] = NULL;
+        wheel_busy[0] &= ~( 1UL << index );
+        wheel_base++;
+
+        wheel_expired = list;
+        if ( list != NULL ) {
+            list->pprev = &wheel_expired;
+        }
+        for ( timer = list; timer != NULL; timer = timer->next ) {
+            timer->slot = WHEEL_NO_SLOT;
+        }
+
+        /* One at a time, a callback may stop the ones after it */
+        while ( ( timer = wheel_expired ) != NULL ) {
+            prvWheelUnlink( timer );
+            wheel_expirations++;
+            taskEXIT_CRITICAL();
+            timer->fn( timer->arg );
+            taskENTER_CRITICAL();
+        }
+    }
+
+    if ( WHEEL_REACHED( now, wheel_base ) ) {
+        wheel_base = now + 1;
+    }
+    pending = prvWheelNext( &next );
+    wheel_running = 0;
+    wheel_armed = pending;
+    wheel_wakeup = next;
+    taskEXIT_CRITICAL();
+
+    /* Allowed from a timer callback with no block time */
+    if ( pending && ( xTimerChangePeriod( driver, next - now, 0 ) != pdPASS ) ) {
+        prvWheelKickFailed();
+    }
+}
+
+void wheel_timer_init( wheel_timer * timer, void (* fn)( void * arg ), void * arg )
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->slot = WHEEL_NO_SLOT;
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+void wheel_timer_start( wheel_timer * timer, TickType_t delay )
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait;
+    uint8_t kick = 0;
+
+    if ( wheel_driver == NULL ) {
+        wheel_driver = xTimerCreate( "Wheel", 1, pdFALSE, NULL, prvWheelRun );
+        configASSERT( wheel_driver );
+        idle_job_start( &wheel_rearm_job );
+    }
+
+    taskENTER_CRITICAL();
+    if ( timer->pprev != NULL ) {
+        prvWheelUnlink( timer );
+    }
+    if ( ( wheel_busy[0] | wheel_busy[1] | wheel_busy[2] ) == 0 ) {
+        /* Nothing left behind, the wheel can start over from now */
+        wheel_base = now;
+    }
+    timer->expiry = now + delay;
+    prvWheelInsert( timer );
+
+    /* The driver wakes up before this one, or runs it on its next pass (the one going on included) */
+    if ( !wheel_running && ( !wheel_armed || !WHEEL_REACHED( timer->expiry, wheel_wakeup ) ) ) {
+        wheel_armed = 1;
+        wheel_wakeup = timer->expiry;
+        kick = 1;
+    }
+    taskEXIT_CRITICAL();
+
+    if ( !kick ) {
+        return;
+    }
+    /* The timer task can't wait for its own queue */
+    wait = ( xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle() ) ? 0 : WHEEL_KICK_WAIT;
+    if ( xTimerChangePeriod( wheel_driver, ( delay > 0 ) ? delay : 1, wait ) != pdPASS ) {
+        prvWheelKickFailed();
+    }
+}
+
+void wheel_timer_stop( wheel_timer * timer )
+{
+    /* The driver isn't rearmed, a pass finding nothing due costs less than the command */
+    taskENTER_CRITICAL();
+    if ( timer->pprev != NULL ) {
+        prvWheelUnlink( timer );
+    }
+    taskEXIT_CRITICAL();
+}
+
+uint8_t wheel_timer_active( const wheel_timer * timer )
+{
+    return timer->pprev != NULL;
+}
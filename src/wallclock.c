@@ -0,0 +1,201 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * @file wallclock.c
+ *
+ * @brief Wall clock, from the MCH time and the tick count, kept in the RTC across resets
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* Project includes */
+#include "chip.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "ipmi.h"
+#include "log.h"
+#include "wallclock.h"
+#include "timer_wheel.h"
+
+/* Marks the RTC as set by a sync, in a general purpose register (kept with the RTC) */
+#define WALLCLOCK_RTC_MAGIC         0x4B4C4357  /* "WCLK" */
+#define WALLCLOCK_RTC_GPREG         0
+/* Days from 0000-03-01 to 1970-01-01, in the proleptic Gregorian calendar */
+#define WALLCLOCK_EPOCH_DAYS        719468
+
+/*! @brief What a reading is based on */
+typedef struct wallclock_base {
+    uint64_t ms;                            /*!< Time at #tick, 0 if unknown */
+    TickType_t tick;
+} wallclock_base;
+
+/*! @brief Two copies, readers use copy seq & 1 and the writer (the sync callback) the other one */
+static wallclock_base wallclock[2];
+static volatile uint32_t wallclock_seq;
+static wheel_timer wallclock_timer;
+
+/* Days since 1970 of a date, month 1 to 12 */
+static uint32_t prvWallclockDays( uint32_t year, uint32_t month, uint32_t day )
+{
+    uint32_t era;
+    uint32_t yoe;
+    uint32_t doy;
+
+    /* Years start in March, so the leap day is the last one */
+    year -= ( month <= 2 );
+    era = year / 400;
+    yoe = year - era * 400;
+    doy = ( 153 * ( ( month > 2 ) ? month - 3 : month + 9 ) + 2 ) / 5 + day - 1;
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - WALLCLOCK_EPOCH_DAYS;
+}
+
+static uint32_t prvWallclockFromRTC( const RTC_TIME_T * time )
+{
+    return prvWallclockDays( time->time[RTC_TIMETYPE_YEAR], time->time[RTC_TIMETYPE_MONTH], time->time[RTC_TIMETYPE_DAYOFMONTH] ) * 86400 +
+           time->time[RTC_TIMETYPE_HOUR] * 3600 + time->time[RTC_TIMETYPE_MINUTE] * 60 + time->time[RTC_TIMETYPE_SECOND];
+}
+
+static void prvWallclockToRTC( uint32_t seconds, RTC_TIME_T * time )
+{
+    uint32_t days = seconds / 86400;
+    uint32_t z = days + WALLCLOCK_EPOCH_DAYS;
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365;
+    uint32_t doy = doe - ( 365 * yoe + yoe / 4 - yoe / 100 );
+    uint32_t mp = ( 5 * doy + 2 ) / 153;
+    uint32_t month = ( mp < 10 ) ? mp + 3 : mp - 9;
+    uint32_t year = yoe + era * 400 + ( month <= 2 );
+
+    time->time[RTC_TIMETYPE_SECOND] = seconds % 60;
+    time->time[RTC_TIMETYPE_MINUTE] = ( seconds / 60 ) % 60;
+    time->time[RTC_TIMETYPE_HOUR] = ( seconds / 3600 ) % 24;
+    time->time[RTC_TIMETYPE_DAYOFMONTH] = doy - ( 153 * mp + 2 ) / 5 + 1;
+    /* 1970-01-01 was a Thursday, Sunday is 0 */
+    time->time[RTC_TIMETYPE_DAYOFWEEK] = ( days + 4 ) % 7;
+    time->time[RTC_TIMETYPE_DAYOFYEAR] = days - prvWallclockDays( year, 1, 1 ) + 1;
+    time->time[RTC_TIMETYPE_MONTH] = month;
+    time->time[RTC_TIMETYPE_YEAR] = year;
+}
+
+/* Publishes a new base, only called from one task at a time (init, then the IPMB RX task) */
+static void prvWallclockSet( uint64_t ms, TickType_t tick )
+{
+    uint32_t seq = wallclock_seq;
+    wallclock_base * next = &wallclock[( seq + 1 ) & 1];
+
+    next->ms = ms;
+    next->tick = tick;
+    /* The copy must be complete before readers are pointed to it */
+    __DMB();
+    wallclock_seq = seq + 1;
+}
+
+uint64_t wallclock_ms( void )
+{
+    const wallclock_base * base;
+    uint64_t ms;
+    uint32_t seq;
+
+    do {
+        seq = wallclock_seq;
+        base = &wallclock[seq & 1];
+        ms = ( base->ms != 0 ) ? base->ms + (uint64_t) ( xTaskGetTickCount() - base->tick ) * portTICK_PERIOD_MS : 0;
+        /* Retried only if two syncs came while reading */
+    } while ( wallclock_seq - seq > 1 );
+
+    return ms;
+}
+
+uint32_t wallclock_seconds( void )
+{
+    return wallclock_ms() / 1000;
+}
+
+/* Called from the IPMB or timer tasks, must not block */
+static void prvWallclockSynced( ipmi_msg * resp, ipmb_error error, void * ctx )
+{
+    RTC_TIME_T time;
+    uint32_t seconds;
+    uint64_t now;
+
+    (void) ctx;
+
+    if ( ( error != ipmb_error_success ) || ( resp->completion_code != IPMI_CC_OK ) || ( resp->data_len < 4 ) ) {
+        LOG( "wallclock,sync_failed,%u", ( error != ipmb_error_success ) ? error : resp->completion_code );
+        wheel_timer_start( &wallclock_timer, WALLCLOCK_SYNC_RETRY );
+        return;
+    }
+
+    seconds = resp->data[0] | ( resp->data[1] << 8 ) | ( resp->data[2] << 16 ) | ( (uint32_t) resp->data[3] << 24 );
+    now = wallclock_ms();
+    if ( now / 1000 < seconds ) {
+        prvWallclockSet( (uint64_t) seconds * 1000, xTaskGetTickCount() );
+    } else if ( now / 1000 > seconds ) {
+        prvWallclockSet( (uint64_t) seconds * 1000 + 999, xTaskGetTickCount() );
+    }
+
+    prvWallclockToRTC( seconds, &time );
+    Chip_RTC_SetFullTime( LPC_RTC, &time );
+    LPC_RTC->GPREG[WALLCLOCK_RTC_GPREG] = WALLCLOCK_RTC_MAGIC;
+
+    now = wallclock_ms();
+    LOG( "wallclock,sync,%u,%u", (uint32_t) ( now / 1000 ), (uint32_t) ( now % 1000 ) );
+    wheel_timer_start( &wallclock_timer, WALLCLOCK_SYNC_PERIOD );
+}
+
+/* Called from the timer task */
+static void prvWallclockTimer( void * arg )
+{
+    ipmi_msg req;
+
+    (void) arg;
+
+    req.dest_addr = MCH_ADDRESS;
+    req.netfn = NETFN_STORAGE;
+    req.cmd = IPMI_GET_SEL_TIME_CMD;
+    req.data_len = 0;
+    if ( ipmb_send_request_async( &req, prvWallclockSynced, NULL ) != ipmb_error_success ) {
+        /* TX queue full, the callback won't be called */
+        wheel_timer_start( &wallclock_timer, WALLCLOCK_SYNC_RETRY );
+    }
+}
+
+void wallclock_init( void )
+{
+    RTC_TIME_T time;
+
+    Chip_Clock_EnablePeriphClock( SYSCTL_CLOCK_RTC );
+    if ( ( LPC_RTC->GPREG[WALLCLOCK_RTC_GPREG] == WALLCLOCK_RTC_MAGIC ) && ( LPC_RTC->CCR & RTC_CCR_CLKEN ) ) {
+        /* Set by a sync before the reset, and still running */
+        Chip_RTC_GetFullTime( LPC_RTC, &time );
+        prvWallclockSet( (uint64_t) prvWallclockFromRTC( &time ) * 1000, xTaskGetTickCount() );
+        LOG( "wallclock,rtc,%u", wallclock_seconds() );
+    } else {
+        Chip_RTC_Init( LPC_RTC );
+        Chip_RTC_Enable( LPC_RTC, ENABLE );
+    }
+
+    wheel_timer_init( &wallclock_timer, prvWallclockTimer, NULL );
+    wheel_timer_start( &wallclock_timer, WALLCLOCK_SYNC_DELAY );
+}
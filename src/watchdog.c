@@ -0,0 +1,151 @@
+/*
+ *   AFCIPMI
+ *
+ *   Copyright (C) 2015  Henrique Silva  <henrique.silva@lnls.br>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*!
+ * @file watchdog.c
+ *
+ * @brief Task liveness monitor and watchdog feed
+ */
+
+/* FreeRTOS includes */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+/* Project includes */
+#include "chip.h"
+#include "i2c.h"
+#include "ipmb.h"
+#include "crash.h"
+#include "log.h"
+#include "periodic.h"
+#include "ram_sections.h"
+#include "task_stack.h"
+#include "watchdog.h"
+
+/*! @brief Registered task */
+typedef struct watchdog_task {
+    const char * name;
+    TickType_t deadline;
+    TickType_t seen;                        /*!< Tick of the check the last check in was collected by */
+    uint8_t late;                           /*!< Already logged as late (#configAPP_WATCHDOG cleared) */
+} watchdog_task;
+
+volatile uint32_t watchdog_alive;
+
+static watchdog_task watchdog_tasks[WATCHDOG_MAX_TASKS];
+static volatile uint8_t watchdog_num;
+static watchdog_id watchdog_timer_id;
+
+TASK_STACK( watchdog_stack, WATCHDOG_STACK_DEPTH, 1 );
+
+/* Runs in the timer service task, which has no loop of its own to check in from */
+static void prvWatchdogTimerCheckin( void * arg )
+{
+    (void) arg;
+    watchdog_checkin( watchdog_timer_id );
+}
+
+static periodic_job watchdog_job = PERIODIC_JOB( "Watchdog", prvWatchdogTimerCheckin, NULL, WATCHDOG_PERIOD, 0 );
+
+static void prvWatchdogLate( watchdog_task * task, TickType_t now )
+{
+#if configAPP_WATCHDOG
+    (void) now;
+    crash_watchdog( task->name );
+#else
+    if ( !task->late ) {
+        LOG( "watchdog,late,%s,%u", task->name, now - task->seen );
+        task->late = 1;
+    }
+#endif
+}
+
+static void prvWatchdogTask( void * pvParameters )
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    TickType_t now;
+    uint32_t alive;
+    uint8_t num;
+    uint8_t i;
+
+    (void) pvParameters;
+
+    for ( ;; ) {
+        vTaskDelayUntil( &last_wake, WATCHDOG_PERIOD );
+
+        /* In this order, every entry looked at was registered at or before now */
+        num = watchdog_num;
+        now = xTaskGetTickCount();
+        alive = __atomic_exchange_n( &watchdog_alive, 0, __ATOMIC_RELAXED );
+        for ( i = 0; i < num; i++ ) {
+            if ( alive & ( 1 << i ) ) {
+                watchdog_tasks[i].seen = now;
+                watchdog_tasks[i].late = 0;
+            } else if ( (TickType_t) ( now - watchdog_tasks[i].seen ) > watchdog_tasks[i].deadline ) {
+                prvWatchdogLate( &watchdog_tasks[i], now );
+            }
+        }
+
+#if configAPP_WATCHDOG
+        /* The feed sequence must not be split by another watchdog access */
+        taskENTER_CRITICAL();
+        Chip_WWDT_Feed( LPC_WWDT );
+        taskEXIT_CRITICAL();
+#endif
+    }
+}
+
+void watchdog_init( void )
+{
+#if configAPP_WATCHDOG
+    Chip_WWDT_Init( LPC_WWDT );
+    Chip_WWDT_SelClockSource( LPC_WWDT, WWDT_CLKSRC_IRC );
+    Chip_WWDT_SetTimeOut( LPC_WWDT, WATCHDOG_TIMEOUT );
+    Chip_WWDT_SetOption( LPC_WWDT, WWDT_WDMOD_WDRESET );
+    /* Can't be stopped from here on, only a reset does */
+    Chip_WWDT_Start( LPC_WWDT );
+#endif
+
+    watchdog_timer_id = watchdog_register( "Tmr Svc", WATCHDOG_DEADLINE );
+    periodic_start( &watchdog_job );
+    xTaskCreateWithStack( prvWatchdogTask, (const char*)"Watchdog", WATCHDOG_STACK_DEPTH, ( void * ) NULL, WATCHDOG_TASK_PRIORITY, ( TaskHandle_t * ) NULL, TASK_STACK_BUFFER( watchdog_stack, 0 ) );
+}
+
+watchdog_id watchdog_register( const char * name, TickType_t deadline )
+{
+    watchdog_id id = 0;
+    uint8_t i;
+
+    taskENTER_CRITICAL();
+    i = watchdog_num;
+    if ( i < WATCHDOG_MAX_TASKS ) {
+        watchdog_tasks[i].name = name;
+        watchdog_tasks[i].deadline = deadline;
+        watchdog_tasks[i].seen = xTaskGetTickCount();
+        /* Published last, the monitor only reads the entries below watchdog_num */
+        watchdog_num = i + 1;
+        id = 1 << i;
+    }
+    taskEXIT_CRITICAL();
+
+    configASSERT( id != 0 );
+    return id;
+}
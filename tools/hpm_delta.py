@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Delta HPM.1 upload of an MMC image over IPMB-L (see inc/hpm.h).
+
+Uploads the .upd file of the slot the MMC isn't running from (tools/image_header.py) through the Linux IPMB
+driver, as tools/mch_emu.py does: Initiate Upgrade Action, then the CRC-32 of every whole chunk of the file
+(custom HPM Delta Manifest command), so the MMC copies the chunks its running image already holds, then only
+the other chunks as Upload Firmware Blocks, and Finish Firmware Upload, which checks the whole image.
+With --activate the MMC then resets into it. A compressed upload file (.upz) is sent as it is, without the
+manifest: the MMC decompresses it as it comes.
+
+With --plan OLD instead of a device, nothing is sent: OLD is the .upd (or binary) of the running image, and the
+chunks the MMC would reuse are counted the way it does, to see what a release saves before rolling it out.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+import image_header
+from mch_emu import CC_OK, NETFN_CUSTOM, NETFN_GRPEXT, IpmbDev, Mch, blocking
+
+PICMG_ID = 0x00
+CMD_GET_CAPABILITIES = 0x2E
+CMD_INITIATE = 0x31
+CMD_UPLOAD = 0x32
+CMD_FINISH = 0x33
+CMD_GET_STATUS = 0x34
+CMD_ACTIVATE = 0x35
+CMD_DELTA_MANIFEST = 0x1E
+
+ACTION_UPLOAD = 0x02
+# HPM_Z_MAGIC of inc/hpm.h, first word of a .upz
+Z_MAGIC = 0x5A434641
+CC_IN_PROGRESS = 0x80
+CC_NODE_BUSY = 0xC0
+
+# Must match HPM_WRITE_CHUNK and HPM_DELTA_CRCS of inc/hpm.h
+CHUNK = 256
+CRCS_PER_REQUEST = 5
+# Image bytes per Upload Firmware Block, in the data of an IPMB request
+BLOCK = 20
+
+
+def slot_of(image, layout):
+    """Slot an image was linked for, from its reset vector"""
+    entry = struct.unpack_from("<I", image, 4)[0] & ~1
+    return 0 if entry < layout["IMAGE_SLOT_B_START"] else 1
+
+
+def relocate(chunk, old_base, new_base, slot_size):
+    """Chunk of the running image as the MMC compares it, see prvHPMRelocate"""
+    words = list(struct.unpack("<%dI" % (len(chunk) // 4), chunk))
+    for i, word in enumerate(words):
+        if old_base <= word < old_base + slot_size:
+            words[i] = word - old_base + new_base
+    return struct.pack("<%dI" % len(words), *words)
+
+
+def chunk_crcs(upd):
+    return [zlib.crc32(upd[i:i + CHUNK]) & 0xFFFFFFFF for i in range(0, len(upd) - CHUNK + 1, CHUNK)]
+
+
+def request(mch, netfn, cmd, data, retries=50):
+    """Response data of a request sent again while it's answered NODE_BUSY or lost"""
+    for _ in range(retries):
+        rsp = blocking(mch, "hpm", netfn, cmd, data)
+        if rsp and rsp[0] != CC_NODE_BUSY:
+            return rsp
+        time.sleep(0.01)
+    sys.exit("no answer to command 0x%02x" % cmd)
+
+
+def wait_status(mch, timeout):
+    """Completion code of the long command going on, once done"""
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        rsp = request(mch, NETFN_GRPEXT, CMD_GET_STATUS, [PICMG_ID])
+        if rsp[0] == CC_OK and len(rsp) >= 4 and rsp[3] != CC_IN_PROGRESS:
+            return rsp[3]
+        time.sleep(0.05)
+    sys.exit("upgrade command still in progress after %d s" % timeout)
+
+
+def plan(upd, old, layout):
+    new_slot, old_slot = slot_of(upd, layout), slot_of(old, layout)
+    if new_slot == old_slot:
+        sys.exit("both images are linked for slot %s, the upload goes to the slot not running" % "AB"[new_slot])
+    bases = (layout["IMAGE_SLOT_A_START"], layout["IMAGE_SLOT_B_START"])
+    old = old.ljust(layout["IMAGE_HEADER_OFFSET"], b"\xff")
+    crcs = chunk_crcs(upd)
+    reused = sum(1 for i, crc in enumerate(crcs)
+                 if zlib.crc32(relocate(old[i * CHUNK:(i + 1) * CHUNK], bases[old_slot], bases[new_slot],
+                                        layout["IMAGE_SLOT_SIZE"])) & 0xFFFFFFFF == crc)
+    return reused, len(crcs)
+
+
+def upload(mch, upd, activate):
+    rsp = request(mch, NETFN_GRPEXT, CMD_GET_CAPABILITIES, [PICMG_ID])
+    if rsp[0] != CC_OK or len(rsp) < 9 or rsp[8] == 0:
+        sys.exit("the MMC has no slot to upgrade (started without the boot loader?)")
+    components = rsp[8]
+    slot = components.bit_length() - 1
+
+    rsp = request(mch, NETFN_GRPEXT, CMD_INITIATE, [PICMG_ID, components, ACTION_UPLOAD])
+    if rsp[0] not in (CC_OK, CC_IN_PROGRESS) or wait_status(mch, 20) != CC_OK:
+        sys.exit("Initiate Upgrade Action failed")
+
+    compressed = struct.unpack_from("<I", upd)[0] == Z_MAGIC
+    crcs = [] if compressed else chunk_crcs(upd)
+    reused = set()
+    for first in range(0, len(crcs), CRCS_PER_REQUEST):
+        group = crcs[first:first + CRCS_PER_REQUEST]
+        rsp = request(mch, NETFN_CUSTOM, CMD_DELTA_MANIFEST,
+                      [first & 0xFF, first >> 8] + list(struct.pack("<%dI" % len(group), *group)))
+        if rsp[0] != CC_OK or len(rsp) < 2:
+            sys.exit("HPM Delta Manifest failed at chunk %d: completion code 0x%02x" % (first, rsp[0]))
+        reused |= {first + i for i in range(len(group)) if rsp[1] & (1 << i)}
+
+    data = b"".join(upd[i:i + CHUNK] for i in range(0, len(upd), CHUNK) if i // CHUNK not in reused)
+    for number, offset in enumerate(range(0, len(data), BLOCK)):
+        rsp = request(mch, NETFN_GRPEXT, CMD_UPLOAD, [PICMG_ID, number & 0xFF] + list(data[offset:offset + BLOCK]))
+        if rsp[0] != CC_OK:
+            sys.exit("Upload Firmware Block %d failed: completion code 0x%02x" % (number, rsp[0]))
+
+    rsp = request(mch, NETFN_GRPEXT, CMD_FINISH, [PICMG_ID, slot] + list(struct.pack("<I", len(upd))))
+    if rsp[0] not in (CC_OK, CC_IN_PROGRESS) or wait_status(mch, 20) != CC_OK:
+        sys.exit("Finish Firmware Upload failed, the uploaded image doesn't match its header")
+    if activate:
+        request(mch, NETFN_GRPEXT, CMD_ACTIVATE, [PICMG_ID])
+    return len(reused), len(crcs), len(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("upd", type=argparse.FileType("rb"), help="upload file of the slot not running (.upd)")
+    parser.add_argument("device", nargs="?", help="IPMB character device of the adapter, e.g. /dev/ipmb-0")
+    parser.add_argument("address", nargs="?", type=lambda v: int(v, 0), help="IPMB address of the MMC, e.g. 0x72")
+    parser.add_argument("--own", type=lambda v: int(v, 0), default=0x20, help="address of the host (default 0x20)")
+    parser.add_argument("--timeout", type=int, default=250, help="response timeout in ms (default 250)")
+    parser.add_argument("--activate", action="store_true", help="activate the image once uploaded")
+    parser.add_argument("--plan", type=argparse.FileType("rb"), metavar="OLD",
+                        help="only count the chunks reused from OLD, the running image")
+    parser.add_argument("--inc", default="inc", help="project include directory (default inc)")
+    args = parser.parse_args()
+
+    upd = args.upd.read()
+    if args.plan:
+        if struct.unpack_from("<I", upd)[0] == Z_MAGIC:
+            parser.error("--plan takes the .upd, a compressed upload isn't a delta")
+        values = image_header.defines(args.inc + "/image.h")
+        layout = {name: image_header.evaluate(values, name) for name in
+                  ("IMAGE_SLOT_B_START", "IMAGE_SLOT_A_START", "IMAGE_SLOT_SIZE", "IMAGE_HEADER_OFFSET")}
+        reused, chunks = plan(upd, args.plan.read(), layout)
+        uploaded = len(upd) - reused * CHUNK
+    else:
+        if args.device is None or args.address is None:
+            parser.error("the device and the MMC address are needed, or --plan")
+        start = time.monotonic()
+        reused, chunks, uploaded = upload(Mch(IpmbDev(args.device), args.address, args.own, args.timeout), upd,
+                                          args.activate)
+        print("uploaded in %.1f s" % (time.monotonic() - start))
+    print("chunks,%d,reused,%d,bytes,%d,uploaded,%d,percent,%.1f"
+          % (chunks, reused, len(upd), uploaded, 100.0 * uploaded / len(upd)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Slot image and HPM.1 upload file of an MMC image linked for a slot (see inc/image.h).
+
+Reads the binary of the image and writes two files:
+  <out>.img  the whole slot: the image padded with 0xFF up to the header row, then the header
+             (sequence 1) and an erased confirmation row, to be programmed at the slot address;
+  <out>.upd  the image followed by its header, the file uploaded over HPM.1;
+  <out>.upz  the same compressed: #HPM_Z_MAGIC, the length of the .upd (4 bytes, LS first), then the .upd as one
+             LZ4 block, which the MMC decompresses as it's uploaded (see inc/hpm.h).
+The layout and the magic numbers are read from inc/image.h, the firmware revision from --version (as given to
+the build, see the Makefile) or else from the defaults of inc/device_id.h.
+"""
+
+import argparse
+import re
+import struct
+import sys
+import zlib
+
+HEADER_FORMAT = "<IIIIHHI"
+
+# LZ4 block format: shortest match, the last match starts 12 bytes before the end and the last 5 bytes are literals
+LZ4_MIN_MATCH = 4
+LZ4_MATCH_END = 12
+LZ4_LITERALS_END = 5
+LZ4_MAX_OFFSET = 0xFFFF
+
+
+def defines(path):
+    """#define NAME value -> {NAME: value text}"""
+    values = {}
+    with open(path) as f:
+        for line in f:
+            m = re.match(r"#define\s+(\w+)\s+(.+?)\s*(/\*.*)?$", line)
+            if m:
+                values[m.group(1)] = m.group(2)
+    return values
+
+
+def evaluate(values, name):
+    """Value of a define made of numbers, other defines and arithmetic"""
+    text = values[name]
+    for _ in range(8):
+        text = re.sub(r"\b([A-Z_][A-Z0-9_]*)\b", lambda m: "(" + values[m.group(1)] + ")", text)
+    return int(eval(re.sub(r"(0x[0-9a-fA-F]+|\d+)[uUlL]+", r"\1", text), {}))
+
+
+def header(values, image, sequence, version):
+    fields = [evaluate(values, "IMAGE_MAGIC"), sequence, len(image), zlib.crc32(image) & 0xFFFFFFFF, version, 0]
+    packed = struct.pack(HEADER_FORMAT[:-1], *fields)
+    return packed + struct.pack("<I", zlib.crc32(packed) & 0xFFFFFFFF)
+
+
+def lz4_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def lz4_sequence(out, literals, offset=0, match=0):
+    lit, ml = len(literals), match - LZ4_MIN_MATCH
+    out.append((min(lit, 15) << 4) | (min(ml, 15) if match else 0))
+    if lit >= 15:
+        lz4_length(out, lit - 15)
+    out += literals
+    if match:
+        out += struct.pack("<H", offset)
+        if ml >= 15:
+            lz4_length(out, ml - 15)
+
+
+def lz4_compress(data):
+    """One LZ4 block, greedy matches on a hash of every position"""
+    out = bytearray()
+    table = {}
+    anchor = i = 0
+    end = len(data)
+    while i < end - LZ4_MATCH_END:
+        key = data[i:i + LZ4_MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > LZ4_MAX_OFFSET:
+            i += 1
+            continue
+        length = LZ4_MIN_MATCH
+        while i + length < end - LZ4_LITERALS_END and data[candidate + length] == data[i + length]:
+            length += 1
+        lz4_sequence(out, data[anchor:i], i - candidate, length)
+        for j in range(i + 1, i + length):
+            table[data[j:j + LZ4_MIN_MATCH]] = j
+        i += length
+        anchor = i
+    lz4_sequence(out, data[anchor:])
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("binary", type=argparse.FileType("rb"), help="image binary (objcopy -O binary)")
+    parser.add_argument("out", help="output name, without the .img/.upd extension")
+    parser.add_argument("--inc", default="inc", help="project include directory (default inc)")
+    parser.add_argument("--version", help="firmware revision, major.minor with 2 BCD digits of minor (e.g. 5.50)")
+    args = parser.parse_args()
+
+    values = defines(args.inc + "/image.h")
+    values.update(defines(args.inc + "/device_id.h"))
+    header_offset = evaluate(values, "IMAGE_HEADER_OFFSET")
+    row = evaluate(values, "IMAGE_ROW")
+    if args.version:
+        major, minor = args.version.split(".")
+        version = int(major) << 8 | int(minor, 16)
+    else:
+        version = evaluate(values, "DEVICE_FW_REV_MAJOR") << 8 | evaluate(values, "DEVICE_FW_REV_MINOR")
+
+    image = args.binary.read()
+    if len(image) > header_offset:
+        print("image is %d bytes, the slot holds %d" % (len(image), header_offset), file=sys.stderr)
+        return 1
+
+    with open(args.out + ".img", "wb") as f:
+        f.write(image + b"\xff" * (header_offset - len(image)))
+        slot_header = header(values, image, 1, version)
+        f.write(slot_header + b"\xff" * (2 * row - len(slot_header)))
+    upload = image + header(values, image, 0, version)
+    with open(args.out + ".upd", "wb") as f:
+        f.write(upload)
+    values.update(defines(args.inc + "/hpm.h"))
+    with open(args.out + ".upz", "wb") as f:
+        f.write(struct.pack("<II", evaluate(values, "HPM_Z_MAGIC"), len(upload)) + lz4_compress(upload))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
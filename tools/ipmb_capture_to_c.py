@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Turns an IPMB traffic capture into the replay table of the load simulator (sim/sim_capture.h).
+
+The capture has one frame per line: the time it was seen on the bus in milliseconds, then the
+frame bytes in hex, as they went on the bus (rsSA first, both checksums included), e.g.
+
+    12.5  72 18 76 20 04 01 db
+
+Lines starting with # are comments. Only the requests sent to the MMC are replayed, the frames
+with an odd netfn (responses) and those with a bad checksum are skipped with a warning.
+The simulator rewrites the destination address and the sequence number of each frame when it
+replays it, so the capture can come from any slot.
+"""
+
+import argparse
+import sys
+
+IPMI_MSG_MAX_LENGTH = 32
+
+
+def chksum(data):
+    return -sum(data) & 0xFF
+
+
+def parse(stream):
+    for number, line in enumerate(stream, 1):
+        line = line.split("#", 1)[0].split()
+        if not line:
+            continue
+        try:
+            when = float(line[0])
+            frame = [int(byte, 16) for byte in line[1:]]
+        except ValueError:
+            sys.exit("line %d: expected '<time_ms> <hex bytes>'" % number)
+        yield number, when, frame
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", type=argparse.FileType("r"), default=sys.stdin,
+                        help="capture file (default: stdin)")
+    parser.add_argument("-o", "--output", type=argparse.FileType("w"), default=sys.stdout,
+                        help="header to write (default: stdout)")
+    args = parser.parse_args()
+
+    entries = []
+    prev = None
+    for number, when, frame in parse(args.input):
+        if len(frame) < 7 or len(frame) > IPMI_MSG_MAX_LENGTH:
+            print("line %d: %d bytes isn't an IPMB request, skipped" % (number, len(frame)), file=sys.stderr)
+            continue
+        if chksum(frame[:2]) != frame[2] or chksum(frame[3:-1]) != frame[-1]:
+            print("line %d: bad checksum, skipped" % number, file=sys.stderr)
+            continue
+        if (frame[1] >> 2) & 0x01:
+            continue
+        # Rounded on the absolute times, so the rounding errors don't add up
+        delay = 0 if prev is None else max(0, int(round(when)) - prev)
+        prev = int(round(when))
+        entries.append((number, delay, frame))
+
+    if not entries:
+        sys.exit("no requests in the capture")
+
+    out = args.output
+    out.write("/* Generated by tools/ipmb_capture_to_c.py from %s, don't edit */\n\n"
+              % getattr(args.input, "name", "stdin"))
+    out.write("#define SIM_CAPTURE_LEN %d\n\n" % len(entries))
+    out.write("static const sim_capture_frame sim_capture[SIM_CAPTURE_LEN] = {\n")
+    for number, delay, frame in entries:
+        out.write("    { %5d, %2d, { %s } }, /* line %d */\n"
+                  % (delay, len(frame), ", ".join("0x%02X" % byte for byte in frame), number))
+    out.write("};\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Turns the MMC kernel trace (custom "Kernel Trace" IPMI command) into a timeline.
+
+Reads the data of successive Kernel Trace read responses, one response per line as hex bytes
+(e.g. the output of `ipmitool raw 0x32 0x0b 0x02 <index LSB> <index MSB>`), or fetches them
+itself with --ipmitool. With --stream the lines are the kernel trace blocks streamed to the debug UART
+instead (Kernel Trace operation 0x03, printed by `tools/log_decode.py --blocks 1`), records only, and the
+core clock comes from --mhz. The records are packed (inc/kernel_trace.h): event, id, cycles since the previous
+record as a varint, then the 2 byte arg if bit 7 of the event is set. Prints one line per event with the time since the first one, the task
+running at the time, and for each task made ready by an interrupt the latency from the
+interrupt entry to the task being switched in (IRQ -> wakeup).
+Task names can be given with --task NUMBER=NAME (see the custom "Get CPU Load" command).
+With --waterfall the span records are grouped by the correlation ID of the request they belong to instead,
+one block per request with the start and length of each of its steps (RX decode, dispatcher queue, handler,
+the I2C transfers of the handler, TX), relative to the start of the first one.
+"""
+
+import argparse
+import shlex
+import struct
+import subprocess
+import sys
+
+EVENTS = {
+    1: "task in",
+    2: "task out",
+    3: "task ready",
+    4: "queue send",
+    5: "queue send (ISR)",
+    6: "queue receive",
+    7: "queue receive (ISR)",
+    8: "block on receive",
+    9: "block on send",
+    10: "ISR enter",
+    11: "ISR exit",
+    12: "span start",
+    13: "span stop",
+}
+TASK_IN, TASK_OUT, TASK_READY = 1, 2, 3
+QUEUE_FIRST, QUEUE_LAST = 4, 9
+ISR_ENTER, ISR_EXIT = 10, 11
+SPAN_START, SPAN_STOP = 12, 13
+
+# kernel_trace_span of inc/kernel_trace.h, the I2C span is followed by one per bus
+SPANS = {0: "RX", 1: "queue", 2: "handler", 3: "TX", 4: "I2C0", 5: "I2C1", 6: "I2C2"}
+
+# ucQueueType values of FreeRTOS (queue.h)
+QUEUE_TYPES = {0: "queue", 1: "mutex", 2: "counting sem", 3: "binary sem", 4: "recursive mutex"}
+
+# LPC175x/6x interrupt numbers, the trace records the exception number (IRQ + 16)
+IRQ_NAMES = {10: "I2C0", 11: "I2C1", 12: "I2C2", 26: "DMA"}
+
+HEADER_LEN = 7
+HAS_ARG = 0x80
+
+
+def parse_response(line):
+    data = bytes(int(tok, 16) for tok in line.split())
+    if len(data) < HEADER_LEN:
+        raise ValueError("short response: %r" % line)
+    length, mhz, base = struct.unpack_from("<HBI", data)
+    return length, mhz, base, data[HEADER_LEN:]
+
+
+def fetch(ipmitool):
+    offset = 0
+    length = None
+    while length is None or offset < length:
+        cmd = shlex.split(ipmitool) + ["raw", "0x32", "0x0b", "0x02",
+                                       "0x%02x" % (offset & 0xFF), "0x%02x" % (offset >> 8)]
+        line = subprocess.check_output(cmd, universal_newlines=True)
+        length, mhz, base, chunk = parse_response(line)
+        if not chunk:
+            break
+        offset += len(chunk)
+        yield mhz, base, chunk
+
+
+def read_lines(stream):
+    for line in stream:
+        if line.strip():
+            _length, mhz, base, chunk = parse_response(line)
+            yield mhz, base, chunk
+
+
+def read_blocks(stream, mhz, base):
+    for line in stream:
+        yield mhz, base, bytes(int(tok, 16) for tok in line.split())
+
+
+def unpack(data):
+    """Packed records -> [(cycles since the base, event, id, arg)], a record cut short at the end is left out"""
+    records = []
+    elapsed = 0
+    pos = 0
+    while pos + 3 <= len(data):
+        header, ident = data[pos], data[pos + 1]
+        pos += 2
+        delta = shift = 0
+        while pos < len(data):
+            byte = data[pos]
+            pos += 1
+            delta |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        else:
+            break
+        arg = 0
+        if header & HAS_ARG:
+            if pos + 2 > len(data):
+                break
+            arg = data[pos] | (data[pos + 1] << 8)
+            pos += 2
+        elapsed += delta
+        records.append((elapsed, header & ~HAS_ARG, ident, arg))
+    return records
+
+
+def describe(event, ident, arg, names):
+    if event in (TASK_IN, TASK_OUT, TASK_READY):
+        return "%-20s %s" % (EVENTS[event], names.get(ident, "task %d" % ident))
+    if QUEUE_FIRST <= event <= QUEUE_LAST:
+        return "%-20s %s @ 0x....%04x" % (EVENTS[event], QUEUE_TYPES.get(ident, "type %d" % ident), arg)
+    if event in (ISR_ENTER, ISR_EXIT):
+        irq = ident - 16
+        return "%-20s %s" % (EVENTS[event], IRQ_NAMES.get(irq, "IRQ %d" % irq))
+    if event in (SPAN_START, SPAN_STOP):
+        return "%-20s %s #%d" % (EVENTS[event], SPANS.get(ident, "span %d" % ident), arg)
+    return "event %d id %d arg 0x%04x" % (event, ident, arg)
+
+
+def waterfall(records, mhz):
+    """Prints the spans of each request, a span still open at the end of the trace is left open ("...")"""
+    requests = {}
+    open_spans = {}
+    for elapsed, event, ident, arg in records:
+        if event == SPAN_START:
+            span = [elapsed, None, ident]
+            requests.setdefault(arg, []).append(span)
+            open_spans.setdefault((arg, ident), []).append(span)
+        elif event == SPAN_STOP and open_spans.get((arg, ident)):
+            open_spans[(arg, ident)].pop()[1] = elapsed
+
+    for corr in sorted(requests, key=lambda c: requests[c][0][0]):
+        spans = requests[corr]
+        first = spans[0][0]
+        ends = [stop for _start, stop, _ident in spans if stop is not None]
+        total = "%.1f us" % ((max(ends) - first) / float(mhz)) if ends else "..."
+        print("request #%d at %.1f us, %s" % (corr, first / float(mhz), total))
+        for start, stop, ident in spans:
+            length = "%10.1f us" % ((stop - start) / float(mhz)) if stop is not None else "%13s" % "..."
+            print("  %-8s +%10.1f us %s" % (SPANS.get(ident, "span %d" % ident), (start - first) / float(mhz), length))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", type=argparse.FileType("r"), default=sys.stdin,
+                        help="file with one response per line (default: stdin)")
+    parser.add_argument("--ipmitool", metavar="CMD",
+                        help="read the trace from the MMC with this ipmitool command line, "
+                             "e.g. \"ipmitool -I lan -H mch -t 0x7a -b 7\"")
+    parser.add_argument("--stream", action="store_true",
+                        help="the input is streamed kernel trace blocks, one per line as hex bytes")
+    parser.add_argument("--mhz", type=int, default=100,
+                        help="core clock with --stream (the ktrace,stream log record has it, default 100)")
+    parser.add_argument("--base", type=lambda v: int(v, 16), default=0,
+                        help="cycle count before the oldest record with --stream, hex (in the ktrace,stream record too)")
+    parser.add_argument("--task", action="append", default=[], metavar="NUMBER=NAME",
+                        help="name of a task number")
+    parser.add_argument("--waterfall", action="store_true",
+                        help="print the spans of each request instead of the timeline")
+    args = parser.parse_args()
+
+    names = {}
+    for item in args.task:
+        number, name = item.split("=", 1)
+        names[int(number, 0)] = name
+
+    if args.ipmitool:
+        source = fetch(args.ipmitool)
+    elif args.stream:
+        source = read_blocks(args.input, args.mhz, args.base)
+    else:
+        source = read_lines(args.input)
+
+    mhz = None
+    base = 0
+    data = bytearray()
+    for mhz, base, chunk in source:
+        data.extend(chunk)
+    records = unpack(bytes(data))
+    if not records:
+        print("empty trace")
+        return
+    mhz = mhz or 1
+
+    if args.waterfall:
+        waterfall(records, mhz)
+        return
+
+    # Times from the base, the first record's delta reaches back to it
+    running = None
+    last_isr_enter = None
+    woken = {}
+    print("# base cycle count 0x%08x" % base)
+    for elapsed, event, ident, arg in records:
+        usec = elapsed / float(mhz)
+
+        note = ""
+        if event == ISR_ENTER:
+            last_isr_enter = usec
+        elif event == TASK_READY and last_isr_enter is not None:
+            woken.setdefault(ident, last_isr_enter)
+        elif event == TASK_IN:
+            running = ident
+            if ident in woken:
+                note = "  (IRQ -> wakeup %.1f us)" % (usec - woken.pop(ident))
+        elif event == ISR_EXIT:
+            last_isr_enter = None
+
+        current = names.get(running, "task %d" % running) if running is not None else "?"
+        print("%12.1f us  %-16s %s%s" % (usec, current, describe(event, ident, arg, names), note))
+
+
+if __name__ == "__main__":
+    main()
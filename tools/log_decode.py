@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Prints the binary log records of the MMC (inc/log.h), as captured on its debug UART.
+
+The format strings aren't sent: each record has the offset of its string in the .log_fmt section of
+the image, which is read from the ELF file (.axf) the MMC runs, as are the strings printed with %s.
+Reads the capture from a file or stdin (e.g. `stty -F /dev/ttyUSB0 115200 raw; cat /dev/ttyUSB0 |
+tools/log_decode.py out/afcipm_a.axf`) and prints one line per record: the time since reset in
+microseconds, the sequence number and the formatted string. A gap in the sequence numbers (records
+dropped by a full ring, or bytes lost on the line) is reported before the next record.
+Blocks (bulk dumps, e.g. the kernel trace) get a line with their tag and length, the sensor telemetry
+snapshots one line per sensor. With --blocks TAG only the
+blocks with that tag are printed, one line of hex bytes each, for the decoder of their contents (e.g.
+`tools/log_decode.py --blocks 1 out/afcipm_a.axf capture | tools/kernel_trace_decode.py --stream`).
+With --wallclock, each record also gets its UTC time, from the last "wallclock,sync" record before it
+(inc/wallclock.h); records before the first one get a dash.
+"""
+
+import argparse
+import datetime
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+SYNC_BLOCK = 0x5A
+HEADER = struct.Struct("<BBBHI")
+BLOCK_MAX = 4095
+BLOCK_SENSORS = 0x02
+# sensor_snapshot (inc/sensor.h): sensor, status, value, tick, average, samples
+SENSOR_SNAPSHOT = struct.Struct("<BBHIhH")
+ARGS_MAX = 4
+CONVERSION = re.compile(r"%([-0 #+]*\d*)([duxXcs%])")
+SHF_ALLOC = 0x2
+# wallclock.c: seconds since 1970 and milliseconds at a sync, seconds from the RTC at boot
+WALLCLOCK_SYNC = ("wallclock,sync,", "wallclock,rtc,")
+
+
+def elf_sections(path):
+    """Name -> (address, data, allocated) of the sections of a 32 bit little endian ELF file"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        sys.exit("%s: not a 32 bit little endian ELF file" % path)
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+    headers = [struct.unpack_from("<IIIIII", data, shoff + i * shentsize) for i in range(shnum)]
+    strtab = headers[shstrndx][4]
+    sections = {}
+    for name_off, sh_type, flags, addr, offset, size in headers:
+        name = data[strtab + name_off:data.index(b"\0", strtab + name_off)].decode()
+        # SHT_NOBITS (.bss) has no contents in the file
+        contents = data[offset:offset + size] if sh_type != 8 else b""
+        sections[name] = (addr, contents, bool(flags & SHF_ALLOC))
+    return sections
+
+
+def c_string(blob, offset):
+    end = blob.find(b"\0", offset)
+    return blob[offset:end if end >= 0 else len(blob)].decode(errors="replace")
+
+
+class Image:
+    def __init__(self, path):
+        sections = elf_sections(path)
+        if ".log_fmt" not in sections:
+            sys.exit("%s: no .log_fmt section, not an image with the logger" % path)
+        self.formats = sections[".log_fmt"][1]
+        self.loaded = [(addr, blob) for addr, blob, alloc in sections.values() if alloc and blob]
+
+    def valid_id(self, fmt_id):
+        return fmt_id < len(self.formats) and (fmt_id == 0 or self.formats[fmt_id - 1] == 0)
+
+    def string_at(self, addr):
+        for base, blob in self.loaded:
+            if base <= addr < base + len(blob):
+                return c_string(blob, addr - base)
+        return "<0x%08x>" % addr
+
+    def format(self, fmt_id, args):
+        fmt = c_string(self.formats, fmt_id)
+        values = iter(args)
+
+        def convert(m):
+            flags, kind = m.groups()
+            if kind == "%":
+                return "%"
+            value = next(values, 0)
+            if kind == "d":
+                value = struct.unpack("<i", struct.pack("<I", value))[0]
+            elif kind == "s":
+                return ("%" + flags + "s") % self.string_at(value)
+            elif kind == "c":
+                value &= 0xFF
+            return ("%" + flags + kind) % value
+
+        return CONVERSION.sub(convert, fmt)
+
+
+def records(stream, image):
+    """(timestamp, sequence, format ID, args) of each record, skipping bytes until a valid header.
+    Blocks come as (timestamp, sequence, None, (tag, bytes))."""
+    buf = b""
+    while True:
+        chunk = stream.read(4096)
+        if not chunk:
+            return
+        buf += chunk
+        while len(buf) >= HEADER.size:
+            sync, nargs, seq, fmt_id, timestamp = HEADER.unpack_from(buf)
+            if sync == SYNC_BLOCK and 0 < fmt_id <= BLOCK_MAX:
+                # nargs is the tag, fmt_id the length
+                if len(buf) < HEADER.size + fmt_id:
+                    break
+                block = buf[HEADER.size:HEADER.size + fmt_id]
+                buf = buf[HEADER.size + fmt_id:]
+                yield timestamp, seq, None, (nargs, block)
+                continue
+            if sync != SYNC or nargs > ARGS_MAX or not image.valid_id(fmt_id):
+                buf = buf[1:]
+                continue
+            length = HEADER.size + 4 * nargs
+            if len(buf) < length:
+                break
+            args = struct.unpack_from("<%dI" % nargs, buf, HEADER.size)
+            buf = buf[length:]
+            yield timestamp, seq, fmt_id, args
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image", help="ELF file of the image the MMC runs (.axf)")
+    parser.add_argument("capture", nargs="?", type=argparse.FileType("rb"), default=sys.stdin.buffer,
+                        help="bytes received on the debug UART (default stdin)")
+    parser.add_argument("--blocks", type=int, metavar="TAG",
+                        help="only print the blocks with this tag, as hex (see LOG_BLOCK_* in inc/log.h)")
+    parser.add_argument("--wallclock", action="store_true",
+                        help="print the UTC time of each record, from the wall clock syncs in the log")
+    args = parser.parse_args()
+
+    image = Image(args.image)
+    expected = None
+    # Microseconds since 1970 at timestamp 0, and the timestamp wraps (32 bit microseconds)
+    offset = None
+    wraps = 0
+    last = 0
+    for timestamp, seq, fmt_id, values in records(args.capture, image):
+        if args.wallclock:
+            # A reset looks like a wrap too, until the next sync
+            if timestamp < last:
+                wraps += 1
+            last = timestamp
+            elapsed = timestamp + (wraps << 32)
+            if fmt_id is not None and image.format(fmt_id, values).startswith(WALLCLOCK_SYNC):
+                offset = values[0] * 1000000 + (values[1] * 1000 if len(values) > 1 else 0) - elapsed
+            when = "-" if offset is None else datetime.datetime.fromtimestamp(
+                (elapsed + offset) / 1e6, datetime.timezone.utc).strftime("%Y-%m-%dT%H:%M:%S.%f")
+            sys.stdout.write(when + " ")
+        if args.blocks is not None:
+            if fmt_id is None and values[0] == args.blocks:
+                print(" ".join("%02x" % b for b in values[1]), flush=True)
+            continue
+        if expected is not None and seq != expected:
+            print("%10s %3s -- %d records lost --" % ("", "", (seq - expected) & 0xFF))
+        expected = (seq + 1) & 0xFF
+        if fmt_id is None:
+            tag, block = values
+            if tag == BLOCK_SENSORS:
+                for off in range(0, len(block) - SENSOR_SNAPSHOT.size + 1, SENSOR_SNAPSHOT.size):
+                    print("%10d %3d sensor,%d,%d,%d,%d,%d,%d" % ((timestamp, seq) + SENSOR_SNAPSHOT.unpack_from(block, off)))
+                sys.stdout.flush()
+                continue
+            print("%10d %3d block,%d,%d" % (timestamp, seq, tag, len(block)), flush=True)
+            continue
+        print("%10d %3d %s" % (timestamp, seq, image.format(fmt_id, values)), flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,451 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""MCH emulator and soak benchmark of an MMC, from a host on its IPMB-L.
+
+Plays the MCH (IPMB master, address 0x20 by default) through the Linux IPMB driver (ipmb-dev-int,
+/dev/ipmb-N), on an I2C adapter that can also be a slave (USB-I2C adapters included): the frames to the
+MMC go out as master writes, its responses and events come back as slave writes to the MCH address.
+No vendor MCH is needed, and every run offers the same load.
+
+First the MMC is enumerated the way an MCH brings an AMC up (Get Device ID, PICMG properties, Set Event
+Receiver, the whole SDR repository and the FRU inventory), which also gives the sensors to poll. Then for
+--duration seconds it polls the sensors at --poll-rate readings per second (up to --window requests in
+flight), enumerates again every --enum-every seconds and, with --hotswap-every, deactivates and activates the
+payload (Set FRU Activation; this cycles the payload power). The MMC's own requests (hot swap and sensor
+events) are answered as an MCH does, and counted. With --selftest a self test of the MMC (see inc/selftest.h)
+runs alongside, e.g. --selftest 3 for the sensor sweep, whose late reads show what the load costs the polling.
+
+The metrics registry of the MMC (custom Get Metrics command, see inc/metrics.h) is read before and after the
+run. Prints CSV: a "soak" line per kind of traffic with the requests sent, answered, timed out and answered
+with an error, the throughput and the round trip percentiles in microseconds; a "metric" line per metric
+that changed, with its value before, after and the difference; then "check" lines holding the frame counts
+of the MMC against those of the emulator. Exits with an error if a check fails or the error rate is above
+--max-error-permille.
+"""
+
+import argparse
+import os
+import select
+import sys
+import time
+
+NETFN_SE = 0x04
+NETFN_APP = 0x06
+NETFN_STORAGE = 0x0A
+NETFN_GRPEXT = 0x2C
+NETFN_CUSTOM = 0x32
+
+CMD_GET_DEVICE_ID = 0x01
+CMD_PLATFORM_EVENT = 0x02
+CMD_SET_EVENT_RECEIVER = 0x00
+CMD_GET_DEVICE_SDR_INFO = 0x20
+CMD_GET_DEVICE_SDR = 0x21
+CMD_RESERVE_DEVICE_SDR = 0x22
+CMD_GET_SENSOR_READING = 0x2D
+CMD_GET_FRU_INFO = 0x10
+CMD_READ_FRU_DATA = 0x11
+CMD_PICMG_GET_PROPERTIES = 0x00
+CMD_PICMG_SET_FRU_ACTIVATION = 0x0C
+CMD_CUSTOM_GET_METRICS = 0x1A
+CMD_CUSTOM_SELF_TEST = 0x1B
+
+PICMG_ID = 0x00
+SDR_FULL_SENSOR = 0x01
+SDR_HEADER_LEN = 5
+SDR_RECORD_LAST = 0xFFFF
+# Bytes per chunk of the SDR and FRU reads, in the 24 data bytes of an IPMB response
+READ_CHUNK = 16
+
+METRICS_PAGE_VALUES = 0x00
+METRICS_PAGE_NAMES = 0x01
+METRICS_END = 0xFFFF
+METRIC_TYPE_HISTOGRAM = 0x03
+
+CC_OK = 0x00
+SEQ_MAX = 64
+
+
+def chksum(data):
+    return -sum(data) & 0xFF
+
+
+def encode(rs_sa, netfn, rs_lun, rq_sa, seq, rq_lun, cmd, data):
+    """IPMB frame, rsSA first, both checksums included"""
+    header = [rs_sa, (netfn << 2) | rs_lun]
+    body = [rq_sa, (seq << 2) | rq_lun, cmd] + list(data)
+    return bytes(header + [chksum(header)] + body + [chksum(header + [chksum(header)] + body)])
+
+
+def decode(frame):
+    """(netfn, rq_sa, seq, cmd, data) of a frame, None if it's malformed"""
+    if len(frame) < 7 or chksum(frame[:2]) != frame[2] or chksum(frame) != 0:
+        return None
+    return frame[1] >> 2, frame[3], frame[4] >> 2, frame[5], bytes(frame[6:-1])
+
+
+class IpmbDev:
+    """Linux ipmb-dev-int character device: one message per read or write, a length byte then the frame"""
+
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NONBLOCK)
+
+    def write(self, frame):
+        os.write(self.fd, bytes([len(frame)]) + frame)
+
+    def read(self, timeout):
+        if not select.select([self.fd], [], [], max(0.0, timeout))[0]:
+            return None
+        msg = os.read(self.fd, 64)
+        return msg[1:1 + msg[0]] if msg else None
+
+
+def varints(data):
+    value, shift = 0, 0
+    for byte in data:
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            yield value
+            value, shift = 0, 0
+
+
+class Stats:
+    def __init__(self):
+        self.sent = self.answered = self.timeouts = self.cc_errors = 0
+        self.rtt_us = []
+
+    def row(self, kind, seconds):
+        rtt = sorted(self.rtt_us)
+
+        def pct(p):
+            return rtt[min(len(rtt) - 1, len(rtt) * p // 100)] if rtt else 0
+
+        return ("soak", kind, self.sent, self.answered, self.timeouts, self.cc_errors,
+                "%.1f" % (self.answered / seconds if seconds else 0), pct(50), pct(90), pct(99), rtt[-1] if rtt else 0)
+
+
+class Mch:
+    """Requester of the emulator: sequence numbers, requests in flight and the MMC's own requests"""
+
+    def __init__(self, dev, mmc, own, timeout):
+        self.dev, self.mmc, self.own, self.timeout = dev, mmc, own, timeout
+        self.seq = 0
+        self.pending = {}               # (netfn, cmd, seq) -> (sent_ns, kind, session)
+        self.timers = []                # (monotonic time, session) of the sessions waiting
+        self.stats = {}
+        self.frames_sent = 0            # to the MMC: requests and the responses to its events
+        self.frames_received = 0        # from the MMC, the malformed ones included
+        self.events = 0
+
+    def kind(self, name):
+        return self.stats.setdefault(name, Stats())
+
+    def send(self, kind, netfn, cmd, data, session=None):
+        """Sends a request, the response goes to session.send(response) (None on timeout)"""
+        for _ in range(SEQ_MAX):
+            self.seq = (self.seq + 1) % SEQ_MAX
+            if (netfn + 1, cmd, self.seq) not in self.pending:
+                break
+        else:
+            return False
+        self.dev.write(encode(self.mmc, netfn, 0, self.own, self.seq, 0, cmd, data))
+        self.pending[(netfn + 1, cmd, self.seq)] = (time.monotonic_ns(), kind, session)
+        self.frames_sent += 1
+        self.kind(kind).sent += 1
+        return True
+
+    def in_flight(self, kind=None):
+        return sum(1 for _, k, _ in self.pending.values() if kind is None or k == kind)
+
+    def answer(self, netfn, rq_sa, seq, cmd, data):
+        """Answers a request of the MMC, completion code only, as an MCH does for the events"""
+        self.dev.write(encode(rq_sa, netfn + 1, 0, self.own, seq, 0, cmd, [CC_OK]))
+        self.frames_sent += 1
+        if netfn == NETFN_SE and cmd == CMD_PLATFORM_EVENT:
+            self.events += 1
+
+    def run(self, until):
+        """Handles the frames received and the timeouts until the monotonic time @p until"""
+        while True:
+            now = time.monotonic_ns()
+            for key, (sent, kind, session) in list(self.pending.items()):
+                if now - sent > self.timeout * 1000000:
+                    del self.pending[key]
+                    self.kind(kind).timeouts += 1
+                    self.resume(session, None)
+            for timer in [t for t in self.timers if t[0] <= now / 1e9]:
+                self.timers.remove(timer)
+                self.resume(timer[1], None)
+            left = until - now / 1e9
+            if left <= 0:
+                return
+            frame = self.dev.read(min(left, 0.005))
+            if frame is None:
+                continue
+            self.frames_received += 1
+            msg = decode(frame)
+            if msg is None:
+                continue
+            netfn, rq_sa, seq, cmd, data = msg
+            if not netfn & 1:
+                self.answer(netfn, rq_sa, seq, cmd, data)
+                continue
+            entry = self.pending.pop((netfn, cmd, seq), None)
+            if entry is None or not data:
+                continue
+            sent, kind, session = entry
+            stats = self.kind(kind)
+            stats.answered += 1
+            stats.rtt_us.append((time.monotonic_ns() - sent) // 1000)
+            if data[0] != CC_OK:
+                stats.cc_errors += 1
+            self.resume(session, data)
+
+    def resume(self, session, response):
+        if session is None:
+            return
+        try:
+            netfn, cmd, data = session.send(response)
+        except StopIteration:
+            return
+        if netfn is None:
+            self.timers.append((time.monotonic() + cmd, session))
+        else:
+            self.send(session.kind, netfn, cmd, data, session)
+
+
+class Session:
+    """Request sequence with one request in flight at a time, each step yields (netfn, cmd, data) and gets the
+    response data (completion code first), None on timeout. A step (None, seconds, None) is a pause."""
+
+    def __init__(self, mch, kind, steps):
+        self.kind, self.steps = kind, steps
+        self.done = False
+        mch.resume(self, None)
+
+    def send(self, response):
+        try:
+            return self.steps.send(response)
+        except StopIteration:
+            self.done = True
+            raise
+
+
+def enumerate_mmc(result, fru_bytes):
+    """MCH bring-up of an AMC, fills result["sensors"] with the numbers of the full sensor records"""
+    yield NETFN_APP, CMD_GET_DEVICE_ID, []
+    yield NETFN_GRPEXT, CMD_PICMG_GET_PROPERTIES, [PICMG_ID]
+    yield NETFN_SE, CMD_SET_EVENT_RECEIVER, [result["own"], 0]
+    yield NETFN_SE, CMD_GET_DEVICE_SDR_INFO, []
+    rsp = yield NETFN_SE, CMD_RESERVE_DEVICE_SDR, []
+    if not rsp or rsp[0] != CC_OK or len(rsp) < 3:
+        return
+    reservation = list(rsp[1:3])
+    sensors = []
+    record = 0
+    while record != SDR_RECORD_LAST:
+        rsp = yield NETFN_SE, CMD_GET_DEVICE_SDR, reservation + [record & 0xFF, record >> 8, 0, SDR_HEADER_LEN]
+        if not rsp or rsp[0] != CC_OK or len(rsp) < 3 + SDR_HEADER_LEN:
+            return
+        following = rsp[1] | (rsp[2] << 8)
+        header = rsp[3:]
+        body = b""
+        length = SDR_HEADER_LEN + header[4]
+        offset = SDR_HEADER_LEN
+        while offset < length:
+            count = min(READ_CHUNK, length - offset)
+            rsp = yield NETFN_SE, CMD_GET_DEVICE_SDR, reservation + [record & 0xFF, record >> 8, offset, count]
+            if not rsp or rsp[0] != CC_OK:
+                return
+            body += rsp[3:]
+            offset += count
+        if header[3] == SDR_FULL_SENSOR and len(body) > 2:
+            sensors.append(body[2])
+        record = following
+    result["sensors"] = sensors
+
+    rsp = yield NETFN_STORAGE, CMD_GET_FRU_INFO, [0]
+    if not rsp or rsp[0] != CC_OK or len(rsp) < 3:
+        return
+    size = min(rsp[1] | (rsp[2] << 8), fru_bytes)
+    for offset in range(0, size, READ_CHUNK):
+        rsp = yield NETFN_STORAGE, CMD_READ_FRU_DATA, [0, offset & 0xFF, offset >> 8, min(READ_CHUNK, size - offset)]
+        if not rsp or rsp[0] != CC_OK:
+            return
+
+
+def scrape_metrics(mch, names=None):
+    """{name: value} of the registry (a histogram gives name[bucket]), with the names read unless given"""
+    if names is None:
+        names = []
+        element = 0
+        while element != METRICS_END:
+            rsp = blocking(mch, "metrics", NETFN_CUSTOM, CMD_CUSTOM_GET_METRICS, [METRICS_PAGE_NAMES, element & 0xFF, element >> 8])
+            if not rsp or rsp[0] != CC_OK or len(rsp) < 3:
+                sys.exit("Get Metrics (names) failed, is the MMC up?")
+            element = rsp[1] | (rsp[2] << 8)
+            tlvs = rsp[3:]
+            while len(tlvs) >= 3:
+                mtype, length, count = tlvs[0], tlvs[1], tlvs[2]
+                name = tlvs[3:2 + length].decode(errors="replace")
+                names += [name] if mtype != METRIC_TYPE_HISTOGRAM else ["%s[%d]" % (name, i) for i in range(count)]
+                tlvs = tlvs[2 + length:]
+
+    values = []
+    element = 0
+    while element != METRICS_END:
+        rsp = blocking(mch, "metrics", NETFN_CUSTOM, CMD_CUSTOM_GET_METRICS, [METRICS_PAGE_VALUES, element & 0xFF, element >> 8])
+        if not rsp or rsp[0] != CC_OK or len(rsp) < 3:
+            sys.exit("Get Metrics (values) failed")
+        element = rsp[1] | (rsp[2] << 8)
+        tlvs = rsp[3:]
+        while len(tlvs) >= 2:
+            values += list(varints(tlvs[2:2 + tlvs[1]]))
+            tlvs = tlvs[2 + tlvs[1]:]
+    return names, dict(zip(names, values))
+
+
+def blocking(mch, kind, netfn, cmd, data):
+    """Sends one request and waits for its response"""
+    box = []
+
+    def steps():
+        box.append((yield netfn, cmd, data))
+
+    session = Session(mch, kind, steps())
+    deadline = time.monotonic() + 2 * mch.timeout / 1000.0
+    while not session.done and time.monotonic() < deadline:
+        mch.run(time.monotonic() + 0.005)
+    return box[0] if box else None
+
+
+def hotswap(off_s):
+    """Deactivates the payload, then activates it again @p off_s later"""
+    yield NETFN_GRPEXT, CMD_PICMG_SET_FRU_ACTIVATION, [PICMG_ID, 0, 0]
+    yield None, off_s, None
+    yield NETFN_GRPEXT, CMD_PICMG_SET_FRU_ACTIVATION, [PICMG_ID, 0, 1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("device", help="IPMB character device of the adapter, e.g. /dev/ipmb-0")
+    parser.add_argument("address", type=lambda v: int(v, 0), help="IPMB address of the MMC, e.g. 0x72")
+    parser.add_argument("--own", type=lambda v: int(v, 0), default=0x20, help="address of the emulated MCH (default 0x20)")
+    parser.add_argument("--duration", type=float, default=60, help="seconds of soak (default 60)")
+    parser.add_argument("--poll-rate", type=float, default=50, help="sensor readings per second (default 50)")
+    parser.add_argument("--window", type=int, default=4, help="most polling requests in flight (default 4)")
+    parser.add_argument("--enum-every", type=float, default=10, help="seconds between enumerations, 0 for none (default 10)")
+    parser.add_argument("--hotswap-every", type=float, default=0,
+                        help="seconds between payload deactivations, 0 for none (default, it cycles the payload power)")
+    parser.add_argument("--hotswap-off", type=float, default=2, help="seconds the payload stays deactivated (default 2)")
+    parser.add_argument("--fru-bytes", type=int, default=256, help="FRU inventory bytes read by each enumeration (default 256)")
+    parser.add_argument("--timeout", type=int, default=250, help="response timeout in ms (default 250)")
+    parser.add_argument("--selftest", type=int, help="self test of the MMC to run alongside (see inc/selftest.h)")
+    parser.add_argument("--max-error-permille", type=int, help="highest timeouts and error completion codes per 1000 requests")
+    args = parser.parse_args()
+
+    mch = Mch(IpmbDev(args.device), args.address, args.own, args.timeout)
+    out = sys.stdout
+
+    names, before = scrape_metrics(mch)
+    scrape_frames = mch.frames_sent
+
+    result = {"own": mch.own, "sensors": []}
+    session = Session(mch, "enumerate", enumerate_mmc(result, args.fru_bytes))
+    while not session.done:
+        mch.run(time.monotonic() + 0.005)
+    sensors = result["sensors"]
+    if not sensors:
+        print("no sensor found in the SDR repository, polling skipped", file=sys.stderr)
+
+    if args.selftest is not None:
+        seconds = int(args.duration) + 1
+        blocking(mch, "selftest", NETFN_CUSTOM, CMD_CUSTOM_SELF_TEST, [args.selftest, seconds & 0xFF, seconds >> 8])
+
+    start = time.monotonic()
+    end = start + args.duration
+    next_poll = next_enum = next_hotswap = start
+    next_enum += args.enum_every
+    next_hotswap += args.hotswap_every
+    poll_index = 0
+    enum = swap = None
+    while time.monotonic() < end:
+        now = time.monotonic()
+        if sensors and args.poll_rate > 0:
+            while next_poll <= now and mch.in_flight("poll") < args.window:
+                mch.send("poll", NETFN_SE, CMD_GET_SENSOR_READING, [sensors[poll_index % len(sensors)]])
+                poll_index += 1
+                next_poll += 1.0 / args.poll_rate
+            # The rate isn't made up after the window was full
+            next_poll = max(next_poll, now - 1.0 / args.poll_rate)
+        if args.enum_every > 0 and now >= next_enum and (enum is None or enum.done):
+            enum = Session(mch, "enumerate", enumerate_mmc(result, args.fru_bytes))
+            next_enum = now + args.enum_every
+        if args.hotswap_every > 0 and now >= next_hotswap and (swap is None or swap.done):
+            swap = Session(mch, "hotswap", hotswap(args.hotswap_off))
+            next_hotswap = now + args.hotswap_every
+        mch.run(min(time.monotonic() + 0.001, end))
+    # Answers still on their way
+    mch.run(time.monotonic() + args.timeout / 1000.0)
+    elapsed = time.monotonic() - start
+
+    soak_frames = mch.frames_sent - scrape_frames
+    received = mch.frames_received
+    _, after = scrape_metrics(mch, names)
+
+    out.write("soak,kind,sent,answered,timeouts,cc_errors,answered_per_s,p50_us,p90_us,p99_us,max_us\n")
+    total = Stats()
+    for kind in sorted(mch.stats):
+        stats = mch.stats[kind]
+        if kind != "metrics":
+            for field in ("sent", "answered", "timeouts", "cc_errors"):
+                setattr(total, field, getattr(total, field) + getattr(stats, field))
+            total.rtt_us += stats.rtt_us
+        out.write(",".join(str(v) for v in stats.row(kind, elapsed)) + "\n")
+    out.write(",".join(str(v) for v in total.row("total", elapsed)) + "\n")
+    out.write("soak,events,%d\n" % mch.events)
+
+    out.write("metric,name,before,after,delta\n")
+    for name in names:
+        if before.get(name) != after.get(name):
+            out.write("metric,%s,%s,%s,%d\n" % (name, before.get(name), after.get(name), after.get(name, 0) - before.get(name, 0)))
+
+    # The scrapes send frames too: the first one is counted before its values were read, the last one after
+    status = 0
+    out.write("check,name,emulator,mmc,slack,result\n")
+    checks = (
+        ("rx_frames", soak_frames, "ipmb.rx_frames", scrape_frames),
+        ("tx_frames", received, "ipmb.tx_frames", scrape_frames + 1),
+    )
+    for check, ours, metric, slack in checks:
+        if metric not in before or metric not in after:
+            continue
+        theirs = after[metric] - before[metric]
+        ok = abs(theirs - ours) <= slack
+        out.write("check,%s,%d,%d,%d,%s\n" % (check, ours, theirs, slack, "ok" if ok else "mismatch"))
+        status |= not ok
+    if args.max_error_permille is not None and total.sent:
+        permille = 1000 * (total.timeouts + total.cc_errors) // total.sent
+        ok = permille <= args.max_error_permille
+        out.write("check,error_permille,%d,,%d,%s\n" % (permille, args.max_error_permille, "ok" if ok else "over"))
+        status |= not ok
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,258 @@
+#!/usr/bin/env python3
+#
+#   AFCIPMI
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Per module size and stack usage of a firmware image, from its linker map file (make size-report).
+
+Sums the input sections of the map by module (object file) into text, rodata, data and bss, and takes
+the largest stack frame of each module from the .su files gcc writes next to the objects with
+-fstack-usage. An LTO build links code generated from all the modules at once, so the sections of the
+map come from LTO partitions instead of the objects: their names (-ffunction-sections and
+-fdata-sections) are looked up in the objects given on the command line to find the module again.
+Prints CSV: one "size" line per module, a "total" line, then a "region" line per memory region with the
+bytes used out of its length (.data counts in flash as well). With --baseline, the modules whose size
+changed from a previous report get a "delta" line.
+Exits with an error if a region overflows or goes past --budget percent of its length.
+"""
+
+import argparse
+import csv
+import os
+import re
+import struct
+import sys
+
+COLUMNS = ("text", "rodata", "data", "bss")
+
+# Output sections not loaded in the target memory
+NOT_ALLOCATED = (".debug", ".comment", ".ARM.attributes", ".stab", ".note", ".gnu.lto", ".log_fmt")
+
+# Suffixes gcc adds to the symbols of cloned or promoted functions and variables
+CLONE_SUFFIX = re.compile(r"\.(lto_priv|constprop|isra|part|cold)\.\d+.*$")
+LTO_OBJECT = re.compile(r"\.ltrans\d*\.ltrans\.o$|\.lto\.o$")
+
+
+def module_name(path):
+    """src/ipmb.o, lib/libfreertos.a(tasks.o) -> ipmb, tasks"""
+    member = re.search(r"\((.*)\)$", path)
+    if member:
+        path = member.group(1)
+    return os.path.splitext(os.path.basename(path))[0]
+
+
+def elf_section_names(path):
+    """Section names of a little endian ELF object (32 bit for the target, 64 bit also works on host builds)"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[5] != 1:
+        return []
+    if data[4] == 1:
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+        header = "<IIIII"
+    else:
+        shoff, = struct.unpack_from("<Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x3A)
+        header = "<IIQQQ"
+    headers = [struct.unpack_from(header, data, shoff + i * shentsize) for i in range(shnum)]
+    strtab_off = headers[shstrndx][4]
+    names = []
+    for name_off, *_ in headers:
+        end = data.index(b"\0", strtab_off + name_off)
+        names.append(data[strtab_off + name_off:end].decode())
+    return names
+
+
+def strip_clone(section):
+    return CLONE_SUFFIX.sub("", section)
+
+
+def section_owners(objects):
+    """Section name -> module, for the sections of LTO partitions"""
+    owners = {}
+    for obj in objects:
+        if not os.path.exists(obj):
+            continue
+        for name in elf_section_names(obj):
+            if re.match(r"\.(text|rodata|data|bss|ramfunc)\.", name):
+                owners.setdefault(strip_clone(name), module_name(obj))
+    return owners
+
+
+def category(output, section):
+    if output.startswith((".bss", ".noinit", ".uninit")) or section == "COMMON":
+        return "bss"
+    if output.startswith(".data"):
+        return "data"
+    if section.startswith((".rodata", ".constdata")):
+        return "rodata"
+    return "text"
+
+
+def parse_map(mapfile):
+    """Returns the memory regions [(name, origin, length)], the output sections [(name, addr, size, load)]
+    and the input sections [(output, name, size, object)]"""
+    regions, outputs, inputs = [], [], []
+    lines = mapfile.read().splitlines()
+    state = None
+    output = None
+    pending = None
+    for line in lines:
+        if line.startswith("Memory Configuration"):
+            state = "memory"
+            continue
+        if line.startswith("Linker script and memory map"):
+            state = "map"
+            continue
+        if state == "memory":
+            m = re.match(r"(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)", line)
+            if m and m.group(1) != "*default*":
+                regions.append((m.group(1), int(m.group(2), 16), int(m.group(3), 16)))
+            continue
+        if state != "map":
+            continue
+
+        m = re.match(r"(\.\S+|COMMON)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(\s+load address 0x([0-9a-fA-F]+))?", line)
+        if m and not line.startswith(" "):
+            output = m.group(1)
+            load = int(m.group(5), 16) if m.group(5) else None
+            outputs.append((output, int(m.group(2), 16), int(m.group(3), 16), load))
+            continue
+        if re.match(r"\.\S+$", line):
+            # Output section name too long, address and size on the next line
+            output = line.strip()
+            pending = ("output", output)
+            continue
+        if pending and pending[0] == "output":
+            m = re.match(r"\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)(\s+load address 0x([0-9a-fA-F]+))?", line)
+            pending = None
+            if m:
+                load = int(m.group(4), 16) if m.group(4) else None
+                outputs.append((output, int(m.group(1), 16), int(m.group(2), 16), load))
+                continue
+        if output is None or output.startswith(NOT_ALLOCATED):
+            continue
+
+        m = re.match(r" (\.\S+|COMMON)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        if m:
+            inputs.append((output, m.group(1), int(m.group(3), 16), m.group(4).strip()))
+            pending = None
+            continue
+        m = re.match(r" (\.\S+|COMMON)$", line)
+        if m:
+            pending = ("input", m.group(1))
+            continue
+        if pending and pending[0] == "input":
+            m = re.match(r"\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+            if m:
+                inputs.append((output, pending[1], int(m.group(2), 16), m.group(3).strip()))
+            pending = None
+    return regions, outputs, inputs
+
+
+def stack_usage(objects):
+    """Module -> (largest frame, function), from the .su files next to the objects"""
+    stacks = {}
+    for obj in objects:
+        su = os.path.splitext(obj)[0] + ".su"
+        if not os.path.exists(su):
+            continue
+        with open(su) as f:
+            for line in f:
+                fields = line.rstrip("\n").split("\t")
+                if len(fields) < 2:
+                    continue
+                function = fields[0].rsplit(":", 1)[-1]
+                frame = int(fields[1])
+                module = module_name(obj)
+                if frame > stacks.get(module, (-1, ""))[0]:
+                    stacks[module] = (frame, function + ("" if fields[2:3] == ["static"] else " (" + fields[2] + ")"))
+    return stacks
+
+
+def region_of(regions, addr):
+    for name, origin, length in regions:
+        if origin <= addr < origin + length:
+            return name
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("map", type=argparse.FileType("r"), help="linker map file")
+    parser.add_argument("objects", nargs="*", help="objects linked into the image (for the LTO sections and the .su files)")
+    parser.add_argument("--baseline", type=argparse.FileType("r"), help="previous report to compare with")
+    parser.add_argument("--budget", type=int, default=100, help="highest use of each memory region, in percent (default 100)")
+    args = parser.parse_args()
+
+    regions, outputs, inputs = parse_map(args.map)
+    owners = section_owners(args.objects)
+    stacks = stack_usage(args.objects)
+
+    sizes = {}
+    for output, section, size, obj in inputs:
+        if size == 0:
+            continue
+        module = module_name(obj)
+        if LTO_OBJECT.search(obj):
+            module = owners.get(strip_clone(section), "(lto)")
+        sizes.setdefault(module, dict.fromkeys(COLUMNS, 0))[category(output, section)] += size
+
+    out = csv.writer(sys.stdout, lineterminator="\n")
+    out.writerow(("size", "module") + COLUMNS + ("stack_max", "stack_function"))
+    total = dict.fromkeys(COLUMNS, 0)
+    for module in sorted(sizes, key=lambda m: -sum(sizes[m].values())):
+        frame, function = stacks.get(module, ("", ""))
+        out.writerow(("size", module) + tuple(sizes[module][c] for c in COLUMNS) + (frame, function))
+        for c in COLUMNS:
+            total[c] += sizes[module][c]
+    out.writerow(("total", "") + tuple(total[c] for c in COLUMNS) + ("", ""))
+
+    used = {name: 0 for name, _, _ in regions}
+    for output, addr, size, load in outputs:
+        if size == 0 or output.startswith(NOT_ALLOCATED):
+            continue
+        for where in (addr, load):
+            region = region_of(regions, where) if where is not None else None
+            if region and not (where == load and region_of(regions, addr) == region):
+                used[region] += size
+
+    status = 0
+    out.writerow(("region", "name", "used", "length", "percent"))
+    for name, origin, length in regions:
+        percent = 100.0 * used[name] / length
+        out.writerow(("region", name, used[name], length, "%.1f" % percent))
+        if percent > args.budget:
+            print("%s: %d bytes used, over %d%% of %d" % (name, used[name], args.budget, length), file=sys.stderr)
+            status = 1
+
+    if args.baseline:
+        before = {}
+        for row in csv.reader(args.baseline):
+            if row and row[0] == "size" and row[1] != "module":
+                before[row[1]] = dict(zip(COLUMNS, (int(v) for v in row[2:6])))
+        empty = dict.fromkeys(COLUMNS, 0)
+        out.writerow(("delta", "module") + COLUMNS)
+        for module in sorted(set(before) | set(sizes)):
+            old, new = before.get(module, empty), sizes.get(module, empty)
+            if old != new:
+                out.writerow(("delta", module) + tuple(new[c] - old[c] for c in COLUMNS))
+
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())